@@ -0,0 +1,357 @@
+/**
+ * Benchmark suite
+ *
+ * This program measures the performance of REBOUND for a range of
+ * gravity routines, integrators and collision detection modules.
+ * Every configuration is run for several particle numbers and, if
+ * REBOUND is compiled with OpenMP, for several thread counts.
+ * The results are printed in CSV format, one line per run:
+ *
+ *   suite,gravity,integrator,collision,driver,N,threads,steps,seconds,
+ *   steps_per_s,ns_per_step,interactions_per_s,efficiency
+ *
+ * The overhead suite measures the fixed cost per step for three 
+ * bodies when the simulation is advanced with reb_step(), reb_steps()
+ * or reb_integrate() (with and without a heartbeat function). 
+ * interactions_per_s is based on r->counters.gravity_interactions.
+ * efficiency is the parallel efficiency relative to the run with
+ * one thread. Run `make benchmark` in the top level directory or
+ * use the following command line options:
+ *
+ *   -s suite   Only run one suite (gravity, integrator, collision or overhead)
+ *   -N list    Comma separated list of particle numbers (overrides defaults)
+ *   -t list    Comma separated list of thread counts (default: 1,2,4,... up to the number of processors)
+ *   -T time    Minimum wall time in seconds per run (default: 0.5)
+ *   -o file    Write the results to a file instead of the standard output
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include "rebound.h"
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
+
+#define BENCHMARK_LIST_MAX 32
+
+enum setup {
+    SETUP_CLUSTER,      // Self-gravitating star cluster in an open box
+    SETUP_PLANETS,      // Star with N-1 low mass planets
+    SETUP_RING,         // Periodic box with colliding particles and no gravity
+    SETUP_SMALL,        // Same as SETUP_PLANETS but with three bodies by default
+};
+
+enum driver {
+    DRIVER_STEPS,               // reb_steps()
+    DRIVER_STEP,                // reb_step() in a loop
+    DRIVER_INTEGRATE,           // reb_integrate()
+    DRIVER_INTEGRATE_HEARTBEAT, // reb_integrate() with a heartbeat function
+};
+
+static const char* const driver_names[] = {"steps", "step", "integrate", "integrate_heartbeat"};
+
+struct config {
+    const char* suite;
+    enum setup setup;
+    const char* gravity_name;
+    int gravity;                // REB_GRAVITY_*
+    const char* integrator_name;
+    int integrator;             // REB_INTEGRATOR_*
+    int whfast_kernel;          // REB_WHFAST_KERNEL_*
+    int whfast_coordinates;     // REB_WHFAST_COORDINATES_*
+    const char* collision_name;
+    int collision;              // REB_COLLISION_*
+    enum driver driver;         // Function used to advance the simulation
+};
+
+static const struct config configs[] = {
+    // Gravity routines
+    {"gravity",    SETUP_CLUSTER, "basic",       REB_GRAVITY_BASIC,       "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE},
+    {"gravity",    SETUP_CLUSTER, "compensated", REB_GRAVITY_COMPENSATED, "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE},
+    {"gravity",    SETUP_CLUSTER, "tree",        REB_GRAVITY_TREE,        "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE},
+    {"gravity",    SETUP_CLUSTER, "fmm",         REB_GRAVITY_FMM,         "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE},
+    {"gravity",    SETUP_PLANETS, "mercurius",   REB_GRAVITY_MERCURIUS,   "mercurius",          REB_INTEGRATOR_MERCURIUS,0, 0, "none", REB_COLLISION_NONE},
+    {"gravity",    SETUP_PLANETS, "jacobi",      REB_GRAVITY_JACOBI,      "whfast",             REB_INTEGRATOR_WHFAST,   0, 0, "none", REB_COLLISION_NONE},
+    // Integrators
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "ias15",              REB_INTEGRATOR_IAS15,    0, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "whfast",             REB_INTEGRATOR_WHFAST,   REB_WHFAST_KERNEL_DEFAULT, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "whfast_whds",        REB_INTEGRATOR_WHFAST,   REB_WHFAST_KERNEL_DEFAULT, REB_WHFAST_COORDINATES_WHDS, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "whfast_modifiedkick",REB_INTEGRATOR_WHFAST,   REB_WHFAST_KERNEL_MODIFIEDKICK, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "whfast_composition", REB_INTEGRATOR_WHFAST,   REB_WHFAST_KERNEL_COMPOSITION, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "whfast_lazy",        REB_INTEGRATOR_WHFAST,   REB_WHFAST_KERNEL_LAZY, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "saba",               REB_INTEGRATOR_SABA,     0, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "eos",                REB_INTEGRATOR_EOS,      0, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "mercurius",   REB_GRAVITY_MERCURIUS,   "mercurius",          REB_INTEGRATOR_MERCURIUS,0, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "bs",                 REB_INTEGRATOR_BS,       0, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "janus",              REB_INTEGRATOR_JANUS,    0, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "hermite",            REB_INTEGRATOR_HERMITE,  0, 0, "none", REB_COLLISION_NONE},
+    {"integrator", SETUP_PLANETS, "basic",       REB_GRAVITY_BASIC,       "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE},
+    // Collision detection
+    {"collision",  SETUP_RING,    "none",        REB_GRAVITY_NONE,        "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "direct",   REB_COLLISION_DIRECT},
+    {"collision",  SETUP_RING,    "none",        REB_GRAVITY_NONE,        "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "tree",     REB_COLLISION_TREE},
+    {"collision",  SETUP_RING,    "none",        REB_GRAVITY_NONE,        "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "line",     REB_COLLISION_LINE},
+    {"collision",  SETUP_RING,    "none",        REB_GRAVITY_NONE,        "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "linetree", REB_COLLISION_LINETREE},
+    {"collision",  SETUP_RING,    "none",        REB_GRAVITY_NONE,        "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "grid",     REB_COLLISION_GRID},
+    {"collision",  SETUP_RING,    "none",        REB_GRAVITY_NONE,        "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "sweep",    REB_COLLISION_SWEEP},
+    // Fixed cost per step
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE, DRIVER_STEP},
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE, DRIVER_STEPS},
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE, DRIVER_INTEGRATE},
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "leapfrog",           REB_INTEGRATOR_LEAPFROG, 0, 0, "none", REB_COLLISION_NONE, DRIVER_INTEGRATE_HEARTBEAT},
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "whfast",             REB_INTEGRATOR_WHFAST,   0, 0, "none", REB_COLLISION_NONE, DRIVER_STEP},
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "whfast",             REB_INTEGRATOR_WHFAST,   0, 0, "none", REB_COLLISION_NONE, DRIVER_STEPS},
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "whfast",             REB_INTEGRATOR_WHFAST,   0, 0, "none", REB_COLLISION_NONE, DRIVER_INTEGRATE},
+    {"overhead",   SETUP_SMALL,   "basic",       REB_GRAVITY_BASIC,       "whfast",             REB_INTEGRATOR_WHFAST,   0, 0, "none", REB_COLLISION_NONE, DRIVER_INTEGRATE_HEARTBEAT},
+};
+
+// Default particle numbers for each setup
+static const int N_cluster[] = {256, 1024, 4096};
+static const int N_planets[] = {4, 16, 64};
+static const int N_ring[] = {500, 2000};
+static const int N_small[] = {3};
+
+static double wall_time(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static struct reb_simulation* create_simulation(const struct config* c, int N){
+    struct reb_simulation* r = reb_create_simulation();
+    r->rand_seed = 1;
+    // Modes need to be set before particles are added so that they get inserted into the tree
+    r->gravity = c->gravity;
+    r->integrator = c->integrator;
+    r->collision = c->collision;
+    r->ri_whfast.kernel = c->whfast_kernel;
+    r->ri_whfast.coordinates = c->whfast_coordinates;
+    switch (c->setup){
+        case SETUP_CLUSTER:
+            reb_configure_box(r, 10., 1, 1, 1);
+            r->boundary = REB_BOUNDARY_OPEN;
+            r->opening_angle2 = 0.25;
+            r->softening = 0.01;
+            r->dt = 1e-4;
+            for (int i=0; i<N; i++){
+                struct reb_particle p = {0};
+                const double radius = pow(reb_random_uniform(r, 0., 1.), 1./3.);
+                const double phi = reb_random_uniform(r, 0., 2.*M_PI);
+                const double costheta = reb_random_uniform(r, -1., 1.);
+                const double sintheta = sqrt(1.-costheta*costheta);
+                p.x = radius*sintheta*cos(phi);
+                p.y = radius*sintheta*sin(phi);
+                p.z = radius*costheta;
+                p.vx = reb_random_normal(r, 0.3);
+                p.vy = reb_random_normal(r, 0.3);
+                p.vz = reb_random_normal(r, 0.3);
+                p.m = 1./N;
+                reb_add(r, p);
+            }
+            break;
+        case SETUP_PLANETS:
+        case SETUP_SMALL:
+            r->dt = 0.02*2.*M_PI;
+            reb_add_fmt(r, "m", 1.);
+            for (int i=1; i<N; i++){
+                const double a = 1.+0.1*i;
+                const double e = reb_random_uniform(r, 0., 0.05);
+                const double inc = reb_random_uniform(r, 0., 0.02);
+                const double f = reb_random_uniform(r, 0., 2.*M_PI);
+                reb_add_fmt(r, "m a e inc f", 1e-7, a, e, inc, f);
+            }
+            reb_move_to_com(r);
+            break;
+        case SETUP_RING:
+        {
+            const double boxsize = sqrt((double)N);
+            reb_configure_box(r, boxsize, 1, 1, 1);
+            r->boundary = REB_BOUNDARY_PERIODIC;
+            r->nghostx = 1;
+            r->nghosty = 1;
+            r->nghostz = 0;
+            r->collision_resolve = reb_collision_resolve_hardsphere;
+            r->dt = 0.01;
+            for (int i=0; i<N; i++){
+                struct reb_particle p = {0};
+                p.x = reb_random_uniform(r, -0.5*boxsize, 0.5*boxsize);
+                p.y = reb_random_uniform(r, -0.5*boxsize, 0.5*boxsize);
+                p.z = reb_random_normal(r, 0.1);
+                p.vx = reb_random_normal(r, 1.);
+                p.vy = reb_random_normal(r, 1.);
+                p.vz = reb_random_normal(r, 0.1);
+                p.r = 0.1;
+                p.m = 1.;
+                reb_add(r, p);
+            }
+            break;
+        }
+    }
+    if (c->integrator==REB_INTEGRATOR_MERCURIUS){
+        r->ri_mercurius.hillfac = 3.;
+    }
+    if (c->integrator==REB_INTEGRATOR_JANUS){
+        r->ri_janus.scale_pos = 1e-16;
+        r->ri_janus.scale_vel = 1e-16;
+    }
+    return r;
+}
+
+static void heartbeat(struct reb_simulation* const r){
+    // Does nothing. Only used to measure the cost of calling the heartbeat function.
+}
+
+// Advances the simulation by N_steps steps with the driver of the configuration.
+static void advance(const struct config* c, struct reb_simulation* const r, unsigned int N_steps){
+    switch (c->driver){
+        case DRIVER_STEPS:
+            reb_steps(r, N_steps);
+            break;
+        case DRIVER_STEP:
+            for (unsigned int i=0; i<N_steps; i++){
+                reb_step(r);
+            }
+            break;
+        case DRIVER_INTEGRATE:
+        case DRIVER_INTEGRATE_HEARTBEAT:
+            r->heartbeat = c->driver==DRIVER_INTEGRATE_HEARTBEAT ? heartbeat : NULL;
+            r->exact_finish_time = 0;
+            reb_integrate(r, r->t + (N_steps-0.5)*r->dt);
+            break;
+    }
+}
+
+// Runs the configuration until at least min_time seconds have passed. Returns the number of steps or 0 if the configuration is not supported.
+static unsigned long run(const struct config* c, int N, double min_time, double* seconds, double* interactions){
+    struct reb_simulation* r = create_simulation(c, N);
+    r->save_messages = 1;
+    reb_step(r); // Warm up, allocates memory
+    char message[1024];
+    int error = 0;
+    while (reb_get_next_message(r, message)){
+        if (message[0]=='e'){
+            error = 1;
+        }
+    }
+    if (error){
+        reb_free_simulation(r);
+        return 0;
+    }
+    reb_counters_reset(r);
+    const unsigned long steps_start = r->steps_done;
+    unsigned int batch = 1;
+    const double start = wall_time();
+    double elapsed = 0.;
+    while (elapsed<min_time){
+        advance(c, r, batch);
+        elapsed = wall_time()-start;
+        if (elapsed<0.1*min_time){
+            batch *= 2;
+        }
+    }
+    const unsigned long steps = r->steps_done - steps_start;
+    *seconds = elapsed;
+    *interactions = (double)r->counters.gravity_interactions;
+    reb_free_simulation(r);
+    return steps;
+}
+
+static int parse_list(char* s, int* list){
+    int n = 0;
+    for (char* tok = strtok(s, ","); tok && n<BENCHMARK_LIST_MAX; tok = strtok(NULL, ",")){
+        list[n++] = atoi(tok);
+    }
+    return n;
+}
+
+int main(int argc, char* argv[]) {
+    const char* suite = NULL;
+    int N_list[BENCHMARK_LIST_MAX];
+    int N_N = 0;
+    int threads_list[BENCHMARK_LIST_MAX];
+    int N_threads = 0;
+    double min_time = 0.5;
+    FILE* out = stdout;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:N:t:T:o:")) != -1){
+        switch (opt){
+            case 's':
+                suite = optarg;
+                break;
+            case 'N':
+                N_N = parse_list(optarg, N_list);
+                break;
+            case 't':
+                N_threads = parse_list(optarg, threads_list);
+                break;
+            case 'T':
+                min_time = atof(optarg);
+                break;
+            case 'o':
+                out = fopen(optarg, "w");
+                if (out==NULL){
+                    fprintf(stderr, "Cannot open file %s.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s suite] [-N list] [-t list] [-T time] [-o file]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (N_threads==0){
+#ifdef OPENMP
+        const int max_threads = omp_get_num_procs();
+        for (int t=1; t<=max_threads && N_threads<BENCHMARK_LIST_MAX; t*=2){
+            threads_list[N_threads++] = t;
+        }
+#else // OPENMP
+        threads_list[N_threads++] = 1;
+#endif // OPENMP
+    }
+
+    fprintf(out, "suite,gravity,integrator,collision,driver,N,threads,steps,seconds,steps_per_s,ns_per_step,interactions_per_s,efficiency\n");
+    for (size_t k=0; k<sizeof(configs)/sizeof(configs[0]); k++){
+        const struct config* c = &configs[k];
+        if (suite && strcmp(suite, c->suite)!=0) continue;
+        const int* Ns = N_list;
+        int N_Ns = N_N;
+        if (N_N==0){
+            switch (c->setup){
+                case SETUP_CLUSTER: Ns = N_cluster; N_Ns = sizeof(N_cluster)/sizeof(int); break;
+                case SETUP_PLANETS: Ns = N_planets; N_Ns = sizeof(N_planets)/sizeof(int); break;
+                case SETUP_RING:    Ns = N_ring;    N_Ns = sizeof(N_ring)/sizeof(int); break;
+                case SETUP_SMALL:   Ns = N_small;   N_Ns = sizeof(N_small)/sizeof(int); break;
+            }
+        }
+        for (int i=0; i<N_Ns; i++){
+            double steps_per_s_serial = 0.;
+            for (int t=0; t<N_threads; t++){
+#ifdef OPENMP
+                omp_set_num_threads(threads_list[t]);
+#else // OPENMP
+                if (threads_list[t]!=1) continue;
+#endif // OPENMP
+                double seconds, interactions;
+                const unsigned long steps = run(c, Ns[i], min_time, &seconds, &interactions);
+                if (steps==0){
+                    fprintf(stderr, "Skipping %s/%s/%s with N=%d and %d threads.\n", c->gravity_name, c->integrator_name, c->collision_name, Ns[i], threads_list[t]);
+                    continue;
+                }
+                const double steps_per_s = steps/seconds;
+                if (threads_list[t]==1){
+                    steps_per_s_serial = steps_per_s;
+                }
+                const double efficiency = steps_per_s_serial>0. ? steps_per_s/(steps_per_s_serial*threads_list[t]) : NAN;
+                fprintf(out, "%s,%s,%s,%s,%s,%d,%d,%lu,%.6f,%.6e,%.2f,%.6e,%.4f\n", c->suite, c->gravity_name, c->integrator_name, c->collision_name, driver_names[c->driver], Ns[i], threads_list[t], steps, seconds, steps_per_s, 1e9/steps_per_s, interactions/seconds, efficiency);
+                fflush(out);
+            }
+        }
+    }
+    if (out!=stdout){
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
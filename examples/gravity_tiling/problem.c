@@ -0,0 +1,60 @@
+/**
+ * Tiled direct summation benchmark
+ *
+ * This example measures the time REBOUND needs for one direct 
+ * summation force evaluation (REB_GRAVITY_BASIC) with and without
+ * tiling. With tiling, the loops over particle pairs are split into
+ * blocks of r->gravity_tile_size particles which fit into the cache.
+ * For small N all particles fit into the cache anyway and both 
+ * versions run at the same speed. Once the particle array is larger 
+ * than the L2 cache, the tiled version starts to pay off. 
+ * The block size can be passed as a command line argument. 
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include "rebound.h"
+
+double time_force_evaluation(int N, int tile_size){
+    struct reb_simulation* r = reb_create_simulation();
+    r->gravity = REB_GRAVITY_BASIC;
+    r->gravity_tile_size = tile_size;
+    r->softening = 0.01;
+    r->rand_seed = 1;
+    for (int i=0; i<N; i++){
+        struct reb_particle p = {0};
+        p.x = reb_random_uniform(r, -1., 1.);
+        p.y = reb_random_uniform(r, -1., 1.);
+        p.z = reb_random_uniform(r, -1., 1.);
+        p.m = 1./N;
+        reb_add(r, p);
+    }
+    // Repeat force evaluation so that each measurement takes roughly the same time.
+    int repeat = 1+(int)(1e8/((double)N*(double)N));
+    struct timeval tstart, tend;
+    reb_update_acceleration(r);
+    gettimeofday(&tstart, NULL);
+    for (int k=0; k<repeat; k++){
+        reb_update_acceleration(r);
+    }
+    gettimeofday(&tend, NULL);
+    reb_free_simulation(r);
+    double seconds = (tend.tv_sec-tstart.tv_sec) + 1e-6*(tend.tv_usec-tstart.tv_usec);
+    return seconds/repeat/(0.5*(double)N*(double)N)*1e9; // ns per pair
+}
+
+int main(int argc, char* argv[]) {
+    int tile_size = 256;
+    if (argc > 1){
+        tile_size = atoi(argv[1]);
+    }
+    printf("Block size: %d particles\n", tile_size);
+    printf("%8s  %16s  %16s  %8s\n", "N", "untiled [ns/pair]", "tiled [ns/pair]", "speedup");
+    for (int N=128; N<=65536; N*=2){
+        double t_untiled = time_force_evaluation(N, 0);
+        double t_tiled = time_force_evaluation(N, tile_size);
+        printf("%8d  %16.3f  %16.3f  %8.2f\n", N, t_untiled, t_tiled, t_untiled/t_tiled);
+    }
+    return EXIT_SUCCESS;
+}
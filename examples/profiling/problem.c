@@ -3,9 +3,9 @@
  *
  * This example demonstrates how to use the profiling tool that
  * comes with REBOUND to find out which parts of your code are 
- * slow. To turn on this option, simple set `PROFILING=1` in 
- * the Makefile.
- * Note that enabeling this option makes REBOUND not thread-safe.
+ * slow. Profiling is turned on at runtime with reb_profiling_enable().
+ * The timing data is stored in r->profiling and printed by 
+ * reb_output_timing().
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,6 +18,7 @@ void heartbeat(struct reb_simulation* const r);
 
 int main(int argc, char* argv[]) {
     struct reb_simulation* r = reb_create_simulation();
+    reb_profiling_enable(r);
     // Setup constants
     r->opening_angle2 = .5; // This determines the precission of the tree code gravity calculation.
     r->integrator = REB_INTEGRATOR_SEI;
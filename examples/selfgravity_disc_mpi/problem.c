@@ -77,7 +77,7 @@ int main(int argc, char* argv[]){
     // Hack to artificially increase particle array.
     // This cannot be done once OpenGL is activated. 
     r->allocatedN *=8;
-    r->particles = realloc(r->particles,sizeof(struct reb_particle)*r->allocatedN);
+    r->particles = reb_realloc(r->particles,sizeof(struct reb_particle)*r->allocatedN);
 #endif // OPENGL
     
     // Start the integration
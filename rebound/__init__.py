@@ -71,11 +71,13 @@ class ParticleNotFound(Exception):
     """Particle was not found in the simulation."""
     pass
 
-from .tools import hash, mod2pi, M_to_f, E_to_f, M_to_E
-from .simulation import Simulation, Orbit, Variation, reb_simulation_integrator_saba, reb_simulation_integrator_whfast, reb_simulation_integrator_sei, reb_simulation_integrator_mercurius, reb_simulation_integrator_ias15
+from .tools import hash, mod2pi, M_to_f, E_to_f, M_to_E, read_recording
+from .simulation import Simulation, SimulationState, PararealResult, TuneResult, Orbit, Variation, reb_simulation_integrator_saba, reb_simulation_integrator_whfast, reb_simulation_integrator_sei, reb_simulation_integrator_mercurius, reb_simulation_integrator_ias15
 from .particle import Particle
 from .plotting import OrbitPlot
-from .simulationarchive import SimulationArchive
+from .simulationarchive import SimulationArchive, SimulationArchiveStream
+from .ensemble import Ensemble, EnsembleResult
 from .interruptible_pool import InterruptiblePool
+from .shared_memory import SharedSimulation
 
-__all__ = ["__libpath__", "__version__", "__build__", "__githash__", "SimulationArchive", "Simulation", "Orbit", "OrbitPlot", "Particle", "SimulationError", "Encounter", "Collision", "Escape", "NoParticles", "ParticleNotFound", "InterruptiblePool","Variation", "reb_simulation_integrator_whfast", "reb_simulation_integrator_ias15", "reb_simulation_integrator_saba", "reb_simulation_integrator_sei","reb_simulation_integrator_mercurius", "clibrebound", "mod2pi", "M_to_f", "E_to_f", "M_to_E"]
+__all__ = ["__libpath__", "__version__", "__build__", "__githash__", "SimulationArchive", "SimulationArchiveStream", "Simulation", "SimulationState", "PararealResult", "TuneResult", "Orbit", "OrbitPlot", "Particle", "SimulationError", "Encounter", "Collision", "Escape", "NoParticles", "ParticleNotFound", "InterruptiblePool", "SharedSimulation", "Variation", "reb_simulation_integrator_whfast", "reb_simulation_integrator_ias15", "reb_simulation_integrator_saba", "reb_simulation_integrator_sei","reb_simulation_integrator_mercurius", "clibrebound", "mod2pi", "M_to_f", "E_to_f", "M_to_E", "read_recording"]
@@ -0,0 +1,412 @@
+from ctypes import Structure, c_double, POINTER, c_int, c_void_p, c_char_p, byref, pointer, CFUNCTYPE
+import os
+from .simulation import Simulation
+from .particle import Particle
+from . import clibrebound
+
+POINTER_REB_SIM = POINTER(Simulation)
+ENSEMBLE_SETUP = CFUNCTYPE(None, POINTER_REB_SIM, c_int, c_void_p)
+
+ENSEMBLE_PARAMETERS = {"m": 0, "r": 1, "x": 2, "y": 3, "z": 4, "vx": 5, "vy": 6, "vz": 7, "a": 8, "e": 9, "inc": 10, "Omega": 11, "omega": 12, "f": 13, "M": 14}
+
+class reb_ensemble_parameter(Structure):
+    _fields_ = [("particle", c_int),
+                ("type", c_int),
+                ("values", POINTER(c_double))]
+
+class EnsembleResult(Structure):
+    """
+    Result of one simulation integrated by Ensemble.run().
+
+    Attributes
+    ----------
+    status : int
+        Exit status of the simulation (see Ensemble.integrate()). 
+        The status is 6 if the run was interrupted or never started.
+    t : float
+        Time at the end of the integration.
+    megno : float
+        MEGNO at the end of the integration (NaN if MEGNO was not calculated).
+    lyapunov : float
+        Lyapunov exponent at the end of the integration (NaN if MEGNO was not calculated).
+    walltime : float
+        Walltime spent on the integration in seconds.
+    """
+    _fields_ = [("status", c_int),
+                ("t", c_double),
+                ("megno", c_double),
+                ("lyapunov", c_double),
+                ("walltime", c_double)]
+
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, status={3}, t={4}, megno={5}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.status, self.t, self.megno)
+
+class Ensemble(Structure):
+    """
+    Ensemble Class.
+
+    An ensemble integrates many independent simulations together.
+    This is useful when every simulation only has a few particles,
+    for example when calculating stability maps. WHFast simulations
+    which have the same number of particles, timestep and integrator
+    settings are advanced in lockstep. Their Kepler steps are then
+    solved for several simulations at a time. This makes use of the
+    SIMD units of the CPU which a single small simulation cannot do.
+    All other simulations are integrated one after the other.
+
+    Unlike Simulation.integrate(), Ensemble.integrate() does not raise
+    an exception when a simulation exits early, for example because a
+    particle escaped. The other simulations continue and the exit status
+    of each simulation is returned. Error messages are raised as
+    exceptions, just as for a single simulation.
+
+    Examples
+    --------
+
+    >>> sims = []
+    >>> for a in np.linspace(1.2,2.,100):
+    >>>     sim = rebound.Simulation()
+    >>>     sim.add(m=1.)
+    >>>     sim.add(m=1e-3, a=1.)
+    >>>     sim.add(m=1e-3, a=a)
+    >>>     sim.integrator = "whfast"
+    >>>     sim.dt = 0.05
+    >>>     sim.exit_max_distance = 10.
+    >>>     sims.append(sim)
+    >>> ensemble = rebound.Ensemble(sims)
+    >>> status = ensemble.integrate(1000.)
+
+    """
+    _fields_ = [("N", c_int),
+                ("_simulations", POINTER(POINTER_REB_SIM)),
+                ("_running", POINTER(POINTER_REB_SIM)),
+                ]
+
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, N={3}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.N)
+
+    def __init__(self, simulations):
+        """
+        Arguments
+        ---------
+        simulations : list of Simulation
+            The simulations in the ensemble. The ensemble keeps a reference to
+            each simulation. The simulations are modified in place.
+        """
+        self.simulations = list(simulations)
+        N = len(self.simulations)
+        sims = (POINTER_REB_SIM*N)(*[pointer(sim) for sim in self.simulations])
+        clibrebound.reb_init_ensemble(byref(self), sims, c_int(N))
+
+    def __del__(self):
+        if self._b_needsfree_ == 1:
+            clibrebound.reb_free_ensemble_pointers(byref(self))
+
+    def __len__(self):
+        return self.N
+
+    def __getitem__(self, key):
+        return self.simulations[key]
+
+    def __iter__(self):
+        return iter(self.simulations)
+
+    def step(self):
+        """
+        Advances every simulation in the ensemble by one timestep.
+        """
+        clibrebound.reb_ensemble_step(byref(self))
+        for sim in self.simulations:
+            sim.process_messages()
+
+    def integrate(self, tmax, exact_finish_time=1):
+        """
+        Integrates every simulation in the ensemble up to time tmax.
+
+        Arguments
+        ---------
+        tmax : float
+            The final time of the simulations.
+        exact_finish_time: int, optional
+            Same as in Simulation.integrate().
+
+        Returns
+        -------
+        A list with the exit status of each simulation. The status is 0 if the
+        simulation reached tmax, 3 if it stopped because of a close encounter
+        (see exit_min_distance), and 4 if a particle escaped (see exit_max_distance).
+        See REB_STATUS in rebound.h for the remaining values.
+        """
+        for sim in self.simulations:
+            sim.exact_finish_time = c_int(exact_finish_time)
+        clibrebound.reb_ensemble_integrate(byref(self), c_double(tmax))
+        for sim in self.simulations:
+            sim.process_messages()
+        return [sim._status for sim in self.simulations]
+
+    @staticmethod
+    def run(N, tmax, setup=None, template=None, threads=0, return_simulations=False):
+        """
+        Creates and integrates N simulations on a pool of threads.
+
+        This is an alternative to running parameter sweeps with 
+        InterruptiblePool. The simulations are integrated in C by 
+        threads of the same process, so there is no pickling and no 
+        process overhead. Threads which finish early pick up the 
+        remaining simulations. Pressing Ctrl-C stops all simulations 
+        and raises a KeyboardInterrupt.
+
+        The setup function is called with the simulation and its 
+        index. Because it is a Python function, only one thread can 
+        run it at a time. Keep it short and do all the work in C 
+        (i.e. in the integration).
+
+        Arguments
+        ---------
+        N : int
+            Number of simulations.
+        tmax : float
+            The final time of the simulations.
+        setup : callable, optional
+            Function called as setup(sim, i) before the i-th simulation is 
+            integrated. If a template is given, sim is a copy of the template.
+        template : Simulation, optional
+            Every simulation starts as a copy of this simulation. 
+            Function pointers are not copied and need to be set in setup.
+        threads : int, optional
+            Number of threads. By default, one thread per processor is used.
+        return_simulations : bool, optional
+            If True, the simulations are returned as well. Otherwise they 
+            are freed as soon as they have been integrated. Default is False.
+
+        Returns
+        -------
+        A list of EnsembleResult objects, or, if return_simulations is True,
+        a tuple of this list and the list of simulations.
+
+        Examples
+        --------
+
+        >>> def setup(sim, i):
+        >>>     sim.add(m=1.)
+        >>>     sim.add(m=1e-3, a=1.)
+        >>>     sim.add(m=1e-3, a=1.2+0.01*i)
+        >>>     sim.integrator = "whfast"
+        >>>     sim.dt = 0.05
+        >>>     sim.init_megno()
+        >>> results = rebound.Ensemble.run(100, 1000., setup=setup)
+        >>> megno = [r.megno for r in results]
+
+        """
+        results = (EnsembleResult*N)()
+        sims = None
+        c_sims = None
+        if return_simulations:
+            sims = [Simulation() for i in range(N)]
+            c_sims = (POINTER_REB_SIM*N)(*[pointer(sim) for sim in sims])
+        wrappers = {} # Keeps Python objects (e.g. function pointers) set in setup alive during the integration.
+        exceptions = []
+        sigint = c_int.in_dll(clibrebound, "reb_sigint")
+        def _setup(r, i, data):
+            try:
+                sim = sims[i] if sims is not None else r.contents
+                wrappers[i] = sim
+                setup(sim, i)
+            except BaseException as e:
+                exceptions.append(e)
+                sigint.value = 1 # Stop all other simulations
+        c_setup = ENSEMBLE_SETUP(_setup) if setup is not None else ENSEMBLE_SETUP()
+        clibrebound.reb_ensemble_run(byref(template) if template is not None else None, c_int(N), c_setup, None, c_double(tmax), c_int(threads), results, c_sims)
+        wrappers = None
+        if exceptions:
+            raise exceptions[0]
+        if sigint.value == 1:
+            raise KeyboardInterrupt
+        results = list(results)
+        if return_simulations:
+            for sim in sims:
+                sim.process_messages()
+            return results, sims
+        return results
+
+    @staticmethod
+    def sweep(N, tmax, template, parameters, threads=0, filename=None, return_particles=False):
+        """
+        Integrates N copies of a template simulation with different parameters.
+
+        Unlike Ensemble.run(), no Python code is called for the individual
+        simulations, so this scales to a very large number of simulations.
+        Each thread takes a chunk of simulations at a time and integrates 
+        them together as an ensemble. Simulations in the chunk which use 
+        WHFast are advanced in lockstep (see Ensemble). Only the simulations
+        of the chunks being integrated are kept in memory.
+
+        Arguments
+        ---------
+        N : int
+            Number of simulations.
+        tmax : float
+            The final time of the simulations.
+        template : Simulation
+            Every simulation starts as a copy of this simulation. 
+            Function pointers are not copied.
+        parameters : dict
+            The keys are tuples (index, name), where index is the index of a 
+            particle in the template and name is one of "m", "r", "x", "y", "z", 
+            "vx", "vy", "vz", "a", "e", "inc", "Omega", "omega", "f", or "M".
+            The values are sequences with one value for each simulation.
+            Masses, radii and coordinates are set first. Orbital elements are 
+            relative to the center of mass of all particles with a lower index.
+        threads : int, optional
+            Number of threads. By default, one thread per processor is used.
+        filename : str, optional
+            Format string containing the index of the simulation, e.g. 
+            "sweep_{}.bin" or "sweep_%d.bin". Every simulation is saved to its 
+            own SimulationArchive after it has been integrated. Simulations whose
+            SimulationArchive already exists are not integrated again.
+        return_particles : bool, optional
+            If True, the final particles of every simulation are returned as well.
+
+        Returns
+        -------
+        A list of EnsembleResult objects, or, if return_particles is True, a 
+        tuple of this list and a list with the particles of every simulation.
+
+        Examples
+        --------
+
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1e-3, a=1.)
+        >>> sim.add(m=1e-3, a=1.5)
+        >>> sim.integrator = "whfast"
+        >>> sim.dt = 0.05
+        >>> sim.init_megno()
+        >>> a = np.linspace(1.2, 2., 1000)
+        >>> results = rebound.Ensemble.sweep(len(a), 1000., sim, {(2, "a"): a})
+        >>> megno = [r.megno for r in results]
+
+        """
+        c_parameters = (reb_ensemble_parameter*len(parameters))()
+        values = [] # Keeps the arrays alive during the integration.
+        for k, ((index, name), v) in enumerate(parameters.items()):
+            if name not in ENSEMBLE_PARAMETERS:
+                raise ValueError("Unknown parameter: {}".format(name))
+            v = list(v)
+            if len(v) != N:
+                raise ValueError("Parameter {} needs {} values.".format(name, N))
+            values.append((c_double*N)(*v))
+            c_parameters[k] = reb_ensemble_parameter(index, ENSEMBLE_PARAMETERS[name], values[-1])
+        N_real = template.N - template.N_var
+        results = (EnsembleResult*N)()
+        particles = (Particle*(N*N_real))() if return_particles else None
+        if filename is not None and "%" not in filename:
+            filename = filename.replace("{}", "%d")
+        c_filename = c_char_p(filename.encode("ascii")) if filename is not None else None
+        clibrebound.reb_ensemble_sweep(byref(template), c_int(N), c_parameters, c_int(len(parameters)), c_double(tmax), c_int(threads), results, particles, c_filename)
+        template.process_messages()
+        if c_int.in_dll(clibrebound, "reb_sigint").value == 1:
+            raise KeyboardInterrupt
+        results = list(results)
+        if return_particles:
+            return results, [particles[i*N_real:(i+1)*N_real] for i in range(N)]
+        return results
+
+    @staticmethod
+    def run_mpi(N, tmax, setup=None, template=None, filename=None, comm=None):
+        """
+        Creates and integrates N simulations distributed over all MPI ranks.
+
+        This function needs to be called by all ranks. Rank 0 hands out 
+        the simulations one at a time, all other ranks integrate them.
+        Ranks which finish early pick up the remaining simulations. With
+        only one rank, all simulations are integrated by rank 0.
+
+        If filename is given, every simulation is saved to its own 
+        SimulationArchive after it has been integrated. Simulations 
+        whose SimulationArchive already exists are not integrated again,
+        so an interrupted parameter sweep can be resumed by running the 
+        same script again.
+
+        This requires mpi4py. The C library itself does not need to be 
+        compiled with MPI. In C, use reb_ensemble_run_mpi().
+
+        Arguments
+        ---------
+        N : int
+            Number of simulations.
+        tmax : float
+            The final time of the simulations.
+        setup : callable, optional
+            Same as in Ensemble.run().
+        template : Simulation, optional
+            Same as in Ensemble.run().
+        filename : str, optional
+            Format string containing the index of the simulation, e.g. 
+            "sweep_{}.bin" or "sweep_%d.bin". 
+        comm : MPI communicator, optional
+            By default, MPI.COMM_WORLD is used.
+
+        Returns
+        -------
+        A list of EnsembleResult objects on all ranks.
+
+        Examples
+        --------
+        Run with `mpirun -np 64 python sweep.py`:
+
+        >>> results = rebound.Ensemble.run_mpi(10000, 1000., setup=setup, filename="sweep_{}.bin")
+
+        """
+        if comm is None:
+            from mpi4py import MPI
+            comm = MPI.COMM_WORLD
+        TAG_RESULT, TAG_WORK = 1, 2
+        def name(i):
+            return filename % i if "%" in filename else filename.format(i)
+        def run_member(i):
+            if filename is not None and os.path.isfile(name(i)):
+                sim = Simulation(name(i))
+                result = EnsembleResult(status=sim._status, t=sim.t, megno=float("nan"), lyapunov=float("nan"), walltime=0.)
+                if sim._calculate_megno:
+                    result.megno = sim.calculate_megno()
+                    result.lyapunov = sim.calculate_lyapunov()
+                return result
+            _setup = (lambda sim, _: setup(sim, i)) if setup is not None else None
+            results, sims = Ensemble.run(1, tmax, setup=_setup, template=template, threads=1, return_simulations=True)
+            if filename is not None and results[0].status != 6:
+                sims[0].simulationarchive_snapshot(name(i))
+            return results[0]
+
+        results = [EnsembleResult(status=6, t=float("nan"), megno=float("nan"), lyapunov=float("nan"), walltime=0.) for i in range(N)]
+        rank, size = comm.Get_rank(), comm.Get_size()
+        if size == 1:
+            for i in range(N):
+                results[i] = run_member(i)
+        elif rank == 0:
+            # Hand out one simulation at a time.
+            from mpi4py import MPI
+            i_next = 0
+            workers = size-1
+            while workers > 0:
+                st = MPI.Status()
+                i, result = comm.recv(source=MPI.ANY_SOURCE, tag=TAG_RESULT, status=st)
+                if i >= 0:
+                    results[i] = EnsembleResult(*result)
+                if i_next < N:
+                    comm.send(i_next, dest=st.Get_source(), tag=TAG_WORK)
+                    i_next += 1
+                else:
+                    comm.send(-1, dest=st.Get_source(), tag=TAG_WORK)
+                    workers -= 1
+        else:
+            message = (-1, None)
+            while True:
+                comm.send(message, dest=0, tag=TAG_RESULT)
+                i = comm.recv(source=0, tag=TAG_WORK)
+                if i < 0:
+                    break
+                r = run_member(i)
+                message = (i, (r.status, r.t, r.megno, r.lyapunov, r.walltime))
+        results = comm.bcast([(r.status, r.t, r.megno, r.lyapunov, r.walltime) for r in results] if rank == 0 else None, root=0)
+        return [EnsembleResult(*r) for r in results]
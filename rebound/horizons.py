@@ -7,17 +7,21 @@ Pull data from HORIZONS and format it for use as a REBOUND particle.
 from __future__ import print_function
 
 import datetime
+import hashlib
+import os
 import re
+import time
 import warnings
 
 try:
     from urllib.parse import urlencode
     from urllib.request import urlopen
+    from urllib.error import HTTPError
 except ImportError:
     from urllib import urlencode
-    from urllib2 import urlopen
+    from urllib2 import urlopen, HTTPError
 
-__all__ = ["getParticle"]
+__all__ = ["getParticle", "getParticles"]
 
 # Default date for orbital elements is the current time when first particle added, if no date is passed.
 # Cached at the beginning to ensure that all particles are synchronized.
@@ -25,6 +29,14 @@ __all__ = ["getParticle"]
 
 INITDATE = None
 
+# Directory in which the responses of HORIZONS are stored. If a query with 
+# the same body, date and plane has been made before, the stored response is 
+# used and no connection to HORIZONS is needed. Set to None to disable.
+CACHE_DIR = os.environ.get("REBOUND_HORIZONS_CACHE")
+
+# Number of attempts if HORIZONS throttles requests or is temporarily unavailable.
+RETRIES = 5
+
 
 def quote(text):
     return "'{}'".format(text)
@@ -51,15 +63,57 @@ def api_request(particle, datestart, dateend, plane):
 
     }
     url = "https://ssd.jpl.nasa.gov/api/horizons.api?" + urlencode(get_params)
-    # don't use a context manager for python2 compatibility
-    f = urlopen(url)
-    body = f.read().decode()
-    f.close()
+    for attempt in range(RETRIES):
+        try:
+            # don't use a context manager for python2 compatibility
+            f = urlopen(url)
+            body = f.read().decode()
+            f.close()
+            return body
+        except HTTPError as e:
+            # Wait and try again if requests are throttled
+            if attempt == RETRIES-1 or e.code not in [429, 500, 502, 503, 504]:
+                raise
+            time.sleep(2**attempt)
+
+
+def cached_api_request(particle, datestart, dateend, plane, cache_dir=None):
+    """
+    Same as api_request but uses the response stored in cache_dir 
+    (default: CACHE_DIR) if the same query has been made before.
+    """
+    if cache_dir is None:
+        cache_dir = CACHE_DIR
+    if not cache_dir:
+        return api_request(particle, datestart, dateend, plane)
+    key = "\n".join([str(particle), str(datestart), str(dateend), str(plane)])
+    filename = os.path.join(cache_dir, hashlib.sha1(key.encode()).hexdigest()+".txt")
+    try:
+        with open(filename) as f:
+            return f.read()
+    except IOError:
+        pass
+    body = api_request(particle, datestart, dateend, plane)
+    if "$$SOE" in body or "Multiple major-bodies match string" in body or "Matching small-bodies" in body:
+        # Only store successful queries. Write to a temporary file first so 
+        # that other processes never read a partial file.
+        if not os.path.isdir(cache_dir):
+            try:
+                os.makedirs(cache_dir)
+            except OSError:
+                pass
+        tmpfilename = "%s.%d.%d.tmp"%(filename, os.getpid(), id(body))
+        with open(tmpfilename, "w") as f:
+            f.write(body)
+        try:
+            os.rename(tmpfilename, filename)
+        except OSError:
+            os.remove(tmpfilename)
     return body
 
 
 def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None, vz=None, primary=None, a=None,
-                anom=None, e=None, omega=None, inc=None, Omega=None, MEAN=None, date=None, plane="ecliptic", hash=0):
+                anom=None, e=None, omega=None, inc=None, Omega=None, MEAN=None, date=None, plane="ecliptic", hash=0, cache_dir=None):
     if plane not in ["ecliptic", "frame"]:
         raise AttributeError(
             "Reference plane needs to be either 'ecliptic' or 'frame'. See Horizons for a definition of these coordinate systems.")
@@ -98,7 +152,7 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
 
     print("Searching NASA Horizons for '{}'... ".format(particle))
     idn = None
-    body = api_request(particle, datestart, dateend, plane)
+    body = cached_api_request(particle, datestart, dateend, plane, cache_dir)
     made_choice = False
     if "Multiple major-bodies match string" in body:
         try:
@@ -110,7 +164,7 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
                 raise Exception("Error while trying to find object.")
 
         made_choice = True
-        body = api_request(idn, datestart, dateend, plane)
+        body = cached_api_request(idn, datestart, dateend, plane, cache_dir)
     elif "Matching small-bodies" in body:
         for line in body.split("\n"):
             try:
@@ -123,7 +177,7 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
         if not idn:
             raise Exception("Error while trying to find object.")
         made_choice = True
-        body = api_request(idn, datestart, dateend, plane)
+        body = cached_api_request(idn, datestart, dateend, plane, cache_dir)
 
     lines = body.split("$$SOE")[-1].split("\n")
     p = Particle()
@@ -163,6 +217,22 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
     return p
 
 
+def getParticles(particles, threads=8, **kwargs):
+    """
+    Queries HORIZONS for several bodies concurrently and returns a list of 
+    particles in the same order. All keyword arguments are passed on to 
+    getParticle. If no date is given, all particles use the same date.
+    """
+    global INITDATE
+    if INITDATE is None and kwargs.get("date") is None:
+        INITDATE = datetime.datetime.utcnow()
+    if threads<=1 or len(particles)<=1:
+        return [getParticle(particle, **kwargs) for particle in particles]
+    from concurrent.futures import ThreadPoolExecutor
+    with ThreadPoolExecutor(max_workers=threads) as executor:
+        return list(executor.map(lambda particle: getParticle(particle, **kwargs), particles))
+
+
 # There is currently no way to get mass data from HORIZONS.
 # The following data was provided by Jon Giorgini (10 May 2015)
 # Last updated: Sep 15 2021.
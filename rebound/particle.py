@@ -38,6 +38,8 @@ class Particle(Structure):
         Pointer to the cell the particle is currently in (if using tree code)
     hash          : c_uint32         
         Particle hash (permanent identifier for the particle)
+    group         : c_uint32
+        Interaction group (see Simulation.set_interaction_groups())
     ap          : c_void_p (C void pointer)
         Pointer to additional parameters one might want to add to particles
     _sim        : POINTER(rebound.Simulation)
@@ -52,7 +54,7 @@ class Particle(Structure):
         return '<{0}.{1} object at {2}, m={3} x={4} y={5} z={6} vx={7} vy={8} vz={9}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.m, self.x, self.y, self.z, self.vx, self.vy, self.vz)
    
 
-    def __init__(self, simulation=None, particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None, vz=None, primary=None, a=None, P=None, e=None, inc=None, Omega=None, omega=None, pomega=None, f=None, M=None, E=None, l=None, theta=None, T=None, r=None, date=None, variation=None, variation2=None, h=None, k=None, ix=None, iy=None, hash=0, jacobi_masses=False):
+    def __init__(self, simulation=None, particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None, vz=None, primary=None, a=None, P=None, e=None, inc=None, Omega=None, omega=None, pomega=None, f=None, M=None, E=None, l=None, theta=None, T=None, r=None, date=None, variation=None, variation2=None, h=None, k=None, ix=None, iy=None, hash=0, group=0, jacobi_masses=False):
         """
         Initializes a Particle structure. Rather than explicitly creating 
         a Particle structure, users may use the ``add()`` member function 
@@ -142,6 +144,8 @@ class Particle(Structure):
             Can be one of the following: m, a, e, inc, omega, Omega, f, k, h, lambda, ix, iy.
         hash        : c_uint32  
             Unsigned integer identifier for particle.  Can pass an integer directly, or a string that will be converted to a hash. User is responsible for assigning unique hashes.
+        group       : int
+            Interaction group of the particle (Default: 0). See Simulation.set_interaction_groups().
         jacobi_masses: bool
             Whether to use jacobi primary mass in orbit initialization. Particle mass will still be set to physical value (Default: False)
         Examples
@@ -176,6 +180,7 @@ class Particle(Structure):
             inc = random.vonmisesvariate(0.,0.) 
 
         self.hash = hash # set via the property, which checks for type
+        self.group = group
 
         if variation:
             if primary is None:
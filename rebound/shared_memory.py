@@ -0,0 +1,151 @@
+# -*- coding: utf-8 -*-
+
+"""
+Sending a simulation to a worker process of a multiprocessing pool
+normally requires the simulation to be serialized, copied through a pipe
+and deserialized for every task. A SharedSimulation instead writes the
+binary of a simulation once into a shared memory segment. Only the name
+of the segment is sent to the workers. They create their simulations
+directly from the shared memory.
+
+"""
+
+from ctypes import c_char, c_int, c_size_t, byref
+try:
+    from multiprocessing import shared_memory
+except ImportError:
+    shared_memory = None # Requires python 3.8 or later
+import warnings
+from .simulation import Simulation, BINARY_WARNINGS
+from . import clibrebound
+
+__all__ = ["SharedSimulation"]
+
+
+class SharedSimulation(object):
+    """
+    A simulation stored in a shared memory segment.
+
+    The process which creates the SharedSimulation owns the segment.
+    The segment is removed when the owner is closed or garbage collected.
+    A SharedSimulation can be pickled. Only the name and size of the
+    segment are pickled, so passing it to a worker is cheap, independent
+    of the number of particles. The unpickled copy attaches to the
+    same segment.
+
+    Every call to simulation() creates a new and independent simulation
+    from the shared binary. The shared binary itself is never modified.
+
+    Examples
+    --------
+
+    >>> def run(args):
+    >>>     shared, a = args
+    >>>     sim = shared.simulation()
+    >>>     sim.particles[1].a = a
+    >>>     sim.integrate(1000.)
+    >>>     return sim.particles[1].e
+    >>>
+    >>> shared = rebound.SharedSimulation(sim)
+    >>> pool = rebound.InterruptiblePool()
+    >>> results = pool.map(run, [(shared, a) for a in np.linspace(1.,2.,100)])
+    >>> shared.close()
+
+    """
+    def __init__(self, simulation, name=None):
+        """
+        Writes the binary of simulation into a new shared memory segment.
+
+        Arguments
+        ---------
+        simulation : rebound.Simulation
+            The simulation to be shared. It is not modified.
+        name : str, optional
+            Name of the shared memory segment. By default a unique name is chosen.
+        """
+        if shared_memory is None:
+            raise RuntimeError("SharedSimulation requires python 3.8 or later.")
+        clibrebound.reb_output_binary_size.restype = c_size_t
+        size = clibrebound.reb_output_binary_size(byref(simulation))
+        self._shm = shared_memory.SharedMemory(name=name, create=True, size=size)
+        self._owner = True
+        # The segment might be larger than requested (page size).
+        self.size = size
+        buf = (c_char*size).from_buffer(self._shm.buf)
+        clibrebound.reb_output_binary_to_buffer.restype = c_size_t
+        clibrebound.reb_output_binary_to_buffer(byref(simulation), buf, c_size_t(size))
+        del buf # Otherwise the segment cannot be closed
+        simulation.process_messages()
+
+    @classmethod
+    def _attach(cls, name, size):
+        shared = cls.__new__(cls)
+        shared._owner = False
+        shared._shm = shared_memory.SharedMemory(name=name)
+        shared.size = size
+        return shared
+
+    def __reduce__(self):
+        return (SharedSimulation._attach, (self.name, self.size))
+
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, name={3}, size={4}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.name, self.size)
+
+    @property
+    def name(self):
+        """
+        Name of the shared memory segment.
+        """
+        return self._shm.name
+
+    def simulation(self):
+        """
+        Creates a new simulation from the shared binary.
+
+        The particles and the integrator state are copied into the new
+        simulation, so it can be modified and integrated without affecting
+        the shared binary or any other simulation created from it. As for
+        simulations loaded from a file, function pointers need to be set again.
+
+        Returns
+        -------
+        A rebound.Simulation object.
+        """
+        if self._shm is None:
+            raise RuntimeError("Shared memory segment has been closed.")
+        buf = (c_char*self.size).from_buffer(self._shm.buf)
+        sim = Simulation()
+        w = c_int(0)
+        clibrebound.reb_create_simulation_from_buffer_with_messages(byref(sim), buf, c_size_t(self.size), byref(w))
+        del buf
+        for majorerror, value, message in BINARY_WARNINGS:
+            if w.value & value:
+                if majorerror:
+                    raise RuntimeError(message)
+                else:
+                    # Just a warning
+                    warnings.warn(message, RuntimeWarning)
+        return sim
+
+    def close(self):
+        """
+        Detaches from the shared memory segment. If called by the owner,
+        the segment is also removed. Workers which are still attached
+        can continue to use it until they close their copy.
+        """
+        if self._shm is None:
+            return
+        self._shm.close()
+        if self._owner:
+            self._shm.unlink()
+        self._shm = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        if getattr(self, "_shm", None) is not None:
+            self.close()
@@ -1,4 +1,4 @@
-from ctypes import Structure, c_double, POINTER, c_uint32, c_float, c_int, c_uint, c_uint32, c_int64, c_long, c_ulong, c_ulonglong, c_void_p, c_char_p, CFUNCTYPE, byref, create_string_buffer, addressof, pointer, cast
+from ctypes import Structure, c_double, POINTER, c_uint32, c_float, c_int, c_uint, c_uint32, c_int64, c_uint64, c_long, c_ulong, c_ulonglong, c_void_p, c_char_p, c_char, c_size_t, CFUNCTYPE, byref, create_string_buffer, addressof, pointer, cast
 from . import clibrebound, Escape, NoParticles, Encounter, Collision, SimulationError, ParticleNotFound, M_to_E
 from .citations import cite
 from .particle import Particle
@@ -21,10 +21,10 @@ import types
 ### The following enum and class definitions need to
 ### consitent with those in rebound.h
         
-INTEGRATORS = {"ias15": 0, "whfast": 1, "sei": 2, "leapfrog": 4, "none": 7, "janus": 8, "mercurius": 9, "saba": 10, "eos": 11, "bs": 12}
+INTEGRATORS = {"ias15": 0, "whfast": 1, "sei": 2, "leapfrog": 4, "none": 7, "janus": 8, "mercurius": 9, "saba": 10, "eos": 11, "bs": 12, "hermite": 13}
 BOUNDARIES = {"none": 0, "open": 1, "periodic": 2, "shear": 3}
-GRAVITIES = {"none": 0, "basic": 1, "compensated": 2, "tree": 3, "mercurius": 4, "jacobi": 5}
-COLLISIONS = {"none": 0, "direct": 1, "tree": 2, "mercurius": 3, "line": 4, "linetree": 5}
+GRAVITIES = {"none": 0, "basic": 1, "compensated": 2, "tree": 3, "mercurius": 4, "jacobi": 5, "fmm": 6, "fft": 7}
+COLLISIONS = {"none": 0, "direct": 1, "tree": 2, "mercurius": 3, "line": 4, "linetree": 5, "grid": 6, "sweep": 7, "verlet": 8, "lineverlet": 9}
 VISUALIZATIONS = {"none": 0, "opengl": 1, "webgl": 2}
 WHFAST_KERNELS = {"default": 0, "modifiedkick": 1, "composition": 2, "lazy": 3}
 WHFAST_COORDINATES = {"jacobi": 0, "democraticheliocentric": 1, "whds": 2}
@@ -46,6 +46,12 @@ EOS_TYPES = {
         "pmlf4": 0x07,
         "pmlf6": 0x08,
         }
+ASCII_FORMATS = {"cartesian": 0, "orbits": 1}
+RECORDER_QUANTITIES = {"energy": 1, "angular_momentum": 2, "megno": 4, "orbits": 8, "min_distance": 16, "reductions": 32}
+REDUCTION_TYPES = {"sum": 0, "moments": 1, "histogram": 2, "profile": 3}
+REDUCTION_FIELDS = {"one": 0, "x": 1, "y": 2, "z": 3, "vx": 4, "vy": 5, "vz": 6, "m": 7, "r": 8, "rxy": 9, "vy_shear": 10, "vx_vy_shear": 11, "area": 12, "midplane_area": 13}
+TUNE_PARAMETERS = {"dt": 0, "epsilon": 1, "hillfac": 2, "opening_angle2": 3}
+DERIVATIVES_PARAMETERS = {"m": 0, "a": 1, "e": 2, "inc": 3, "omega": 4, "Omega": 5, "f": 6, "k": 7, "h": 8, "lambda": 9, "ix": 10, "iy": 11, "i": 3, "l": 9}
 
 # Format: Majorerror, id, message
 BINARY_WARNINGS = [
@@ -59,6 +65,7 @@ BINARY_WARNINGS = [
     (False, 128, "Encountered unkown field in file. File might have been saved with a different version of REBOUND."),
     (True,  256, "Integrator type is not supported by this simulation archive version."),
     (False,  512, "The binary file seems to be corrupted. An attempt has been made to read the uncorrupted parts of it."),
+    (False, 1024, "The snapshot only contains the physical state of the particles. Integrating it further is not bit-exact."),
 ]
 
 class reb_hash_pointer_pair(Structure):
@@ -79,6 +86,21 @@ class reb_dp7(Structure):
                 ("p5", POINTER(c_double)),
                 ("p6", POINTER(c_double))]
 
+class reb_particles_soa(Structure):
+    _fields_ = [("x", POINTER(c_double)),
+                ("y", POINTER(c_double)),
+                ("z", POINTER(c_double)),
+                ("vx", POINTER(c_double)),
+                ("vy", POINTER(c_double)),
+                ("vz", POINTER(c_double)),
+                ("m", POINTER(c_double)),
+                ("ax", POINTER(c_double)),
+                ("ay", POINTER(c_double)),
+                ("az", POINTER(c_double)),
+                ("N", c_int),
+                ("allocatedN", c_int),
+                ("device_N", c_int)]
+
 class reb_ghostbox(Structure):
     _fields_ = [("shiftx", c_double),
                 ("shifty", c_double),
@@ -146,6 +168,9 @@ class reb_simulation_integrator_ias15(Structure):
     :ivar float epsilon_global:          
         Determines how the adaptive timestep is chosen. 
     
+    :ivar int reuse_gravity:          
+        If 1 (default), gravity is reused in the predictor corrector loop when the predicted positions did not change.
+    
     """
     def __repr__(self):
         return '<{0}.{1} object at {2}, epsilon={3}, min_dt={4}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.epsilon, self.min_dt)
@@ -153,6 +178,7 @@ class reb_simulation_integrator_ias15(Structure):
     _fields_ = [("epsilon", c_double),
                 ("min_dt", c_double),
                 ("epsilon_global", c_uint),
+                ("reuse_gravity", c_uint),
                 ("_iterations_max_exceeded", c_ulong),
                 ("_allocatedN", c_int),
                 ("_at", POINTER(c_double)),
@@ -170,6 +196,15 @@ class reb_simulation_integrator_ias15(Structure):
                 ("_er", reb_dp7),
                 ("_map", POINTER(c_int)),
                 ("_map_allocated_n", c_int),
+                ("_gravity_cache_allocatedN", c_int),
+                ("_gravity_cache_x", POINTER(c_double)),
+                ("_gravity_cache_a", POINTER(c_double)),
+                ("_dense_N", c_int),
+                ("_dense_t0", c_double),
+                ("_dense_dt", c_double),
+                ("_dense_allocatedN", c_int),
+                ("_dense_x0", POINTER(c_double)),
+                ("_dense_v0", POINTER(c_double)),
                 ]
 
 class reb_simulation_integrator_saba(Structure):
@@ -276,6 +311,13 @@ class reb_simulation_integrator_whfast(Structure):
         If you set safe_mode to 0, the speed and accuracy of WHFast improve.
         However, make sure you are aware of the consequences. Read the iPython tutorial
         on advanced WHFast usage to learn more.
+    :ivar int kepler_warm_start:
+        If set to 1 (default 0), the Kepler solver remembers by how much its 
+        initial guess was off in the last step of each particle and uses this
+        to improve the next guess. This reduces the number of iterations. The 
+        results differ from those without warm start at the level of round-off 
+        errors. The warm start state is stored in binary files and the 
+        SimulationArchive, so restarts are bit-wise reproducible.
     """
     _fields_ = [("corrector", c_uint),
                 ("corrector2", c_uint),
@@ -284,13 +326,21 @@ class reb_simulation_integrator_whfast(Structure):
                 ("recalculate_coordinates_this_timestep", c_uint),
                 ("safe_mode", c_uint),
                 ("keep_unsynchronized", c_uint),
+                ("kepler_warm_start", c_uint),
                 ("_p_jh", POINTER(Particle)),
                 ("_p_temp", POINTER(Particle)),
+                ("_kepler_X_correction", POINTER(c_double)),
+                ("_allocated_N_kepler", c_uint),
                 ("is_synchronized", c_uint),
                 ("_allocatedN", c_uint),
                 ("_allocatedNtmp", c_uint),
                 ("_timestep_warning", c_uint),
-                ("_recalculate_coordinates_but_not_synchronized_warning", c_uint)]
+                ("_recalculate_coordinates_but_not_synchronized_warning", c_uint),
+                ("_p_backup", POINTER(Particle)),
+                ("_allocatedNbackup", c_uint),
+                ("_N_backup", c_int),
+                ("_N_active_backup", c_int),
+                ("_output_is_synchronized", c_uint)]
 
     def __repr__(self):
         return '<{0}.{1} object at {2}, safe_mode={3}, keep_unsynchonized={4}, is_synchronized={5}, corrector={6}, corrector2={7}, kernel={8}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.safe_mode, self.keep_unsynchronized, self.is_synchronized, self.corrector, self.corrector2, self.kernel)
@@ -527,22 +577,18 @@ class Simulation(Structure):
         """
         Returns a deep copy of a REBOUND simulation. You need to reset 
         any function pointers on the copy. 
+
+        The particles and the integrator state are copied directly in 
+        memory. This is much faster than saving and loading the simulation
+        and the copy can be integrated bit by bit identically to the original.
         
         Returns
         ------- 
         A rebound.Simulation object.
         
         """
-        w = c_int(0)
         sim = Simulation()
-        clibrebound._reb_copy_simulation_with_messages(byref(sim),byref(self),byref(w))
-        for majorerror, value, message in BINARY_WARNINGS:
-            if w.value & value:
-                if majorerror:
-                    raise RuntimeError(message)
-                else:  
-                    # Just a warning
-                    warnings.warn(message, RuntimeWarning)
+        clibrebound.reb_copy_simulation_into(byref(sim),byref(self))
         return sim
 
     def cite(self):
@@ -588,8 +634,11 @@ class Simulation(Structure):
         if not hasattr(self, '_widgets'):
             self._widgets = []
             def display_heartbeat(simp):
-                for w in self._widgets:
-                    w.refresh(simp,isauto=1)
+                # The frame rate is limited in C. If the first widget 
+                # receives a new frame, all other widgets do as well.
+                if self._widgets and self._widgets[0].refresh(simp,isauto=1):
+                    for w in self._widgets[1:]:
+                        w.refresh(simp,isauto=0)
             self.visualization = VISUALIZATIONS["webgl"] 
             clibrebound.reb_display_init_data(byref(self))
             self._dhbf = AFF(display_heartbeat)
@@ -674,6 +723,41 @@ class Simulation(Structure):
             clibrebound.reb_simulationarchive_automate_step(byref(self), c_char_p(filename.encode("ascii")), c_ulonglong(step))
         self.process_messages()
 
+    def automateCheckpoints(self, filename, walltime, N=2):
+        """
+        This function automates writing checkpoints in regular wall time intervals.
+        Unlike a Simulation Archive, the checkpoint file does not grow. It only 
+        contains the most recent snapshot and is replaced atomically. The N-1
+        previous checkpoints are kept in the files filename.1, filename.2, ...
+        Checkpoints are independent of the Simulation Archive and can be 
+        used together with it.
+
+        Arguments
+        ---------
+        filename : str
+            Filename of the checkpoint file.
+        walltime : float
+            Interval between checkpoints in wall time (seconds). 
+        N : int
+            Number of checkpoints to keep (default: 2).
+        
+        Examples
+        --------
+
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1.e-3,x=1.,vy=1.)
+        >>> sim.automateCheckpoints("checkpoint.bin", walltime=600.)
+        >>> sim.integrate(1e8)
+
+        After an interruption, the simulation can be restarted with:
+
+        >>> sim = rebound.Simulation("checkpoint.bin")
+
+        """
+        clibrebound.reb_simulationarchive_automate_checkpoint(byref(self), c_char_p(filename.encode("ascii")), c_double(walltime), c_int(N))
+        self.process_messages()
+
     def simulationarchive_snapshot(self, filename, deletefile=False):
         """
         Take a snapshot and save it to a SimulationArchive file.
@@ -845,6 +929,107 @@ class Simulation(Structure):
         s += "---------------------------------"
         print(s)
 
+# Profiling
+    @property
+    def profiling(self):
+        """
+        Get or set whether the runtime profiler is enabled (default: False).
+
+        If enabled, REBOUND records how much time is spent in the 
+        different parts of the code, for example the tree, the 
+        gravity calculation, or the Kepler steps of WHFast. Setting
+        this to True again resets all counters. The results can be
+        accessed with `profiling_results()`.
+        """
+        return bool(self._profiling)
+    @profiling.setter
+    def profiling(self, value):
+        if value:
+            clibrebound.reb_profiling_enable(byref(self))
+        else:
+            clibrebound.reb_profiling_disable(byref(self))
+
+    def profiling_results(self):
+        """
+        Returns the timing data of the runtime profiler.
+
+        The result is a dictionary with one entry per category. Each
+        entry is a dictionary with the total time in seconds (`time`),
+        the time excluding nested categories (`time_self`), and the 
+        number of times the category was entered (`calls`). 
+
+        Examples
+        --------
+        
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1e-3, a=1.)
+        >>> sim.profiling = True
+        >>> sim.integrate(100.)
+        >>> print(sim.profiling_results()["gravity"]["calls"])
+
+        """
+        if not self._profiling:
+            raise RuntimeError("Profiling is not enabled. Set sim.profiling = True first.")
+        p = self._profiling.contents
+        names = (c_char_p*REB_PROFILING_CAT_NUM).in_dll(clibrebound, "reb_profiling_category_names")
+        results = {}
+        for i in range(REB_PROFILING_CAT_NUM):
+            results[names[i].decode("ascii")] = {"time": p.time[i], "time_self": p.time_self[i], "calls": p.calls[i]}
+        return results
+
+    def reset_counters(self):
+        """
+        Sets all work counters in `sim.counters` to zero.
+
+        The counters record, for example, the number of gravitational 
+        interactions, IAS15 iterations and rejected steps, and Kepler 
+        solver iterations. They are always on and are useful to tune 
+        accuracy parameters such as `epsilon`, `hillfac` or `opening_angle2`.
+        """
+        clibrebound.reb_counters_reset(byref(self))
+
+    def trace_enable(self, capacity=100000):
+        """
+        Enables the event tracer.
+
+        The tracer records the beginning and end of every phase of a 
+        timestep (integrator, tree, MPI exchange, gravity, collisions, 
+        heartbeat, SimulationArchive, ...) together with the OpenMP 
+        thread number. The events are stored in a ring buffer which 
+        holds `capacity` events. Once the buffer is full, the oldest 
+        events are overwritten. Calling this function again clears 
+        the buffer. Use `trace_output_chrome()` to save the events.
+        """
+        clibrebound.reb_trace_enable(byref(self), c_ulonglong(capacity))
+        self.process_messages()
+
+    def trace_disable(self):
+        """
+        Disables the event tracer and frees the ring buffer.
+        """
+        clibrebound.reb_trace_disable(byref(self))
+
+    def trace_output_chrome(self, filename):
+        """
+        Writes the events recorded by the tracer to a file in the 
+        Chrome trace event format (JSON). The file can be viewed 
+        with Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+
+        Examples
+        --------
+        
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1e-3, a=1.)
+        >>> sim.trace_enable()
+        >>> sim.integrate(100.)
+        >>> sim.trace_output_chrome("trace.json")
+
+        """
+        clibrebound.reb_trace_output_chrome(byref(self), c_char_p(filename.encode("ascii")))
+        self.process_messages()
+
 # Set function pointer for additional forces
     @property
     def additional_forces(self):
@@ -864,6 +1049,148 @@ class Simulation(Structure):
         self._afp = AFF(func)
         self._additional_forces = self._afp
 
+    def add_force(self, func, istart=0, iend=-1, velocity_dependent=False):
+        """
+        Registers a force which acts on the particles with indices istart,...,iend-1.
+
+        All registered forces are evaluated in a single pass over the particles, after 
+        additional_forces. The particles are processed in chunks. The function is called as
+        func(sim, force, soa, istart, iend) for each chunk, where soa is a pointer to a 
+        reb_particles_soa structure. It needs to add the accelerations of the particles 
+        istart,...,iend-1 to soa.contents.ax, ay, az. Positions, velocities and masses of all 
+        particles can be read from soa. Returns the index of the force.
+
+        Arguments
+        ---------
+        func : function or C function pointer
+        istart : int
+            First particle the force acts on (default: 0).
+        iend : int
+            One past the last particle the force acts on (default: -1, all particles).
+        velocity_dependent : bool
+            Set to True if the force depends on the velocities.
+
+        Examples
+        --------
+
+        >>> def drag(sim, force, soa, istart, iend):
+        >>>     s = soa.contents
+        >>>     for i in range(istart, iend):
+        >>>         s.ax[i] -= 0.1*s.vx[i]
+        >>> sim.add_force(drag, istart=1, velocity_dependent=True)
+        """
+        fp = FORCEF(func)
+        if not hasattr(self, "_forcefps"):
+            self._forcefps = []
+        self._forcefps.append(fp)
+        index = clibrebound.reb_add_force(byref(self), fp, c_int(istart), c_int(iend), c_uint(velocity_dependent), None)
+        self.process_messages()
+        return index
+
+    def remove_forces(self):
+        """
+        Removes all forces registered with add_force().
+        """
+        clibrebound.reb_remove_forces(byref(self))
+        self._forcefps = []
+
+    def set_interaction_groups(self, N_groups, matrix=None):
+        """
+        Sets up interaction groups. Every particle belongs to a group (Particle.group, default 0).
+        Particles in group g only feel particles in group h if matrix[g][h] is True. 
+        Pairs of particles which do not interact in either direction do not collide.
+
+        Interaction groups are supported by the BASIC gravity routine (but not with WHFast 
+        in Jacobi coordinates) and by MERCURIUS. Interactions with the central object in 
+        democratic heliocentric coordinates and in MERCURIUS are part of the Kepler step 
+        and always included.
+
+        Arguments
+        ---------
+        N_groups : int
+            Number of groups (at most 64). Set to 0 to let all particles interact.
+        matrix : list of lists of bool
+            N_groups x N_groups interaction matrix (default: all groups interact).
+
+        Examples
+        --------
+
+        >>> # Embryos (group 0) feel everything, planetesimals (group 1) 
+        >>> # only feel the embryos and the star.
+        >>> sim.set_interaction_groups(2, [[True, True], [True, False]])
+        >>> sim.add(m=1e-7, a=1.2, group=1)
+        """
+        m = None
+        if matrix is not None:
+            if len(matrix)!=N_groups or any(len(row)!=N_groups for row in matrix):
+                raise ValueError("The interaction matrix needs to have N_groups x N_groups entries.")
+            m = (c_int*(N_groups*N_groups))(*[1 if matrix[g][h] else 0 for g in range(N_groups) for h in range(N_groups)])
+        clibrebound.reb_set_interaction_groups(byref(self), c_int(N_groups), m)
+        self.process_messages()
+
+    def set_interaction(self, group, source, enabled=True):
+        """
+        Enables or disables the force of particles in group source on particles in group group.
+        The groups must have been set up with set_interaction_groups().
+        """
+        clibrebound.reb_set_interaction(byref(self), c_int(group), c_int(source), c_int(enabled))
+        self.process_messages()
+
+    def add_reduction(self, type, field, bin_field="one", min=0., max=1., N_bins=1):
+        """
+        Registers a reduction of a particle quantity. Returns the index of the reduction.
+
+        All registered reductions are evaluated together in a single pass over the 
+        particles by calculate_reductions() or by the diagnostics recorder (quantity 
+        "reductions"). 
+
+        Arguments
+        ---------
+        type : str
+            "sum": sum of field. 
+            "moments": number of particles, mean and variance of field. 
+            "histogram": number of particles for which field is in each bin.
+            "profile": sum of field over the particles for which bin_field is in each bin.
+        field : str
+            One of "one", "x", "y", "z", "vx", "vy", "vz", "m", "r", "rxy" (cylindrical radius), 
+            "vy_shear" (vy relative to the shear in the shearing sheet), "vx_vy_shear", 
+            "area" (pi r^2), "midplane_area" (pi (r^2-z^2) if positive).
+        bin_field : str
+            Quantity used for binning profiles (same options as field).
+        min, max, N_bins : float, float, int
+            The bins are N_bins equal intervals between min and max. Particles outside are ignored.
+
+        Examples
+        --------
+
+        >>> sim.add_reduction("moments", "vy_shear")                   # velocity dispersion
+        >>> sim.add_reduction("profile", "m", "x", -50., 50., 20)       # surface density profile
+        >>> sim.calculate_reductions()
+        """
+        if type not in REDUCTION_TYPES:
+            raise ValueError("Unknown reduction type '%s'. Use one of %s." % (type, ", ".join(REDUCTION_TYPES)))
+        for f in [field, bin_field]:
+            if f not in REDUCTION_FIELDS:
+                raise ValueError("Unknown field '%s'. Use one of %s." % (f, ", ".join(REDUCTION_FIELDS)))
+        clibrebound.reb_add_reduction.restype = c_int
+        index = clibrebound.reb_add_reduction(byref(self), c_int(REDUCTION_TYPES[type]), c_int(REDUCTION_FIELDS[field]), c_int(REDUCTION_FIELDS[bin_field]), c_double(min), c_double(max), c_int(N_bins))
+        self.process_messages()
+        return index
+
+    def calculate_reductions(self):
+        """
+        Evaluates all reductions registered with add_reduction() in a single pass over 
+        the particles. Returns a list with the values of each reduction.
+        """
+        clibrebound.reb_calculate_reductions(byref(self))
+        return [r._values[:r.N_values] for r in self._reductions[:self._reductions_N]]
+
+    def remove_reductions(self):
+        """
+        Removes all reductions registered with add_reduction().
+        """
+        clibrebound.reb_remove_reductions(byref(self))
+
     @property
     def pre_timestep_modifications(self):
         """
@@ -899,6 +1226,10 @@ class Simulation(Structure):
         The heartbeat function is called every timestep and can be used
         to monitor long simulations, check for stalled simulations and 
         output debugging information.
+        Set ``heartbeat_steps`` to only call the heartbeat function 
+        every ``heartbeat_steps`` steps. This reduces the overhead of
+        calling a python function from C (and acquiring the GIL) 
+        for simulations with many short timesteps.
      
         The argument can be a python function or something that can be 
         cast to a C function or a python function.
@@ -1006,6 +1337,7 @@ class Simulation(Structure):
         - ``'SABA(10,6,4)'`` 
         - ``'EOS'`` 
         - ``'BS'`` 
+        - ``'HERMITE'`` 
         - ``'none'``
         
         Check the online documentation for a full description of each of the integrators. 
@@ -1091,6 +1423,8 @@ class Simulation(Structure):
         - ``'basic'`` (default)
         - ``'compensated'``
         - ``'tree'``
+        - ``'fmm'``
+        - ``'fft'`` (requires FFTW)
         
         Check the online documentation for a full description of each of the modules. 
         """
@@ -1122,6 +1456,10 @@ class Simulation(Structure):
         - ``'tree'``
         - ``'mercurius'`` 
         - ``'direct'``
+        - ``'grid'``
+        - ``'sweep'``
+        - ``'verlet'``
+        - ``'lineverlet'``
         
         Check the online documentation for a full description of each of the modules. 
         """
@@ -1265,6 +1603,56 @@ class Simulation(Structure):
         s = Variation.from_buffer_copy(self.var_config[cur_var_config_N])
 
         return s
+
+    def calculate_derivatives(self, particle_index, variations, primary=None):
+        """
+        Calculates several first and/or second derivatives of a particle's Keplerian orbit at once.
+
+        The orbital elements, the solution of Kepler's equation and the trigonometric terms
+        are calculated only once and shared by all derivatives. The results agree with
+        those used by ``Variation.vary()``, which makes this function useful to initialize many
+        variational particles of the same orbit.
+
+        Parameters
+        ----------
+        particle_index : int
+            The index of the particle whose orbit is differentiated.
+        variations : list
+            Each entry is either a string (first derivative) or a tuple of two strings (second 
+            derivative). Supported are the same parameters as in ``Variation.vary()``.
+        primary: Particle, optional
+            By default, derivatives are calculated in the Heliocentric frame. 
+
+        Returns
+        -------
+        A list of particles, one for each entry in variations.
+
+        Examples
+        --------
+
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1.e-3, a=1., e=0.1)
+        >>> da, dade = sim.calculate_derivatives(1, ["a", ("a","e")])
+        """
+        if primary is None:
+            primary = self.particles[0]
+        N = len(variations)
+        v1 = (c_int*N)()
+        v2 = (c_int*N)()
+        for i, v in enumerate(variations):
+            if isinstance(v, str):
+                v = (v,)
+            if len(v)<1 or len(v)>2 or any(vi not in DERIVATIVES_PARAMETERS for vi in v):
+                raise ValueError("Derivatives can only be calculated with respect to one or two of the following: %s."%", ".join(DERIVATIVES_PARAMETERS.keys()))
+            v1[i] = DERIVATIVES_PARAMETERS[v[0]]
+            v2[i] = DERIVATIVES_PARAMETERS[v[1]] if len(v)==2 else -1
+        derivatives = (Particle*N)()
+        clibrebound.reb_derivatives_many.restype = c_int
+        N_unsupported = clibrebound.reb_derivatives_many(c_double(self.G), primary, self.particles[particle_index], c_int(N), v1, v2, derivatives)
+        if N_unsupported:
+            raise ValueError("%d of the requested derivatives are not implemented."%N_unsupported)
+        return list(derivatives)
         
 # MEGNO
     def init_megno(self, seed=None):
@@ -1319,17 +1707,31 @@ class Simulation(Structure):
         2) The particle's mass and a set of cartesian coordinates: m,x,y,z,vx,vy,vz.
         3) The primary as a Particle structure, the particle's mass and a set of orbital elements: primary,m,a,anom,e,omega,inv,Omega,MEAN (see :class:`.Orbit` for the definition of orbital elements).
         4) A name of an object (uses NASA Horizons to look up coordinates)
-        5) A list of particles or names.
+        5) A list of particles or names. Names are looked up concurrently.
         """
         if particle is not None:
             if isinstance(particle, Particle):
-                if (self.gravity == "tree" or self.collision == "tree") and self.root_size <=0.:
+                if (self.gravity == "tree" or self.gravity == "fmm" or self.collision == "tree") and self.root_size <=0.:
                     raise ValueError("The tree code for gravity and/or collision detection has been selected. However, the simulation box has not been configured yet. You cannot add particles until the the simulation box has a finite size.")
 
                 clibrebound.reb_add(byref(self), particle)
             elif isinstance(particle, list):
-                for p in particle:
-                    self.add(p, **kwargs)
+                if len(particle)>0 and not kwargs and all(isinstance(p, Particle) for p in particle):
+                    # Add all particles at once
+                    if (self.gravity == "tree" or self.gravity == "fmm" or self.collision == "tree") and self.root_size <=0.:
+                        raise ValueError("The tree code for gravity and/or collision detection has been selected. However, the simulation box has not been configured yet. You cannot add particles until the the simulation box has a finite size.")
+                    ps = (Particle*len(particle))(*particle)
+                    clibrebound.reb_add_many(byref(self), ps, c_int(len(particle)))
+                elif len(particle)>1 and all(isinstance(p, str) and p.lower() not in ["solar system", "outer solar system"] for p in particle):
+                    # Query NASA Horizons for all bodies concurrently
+                    if self.python_unit_l == 0 or self.python_unit_m == 0 or self.python_unit_t == 0:
+                        self.units = ('AU', 'yr2pi', 'Msun')
+                    for name, p in zip(particle, horizons.getParticles(particle, **kwargs)):
+                        self.add(p, hash=name)
+                        units_convert_particle(self.particles[-1], 'km', 's', 'kg', hash_to_unit(self.python_unit_l), hash_to_unit(self.python_unit_t), hash_to_unit(self.python_unit_m))
+                else:
+                    for p in particle:
+                        self.add(p, **kwargs)
             elif isinstance(particle,str):
                 if self.python_unit_l == 0 or self.python_unit_m == 0 or self.python_unit_t == 0:
                     self.units = ('AU', 'yr2pi', 'Msun')
@@ -1375,14 +1777,24 @@ class Simulation(Structure):
 
         Parameters
         ----------
-        index : int, optional
-            Specify particle to remove by index.
-        hash : c_uint32 or string, optional
+        index : int or list of int, optional
+            Specify particle to remove by index. If a list is passed, all
+            particles in the list are removed in a single pass.
+        hash : c_uint32 or string, or a list of these, optional
             Specifiy particle to remove by hash (if a string is passed, the corresponding hash is calculated).
+            If a list is passed, all particles in the list are removed in a single pass.
         keepSorted : bool, optional
             By default, remove preserves the order of particles in the particles array. 
             Might set it to zero in cases with many particles and many removals to speed things up.
         """
+        if index is not None and hasattr(index, "__len__"):
+            indices = (c_int*len(index))(*[int(i) for i in index])
+            clibrebound.reb_remove_many(byref(self), indices, c_int(len(index)), keepSorted)
+            index = None
+        if hash is not None and hasattr(hash, "__len__") and not isinstance(hash, str):
+            hashes = (c_uint32*len(hash))(*[rebhash(h).value if isinstance(h, str) else getattr(h, "value", h) for h in hash])
+            clibrebound.reb_remove_many_by_hash(byref(self), hashes, c_int(len(hash)), keepSorted)
+            hash = None
         if index is not None:
             clibrebound.reb_remove(byref(self), index, keepSorted)
         if hash is not None:
@@ -1405,40 +1817,77 @@ class Simulation(Structure):
 
         self.process_messages()
 
-    def particles_ascii(self, prec=8):
+    def particles_ascii(self, prec=8, format="cartesian", delimiter=" ", threads=1):
         """
-        Returns an ASCII string with all particles' masses, radii, positions and velocities.
+        Returns an ASCII string with one line per particle.
 
         Parameters
         ----------
         prec : int, optional
             Number of digits after decimal point. Default 8.
-        """
-        s = ""
-        for p in self.particles:
-            s += (("%%.%de "%prec) * 8)%(p.m, p.r, p.x, p.y, p.z, p.vx, p.vy, p.vz) + "\n"
+        format : string, optional
+            "cartesian" (default): mass, radius, position (x,y,z) and velocity (x,y,z).
+            "orbits": mass, radius, a, e, inc, Omega, omega, f relative to the first particle.
+            The first particle itself is not included in this format.
+        delimiter : string, optional
+            Character separating the columns. Default is a space. Use "," for CSV.
+        threads : int, optional
+            Number of threads used to format the particles. If 0, all cores are used. Default 1.
+        """
+        size = c_size_t()
+        clibrebound.reb_output_particles_ascii_to_buffer.restype = c_void_p
+        buf = clibrebound.reb_output_particles_ascii_to_buffer(byref(self), c_int(ASCII_FORMATS[format]), c_int(prec), c_char(delimiter.encode("ascii")), c_int(threads), byref(size))
+        s = ctypes.string_at(buf, size.value).decode("ascii")
+        clibrebound.reb_free_buffer(c_void_p(buf))
         if len(s):
             s = s[:-1]
         return s
-    
-    def add_particles_ascii(self, s):
+
+    def add_particles_ascii(self, s, format="cartesian", threads=1):
         """
         Adds particles from an ASCII string. 
 
+        Columns can be separated by spaces, tabs or commas. Empty lines and lines
+        starting with # are ignored. If any line cannot be parsed, no particle is added.
+
         Parameters
         ----------
         s : string
             One particle per line. Each line should include particle's mass, radius, position and velocity.
+            If format is "orbits", each line should include the particle's mass, radius, a, e, inc, Omega, omega, f.
+            The orbits are relative to the first particle which needs to be added beforehand.
+        format : string, optional
+            "cartesian" (default) or "orbits".
+        threads : int, optional
+            Number of threads used to parse the string. If 0, all cores are used. Default 1.
+        """
+        b = s.encode("ascii")
+        clibrebound.reb_input_particles_ascii_from_buffer.restype = c_int
+        N = clibrebound.reb_input_particles_ascii_from_buffer(byref(self), c_char_p(b), c_size_t(len(b)), c_int(ASCII_FORMATS[format]), c_int(threads))
+        try:
+            self.process_messages()
+        except RuntimeError as e:
+            raise AttributeError(str(e))
+        return N
+
+    def save_particles_ascii(self, filename, prec=16, format="cartesian", delimiter=" ", threads=0):
+        """
+        Writes all particles to a text file with one line per particle.
+        See particles_ascii() for a description of the arguments.
+        By default, 16 digits are written so that the file can be read back without loss of precision.
         """
-        for l in s.split("\n"):
-            r = l.split()
-            if len(r):
-                try:
-                    r = [float(x) for x in r]
-                    p = Particle(simulation=self, m=r[0], r=r[1], x=r[2], y=r[3], z=r[4], vx=r[5], vy=r[6], vz=r[7])
-                    self.add(p)
-                except:
-                    raise AttributeError("Each line requires 8 floats corresponding to mass, radius, position (x,y,z) and velocity (x,y,z).")
+        clibrebound.reb_output_particles_ascii(byref(self), c_char_p(filename.encode("ascii")), c_int(ASCII_FORMATS[format]), c_int(prec), c_char(delimiter.encode("ascii")), c_int(threads))
+        self.process_messages()
+
+    def load_particles_ascii(self, filename, format="cartesian", threads=0):
+        """
+        Adds particles from a text file with one line per particle.
+        See add_particles_ascii() for a description of the format. Returns the number of particles added.
+        """
+        clibrebound.reb_input_particles_ascii.restype = c_int
+        N = clibrebound.reb_input_particles_ascii(byref(self), c_char_p(filename.encode("ascii")), c_int(ASCII_FORMATS[format]), c_int(threads))
+        self.process_messages()
+        return N
 
 # Orbit calculation
     def calculate_orbits(self, primary=None, jacobi_masses=False):
@@ -1484,6 +1933,70 @@ class Simulation(Structure):
 
         return orbits
 
+    def serialize_orbits(self, primary="jacobi", jacobi_masses=False, **kwargs):
+        """
+        Fast way to calculate the orbital elements of all particles.
+
+        This is much faster than `calculate_orbits()` for simulations with 
+        many particles. The orbits are calculated in C (in parallel if 
+        REBOUND was compiled with OpenMP) and written directly into 
+        arrays. No Orbit objects are created.
+
+        Possible argument names are "a", "e", "inc", "Omega", "omega", 
+        "pomega", "f", "M", and "l". The arrays need to have a datatype of 
+        float64 and a length of at least sim.N_real-1. Element i of each 
+        array corresponds to particle i+1. If no arrays are passed, numpy 
+        arrays for all elements are allocated and returned in a dictionary.
+        Orbital elements of particles for which no orbit can be calculated 
+        are NaN.
+
+        Parameters
+        ----------
+        primary : str, optional
+            "jacobi" (default) uses the center of mass of all interior particles, 
+            "heliocentric" uses particle 0, and "barycentric" the center of mass of 
+            all particles as the primary.
+        jacobi_masses: bool
+            Whether to use jacobi primary mass in orbit calculation. (Default: False)
+
+        Examples
+        --------
+
+        >>> import numpy as np
+        >>> a = np.zeros(sim.N_real-1)
+        >>> e = np.zeros(sim.N_real-1)
+        >>> sim.serialize_orbits(a=a, e=e)
+        >>> orbits = sim.serialize_orbits(primary="heliocentric")
+        >>> print(orbits["inc"])
+
+        """
+        primaries = {"jacobi": 0, "heliocentric": 1, "barycentric": 2}
+        if primary not in primaries:
+            raise ValueError("Primary must be one of '%s'." % "', '".join(primaries.keys()))
+        possible_keys = ["a","e","inc","Omega","omega","pomega","f","M","l"]
+        N = max(self.N_real-1, 0)
+        ret = None
+        if len(kwargs)==0:
+            import numpy as np
+            ret = {k: np.zeros(N, dtype="float64") for k in possible_keys}
+            kwargs = ret
+        d = {x:None for x in possible_keys}
+        for k,v in kwargs.items():
+            if k not in d:
+                raise AttributeError("Only '%s' are currently supported attributes for serialization." % "', '".join(d.keys()))
+            if hasattr(v, "ctypes"): # numpy array
+                if v.dtype!= "float64":
+                    raise AttributeError("Expected 'float64' data type for %s array."%k)
+                if v.size<N:
+                    raise AttributeError("Array '%s' is not large enough."%k)
+                d[k] = v.ctypes.data_as(ctypes.POINTER(c_double))
+            else: # ctypes array
+                if len(v)<N:
+                    raise AttributeError("Array '%s' is not large enough."%k)
+                d[k] = cast(v, ctypes.POINTER(c_double))
+        clibrebound.reb_serialize_orbits(byref(self), c_int(primaries[primary]), c_int(int(jacobi_masses)), *[d[k] for k in possible_keys])
+        return ret
+
 # COM calculation 
     def calculate_com(self, first=0, last=None):
         """
@@ -1632,6 +2145,188 @@ class Simulation(Structure):
 
         clibrebound.reb_set_serialized_particle_data(byref(self), d["hash"], d["m"], d["r"], d["xyz"], d["vxvyvz"], d["xyzvxvyvz"])
 
+    def save_state(self, state=None):
+        """
+        Saves the mutable state of the simulation: the time, the timestep, 
+        the particles and the internal arrays of the integrator. 
+
+        This is much cheaper than copying the simulation. It is useful 
+        for methods which repeatedly step forward and then go back, for 
+        example to find the exact time of an encounter. Pass a previously 
+        returned state to reuse its memory. 
+
+        Parameters
+        ----------
+        state : SimulationState, optional
+            If given, the state is stored in this object.
+
+        Returns
+        -------
+        A SimulationState object.
+
+        Examples
+        --------
+
+        >>> state = sim.save_state()
+        >>> sim.integrate(10.)
+        >>> sim.restore_state(state) # Back to where we were
+        """
+        if state is None:
+            state = SimulationState()
+        clibrebound.reb_simulation_state_save(state._ptr, byref(self))
+        return state
+
+    def restore_state(self, state):
+        """
+        Restores a state previously saved with `save_state()`. Settings of
+        the simulation (for example the integrator) are not changed.
+        The state can be restored many times.
+        """
+        clibrebound.reb_simulation_state_restore(byref(self), state._ptr)
+        self.process_messages()
+
+    def particle_data_view(self, readonly=False):
+        """
+        Returns zero-copy numpy views onto the particle data.
+
+        Unlike `serialize_particle_data()`, no data is copied. The 
+        arrays of the returned `ParticleDataView` point directly into the 
+        particles array of the simulation. The view becomes invalid 
+        when particles are added or removed.
+
+        Parameters
+        ----------
+        readonly : bool, optional
+            If True, the arrays cannot be modified. Default is False.
+
+        Examples
+        --------
+        
+        >>> v = sim.particle_data_view(readonly=True)
+        >>> print(v.xyz[:,0].mean())
+
+        Changes made within a `with` block are committed when the block ends:
+
+        >>> with sim.particle_data_view() as v:
+        ...     v.vxvyvz[1:] *= 1.01
+
+        """
+        return ParticleDataView(self, readonly=readonly)
+
+    def add_serialized_particle_data(self,**kwargs):
+        """
+        Fast way to add many particles via numpy arrays.
+        This uses the same syntax as Simulation.set_serialized_particle_data()
+        but adds new particles instead of modifying existing ones. The
+        number of particles is determined by the size of the arrays.
+        Values which are not passed are set to 0. Memory is only 
+        allocated once, making this much faster than calling add()
+        for every particle.
+
+        Examples
+        --------
+        This adds 1000 test particles at random positions:
+
+        >>> import numpy as np
+        >>> xyz = np.random.random((1000,3))
+        >>> sim.add_serialized_particle_data(xyz=xyz)
+
+        """
+        possible_keys = ["hash","m","r","xyz","vxvyvz","xyzvxvyvz"]
+        d = {x:None for x in possible_keys}
+        N = None
+        for k,v in kwargs.items():
+            if k in d:
+                if k == "hash":
+                    if v.dtype!= "uint32":
+                        raise AttributeError("Expected 'uint32' data type for '%s' array."%k)
+                    d[k] = v.ctypes.data_as(ctypes.POINTER(ctypes.c_uint32))
+                else:
+                    if v.dtype!= "float64":
+                        raise AttributeError("Expected 'float64' data type for %s array."%k)
+                    d[k] = v.ctypes.data_as(ctypes.POINTER(ctypes.c_double))
+                if k in ["xyz", "vxvyvz"]:
+                    Nk = v.size//3
+                elif k in ["xyzvxvyvz"]:
+                    Nk = v.size//6
+                else:
+                    Nk = v.size
+                if N is not None and N!=Nk:
+                    raise AttributeError("Arrays have different lengths.")
+                N = Nk
+            else:
+                raise AttributeError("Only '%s' are currently supported attributes for serialization." % "', '".join(d.keys()))
+        if N is None:
+            return
+        if (self.gravity == "tree" or self.gravity == "fmm" or self.collision == "tree") and self.root_size <=0.:
+            raise ValueError("The tree code for gravity and/or collision detection has been selected. However, the simulation box has not been configured yet. You cannot add particles until the the simulation box has a finite size.")
+        clibrebound.reb_add_serialized_particle_data(byref(self), c_int(N), d["hash"], d["m"], d["r"], d["xyz"], d["vxvyvz"], d["xyzvxvyvz"])
+        self.process_messages()
+
+    def add_serialized_orbits(self, primary="jacobi", **kwargs):
+        """
+        Fast way to add many particles from arrays of orbital elements.
+
+        This is the counterpart of `serialize_orbits()`. The conversion to 
+        Cartesian coordinates is done in C (in parallel if REBOUND was 
+        compiled with OpenMP) and the particles are written directly into 
+        the particle array. This is much faster than calling add() with 
+        orbital elements for every particle.
+
+        Possible argument names are "hash", "m", "r", "a", "e", "inc", 
+        "Omega", "omega", "f", and "M". The semi-major axis "a" is required. 
+        All arrays need to have the same length and a datatype of float64 
+        (uint32 for "hash"). Values which are not passed are set to 0. 
+        If "M" is passed, "f" is ignored. If any of the orbits is not valid, 
+        no particles are added and an exception is raised.
+
+        Parameters
+        ----------
+        primary : str, optional
+            "jacobi" (default) uses the center of mass of all particles added 
+            before (the same as add()), "heliocentric" uses particle 0, and 
+            "barycentric" the center of mass of all particles in the simulation
+            before this call.
+
+        Examples
+        --------
+        This adds 1000 test particles on circular orbits:
+
+        >>> import numpy as np
+        >>> a = np.linspace(1., 2., 1000)
+        >>> f = np.random.uniform(0., 2.*np.pi, 1000)
+        >>> sim.add_serialized_orbits(primary="heliocentric", a=a, f=f)
+
+        """
+        primaries = {"jacobi": 0, "heliocentric": 1, "barycentric": 2}
+        if primary not in primaries:
+            raise ValueError("Primary must be one of '%s'." % "', '".join(primaries.keys()))
+        possible_keys = ["hash","m","r","a","e","inc","Omega","omega","f","M"]
+        d = {x:None for x in possible_keys}
+        N = None
+        for k,v in kwargs.items():
+            if k not in d:
+                raise AttributeError("Only '%s' are currently supported attributes for serialization." % "', '".join(d.keys()))
+            if k == "hash":
+                if v.dtype!= "uint32":
+                    raise AttributeError("Expected 'uint32' data type for '%s' array."%k)
+                d[k] = v.ctypes.data_as(ctypes.POINTER(ctypes.c_uint32))
+            else:
+                if v.dtype!= "float64":
+                    raise AttributeError("Expected 'float64' data type for %s array."%k)
+                d[k] = v.ctypes.data_as(ctypes.POINTER(ctypes.c_double))
+            if N is not None and N!=v.size:
+                raise AttributeError("Arrays have different lengths.")
+            N = v.size
+        if N is None:
+            return
+        if d["a"] is None:
+            raise AttributeError("The semi-major axis 'a' is required.")
+        if (self.gravity == "tree" or self.gravity == "fmm" or self.collision == "tree") and self.root_size <=0.:
+            raise ValueError("The tree code for gravity and/or collision detection has been selected. However, the simulation box has not been configured yet. You cannot add particles until the the simulation box has a finite size.")
+        clibrebound.reb_add_serialized_orbits(byref(self), c_int(N), c_int(primaries[primary]), *[d[k] for k in possible_keys])
+        self.process_messages()
+
     def move_to_hel(self):
         """
         This function moves all particles in the simulation to the heliocentric frame.
@@ -1649,6 +2344,73 @@ class Simulation(Structure):
         """
         clibrebound.reb_move_to_com(byref(self))
     
+    def recorder_enable(self, filename, quantities=["energy"], interval=0., steps=0, capacity=1024):
+        """
+        Starts recording diagnostics to a binary file.
+
+        Samples are taken every `interval` in simulation time or every `steps` 
+        timesteps. If both are 0, a sample is taken every timestep. Samples are 
+        stored in a buffer with room for `capacity` samples. Once the buffer is 
+        full, it is written to the file on a background thread while the 
+        integration continues. Use `recorder_flush()` or `recorder_disable()` 
+        to write the remaining samples and `rebound.read_recording()` to read 
+        the file. The column `t` is always recorded.
+
+        Arguments
+        ---------
+        filename : str
+        quantities : list of str
+            Any of "energy" (column E), "angular_momentum" (Lx, Ly, Lz), 
+            "megno" (megno, lyapunov), "orbits" (a1, e1, inc1, a2, ... in 
+            Jacobi coordinates), "min_distance" (d_min), and "reductions" 
+            (values of all reductions registered with add_reduction(): red0, 
+            red1_0, red1_1, ...).
+        interval : float
+        steps : int
+        capacity : int
+        
+        Examples
+        --------
+        
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1e-3, a=1.)
+        >>> sim.recorder_enable("diagnostics.bin", ["energy", "orbits"], interval=1.)
+        >>> sim.integrate(100.)
+        >>> sim.recorder_disable()
+        >>> data = rebound.read_recording("diagnostics.bin")
+        >>> print(data["a1"][-1])
+
+        """
+        q = 0
+        for quantity in quantities:
+            if quantity not in RECORDER_QUANTITIES:
+                raise ValueError("Unknown quantity '%s'. Use one of %s." % (quantity, ", ".join(RECORDER_QUANTITIES)))
+            q |= RECORDER_QUANTITIES[quantity]
+        clibrebound.reb_recorder_enable(byref(self), c_char_p(filename.encode("ascii")), c_uint(q), c_double(interval), c_uint(steps), c_uint(capacity))
+        self.process_messages()
+
+    def recorder_sample(self):
+        """
+        Records one sample of the diagnostics now.
+        """
+        clibrebound.reb_recorder_sample(byref(self))
+        self.process_messages()
+
+    def recorder_flush(self):
+        """
+        Writes all buffered samples of the diagnostics recorder to the file.
+        """
+        clibrebound.reb_recorder_flush(byref(self))
+        self.process_messages()
+
+    def recorder_disable(self):
+        """
+        Writes all buffered samples and closes the file of the diagnostics recorder.
+        """
+        clibrebound.reb_recorder_disable(byref(self))
+        self.process_messages()
+
     def calculate_energy(self):
         """
         Returns the sum of potential and kinetic energy of all particles in the simulation.
@@ -1664,6 +2426,21 @@ class Simulation(Structure):
         L = clibrebound.reb_tools_angular_momentum(byref(self))
         return [L.x, L.y, L.z]
 
+    def calculate_diagnostics(self, tree=False):
+        """
+        Calculates the energy and angular momentum in a single pass over the particles
+        and returns them as a `reb_diagnostics` object.
+
+        Arguments
+        ---------
+        tree : bool
+            If True and the simulation uses the tree gravity module, the potential energy is
+            approximated with the tree (using the same opening angle and multipole order as the
+            force calculation). Otherwise, all pairs are summed up exactly.
+        """
+        clibrebound.reb_tools_diagnostics.restype = reb_diagnostics
+        return clibrebound.reb_tools_diagnostics(byref(self), c_int(1 if tree else 0))
+
     def configure_box(self, boxsize, root_nx=1, root_ny=1, root_nz=1):
         """
         Initialize the simulation box.
@@ -1722,6 +2499,7 @@ class Simulation(Structure):
         """
         Perform exactly N_steps integration steps with REBOUND. This function is rarely needed.
         Instead, use integrate().
+        As with integrate(), the GIL is released while the steps are performed.
         """
         clibrebound.reb_steps(byref(self),c_uint(N_steps))
         self.process_messages()
@@ -1741,6 +2519,14 @@ class Simulation(Structure):
         ----------
         Exceptions are thrown when no more particles are left in the simulation or when a generic integration error occured. 
         If you specified exit_min_distance or exit_max_distance, then additional exceptions might thrown for escaping particles or particles that undergo a clos encounter.
+
+        Threads
+        -------
+        The GIL is released during the integration. Different simulations can therefore be integrated 
+        concurrently from different python threads. Python callbacks (e.g. ``heartbeat`` or 
+        ``additional_forces``) reacquire the GIL every time they are called. If only a heartbeat 
+        function is needed, set ``heartbeat_steps`` to call it less often. The same simulation must 
+        not be accessed from another thread while it is being integrated.
         
         Examples
         -------- 
@@ -1755,6 +2541,203 @@ class Simulation(Structure):
         """
         self.exact_finish_time = c_int(exact_finish_time)
         ret_value = clibrebound.reb_integrate(byref(self), c_double(tmax))
+        self._check_integrate_status(ret_value)
+
+    def integrate_budget(self, tmax, walltime=0., steps=0, exact_finish_time=1):
+        """
+        Integrates towards tmax for a limited amount of wall time and/or number of steps.
+
+        This allows one thread (for example an event loop) to interleave many 
+        simulations. Calling this function again with the same tmax resumes the 
+        integration. The result does not depend on how the integration was 
+        split up and is identical to a single call to ``integrate(tmax)``.
+
+        While the integration has not finished, the particles are not synchronized.
+        Use ``integrator_synchronize_output()`` if you need the current 
+        positions and velocities in-between calls.
+        
+        Parameters
+        ----------
+        tmax : float
+            The final time of the integration (see ``integrate``).
+        walltime : float, optional
+            Maximum wall time in seconds spent in this call. The budget is checked 
+            after every few steps, so it can be exceeded by a few steps. 0 means no limit.
+        steps : int, optional
+            Maximum number of steps taken in this call. 0 means no limit.
+        exact_finish_time: int, optional
+            See ``integrate``.
+
+        Returns
+        -------
+        True if the integration has reached tmax, False if the budget ran out first.
+
+        Exceptions
+        ----------
+        The same exceptions as ``integrate`` are raised.
+
+        Examples
+        --------
+        
+        >>> while not sim.integrate_budget(100., walltime=0.01):
+        >>>     handle_other_work()
+        
+        """
+        self.exact_finish_time = c_int(exact_finish_time)
+        ret_value = clibrebound.reb_integrate_budget(byref(self), c_double(tmax), c_double(walltime), c_ulong(steps))
+        if ret_value < 0:
+            self.process_messages()
+            return False
+        self._check_integrate_status(ret_value)
+        return True
+
+    async def integrate_async(self, tmax, walltime=1e-3, exact_finish_time=1):
+        """
+        Integrates to tmax without blocking an asyncio event loop.
+
+        The simulation is advanced with ``integrate_budget`` in slices of 
+        ``walltime`` seconds. Control is returned to the event loop in-between 
+        slices. Many simulations can be integrated concurrently on one thread:
+
+        >>> await asyncio.gather(sim1.integrate_async(100.), sim2.integrate_async(100.))
+
+        The simulation must not be modified while it is being integrated.
+        """
+        import asyncio
+        while not self.integrate_budget(tmax, walltime=walltime, exact_finish_time=exact_finish_time):
+            await asyncio.sleep(0)
+
+    def integrate_parareal(self, tmax, N_slices, coarse=None, coarse_dt=None, tolerance=1e-10, max_iterations=None, threads=0):
+        """
+        Integrates to tmax using the time-parallel Parareal algorithm.
+
+        The interval is split into ``N_slices`` time slices. A coarse propagator 
+        predicts the state at the start of every slice. All slices are then 
+        integrated in parallel with this simulation's integrator and settings 
+        (the fine propagator). The predictions are corrected iteratively until 
+        they change by less than ``tolerance`` (relative to the positions and 
+        velocities). After N_slices iterations, the result is the same as a
+        serial integration, so Parareal only pays off if it converges in 
+        a few iterations, e.g. for long, regular integrations of few particles.
+
+        Supported integrators are IAS15, WHFast, SABA and Leapfrog. The number 
+        of particles must not change during the integration.
+        
+        Parameters
+        ----------
+        tmax : float
+            The final time.
+        N_slices : int
+            Number of time slices. Typically a small multiple of the number of threads.
+        coarse : Simulation, optional
+            Simulation used as the coarse propagator. It needs to have the same 
+            particles, but can use a different integrator or timestep.
+        coarse_dt : float, optional
+            If coarse is not given, a copy of this simulation with the timestep 
+            coarse_dt is used as the coarse propagator. Default: 10 times the timestep.
+        tolerance : float, optional
+            Relative tolerance for convergence.
+        max_iterations : int, optional
+            Maximum number of iterations. Default: N_slices.
+        threads : int, optional
+            Number of threads. 0 (default) uses one thread per processor.
+
+        Returns
+        -------
+        A PararealResult.
+
+        Examples
+        --------
+        
+        >>> sim.integrator = "whfast"
+        >>> sim.dt = 0.01
+        >>> result = sim.integrate_parareal(1e4, 16, coarse_dt=0.1)
+        >>> print(result.iterations, result.converged)
+        
+        """
+        if coarse is None:
+            coarse = self.copy()
+            coarse.dt = 10.*self.dt if coarse_dt is None else coarse_dt
+        if max_iterations is None:
+            max_iterations = N_slices
+        result = PararealResult()
+        ret_value = clibrebound.reb_integrate_parareal(byref(self), byref(coarse), c_double(tmax), c_int(N_slices), c_double(tolerance), c_int(max_iterations), c_int(threads), byref(result))
+        if ret_value < 0 and self._status == 6:
+            raise KeyboardInterrupt
+        self.process_messages() # Raises an exception if the integration failed
+        return result
+
+    def tune(self, parameter, values, t_pilot, error, apply=True, setup=None):
+        """
+        Selects the cheapest value of an integrator parameter which meets an energy error target.
+
+        For every value, a copy of this simulation is integrated from the 
+        current time to the current time plus ``t_pilot``. The relative 
+        energy error is checked 16 times during this pilot integration. 
+        Among all values whose error stays below ``error``, the one with the 
+        shortest walltime is selected. A pilot is stopped as soon as its error 
+        exceeds the target. Because the choice depends on timings, it can differ 
+        between machines.
+
+        Parameters
+        ----------
+        parameter : str
+            One of "dt" (integrators with a fixed timestep), "epsilon" 
+            (``ri_ias15.epsilon``, IAS15 and MERCURIUS), "hillfac" 
+            (``ri_mercurius.hillfac``) or "opening_angle2" (tree gravity).
+        values : sequence of floats
+            Candidate values.
+        t_pilot : float
+            Length of the pilot integrations.
+        error : float
+            Largest allowed relative energy error.
+        apply : bool, optional
+            If True (default), the parameter of this simulation is set to the selected value.
+        setup : callable, optional
+            Called with every copy before the pilot integration, e.g. to set 
+            additional forces. Function pointers are not copied otherwise.
+
+        Returns
+        -------
+        A tuple of the selected value (None if no value meets the target) 
+        and a list with one TuneResult for every value.
+
+        Examples
+        --------
+        
+        >>> sim.integrator = "whfast"
+        >>> dt, results = sim.tune("dt", [0.001, 0.01, 0.05, 0.1], 100., 1e-6)
+        
+        """
+        if parameter not in TUNE_PARAMETERS:
+            raise ValueError("Unknown parameter: {}".format(parameter))
+        values = list(values)
+        N = len(values)
+        c_values = (c_double*N)(*values)
+        results = (TuneResult*N)()
+        pilots = [] # Keeps Python objects (e.g. function pointers) set in setup alive during the integration.
+        exceptions = []
+        sigint = c_int.in_dll(clibrebound, "reb_sigint")
+        def _setup(r):
+            try:
+                sim = r.contents
+                pilots.append(sim)
+                setup(sim)
+            except BaseException as e:
+                exceptions.append(e)
+                sigint.value = 1 # Stops the pilot integration
+        c_setup = AFF(_setup) if setup is not None else AFF()
+        clibrebound.reb_tune.restype = c_int
+        index = clibrebound.reb_tune(byref(self), c_int(TUNE_PARAMETERS[parameter]), c_values, c_int(N), c_double(t_pilot), c_double(error), c_int(1 if apply else 0), c_setup, results)
+        pilots = None
+        if exceptions:
+            raise exceptions[0]
+        self.process_messages()
+        if sigint.value == 1:
+            raise KeyboardInterrupt
+        return (values[index] if index >= 0 else None), list(results)
+
+    def _check_integrate_status(self, ret_value):
         if ret_value == 1:
             self.process_messages()
             raise SimulationError("An error occured during the integration.")
@@ -1764,7 +2747,8 @@ class Simulation(Structure):
             else:
                 raise NoParticles("No more particles left in simulation.")
         if ret_value == 3:
-            raise Encounter("Two particles had a close encounter (d<exit_min_distance).")
+            e = self.exit_encounter
+            raise Encounter("Two particles had a close encounter (d<exit_min_distance). Particles %d and %d came within a distance of %g at t=%g." % (e.p1, e.p2, e.d, e.t))
         if ret_value == 4:
             raise Escape("A particle escaped (r>exit_max_distance).")
         if ret_value == 5:
@@ -1781,6 +2765,52 @@ class Simulation(Structure):
         """
         clibrebound.reb_integrator_reset(byref(self))
 
+    def integrator_synchronize_output(self):
+        """
+        Synchronizes the particle positions and velocities for output only.
+
+        For WHFast and SABA, the integrator keeps its unsynchronized state (as if
+        ``keep_unsynchronized`` was set), so the integration continues as if 
+        this function had not been called. This is useful for frequent outputs 
+        when symplectic correctors are used. For WHFast, the result is reused 
+        by all calls until the next step. For all other integrators, this is 
+        the same as ``integrator_synchronize()``.
+        """
+        clibrebound.reb_integrator_synchronize_output(byref(self))
+
+    def ias15_dense_output(self, t):
+        """
+        Returns the particles at time t without integrating to t.
+
+        This uses the interpolating polynomial of the last step accepted by IAS15. 
+        The time t needs to be within this step, i.e. between 
+        ``sim.t-sim.dt_last_done`` and ``sim.t``. The timestep is not changed. 
+        This allows for sampling a simulation at many times without shortening 
+        the steps as ``exact_finish_time=1`` would.
+
+        Returns
+        -------
+        A list of particles (copies) at time t.
+
+        Examples
+        --------
+
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1.e-3, a=1.)
+        >>> sim.step()
+        >>> ps = sim.ias15_dense_output(sim.t-0.5*sim.dt_last_done)
+        """
+        N = self.N
+        particles = (Particle*N)()
+        clibrebound.reb_integrator_ias15_dense_output.restype = c_int
+        ret = clibrebound.reb_integrator_ias15_dense_output(byref(self), c_double(t), particles)
+        if ret == 1:
+            raise RuntimeError("No dense output available. IAS15 needs to have completed a step with the current particles.")
+        if ret == 2:
+            raise ValueError("Time is outside of the last step.")
+        return list(particles)
+
     def integrator_synchronize(self):
         """
         Call this function if safe-mode is disabled and you need to synchronize particle positions and velocities between timesteps.
@@ -2040,9 +3070,10 @@ class reb_simulation_integrator_mercurius(Structure):
                 ("_allocatedN_additionalforces", c_uint),
                 ("_dcrit_allocatedN", c_uint),
                 ("_dcrit", POINTER(c_double)),
-                ("_particles_backup", POINTER(Particle)),
-                ("_particles_backup_additionalforces", POINTER(Particle)),
+                ("_particles_backup", c_void_p),
+                ("_particles_backup_additionalforces", c_void_p),
                 ("_encounter_map", POINTER(c_int)),
+                ("_encounter_group", POINTER(c_int)),
                 ("_com_pos", reb_vec3d),
                 ("_com_vel", reb_vec3d),
                 ]
@@ -2058,7 +3089,7 @@ class reb_simulation_integrator_mercurius(Structure):
         elif func == "C5":
             self._L = cast(clibrebound.reb_integrator_mercurius_L_C5,MERCURIUSLF)
         elif func == "infinity":
-            self._L = cast(clibrebound.reb_integrator_mercurius_L_minfinity,MERCURIUSLF)
+            self._L = cast(clibrebound.reb_integrator_mercurius_L_infinity,MERCURIUSLF)
         else:
             self._Lfp = MERCURIUSLF(func)
             self._L = self._Lfp
@@ -2088,6 +3119,8 @@ ODE._fields_ = [
                 ("_y0Dot", POINTER(c_double)),
                 ("_yDot", POINTER(c_double)),
                 ("_yTmp", POINTER(c_double)),
+                ("_yTmps", POINTER(POINTER(c_double))),
+                ("_yDots", POINTER(POINTER(c_double))),
                 ("_derivatives", CFUNCTYPE(None,POINTER(ODE), POINTER(c_double), POINTER(c_double), c_double)),
                 ("_getscale", CFUNCTYPE(None,POINTER(ODE), POINTER(c_double), POINTER(c_double))),
                 ("r", POINTER(Simulation)),
@@ -2115,25 +3148,273 @@ class reb_simulation_integrator_bs(Structure):
                 ("_previousRejected", c_int),
                 ("_targetIter", c_int),
                 ("_user_ode_needs_nbody", c_int),
+                ("parallel_columns", c_int),
+                ("parallel_odes", c_int),
             ]               
 
+class reb_simulation_integrator_hermite(Structure):
+    """
+    This class is an abstraction of the C-struct reb_simulation_integrator_hermite.
+    It controls the behaviour of the HERMITE integrator which uses individual 
+    block timesteps. Every particle uses a timestep dt/2^n, where dt is the 
+    timestep of the simulation and n is chosen for each particle separately.
+    
+    :ivar float eta:      
+        Accuracy parameter of the Aarseth timestep criterion (default: 0.02).
+    :ivar float eta_start:      
+        Accuracy parameter for the first step of each particle within a timestep (default: 0.01).
+    :ivar int particle_steps:      
+        Number of individual particle steps performed so far (for diagnostics).
+    """
+    _fields_ = [
+                ("eta", c_double),
+                ("eta_start", c_double),
+                ("particle_steps", c_ulonglong),
+                ("_level_warning", c_uint),
+                ("_additional_forces_warning", c_uint),
+                ("_allocated_N", c_int),
+                ("_p_pred", POINTER(Particle)),
+                ("_jerk", POINTER(reb_vec3d)),
+                ("_jerk_pred", POINTER(reb_vec3d)),
+                ("_level", POINTER(c_int)),
+                ("_t", POINTER(c_int64)),
+                ("_active", POINTER(c_int)),
+            ]
+
+class reb_force(Structure):
+    """
+    This class is an abstraction of the C-struct reb_force. 
+    It describes a force registered with Simulation.add_force().
+    """
+    _fields_ = [
+                ("_force", c_void_p),
+                ("istart", c_int),
+                ("iend", c_int),
+                ("velocity_dependent", c_uint),
+                ("data", c_void_p),
+            ]
+
+class reb_reduction(Structure):
+    """
+    This class is an abstraction of the C-struct reb_reduction. 
+    It describes a reduction registered with Simulation.add_reduction().
+    """
+    _fields_ = [
+                ("type", c_int),
+                ("field", c_int),
+                ("bin_field", c_int),
+                ("min", c_double),
+                ("max", c_double),
+                ("N_bins", c_int),
+                ("N_values", c_int),
+                ("_values", POINTER(c_double)),
+            ]
+
+class reb_simulation_integrator_leapfrog(Structure):
+    """
+    This class is an abstraction of the C-struct reb_simulation_integrator_leapfrog.
+    It controls the behaviour of the LEAPFROG integrator.
+    
+    :ivar int safe_mode:      
+        By default, safe_mode is on (1). Set to 0 (off) to combine the kick and 
+        the closing drift of one timestep with the opening drift of the next one.
+        Each timestep then requires only one pass over all particles. 
+        Positions and velocities are only synchronized when synchronize() is called.
+
+    Example usage:
+    
+    >>> sim = rebound.Simulation()
+    >>> sim.integrator = "leapfrog"
+    >>> sim.ri_leapfrog.safe_mode = 0
+    """
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, safe_mode={3}, is_synchronized={4}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.safe_mode, self.is_synchronized)
+    _fields_ = [
+                ("safe_mode", c_uint),
+                ("is_synchronized", c_uint),
+            ]
+
 class timeval(Structure):
     _fields_ = [("tv_sec",c_long),("tv_usec",c_long)]
 
+REB_PROFILING_CAT_NUM = 13
+REB_PROFILING_DEPTH_MAX = 16
+
+class reb_profiling_scope(Structure):
+    _fields_ = [("start", c_double),
+                ("children", c_double)]
+
+class reb_profiling(Structure):
+    """
+    Mirrors the C struct reb_profiling which holds the timing data
+    of the runtime profiler. See Simulation.profiling.
+    """
+    _fields_ = [("time", c_double*REB_PROFILING_CAT_NUM),
+                ("time_self", c_double*REB_PROFILING_CAT_NUM),
+                ("calls", c_ulonglong*REB_PROFILING_CAT_NUM),
+                ("time_start", c_double),
+                ("depth", c_int),
+                ("output_timing_lines", c_int),
+                ("stack", reb_profiling_scope*REB_PROFILING_DEPTH_MAX)]
+
+REB_COUNTERS_ENCOUNTER_BINS = 16
+
+class reb_diagnostics(Structure):
+    """
+    Energy and angular momentum of a simulation. See `Simulation.calculate_diagnostics`.
+    `energy` includes the energy offset.
+    """
+    _fields_ = [("energy", c_double),
+                ("energy_kinetic", c_double),
+                ("energy_potential", c_double),
+                ("angular_momentum", reb_vec3d)]
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, energy={3}, energy_kinetic={4}, energy_potential={5}, angular_momentum=({6}, {7}, {8})>'.format(self.__module__, type(self).__name__, hex(id(self)), self.energy, self.energy_kinetic, self.energy_potential, self.angular_momentum.x, self.angular_momentum.y, self.angular_momentum.z)
+
+class reb_encounter(Structure):
+    """
+    Pair of particles which caused the simulation to exit because their 
+    distance fell below `exit_min_distance`. See `Simulation.exit_encounter`.
+
+    The particles are assumed to move on straight lines during the last
+    timestep to interpolate the time `t` at which the distance fell below
+    `exit_min_distance` and the minimum distance `d`.
+    """
+    _fields_ = [("p1", c_int),
+                ("p2", c_int),
+                ("t", c_double),
+                ("d", c_double)]
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, p1={3}, p2={4}, t={5}, d={6}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.p1, self.p2, self.t, self.d)
+
+class PararealResult(Structure):
+    """
+    Result of Simulation.integrate_parareal().
+
+    Attributes
+    ----------
+    iterations : int
+        Number of Parareal iterations. Each iteration integrates the remaining time slices in parallel.
+    error : float
+        Largest relative change of the state at the start of a time slice in the last iteration.
+    converged : int
+        1 if the error is below the tolerance or if all slices have been integrated with the fine propagator.
+    walltime : float
+        Walltime in seconds.
+    """
+    _fields_ = [("iterations", c_int),
+                ("error", c_double),
+                ("converged", c_int),
+                ("walltime", c_double)]
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, iterations={3}, error={4}, converged={5}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.iterations, self.error, self.converged)
+
+class TuneResult(Structure):
+    """
+    Result of one pilot integration of Simulation.tune().
+
+    Attributes
+    ----------
+    value : float
+        Value of the parameter.
+    error : float
+        Largest relative energy error during the pilot integration.
+    walltime : float
+        Walltime spent on the pilot integration in seconds (without the energy calculations).
+    t : float
+        Time at the end of the pilot integration. The pilot stops early if the error target is exceeded.
+    status : int
+        Exit status of the pilot integration (see Simulation.integrate()).
+    """
+    _fields_ = [("value", c_double),
+                ("error", c_double),
+                ("walltime", c_double),
+                ("t", c_double),
+                ("status", c_int)]
+    def __repr__(self):
+        return '<{0}.{1} object at {2}, value={3}, error={4}, walltime={5}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.value, self.error, self.walltime)
+
+class reb_counters(Structure):
+    """
+    Counters of the work done during the integration. See `Simulation.counters`.
+
+    :ivar int gravity_interactions:
+        Particle-particle and particle-cell force evaluations. Pairs in direct summation are counted once per ghost box.
+    :ivar int tree_cells_opened:
+        Tree cells opened during the force calculation of the tree and FMM gravity routines.
+    :ivar int ias15_iterations:
+        Predictor corrector iterations of IAS15.
+    :ivar int ias15_steps_rejected:
+        Steps rejected by IAS15 because the error estimate was too large.
+    :ivar int ias15_gravity_reused:
+        Substeps of the IAS15 predictor corrector loop in which gravity was reused (see ri_ias15.reuse_gravity).
+    :ivar int bs_steps_rejected:
+        Steps rejected by the BS integrator.
+    :ivar int mercurius_encounter_steps:
+        Timesteps in which MERCURIUS integrated at least one close encounter with IAS15.
+    :ivar list mercurius_encounter_N:
+        Histogram of encounterN (including the central object). Bin k counts steps with 2^k <= encounterN < 2^(k+1).
+    :ivar int collisions_detected:
+        Collisions found by the collision search.
+    :ivar int collisions_resolved:
+        Collisions passed on to the collision resolve function.
+    :ivar int kepler_solves:
+        Orbits advanced by the WHFast Kepler solver.
+    :ivar int kepler_iterations:
+        Iterations of the WHFast Kepler solver.
+    :ivar int kepler_bisections:
+        Orbits for which the WHFast Kepler solver fell back to bisection.
+    :ivar int collision_verlet_builds:
+        Neighbour lists built by the verlet and lineverlet collision searches.
+    :ivar int tree_lists_reused:
+        Kept interaction lists of groups which have been reused (see ``tree_list_interval``).
+    :ivar int tree_fused_searches:
+        Collision searches which used the candidate pairs collected during the gravity tree walk (see ``tree_fused_walk``).
+    """
+    _fields_ = [("gravity_interactions", c_ulonglong),
+                ("tree_cells_opened", c_ulonglong),
+                ("ias15_iterations", c_ulonglong),
+                ("ias15_steps_rejected", c_ulonglong),
+                ("ias15_gravity_reused", c_ulonglong),
+                ("bs_steps_rejected", c_ulonglong),
+                ("mercurius_encounter_steps", c_ulonglong),
+                ("mercurius_encounter_N", c_ulonglong*REB_COUNTERS_ENCOUNTER_BINS),
+                ("collisions_detected", c_ulonglong),
+                ("collisions_resolved", c_ulonglong),
+                ("kepler_solves", c_ulonglong),
+                ("kepler_iterations", c_ulonglong),
+                ("kepler_bisections", c_ulonglong),
+                ("collision_verlet_builds", c_ulonglong),
+                ("tree_lists_reused", c_ulonglong),
+                ("tree_fused_searches", c_ulonglong)]
+
+    def __repr__(self):
+        s = "<rebound.reb_counters"
+        for name, _ in self._fields_:
+            v = getattr(self, name)
+            if name=="mercurius_encounter_N":
+                v = list(v)
+            s += " %s=%s"%(name, v)
+        return s + ">"
+
 class reb_display_data(Structure):
     _fields_ = [("r", POINTER(Simulation)),
                 ("r_copy", POINTER(Simulation)),
                 ("particle_data", c_void_p),
                 ("orbit_data", c_void_p),
-                ("particles_copy", POINTER(Particle)),
-                ("p_jh_copy", POINTER(Particle)),
                 ("allocated_N", c_ulong),
-                ("allocated_N_whfast", c_ulong),
-                ("opengl_enabled", c_int),
+                ("N_draw", c_uint),
+                ("N_orbits_draw", c_uint),
+                ("opengl_enabled", c_uint),
                 ("scale", c_double),
                 ("mouse_x", c_double),
                 ("mouse_y", c_double),
                 ("retina", c_double),
+                ("frame", c_void_p),
+                ("frame_size", c_ulong),
+                ("frame_allocated", c_ulong),
+                ("frame_clock", c_ulong),
+                ("frame_interval", c_uint),
                 # ignoring other data (never used)
                 ]
 
@@ -2161,24 +3442,66 @@ Simulation._fields_ = [
                 ("_particles", POINTER(Particle)),
                 ("gravity_cs", POINTER(reb_vec3d)),
                 ("gravity_cs_allocatedN", c_int),
+                ("_particles_soa", reb_particles_soa),
+                ("_gravity_omp_a", POINTER(c_double)),
+                ("_gravity_omp_a_allocatedN", c_int),
+                ("_gravity_var_pairs", POINTER(c_double)),
+                ("_gravity_var_pairs_allocatedN", c_size_t),
+                ("_gravity_ghostboxes", POINTER(c_double)),
+                ("_gravity_ghostboxes_allocatedN", c_int),
                 ("_tree_root", c_void_p),
                 ("_tree_needs_update", c_int),
+                ("_tree_pool_blocks", c_void_p),
+                ("_tree_pool_N_blocks", c_int),
+                ("_tree_pool_block", c_int),
+                ("_tree_pool_N_used", c_int),
+                ("_tree_pool_free", c_void_p),
+                ("tree_sort", c_int),
+                ("_tree_sort_buffer", c_void_p),
+                ("_tree_sort_allocatedN", c_int),
+                ("_tree_cell_id", c_ulonglong),
+                ("_tree_lists", c_void_p),
                 ("opening_angle2", c_double),
                 ("_status", c_int),
                 ("exact_finish_time", c_int),
+                ("_integrate_resumable", c_int),
+                ("_integrate_tmax", c_double),
+                ("_integrate_last_full_dt", c_double),
                 ("force_is_velocity_dependent", c_uint),
                 ("gravity_ignore", c_uint),
+                ("gravity_tile_size", c_int),
+                ("gravity_ghostbox_tolerance", c_double),
+                ("gravity_testparticle_float", c_uint),
+                ("N_interaction_groups", c_int),
+                ("_interaction_groups", POINTER(c_uint64)),
+                ("omp_persistent_team", c_int),
+                ("fmm_order", c_uint),
+                ("tree_group_size", c_int),
+                ("tree_order", c_uint),
+                ("tree_list_interval", c_int),
+                ("tree_list_margin", c_double),
+                ("tree_fused_walk", c_int),
+                ("auto_select_interval", c_int),
+                ("auto_select_opening_angle2", c_double),
+                ("gravity_fft_nx", c_int),
+                ("gravity_fft_ny", c_int),
+                ("_gravity_fft", c_void_p),
                 ("_output_timing_last", c_double),
                 ("_display_clock", c_ulong),
                 ("save_messages", c_int),
                 ("messages", c_void_p),
                 ("exit_max_distance", c_double),
                 ("exit_min_distance", c_double),
+                ("exit_encounter", reb_encounter),
                 ("usleep", c_double),
                 ("display_data", POINTER(reb_display_data)),
                 ("track_energy_offset", c_int),
                 ("energy_offset", c_double),
                 ("walltime", c_double),
+                ("_profiling", POINTER(reb_profiling)),
+                ("counters", reb_counters),
+                ("_trace", c_void_p),
+                ("_recorder", c_void_p),
                 ("python_unit_t",c_uint32),
                 ("python_unit_l",c_uint32),
                 ("python_unit_m",c_uint32),
@@ -2195,6 +3518,10 @@ Simulation._fields_ = [
                 ("collision_resolve_keep_sorted", c_int),
                 ("collisions", c_void_p),
                 ("collisions_allocatedN", c_int),
+                ("_collision_sweep_order", c_void_p),
+                ("_collision_sweep_N", c_int),
+                ("_collision_verlet", c_void_p),
+                ("collision_verlet_skin", c_double),
                 ("minimum_collision_velocity", c_double),
                 ("collisions_plog", c_double),
                 ("max_radius", c_double*2),
@@ -2209,6 +3536,8 @@ Simulation._fields_ = [
                 ("_megno_n", c_long),
                 ("rand_seed",c_uint),
                 ("simulationarchive_version", c_int),
+                ("simulationarchive_compression", c_int),
+                ("simulationarchive_physical_only", c_int),
                 ("simulationarchive_size_first", c_long),
                 ("simulationarchive_size_snapshot", c_long),
                 ("simulationarchive_auto_interval", c_double),
@@ -2217,6 +3546,13 @@ Simulation._fields_ = [
                 ("simulationarchive_next", c_double),
                 ("simulationarchive_next_step", c_ulonglong),
                 ("_simulationarchive_filename", c_char_p),
+                ("simulationarchive_async", c_int),
+                ("_simulationarchive_writer", c_void_p),
+                ("_simulationarchive_cache", c_void_p),
+                ("simulationarchive_checkpoint_walltime", c_double),
+                ("simulationarchive_checkpoint_next", c_double),
+                ("simulationarchive_checkpoint_N", c_int),
+                ("_simulationarchive_checkpoint_filename", c_char_p),
                 ("_visualization", c_int),
                 ("_collision", c_int),
                 ("_integrator", c_int),
@@ -2230,11 +3566,20 @@ Simulation._fields_ = [
                 ("ri_janus", reb_simulation_integrator_janus),
                 ("ri_eos", reb_simulation_integrator_eos),
                 ("ri_bs", reb_simulation_integrator_bs),
+                ("ri_hermite", reb_simulation_integrator_hermite),
+                ("ri_leapfrog", reb_simulation_integrator_leapfrog),
                 ("_odes", POINTER(POINTER(ODE))),
                 ("_odes_N", c_int),
                 ("_odes_allocatedN", c_int),
                 ("_odes_warnings", c_int),
+                ("heartbeat_steps", c_uint),
                 ("_additional_forces", CFUNCTYPE(None,POINTER(Simulation))),
+                ("_forces", POINTER(reb_force)),
+                ("_forces_N", c_int),
+                ("_forces_allocatedN", c_int),
+                ("_reductions", POINTER(reb_reduction)),
+                ("_reductions_N", c_int),
+                ("_reductions_allocatedN", c_int),
                 ("_pre_timestep_modifications", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_post_timestep_modifications", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_heartbeat", CFUNCTYPE(None,POINTER(Simulation))),
@@ -2260,11 +3605,13 @@ Particle._fields_ = [("x", c_double),
                 ("lastcollision", c_double),
                 ("c", c_void_p),
                 ("_hash", c_uint32),
+                ("group", c_uint32),
                 ("ap", c_void_p),
                 ("_sim", POINTER(Simulation))]
 
 POINTER_REB_SIM = POINTER(Simulation) 
 AFF = CFUNCTYPE(None,POINTER_REB_SIM)
+FORCEF = CFUNCTYPE(None,POINTER_REB_SIM, POINTER(reb_force), POINTER(reb_particles_soa), c_int, c_int)
 ODEDER = CFUNCTYPE(None,POINTER(ODE), POINTER(c_double), POINTER(c_double), c_double)
 ODESCALE = CFUNCTYPE(None,POINTER(ODE), POINTER(c_double), POINTER(c_double))
 CORFF = CFUNCTYPE(c_double,POINTER_REB_SIM, c_double)
@@ -2341,6 +3688,121 @@ class Particles(MutableMapping):
     def __len__(self):
         return self.sim.N
 
+class ParticleDataView(object):
+    """
+    Zero-copy numpy views onto the particles array of a simulation.
+
+    The arrays `xyz`, `vxvyvz` and `axayaz` have the shape (N,3), the 
+    arrays `m`, `r` and `hash` have the shape (N,). They are strided views 
+    directly into the memory of `sim.particles`. No data is copied.
+    Use `Simulation.particle_data_view()` to create a view.
+
+    The views become invalid whenever the particles array is reallocated 
+    or the number of particles changes, for example when particles are 
+    added or removed. Accessing an array through an invalid view raises a 
+    RuntimeError. Do not keep references to the arrays themselves 
+    beyond such a change.
+
+    If the view is writeable, call `commit()` after modifying particles 
+    (or use the view as a context manager). This sets the flags which 
+    tell the integrators to recalculate their internal coordinates.
+    """
+    _fields = {"xyz": ("x", 3), "vxvyvz": ("vx", 3), "axayaz": ("ax", 3), "m": ("m", 1), "r": ("r", 1), "hash": ("_hash", 1)}
+
+    def __init__(self, sim, readonly=False):
+        self._sim = sim
+        self.readonly = readonly
+        self._address, self._N = self._state()
+        self._arrays = {}
+
+    def _state(self):
+        if self._sim.N == 0:
+            return None, 0
+        return ctypes.addressof(self._sim._particles.contents), self._sim.N
+
+    @property
+    def valid(self):
+        """
+        False if the particles array has been reallocated or resized since the view was created.
+        """
+        return self._state() == (self._address, self._N)
+
+    def _array(self, name):
+        import numpy as np
+        if not self.valid:
+            raise RuntimeError("The particles array has been reallocated or resized. Create a new view with sim.particle_data_view().")
+        if name not in self._arrays:
+            field, n = self._fields[name]
+            size = ctypes.sizeof(Particle)
+            dtype = np.uint32 if name == "hash" else np.float64
+            shape, strides = ((self._N, n), (size, 8)) if n > 1 else ((self._N,), (size,))
+            if self._N == 0:
+                a = np.zeros(shape, dtype=dtype)
+            else:
+                buf = (ctypes.c_char*(self._N*size)).from_address(self._address)
+                a = np.ndarray(shape=shape, dtype=dtype, buffer=buf, offset=getattr(Particle, field).offset, strides=strides)
+            if self.readonly:
+                a.flags.writeable = False
+            self._arrays[name] = a
+        return self._arrays[name]
+
+    def __getattr__(self, name):
+        if name in ParticleDataView._fields:
+            return self._array(name)
+        raise AttributeError(name)
+
+    def soa(self):
+        """
+        Returns a dictionary with read-only views of the structure-of-arrays 
+        mirror (x, y, z, vx, vy, vz, m, ax, ay, az) used by the vectorized 
+        gravity kernels. The mirror is only updated when these kernels run, 
+        so its content may lag behind the particles array. Returns None if 
+        the mirror has not been allocated.
+        """
+        import numpy as np
+        soa = self._sim._particles_soa
+        if soa.N == 0 or not soa.x:
+            return None
+        d = {}
+        for k in ["x", "y", "z", "vx", "vy", "vz", "m", "ax", "ay", "az"]:
+            a = np.ctypeslib.as_array(getattr(soa, k), shape=(soa.N,))
+            a.flags.writeable = False
+            d[k] = a
+        return d
+
+    def commit(self):
+        """
+        Tells the integrators that particles have been modified through this view.
+        """
+        if self.readonly:
+            raise RuntimeError("Cannot commit changes of a read-only view.")
+        sim = self._sim
+        sim.ri_whfast.recalculate_coordinates_this_timestep = 1
+        sim.ri_mercurius.recalculate_coordinates_this_timestep = 1
+        sim.ri_mercurius.recalculate_dcrit_this_timestep = 1
+        sim.ri_janus.recalculate_integer_coordinates_this_timestep = 1
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        if not self.readonly and exc_type is None:
+            self.commit()
+
+class SimulationState(object):
+    """
+    Storage for the mutable state of a simulation. 
+    Use `Simulation.save_state()` and `Simulation.restore_state()`.
+    """
+    def __init__(self):
+        clibrebound.reb_simulation_state_create.restype = c_void_p
+        self._ptr = c_void_p(clibrebound.reb_simulation_state_create(None))
+
+    def __del__(self):
+        if self._ptr:
+            clibrebound.reb_simulation_state_free(self._ptr)
+            self._ptr = None
+
 # Import at the end to avoid circular dependence
 from . import horizons
 from . import data
@@ -1,4 +1,4 @@
-from ctypes import Structure, c_double, POINTER, c_float, c_int, c_uint, c_uint32, c_int64, c_long, c_ulong, c_ulonglong, c_void_p, c_char_p, CFUNCTYPE, byref, create_string_buffer, addressof, pointer, cast
+from ctypes import Structure, c_double, POINTER, c_float, c_int, c_uint, c_uint32, c_uint64, c_size_t, c_int64, c_long, c_ulong, c_ulonglong, c_void_p, c_char_p, CFUNCTYPE, byref, create_string_buffer, addressof, pointer, cast
 from .simulation import Simulation, BINARY_WARNINGS
 from . import clibrebound 
 import os
@@ -8,6 +8,9 @@ import warnings
 
 POINTER_REB_SIM = POINTER(Simulation) 
 
+# Order corresponds to the C enum REB_SAEXPORT_FIELD
+SAEXPORT_FIELDS = ["m", "x", "y", "z", "vx", "vy", "vz", "a", "e", "inc", "Omega", "omega", "pomega", "f", "M", "l"]
+
 class SimulationArchive(Structure):
     """
     SimulationArchive Class.
@@ -54,8 +57,13 @@ class SimulationArchive(Structure):
                 ("auto_walltime", c_double), 
                 ("auto_step", c_ulonglong), 
                 ("nblobs", c_long), 
-                ("offset", POINTER(c_uint32)), 
-                ("t", POINTER(c_double)) 
+                ("offset", POINTER(c_uint64)), 
+                ("t", POINTER(c_double)),
+                ("_mmap_data", c_void_p),
+                ("_mmap_size", c_size_t),
+                ("_mmap_pos", c_size_t),
+                ("_cache_simulation", c_void_p),
+                ("_cache_snapshot", c_long),
                 ]
     def __repr__(self):
         return '<{0}.{1} object at {2}, nblobs={3}>'.format(self.__module__, type(self).__name__, hex(id(self)), self.nblobs)
@@ -83,6 +91,7 @@ class SimulationArchive(Structure):
         self.setup = setup
         self.setup_args = setup_args
         self.process_warnings = process_warnings
+        self._exact_cache = None
         w = c_int(0)
         if reuse_index:
             # Optimized loading
@@ -149,6 +158,56 @@ class SimulationArchive(Structure):
 
         return sim
     
+    def load_snapshot(self, sim, key):
+        """
+        Loads a snapshot into an existing simulation instead of creating 
+        a new one. The allocations of the simulation are reused. This is
+        much faster when iterating over many snapshots.
+
+        If the simulation contains another snapshot of this archive (loaded 
+        with this function) and has not been integrated since, only the fields 
+        which differ between the two snapshots are read. Do not modify the 
+        particles in-between calls. Function pointers and settings not stored 
+        in the archive are kept and the setup function is not called again.
+
+        Arguments
+        ---------
+        sim : rebound.Simulation
+            Simulation into which the snapshot is loaded.
+        key : int
+            Index of the snapshot.
+
+        Examples
+        --------
+
+        >>> sa = rebound.SimulationArchive("archive.bin")
+        >>> sim = sa[0]
+        >>> for i in range(len(sa)):
+        >>>     sa.load_snapshot(sim, i)
+        >>>     print(sim.t, sim.particles[1].x)
+
+        """
+        if key < 0:
+            key += len(self)
+        if key>= len(self) or key<0:
+            raise IndexError("Index out of range, number of snapshots stored in binary: %d."%len(self))
+        loaded = -1
+        previous = getattr(sim, "_simulationarchive_loaded", None)
+        if previous is not None and previous[0] == id(self) and sim.t == self.t[previous[1]] and sim.steps_done == previous[2]:
+            loaded = previous[1]
+        w = c_int(0)
+        clibrebound.reb_load_simulation_from_simulationarchive_with_messages(byref(sim), byref(self), c_long(key), c_long(loaded), byref(w))
+        sim._simulationarchive_loaded = (id(self), key, sim.steps_done)
+        for majorerror, value, message in BINARY_WARNINGS:
+            if w.value & value:
+                if majorerror:
+                    sim._simulationarchive_loaded = None
+                    raise RuntimeError(message)
+                else:  
+                    # Just a warning
+                    if self.process_warnings:
+                        warnings.warn(message, RuntimeWarning)
+
     def __setitem__(self, key, value):
         raise AttributeError("Cannot modify SimulationArchive.")
 
@@ -197,7 +256,7 @@ class SimulationArchive(Structure):
             There are three options. 
             - 'snapshot' This loads a nearby snapshot such that sim.t<t. This is the default.
             - 'close' This integrates the simulation to get to the time t but may overshoot by at most one timestep sim.dt.
-            - 'exact' This integrates the simulation to exactly time t. This is not compatible with keep_unsynchronized=1. 
+            - 'exact' This integrates the simulation to exactly time t. This is not compatible with keep_unsynchronized=1. The archive keeps the simulation it integrated. If the next requested time is later and there is no snapshot in-between, the integration continues from there. The result is bitwise the same as integrating from the snapshot.
         keep_unsynchronized : int
             By default this argument is 1. This means that if the simulation had to be synchronized to generate this output, then it will nevertheless use the unsynchronized values if one integrates the simulation further in time. This is important for exact (bit-by-bit) reproducibility. If the value of this argument is 0, then one can modify the particles coordinates and these changes are taken into account when integrating the simulation further in time.
         
@@ -224,6 +283,8 @@ class SimulationArchive(Structure):
             raise AttributeError("Unknown mode.")
 
         bi, bt = self._getSnapshotIndex(t)
+        if mode=='exact':
+            return self._getSimulationExact(t, bi)
         sim = Simulation()
         w = c_int(0)
         clibrebound.reb_create_simulation_from_simulationarchive_with_messages(byref(sim),byref(self),bi,byref(w))
@@ -240,17 +301,43 @@ class SimulationArchive(Structure):
             sim.integrator_synchronize()
             return sim
         else:
-            if mode=='exact':
-                keep_unsynchronized = 0
             if (sim.integrator=="mercurius" and sim.ri_mercurius.safe_mode == 1) or (sim.integrator=="whfast" and sim.ri_whfast.safe_mode == 1) or (sim.integrator=="saba" and sim.ri_saba.safe_mode == 1):
                 keep_unsynchronized = 0
             sim.ri_whfast.keep_unsynchronized = keep_unsynchronized
             sim.ri_saba.keep_unsynchronized = keep_unsynchronized
-            exact_finish_time = 1 if mode=='exact' else 0
-            sim.integrate(t,exact_finish_time=exact_finish_time)
+            sim.integrate(t,exact_finish_time=0)
                 
             return sim
 
+    def _createSimulationExact(self, bi):
+        sim = Simulation()
+        w = c_int(0)
+        clibrebound.reb_create_simulation_from_simulationarchive_with_messages(byref(sim),byref(self),bi,byref(w))
+        if self.setup:
+            self.setup(sim, *self.setup_args)
+        sim.ri_whfast.keep_unsynchronized = 0
+        sim.ri_saba.keep_unsynchronized = 0
+        return sim
+
+    def _getSimulationExact(self, t, bi):
+        # The simulation kept in _exact_cache only takes full timesteps, so it 
+        # can be reused for any later time before the next snapshot. The 
+        # shortened last timestep is taken on a copy.
+        # See reb_simulationarchive_get_simulation_exact().
+        if self._exact_cache is None or self._exact_cache[0]!=bi or (self._exact_cache[1].t-t)*math.copysign(1.,self._exact_cache[1].dt)>0.:
+            self._exact_cache = (bi, self._createSimulationExact(bi))
+        cache = self._exact_cache[1]
+        if clibrebound.reb_simulationarchive_integrate_full_steps(byref(cache), c_double(t)):
+            # Integration stopped early. Raise the same exception as without the cache.
+            self._exact_cache = None
+            sim = self._createSimulationExact(bi)
+        else:
+            sim = cache.copy()
+            if self.setup:
+                self.setup(sim, *self.setup_args)
+        sim.integrate(t,exact_finish_time=1)
+        return sim
+
 
     def getSimulations(self, times, **kwargs):
         """
@@ -260,6 +347,136 @@ class SimulationArchive(Structure):
         for t in times:
             yield self.getSimulation(t, **kwargs)
 
+
+    def serialize_particle_data(self, snapshots, N=None, threads=0, **kwargs):
+        """
+        Fast way to load the particle data of many snapshots.
+
+        The snapshots are decoded in parallel on the C side without
+        creating a simulation object for each snapshot. The first 
+        snapshot is decoded only once and reused for all snapshots.
+        Snapshots which are not synchronized are synchronized before 
+        the particle data is copied.
+        
+        The function expects correctly sized arrays as arguments, just 
+        like Simulation.serialize_particle_data(). Possible argument 
+        names are "m", "xyz" and "vxvyvz". The arrays need to have a
+        datatype of float64 and a length of at least len(snapshots)*N
+        (3*len(snapshots)*N for "xyz" and "vxvyvz"). 
+
+        Arguments
+        ---------
+        snapshots : list of int
+            Indices of the snapshots to load. 
+        N : int, optional
+            Number of particles in each snapshot. By default, this is 
+            the number of particles in the first snapshot.
+        threads : int, optional
+            Number of threads. By default, one thread per processor is used.
+
+        Examples
+        --------
+        This loads the positions of all particles in all snapshots:
+
+        >>> import numpy as np
+        >>> sa = rebound.SimulationArchive("archive.bin")
+        >>> N = sa[0].N
+        >>> xyz = np.zeros((len(sa),N,3),dtype="float64")
+        >>> sa.serialize_particle_data(range(len(sa)), xyz=xyz)
+
+        """
+        snapshots = list(snapshots)
+        if N is None:
+            N = self[0].N
+        Ns = len(snapshots)
+        d = {x:None for x in ["m","xyz","vxvyvz"]}
+        for k,v in kwargs.items():
+            if k not in d:
+                raise AttributeError("Only '%s' are currently supported attributes for serialization." % "', '".join(d.keys()))
+            minsize = Ns*N if k=="m" else 3*Ns*N
+            if hasattr(v, "ctypes"): # numpy array
+                if v.dtype!= "float64":
+                    raise AttributeError("Expected 'float64' data type for %s array."%k)
+                if v.size<minsize:
+                    raise AttributeError("Array '%s' is not large enough."%k)
+                d[k] = v.ctypes.data_as(POINTER(c_double))
+            else: # ctypes array
+                if len(v)<minsize:
+                    raise AttributeError("Array '%s' is not large enough."%k)
+                d[k] = cast(v, POINTER(c_double))
+        s = (c_long*Ns)(*snapshots)
+        clibrebound.reb_simulationarchive_serialize_particle_data.restype = c_int
+        w = clibrebound.reb_simulationarchive_serialize_particle_data(byref(self), s, c_int(Ns), c_int(N), c_int(threads), d["m"], d["xyz"], d["vxvyvz"])
+        for majorerror, value, message in BINARY_WARNINGS:
+            if w & value:
+                if majorerror:
+                    raise RuntimeError(message)
+                else:  
+                    # Just a warning
+                    if self.process_warnings:
+                        warnings.warn(message, RuntimeWarning)
+
+    def export(self, filename, fields=("x","y","z"), order="time", threads=0, memmap=True):
+        """
+        Exports particle data of all snapshots to a binary file.
+
+        The SimulationArchive is read only once and in chunks, so the 
+        memory used does not depend on the number of snapshots. The file
+        contains one contiguous array of float64 values per field, in
+        the order given by `fields`. Variational particles are not exported.
+
+        Arguments
+        ---------
+        filename : str
+            Name of the output file. An existing file is overwritten.
+        fields : list of str
+            Any of "m", "x", "y", "z", "vx", "vy", "vz" and the orbital 
+            elements "a", "e", "inc", "Omega", "omega", "pomega", "f", 
+            "M", "l". Orbital elements are calculated in Jacobi 
+            coordinates. They are NaN for the first particle.
+        order : str
+            If "time" (default), each array has the shape (len(sa), N).
+            If "particle", each array has the shape (N, len(sa)).
+        threads : int, optional
+            Number of threads used to decode snapshots. By default, one
+            thread per processor is used.
+        memmap : bool, optional
+            If True (default), returns a dictionary with a numpy.memmap for 
+            each field. Otherwise, nothing is returned.
+
+        Examples
+        --------
+        
+        >>> sa = rebound.SimulationArchive("archive.bin")
+        >>> data = sa.export("archive.npy", fields=["a","e"])
+        >>> print(data["a"][:,1]) # semi-major axis of particle 1 in all snapshots
+
+        """
+        fields = list(fields)
+        if order not in ["time", "particle"]:
+            raise AttributeError("Unknown order.")
+        f = (c_int*len(fields))()
+        for k, field in enumerate(fields):
+            if field not in SAEXPORT_FIELDS:
+                raise AttributeError("Unknown field '%s'. Supported fields are '%s'." % (field, "', '".join(SAEXPORT_FIELDS)))
+            f[k] = SAEXPORT_FIELDS.index(field)
+        clibrebound.reb_simulationarchive_export.restype = c_int
+        w = clibrebound.reb_simulationarchive_export(byref(self), c_char_p(filename.encode("ascii")), f, c_int(len(fields)), c_int(order=="particle"), c_int(threads))
+        for majorerror, value, message in BINARY_WARNINGS:
+            if w & value:
+                if majorerror:
+                    raise RuntimeError(message)
+                else:  
+                    # Just a warning
+                    if self.process_warnings:
+                        warnings.warn(message, RuntimeWarning)
+        if memmap:
+            import numpy as np
+            sim = self[0]
+            N = sim.N - sim.N_var
+            shape = (len(self), N) if order=="time" else (N, len(self))
+            data = np.memmap(filename, dtype="float64", mode="r", shape=(len(fields),)+shape)
+            return {field: data[k] for k, field in enumerate(fields)}
     
     def getBezierPaths(self,origin=None):
         """
@@ -354,3 +571,100 @@ class SimulationArchive(Structure):
         codes = np.full(Npoints,4,dtype=np.uint8) # Hardcoded 4 = matplotlib.path.Path.CURVE4
         codes[0] = 1 # Hardcoded 1 = matplotlib.path.Path.MOVETO
         return verts, codes
+
+
+class SimulationArchiveStream(object):
+    """
+    Snapshots written to or read from a pipe, a socket or any other file descriptor.
+
+    A stream is written forward-only. Nothing is ever written twice, so
+    it does not need to be seekable. The first snapshot is the full binary,
+    later snapshots are stored as differences to the first one, exactly as in
+    a SimulationArchive file. Data saved from a stream is a valid SimulationArchive.
+    The reading side loads every snapshot as soon as it has arrived.
+
+    Examples
+    --------
+    On the compute node:
+
+    >>> stream = rebound.SimulationArchiveStream(sock)
+    >>> for t in times:
+    >>>     sim.integrate(t)
+    >>>     stream.write(sim)
+
+    On the analysis node:
+
+    >>> for sim in rebound.SimulationArchiveStream(sock):
+    >>>     print(sim.t, sim.particles[1].a)
+
+    """
+    def __init__(self, f):
+        """
+        Arguments
+        ---------
+        f : int or file-like object
+            An open file descriptor or an object with a fileno() method 
+            such as a socket or a file. It is not closed by the stream. 
+            A stream should be used either for writing or for reading.
+        """
+        self._f = f # Keep a reference so the file is not closed
+        fd = f if isinstance(f, int) else f.fileno()
+        clibrebound.reb_simulationarchive_stream_create.restype = c_void_p
+        self._s = c_void_p(clibrebound.reb_simulationarchive_stream_create(c_int(fd)))
+
+    def write(self, sim):
+        """
+        Writes a snapshot of the simulation sim to the stream.
+        """
+        clibrebound.reb_simulationarchive_stream_write(self._s, byref(sim))
+        sim.process_messages()
+
+    def read(self):
+        """
+        Waits for the next snapshot and returns it as a new simulation.
+        Returns None at the end of the stream. For a non-blocking file 
+        descriptor, BlockingIOError is raised if no complete snapshot is 
+        available yet.
+        """
+        sim = Simulation()
+        w = c_int(0)
+        ret = clibrebound.reb_simulationarchive_stream_read_with_messages(self._s, byref(sim), byref(w))
+        for majorerror, value, message in BINARY_WARNINGS:
+            if w.value & value:
+                if majorerror:
+                    raise RuntimeError(message)
+                else:
+                    # Just a warning
+                    warnings.warn(message, RuntimeWarning)
+        if ret==-1:
+            if sys.version_info[0] < 3:
+                raise IOError("No complete snapshot available.")
+            raise BlockingIOError("No complete snapshot available.")
+        if ret==0:
+            return None
+        return sim
+
+    def __iter__(self):
+        while True:
+            sim = self.read()
+            if sim is None:
+                return
+            yield sim
+
+    def close(self):
+        """
+        Frees the stream. The file descriptor is not closed.
+        """
+        if self._s:
+            clibrebound.reb_simulationarchive_stream_free(self._s)
+            self._s = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        if getattr(self, "_s", None):
+            self.close()
@@ -20,6 +20,32 @@ class TestAdditionalForces(unittest.TestCase):
         sim.integrate(10.)
         self.assertAlmostEqual(sim.particles[2].a,4.86583,delta=1e-5)
 
+    def test_af_ias15_reuse_gravity(self):
+        def af(sim):
+            fac = 0.01
+            sim.contents.particles[2].ax -= fac*sim.contents.particles[2].vx
+            sim.contents.particles[2].ay -= fac*sim.contents.particles[2].vy
+            sim.contents.particles[2].az -= fac*sim.contents.particles[2].vz
+        sims = []
+        for reuse_gravity in [1, 0]:
+            sim = rebound.Simulation()
+            sim.integrator = "ias15"
+            sim.ri_ias15.reuse_gravity = reuse_gravity
+            sim.force_is_velocity_dependent = 1
+            sim.add(m=1)
+            sim.add(m=1e-6,a=1)
+            sim.add(m=1e-3,a=5)
+            sim.move_to_com()
+            sim.additional_forces = af
+            sim.integrate(10.)
+            sims.append(sim)
+        self.assertGreater(sims[0].counters.ias15_gravity_reused, 0)
+        self.assertEqual(sims[1].counters.ias15_gravity_reused, 0)
+        self.assertEqual(sims[0].counters.ias15_iterations, sims[1].counters.ias15_iterations)
+        for p0, p1 in zip(sims[0].particles, sims[1].particles):
+            self.assertEqual(p0.xyz, p1.xyz)
+            self.assertEqual(p0.vxyz, p1.vxyz)
+
     def test_af_mercurius(self):
         sim = rebound.Simulation()
         sim.integrator = "mercurius"
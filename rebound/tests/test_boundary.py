@@ -17,6 +17,21 @@ class TestBoundary(unittest.TestCase):
         with self.assertRaises(rebound.NoParticles):
             sim.integrate(2.)
     
+    def test_open_track_energy_offset(self):
+        sim = rebound.Simulation()
+        sim.boundary = "open"
+        sim.configure_box(10.)
+        sim.track_energy_offset = 1
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1.)
+        sim.add(m=1e-3, x=3., vx=8.)
+        sim.add(m=1e-3, x=-3., vy=-8.)
+        sim.add(m=1e-3, a=2., e=0.1)
+        e0 = sim.calculate_energy()
+        sim.integrate(1.)
+        self.assertEqual(sim.N,3)
+        self.assertAlmostEqual(sim.calculate_energy(), e0, delta=1e-10*abs(e0))
+    
     def test_periodic(self):
         sim = rebound.Simulation()
         sim.boundary = "periodic"
@@ -100,6 +100,71 @@ class TestIntegratorBS(unittest.TestCase):
         self.assertEqual(sim.particles[0].m, 2.)
         self.assertEqual(sim.particles[0].x, 0.)
         self.assertEqual(sim.particles[0].vx, 0.)
+    
+    def test_bs_parallel_columns(self):
+        def derivatives(ode, yDot, y, t):
+            yDot[0] = y[1]
+            yDot[1] = -y[0] - 0.1*y[0]**3 + 0.3*math.cos(t)
+        ys = []
+        for parallel_columns in [0, 1]:
+            sim = rebound.Simulation()
+            sim.integrator = "BS"
+            sim.ri_bs.parallel_columns = parallel_columns
+            ode = sim.create_ode(length=2, needs_nbody=False)
+            ode.derivatives = derivatives
+            ode.y[0] = 1.
+            ode.y[1] = 0.
+            sim.integrate(30)
+            ys.append((ode.y[0], ode.y[1]))
+        self.assertEqual(ys[0], ys[1])
+
+    def test_bs_parallel_odes(self):
+        def derivatives(ode, yDot, y, t):
+            yDot[0] = y[1]
+            yDot[1] = -y[0] - 0.1*y[0]**3 + 0.3*math.cos(t)
+        ys = []
+        for parallel_odes in [0, 1]:
+            sim = rebound.Simulation()
+            sim.integrator = "BS"
+            sim.ri_bs.parallel_odes = parallel_odes
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1)
+            odes = []
+            for i in range(4):
+                ode = sim.create_ode(length=2, needs_nbody=False)
+                ode.derivatives = derivatives
+                ode.y[0] = 1.+0.1*i
+                ode.y[1] = 0.
+                odes.append(ode)
+            sim.integrate(30)
+            ys.append([(ode.y[0], ode.y[1]) for ode in odes] + [sim.particles[1].xyz])
+        self.assertEqual(ys[0], ys[1])
+
+    def test_bs_direct_derivatives(self):
+        # Additional forces disable the direct calculation of the
+        # N-body derivatives from the state vector.
+        def af(sim):
+            pass
+        for testparticle_type in [0, 1]:
+            sims = []
+            for use_af in [0, 1]:
+                sim = rebound.Simulation()
+                sim.integrator = "BS"
+                sim.testparticle_type = testparticle_type
+                sim.add(m=1)
+                sim.add(m=1e-3,a=1,e=0.1)
+                sim.add(m=1e-3,a=2,e=0.1,f=1.)
+                sim.N_active = 3
+                sim.add(m=1e-6,a=1.5,e=0.2,f=2.)
+                sim.move_to_com()
+                if use_af:
+                    sim.additional_forces = af
+                sim.integrate(20)
+                sims.append(sim)
+            self.assertEqual(sims[0].t, sims[1].t)
+            for p0, p1 in zip(sims[0].particles, sims[1].particles):
+                for a, b in zip(p0.xyz+p0.vxyz, p1.xyz+p1.vxyz):
+                    self.assertAlmostEqual(a, b, delta=1e-12)
 
 
 class TestVariationalBS(unittest.TestCase):
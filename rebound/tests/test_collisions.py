@@ -1,6 +1,7 @@
 import rebound
 import unittest
 import math
+import random
 import numpy as np
 
 class TestLineTreeCollisions(unittest.TestCase):
@@ -135,6 +136,227 @@ class TestCollisions(unittest.TestCase):
             sim.integrate(1000.)
         self.assertEqual(sim.collisions_Nlog,5)
     
+    def test_tree_sort(self):
+        # Sorting particles along a Morton curve should not change the result
+        def get_sim(collision, tree_sort):
+            sim = rebound.Simulation()
+            sim.configure_box(10., root_nx=2, root_ny=2, root_nz=1)
+            sim.integrator = "leapfrog"
+            sim.boundary   = "periodic"
+            sim.gravity    = "tree"
+            sim.collision  = collision
+            sim.collision_resolve = "merge"
+            sim.tree_sort  = tree_sort
+            sim.G = 1e-3
+            sim.dt = 1e-2
+            rnd = random.Random(1)
+            for i in range(400):
+                sim.add(m=1e-3, r=0.05, x=rnd.uniform(-10.,10.), y=rnd.uniform(-5.,5.), z=rnd.uniform(-2.,2.),
+                        vx=rnd.gauss(0.,1.), vy=rnd.gauss(0.,1.), vz=rnd.gauss(0.,1.), hash=i+1)
+            return sim
+        sim0 = get_sim("none", 0)
+        sim0.integrate(1.)
+        sim1 = get_sim("none", 1)
+        sim1.integrate(1.)
+        for p in sim1.particles:
+            q = sim0.particles[p.hash]
+            self.assertAlmostEqual(p.x, q.x, delta=1e-10)
+            self.assertAlmostEqual(p.vz, q.vz, delta=1e-10)
+
+        # Hashes need to remain valid when particles get merged and reordered
+        sim = get_sim("tree", 1)
+        while sim.t < 1.:
+            try:
+                sim.integrate(1.)
+            except rebound.Collision:
+                pass
+        self.assertLess(sim.N, 400)
+        self.assertAlmostEqual(sum(p.m for p in sim.particles), 0.4, delta=1e-13)
+        for p in sim.particles:
+            self.assertEqual(sim.particles[p.hash].hash.value, p.hash.value)
+    
+    def test_tree_same_as_direct(self):
+        # The dual tree search needs to find the same pairs as the direct search
+        found = {}
+        for collision in ["direct", "tree"]:
+            sim = rebound.Simulation()
+            sim.configure_box(10., root_nx=2, root_ny=2, root_nz=1)
+            sim.boundary   = "periodic"
+            sim.configure_ghostboxes(1, 1, 0)
+            sim.integrator = "leapfrog"
+            sim.gravity    = "none"
+            sim.collision  = collision
+            sim.dt = 1e-2
+            rnd = random.Random(2)
+            for i in range(500):
+                sim.add(m=1., r=rnd.uniform(0.05,0.2), x=rnd.uniform(-10.,10.), y=rnd.uniform(-10.,10.), z=rnd.uniform(-1.,1.),
+                        vx=rnd.gauss(0.,1.), vy=rnd.gauss(0.,1.), vz=rnd.gauss(0.,1.))
+            pairs = []
+            def log(r, c):
+                pairs.append((c.p1, c.p2, round(c.gb.shiftx), round(c.gb.shifty)))
+                return 0
+            sim.collision_resolve = log
+            sim.step()
+            found[collision] = sorted(pairs)
+        self.assertGreater(len(found["tree"]), 0)
+        self.assertEqual(found["tree"], found["direct"])
+    
+    def test_grid_same_as_direct(self):
+        # The grid search needs to find the same pairs as the direct search
+        for boundary in ["periodic", "shear"]:
+            found = {}
+            for collision in ["direct", "grid"]:
+                sim = rebound.Simulation()
+                sim.configure_box(10., root_nx=2, root_ny=2, root_nz=1)
+                sim.boundary   = boundary
+                sim.configure_ghostboxes(1, 1, 0)
+                if boundary == "shear":
+                    sim.integrator = "sei"
+                    sim.ri_sei.OMEGA = 1.
+                else:
+                    sim.integrator = "leapfrog"
+                sim.gravity    = "none"
+                sim.collision  = collision
+                sim.dt = 1e-2
+                rnd = random.Random(3)
+                for i in range(500):
+                    sim.add(m=1., r=rnd.uniform(0.05,0.2), x=rnd.uniform(-10.,10.), y=rnd.uniform(-10.,10.), z=rnd.uniform(-1.,1.),
+                            vx=rnd.gauss(0.,1.), vy=rnd.gauss(0.,1.), vz=rnd.gauss(0.,1.))
+                pairs = []
+                def log(r, c):
+                    pairs.append((c.p1, c.p2, round(c.gb.shiftx), round(c.gb.shifty,6)))
+                    return 0
+                sim.collision_resolve = log
+                sim.step()
+                found[collision] = sorted(pairs)
+            self.assertGreater(len(found["grid"]), 0)
+            self.assertEqual(found["grid"], found["direct"])
+    
+    def test_sweep_same_as_line(self):
+        # The sweep needs to find the same pairs as the line search, also after particles have moved
+        for boundary in ["periodic", "shear"]:
+            found = {}
+            for collision in ["line", "sweep"]:
+                sim = rebound.Simulation()
+                sim.configure_box(10., root_nx=2, root_ny=2, root_nz=1)
+                sim.boundary   = boundary
+                sim.configure_ghostboxes(1, 1, 0)
+                if boundary == "shear":
+                    sim.integrator = "sei"
+                    sim.ri_sei.OMEGA = 1.
+                else:
+                    sim.integrator = "leapfrog"
+                sim.gravity    = "none"
+                sim.collision  = collision
+                sim.dt = 1e-1
+                rnd = random.Random(4)
+                for i in range(500):
+                    sim.add(m=1., r=rnd.uniform(0.02,0.1), x=rnd.uniform(-10.,10.), y=rnd.uniform(-10.,10.), z=rnd.uniform(-1.,1.),
+                            vx=rnd.gauss(0.,1.), vy=rnd.gauss(0.,1.), vz=rnd.gauss(0.,1.))
+                pairs = []
+                def log(r, c):
+                    pairs.append((r.contents.steps_done, c.p1, c.p2, round(c.gb.shiftx), round(c.gb.shifty,6)))
+                    return 0
+                sim.collision_resolve = log
+                for step in range(5):
+                    sim.step()
+                sim.remove(0)
+                sim.step()
+                found[collision] = sorted(pairs)
+            self.assertGreater(len(found["sweep"]), 0)
+            self.assertEqual(found["sweep"], found["line"])
+    
+    def test_verlet_same_as_grid_and_line(self):
+        # The neighbour lists need to find the same pairs as the searches which start from scratch 
+        # every timestep, also after particles have moved, crossed the boundaries or have been removed.
+        for boundary in ["periodic", "shear"]:
+            for reference, collision in [("grid", "verlet"), ("line", "lineverlet")]:
+                found = {}
+                builds = {}
+                for c in [reference, collision]:
+                    sim = rebound.Simulation()
+                    sim.configure_box(10., root_nx=2, root_ny=2, root_nz=1)
+                    sim.boundary   = boundary
+                    sim.nghostx = 1
+                    sim.nghosty = 1
+                    if boundary == "shear":
+                        sim.integrator = "sei"
+                        sim.ri_sei.OMEGA = 1.
+                    else:
+                        sim.integrator = "leapfrog"
+                    sim.gravity    = "none"
+                    sim.collision  = c
+                    sim.dt = 1e-2
+                    rnd = random.Random(5)
+                    for i in range(500):
+                        sim.add(m=1., r=rnd.uniform(0.05,0.2), x=rnd.uniform(-10.,10.), y=rnd.uniform(-10.,10.), z=rnd.uniform(-1.,1.),
+                                vx=rnd.gauss(0.,0.5), vy=rnd.gauss(0.,0.5), vz=rnd.gauss(0.,0.5))
+                    pairs = []
+                    def log(r, c):
+                        pairs.append((r.contents.steps_done, c.p1, c.p2, round(c.gb.shiftx), round(c.gb.shifty,6)))
+                        return 0
+                    sim.collision_resolve = log
+                    for step in range(200):
+                        sim.step()
+                    sim.remove(0)
+                    for step in range(10):
+                        sim.step()
+                    found[c] = sorted(pairs)
+                    builds[c] = sim.counters.collision_verlet_builds
+                self.assertGreater(len(found[collision]), 0)
+                self.assertEqual(found[collision], found[reference])
+                self.assertEqual(builds[reference], 0)
+                self.assertGreater(builds[collision], 1)
+                self.assertLess(builds[collision], 50)
+
+    def test_tree_fused_walk(self):
+        # The candidates collected during the gravity tree walk need to give the same 
+        # collisions as the dual tree search, also after particles have crossed the boundaries 
+        # or have been removed. Particles are identified by their hash, because the tree update 
+        # in the collision search can change their order.
+        for boundary in ["periodic", "shear"]:
+            for collision in ["tree", "linetree"]:
+                found = {}
+                searches = {}
+                for fused in [0, 1]:
+                    sim = rebound.Simulation()
+                    sim.configure_box(10., root_nx=2, root_ny=2, root_nz=1)
+                    sim.boundary   = boundary
+                    sim.nghostx = 2
+                    sim.nghosty = 2
+                    if boundary == "shear":
+                        sim.integrator = "sei"
+                        sim.ri_sei.OMEGA = 1.
+                    else:
+                        sim.integrator = "leapfrog"
+                    sim.gravity    = "tree"
+                    sim.G = 1e-8
+                    sim.opening_angle2 = 0.5
+                    sim.collision  = collision
+                    sim.tree_fused_walk = fused
+                    sim.dt = 1e-2
+                    rnd = random.Random(5)
+                    for i in range(500):
+                        sim.add(m=1., r=rnd.uniform(0.05,0.2), x=rnd.uniform(-10.,10.), y=rnd.uniform(-10.,10.), z=rnd.uniform(-1.,1.),
+                                vx=rnd.gauss(0.,0.5), vy=rnd.gauss(0.,0.5), vz=rnd.gauss(0.,0.5), hash=i+1)
+                    pairs = []
+                    def log(r, c):
+                        ps = r.contents.particles
+                        pairs.append((r.contents.steps_done, ps[c.p1].hash.value, ps[c.p2].hash.value, round(c.gb.shiftx), round(c.gb.shifty,6)))
+                        return 0
+                    sim.collision_resolve = log
+                    for step in range(100):
+                        sim.step()
+                    sim.remove(0, keepSorted=False)
+                    for step in range(10):
+                        sim.step()
+                    found[fused] = sorted(pairs)
+                    searches[fused] = sim.counters.tree_fused_searches
+                self.assertGreater(len(found[1]), 0)
+                self.assertEqual(found[1], found[0])
+                self.assertEqual(searches[0], 0)
+                self.assertGreater(searches[1], 100)
+
     def test_direct_remove_both(self):
         sim = rebound.Simulation()
         boxsize = 50000.           
@@ -199,5 +421,44 @@ class TestCollisions(unittest.TestCase):
         sim.integrate(2.*sim.dt)
         self.assertLess(sim.N,25)
 
+    def test_merge_track_energy_offset(self):
+        # The energy offset includes the interaction of the merging particles with all other particles
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1., r=0.05)
+        sim.add(m=1e-3, a=1.02, f=0.05, r=0.05)
+        sim.add(m=1e-2, a=3.)
+        sim.move_to_com()
+        sim.collision = "direct"
+        sim.collision_resolve = "merge"
+        sim.track_energy_offset = 1
+        e0 = sim.calculate_energy()
+        with self.assertRaises(rebound.Collision):
+            sim.integrate(1.)
+        self.assertEqual(sim.N, 3)
+        self.assertAlmostEqual(sim.calculate_energy(), e0, delta=1e-14*abs(e0))
+
+    def test_merge_many_track_energy_offset(self):
+        # Many mergers in one timestep are removed in one pass at the end
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(40):
+            sim.add(m=1e-5, a=1.+0.001*(i%20), f=0.0005*(i//2), r=0.002, hash=i+1)
+        sim.move_to_com()
+        sim.collision = "direct"
+        sim.collision_resolve = "merge"
+        sim.collision_resolve_keep_sorted = 1
+        sim.track_energy_offset = 1
+        e0 = sim.calculate_energy()
+        m0 = sum(p.m for p in sim.particles)
+        sim.dt = 1e-4
+        sim.step()
+        self.assertLess(sim.N, 41)
+        self.assertGreater(sim.N, 20)
+        hashes = [p.hash.value for p in sim.particles[1:]]
+        self.assertEqual(hashes, sorted(hashes))
+        self.assertAlmostEqual(sum(p.m for p in sim.particles), m0, delta=1e-14)
+        self.assertAlmostEqual(sim.calculate_energy(), e0, delta=1e-13*abs(e0))
+
 if __name__ == "__main__":
     unittest.main()
@@ -49,6 +49,42 @@ class TestCopy(unittest.TestCase):
             self.assertNotEqual(sim.particles[i].vy,sim_copy.particles[i].vy)
             self.assertNotEqual(sim.particles[i].vz,sim_copy.particles[i].vz)
 
+    def test_copy_integrators(self):
+        for integrator in ["ias15", "whfast", "mercurius", "janus", "saba", "bs", "hermite"]:
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=1.3,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.integrator = integrator
+            sim.dt = 0.01
+            if integrator=="whfast":
+                sim.ri_whfast.safe_mode = 0
+            if integrator=="ias15":
+                sim.add_variation()
+            sim.integrate(10., exact_finish_time=0)
+            sim_copy = sim.copy()
+            sim.integrate(20., exact_finish_time=0)
+            sim_copy.integrate(20., exact_finish_time=0)
+            self.assertEqual(sim.t,sim_copy.t)
+            for i in range(sim.N):
+                self.assertEqual(sim.particles[i].x,sim_copy.particles[i].x)
+                self.assertEqual(sim.particles[i].vy,sim_copy.particles[i].vy)
+
+    def test_copy_tree(self):
+        sim = rebound.Simulation()
+        sim.configure_box(10.)
+        sim.gravity = "tree"
+        sim.integrator = "leapfrog"
+        sim.dt = 0.01
+        for i in range(20):
+            sim.add(m=0.01, x=0.2*i-2., y=0.1*i, vx=0.01*i)
+        sim.integrate(0.5)
+        sim_copy = sim.copy()
+        sim.integrate(1.)
+        sim_copy.integrate(1.)
+        for i in range(sim.N):
+            self.assertEqual(sim.particles[i].x,sim_copy.particles[i].x)
+
 class TestMultiply(unittest.TestCase):
     def test_multiply_with_minus_one(self):
         sim1 = rebound.Simulation()
@@ -0,0 +1,208 @@
+import rebound
+import unittest
+
+def get_sim(a, coordinates="jacobi", integrator="whfast"):
+    sim = rebound.Simulation()
+    sim.add(m=1.)
+    sim.add(m=1e-3, a=1., e=0.05)
+    sim.add(m=1e-3, a=a, e=0.1, f=1.)
+    sim.add(a=2.5, e=0.3, f=2.)
+    sim.N_active = 3
+    sim.integrator = integrator
+    sim.ri_whfast.coordinates = coordinates
+    sim.dt = 0.0312
+    sim.exit_max_distance = 10.
+    sim.move_to_com()
+    return sim
+
+def same(sim1, sim2):
+    if sim1.t != sim2.t or sim1.N != sim2.N:
+        return False
+    for p1, p2 in zip(sim1.particles, sim2.particles):
+        if p1.xyz != p2.xyz or p1.vxyz != p2.vxyz:
+            return False
+    return True
+
+class TestEnsemble(unittest.TestCase):
+    
+    def test_same_as_single(self):
+        for coordinates in ["jacobi", "democraticheliocentric", "whds"]:
+            avalues = [1.2+0.03*i for i in range(20)]
+            sims = [get_sim(a, coordinates) for a in avalues]
+            sims.append(get_sim(1.5, integrator="ias15"))
+            ensemble = rebound.Ensemble(sims)
+            status = ensemble.integrate(50.)
+            self.assertEqual(len(status), len(sims))
+            for i, a in enumerate(avalues):
+                sim = get_sim(a, coordinates)
+                try:
+                    sim.integrate(50.)
+                except rebound.Escape:
+                    pass
+                self.assertTrue(same(sim, sims[i]))
+                self.assertEqual(sim._status, status[i])
+            sim = get_sim(1.5, integrator="ias15")
+            sim.integrate(50.)
+            self.assertTrue(same(sim, sims[-1]))
+    
+    def test_escape(self):
+        sims = [get_sim(1.5), get_sim(1.5)]
+        # The test particle's apocentre is at 3.25
+        sims[0].exit_max_distance = 3.
+        ensemble = rebound.Ensemble(sims)
+        status = ensemble.integrate(200.)
+        self.assertEqual(status, [4, 0])
+        self.assertLess(sims[0].t, 200.)
+        self.assertEqual(sims[1].t, 200.)
+    
+    def test_step(self):
+        sims = [get_sim(1.5), get_sim(1.6)]
+        ensemble = rebound.Ensemble(sims)
+        for i in range(10):
+            ensemble.step()
+        sim = get_sim(1.6)
+        sim.steps(10)
+        self.assertEqual(sims[1].steps_done, 10)
+        self.assertTrue(same(sim, sims[1]))
+
+    def test_run(self):
+        avalues = [1.2+0.03*i for i in range(20)]
+        def setup(sim, i):
+            sim.add([p.copy() for p in get_sim(avalues[i]).particles])
+            sim.N_active = 3
+            sim.integrator = "whfast"
+            sim.dt = 0.0312
+            sim.exit_max_distance = 10.
+            sim.init_megno()
+        results, sims = rebound.Ensemble.run(len(avalues), 50., setup=setup, threads=4, return_simulations=True)
+        for i, a in enumerate(avalues):
+            sim = rebound.Simulation()
+            setup(sim, i)
+            status = 0
+            try:
+                sim.integrate(50.)
+            except rebound.Escape:
+                status = 4
+            # Variational particles are initialized randomly
+            for p1, p2 in zip(sim.particles[:sim.N_real], sims[i].particles[:sim.N_real]):
+                self.assertEqual(p1.xyz, p2.xyz)
+            self.assertEqual(results[i].status, status)
+            self.assertEqual(results[i].t, sim.t)
+            self.assertEqual(results[i].megno, sims[i].calculate_megno())
+
+    def test_run_template(self):
+        template = get_sim(1.5)
+        def setup(sim, i):
+            sim.particles[2].m = 1e-4*(i+1)
+        results = rebound.Ensemble.run(8, 20., setup=setup, template=template)
+        for i in range(8):
+            sim = get_sim(1.5)
+            setup(sim, i)
+            sim.integrate(20.)
+            self.assertEqual(results[i].t, sim.t)
+            self.assertEqual(results[i].status, 0)
+            self.assertNotEqual(results[i].megno, results[i].megno) # NaN
+
+    def test_run_exception(self):
+        def setup(sim, i):
+            raise ValueError("Setup failed.")
+        with self.assertRaises(ValueError):
+            rebound.Ensemble.run(10, 1., setup=setup)
+
+    def test_sweep(self):
+        template = get_sim(1.5)
+        N = 70 # More than one chunk
+        masses = [1e-5*(i+1) for i in range(N)]
+        results, particles = rebound.Ensemble.sweep(N, 20., template, {(2, "m"): masses}, threads=2, return_particles=True)
+        self.assertEqual(len(particles[0]), 4)
+        for i in [0, 63, 64, 69]:
+            sim = get_sim(1.5)
+            sim.particles[2].m = masses[i]
+            sim.integrate(20.)
+            self.assertEqual(results[i].t, sim.t)
+            self.assertEqual(results[i].status, 0)
+            for p1, p2 in zip(sim.particles, particles[i]):
+                self.assertEqual(p1.xyz, p2.xyz)
+                self.assertEqual(p1.m, p2.m)
+
+    def test_sweep_orbits(self):
+        template = get_sim(1.5)
+        template.init_megno()
+        avalues = [1.2+0.03*i for i in range(10)]
+        results, particles = rebound.Ensemble.sweep(len(avalues), 20., template, {(2, "a"): avalues, (2, "e"): [0.2]*len(avalues)}, return_particles=True)
+        for i, a in enumerate(avalues):
+            sim = get_sim(1.5)
+            com = sim.calculate_com(last=2)
+            o = sim.particles[2].calculate_orbit(primary=com)
+            sim.particles[2] = rebound.Particle(simulation=sim, primary=com, m=sim.particles[2].m, a=a, e=0.2, inc=o.inc, Omega=o.Omega, omega=o.omega, f=o.f)
+            sim.integrate(20.)
+            self.assertAlmostEqual(particles[i][2].x, sim.particles[2].x, delta=1e-10)
+            self.assertEqual(results[i].megno, results[i].megno) # not NaN
+
+    def test_sweep_escape(self):
+        template = get_sim(1.5)
+        template.exit_max_distance = 3.
+        results = rebound.Ensemble.sweep(2, 200., template, {(3, "e"): [0.3, 0.05]})
+        self.assertEqual([r.status for r in results], [4, 0])
+
+    def test_sweep_invalid(self):
+        template = get_sim(1.5)
+        with self.assertRaises(RuntimeError):
+            rebound.Ensemble.sweep(2, 1., template, {(0, "a"): [1., 2.]})
+        with self.assertRaises(ValueError):
+            rebound.Ensemble.sweep(2, 1., template, {(1, "q"): [1., 2.]})
+        with self.assertRaises(ValueError):
+            rebound.Ensemble.sweep(2, 1., template, {(1, "a"): [1.]})
+
+    def test_sweep_resume(self):
+        import os
+        import tempfile
+        template = get_sim(1.5)
+        template.init_megno()
+        with tempfile.TemporaryDirectory() as d:
+            filename = os.path.join(d, "member_{}.bin")
+            results = rebound.Ensemble.sweep(4, 20., template, {(2, "a"): [1.4, 1.5, 1.6, 1.7]}, filename=filename)
+            for i in range(4):
+                self.assertTrue(os.path.isfile(filename.format(i)))
+                sim = rebound.Simulation(filename.format(i))
+                self.assertEqual(sim.t, 20.)
+            resumed = rebound.Ensemble.sweep(4, 20., template, {(2, "a"): [1.4, 1.5, 1.6, 1.7]}, filename=filename)
+            for r1, r2 in zip(results, resumed):
+                self.assertEqual(r1.t, r2.t)
+                self.assertEqual(r1.megno, r2.megno)
+                self.assertEqual(r2.walltime, 0.)
+
+    def test_run_mpi_resume(self):
+        class Comm: # Single rank, no mpi4py needed
+            def Get_rank(self):
+                return 0
+            def Get_size(self):
+                return 1
+            def bcast(self, obj, root=0):
+                return obj
+        import os
+        import tempfile
+        def setup(sim, i):
+            sim.add([p.copy() for p in get_sim(1.2+0.03*i).particles])
+            sim.N_active = 3
+            sim.integrator = "whfast"
+            sim.dt = 0.0312
+            sim.init_megno()
+        with tempfile.TemporaryDirectory() as d:
+            filename = os.path.join(d, "member_{}.bin")
+            results = rebound.Ensemble.run_mpi(4, 20., setup=setup, filename=filename, comm=Comm())
+            for i in range(4):
+                self.assertTrue(os.path.isfile(filename.format(i)))
+                self.assertEqual(results[i].status, 0)
+                self.assertEqual(results[i].t, 20.)
+            # Members which have been saved are not integrated again
+            def setup_fail(sim, i):
+                raise ValueError("Should not be called.")
+            resumed = rebound.Ensemble.run_mpi(4, 20., setup=setup_fail, filename=filename, comm=Comm())
+            for r1, r2 in zip(results, resumed):
+                self.assertEqual(r1.t, r2.t)
+                self.assertEqual(r1.megno, r2.megno)
+                self.assertEqual(r2.walltime, 0.)
+
+if __name__ == "__main__":
+    unittest.main()
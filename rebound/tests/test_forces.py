@@ -0,0 +1,73 @@
+import rebound
+import unittest
+
+def drag(sim, force, soa, istart, iend):
+    s = soa.contents
+    for i in range(istart, iend):
+        s.ax[i] -= 1e-3*s.vx[i]
+        s.ay[i] -= 1e-3*s.vy[i]
+        s.az[i] -= 1e-3*s.vz[i]
+
+def drag_all(simp):
+    sim = simp.contents
+    for p in sim.particles[2:]:
+        p.ax -= 1e-3*p.vx
+        p.ay -= 1e-3*p.vy
+        p.az -= 1e-3*p.vz
+
+class TestForces(unittest.TestCase):
+    def setUp(self):
+        self.sim = rebound.Simulation()
+        self.sim.add(m=1.)
+        self.sim.add(m=1e-3, a=1., e=0.1)
+        for i in range(700):
+            self.sim.add(a=1.5+0.001*i, l=i)
+        self.sim.N_active = 2
+
+    def test_compare_additional_forces(self):
+        for integrator in ["ias15", "leapfrog", "whfast"]:
+            sim1 = self.sim.copy()
+            sim2 = self.sim.copy()
+            for sim in [sim1, sim2]:
+                sim.integrator = integrator
+                sim.dt = 0.01
+            sim1.additional_forces = drag_all
+            sim1.force_is_velocity_dependent = 1
+            self.assertEqual(sim2.add_force(drag, istart=2, velocity_dependent=True), 0)
+            self.assertEqual(sim2.force_is_velocity_dependent, 1)
+            sim1.integrate(1.)
+            sim2.integrate(1.)
+            self.assertEqual(sim1.t, sim2.t)
+            for p1, p2 in zip(sim1.particles, sim2.particles):
+                self.assertAlmostEqual(p1.x, p2.x, delta=1e-14)
+                self.assertAlmostEqual(p1.vy, p2.vy, delta=1e-14)
+
+    def test_ranges(self):
+        sim = self.sim
+        sim.integrator = "none"
+        sim0 = sim.copy()
+        sim.add_force(drag, istart=10, iend=20, velocity_dependent=True)
+        sim.add_force(drag, istart=15, iend=-1, velocity_dependent=True)
+        sim.step()
+        sim0.step()
+        for i in [2, 9, 10, 15, 19, 20, 600, sim.N-1]:
+            k = 0 if i<10 else (1 if i<15 else (2 if i<20 else 1))
+            p, p0 = sim.particles[i], sim0.particles[i]
+            self.assertEqual(p.ax, p0.ax-k*1e-3*p.vx)
+
+    def test_remove_and_copy(self):
+        sim = self.sim
+        sim.add_force(drag)
+        self.assertEqual(sim._forces_N, 1)
+        sim2 = sim.copy()
+        self.assertEqual(sim2._forces_N, 0)
+        sim.remove_forces()
+        self.assertEqual(sim._forces_N, 0)
+        sim.integrate(0.1)
+
+    def test_invalid(self):
+        with self.assertRaises(RuntimeError):
+            self.sim.add_force(drag, istart=5, iend=3)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,6 +1,7 @@
 import rebound
 import unittest
 import math
+import random
 import numpy as np
 import warnings
 
@@ -100,6 +101,343 @@ class TestGravity(unittest.TestCase):
         x1ias = sim.particles[1].x
         self.assertAlmostEqual(x1ias, x1,delta=1e-9)
 
+    def test_testparticle_batches(self):
+        # Massless test particles of type 0 are calculated in batches.
+        # They should feel the same forces as test particles of type 1.
+        def get_sim(integrator, gravity, testparticle_type):
+            sim = rebound.Simulation()
+            sim.integrator = integrator
+            sim.gravity = gravity
+            sim.testparticle_type = testparticle_type
+            rnd = random.Random(1)
+            sim.add(m=1.)
+            for i in range(5):
+                sim.add(m=1e-4, a=rnd.uniform(1., 3.), inc=rnd.uniform(0., 0.1), f=rnd.uniform(0., 6.))
+            for i in range(73):
+                sim.add(m=0., a=rnd.uniform(0.5, 4.), inc=rnd.uniform(0., 0.1), f=rnd.uniform(0., 6.))
+            sim.N_active = 6
+            sim.move_to_com()
+            sim.dt = 0.01
+            return sim
+        for integrator, gravity in [("leapfrog", "basic"), ("whfast", "jacobi")]:
+            sim0 = get_sim(integrator, gravity, 0)
+            sim0.integrate(5.)
+            sim1 = get_sim(integrator, gravity, 1)
+            sim1.integrate(5.)
+            for i in range(sim0.N):
+                self.assertAlmostEqual(sim0.particles[i].x, sim1.particles[i].x, delta=1e-12)
+                self.assertAlmostEqual(sim0.particles[i].vy, sim1.particles[i].vy, delta=1e-12)
+
+    def test_jacobi_single_particle(self):
+        # N_active=1 with only one particle must not access a second particle.
+        sim = rebound.Simulation()
+        sim.integrator = "whfast"
+        sim.gravity = "jacobi"
+        sim.add(m=1., x=0.1, vy=0.2)
+        sim.N_active = 1
+        sim.integrate(1.)
+        self.assertEqual(sim.particles[0].ax, 0.)
+        self.assertAlmostEqual(sim.particles[0].y, 0.2, delta=1e-14)
+        self.assertEqual(sim.particles[0].vy, 0.2)
+
+    def test_testparticle_float(self):
+        # The perturbations on test particles are calculated in single precision.
+        # The primary is still calculated in double precision.
+        def get_sim(testparticle_float, N_active):
+            sim = rebound.Simulation()
+            sim.gravity_testparticle_float = testparticle_float
+            rnd = random.Random(1)
+            sim.add(m=1.)
+            for i in range(N_active-1):
+                sim.add(m=1e-3, a=rnd.uniform(1., 3.), inc=rnd.uniform(0., 0.1), f=rnd.uniform(0., 6.))
+            for i in range(73):
+                sim.add(m=0., a=rnd.uniform(0.5, 4.), inc=rnd.uniform(0., 0.1), f=rnd.uniform(0., 6.))
+            sim.N_active = N_active
+            sim.move_to_com()
+            sim.integrator = "leapfrog"
+            sim.dt = 0.01
+            return sim
+        for N_active in [1, 6]:
+            # Both leapfrog steps evaluate the forces at the same positions
+            sim0 = get_sim(0, N_active)
+            sim0.step()
+            sim1 = get_sim(1, N_active)
+            sim1.step()
+            for i in range(N_active):
+                self.assertEqual(sim0.particles[i].xyz, sim1.particles[i].xyz)
+            for i in range(N_active, sim0.N):
+                p0, p1 = sim0.particles[i], sim1.particles[i]
+                if N_active == 1:
+                    self.assertEqual(p0.xyz, p1.xyz)
+                else:
+                    a0 = (p0.ax**2+p0.ay**2+p0.az**2)**0.5
+                    self.assertAlmostEqual(p0.ax, p1.ax, delta=1e-6*a0)
+                    self.assertAlmostEqual(p0.ay, p1.ay, delta=1e-6*a0)
+                    self.assertAlmostEqual(p0.az, p1.az, delta=1e-6*a0)
+            if N_active > 1:
+                self.assertNotEqual([p.ax for p in sim0.particles], [p.ax for p in sim1.particles])
+
+    def test_tile_size(self):
+        for gravity in ["basic", "compensated"]:
+            for testparticle_type in [0, 1]:
+                xs = []
+                for tile_size in [0, 3]:
+                    sim = rebound.Simulation()
+                    sim.gravity = gravity
+                    sim.gravity_tile_size = tile_size
+                    sim.testparticle_type = testparticle_type
+                    sim.testparticle_hidewarnings = 1
+                    sim.add(m=1.)
+                    for i in range(20):
+                        sim.add(m=1e-3*(i%2), a=1.+0.1*i, f=i)
+                    sim.N_active = 15
+                    sim.integrator = "leapfrog"
+                    sim.dt = 0.01
+                    sim.integrate(1.)
+                    xs.append([p.x for p in sim.particles])
+                for x0, x1 in zip(xs[0], xs[1]):
+                    self.assertAlmostEqual(x0, x1, delta=1e-14)
+
+    def test_compensated_accuracy(self):
+        for testparticle_type in [0, 1]:
+            for gravity_ignore in [0, 1, 2]:
+                sim = rebound.Simulation()
+                sim.gravity = "compensated"
+                sim.testparticle_type = testparticle_type
+                sim.gravity_ignore = gravity_ignore
+                rnd = random.Random(2)
+                sim.add(m=1.)
+                for i in range(45):
+                    sim.add(m=rnd.choice([1e-3, 1e-9, 0.]), a=rnd.uniform(0.5, 30.), inc=rnd.uniform(0., 0.1), f=rnd.uniform(0., 6.))
+                sim.N_active = 30
+                sim.testparticle_hidewarnings = 1
+                sim.integrator = "none"
+                sim.dt = 0.
+                sim.step()
+                ps = sim.particles
+                for i in range(sim.N):
+                    sources = range(sim.N) if (i<sim.N_active and testparticle_type==1) else range(sim.N_active)
+                    a = [[], [], []]
+                    for j in sources:
+                        if i==j: continue
+                        if gravity_ignore==1 and i+j==1: continue
+                        if gravity_ignore==2 and (i==0 or j==0): continue
+                        d = [ps[i].x-ps[j].x, ps[i].y-ps[j].y, ps[i].z-ps[j].z]
+                        r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2]
+                        prefact = -sim.G/(r2*math.sqrt(r2))*ps[j].m
+                        for k in range(3):
+                            a[k].append(prefact*d[k])
+                    exact = [math.fsum(a[k]) for k in range(3)]
+                    norm = sum(abs(x) for x in exact)+1e-300
+                    self.assertLess(abs(ps[i].ax-exact[0])/norm, 1e-15)
+                    self.assertLess(abs(ps[i].ay-exact[1])/norm, 1e-15)
+                    self.assertLess(abs(ps[i].az-exact[2])/norm, 1e-15)
+
+    def test_fmm(self):
+        errors = []
+        for fmm_order in [0, 1, 2]:
+            accs = []
+            for gravity in ["basic", "fmm"]:
+                rnd = random.Random(1)
+                sim = rebound.Simulation()
+                sim.configure_box(10.)
+                sim.gravity = gravity
+                sim.fmm_order = fmm_order
+                sim.opening_angle2 = 0.25
+                sim.softening = 0.01
+                for i in range(200):
+                    sim.add(m=0.005, x=rnd.uniform(-4.,4.), y=rnd.uniform(-4.,4.), z=rnd.uniform(-1.,1.))
+                sim.integrator = "leapfrog"
+                sim.dt = 0.
+                sim.step()
+                accs.append([(p.ax, p.ay, p.az) for p in sim.particles])
+            error = 0.
+            for a0, a1 in zip(accs[0], accs[1]):
+                error += math.sqrt(sum((x-y)**2 for x, y in zip(a0, a1))/sum(x*x for x in a0))
+            errors.append(error/len(accs[0]))
+        self.assertLess(errors[0], 0.2)
+        self.assertLess(errors[1], errors[0])
+        self.assertLess(errors[2], errors[1])
+        self.assertLess(errors[2], 1e-2)
+
+    def test_tree_group_size(self):
+        # Group walks use the same opening criterion with a larger distance, so they are at least as accurate
+        accs = []
+        for gravity, tree_group_size in [("basic", 0), ("tree", 0), ("tree", 16)]:
+            rnd = random.Random(1)
+            sim = rebound.Simulation()
+            sim.configure_box(10.)
+            sim.gravity = gravity
+            sim.tree_group_size = tree_group_size
+            sim.opening_angle2 = 0.25
+            sim.softening = 0.01
+            for i in range(400):
+                sim.add(m=0.0025, x=rnd.uniform(-4.,4.), y=rnd.uniform(-4.,4.), z=rnd.uniform(-1.,1.))
+            sim.integrator = "leapfrog"
+            sim.dt = 0.
+            sim.step()
+            accs.append([(p.ax, p.ay, p.az) for p in sim.particles])
+        errors = []
+        for a in accs[1:]:
+            error = 0.
+            for a0, a1 in zip(accs[0], a):
+                error += math.sqrt(sum((x-y)**2 for x, y in zip(a0, a1))/sum(x*x for x in a0))
+            errors.append(error/len(accs[0]))
+        self.assertLess(errors[0], 0.05)
+        self.assertLessEqual(errors[1], errors[0])
+
+    def test_tree_list_interval(self):
+        # Kept interaction lists are only reused while they pass the opening criterion
+        sims = []
+        for tree_list_interval in [0, 10]:
+            rnd = random.Random(1)
+            sim = rebound.Simulation()
+            sim.configure_box(10.)
+            sim.gravity = "tree"
+            sim.tree_group_size = 16
+            sim.tree_list_interval = tree_list_interval
+            sim.opening_angle2 = 0.25
+            sim.softening = 0.01
+            for i in range(400):
+                sim.add(m=0.0025, x=rnd.uniform(-4.,4.), y=rnd.uniform(-4.,4.), z=rnd.uniform(-1.,1.), vx=rnd.gauss(0.,0.01), vy=rnd.gauss(0.,0.01))
+            sim.integrator = "leapfrog"
+            sim.dt = 1e-3
+            sim.step()
+            sims.append(sim)
+        # The lists are built with the same criterion as the walk
+        for p0, p1 in zip(sims[0].particles, sims[1].particles):
+            self.assertEqual((p0.ax, p0.ay, p0.az), (p1.ax, p1.ay, p1.az))
+        for sim in sims:
+            sim.steps(5)
+        self.assertEqual(sims[0].counters.tree_lists_reused, 0)
+        self.assertGreater(sims[1].counters.tree_lists_reused, 0)
+        self.assertLess(sims[1].counters.tree_cells_opened, sims[0].counters.tree_cells_opened)
+        error = 0.
+        for p0, p1 in zip(sims[0].particles, sims[1].particles):
+            a0 = (p0.ax, p0.ay, p0.az)
+            a1 = (p1.ax, p1.ay, p1.az)
+            error += math.sqrt(sum((x-y)**2 for x, y in zip(a0, a1))/sum(x*x for x in a0))
+        self.assertLess(error/len(sims[0].particles), 1e-2)
+
+    def test_ghostbox_tolerance(self):
+        tolerance = 1e-3
+        for gravity, tree_group_size in [("basic", 0), ("tree", 0), ("tree", 8)]:
+            accs = []
+            interactions = []
+            for gravity_ghostbox_tolerance in [0., tolerance]:
+                rnd = random.Random(1)
+                sim = rebound.Simulation()
+                sim.configure_box(5., 2, 2, 2)
+                sim.boundary = "periodic"
+                sim.nghostx = sim.nghosty = sim.nghostz = 2
+                sim.gravity = gravity
+                sim.gravity_ghostbox_tolerance = gravity_ghostbox_tolerance
+                sim.tree_group_size = tree_group_size
+                sim.opening_angle2 = 0.25
+                sim.gravity_tile_size = 16
+                # Sorted, so that the blocks of the direct summation are compact
+                for x in sorted(rnd.uniform(-5.,5.) for i in range(200)):
+                    sim.add(m=0.0025, x=x, y=rnd.uniform(-5.,5.), z=rnd.uniform(-5.,5.))
+                sim.integrator = "leapfrog"
+                sim.dt = 0.
+                sim.step()
+                accs.append([(p.ax, p.ay, p.az) for p in sim.particles])
+                interactions.append(sim.counters.gravity_interactions)
+            self.assertLess(interactions[1], interactions[0])
+            # Every skipped ghost box of a cell (or block of particles) contributes less than the tolerance
+            N_ghostboxes = 5*5*5
+            N_roots = 2*2*2
+            bound = tolerance*N_ghostboxes*(1 if gravity=="basic" else N_roots)
+            for a0, a1 in zip(accs[0], accs[1]):
+                for x0, x1 in zip(a0, a1):
+                    self.assertLess(abs(x0-x1), bound)
+
+    def test_auto_select(self):
+        def setup(auto_select_interval, auto_select_opening_angle2):
+            sim = rebound.Simulation()
+            sim.configure_box(10.)
+            sim.boundary = "open"
+            sim.integrator = "leapfrog"
+            sim.dt = 1e-3
+            rnd = random.Random(1)
+            for i in range(3000):
+                sim.add(m=1./3000, r=1e-4, x=rnd.uniform(-4.,4.), y=rnd.uniform(-4.,4.), z=rnd.uniform(-4.,4.))
+            sim.collision = "direct"
+            sim.collision_resolve = "halt"
+            sim.auto_select_interval = auto_select_interval
+            sim.auto_select_opening_angle2 = auto_select_opening_angle2
+            return sim
+        sim0 = setup(0, 0.)
+        sim1 = setup(5, 0.)
+        with warnings.catch_warnings(record=True):
+            warnings.simplefilter("always")
+            sim0.steps(6)
+            sim1.steps(6)
+        # The trials do not change the result, gravity is exact.
+        self.assertEqual(sim1.gravity, "basic")
+        for p0, p1 in zip(sim0.particles, sim1.particles):
+            self.assertEqual(p0.xyz, p1.xyz)
+            self.assertEqual(p0.vxyz, p1.vxyz)
+        self.assertEqual(sim0.counters.gravity_interactions, sim1.counters.gravity_interactions)
+
+        sim2 = setup(5, 0.25)
+        with warnings.catch_warnings(record=True) as w:
+            warnings.simplefilter("always")
+            sim2.steps(6)
+        self.assertEqual(sim2.gravity, "tree")
+        self.assertIn("switched gravity from basic to tree", "".join(str(m.message) for m in w))
+
+    def test_tree_order(self):
+        for tree_group_size in [0, 16]:
+            accs = []
+            for gravity, tree_order in [("basic", 0), ("tree", 0), ("tree", 1), ("tree", 2)]:
+                rnd = random.Random(1)
+                sim = rebound.Simulation()
+                sim.configure_box(10.)
+                sim.gravity = gravity
+                sim.tree_order = tree_order
+                sim.tree_group_size = tree_group_size
+                sim.opening_angle2 = 0.5
+                sim.softening = 0.01
+                for i in range(300):
+                    sim.add(m=0.003, x=rnd.uniform(-4.,4.), y=rnd.uniform(-4.,4.), z=rnd.uniform(-1.,1.))
+                sim.integrator = "leapfrog"
+                sim.dt = 0.
+                sim.step()
+                accs.append([(p.ax, p.ay, p.az) for p in sim.particles])
+            errors = []
+            for a in accs[1:]:
+                error = 0.
+                for a0, a1 in zip(accs[0], a):
+                    error += math.sqrt(sum((x-y)**2 for x, y in zip(a0, a1))/sum(x*x for x in a0))
+                errors.append(error/len(accs[0]))
+            self.assertLess(errors[1], errors[0])
+            self.assertLess(errors[2], errors[1])
+
+    def test_tree_potential_energy(self):
+        errors = []
+        for opening_angle2, tree_order in [(0., 0), (0.5, 0), (0.5, 1), (0.5, 2)]:
+            rnd = random.Random(1)
+            sim = rebound.Simulation()
+            sim.configure_box(10.)
+            sim.gravity = "tree"
+            sim.tree_order = tree_order
+            sim.opening_angle2 = opening_angle2
+            for i in range(300):
+                sim.add(m=0.003, x=rnd.uniform(-4.,4.), y=rnd.uniform(-4.,4.), z=rnd.uniform(-1.,1.), vx=rnd.uniform(-0.1,0.1))
+            sim.integrator = "leapfrog"
+            sim.dt = 1e-3
+            sim.step()
+            exact = sim.calculate_diagnostics()
+            approx = sim.calculate_diagnostics(tree=True)
+            self.assertEqual(exact.energy_kinetic, approx.energy_kinetic)
+            self.assertAlmostEqual(exact.energy, sim.calculate_energy(), delta=1e-12*abs(exact.energy))
+            errors.append(abs((approx.energy_potential-exact.energy_potential)/exact.energy_potential))
+        self.assertLess(errors[0], 1e-12)
+        self.assertLess(errors[1], 1e-2)
+        self.assertLess(errors[2], errors[1])
+        self.assertLess(errors[3], errors[2])
+
 
 if __name__ == "__main__":
     unittest.main()
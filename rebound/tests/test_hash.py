@@ -57,6 +57,21 @@ class TestHash(unittest.TestCase):
         self.sim.add(a=7., hash = "planet 9")
         self.assertEqual(rebound.hash("planet 9").value, self.sim.particles["planet 9"].hash.value)
 
+    def test_lookup_with_churn(self):
+        self.assertAlmostEqual(self.sim.particles["earth"].a, 1., delta=1e-15)
+        for i in range(500):
+            self.sim.add(a=10.+i, hash=1000+i)
+        for i in range(0, 500, 3):
+            self.sim.remove(hash=1000+i, keepSorted=i%2)
+        for i in range(500):
+            if i%3:
+                self.assertAlmostEqual(self.sim.particles[c_uint32(1000+i)].a, 10.+i, delta=1e-10)
+            else:
+                with self.assertRaises(rebound.ParticleNotFound):
+                    self.sim.particles[c_uint32(1000+i)]
+        self.assertAlmostEqual(self.sim.particles["jupiter"].a, 5., delta=1e-15)
+        self.assertEqual(self.sim.N_lookup, self.sim.N-1) # Two particles with hash 0
+
 class TestEmptyLookup(unittest.TestCase):
     def setUp(self):
         self.sim = rebound.Simulation()
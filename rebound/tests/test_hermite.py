@@ -0,0 +1,76 @@
+import rebound
+import math
+import unittest
+import rebound.data
+
+class TestIntegratorHermite(unittest.TestCase):
+    def setup_hierarchical(self):
+        # A binary planet and distant test particles.
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1.)
+        sim.add(primary=sim.particles[1], m=1e-3, a=0.01)
+        for i in range(20):
+            sim.add(a=5.+0.1*i, f=i*0.7)
+        sim.N_active = 3
+        sim.move_to_com()
+        sim.integrator = "hermite"
+        sim.dt = 1.
+        return sim
+
+    def test_hermite_outersolarsystem(self):
+        sim = rebound.Simulation()
+        rebound.data.add_outer_solar_system(sim)
+        sim.integrator = "hermite"
+        sim.dt = 100.
+        sim.ri_hermite.eta = 0.002
+        e0 = sim.calculate_energy()
+        sim.integrate(10000)
+        e1 = sim.calculate_energy()
+        self.assertLess(math.fabs((e0-e1)/e1),1e-6)
+
+    def test_hermite_hierarchical(self):
+        sim = self.setup_hierarchical()
+        e0 = sim.calculate_energy()
+        sim.integrate(100.)
+        e1 = sim.calculate_energy()
+        self.assertLess(math.fabs((e0-e1)/e1),1e-4)
+        d = sim.particles[1] - sim.particles[2]
+        self.assertAlmostEqual(math.sqrt(d.x*d.x+d.y*d.y+d.z*d.z), 0.01, delta=1e-4)
+        # The distant test particles take much larger timesteps than the binary.
+        # With a shared timestep, the number of particle steps would grow with N.
+        sim3 = self.setup_hierarchical()
+        while sim3.N>3:
+            sim3.remove(index=3)
+        sim3.integrate(100.)
+        self.assertLess(sim.ri_hermite.particle_steps, 1.2*sim3.ri_hermite.particle_steps)
+
+    def test_hermite_restart(self):
+        sim = self.setup_hierarchical()
+        sim.automateSimulationArchive("test.sa", interval=10., deletefile=True)
+        sim.integrate(50., exact_finish_time=0)
+        sim1 = rebound.SimulationArchive("test.sa")[-1]
+        self.assertEqual(sim1.integrator, "hermite")
+        sim.integrate(100., exact_finish_time=0)
+        sim1.integrate(100., exact_finish_time=0)
+        self.assertEqual(sim.t, sim1.t)
+        for i in range(sim.N):
+            self.assertEqual(sim.particles[i].x, sim1.particles[i].x)
+            self.assertEqual(sim.particles[i].vy, sim1.particles[i].vy)
+
+    def test_hermite_collide(self):
+        sim = rebound.Simulation()
+        sim.integrator = "hermite"
+        sim.add(m=1,r=1,x=-3)
+        sim.add(m=1,r=1,x=3)
+        sim.add(m=1e-3,r=1e-3,x=100,vy=0.1)
+        sim.dt = 0.1
+        sim.collision = "direct"
+        with self.assertRaises(rebound.Collision):
+            sim.integrate(20)
+        d = sim.particles[0] - sim.particles[1]
+        self.assertLess(math.sqrt(d.x*d.x+d.y*d.y+d.z*d.z), 2.)
+        self.assertLess(sim.t, 20.)
+
+if __name__ == "__main__":
+    unittest.main()
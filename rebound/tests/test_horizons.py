@@ -3,6 +3,10 @@ import unittest
 import datetime
 import socket
 import warnings
+import tempfile
+import shutil
+import os
+import hashlib
 
 class TestHorizons(unittest.TestCase):
     def setUp(self):
@@ -31,6 +35,39 @@ class TestHorizons(unittest.TestCase):
                 print("Socket error. Most likely due to HORIZON being slow. Ignoring.")
                 raise Exception("Socket error. Should have been bogus planet error. Ignoring")
 
+    def test_cache(self):
+        # Responses stored in the cache are used without connecting to HORIZONS.
+        cache_dir = tempfile.mkdtemp()
+        body = """Target body name: %s (%d)   {source: fake}
+$$SOE
+2458849.500000000 = A.D. 2020-Jan-01 00:00:00.0000 TDB 
+ %s
+ 1.0E+01 2.0E+01 3.0E+01
+ 1.0E+00 5.0E+00 4.0E+00
+$$EOE
+"""
+        for name, idn, x in [("Mars", 499, 2.0E+08), ("Venus", 299, -1.0E+08)]:
+            key = "\n".join([name, "2020-01-01 00:00:00", "2020-01-01 00:01:00", "ecliptic"])
+            with open(os.path.join(cache_dir, hashlib.sha1(key.encode()).hexdigest()+".txt"), "w") as f:
+                f.write(body%(name, idn, "%e 0.0 0.0"%x))
+        def offline(url):
+            raise socket.error("offline")
+        urlopen = rebound.horizons.urlopen
+        rebound.horizons.urlopen = offline
+        try:
+            sim = rebound.Simulation()
+            sim.units = ('km', 's', 'kg')
+            sim.add(["Mars", "Venus"], date="2020-01-01 00:00", cache_dir=cache_dir)
+            self.assertEqual(sim.N, 2)
+            self.assertEqual(sim.particles[0].x, 2.0E+08)
+            self.assertEqual(sim.particles[1].x, -1.0E+08)
+            self.assertAlmostEqual(sim.particles[0].m, 4.282837362069909E+04/rebound.horizons.Gkmkgs, delta=1e10)
+            with self.assertRaises(socket.error):
+                sim.add("Earth", date="2020-01-01 00:00", cache_dir=cache_dir)
+        finally:
+            rebound.horizons.urlopen = urlopen
+            shutil.rmtree(cache_dir)
+
 
 if __name__ == "__main__":
     unittest.main()
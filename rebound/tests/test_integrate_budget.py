@@ -0,0 +1,76 @@
+import rebound
+import unittest
+import asyncio
+
+def create_simulation(integrator):
+    sim = rebound.Simulation()
+    sim.integrator = integrator
+    sim.add(m=1.)
+    sim.add(m=1e-3, a=1., e=0.1)
+    sim.add(m=1e-3, a=1.7, e=0.1, inc=0.1)
+    sim.move_to_com()
+    sim.dt = 0.0123
+    return sim
+
+class TestIntegrateBudget(unittest.TestCase):
+    def test_same_result(self):
+        for integrator in ["whfast", "ias15", "mercurius", "leapfrog"]:
+            sim1 = create_simulation(integrator)
+            sim2 = create_simulation(integrator)
+            sim1.integrate(10.)
+            calls = 1
+            while not sim2.integrate_budget(10., steps=7):
+                calls += 1
+            self.assertGreater(calls, 10)
+            self.assertEqual(sim1.t, sim2.t)
+            self.assertEqual(sim1.dt, sim2.dt)
+            self.assertEqual(sim1.steps_done, sim2.steps_done)
+            for i in range(sim1.N):
+                self.assertEqual(sim1.particles[i].x, sim2.particles[i].x)
+                self.assertEqual(sim1.particles[i].vy, sim2.particles[i].vy)
+
+    def test_steps(self):
+        sim = create_simulation("whfast")
+        self.assertFalse(sim.integrate_budget(10., steps=5))
+        self.assertEqual(sim.steps_done, 5)
+        self.assertFalse(sim.integrate_budget(10., steps=100))
+        self.assertEqual(sim.steps_done, 105)
+        self.assertTrue(sim.integrate_budget(10.))
+        self.assertEqual(sim.t, 10.)
+        self.assertEqual(sim.dt, 0.0123)
+
+    def test_walltime(self):
+        sim = create_simulation("ias15")
+        self.assertFalse(sim.integrate_budget(1e6, walltime=1e-3))
+        self.assertGreater(sim.t, 0.)
+        self.assertLess(sim.t, 1e6)
+
+    def test_abandon(self):
+        # Starting a new integration after the budget ran out with a shrunk timestep.
+        sim = create_simulation("whfast")
+        while sim.integrate_budget(1., steps=1)==False and sim.t<0.99:
+            pass
+        sim.integrate(2.)
+        self.assertEqual(sim.t, 2.)
+        self.assertEqual(sim.dt, 0.0123)
+
+    def test_exceptions(self):
+        sim = create_simulation("whfast")
+        sim.exit_max_distance = 1.5
+        with self.assertRaises(rebound.Escape):
+            while not sim.integrate_budget(100., steps=10):
+                pass
+
+    def test_async(self):
+        sims = [create_simulation("whfast") for i in range(3)]
+        sim0 = create_simulation("whfast")
+        sim0.integrate(5.)
+        async def run():
+            await asyncio.gather(*[sim.integrate_async(5., walltime=1e-5) for sim in sims])
+        asyncio.run(run())
+        for sim in sims:
+            self.assertEqual(sim.t, 5.)
+            self.assertEqual(sim.particles[1].x, sim0.particles[1].x)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -112,6 +112,40 @@ class TestIntegrator(unittest.TestCase):
         #e1 = self.sim.calculate_energy()
         #self.assertLess(math.fabs((e0-e1)/e1),10**13.5)
     
+    def test_ias15_dense_output(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1., e=0.3)
+        sim.add(m=1e-3, a=2., e=0.1, inc=0.1)
+        sim.integrator = "ias15"
+        with self.assertRaises(RuntimeError):
+            sim.ias15_dense_output(0.)
+        sim.integrate(10., exact_finish_time=0)
+        t0 = sim.t-sim.dt_last_done
+        ps = sim.ias15_dense_output(sim.t)
+        for p0, p1 in zip(ps, sim.particles):
+            self.assertAlmostEqual(p0.x, p1.x, delta=1e-14)
+            self.assertAlmostEqual(p0.vy, p1.vy, delta=1e-14)
+            self.assertEqual(p0.m, p1.m)
+        for f in [0., 0.3, 0.77]:
+            t = t0+f*sim.dt_last_done
+            ps = sim.ias15_dense_output(t)
+            sim2 = rebound.Simulation()
+            sim2.add(m=1.)
+            sim2.add(m=1e-3, a=1., e=0.3)
+            sim2.add(m=1e-3, a=2., e=0.1, inc=0.1)
+            sim2.integrator = "ias15"
+            sim2.integrate(t)
+            for p0, p1 in zip(ps, sim2.particles):
+                self.assertAlmostEqual(p0.x, p1.x, delta=1e-12)
+                self.assertAlmostEqual(p0.z, p1.z, delta=1e-12)
+                self.assertAlmostEqual(p0.vx, p1.vx, delta=1e-12)
+        with self.assertRaises(ValueError):
+            sim.ias15_dense_output(sim.t+sim.dt_last_done)
+        sim.add(m=1e-3, a=3.)
+        with self.assertRaises(RuntimeError):
+            sim.ias15_dense_output(sim.t)
+    
     def test_ias15_compensated(self):
         self.sim.integrator = "ias15"
         self.sim.gravity = "compensated"
@@ -174,6 +208,47 @@ class TestIntegrator(unittest.TestCase):
         self.assertNotEqual(e0,0.)
         e1 = self.sim.calculate_energy()
         self.assertLess(math.fabs((e0-e1)/e1),1e-9)
+    
+    def test_whfast_synchronize_output(self):
+        self.sim.integrator = "whfast"
+        self.sim.ri_whfast.safe_mode = 0
+        self.sim.ri_whfast.corrector = 11
+        self.sim.dt = 0.0123*11.86*2.*math.pi
+        sim2 = self.sim.copy()
+        for i in range(20):
+            self.sim.step()
+            sim2.step()
+            sim3 = self.sim.copy()
+            sim3.integrator_synchronize()
+            self.sim.integrator_synchronize_output()
+            self.assertEqual(self.sim.ri_whfast.is_synchronized, 0)
+            self.assertEqual(self.sim.ri_whfast._output_is_synchronized, 1)
+            self.sim.integrator_synchronize_output() # reuses the output
+            for p1, p3 in zip(self.sim.particles, sim3.particles):
+                self.assertEqual(p1.xyz, p3.xyz)
+                self.assertEqual(p1.vxyz, p3.vxyz)
+        # Output does not change the integration
+        self.sim.integrator_synchronize()
+        sim2.integrator_synchronize()
+        for p1, p2 in zip(self.sim.particles, sim2.particles):
+            self.assertEqual(p1.xyz, p2.xyz)
+            self.assertEqual(p1.vxyz, p2.vxyz)
+    
+    def test_leapfrog_nosafemode(self):
+        sim2 = self.sim.copy()
+        self.sim.integrator = "leapfrog"
+        sim2.integrator = "leapfrog"
+        sim2.ri_leapfrog.safe_mode = 0
+        jupyr = 11.86*2.*math.pi
+        self.sim.dt = 0.00123*jupyr
+        sim2.dt = self.sim.dt
+        self.sim.integrate(10.*jupyr, exact_finish_time=0)
+        sim2.integrate(10.*jupyr, exact_finish_time=0)
+        self.assertEqual(sim2.ri_leapfrog.is_synchronized, 1)
+        self.assertEqual(self.sim.t, sim2.t)
+        for p1, p2 in zip(self.sim.particles, sim2.particles):
+            self.assertAlmostEqual(p1.x, p2.x, delta=1e-10)
+            self.assertAlmostEqual(p1.vy, p2.vy, delta=1e-10)
 
 if __name__ == "__main__":
     unittest.main()
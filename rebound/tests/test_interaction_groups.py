@@ -0,0 +1,158 @@
+import rebound
+import unittest
+import random
+import os
+
+class TestInteractionGroups(unittest.TestCase):
+
+    def planetesimals(self, tile_size=4):
+        sim = rebound.Simulation()
+        sim.gravity_tile_size = tile_size
+        sim.add(m=1.)
+        rnd = random.Random(1)
+        for i in range(5):
+            sim.add(m=1e-5, a=1.+0.1*i, f=rnd.uniform(0.,6.), r=1e-3)
+        for i in range(15):
+            sim.add(m=1e-8, a=rnd.uniform(0.9,1.5), f=rnd.uniform(0.,6.), r=1e-5, group=1)
+        return sim
+
+    def accelerations(self, sim):
+        # Leapfrog with dt=0 calculates the accelerations without moving the particles.
+        sim.integrator = "leapfrog"
+        sim.dt = 0.
+        sim.step()
+        return [(p.ax, p.ay, p.az) for p in sim.particles]
+
+    def test_planetesimals_do_not_feel_each_other(self):
+        sim = self.planetesimals()
+        sim.set_interaction_groups(2, [[True, True], [True, False]])
+        a = self.accelerations(sim)
+        ps = sim.particles
+        for i in range(sim.N):
+            ax = 0.
+            for j in range(sim.N):
+                if i==j or (ps[i].group==1 and ps[j].group==1):
+                    continue
+                d = ps[i] - ps[j]
+                r = (d.x**2 + d.y**2 + d.z**2)**0.5
+                ax -= ps[j].m*d.x/r**3
+            self.assertAlmostEqual(a[i][0], ax, delta=1e-14*abs(ax)+1e-16)
+
+    def test_all_groups_interact(self):
+        for tile_size in [0, 4]:
+            sim0 = self.planetesimals(tile_size)
+            sim1 = self.planetesimals(tile_size)
+            sim1.set_interaction_groups(2)
+            a0 = self.accelerations(sim0)
+            a1 = self.accelerations(sim1)
+            for p0, p1 in zip(a0, a1):
+                for c in range(3):
+                    self.assertAlmostEqual(p0[c], p1[c], delta=1e-14*abs(p0[c]))
+
+    def test_independent_systems(self):
+        sims = []
+        for k in range(2):
+            sim = rebound.Simulation()
+            sim.add(m=1., x=100.*k)
+            sim.add(m=1e-3, a=1., primary=sim.particles[0])
+            sims.append(sim)
+        sim = rebound.Simulation()
+        sim.set_interaction_groups(2, [[True, False], [False, True]])
+        for k in range(2):
+            for p in sims[k].particles:
+                p.group = k
+                sim.add(p)
+        for s in sims + [sim]:
+            s.integrator = "leapfrog"
+            s.dt = 0.01
+            s.integrate(10.)
+        for k in range(2):
+            for i in range(2):
+                self.assertAlmostEqual(sim.particles[2*k+i].x, sims[k].particles[i].x, delta=1e-12)
+                self.assertAlmostEqual(sim.particles[2*k+i].vy, sims[k].particles[i].vy, delta=1e-12)
+
+    def test_mercurius(self):
+        for N_active in [-1, 6]:
+            xs = []
+            for groups in [False, True]:
+                sim = self.planetesimals()
+                sim.N_active = N_active
+                sim.testparticle_hidewarnings = 1
+                sim.integrator = "mercurius"
+                sim.dt = 0.01
+                if groups:
+                    sim.set_interaction_groups(2)
+                sim.integrate(5.)
+                xs.append([p.x for p in sim.particles])
+            for x0, x1 in zip(xs[0], xs[1]):
+                self.assertAlmostEqual(x0, x1, delta=1e-12)
+
+    def test_mercurius_no_encounters_between_groups(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1.)
+        sim.add(m=1e-3, a=1., f=1e-3)
+        sim.particles[2].group = 1
+        sim.set_interaction_groups(2, [[True, False], [False, True]])
+        sim.integrator = "mercurius"
+        sim.dt = 0.01
+        sim.integrate(1.)
+        self.assertEqual(sim.counters.mercurius_encounter_steps, 0)
+
+    def test_collisions(self):
+        for matrix, N in [([[True, False], [False, True]], 2), ([[True, True], [False, True]], 1)]:
+            sim = rebound.Simulation()
+            sim.gravity = "none"
+            sim.collision = "direct"
+            sim.collision_resolve = "merge"
+            sim.add(m=1., r=1., x=-0.5, vx=1.)
+            sim.add(m=1., r=1., x=0.5, vx=-1., group=1)
+            sim.set_interaction_groups(2, matrix)
+            sim.dt = 0.01
+            try:
+                sim.integrate(0.1)
+            except rebound.Collision:
+                pass
+            self.assertEqual(sim.N, N)
+
+    def test_invalid_group(self):
+        sim = self.planetesimals()
+        sim.set_interaction_groups(1)
+        with self.assertRaises(RuntimeError):
+            sim.integrate(1.)
+        with self.assertRaises(RuntimeError):
+            sim.set_interaction_groups(65)
+
+    def test_unsupported_gravity(self):
+        sim = self.planetesimals()
+        sim.set_interaction_groups(2)
+        sim.gravity = "compensated"
+        with self.assertRaises(RuntimeError):
+            sim.integrate(1.)
+        sim = self.planetesimals()
+        sim.set_interaction_groups(2)
+        sim.integrator = "whfast" # Jacobi coordinates
+        with self.assertRaises(RuntimeError):
+            sim.integrate(1.)
+        sim = self.planetesimals()
+        sim.set_interaction_groups(2)
+        sim.integrator = "whfast"
+        sim.ri_whfast.coordinates = "democraticheliocentric"
+        sim.integrate(1.)
+
+    def test_save(self):
+        sim = self.planetesimals()
+        sim.set_interaction_groups(2, [[True, True], [True, False]])
+        sim.save("test_interaction_groups.bin")
+        sim2 = rebound.Simulation("test_interaction_groups.bin")
+        os.remove("test_interaction_groups.bin")
+        self.assertEqual(sim2.N_interaction_groups, 2)
+        self.assertEqual(sim2._interaction_groups[0], 3)
+        self.assertEqual(sim2._interaction_groups[1], 1)
+        self.assertEqual(sim2.particles[10].group, 1)
+        a0 = self.accelerations(sim)
+        a1 = self.accelerations(sim2)
+        self.assertEqual(a0, a1)
+
+if __name__ == "__main__":
+    unittest.main()
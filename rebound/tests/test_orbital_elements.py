@@ -33,6 +33,61 @@ class TestOrbitalElements(unittest.TestCase):
         with self.assertRaises(ValueError):
             a = sim.particles[1].a
 
+    def test_serialize_orbits(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(10):
+            sim.add(m=1e-3, a=1.+i, e=0.1, inc=0.1*i, Omega=0.2*i, omega=0.3, f=i)
+        sim.add(sim.particles[3]) # Same heliocentric orbit as particle 3
+        for primary, p in [("jacobi", None), ("heliocentric", sim.particles[0]), ("barycentric", sim.calculate_com())]:
+            orbits = sim.calculate_orbits(primary=p, jacobi_masses=True)[:9]
+            a = (ctypes.c_double*sim.N)()
+            pomega = (ctypes.c_double*sim.N)()
+            sim.serialize_orbits(primary=primary, jacobi_masses=True, a=a, pomega=pomega)
+            for i, o in enumerate(orbits):
+                self.assertEqual(o.a, a[i])
+                self.assertEqual(o.pomega, pomega[i])
+        a = (ctypes.c_double*sim.N)()
+        sim.serialize_orbits(primary="heliocentric", a=a)
+        self.assertEqual(a[10], a[2])
+        with self.assertRaises(ValueError):
+            sim.serialize_orbits(primary="galactic", a=a)
+        with self.assertRaises(AttributeError):
+            sim.serialize_orbits(a=(ctypes.c_double*5)())
+
+    def test_add_serialized_orbits(self):
+        N = 20
+        m = np.full(N, 1e-3)
+        a = np.linspace(1., 3., N)
+        e = np.linspace(0., 0.5, N)
+        inc = np.linspace(0., 0.3, N)
+        Omega = np.linspace(0., 6., N)
+        omega = np.linspace(1., 2., N)
+        M = np.linspace(0., 12., N)
+        for primary in ["jacobi", "heliocentric", "barycentric"]:
+            sim1 = rebound.Simulation()
+            sim1.add(m=1.)
+            sim1.add(m=1e-3, a=0.5)
+            p = {"jacobi": None, "heliocentric": sim1.particles[0], "barycentric": sim1.calculate_com()}[primary]
+            for i in range(N):
+                sim1.add(primary=p, m=m[i], a=a[i], e=e[i], inc=inc[i], Omega=Omega[i], omega=omega[i], M=M[i])
+            sim2 = rebound.Simulation()
+            sim2.add(m=1.)
+            sim2.add(m=1e-3, a=0.5)
+            sim2.add_serialized_orbits(primary=primary, m=m, a=a, e=e, inc=inc, Omega=Omega, omega=omega, M=M)
+            self.assertEqual(sim1.N, sim2.N)
+            for p1, p2 in zip(sim1.particles, sim2.particles):
+                self.assertEqual(p1.m, p2.m)
+                for c1, c2 in zip(p1.xyz+p1.vxyz, p2.xyz+p2.vxyz):
+                    self.assertAlmostEqual(c1, c2, delta=1e-14)
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        with self.assertRaises(RuntimeError):
+            sim.add_serialized_orbits(a=np.array([1., -1.]), e=np.array([0.1, 0.1]))
+        self.assertEqual(sim.N, 1)
+        with self.assertRaises(AttributeError):
+            sim.add_serialized_orbits(e=np.array([0.1]))
+
     def test_inclined_eccentric(self):
         sim = rebound.Simulation()
         d = 1.e-12 # abs error tolerance
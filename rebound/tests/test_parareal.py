@@ -0,0 +1,56 @@
+import rebound
+import unittest
+
+def create_simulation(integrator, dt):
+    sim = rebound.Simulation()
+    sim.integrator = integrator
+    sim.dt = dt
+    sim.add(m=1.)
+    sim.add(m=1e-3, a=1., e=0.05)
+    sim.add(m=3e-4, a=1.8, e=0.05, inc=0.05)
+    sim.add(m=5e-5, a=3.1, e=0.02)
+    sim.move_to_com()
+    return sim
+
+class TestParareal(unittest.TestCase):
+    def test_whfast(self):
+        serial = create_simulation("whfast", 0.01)
+        serial.integrate(200.)
+        sim = create_simulation("whfast", 0.01)
+        result = sim.integrate_parareal(200., 8, coarse_dt=0.1, tolerance=1e-9, threads=2)
+        self.assertEqual(result.converged, 1)
+        self.assertLess(result.iterations, 8)
+        self.assertEqual(sim.t, 200.)
+        self.assertEqual(sim.dt, 0.01)
+        for i in range(sim.N):
+            self.assertAlmostEqual(sim.particles[i].x, serial.particles[i].x, delta=1e-8)
+            self.assertAlmostEqual(sim.particles[i].vy, serial.particles[i].vy, delta=1e-8)
+        # Continue integrating normally
+        sim.integrate(210.)
+        serial.integrate(210.)
+        self.assertAlmostEqual(sim.particles[1].x, serial.particles[1].x, delta=1e-8)
+
+    def test_ias15_with_whfast_coarse(self):
+        serial = create_simulation("ias15", 0.01)
+        serial.integrate(100.)
+        sim = create_simulation("ias15", 0.01)
+        coarse = create_simulation("whfast", 0.05)
+        result = sim.integrate_parareal(100., 4, coarse=coarse, tolerance=1e-9)
+        self.assertEqual(result.converged, 1)
+        for i in range(sim.N):
+            self.assertAlmostEqual(sim.particles[i].x, serial.particles[i].x, delta=1e-8)
+
+    def test_exact_after_N_slices(self):
+        # Converges at the latest after N_slices iterations.
+        sim = create_simulation("leapfrog", 0.01)
+        result = sim.integrate_parareal(10., 3, coarse_dt=1., tolerance=0.)
+        self.assertEqual(result.converged, 1)
+        self.assertEqual(result.iterations, 3)
+
+    def test_unsupported(self):
+        sim = create_simulation("mercurius", 0.01)
+        with self.assertRaises(RuntimeError):
+            sim.integrate_parareal(10., 4)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -47,6 +47,66 @@ class TestParticleInSimulation(unittest.TestCase):
         ind = p4.index
         self.assertEqual(ind,4)
 
+    def test_adding_list(self):
+        self.sim.add(m=1.)
+        ps = [rebound.Particle(simulation=self.sim, m=1e-3, a=1.+i, primary=self.sim.particles[0], hash=i) for i in range(300)]
+        self.sim.add(ps)
+        self.assertEqual(self.sim.N, 301)
+        for i in range(300):
+            self.assertEqual(self.sim.particles[i+1].x, ps[i].x)
+            self.assertEqual(self.sim.particles[i+1].hash.value, i)
+        self.assertEqual(self.sim.particles[300].index, 300)
+
+    def test_alignment(self):
+        import ctypes
+        self.sim.add(m=1.)
+        for i in range(1000):
+            self.sim.add(m=1e-6, a=1.+0.01*i)
+            self.assertEqual(ctypes.addressof(self.sim.particles[0])%64, 0)
+        self.sim.integrator = "whfast"
+        self.sim.dt = 1e-3
+        self.sim.step()
+        self.assertEqual(ctypes.addressof(self.sim.ri_whfast._p_jh.contents)%64, 0)
+        sim2 = self.sim.copy()
+        self.assertEqual(ctypes.addressof(sim2.particles[0])%64, 0)
+        self.assertEqual(sim2.particles[500].x, self.sim.particles[500].x)
+
+    def test_adding_list_mercurius(self):
+        self.sim.integrator = "mercurius"
+        self.sim.add(m=1.)
+        self.sim.add(m=1e-3, a=1.)
+        self.sim.integrate(1.)
+        self.sim.add([rebound.Particle(simulation=self.sim, m=0., a=2.+i, primary=self.sim.particles[0]) for i in range(200)])
+        self.assertEqual(self.sim.N, 202)
+        self.sim.integrate(2.)
+        self.assertGreater(self.sim.particles[201].x**2+self.sim.particles[201].y**2, 200.**2)
+
+    def test_removing_list(self):
+        self.sim.add(m=1., hash=0)
+        self.sim.add([rebound.Particle(simulation=self.sim, m=1e-3, a=1.+i, primary=self.sim.particles[0], hash=i+1) for i in range(100)])
+        self.sim.remove(index=[3, 1, 3, 50])
+        self.assertEqual(self.sim.N, 98)
+        hashes = [p.hash.value for p in self.sim.particles]
+        self.assertEqual(hashes, [h for h in range(101) if h not in [1, 3, 50]])
+        self.sim.remove(hash=[100, 2])
+        self.assertEqual(self.sim.N, 96)
+        self.assertEqual(self.sim.particles[-1].hash.value, 99)
+        self.assertEqual(self.sim.particles[1].hash.value, 4)
+
+    def test_removing_list_mercurius(self):
+        self.sim.integrator = "mercurius"
+        self.sim.add(m=1.)
+        for i in range(20):
+            self.sim.add(m=1e-5, a=1.+0.1*i, f=0.3*i, r=1e-3)
+        self.sim.integrate(1.)
+        dcrit = [self.sim.ri_mercurius._dcrit[i] for i in range(self.sim.N)]
+        self.sim.remove(index=[2, 5, 6, 20])
+        self.assertEqual(self.sim.N, 17)
+        removed = [2, 5, 6, 20]
+        self.assertEqual([self.sim.ri_mercurius._dcrit[i] for i in range(self.sim.N)], [d for i, d in enumerate(dcrit) if i not in removed])
+        self.sim.integrate(2.)
+        self.assertEqual(self.sim.N, 17)
+
     def test_masses(self):
         self.sim.add(m=1.)
         self.sim.add(m=1.e-3, a=1.)
@@ -71,6 +71,73 @@ class TestPostTimestepModifications(unittest.TestCase):
         self.assertAlmostEqual(sim.particles[2].m,1e-3-mdot*sim.t,delta=1e-13)
 
 
+    def setup_whfast_nosafemode(self, coordinates):
+        sim = rebound.Simulation()
+        sim.integrator = "whfast"
+        sim.ri_whfast.coordinates = coordinates
+        sim.ri_whfast.safe_mode = 0
+        sim.dt = 0.01
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1)
+        sim.add(m=1e-3,a=5)
+        sim.add(a=3,e=0.1)
+        sim.N_active = 3
+        sim.move_to_com()
+        return sim
+
+    def test_ptm_whfast_readonly(self):
+        # Reading particles in a callback does not require new coordinates.
+        def ptm_readonly(sim):
+            sim.contents.particles[1].x
+        sim0 = self.setup_whfast_nosafemode("jacobi")
+        sim0.ri_whfast.keep_unsynchronized = 1
+        sim1 = self.setup_whfast_nosafemode("jacobi")
+        sim1.ri_whfast.keep_unsynchronized = 1
+        sim1.post_timestep_modifications = ptm_readonly
+        sim0.integrate(10.)
+        sim1.integrate(10.)
+        for i in range(sim0.N):
+            self.assertEqual(sim0.particles[i].x, sim1.particles[i].x)
+            self.assertEqual(sim0.particles[i].vy, sim1.particles[i].vy)
+
+    def test_ptm_whfast_modified_particles(self):
+        # Only modified particles get new coordinates. Compare to recalculating all coordinates.
+        def ptm_partial(sim):
+            sim.contents.particles[2].m -= sim.contents.dt_last_done*mdot
+            sim.contents.particles[3].vx *= 1.+1e-6
+        def ptm_full(sim):
+            ptm_partial(sim)
+            sim.contents.ri_whfast.recalculate_coordinates_this_timestep = 1
+        for coordinates in ["jacobi", "democraticheliocentric", "whds"]:
+            sim0 = self.setup_whfast_nosafemode(coordinates)
+            sim0.post_timestep_modifications = ptm_full
+            sim1 = self.setup_whfast_nosafemode(coordinates)
+            sim1.post_timestep_modifications = ptm_partial
+            sim0.integrate(10.)
+            sim1.integrate(10.)
+            self.assertAlmostEqual(sim1.particles[2].m,1e-3-mdot*sim1.t,delta=1e-13)
+            for i in range(sim0.N):
+                self.assertAlmostEqual(sim0.particles[i].x, sim1.particles[i].x, delta=1e-12)
+                self.assertAlmostEqual(sim0.particles[i].vy, sim1.particles[i].vy, delta=1e-12)
+
+    def test_ptm_whfast_testparticle(self):
+        def ptm_testparticle(sim):
+            sim.contents.particles[3].vx *= 1.+1e-6
+        def ptm_full(sim):
+            ptm_testparticle(sim)
+            sim.contents.ri_whfast.recalculate_coordinates_this_timestep = 1
+        for coordinates in ["jacobi", "democraticheliocentric", "whds"]:
+            sim0 = self.setup_whfast_nosafemode(coordinates)
+            sim0.post_timestep_modifications = ptm_full
+            sim1 = self.setup_whfast_nosafemode(coordinates)
+            sim1.post_timestep_modifications = ptm_testparticle
+            sim0.integrate(10.)
+            sim1.integrate(10.)
+            for i in range(sim0.N):
+                self.assertAlmostEqual(sim0.particles[i].x, sim1.particles[i].x, delta=1e-12)
+                self.assertAlmostEqual(sim0.particles[i].vy, sim1.particles[i].vy, delta=1e-12)
+
+
 if __name__ == "__main__":
     unittest.main()
 
@@ -0,0 +1,199 @@
+import rebound
+import unittest
+import json
+import os
+
+class TestProfiling(unittest.TestCase):
+    def test_disabled(self):
+        sim = rebound.Simulation()
+        self.assertFalse(sim.profiling)
+        with self.assertRaises(RuntimeError):
+            sim.profiling_results()
+
+    def test_whfast(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1)
+        sim.add(m=1e-3,a=1.3,e=0.1)
+        sim.integrator = "whfast"
+        sim.dt = 0.01
+        sim.profiling = True
+        self.assertTrue(sim.profiling)
+        sim.integrate(1., exact_finish_time=0)
+        res = sim.profiling_results()
+        self.assertEqual(len(res), 13)
+        self.assertEqual(res["gravity"]["calls"], sim.steps_done)
+        self.assertEqual(res["kepler"]["calls"], 2*sim.steps_done) # safe mode: two half drifts per step
+        self.assertEqual(res["ias15_iterations"]["calls"], 0)
+        for name in res:
+            self.assertGreaterEqual(res[name]["time"], res[name]["time_self"]-1e-12)
+        # Kepler steps are nested in the integrator scope
+        self.assertLessEqual(res["integrator"]["time_self"], res["integrator"]["time"]-res["kepler"]["time"]+1e-12)
+        sim.profiling = False
+        self.assertFalse(sim.profiling)
+
+    def test_ias15_and_copy(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1)
+        sim.profiling = True
+        sim.integrate(1.)
+        res = sim.profiling_results()
+        self.assertGreaterEqual(res["ias15_iterations"]["calls"], sim.steps_done)
+        self.assertEqual(res["kepler"]["calls"], 0)
+        sim2 = sim.copy()
+        self.assertFalse(sim2.profiling)
+        sim2.integrate(2.)
+        # Restarting resets the counters
+        sim.profiling = True
+        self.assertEqual(sim.profiling_results()["gravity"]["calls"], 0)
+
+    def test_tree(self):
+        sim = rebound.Simulation()
+        sim.configure_box(10.)
+        sim.gravity = "tree"
+        sim.integrator = "leapfrog"
+        sim.dt = 0.01
+        for i in range(50):
+            sim.add(m=0.01, x=i%7-3., y=i%5-2., z=(i%3-1.)*0.5)
+        sim.profiling = True
+        sim.steps(3)
+        res = sim.profiling_results()
+        self.assertEqual(res["gravity_walk"]["calls"], 3)
+        self.assertGreaterEqual(res["tree_build"]["calls"], 3)
+        self.assertEqual(res["tree_moments"]["calls"], 3)
+
+class TestCounters(unittest.TestCase):
+    def test_whfast(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1)
+        sim.add(m=1e-3,a=1.3,e=0.1)
+        sim.integrator = "whfast"
+        sim.dt = 0.01
+        sim.integrate(1., exact_finish_time=0)
+        c = sim.counters
+        self.assertEqual(c.kepler_solves, 2*2*sim.steps_done)
+        self.assertGreaterEqual(c.kepler_iterations, c.kepler_solves)
+        self.assertEqual(c.kepler_bisections, 0)
+        self.assertEqual(c.gravity_interactions, 3*sim.steps_done)
+        sim.reset_counters()
+        self.assertEqual(sim.counters.kepler_solves, 0)
+        self.assertEqual(sim.counters.gravity_interactions, 0)
+
+    def test_ias15(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.9)
+        sim.dt = 10.
+        sim.integrate(10.)
+        c = sim.counters
+        self.assertGreaterEqual(c.ias15_iterations, 2*sim.steps_done)
+        self.assertGreater(c.ias15_steps_rejected, 0)
+        # Seven force evaluations per predictor corrector iteration, unless gravity was reused
+        self.assertGreater(c.ias15_gravity_reused, 0)
+        self.assertGreaterEqual(c.gravity_interactions, 7*c.ias15_iterations-c.ias15_gravity_reused)
+
+    def test_mercurius(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1)
+        sim.add(m=1e-3,a=1.02,f=0.01)
+        sim.integrator = "mercurius"
+        sim.dt = 0.01
+        sim.integrate(1.)
+        c = sim.counters
+        self.assertEqual(sum(c.mercurius_encounter_N), sim.steps_done)
+        self.assertGreater(c.mercurius_encounter_steps, 0)
+        self.assertEqual(c.mercurius_encounter_N[1], c.mercurius_encounter_steps)
+
+    def test_collisions(self):
+        sim = rebound.Simulation()
+        sim.add(m=1, r=0.1)
+        sim.add(m=1, r=0.1, x=1)
+        sim.collision = "direct"
+        sim.collision_resolve = "merge"
+        try:
+            sim.integrate(2.)
+        except rebound.Collision:
+            pass
+        c = sim.counters
+        self.assertEqual(sim.N, 1)
+        self.assertEqual(c.collisions_resolved, 1)
+        self.assertGreaterEqual(c.collisions_detected, c.collisions_resolved)
+
+    def test_tree(self):
+        sim = rebound.Simulation()
+        sim.configure_box(10.)
+        sim.gravity = "tree"
+        sim.integrator = "leapfrog"
+        sim.dt = 0.01
+        for i in range(50):
+            sim.add(m=0.01, x=i%7-3., y=i%5-2., z=(i%3-1.)*0.5)
+        sim.opening_angle2 = 0.
+        sim.steps(1)
+        # Without approximations every particle interacts with every other particle
+        self.assertEqual(sim.counters.gravity_interactions, 50*49)
+        sim.reset_counters()
+        sim.opening_angle2 = 1.
+        sim.steps(1)
+        self.assertLess(sim.counters.gravity_interactions, 50*49)
+        self.assertGreater(sim.counters.tree_cells_opened, 0)
+
+class TestTrace(unittest.TestCase):
+    def setUp(self):
+        self.filename = "test_trace.json"
+
+    def tearDown(self):
+        if os.path.isfile(self.filename):
+            os.remove(self.filename)
+
+    def simulation(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1)
+        sim.add(m=1e-3,a=2)
+        sim.integrator = "whfast"
+        sim.dt = 0.01
+        return sim
+
+    def test_chrome(self):
+        sim = self.simulation()
+        sim.trace_enable()
+        sim.steps(10)
+        sim.trace_output_chrome(self.filename)
+        with open(self.filename) as f:
+            events = json.load(f)["traceEvents"]
+        steps = [e for e in events if e["name"]=="step"]
+        self.assertEqual(len([e for e in steps if e["ph"]=="B"]), 10)
+        self.assertEqual(len([e for e in steps if e["ph"]=="E"]), 10)
+        for name in ["part1", "gravity", "part2", "collision_search"]:
+            self.assertEqual(len([e for e in events if e["name"]==name]), 20)
+        ts = [e["ts"] for e in steps]
+        self.assertEqual(ts, sorted(ts))
+
+    def test_ring_buffer(self):
+        sim = self.simulation()
+        sim.trace_enable(capacity=7)
+        sim.steps(10)
+        sim.trace_output_chrome(self.filename)
+        with open(self.filename) as f:
+            events = json.load(f)["traceEvents"]
+        events = [e for e in events if e["ph"]!="M"]
+        self.assertLessEqual(len(events), 7)
+        # End events whose begin events were overwritten are dropped
+        depth = 0
+        for e in events:
+            depth += 1 if e["ph"]=="B" else -1
+            self.assertGreaterEqual(depth, 0)
+
+    def test_disable(self):
+        sim = self.simulation()
+        sim.trace_enable()
+        sim.trace_disable()
+        sim.steps(10)
+        with self.assertRaises(RuntimeError):
+            sim.trace_output_chrome(self.filename)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,56 @@
+import rebound
+import unittest
+import os
+import math
+
+class TestRecorder(unittest.TestCase):
+    def tearDown(self):
+        if os.path.isfile("recording.bin"):
+            os.remove("recording.bin")
+
+    def setUp(self):
+        self.sim = rebound.Simulation()
+        self.sim.add(m=1.)
+        self.sim.add(m=1e-3, a=1., e=0.1)
+        self.sim.add(m=1e-3, a=2., e=0.05, inc=0.1)
+        self.sim.move_to_com()
+        self.sim.integrator = "whfast"
+        self.sim.dt = 0.01
+
+    def test_interval(self):
+        sim = self.sim
+        e0 = sim.calculate_energy()
+        sim.recorder_enable("recording.bin", ["energy", "angular_momentum", "orbits", "min_distance"], interval=1., capacity=7)
+        sim.integrate(20.)
+        sim.recorder_disable()
+        data = rebound.read_recording("recording.bin")
+        self.assertEqual(list(data.keys()), ["t", "E", "Lx", "Ly", "Lz", "a1", "e1", "inc1", "a2", "e2", "inc2", "d_min"])
+        self.assertEqual(len(data["t"]), 21)
+        for i, t in enumerate(data["t"]):
+            self.assertAlmostEqual(t, i, delta=sim.dt)
+        self.assertEqual(data["E"][0], e0)
+        for E in data["E"]:
+            self.assertAlmostEqual(E, e0, delta=1e-5*abs(e0))
+        for a1, e2 in zip(data["a1"], data["e2"]):
+            self.assertAlmostEqual(a1, 1., delta=1e-2)
+            self.assertAlmostEqual(e2, 0.05, delta=1e-2)
+        self.assertAlmostEqual(data["d_min"][0], 0.9, delta=1e-2)
+        o = sim.particles[1].calculate_orbit(primary=sim.particles[0])
+        self.assertAlmostEqual(data["a1"][-1], o.a, delta=1e-14)
+
+    def test_steps(self):
+        sim = self.sim
+        sim.recorder_enable("recording.bin", ["megno"], steps=10)
+        sim.integrate(1.)
+        sim.integrate(2.)
+        self.assertEqual(len(rebound.read_recording("recording.bin")["t"]), 0)
+        sim.recorder_flush()
+        data = rebound.read_recording("recording.bin")
+        self.assertEqual(len(data["t"]), sim.steps_done//10+1)
+        self.assertTrue(math.isnan(data["megno"][0]))
+        sim.recorder_sample()
+        sim.recorder_disable()
+        self.assertEqual(len(rebound.read_recording("recording.bin")["t"]), sim.steps_done//10+2)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,80 @@
+import rebound
+import unittest
+import os
+import math
+import random
+
+class TestReductions(unittest.TestCase):
+    def tearDown(self):
+        if os.path.isfile("reductions.bin"):
+            os.remove("reductions.bin")
+
+    def setUp(self):
+        self.sim = rebound.Simulation()
+        rnd = random.Random(1)
+        for i in range(3000):
+            self.sim.add(m=rnd.uniform(1.,2.), r=rnd.uniform(0.1,0.3), x=rnd.uniform(-10.,10.), y=rnd.uniform(-10.,10.), z=rnd.gauss(0.,0.2), vx=rnd.gauss(1e3,0.1), vy=rnd.gauss(0.,0.2), vz=rnd.gauss(0.,0.3))
+
+    def test_values(self):
+        sim = self.sim
+        ps = sim.particles
+        self.assertEqual(sim.add_reduction("sum", "m"), 0)
+        self.assertEqual(sim.add_reduction("moments", "vx"), 1)
+        sim.add_reduction("histogram", "x", min=-5., max=5., N_bins=10)
+        sim.add_reduction("profile", "m", "x", -10., 10., 4)
+        sim.add_reduction("sum", "midplane_area")
+        v = sim.calculate_reductions()
+        self.assertEqual([len(vk) for vk in v], [1, 3, 10, 4, 1])
+
+        self.assertAlmostEqual(v[0][0], sum(p.m for p in ps), delta=1e-9)
+
+        vx = [p.vx for p in ps]
+        mean = math.fsum(vx)/len(vx)
+        variance = math.fsum((x-mean)**2 for x in vx)/len(vx)
+        self.assertEqual(v[1][0], len(ps))
+        self.assertAlmostEqual(v[1][1], mean, delta=1e-12)
+        self.assertAlmostEqual(v[1][2], variance, delta=1e-12)
+
+        histogram = [0]*10
+        profile = [0.]*4
+        for p in ps:
+            if -5.<=p.x<5.:
+                histogram[int(p.x+5.)] += 1
+            profile[int((p.x+10.)/5.)] += p.m
+        self.assertEqual(v[2], histogram)
+        for a, b in zip(v[3], profile):
+            self.assertAlmostEqual(a, b, delta=1e-9)
+
+        area = sum(math.pi*(p.r**2-p.z**2) for p in ps if p.r>abs(p.z))
+        self.assertAlmostEqual(v[4][0], area, delta=1e-9)
+
+        sim.remove_reductions()
+        self.assertEqual(sim.calculate_reductions(), [])
+
+    def test_errors(self):
+        sim = self.sim
+        with self.assertRaises(ValueError):
+            sim.add_reduction("median", "m")
+        with self.assertRaises(ValueError):
+            sim.add_reduction("sum", "mass")
+        with self.assertRaises(RuntimeError):
+            sim.add_reduction("histogram", "x", min=1., max=0.)
+
+    def test_recorder(self):
+        sim = self.sim
+        sim.add_reduction("sum", "one")
+        sim.add_reduction("histogram", "y", min=-10., max=10., N_bins=2)
+        sim.integrator = "leapfrog"
+        sim.dt = 1e-3
+        sim.recorder_enable("reductions.bin", ["reductions"], steps=1)
+        sim.integrate(0.01)
+        sim.recorder_disable()
+        data = rebound.read_recording("reductions.bin")
+        self.assertEqual(list(data.keys()), ["t", "red0", "red1_0", "red1_1"])
+        self.assertEqual(data["red0"][-1], 3000)
+        self.assertEqual(data["red1_0"][-1]+data["red1_1"][-1], 3000)
+        v = sim.calculate_reductions()
+        self.assertEqual(data["red1_0"][-1], v[1][0])
+
+if __name__ == "__main__":
+    unittest.main()
@@ -35,6 +35,50 @@ class TestSerialize(unittest.TestCase):
         with self.assertRaises(AttributeError):
             self.sim.serialize_particle_data(xyz=c)
 
+    def test_add_serialized(self):
+        xyz = np.zeros((100,3),dtype="float64")
+        xyz[:,0] = np.arange(100)+2.
+        m = np.full(100, 1e-6)
+        self.sim.add_serialized_particle_data(xyz=xyz, m=m)
+        self.assertEqual(self.sim.N, 102)
+        self.assertEqual(self.sim.particles[2].x, 2.)
+        self.assertEqual(self.sim.particles[101].x, 101.)
+        self.assertEqual(self.sim.particles[101].m, 1e-6)
+        self.assertEqual(self.sim.particles[101].vx, 0.)
+        
+        with self.assertRaises(AttributeError):
+            self.sim.add_serialized_particle_data(xyz=xyz, m=np.zeros(10))
+
+
+    def test_particle_data_view(self):
+        self.sim.particles[1].hash = "planet"
+        v = self.sim.particle_data_view()
+        self.assertEqual(v.xyz.shape, (2,3))
+        self.assertEqual(v.xyz[1][0], 1.)
+        self.assertEqual(v.m[0], 1.)
+        self.assertEqual(v.hash[1], rebound.hash("planet").value)
+        v.xyz[1,1] = 2.
+        self.assertEqual(self.sim.particles[1].y, 2.)
+        self.sim.particles[1].vz = 3.
+        self.assertEqual(v.vxvyvz[1,2], 3.)
+        self.sim.integrator = "whfast"
+        self.sim.ri_whfast.recalculate_coordinates_this_timestep = 0
+        with self.sim.particle_data_view() as v2:
+            v2.m[1] = 1e-3
+        self.assertEqual(self.sim.ri_whfast.recalculate_coordinates_this_timestep, 1)
+        
+        r = self.sim.particle_data_view(readonly=True)
+        with self.assertRaises(ValueError):
+            r.xyz[0,0] = 1.
+        with self.assertRaises(RuntimeError):
+            r.commit()
+
+        for i in range(100):
+            self.sim.add(a=2.+i)
+        self.assertFalse(v.valid)
+        with self.assertRaises(RuntimeError):
+            v.xyz
+
     
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,68 @@
+import rebound
+import unittest
+import pickle
+from rebound.interruptible_pool import InterruptiblePool
+
+def runsim(args):
+    shared, a = args
+    sim = shared.simulation()
+    sim.particles[2].a = a
+    sim.integrate(10.)
+    return sim.particles[2].x
+
+class TestSharedMemory(unittest.TestCase):
+    def simulation(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1.)
+        sim.add(m=1e-3, a=1.5)
+        sim.integrator = "whfast"
+        sim.dt = 0.01
+        sim.integrate(1.)
+        return sim
+
+    def test_simulation(self):
+        sim = self.simulation()
+        with rebound.SharedSimulation(sim) as shared:
+            sim2 = shared.simulation()
+            sim3 = shared.simulation()
+        self.assertEqual(sim2.N, 3)
+        self.assertEqual(sim2.t, sim.t)
+        sim.integrate(10.)
+        sim2.integrate(10.)
+        self.assertEqual(sim.particles[2].x, sim2.particles[2].x)
+        # sim3 is not affected by sim2
+        self.assertEqual(sim3.t, 1.)
+
+    def test_pickle(self):
+        sim = self.simulation()
+        shared = rebound.SharedSimulation(sim)
+        s = pickle.dumps(shared)
+        self.assertLess(len(s), 1000)
+        shared2 = pickle.loads(s)
+        self.assertEqual(shared2.name, shared.name)
+        sim2 = shared2.simulation()
+        self.assertEqual(sim2.particles[1].x, sim.particles[1].x)
+        shared2.close()
+        shared.close()
+        with self.assertRaises(RuntimeError):
+            shared.simulation()
+
+    def test_pool(self):
+        sim = self.simulation()
+        params = [1.4, 1.6]
+        res0 = []
+        for a in params:
+            sim2 = sim.copy()
+            sim2.particles[2].a = a
+            sim2.integrate(10.)
+            res0.append(sim2.particles[2].x)
+        shared = rebound.SharedSimulation(sim)
+        pool = InterruptiblePool(2)
+        res = pool.map(runsim, [(shared, a) for a in params])
+        pool.close()
+        shared.close()
+        self.assertEqual(res, res0)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -31,6 +31,42 @@ class TestSimulation(unittest.TestCase):
         self.sim.exit_min_distance = 1.
         with self.assertRaises(rebound.Encounter):
             self.sim.integrate(1.)
+        self.assertEqual(self.sim.exit_encounter.p1, 0)
+        self.assertEqual(self.sim.exit_encounter.p2, 1)
+        self.assertLess(self.sim.exit_encounter.d, 1.)
+
+    def test_encounter_interpolated(self):
+        # Two particles on a straight line pass each other during one timestep.
+        sim = rebound.Simulation()
+        sim.G = 0.
+        sim.integrator = "leapfrog"
+        sim.add(x=-1., vx=1.)
+        sim.add(x=1., y=0.05, vx=-1.)
+        sim.dt = 2.
+        sim.exit_min_distance = 0.1
+        with self.assertRaises(rebound.Encounter):
+            sim.integrate(10.)
+        e = sim.exit_encounter
+        self.assertEqual((e.p1, e.p2), (0, 1))
+        self.assertAlmostEqual(e.d, 0.05, delta=1e-12)
+        # The distance is 0.1 when the x separation is sqrt(0.1^2-0.05^2). The relative velocity is 2.
+        self.assertAlmostEqual(e.t, 1.-(0.1**2-0.05**2)**0.5/2., delta=1e-12)
+
+    def test_encounter_many_particles(self):
+        sim = rebound.Simulation()
+        sim.G = 0.
+        sim.integrator = "leapfrog"
+        sim.dt = 0.1
+        for i in range(200):
+            sim.add(x=(i*0.61803)%10., y=(i*0.4142)%10., z=(i*0.7320)%10., vx=((i*0.37)%1.-0.5), vy=((i*0.53)%1.-0.5))
+        # Smallest distance at t=0
+        d2 = min((sim.particles[i].x-sim.particles[j].x)**2+(sim.particles[i].y-sim.particles[j].y)**2+(sim.particles[i].z-sim.particles[j].z)**2 for i in range(200) for j in range(i))
+        sim.exit_min_distance = d2**0.5*1.01
+        with self.assertRaises(rebound.Encounter):
+            sim.integrate(1.)
+        self.assertEqual(sim.steps_done, 0)
+        sim.exit_min_distance = d2**0.5*0.99
+        sim.integrate(0.)
     
     def test_removeall(self):
         del self.sim.particles
@@ -79,6 +115,53 @@ class TestSimulation(unittest.TestCase):
             self.assertAlmostEqual(self.sim.particles[i].x,sim.particles[i].x,delta=1e-7)
             self.assertAlmostEqual(self.sim.particles[i].vy,sim.particles[i].vy,delta=1e-7)
     
+    def test_ascii_csv(self):
+        a = self.sim.particles_ascii(prec=16, delimiter=",")
+        self.assertEqual(len(a.split("\n")), self.sim.N)
+        self.assertEqual(len(a.split("\n")[0].split(",")), 8)
+        sim = rebound.Simulation()
+        sim.add_particles_ascii("# m r x y z vx vy vz\n\n"+a)
+        self.assertEqual(sim.N, self.sim.N)
+        for i in range(self.sim.N):
+            self.assertEqual(self.sim.particles[i].x,sim.particles[i].x)
+            self.assertEqual(self.sim.particles[i].vz,sim.particles[i].vz)
+    
+    def test_ascii_orbits(self):
+        a = self.sim.particles_ascii(prec=16, format="orbits")
+        self.assertEqual(len(a.split("\n")), self.sim.N-1)
+        sim = rebound.Simulation()
+        with self.assertRaises(AttributeError):
+            sim.add_particles_ascii(a, format="orbits")
+        sim.add(self.sim.particles[0])
+        sim.add_particles_ascii(a, format="orbits")
+        self.assertEqual(sim.N, self.sim.N)
+        for i in range(self.sim.N):
+            self.assertAlmostEqual(self.sim.particles[i].x,sim.particles[i].x,delta=1e-12)
+            self.assertAlmostEqual(self.sim.particles[i].vy,sim.particles[i].vy,delta=1e-12)
+    
+    def test_ascii_invalid(self):
+        sim = rebound.Simulation()
+        with self.assertRaises(AttributeError):
+            sim.add_particles_ascii("1 0 0 0 0 0 0 0\n1 0 0 0 0 0 0")
+        self.assertEqual(sim.N, 0)
+        with self.assertRaises(AttributeError):
+            sim.add_particles_ascii("1 0 0 0 0 0 0 x")
+        self.assertEqual(sim.N, 0)
+    
+    def test_ascii_file_threads(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        for i in range(10000):
+            sim.add(m=1e-9, a=1.+i*1e-4, e=0.01, inc=0.01, f=i)
+        sim.save_particles_ascii("particles.txt", threads=4)
+        sim2 = rebound.Simulation()
+        self.assertEqual(sim2.load_particles_ascii("particles.txt", threads=4), sim.N)
+        for i in range(sim.N):
+            self.assertEqual(sim.particles[i].x,sim2.particles[i].x)
+            self.assertEqual(sim.particles[i].vy,sim2.particles[i].vy)
+        with self.assertRaises(RuntimeError):
+            sim2.load_particles_ascii("does_not_exist.txt")
+    
     def test_configure_ghostboxes(self):
         self.sim.configure_ghostboxes(1,1,1)
    
@@ -159,6 +242,19 @@ class TestSimulation(unittest.TestCase):
         for i in range(3):
             self.assertAlmostEqual(abs((Lf[i]-L0[i])/L0[i]), 0., delta=1e-15)
 
+    def test_calculate_diagnostics(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1., inc=0.3, Omega=0.5)
+        sim.add(m=1.e-3, a=3., inc=0.2, Omega = -0.8)
+        sim.add(m=0., a=2., e=0.1)
+        sim.N_active = 3
+        d = sim.calculate_diagnostics()
+        self.assertAlmostEqual(d.energy, sim.calculate_energy(), delta=1e-15)
+        self.assertAlmostEqual(d.energy, d.energy_kinetic+d.energy_potential, delta=1e-15)
+        L = sim.calculate_angular_momentum()
+        self.assertEqual([d.angular_momentum.x, d.angular_momentum.y, d.angular_momentum.z], L)
+
     def test_additional_forces(self):
         def af(sim):
             sim.contents.particles[0].hash = 5
@@ -179,6 +275,61 @@ class TestSimulation(unittest.TestCase):
         with self.assertRaises(AttributeError):
             self.sim.post_timestep_modifications
 
+    def test_heartbeat_steps(self):
+        calls = []
+        def hb(sim):
+            calls.append(sim.contents.steps_done)
+        self.sim.heartbeat = hb
+        self.sim.heartbeat_steps = 10
+        self.sim.integrator = "leapfrog"
+        self.sim.dt = 0.01
+        self.sim.integrate(self.sim.t+1., exact_finish_time=0)
+        self.assertGreaterEqual(self.sim.steps_done, 100)
+        self.assertEqual(len(calls), 1+self.sim.steps_done//10) # Includes call before first step
+        for s in calls:
+            self.assertEqual(s%10, 0)
+        sim2 = self.sim.copy()
+        self.assertEqual(sim2.heartbeat_steps, 10)
+
+    def test_integrate_batched_steps(self):
+        # Without a heartbeat, several steps are taken between exit checks.
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1., e=0.01)
+        sim.integrator = "leapfrog"
+        sim.dt = 0.01
+        sim2 = sim.copy()
+        sim.integrate(1.2345)
+        self.assertEqual(sim.t, 1.2345)
+        for i in range(123):
+            sim2.step()
+        sim2.integrate(1.2345)
+        self.assertEqual(sim.steps_done, sim2.steps_done)
+        self.assertEqual(sim.particles[1].x, sim2.particles[1].x)
+        self.assertGreater(sim.walltime, 0.)
+        walltime = sim.walltime
+        sim.steps(10)
+        self.assertGreater(sim.walltime, walltime)
+
+    def test_integrate_threads(self):
+        import threading
+        sims = [self.sim.copy() for i in range(4)]
+        for sim in sims:
+            sim.integrator = "whfast"
+            sim.dt = 1e-3
+        ref = self.sim.copy()
+        ref.integrator = "whfast"
+        ref.dt = 1e-3
+        ref.integrate(20.)
+        threads = [threading.Thread(target=sim.integrate, args=(20.,)) for sim in sims]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for sim in sims:
+            self.assertEqual(sim.t, ref.t)
+            self.assertEqual(sim.particles[1].x, ref.particles[1].x)
+
     def test_N(self):
         self.assertEqual(self.sim.N, 2)
     
@@ -214,8 +365,8 @@ class TestSimulation(unittest.TestCase):
     def test_collision(self):
         self.sim.collision = "tree"
         self.assertEqual(self.sim.collision, "tree")
-        self.sim.collision = 8
-        self.assertEqual(self.sim.collision, 8)
+        self.sim.collision = 10
+        self.assertEqual(self.sim.collision, 10)
         with self.assertRaises(ValueError):
             self.sim.collision = "boguscollision"
 
@@ -248,6 +399,27 @@ class TestSimulation(unittest.TestCase):
         self.assertEqual(self.sim.integrator, sim2.integrator)
         os.remove("bintest.bin")
     
+    def test_checkpoint_large(self):
+        # The particles do not fit into one write buffer.
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(1000):
+            sim.add(a=1.+0.001*i, f=i)
+        sim.integrator = "ias15"
+        sim.step()
+        sim.save("bintest.bin")
+        # Written directly to a file and to a contiguous buffer
+        sim.simulationarchive_snapshot("bintest.sa", deletefile=True)
+        with open("bintest.bin","rb") as f1, open("bintest.sa","rb") as f2:
+            self.assertEqual(f1.read(), f2.read())
+        sim2 = rebound.Simulation("bintest.bin")
+        sim.step()
+        sim2.step()
+        self.assertEqual(sim.N, sim2.N)
+        self.assertEqual(sim.particles[999].x, sim2.particles[999].x)
+        os.remove("bintest.bin")
+        os.remove("bintest.sa")
+    
 class TestSimulationCollisions(unittest.TestCase):
     def setUp(self):
         self.sim = rebound.Simulation()
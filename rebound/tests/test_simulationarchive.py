@@ -1,6 +1,7 @@
 import rebound
 import unittest
 import os
+import math
 import warnings
 
 class TestSimulationArchive(unittest.TestCase):
@@ -364,6 +365,36 @@ class TestSimulationArchive(unittest.TestCase):
         self.assertAlmostEqual(sim.t,tget,delta=sim.dt)
     
     
+    def test_sa_restart_kepler_warm_start(self):
+        def setup():
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=-2,e=1.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            for i in range(10):
+                sim.add(a=1.5+0.1*i,e=0.05,M=0.7*i)
+            sim.N_active = 3
+            sim.integrator = "whfast"
+            sim.dt = 0.1313
+            sim.ri_whfast.safe_mode = 0
+            sim.ri_whfast.kepler_warm_start = 1
+            return sim
+        sim = setup()
+        sim.automateSimulationArchive("test.bin", 10.,deletefile=True)
+        sim.integrate(42.,exact_finish_time=0)
+
+        sim = None
+        sa = rebound.SimulationArchive("test.bin")
+        sim = sa[-1]
+        self.assertEqual(sim.ri_whfast.kepler_warm_start, 1)
+        sim.integrate(80.,exact_finish_time=0)
+        
+        sim2 = setup()
+        sim2.integrate(80.,exact_finish_time=0)
+        for p1, p2 in zip(sim.particles, sim2.particles):
+            self.assertEqual(p1.xyz, p2.xyz)
+            self.assertEqual(p1.vxyz, p2.vxyz)
+    
     def test_sa_restart_ias15(self):
         sim = rebound.Simulation()
         sim.add(m=1)
@@ -582,5 +613,528 @@ class TestSimulationArchiveMercurius(unittest.TestCase):
         self.assertEqual(sa.nblobs, 8)
         self.assertAlmostEqual(sa[-1].t, 7000, places=0)
 
+    def test_append_to_corrupt_snapshot_while_writing(self):
+        # The writer keeps the file open. It notices that the file has been modified.
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3,a=1.)
+        sim.add(m=5e-3,a=2.25)
+    
+        sim.automateSimulationArchive("simulationarchive.bin", interval=1000,deletefile=True) 
+        sim.integrate(3001)
+        with open('simulationarchive.bin', 'r+b') as f:
+            f.seek(0, os.SEEK_END)          
+            f.seek(f.tell() - 2, os.SEEK_SET)
+            f.truncate() # truncate by 2 bytes
+        with warnings.catch_warnings(record=True) as w:
+            warnings.simplefilter("always")
+            sim.integrate(7001)
+            self.assertTrue(any("corrupt" in str(m.message) for m in w))
+        sa = rebound.SimulationArchive("simulationarchive.bin")
+        # The snapshot at t=3000 has been dropped
+        self.assertEqual(sa.nblobs, 7)
+        self.assertAlmostEqual(sa[-1].t, 7000, places=0)
+
+    def test_sa_shared_readers(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3,a=1.)
+        sim.add(m=5e-3,a=2.25)
+        sim.integrator = "whfast"
+        sim.dt = 0.1
+        sim.automateSimulationArchive("simulationarchive.bin", interval=10.,deletefile=True) 
+        sim.integrate(100.)
+        sa1 = rebound.SimulationArchive("simulationarchive.bin")
+        sa2 = rebound.SimulationArchive("simulationarchive.bin")
+        sa3 = rebound.SimulationArchive("simulationarchive.bin", reuse_index=sa1)
+        self.assertEqual(sa1.nblobs, sa2.nblobs)
+        self.assertEqual(sa1.nblobs, sa3.nblobs)
+        for i in [5, 0, -1, 3]:
+            sim1, sim2, sim3 = sa1[i], sa2[i], sa3[i]
+            self.assertEqual(sim1.t, sim2.t)
+            self.assertEqual(sim1.t, sim3.t)
+            self.assertEqual(sim1.particles[2].x, sim2.particles[2].x)
+            self.assertEqual(sim1.particles[2].x, sim3.particles[2].x)
+        self.assertEqual(sa1[-1].particles[2].x, sim.particles[2].x)
+
+    def test_sa_truncated_after_opening(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3,a=1.)
+        sim.automateSimulationArchive("simulationarchive.bin", interval=10.,deletefile=True) 
+        sim.integrate(100.)
+        sa = rebound.SimulationArchive("simulationarchive.bin")
+        self.assertAlmostEqual(sa[1].t, 10., delta=sim.dt)
+        with open('simulationarchive.bin', 'r+b') as f:
+            f.truncate(100)
+        # The file is no longer read from memory. Otherwise this would crash.
+        sim1 = sa[1]
+        self.assertEqual(sim1.N, 0)
+
+    def test_sa_index_file(self):
+        def run(a):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3,a=a)
+            sim.add(m=5e-3,a=2.25)
+            sim.integrator = "whfast"
+            sim.dt = 0.1
+            sim.automateSimulationArchive("simulationarchive.bin", interval=1.,deletefile=True) 
+            sim.integrate(50.)
+            return sim
+        def index(sa):
+            return [(sa.offset[i], sa.t[i]) for i in range(sa.nblobs)]
+        sim = run(1.)
+        # Index file is written and updated by the SimulationArchive itself
+        self.assertTrue(os.path.isfile("simulationarchive.bin.idx"))
+        sa1 = rebound.SimulationArchive("simulationarchive.bin")
+        os.remove("simulationarchive.bin.idx")
+        sa2 = rebound.SimulationArchive("simulationarchive.bin")
+        self.assertEqual(index(sa1), index(sa2))
+        self.assertEqual(sa1[-1].particles[1].x, sim.particles[1].x)
+        # Index is rebuilt when reading
+        self.assertTrue(os.path.isfile("simulationarchive.bin.idx"))
+        with open("simulationarchive.bin.idx","rb") as f:
+            index_old = f.read()
+        # Snapshots appended after the index was written
+        sim.automateSimulationArchive("simulationarchive.bin", interval=1.) 
+        with warnings.catch_warnings(record=True) as w:
+            warnings.simplefilter("always")
+            sim.integrate(60.)
+        with open("simulationarchive.bin.idx","wb") as f:
+            f.write(index_old)
+        sa3 = rebound.SimulationArchive("simulationarchive.bin")
+        self.assertEqual(sa3.nblobs, sa1.nblobs+10)
+        self.assertEqual(sa3[-1].particles[1].x, sim.particles[1].x)
+        # Index of a different file with the same structure is not used
+        sim = run(1.1)
+        with open("simulationarchive.bin.idx","wb") as f:
+            f.write(index_old)
+        sa4 = rebound.SimulationArchive("simulationarchive.bin")
+        self.assertEqual(sa4.nblobs, sa1.nblobs)
+        self.assertEqual(sa4[-1].particles[1].x, sim.particles[1].x)
+        self.assertEqual(sa4.tmax, sim.t)
+
+    def test_sa_async(self):
+        def run(filename, asynchronous):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3,a=1.)
+            sim.add(m=5e-3,a=2.25)
+            sim.integrator = "whfast"
+            sim.dt = 0.1
+            sim.simulationarchive_async = asynchronous
+            sim.automateSimulationArchive(filename, interval=1.,deletefile=True) 
+            sim.integrate(20.)
+            # Manual snapshots are written after the queued ones
+            sim.simulationarchive_snapshot(filename)
+            sim.integrate(40.)
+            return sim
+        sim1 = run("sim0.bin", 0)
+        sim2 = run("sim1.bin", 1)
+        # Archive is complete once integrate() returns
+        sa1 = rebound.SimulationArchive("sim0.bin")
+        sa2 = rebound.SimulationArchive("sim1.bin")
+        self.assertEqual(sa1.nblobs, sa2.nblobs)
+        for i in range(sa1.nblobs):
+            s1, s2 = sa1[i], sa2[i]
+            self.assertEqual(s1.t, s2.t)
+            for j in range(s1.N):
+                self.assertEqual(s1.particles[j].x, s2.particles[j].x)
+                self.assertEqual(s1.particles[j].vy, s2.particles[j].vy)
+        self.assertEqual(sa2[-1].particles[1].x, sim2.particles[1].x)
+        # Appending to the archive from another simulation
+        sim3 = sa2[-1]
+        sim3.simulationarchive_async = 1
+        sim3.automateSimulationArchive("sim1.bin", interval=1.) 
+        sim3.integrate(50.)
+        del sim3
+        sa3 = rebound.SimulationArchive("sim1.bin")
+        self.assertEqual(sa3.nblobs, sa2.nblobs+10)
+
+    def test_sa_compression(self):
+        def run(filename, compression, asynchronous=0):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            for i in range(10):
+                sim.add(m=1e-5,a=1.+0.2*i,e=0.05,f=i)
+            sim.integrator = "ias15"
+            sim.simulationarchive_compression = compression
+            sim.simulationarchive_async = asynchronous
+            sim.automateSimulationArchive(filename, interval=5.,deletefile=True) 
+            sim.integrate(50.)
+            return sim
+        run("sim0.bin", 0)
+        sim1 = run("sim1.bin", 1)
+        sim2 = run("test.sa", 9, asynchronous=1)
+        self.assertLess(os.path.getsize("sim1.bin"), 0.8*os.path.getsize("sim0.bin"))
+        self.assertLessEqual(os.path.getsize("test.sa"), os.path.getsize("sim1.bin"))
+        sa0 = rebound.SimulationArchive("sim0.bin")
+        for filename in ["sim1.bin", "test.sa"]:
+            sa = rebound.SimulationArchive(filename)
+            self.assertEqual(sa0.nblobs, sa.nblobs)
+            for i in range(sa.nblobs):
+                s0, s = sa0[i], sa[i]
+                self.assertEqual(s0.t, s.t)
+                self.assertEqual(s0.dt, s.dt)
+                for j in range(s.N):
+                    self.assertEqual(s0.particles[j].x, s.particles[j].x)
+                    self.assertEqual(s0.particles[j].vz, s.particles[j].vz)
+            # Restarting from a compressed snapshot is bitwise exact
+            sim = sa[-1]
+            self.assertEqual(sim.simulationarchive_compression, sa[0].simulationarchive_compression)
+            sim.integrate(60.)
+            sim1.integrate(60.)
+            self.assertEqual(sim.particles[3].x, sim1.particles[3].x)
+
+    def test_sa_physical_only(self):
+        def run(filename, integrator, physical_only):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            for i in range(10):
+                sim.add(m=1e-5,a=1.+0.2*i,e=0.05,f=i)
+            sim.integrator = integrator
+            sim.dt = 0.05
+            if integrator=="whfast":
+                sim.ri_whfast.safe_mode = 0
+            sim.simulationarchive_physical_only = physical_only
+            sim.automateSimulationArchive(filename, interval=5.,deletefile=True) 
+            sim.integrate(50.)
+            return sim
+        for integrator in ["ias15", "whfast"]:
+            sim0 = run("sim0.bin", integrator, 0)
+            sim1 = run("sim1.bin", integrator, 1)
+            sim2 = run("test.sa", integrator, 2)
+            # Physical state snapshots do not change the simulation
+            self.assertEqual(sim0.particles[3].x, sim1.particles[3].x)
+            self.assertEqual(sim0.particles[3].x, sim2.particles[3].x)
+            self.assertLess(os.path.getsize("sim1.bin"), os.path.getsize("sim0.bin"))
+            self.assertLess(os.path.getsize("test.sa"), os.path.getsize("sim1.bin"))
+            sa0 = rebound.SimulationArchive("sim0.bin")
+            sa1 = rebound.SimulationArchive("sim1.bin")
+            sa2 = rebound.SimulationArchive("test.sa")
+            self.assertEqual(sa0.nblobs, sa1.nblobs)
+            self.assertEqual(sa0.nblobs, sa2.nblobs)
+            for i in range(1,sa0.nblobs):
+                s0 = sa0[i]
+                s0.integrator_synchronize()
+                with warnings.catch_warnings(record=True) as w:
+                    warnings.simplefilter("always")
+                    s1 = sa1[i]
+                    s2 = sa2[i]
+                    self.assertEqual(len(w),2)
+                self.assertEqual(s0.t, s1.t)
+                self.assertEqual(s0.N, s1.N)
+                for j in range(s0.N):
+                    self.assertEqual(s0.particles[j].hash.value, s1.particles[j].hash.value)
+                    self.assertEqual(s0.particles[j].m, s1.particles[j].m)
+                    self.assertAlmostEqual(s0.particles[j].x, s1.particles[j].x, delta=1e-14)
+                    self.assertAlmostEqual(s0.particles[j].vy, s1.particles[j].vy, delta=1e-14)
+                    self.assertAlmostEqual(s0.particles[j].x, s2.particles[j].x, delta=1e-6)
+                    self.assertAlmostEqual(s0.particles[j].vy, s2.particles[j].vy, delta=1e-6)
+            # Integrating from a physical state snapshot is not bit-exact but accurate
+            with warnings.catch_warnings(record=True) as w:
+                warnings.simplefilter("always")
+                sim = sa1[5]
+            sim.integrate(50.)
+            self.assertAlmostEqual(sim0.particles[3].x, sim.particles[3].x, delta=1e-8)
+
+    def test_sa_checkpoint(self):
+        for f in ["test.bin", "test.bin.1", "test.bin.2", "test.bin.3"]:
+            if os.path.isfile(f):
+                os.remove(f)
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3,a=1.)
+        sim.integrator = "whfast"
+        sim.dt = 0.1
+        sim.automateSimulationArchive("simulationarchive.bin", interval=1.,deletefile=True) 
+        sim.automateCheckpoints("test.bin", walltime=1e-300, N=3)
+        sim.integrate(10.)
+        self.assertTrue(os.path.isfile("test.bin.1"))
+        self.assertTrue(os.path.isfile("test.bin.2"))
+        self.assertFalse(os.path.isfile("test.bin.3"))
+        self.assertFalse(os.path.isfile("test.bin.tmp"))
+        size = os.path.getsize("test.bin")
+        sim.integrate(20.)
+        self.assertEqual(size, os.path.getsize("test.bin"))
+        # Most recent checkpoint first
+        sims = [rebound.Simulation(f) for f in ["test.bin", "test.bin.1", "test.bin.2"]]
+        self.assertEqual(sims[0].t, sim.t)
+        self.assertGreater(sims[0].t, sims[1].t)
+        self.assertGreater(sims[1].t, sims[2].t)
+        self.assertEqual(sims[0].particles[1].x, sim.particles[1].x)
+        # Checkpoints do not affect the Simulation Archive
+        sa = rebound.SimulationArchive("simulationarchive.bin")
+        self.assertEqual(sa.nblobs, 21)
+        sims[0].integrate(30.)
+        sim.integrate(30.)
+        self.assertEqual(sims[0].particles[1].x, sim.particles[1].x)
+
+    def test_sa_serialize_particle_data(self):
+        from ctypes import c_double
+        for integrator, compression, physical_only in [("ias15",0,0), ("whfast",0,0), ("whfast",3,0), ("ias15",0,1), ("ias15",0,2)]:
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            for i in range(10):
+                sim.add(m=1e-5,a=1.+0.2*i,e=0.05,f=i)
+            sim.integrator = integrator
+            sim.dt = 0.05
+            if integrator=="whfast":
+                sim.ri_whfast.safe_mode = 0
+            sim.simulationarchive_compression = compression
+            sim.simulationarchive_physical_only = physical_only
+            sim.automateSimulationArchive("test.sa", interval=5.,deletefile=True) 
+            sim.integrate(50.)
+            sa = rebound.SimulationArchive("test.sa", process_warnings=False)
+            N = sim.N
+            snapshots = [0, 3, len(sa)-1, -2, 1]
+            for threads in [1, 4]:
+                m = (c_double*(len(snapshots)*N))()
+                xyz = (c_double*(3*len(snapshots)*N))()
+                vxvyvz = (c_double*(3*len(snapshots)*N))()
+                sa.serialize_particle_data(snapshots, threads=threads, m=m, xyz=xyz, vxvyvz=vxvyvz)
+                for k, snapshot in enumerate(snapshots):
+                    with warnings.catch_warnings():
+                        warnings.simplefilter("ignore")
+                        s = sa[snapshot]
+                    s.integrator_synchronize()
+                    for j in range(N):
+                        self.assertEqual(s.particles[j].m, m[k*N+j])
+                        self.assertEqual(s.particles[j].x, xyz[3*(k*N+j)+0])
+                        self.assertEqual(s.particles[j].z, xyz[3*(k*N+j)+2])
+                        self.assertEqual(s.particles[j].vy, vxvyvz[3*(k*N+j)+1])
+        with self.assertRaises(RuntimeError):
+            sa.serialize_particle_data([len(sa)], m=m)
+
+    def test_sa_export(self):
+        from array import array
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(5):
+            sim.add(m=1e-3,a=1.+0.2*i,e=0.05,inc=0.01*i,f=i)
+        sim.integrator = "whfast"
+        sim.dt = 0.05
+        sim.automateSimulationArchive("test.sa", interval=5.,deletefile=True) 
+        sim.integrate(50.)
+        sa = rebound.SimulationArchive("test.sa")
+        fields = ["x", "vz", "m", "a", "e", "Omega"]
+        Ns, N = len(sa), sim.N
+        for order in ["time", "particle"]:
+            sa.export("sim0.bin", fields=fields, order=order, memmap=False)
+            data = array("d")
+            with open("sim0.bin", "rb") as f:
+                data.frombytes(f.read())
+            self.assertEqual(len(data), len(fields)*Ns*N)
+            for s in range(Ns):
+                sim1 = sa[s]
+                for i in range(N):
+                    p = sim1.particles[i]
+                    idx = s*N+i if order=="time" else i*Ns+s
+                    get = lambda k: data[k*Ns*N+idx]
+                    self.assertEqual(get(0), p.x)
+                    self.assertEqual(get(1), p.vz)
+                    self.assertEqual(get(2), p.m)
+                    if i==0:
+                        self.assertTrue(math.isnan(get(3)))
+                    else:
+                        self.assertAlmostEqual(get(3), p.a, delta=1e-14)
+                        self.assertAlmostEqual(get(4), p.e, delta=1e-14)
+                        self.assertAlmostEqual(get(5), p.Omega, delta=1e-14)
+        with self.assertRaises(AttributeError):
+            sa.export("sim0.bin", fields=["q"], memmap=False)
+
+    def test_sa_particles_diff(self):
+        # Only one particle moves. Snapshots only store this particle.
+        sim = rebound.Simulation()
+        sim.G = 0.
+        sim.integrator = "leapfrog"
+        sim.dt = 0.1
+        for i in range(100):
+            sim.add(m=1., x=i)
+        sim.particles[7].vy = 1.
+        sim.automateSimulationArchive("test.sa", interval=1.,deletefile=True) 
+        sim.integrate(10.)
+        sa = rebound.SimulationArchive("test.sa")
+        self.assertEqual(len(sa), 11)
+        # Storing all particles would require more than 100*128 bytes per snapshot
+        self.assertLess(os.path.getsize("test.sa")-sa.offset[1], 10*1000)
+        for i in range(len(sa)):
+            sim1 = sa[i]
+            self.assertEqual(sim1.N, 100)
+            self.assertAlmostEqual(sim1.particles[7].y, sim1.t, delta=1e-12)
+            self.assertEqual(sim1.particles[8].x, 8.)
+            self.assertEqual(sim1.particles[8].y, 0.)
+        self.assertEqual(sim1.particles[7].y, sim.particles[7].y)
+
+    def test_sa_load_snapshot(self):
+        for integrator in ["ias15", "whfast", "leapfrog"]:
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=2,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=0.,a=3,e=0.1)
+            sim.integrator = integrator
+            sim.ri_whfast.safe_mode = 0
+            sim.dt = 0.1313
+            sim.automateSimulationArchive("test.sa", 1.,deletefile=True)
+            sim.integrate(20.,exact_finish_time=0)
+            sa = rebound.SimulationArchive("test.sa")
+            sim = sa[0]
+            for i in [1, 2, 3, 3, 15, 0, 7, -1, 4]:
+                sa.load_snapshot(sim, i)
+                sim0 = sa[i]
+                self.assertEqual(sim0.t, sim.t)
+                self.assertEqual(sim0.steps_done, sim.steps_done)
+                for j in range(sim0.N):
+                    self.assertEqual(sim0.particles[j].x, sim.particles[j].x)
+                    self.assertEqual(sim0.particles[j].vz, sim.particles[j].vz)
+                if i in [3, 0]:
+                    # Integrate (all fields are read again in the next call)
+                    sim.integrate(sim.t+1.)
+                    sim0.integrate(sim0.t+1.)
+                    self.assertEqual(sim0.particles[1].x, sim.particles[1].x)
+                    sa.load_snapshot(sim, i)
+                    self.assertEqual(sim.particles[1].x, sa[i].particles[1].x)
+        with self.assertRaises(IndexError):
+            sa.load_snapshot(sim, len(sa))
+
+    def test_sa_exact_cache(self):
+        # Consecutive exact lookups continue from the previous integration.
+        for integrator in ["ias15", "whfast"]:
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=2,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.integrator = integrator
+            sim.dt = 0.1313
+            sim.automateSimulationArchive("test.sa", 10.,deletefile=True)
+            sim.integrate(40.,exact_finish_time=0)
+            sa = rebound.SimulationArchive("test.sa")
+            for tget in [3.1, 7.7, 7.7, 8.3, 12.05, 19.9, 5.5, 33.3]:
+                sim1 = sa.getSimulation(tget,mode="exact")
+                sim0 = rebound.SimulationArchive("test.sa").getSimulation(tget,mode="exact")
+                self.assertEqual(sim1.t, tget)
+                self.assertEqual(sim0.t, sim1.t)
+                for i in range(sim0.N):
+                    self.assertEqual(sim0.particles[i].x, sim1.particles[i].x)
+                    self.assertEqual(sim0.particles[i].vy, sim1.particles[i].vy)
+                # Returned simulations can be integrated further
+                sim0.integrate(tget+1.)
+                sim1.integrate(tget+1.)
+                self.assertEqual(sim0.particles[1].x, sim1.particles[1].x)
+
+    def stream_simulation(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(10):
+            sim.add(m=1e-5,a=1.+0.2*i,e=0.05,f=i)
+        sim.integrator = "whfast"
+        sim.dt = 0.05
+        return sim
+
+    def test_sa_stream_pipe(self):
+        import threading
+        def write(fd, compression):
+            sim = self.stream_simulation()
+            sim.simulationarchive_compression = compression
+            stream = rebound.SimulationArchiveStream(fd)
+            for t in range(11):
+                sim.integrate(5.*t)
+                stream.write(sim)
+            stream.close()
+            os.close(fd)
+        sim0 = self.stream_simulation()
+        if os.path.isfile("test.sa"):
+            os.remove("test.sa")
+        for t in range(11):
+            sim0.integrate(5.*t)
+            sim0.simulationarchive_snapshot("test.sa")
+        sa = rebound.SimulationArchive("test.sa")
+        for compression in [0, 1]:
+            fd_read, fd_write = os.pipe()
+            thread = threading.Thread(target=write, args=(fd_write, compression))
+            thread.start()
+            sims = []
+            with rebound.SimulationArchiveStream(fd_read) as stream:
+                for sim in stream:
+                    sims.append(sim)
+            thread.join()
+            os.close(fd_read)
+            self.assertEqual(len(sims), sa.nblobs)
+            for i in range(sa.nblobs):
+                s0 = sa[i]
+                self.assertEqual(s0.t, sims[i].t)
+                for j in range(s0.N):
+                    self.assertEqual(s0.particles[j].x, sims[i].particles[j].x)
+                    self.assertEqual(s0.particles[j].vz, sims[i].particles[j].vz)
+            # Restarting from a streamed snapshot is bitwise exact
+            sim, s0 = sims[5], sa[5]
+            sim.integrate(50.)
+            s0.integrate(50.)
+            self.assertEqual(sim.particles[3].x, s0.particles[3].x)
+
+    def test_sa_stream_socket(self):
+        import socket
+        sock_write, sock_read = socket.socketpair()
+        sim = self.stream_simulation()
+        sim.simulationarchive_physical_only = 1
+        writer = rebound.SimulationArchiveStream(sock_write)
+        reader = rebound.SimulationArchiveStream(sock_read)
+        sock_read.setblocking(False)
+        with self.assertRaises(BlockingIOError):
+            reader.read()
+        # Snapshots can be read as soon as they have been written
+        for t in range(5):
+            sim.integrate(1.*t)
+            writer.write(sim)
+            with warnings.catch_warnings(record=True) as w:
+                warnings.simplefilter("always")
+                sim1 = reader.read()
+            self.assertEqual(len(w), 0 if t==0 else 1)
+            self.assertEqual(sim1.t, sim.t)
+            self.assertAlmostEqual(sim1.particles[3].x, sim.particles[3].x, delta=1e-15)
+        with self.assertRaises(BlockingIOError):
+            reader.read()
+        sock_write.close()
+        sock_read.setblocking(True)
+        self.assertIsNone(reader.read())
+        sock_read.close()
+
+    def test_sa_stream_file(self):
+        sim = self.stream_simulation()
+        with open("test.sa", "wb") as f:
+            stream = rebound.SimulationArchiveStream(f)
+            for t in range(4):
+                sim.integrate(1.*t)
+                stream.write(sim)
+        # A saved stream is a SimulationArchive which can be appended to
+        sa = rebound.SimulationArchive("test.sa")
+        self.assertEqual(sa.nblobs, 4)
+        self.assertEqual(sa[3].particles[2].x, sim.particles[2].x)
+        sim.integrate(4.)
+        sim.simulationarchive_snapshot("test.sa")
+        sa = rebound.SimulationArchive("test.sa")
+        self.assertEqual(sa.nblobs, 5)
+        self.assertEqual(sa[4].t, 4.)
+        self.assertEqual(sa[4].particles[2].x, sim.particles[2].x)
+        # A stream which ends in the middle of a snapshot
+        with open("test.sa", "rb") as f:
+            data = f.read()
+        with open("test.sa", "wb") as f:
+            f.write(data[:-100])
+        with open("test.sa", "rb") as f:
+            with warnings.catch_warnings(record=True) as w:
+                warnings.simplefilter("always")
+                sims = list(rebound.SimulationArchiveStream(f))
+                self.assertEqual(len(w), 1)
+        self.assertEqual(len(sims), 4)
+        self.assertEqual(sims[3].t, 3.)
+        with open("test.sa", "wb") as f:
+            f.write(b"not a simulationarchive")
+        with open("test.sa", "rb") as f:
+            with self.assertRaises(RuntimeError):
+                rebound.SimulationArchiveStream(f).read()
+
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,69 @@
+import rebound
+import unittest
+
+class TestSimulationState(unittest.TestCase):
+    def setup_sim(self, integrator):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+        sim.add(m=1e-3,a=1.3,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+        sim.integrator = integrator
+        sim.dt = 0.01
+        if integrator=="whfast":
+            sim.ri_whfast.safe_mode = 0
+        return sim
+
+    def test_restore(self):
+        for integrator in ["ias15", "whfast", "mercurius", "janus", "saba", "eos", "bs", "hermite", "leapfrog"]:
+            sim = self.setup_sim(integrator)
+            sim.integrate(1., exact_finish_time=0)
+            t0 = sim.t
+            state = sim.save_state()
+            sim.integrate(2., exact_finish_time=0)
+            t1, x1, vy1 = sim.t, sim.particles[1].x, sim.particles[2].vy
+            for i in range(3):
+                sim.restore_state(state)
+                self.assertEqual(sim.t, t0)
+                sim.integrate(2., exact_finish_time=0)
+                self.assertEqual(sim.t, t1)
+                self.assertEqual(sim.particles[1].x, x1)
+                self.assertEqual(sim.particles[2].vy, vy1)
+
+    def test_reuse(self):
+        sim = self.setup_sim("ias15")
+        state = sim.save_state()
+        sim.integrate(1.)
+        self.assertIs(sim.save_state(state), state)
+        x1 = sim.particles[1].x
+        sim.integrate(2.)
+        sim.restore_state(state)
+        self.assertEqual(sim.t, 1.)
+        self.assertEqual(sim.particles[1].x, x1)
+
+    def test_removed_particle(self):
+        sim = self.setup_sim("whfast")
+        sim.integrate(1., exact_finish_time=0)
+        state = sim.save_state()
+        sim.integrate(2., exact_finish_time=0)
+        x1 = sim.particles[2].x
+        sim.restore_state(state)
+        sim.remove(1)
+        self.assertEqual(sim.N, 2)
+        sim.restore_state(state)
+        self.assertEqual(sim.N, 3)
+        sim.integrate(2., exact_finish_time=0)
+        self.assertEqual(sim.particles[2].x, x1)
+
+    def test_megno(self):
+        sim = self.setup_sim("whfast")
+        sim.init_megno()
+        sim.integrate(1., exact_finish_time=0)
+        state = sim.save_state()
+        sim.integrate(2., exact_finish_time=0)
+        megno = sim.calculate_megno()
+        sim.restore_state(state)
+        sim.integrate(2., exact_finish_time=0)
+        self.assertEqual(sim.calculate_megno(), megno)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,72 @@
+import rebound
+import unittest
+
+def create_simulation(integrator):
+    sim = rebound.Simulation()
+    sim.integrator = integrator
+    sim.add(m=1.)
+    sim.add(m=1e-3, a=1., e=0.1)
+    sim.add(m=1e-3, a=1.6, e=0.1)
+    sim.move_to_com()
+    return sim
+
+class TestTune(unittest.TestCase):
+    def test_dt(self):
+        sim = create_simulation("whfast")
+        sim.dt = 0.001
+        x = sim.particles[1].x
+        dt, results = sim.tune("dt", [0.002, 0.02, 0.2, 0.5], 100., 1e-6)
+        self.assertEqual(len(results), 4)
+        self.assertEqual(sim.dt, dt)
+        self.assertIn(dt, [0.002, 0.02])
+        for r in results[:2]:
+            self.assertLess(r.error, 1e-6)
+            self.assertGreaterEqual(r.t, 100.)
+        for r in results[2:]:
+            # Pilots stop once the error target is exceeded
+            self.assertGreater(r.error, 1e-6)
+            self.assertLess(r.t, 100.)
+        # The simulation itself is not integrated
+        self.assertEqual(sim.t, 0.)
+        self.assertEqual(sim.particles[1].x, x)
+
+    def test_no_apply(self):
+        sim = create_simulation("whfast")
+        sim.dt = 0.001
+        dt, results = sim.tune("dt", [0.01, 0.1], 10., 1e-4, apply=False)
+        self.assertIsNotNone(dt)
+        self.assertEqual(sim.dt, 0.001)
+
+    def test_target_not_met(self):
+        sim = create_simulation("whfast")
+        sim.dt = 0.001
+        dt, results = sim.tune("dt", [0.1, 0.2], 10., 1e-14)
+        self.assertIsNone(dt)
+        self.assertEqual(sim.dt, 0.001)
+
+    def test_epsilon(self):
+        sim = create_simulation("ias15")
+        epsilon, results = sim.tune("epsilon", [1e-9, 1e-2], 10., 1e-12)
+        self.assertEqual(epsilon, 1e-9)
+        self.assertEqual(sim.ri_ias15.epsilon, 1e-9)
+
+    def test_setup(self):
+        sim = create_simulation("whfast")
+        calls = []
+        def setup(s):
+            calls.append(s.t)
+        sim.tune("dt", [0.01, 0.02], 1., 1e-4, setup=setup)
+        self.assertEqual(len(calls), 2)
+
+    def test_errors(self):
+        sim = create_simulation("whfast")
+        with self.assertRaises(ValueError):
+            sim.tune("unknown", [1.], 1., 1e-6)
+        with self.assertRaises(RuntimeError):
+            sim.tune("hillfac", [1., 2.], 1., 1e-6)
+        sim.integrator = "ias15"
+        with self.assertRaises(RuntimeError):
+            sim.tune("dt", [0.01], 1., 1e-6)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -42,9 +42,29 @@ class TestVariational(unittest.TestCase):
                 self.assertLess(abs(dp.vy),prec)
                 self.assertLess(abs(dp.vz),prec)
                 self.assertLess(abs(dp.m ),prec)
-    
-    
-    
+
+    def test_calculate_derivatives(self):
+        for params in self.paramlist:
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(**dict(zip(self.paramkeys, params)))
+            variations = list(self.paramkeys)
+            for i, v in enumerate(self.paramkeys):
+                for v2 in self.paramkeys[i:]:
+                    variations.append((v2, v))
+            derivatives = sim.calculate_derivatives(1, variations)
+            for v, d in zip(variations, derivatives):
+                if isinstance(v, str):
+                    p = rebound.Particle(simulation=sim, particle=sim.particles[1], variation=v)
+                else:
+                    p = rebound.Particle(simulation=sim, particle=sim.particles[1], variation=v[0], variation2=v[1])
+                for attr in ["m", "x", "y", "z", "vx", "vy", "vz"]:
+                    self.assertAlmostEqual(getattr(d, attr), getattr(p, attr), delta=1e-14*max(1., abs(getattr(p, attr))))
+        with self.assertRaises(ValueError):
+            sim.calculate_derivatives(1, [("e","k")])
+
+
+
     def test_all_2nd_order_full(self):
         self.run_2nd_order_full(com=False)
     def test_all_2nd_order_full_com(self):
@@ -132,6 +132,24 @@ class TestIntegratorWHFast(unittest.TestCase):
         self.assertLess(abs(o1.a-o4.a),2e-16)
         self.assertLess(abs(o2.a-o3.a),2e-16)
     
+    def test_kepler_warm_start(self):
+        sims = []
+        for kepler_warm_start in [0, 1]:
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            for i in range(20):
+                sim.add(a=1.+0.1*i, e=0.01*i, f=0.3*i)
+            sim.integrator = "whfast"
+            sim.ri_whfast.coordinates = "democraticheliocentric"
+            sim.ri_whfast.kepler_warm_start = kepler_warm_start
+            sim.dt = 0.05
+            sim.integrate(100.)
+            sims.append(sim)
+        self.assertLess(sims[1].counters.kepler_iterations, sims[0].counters.kepler_iterations)
+        for p0, p1 in zip(sims[0].particles, sims[1].particles):
+            self.assertAlmostEqual(p0.x, p1.x, delta=1e-12)
+            self.assertAlmostEqual(p0.vy, p1.vy, delta=1e-12)
+
     def test_order_doesnt_matter_tp1(self):
         sim = rebound.Simulation()
         sim.add(m=1)
@@ -1,6 +1,7 @@
 from ctypes import c_uint32, c_uint, c_ulong, c_char_p, c_double
 from . import clibrebound
 import sys
+import struct
 
 def hash(key):
     hash_types = c_uint32, c_uint, c_ulong
@@ -56,3 +57,28 @@ def M_to_E(e, M):
         ValueError("Arguments of M_to_E need to be floats.")
     clibrebound.reb_tools_M_to_E.restype = c_double
     return clibrebound.reb_tools_M_to_E(c_double(e), c_double(M))
+
+def read_recording(filename):
+    """
+    Reads a file written by the diagnostics recorder (see `Simulation.recorder_enable`).
+
+    Returns a dictionary with the column names as keys and lists of the samples as values.
+    """
+    with open(filename, "rb") as f:
+        data = f.read()
+    if data[:8] != b"REBREC1\0":
+        raise ValueError("File is not a REBOUND diagnostics recording.")
+    N_columns, = struct.unpack_from("=i", data, 8)
+    offset = 12
+    names = []
+    for c in range(N_columns):
+        names.append(data[offset:offset+16].split(b"\0")[0].decode("ascii"))
+        offset += 16
+    columns = {name: [] for name in names}
+    while offset+4 <= len(data):
+        N_rows, = struct.unpack_from("=i", data, offset)
+        offset += 4
+        for name in names:
+            columns[name].extend(struct.unpack_from("=%dd" % N_rows, data, offset))
+            offset += 8*N_rows
+    return columns
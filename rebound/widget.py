@@ -1,36 +1,30 @@
 shader_code = """
 <script id="orbit_shader-vs" type="x-shader/x-vertex">
     uniform vec3 focus;
-    uniform vec3 aef;
-    uniform vec3 omegaOmegainc;
+    uniform vec3 dx;
+    uniform vec3 dv;
+    uniform float gm;
     attribute float lintwopi;
     varying float lin;
     uniform mat4 mvp;
     const float M_PI = 3.14159265359;
     void main() {
-       float a = aef.x;
-       float e = aef.y;
-       float f = aef.z+lintwopi;
+       vec3 h = cross(dx,dv);
+       float d = length(dx);
+       vec3 ev = cross(dv,h)/gm - dx/d;
+       float e = length(ev);
+       float p = dot(h,h)/gm;
+       vec3 P = e>1e-6 ? ev/e : dx/d;
+       vec3 Q = normalize(cross(h,P));
+       float f = atan(dot(dx,Q),dot(dx,P))+lintwopi;
        lin = lintwopi/(M_PI*2.);
        if (e>1.){
            float theta_max = acos(-1./e);
            f = 0.0001-theta_max+1.9998*lin*theta_max;
            lin = sqrt(min(0.5,lin));
        }
-       float omega = omegaOmegainc.x;
-       float Omega = omegaOmegainc.y;
-       float inc = omegaOmegainc.z;
-       float r = a*(1.-e*e)/(1. + e*cos(f));
-       float cO = cos(Omega);
-       float sO = sin(Omega);
-       float co = cos(omega);
-       float so = sin(omega);
-       float cf = cos(f);
-       float sf = sin(f);
-       float ci = cos(inc);
-       float si = sin(inc);
-       vec3 pos = vec3(r*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci),r*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci),+ r*(so*cf+co*sf)*si);
-       gl_Position = mvp*(vec4(focus+pos, 1.0));
+       float r = p/(1. + e*cos(f));
+       gl_Position = mvp*(vec4(focus+r*(cos(f)*P+sin(f)*Q), 1.0));
     }
 </script>
 <script id="orbit_shader-fs" type="x-shader/x-fragment">
@@ -287,8 +281,9 @@ function startGL(reboundView) {
     gl.bufferSubData(gl.ARRAY_BUFFER, 0, lintwopi)
     reboundView.orbit_shader_mvp_location = gl.getUniformLocation(reboundView.orbit_shader_program,"mvp");
     reboundView.orbit_shader_focus_location = gl.getUniformLocation(reboundView.orbit_shader_program,"focus");
-    reboundView.orbit_shader_aef_location = gl.getUniformLocation(reboundView.orbit_shader_program,"aef");
-    reboundView.orbit_shader_omegaOmegainc_location = gl.getUniformLocation(reboundView.orbit_shader_program,"omegaOmegainc");
+    reboundView.orbit_shader_dx_location = gl.getUniformLocation(reboundView.orbit_shader_program,"dx");
+    reboundView.orbit_shader_dv_location = gl.getUniformLocation(reboundView.orbit_shader_program,"dv");
+    reboundView.orbit_shader_gm_location = gl.getUniformLocation(reboundView.orbit_shader_program,"gm");
     
     reboundView.particle_data_buffer = gl.createBuffer();
     gl.useProgram(reboundView.point_shader_program);
@@ -303,17 +298,27 @@ function updateRenderData(reboundView){
     var overlay = document.getElementById("reboundoverlay-"+reboundView.cid);
     overlay.innerHTML = reboundView.model.get("overlay");
     var previousN = reboundView.N;
-    reboundView.N = reboundView.model.get("N");
     reboundView.t = reboundView.model.get("t");
-    reboundView.particle_data = reboundView.model.get('particle_data');
-    if (reboundView.orbits){
-        reboundView.orbit_data = reboundView.model.get('orbit_data');
+    // Frame layout: uint32 N_draw, uint32 N_orbits, float32 x,y,z per particle, 10 float32 per orbit.
+    // The bytes are copied once so that the typed arrays below are aligned.
+    var frame = reboundView.model.get('frame');
+    if (!frame || frame.byteLength<8){
+        reboundView.N = 0;
+        reboundView.orbit_data = new Float32Array(0);
+        return;
     }
+    var bytes = new Uint8Array(frame.buffer, frame.byteOffset, frame.byteLength).slice();
+    var header = new Uint32Array(bytes.buffer, 0, 2);
+    reboundView.N = header[0];
+    reboundView.orbit_data = new Float32Array(bytes.buffer, 8+4*3*header[0], 10*header[1]);
     var gl = reboundView.gl
     if (reboundView.N>0){
         gl.bindBuffer(gl.ARRAY_BUFFER, reboundView.particle_data_buffer);
-        gl.bufferData(gl.ARRAY_BUFFER, reboundView.N*7*4, gl.DYNAMIC_DRAW);
-        gl.bufferSubData(gl.ARRAY_BUFFER, 0, reboundView.particle_data)
+        if (!reboundView.particle_data_size || reboundView.N>reboundView.particle_data_size){
+            reboundView.particle_data_size = reboundView.N;
+            gl.bufferData(gl.ARRAY_BUFFER, reboundView.N*3*4, gl.DYNAMIC_DRAW);
+        }
+        gl.bufferSubData(gl.ARRAY_BUFFER, 0, new Float32Array(bytes.buffer, 8, 3*reboundView.N));
     }
 }
 function drawGL(reboundView) {
@@ -330,7 +335,7 @@ function drawGL(reboundView) {
     gl.bindBuffer(gl.ARRAY_BUFFER, reboundView.particle_data_buffer);
     var pvp = gl.getAttribLocation(reboundView.point_shader_program,"vp");
     gl.enableVertexAttribArray(pvp);
-    gl.vertexAttribPointer(pvp, 3, gl.FLOAT, 0, 4*7,0); // 4 = size of float
+    gl.vertexAttribPointer(pvp, 3, gl.FLOAT, 0, 4*3,0); // 4 = size of float
     var projection = [0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.];
     if (reboundView.ratio>=1.){
         matortho(projection, 
@@ -362,13 +367,12 @@ function drawGL(reboundView) {
         // Need to do this one by one
         // because WebGL is not supporting
         // instancing:
-        for(i=0;i<reboundView.N-1;i++){
-            var focus = new Float32Array(reboundView.orbit_data.buffer,4*9*i,3);
-            gl.uniform3fv(reboundView.orbit_shader_focus_location,focus);
-            var aef = new Float32Array(reboundView.orbit_data.buffer,4*(9*i+3),3);
-            gl.uniform3fv(reboundView.orbit_shader_aef_location,aef);
-            var omegaOmegainc = new Float32Array(reboundView.orbit_data.buffer,4*(9*i+6),3);
-            gl.uniform3fv(reboundView.orbit_shader_omegaOmegainc_location,omegaOmegainc);
+        var od = reboundView.orbit_data;
+        for(i=0;i<od.length/10;i++){
+            gl.uniform3fv(reboundView.orbit_shader_focus_location,od.subarray(10*i,10*i+3));
+            gl.uniform3fv(reboundView.orbit_shader_dx_location,od.subarray(10*i+3,10*i+6));
+            gl.uniform3fv(reboundView.orbit_shader_dv_location,od.subarray(10*i+6,10*i+9));
+            gl.uniform1f(reboundView.orbit_shader_gm_location,od[10*i+9]);
 
             gl.drawArrays(gl.LINE_STRIP,0,500);
         }
@@ -468,13 +472,12 @@ class Widget(DOMWidget):
     width = traitlets.Float().tag(sync=True)
     height = traitlets.Float().tag(sync=True)
     scale = traitlets.Float().tag(sync=True)
-    particle_data = traitlets.CBytes(allow_none=True).tag(sync=True)
-    orbit_data = traitlets.CBytes(allow_none=True).tag(sync=True)
+    frame = traitlets.CBytes(allow_none=True).tag(sync=True)
     orientation = traitlets.Tuple().tag(sync=True)
     orbits = traitlets.Int().tag(sync=True)
     pointsize = traitlets.Float().tag(sync=True)
     screenshot = traitlets.Unicode().tag(sync=True)
-    def __init__(self,simulation,size=(200,200),orientation=(0.,0.,0.,1.),scale=None,autorefresh=True,pointsize=15,orbits=True, overlay=True):
+    def __init__(self,simulation,size=(200,200),orientation=(0.,0.,0.,1.),scale=None,autorefresh=True,pointsize=15,orbits=True, overlay=True, max_fps=20, max_N=None):
         """ 
         Initializes a Widget.
 
@@ -505,6 +508,13 @@ class Widget(DOMWidget):
             The default point size is 15. 
         overlay : string, optional
             Change the default text overlay. Set to None to hide all text.
+        max_fps : float, optional
+            Automatic refreshes are sent to the browser at most max_fps times per 
+            second (default 20). Refreshes in between are skipped without copying 
+            any data, so a running integration is not slowed down by the widget.
+        max_N : int, optional
+            If set, at most max_N particles are sent to the browser (every 2nd, 4th, ...
+            particle is shown). By default all particles are sent.
         """
         self.screenshotcountall = 0
         self.width, self.height  = size
@@ -515,7 +525,10 @@ class Widget(DOMWidget):
         self.pointsize = pointsize
         self.useroverlay = overlay
         self.simp = pointer(simulation)
-        clibrebound.reb_display_copy_data.restype = c_int
+        self.max_N = 0 if max_N is None else int(max_N)
+        if max_fps:
+            simulation.display_data.contents.frame_interval = int(1000./max_fps)
+        clibrebound.reb_display_prepare_frame.restype = c_int
         if scale is None:
             self.scale = simulation.display_data.contents.scale
         else:
@@ -526,7 +539,7 @@ class Widget(DOMWidget):
 
     def refresh(self, simp=None, isauto=0):
         """ 
-        Manually refreshes a widget.
+        Manually refreshes a widget. Returns True if a new frame was sent.
         
         Note that this function can also be called using the wrapper function of
         the Simulation object: sim.refreshWidgets(). 
@@ -535,26 +548,25 @@ class Widget(DOMWidget):
         if simp is None:
             simp = self.simp
         if self.autorefresh==0 and isauto==1:
-            return
+            return False
         sim = simp.contents
-        size_changed = clibrebound.reb_display_copy_data(simp)
-        clibrebound.reb_display_prepare_data(simp,c_int(self.orbits))
-        if sim.N>0:
-            self.particle_data = (c_char * (4*7*sim.N)).from_address(sim.display_data.contents.particle_data).raw
-            if self.orbits:
-                self.orbit_data = (c_char * (4*9*(sim.N-1))).from_address(sim.display_data.contents.orbit_data).raw
-        if size_changed:
-            #TODO: Implement better GPU size change
-            pass
-        if self.useroverlay==True:
-            self.overlay = "REBOUND (%s), N=%d, t=%g"%(sim.integrator,sim.N,sim.t)
-        elif self.useroverlay is None or self.useroverlay==False:
-            self.overlay = ""
-        else:
-            self.overlay = self.useroverlay + ", N=%d, t=%g"%(sim.N,sim.t)
-        self.N = sim.N
-        self.t = sim.t
-        self.count += 1
+        # Automatic refreshes are throttled in C. Manual refreshes are always sent.
+        if not clibrebound.reb_display_prepare_frame(simp, c_int(self.orbits), c_int(self.max_N), c_int(1-isauto)):
+            return False
+        data = sim.display_data.contents
+        frame = (c_char * data.frame_size).from_address(data.frame).raw
+        with self.hold_sync():
+            self.frame = frame
+            if self.useroverlay==True:
+                self.overlay = "REBOUND (%s), N=%d, t=%g"%(sim.integrator,sim.N,sim.t)
+            elif self.useroverlay is None or self.useroverlay==False:
+                self.overlay = ""
+            else:
+                self.overlay = self.useroverlay + ", N=%d, t=%g"%(sim.N,sim.t)
+            self.N = sim.N
+            self.t = sim.t
+            self.count += 1
+        return True
 
     def takeScreenshot(self, times=None, prefix="./screenshot", resetCounter=False, archive=None,mode="snapshot"):
         """
@@ -19,6 +19,13 @@ try:
 except:
     ghash_arg = "-DGITHASH=a32e1d9227026056c51355dbf7c8ff8db3d30d88" #GITHASHAUTOUPDATE
 
+# Set REBOUND_PORTABLE=1 to build a library which runs on any CPU of the same architecture. 
+# Hot kernels are then compiled for several instruction sets and selected at load time.
+if os.environ.get("REBOUND_PORTABLE", "0") == "1":
+    march_args=['-DPORTABLE']
+else:
+    march_args=['-march=native']
+
 extra_link_args=[]
 if sys.platform == 'darwin':
     from distutils import sysconfig
@@ -35,10 +42,12 @@ libreboundmodule = Extension('librebound',
                                 'src/integrator_eos.c',
                                 'src/integrator_leapfrog.c',
                                 'src/integrator_bs.c',
+                                'src/integrator_hermite.c',
                                 'src/integrator_janus.c',
                                 'src/integrator_sei.c',
                                 'src/integrator.c',
                                 'src/gravity.c',
+                                'src/gravity_fft.c',
                                 'src/boundary.c',
                                 'src/display.c',
                                 'src/collision.c',
@@ -47,15 +56,26 @@ libreboundmodule = Extension('librebound',
                                 'src/tree.c',
                                 'src/particle.c',
                                 'src/binarydiff.c',
+                                'src/compression.c',
+                                'src/profiling.c',
+                                'src/recorder.c',
+                                'src/forces.c',
+                                'src/reductions.c',
+                                'src/allocator.c',
+                                'src/parareal.c',
+                                'src/interaction_groups.c',
+                                'src/autoselect.c',
                                 'src/output.c',
                                 'src/input.c',
                                 'src/simulationarchive.c',
+                                'src/ensemble.c',
+                                'src/simulationstate.c',
+                                'src/ascii.c',
                                 'src/transformations.c',
                                 ],
                     include_dirs = ['src'],
                     define_macros=[ ('LIBREBOUND', None) ],
-                    # Removed '-march=native' for now.
-                    extra_compile_args=['-fstrict-aliasing', '-O3','-std=c99','-Wno-unknown-pragmas', ghash_arg, '-DLIBREBOUND', '-D_GNU_SOURCE', '-fPIC', '-march=native', '-fno-math-errno', '-fno-trapping-math'],
+                    extra_compile_args=['-fstrict-aliasing', '-O3','-std=c99','-Wno-unknown-pragmas', ghash_arg, '-DLIBREBOUND', '-D_GNU_SOURCE', '-fPIC', '-fno-math-errno', '-fno-trapping-math']+march_args,
                     extra_link_args=extra_link_args,
                     )
 
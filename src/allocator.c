@@ -0,0 +1,151 @@
+/**
+ * @file    allocator.c
+ * @brief   Aligned memory allocation for large arrays.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details The particle array and the large integrator arrays (WHFast, 
+ * IAS15, MERCURIUS) are allocated with reb_malloc(). Blocks are aligned to 
+ * 64 bytes. By default, large blocks are aligned to 2 MB and the kernel is 
+ * advised to back them with transparent huge pages. Users can replace the 
+ * allocator with reb_set_allocator(), for example to embed REBOUND in an 
+ * application with its own memory management.
+ *
+ * Every block starts with a header which stores its capacity. This allows
+ * reb_realloc() to work with allocators which cannot resize blocks, and to 
+ * reuse blocks which are large enough without copying.
+ * 
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "rebound.h"
+#include "allocator.h"
+
+/**
+ * @brief Size of huge pages and alignment of blocks which use them.
+ */
+#define REB_HUGEPAGE_SIZE (2*1024*1024)
+
+// The header is padded so that the block after it keeps the alignment.
+struct reb_allocation_header {
+    size_t capacity;
+    char padding[REB_ALIGNMENT-sizeof(size_t)];
+};
+
+static size_t reb_hugepage_threshold = REB_HUGEPAGE_SIZE;
+
+static void* reb_default_allocate(size_t size, size_t alignment, void* data){
+    void* ptr = NULL;
+    const int hugepages = reb_hugepage_threshold && size>=reb_hugepage_threshold;
+    if (hugepages && alignment<REB_HUGEPAGE_SIZE){
+        alignment = REB_HUGEPAGE_SIZE;
+    }
+    if (posix_memalign(&ptr, alignment, size)){
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (hugepages){
+        madvise(ptr, size, MADV_HUGEPAGE); // Only a hint. Errors are ignored.
+    }
+#endif // MADV_HUGEPAGE
+    return ptr;
+}
+
+static void reb_default_deallocate(void* ptr, void* data){
+    free(ptr);
+}
+
+static void* (*reb_allocate)(size_t size, size_t alignment, void* data) = reb_default_allocate;
+static void (*reb_deallocate)(void* ptr, void* data) = reb_default_deallocate;
+static void* reb_allocator_data = NULL;
+
+void reb_set_allocator(void* (*allocate)(size_t size, size_t alignment, void* data), void (*deallocate)(void* ptr, void* data), void* data){
+    if (allocate==NULL || deallocate==NULL){
+        reb_allocate = reb_default_allocate;
+        reb_deallocate = reb_default_deallocate;
+        reb_allocator_data = NULL;
+    }else{
+        reb_allocate = allocate;
+        reb_deallocate = deallocate;
+        reb_allocator_data = data;
+    }
+}
+
+void reb_set_hugepage_threshold(size_t size){
+    reb_hugepage_threshold = size;
+}
+
+void* reb_malloc(size_t size){
+    struct reb_allocation_header* const h = reb_allocate(sizeof(struct reb_allocation_header)+size, REB_ALIGNMENT, reb_allocator_data);
+    if (h==NULL){
+        fprintf(stderr, "\n\033[1mFatal error! Exiting now.\033[0m Cannot allocate %zu bytes.\n", size);
+        exit(EXIT_FAILURE);
+    }
+    h->capacity = size;
+    return h+1;
+}
+
+void* reb_calloc(size_t N, size_t size){
+    void* const ptr = reb_malloc(N*size);
+    memset(ptr, 0, N*size);
+    return ptr;
+}
+
+static inline size_t reb_capacity(void* ptr){
+    return ((struct reb_allocation_header*)ptr - 1)->capacity;
+}
+
+void* reb_realloc(void* ptr, size_t size){
+    if (ptr==NULL){
+        return reb_malloc(size);
+    }
+    const size_t capacity = reb_capacity(ptr);
+    if (size<=capacity){
+        return ptr;
+    }
+    void* const ptr_new = reb_malloc(size);
+    memcpy(ptr_new, ptr, capacity);
+    reb_free(ptr);
+    return ptr_new;
+}
+
+void* reb_reserve(void* ptr, size_t size){
+    if (ptr && size<=reb_capacity(ptr)){
+        return ptr;
+    }
+    reb_free(ptr);
+    return reb_malloc(size);
+}
+
+void* reb_malloc_copy(const void* src, size_t size){
+    if (src==NULL || size==0){
+        return NULL;
+    }
+    void* const dst = reb_malloc(size);
+    memcpy(dst, src, size);
+    return dst;
+}
+
+void reb_free(void* ptr){
+    if (ptr){
+        reb_deallocate((struct reb_allocation_header*)ptr - 1, reb_allocator_data);
+    }
+}
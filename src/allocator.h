@@ -0,0 +1,42 @@
+/**
+ * @file    allocator.h
+ * @brief   Aligned memory allocation for large arrays.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _ALLOCATOR_H
+#define _ALLOCATOR_H
+#include <stddef.h>
+
+/**
+ * @brief Alignment in bytes of all blocks returned by reb_malloc().
+ */
+#define REB_ALIGNMENT 64
+
+// reb_malloc(), reb_calloc(), reb_realloc(), reb_reserve() and reb_free() are declared in rebound.h.
+// Blocks allocated with reb_malloc() must only be resized with reb_realloc() or reb_reserve() and freed with reb_free().
+
+/**
+ * @brief Returns a new block with a copy of size bytes of src or NULL if src is NULL or size is 0.
+ */
+void* reb_malloc_copy(const void* src, size_t size);
+
+#endif // _ALLOCATOR_H
@@ -0,0 +1,364 @@
+/**
+ * @file    ascii.c
+ * @brief   Reading and writing particles in text files.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details Each line of the text contains one particle with a fixed set
+ * of columns. The columns can be separated by spaces, tabs or commas.
+ * Empty lines and lines starting with # are ignored. Text is parsed and
+ * formatted in large buffers on several threads. Particles are only added
+ * to the simulation once the entire text has been parsed successfully.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rebound.h"
+#include "ascii.h"
+#include "tools.h"
+#include "allocator.h"
+
+#define REB_ASCII_N_COLUMNS 8   ///< Number of columns in both formats
+
+struct reb_ascii_job {
+    struct reb_simulation* r;
+    enum REB_ASCII_FORMAT format;
+    int N_threads;
+    int N;                          // Number of lines or particles
+    struct reb_particle primary;    // Only used for REB_ASCII_ORBITS
+    // Input
+    const char* buf;
+    const size_t* lines;            // Offset of each line in buf
+    size_t size;
+    struct reb_particle* particles; // Parsed particles
+    // Output
+    int precision;
+    char delimiter;
+};
+
+struct reb_ascii_thread {
+    struct reb_ascii_job* job;
+    int thread;
+    int error_line;                 // First line which could not be parsed or converted (-1 if none)
+    char* buf;                      // Formatted text (output only)
+    size_t size;
+};
+
+// Runs func for every thread. The calling thread does the work of the first thread
+// and of all threads which could not be created.
+static void reb_ascii_run(struct reb_ascii_thread* threads, int N_threads, void* (*func)(void*)){
+    pthread_t* pthreads = malloc(sizeof(pthread_t)*N_threads);
+    int* started = calloc(N_threads, sizeof(int));
+    for (int k=1;k<N_threads;k++){
+        started[k] = pthread_create(&pthreads[k], NULL, func, &threads[k])==0;
+    }
+    func(&threads[0]);
+    for (int k=1;k<N_threads;k++){
+        if (started[k]){
+            pthread_join(pthreads[k], NULL);
+        }else{
+            func(&threads[k]);
+        }
+    }
+    free(started);
+    free(pthreads);
+}
+
+static struct reb_ascii_thread* reb_ascii_threads(struct reb_ascii_job* job, int N_threads){
+    if (N_threads<=0){
+        N_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    // Not worth starting threads for only a few lines.
+    const int N_per_thread_min = 4096;
+    if (N_threads > job->N/N_per_thread_min){
+        N_threads = job->N/N_per_thread_min;
+    }
+    if (N_threads<1) N_threads = 1;
+    job->N_threads = N_threads;
+    struct reb_ascii_thread* threads = calloc(N_threads, sizeof(struct reb_ascii_thread));
+    for (int k=0;k<N_threads;k++){
+        threads[k].job = job;
+        threads[k].thread = k;
+        threads[k].error_line = -1;
+    }
+    return threads;
+}
+
+static void* reb_ascii_parse_thread(void* args){
+    struct reb_ascii_thread* const t = args;
+    struct reb_ascii_job* const job = t->job;
+    const int i_start = (int)((long long)job->N*t->thread/job->N_threads);
+    const int i_end = (int)((long long)job->N*(t->thread+1)/job->N_threads);
+    const char* const end = job->buf + job->size;
+    for (int i=i_start;i<i_end;i++){
+        const char* c = job->buf + job->lines[i];
+        double v[REB_ASCII_N_COLUMNS];
+        int k = 0;
+        for (;k<REB_ASCII_N_COLUMNS;k++){
+            while (c<end && (*c==' ' || *c=='\t' || *c==',' || *c=='\r')){
+                c++;
+            }
+            if (c>=end || *c=='\n'){
+                break;
+            }
+            char* next;
+            v[k] = strtod(c, &next);
+            if (next==c){
+                break;
+            }
+            c = next;
+        }
+        if (k<REB_ASCII_N_COLUMNS){
+            t->error_line = i;
+            return NULL;
+        }
+        struct reb_particle p = {0};
+        if (job->format==REB_ASCII_ORBITS){
+            int err = 0;
+            p = reb_tools_orbit_to_particle_err(job->r->G, job->primary, v[0], v[2], v[3], v[4], v[5], v[6], v[7], &err);
+            if (err){
+                t->error_line = i;
+                return NULL;
+            }
+        }else{
+            p.m = v[0];
+            p.x = v[2];
+            p.y = v[3];
+            p.z = v[4];
+            p.vx = v[5];
+            p.vy = v[6];
+            p.vz = v[7];
+        }
+        p.r = v[1];
+        job->particles[i] = p;
+    }
+    return NULL;
+}
+
+int reb_input_particles_ascii_from_buffer(struct reb_simulation* const r, const char* const buf, const size_t size, const enum REB_ASCII_FORMAT format, int N_threads){
+    struct reb_ascii_job job = {
+        .r = r,
+        .format = format,
+        .buf = buf,
+        .size = size,
+    };
+    if (format==REB_ASCII_ORBITS){
+        if (r->N==0){
+            reb_error(r, "Orbital elements are relative to the first particle. Add a particle before reading orbital elements.");
+            return -1;
+        }
+        job.primary = r->particles[0];
+    }
+
+    // Find the beginning of all lines which are not empty and not comments.
+    int allocatedN = 1024;
+    size_t* lines = malloc(sizeof(size_t)*allocatedN);
+    const char* c = buf;
+    const char* const end = buf+size;
+    while (c<end){
+        const char* const line_end = memchr(c, '\n', end-c);
+        const char* first = c;
+        while (first<end && (*first==' ' || *first=='\t' || *first=='\r')){
+            first++;
+        }
+        if (first<end && *first!='\n' && *first!='#'){
+            if (job.N==allocatedN){
+                allocatedN *= 2;
+                lines = realloc(lines, sizeof(size_t)*allocatedN);
+            }
+            lines[job.N++] = c-buf;
+        }
+        if (line_end==NULL){
+            break;
+        }
+        c = line_end+1;
+    }
+    job.lines = lines;
+    job.particles = malloc(sizeof(struct reb_particle)*(job.N?job.N:1));
+
+    struct reb_ascii_thread* threads = reb_ascii_threads(&job, N_threads);
+    reb_ascii_run(threads, job.N_threads, reb_ascii_parse_thread);
+    int error_line = -1;
+    for (int k=0;k<job.N_threads;k++){
+        if (threads[k].error_line>=0){
+            error_line = threads[k].error_line;
+            break;
+        }
+    }
+    free(threads);
+
+    if (error_line>=0){
+        // Report the line number in the text, counting from 1.
+        int line_number = 1;
+        for (const char* l=buf; l<buf+lines[error_line]; l++){
+            if (*l=='\n') line_number++;
+        }
+        char msg[256];
+        if (format==REB_ASCII_ORBITS){
+            snprintf(msg, 256, "Line %d requires 8 numbers (mass, radius, a, e, inc, Omega, omega, f) describing a valid orbit.", line_number);
+        }else{
+            snprintf(msg, 256, "Line %d requires 8 numbers (mass, radius, x, y, z, vx, vy, vz).", line_number);
+        }
+        reb_error(r, msg);
+        free(lines);
+        free(job.particles);
+        return -1;
+    }
+
+    // Particles are added one by one so that integrators and the tree are updated.
+    if (r->allocatedN < r->N+job.N){
+        r->allocatedN = r->N+job.N;
+        r->particles = reb_realloc(r->particles, sizeof(struct reb_particle)*r->allocatedN);
+    }
+    for (int i=0;i<job.N;i++){
+        reb_add(r, job.particles[i]);
+    }
+    free(lines);
+    free(job.particles);
+    return job.N;
+}
+
+int reb_input_particles_ascii(struct reb_simulation* const r, const char* const filename, const enum REB_ASCII_FORMAT format, int N_threads){
+    FILE* inf = fopen(filename, "rb");
+    if (inf==NULL){
+        reb_error(r, "Can not open file.");
+        return -1;
+    }
+    fseek(inf, 0, SEEK_END);
+    const long size = ftell(inf);
+    fseek(inf, 0, SEEK_SET);
+    char* buf = malloc(size>0?size:1);
+    const size_t size_read = fread(buf, 1, size>0?size:0, inf);
+    fclose(inf);
+    const int ret = reb_input_particles_ascii_from_buffer(r, buf, size_read, format, N_threads);
+    free(buf);
+    return ret;
+}
+
+static void* reb_ascii_format_thread(void* args){
+    struct reb_ascii_thread* const t = args;
+    struct reb_ascii_job* const job = t->job;
+    struct reb_simulation* const r = job->r;
+    const int i_start = (int)((long long)job->N*t->thread/job->N_threads);
+    const int i_end = (int)((long long)job->N*(t->thread+1)/job->N_threads);
+    const int precision = job->precision;
+    // Upper limit for the length of one number: sign, digit, point, digits, exponent and delimiter.
+    const size_t size_value = precision + 16;
+    const size_t size_line = REB_ASCII_N_COLUMNS*size_value + 2;
+    size_t allocated = size_line*(i_end-i_start) + 1;
+    t->buf = malloc(allocated);
+    t->size = 0;
+    for (int i=i_start;i<i_end;i++){
+        double v[REB_ASCII_N_COLUMNS];
+        if (job->format==REB_ASCII_ORBITS){
+            // Particle 0 is the primary and is not written.
+            const struct reb_particle p = r->particles[i+1];
+            int err = 0;
+            const struct reb_orbit o = reb_tools_particle_to_orbit_err(r->G, p, job->primary, &err);
+            v[0] = p.m; v[1] = p.r;
+            v[2] = o.a; v[3] = o.e; v[4] = o.inc; v[5] = o.Omega; v[6] = o.omega; v[7] = o.f;
+        }else{
+            const struct reb_particle p = r->particles[i];
+            v[0] = p.m; v[1] = p.r;
+            v[2] = p.x; v[3] = p.y; v[4] = p.z; v[5] = p.vx; v[6] = p.vy; v[7] = p.vz;
+        }
+        char* c = t->buf + t->size;
+        for (int k=0;k<REB_ASCII_N_COLUMNS;k++){
+            c += snprintf(c, size_value, "%.*e", precision, v[k]);
+            *(c++) = (k==REB_ASCII_N_COLUMNS-1)?'\n':job->delimiter;
+        }
+        t->size = c - t->buf;
+    }
+    return NULL;
+}
+
+// Formats the particles on several threads. Each thread has its own buffer.
+static struct reb_ascii_thread* reb_ascii_format(struct reb_simulation* const r, struct reb_ascii_job* job, int N_threads){
+    job->r = r;
+    const int N_real = r->N - r->N_var;
+    if (job->format==REB_ASCII_ORBITS){
+        job->N = N_real>0?N_real-1:0;
+        if (N_real>0){
+            job->primary = r->particles[0];
+        }
+    }else{
+        job->N = N_real;
+    }
+    if (job->precision<0) job->precision = 0;
+    if (job->precision>40) job->precision = 40;
+    struct reb_ascii_thread* threads = reb_ascii_threads(job, N_threads);
+    reb_ascii_run(threads, job->N_threads, reb_ascii_format_thread);
+    return threads;
+}
+
+char* reb_output_particles_ascii_to_buffer(struct reb_simulation* const r, const enum REB_ASCII_FORMAT format, const int precision, const char delimiter, int N_threads, size_t* const size){
+    struct reb_ascii_job job = {
+        .format = format,
+        .precision = precision,
+        .delimiter = delimiter,
+    };
+    struct reb_ascii_thread* threads = reb_ascii_format(r, &job, N_threads);
+    size_t size_total = 0;
+    for (int k=0;k<job.N_threads;k++){
+        size_total += threads[k].size;
+    }
+    char* buf = malloc(size_total+1);
+    size_t offset = 0;
+    for (int k=0;k<job.N_threads;k++){
+        memcpy(buf+offset, threads[k].buf, threads[k].size);
+        offset += threads[k].size;
+        free(threads[k].buf);
+    }
+    buf[size_total] = '\0';
+    free(threads);
+    if (size){
+        *size = size_total;
+    }
+    return buf;
+}
+
+int reb_output_particles_ascii(struct reb_simulation* const r, const char* const filename, const enum REB_ASCII_FORMAT format, const int precision, const char delimiter, int N_threads){
+    FILE* of = fopen(filename, "w");
+    if (of==NULL){
+        reb_error(r, "Can not open file.");
+        return 1;
+    }
+    struct reb_ascii_job job = {
+        .format = format,
+        .precision = precision,
+        .delimiter = delimiter,
+    };
+    struct reb_ascii_thread* threads = reb_ascii_format(r, &job, N_threads);
+    int ret = 0;
+    for (int k=0;k<job.N_threads;k++){
+        if (fwrite(threads[k].buf, 1, threads[k].size, of)!=threads[k].size){
+            ret = 1;
+        }
+        free(threads[k].buf);
+    }
+    free(threads);
+    fclose(of);
+    if (ret){
+        reb_error(r, "Error while writing file.");
+    }
+    return ret;
+}
@@ -0,0 +1,419 @@
+/**
+ * @file    autoselect.c
+ * @brief   Automatic selection of the gravity and collision methods, tuning of integrator parameters.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details Every auto_select_interval steps, the accelerations are calculated 
+ * with every candidate gravity method and the collision search is run with every 
+ * candidate collision method. The fastest candidates are kept. Only methods which give 
+ * the same results, or which stay within the accuracy set by auto_select_opening_angle2, 
+ * are candidates. Accelerations and counters are restored after the trials, and no 
+ * collisions are resolved.
+ *
+ * reb_tune() selects the cheapest value of an integrator parameter which meets
+ * an energy error target. Every value is tried in a pilot integration of a copy
+ * of the simulation.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "rebound.h"
+#include "autoselect.h"
+#include "gravity.h"
+#include "collision.h"
+#include "boundary.h"
+#include "tree.h"
+#include "profiling.h"
+
+/**
+ * @brief A candidate is only selected if it is faster than the current method by this factor.
+ */
+#define REB_AUTOSELECT_MARGIN 0.8
+
+/**
+ * @brief Number of trials per candidate. The fastest trial counts.
+ */
+#define REB_AUTOSELECT_TRIALS 2
+
+#ifndef MPI
+struct reb_autoselect_gravity {
+    int gravity;
+    int tree_group_size;
+    double opening_angle2;
+};
+
+static const char* reb_autoselect_gravity_name(const int gravity){
+    switch (gravity){
+        case REB_GRAVITY_BASIC:
+            return "basic";
+        case REB_GRAVITY_TREE:
+            return "tree";
+        default:
+            return "unknown";
+    }
+}
+
+static const char* reb_autoselect_collision_name(const int collision){
+    switch (collision){
+        case REB_COLLISION_DIRECT:
+            return "direct";
+        case REB_COLLISION_TREE:
+            return "tree";
+        case REB_COLLISION_LINE:
+            return "line";
+        case REB_COLLISION_LINETREE:
+            return "linetree";
+        case REB_COLLISION_GRID:
+            return "grid";
+        case REB_COLLISION_SWEEP:
+            return "sweep";
+        default:
+            return "unknown";
+    }
+}
+
+static int reb_autoselect_needs_tree(const struct reb_simulation* const r){
+    return r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE;
+}
+
+// A tree can only be used if a box has been configured and particles leaving it are taken care of.
+static int reb_autoselect_tree_possible(const struct reb_simulation* const r){
+    return r->root_size>0 && r->boundary!=REB_BOUNDARY_NONE;
+}
+
+static void reb_autoselect_build_tree(struct reb_simulation* const r){
+    if (r->tree_root){
+        return;
+    }
+    for (int i=0;i<r->N;i++){
+        reb_tree_add_particle_to_tree(r, i);
+    }
+}
+
+static double reb_autoselect_time_gravity(struct reb_simulation* const r, const struct reb_autoselect_gravity g){
+    r->gravity = g.gravity;
+    r->tree_group_size = g.tree_group_size;
+    r->opening_angle2 = g.opening_angle2;
+    if (g.gravity==REB_GRAVITY_TREE){
+        reb_autoselect_build_tree(r);
+    }
+    double time = -1.;
+    for (int k=0;k<REB_AUTOSELECT_TRIALS;k++){
+        const double start = reb_profiling_clock();
+        if (g.gravity==REB_GRAVITY_TREE){
+            reb_tree_update(r);
+            reb_tree_update_gravity_data(r);
+        }
+        reb_calculate_acceleration(r);
+        const double t = reb_profiling_clock()-start;
+        if (time<0. || t<time){
+            time = t;
+        }
+    }
+    return time;
+}
+
+static double reb_autoselect_time_collision(struct reb_simulation* const r, const int collision){
+    r->collision = collision;
+    if (collision==REB_COLLISION_TREE || collision==REB_COLLISION_LINETREE){
+        reb_autoselect_build_tree(r);
+    }
+    double time = -1.;
+    for (int k=0;k<REB_AUTOSELECT_TRIALS;k++){
+        const double start = reb_profiling_clock();
+        reb_collision_find(r);
+        const double t = reb_profiling_clock()-start;
+        if (time<0. || t<time){
+            time = t;
+        }
+    }
+    return time;
+}
+
+static void reb_autoselect_gravity(struct reb_simulation* const r){
+    if (r->gravity!=REB_GRAVITY_BASIC && r->gravity!=REB_GRAVITY_TREE){
+        return;
+    }
+    if (r->N_interaction_groups){
+        return; // Interaction groups are only supported by REB_GRAVITY_BASIC
+    }
+    const struct reb_autoselect_gravity current = {
+        .gravity = r->gravity,
+        .tree_group_size = r->tree_group_size,
+        .opening_angle2 = r->opening_angle2,
+    };
+    struct reb_autoselect_gravity candidates[4];
+    int N_candidates = 0;
+    if (current.gravity!=REB_GRAVITY_BASIC){
+        candidates[N_candidates++] = (struct reb_autoselect_gravity){.gravity = REB_GRAVITY_BASIC, .tree_group_size = current.tree_group_size, .opening_angle2 = current.opening_angle2};
+    }
+    if (r->auto_select_opening_angle2>0. && reb_autoselect_tree_possible(r) && r->N_var==0){
+        const int group_sizes[3] = {0, 8, 32};
+        for (int k=0;k<3;k++){
+            const struct reb_autoselect_gravity g = {.gravity = REB_GRAVITY_TREE, .tree_group_size = group_sizes[k], .opening_angle2 = r->auto_select_opening_angle2};
+            if (g.gravity!=current.gravity || g.tree_group_size!=current.tree_group_size || g.opening_angle2!=current.opening_angle2){
+                candidates[N_candidates++] = g;
+            }
+        }
+    }
+    if (N_candidates==0){
+        return;
+    }
+
+    double best_time = reb_autoselect_time_gravity(r, current);
+    const double current_time = best_time;
+    struct reb_autoselect_gravity best = current;
+    for (int k=0;k<N_candidates;k++){
+        const double t = reb_autoselect_time_gravity(r, candidates[k]);
+        if (t<best_time){
+            best_time = t;
+            best = candidates[k];
+        }
+    }
+    if (best_time>=REB_AUTOSELECT_MARGIN*current_time){
+        best = current;
+    }
+    r->gravity = best.gravity;
+    r->tree_group_size = best.tree_group_size;
+    r->opening_angle2 = best.opening_angle2;
+    if (best.gravity!=current.gravity || best.tree_group_size!=current.tree_group_size){
+        char msg[256];
+        if (best.gravity==REB_GRAVITY_TREE){
+            snprintf(msg, sizeof(msg), "Automatic selection: switched gravity from %s to %s (tree_group_size %d, opening_angle2 %g).", reb_autoselect_gravity_name(current.gravity), reb_autoselect_gravity_name(best.gravity), best.tree_group_size, best.opening_angle2);
+        }else{
+            snprintf(msg, sizeof(msg), "Automatic selection: switched gravity from %s to %s.", reb_autoselect_gravity_name(current.gravity), reb_autoselect_gravity_name(best.gravity));
+        }
+        reb_warning(r, msg);
+    }
+}
+
+static void reb_autoselect_collision(struct reb_simulation* const r){
+    // Only methods which find the same collisions are candidates.
+    int candidates[3];
+    int N_candidates = 0;
+    switch (r->collision){
+        case REB_COLLISION_DIRECT:
+        case REB_COLLISION_TREE:
+        case REB_COLLISION_GRID:
+            candidates[N_candidates++] = REB_COLLISION_DIRECT;
+            candidates[N_candidates++] = REB_COLLISION_GRID;
+            if (reb_autoselect_tree_possible(r)){
+                candidates[N_candidates++] = REB_COLLISION_TREE;
+            }
+            break;
+        case REB_COLLISION_LINE:
+        case REB_COLLISION_LINETREE:
+        case REB_COLLISION_SWEEP:
+            candidates[N_candidates++] = REB_COLLISION_LINE;
+            candidates[N_candidates++] = REB_COLLISION_SWEEP;
+            if (reb_autoselect_tree_possible(r)){
+                candidates[N_candidates++] = REB_COLLISION_LINETREE;
+            }
+            break;
+        default:
+            return;
+    }
+
+    const int current = r->collision;
+    double best_time = reb_autoselect_time_collision(r, current);
+    const double current_time = best_time;
+    int best = current;
+    for (int k=0;k<N_candidates;k++){
+        if (candidates[k]==current) continue;
+        const double t = reb_autoselect_time_collision(r, candidates[k]);
+        if (t<best_time){
+            best_time = t;
+            best = candidates[k];
+        }
+    }
+    if (best_time>=REB_AUTOSELECT_MARGIN*current_time){
+        best = current;
+    }
+    r->collision = best;
+    if (best!=current){
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Automatic selection: switched collision search from %s to %s.", reb_autoselect_collision_name(current), reb_autoselect_collision_name(best));
+        reb_warning(r, msg);
+    }
+}
+
+#endif // MPI
+
+void reb_autoselect(struct reb_simulation* const r){
+#ifndef MPI
+    if (r->N-r->N_var<2 || r->tree_sort){
+        // With tree_sort, the trials would reorder the particles.
+        return;
+    }
+    if (reb_autoselect_tree_possible(r)){
+        // Remove or wrap particles which have left the box before they are added to a tree.
+        reb_boundary_check(r);
+    }
+    const int N = r->N;
+    double* const a = malloc(sizeof(double)*3*N);
+    for (int i=0;i<N;i++){
+        a[3*i+0] = r->particles[i].ax;
+        a[3*i+1] = r->particles[i].ay;
+        a[3*i+2] = r->particles[i].az;
+    }
+    const struct reb_counters counters = r->counters;
+    const int had_tree = r->tree_root!=NULL;
+
+    reb_autoselect_gravity(r);
+    if (r->integrator!=REB_INTEGRATOR_MERCURIUS){
+        reb_autoselect_collision(r);
+    }
+
+    if (!had_tree && r->tree_root && !reb_autoselect_needs_tree(r)){
+        reb_tree_delete(r);
+    }
+    for (int i=0;i<N;i++){
+        r->particles[i].ax = a[3*i+0];
+        r->particles[i].ay = a[3*i+1];
+        r->particles[i].az = a[3*i+2];
+    }
+    r->counters = counters;
+    free(a);
+#endif // MPI
+}
+
+/**
+ * @brief Number of times the energy error is checked during a pilot integration of reb_tune().
+ */
+#define REB_TUNE_SAMPLES 16
+
+static void reb_tune_set(struct reb_simulation* const r, const enum REB_TUNE_PARAMETER parameter, const double value){
+    switch (parameter){
+        case REB_TUNE_PARAMETER_DT:
+            r->dt = value;
+            break;
+        case REB_TUNE_PARAMETER_IAS15_EPSILON:
+            r->ri_ias15.epsilon = value;
+            break;
+        case REB_TUNE_PARAMETER_MERCURIUS_HILLFAC:
+            r->ri_mercurius.hillfac = value;
+            r->ri_mercurius.recalculate_dcrit_this_timestep = 1;
+            break;
+        case REB_TUNE_PARAMETER_OPENING_ANGLE2:
+            r->opening_angle2 = value;
+            break;
+    }
+}
+
+// Returns an error message if the parameter cannot be tuned for this simulation, NULL otherwise.
+static const char* reb_tune_check(const struct reb_simulation* const r, const enum REB_TUNE_PARAMETER parameter){
+    switch (parameter){
+        case REB_TUNE_PARAMETER_DT:
+            if ((r->integrator==REB_INTEGRATOR_IAS15 && r->ri_ias15.epsilon>0.) || r->integrator==REB_INTEGRATOR_BS){
+                return "reb_tune: The timestep of IAS15 and BS is adaptive. Tune ri_ias15.epsilon instead.";
+            }
+            return NULL;
+        case REB_TUNE_PARAMETER_IAS15_EPSILON:
+            if (r->integrator!=REB_INTEGRATOR_IAS15 && r->integrator!=REB_INTEGRATOR_MERCURIUS){
+                return "reb_tune: ri_ias15.epsilon is only used by IAS15 and MERCURIUS.";
+            }
+            return NULL;
+        case REB_TUNE_PARAMETER_MERCURIUS_HILLFAC:
+            if (r->integrator!=REB_INTEGRATOR_MERCURIUS){
+                return "reb_tune: ri_mercurius.hillfac is only used by MERCURIUS.";
+            }
+            return NULL;
+        case REB_TUNE_PARAMETER_OPENING_ANGLE2:
+            if (r->gravity!=REB_GRAVITY_TREE && r->gravity!=REB_GRAVITY_FMM){
+                return "reb_tune: opening_angle2 is only used by REB_GRAVITY_TREE and REB_GRAVITY_FMM.";
+            }
+            return NULL;
+    }
+    return "reb_tune: Unknown parameter.";
+}
+
+// Integrates a copy of r with the parameter set to value. Stops early once the error target is exceeded.
+static struct reb_tune_result reb_tune_pilot(const struct reb_simulation* const r, const enum REB_TUNE_PARAMETER parameter, const double value, const double t_pilot, const double error_target, const double E0, void (*setup)(struct reb_simulation* const r)){
+    struct reb_tune_result result = {
+        .value = value,
+        .error = 0.,
+        .walltime = 0.,
+        .t = r->t,
+        .status = REB_EXIT_SUCCESS,
+    };
+    struct reb_simulation* const pilot = reb_create_simulation();
+    reb_copy_simulation_into(pilot, r);
+    pilot->visualization = REB_VISUALIZATION_NONE;
+    // The timestep is not shrunk at the sampling times, so the pilot takes the same steps as a long integration.
+    pilot->exact_finish_time = 0;
+    if (setup){
+        setup(pilot);
+    }
+    reb_tune_set(pilot, parameter, value);
+    const double t0 = r->t;
+    if (reb_sigint){
+        // Interrupted during setup. reb_integrate() would reset reb_sigint.
+        result.status = REB_EXIT_SIGINT;
+    }
+    for (int s=1; s<=REB_TUNE_SAMPLES && result.status==REB_EXIT_SUCCESS; s++){
+        const double start = reb_profiling_clock();
+        result.status = reb_integrate(pilot, t0+t_pilot*s/REB_TUNE_SAMPLES);
+        result.walltime += reb_profiling_clock()-start;
+        result.t = pilot->t;
+        const double E = reb_tools_energy(pilot);
+        const double error = E0!=0. ? fabs((E-E0)/E0) : fabs(E-E0);
+        if (!(error<=result.error)){ // Also catches NaN
+            result.error = error;
+        }
+        if (!(result.error<=error_target)){
+            break;
+        }
+    }
+    reb_free_simulation(pilot);
+    return result;
+}
+
+int reb_tune(struct reb_simulation* const r, const enum REB_TUNE_PARAMETER parameter, const double* const values, const int N_values, const double t_pilot, const double error_target, const int apply, void (*setup)(struct reb_simulation* const r), struct reb_tune_result* const results){
+    const char* const msg = reb_tune_check(r, parameter);
+    if (msg){
+        reb_error(r, msg);
+        return -1;
+    }
+    if (values==NULL || N_values<1 || t_pilot==0. || !(error_target>0.)){
+        reb_error(r, "reb_tune: Needs at least one value, a non-zero pilot time and a positive error target.");
+        return -1;
+    }
+    const double E0 = reb_tools_energy(r);
+    int best = -1;
+    double best_walltime = 0.;
+    for (int i=0; i<N_values; i++){
+        const struct reb_tune_result result = reb_tune_pilot(r, parameter, values[i], t_pilot, error_target, E0, setup);
+        if (results){
+            results[i] = result;
+        }
+        if (result.status==REB_EXIT_SIGINT){
+            return -1;
+        }
+        if (result.status==REB_EXIT_SUCCESS && result.error<=error_target && (best<0 || result.walltime<best_walltime)){
+            best = i;
+            best_walltime = result.walltime;
+        }
+    }
+    if (best>=0 && apply){
+        reb_tune_set(r, parameter, values[best]);
+    }
+    return best;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file    autoselect.h
+ * @brief   Automatic selection of the gravity and collision methods.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _AUTOSELECT_H
+#define _AUTOSELECT_H
+struct reb_simulation;
+
+/**
+ * @brief Times the candidate gravity and collision methods and switches to the fastest ones.
+ * @details Called by reb_step() every auto_select_interval steps. Every switch is reported 
+ * with reb_warning(). Does nothing with MPI.
+ */
+void reb_autoselect(struct reb_simulation* const r);
+
+#endif // _AUTOSELECT_H
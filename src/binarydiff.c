@@ -35,23 +35,88 @@
 #include "output.h"
 #include "binarydiff.h"
 
+#include <stdint.h>
+#include <stddef.h>
 
-static inline int reb_binary_diff_particle(struct reb_particle p1, struct reb_particle p2){
-    int differ = 0;
-    differ = differ || (p1.x != p2.x);
-    differ = differ || (p1.y != p2.y);
-    differ = differ || (p1.z != p2.z);
-    differ = differ || (p1.vx != p2.vx);
-    differ = differ || (p1.vy != p2.vy);
-    differ = differ || (p1.vz != p2.vz);
-    differ = differ || (p1.ax != p2.ax);
-    differ = differ || (p1.ay != p2.ay);
-    differ = differ || (p1.az != p2.az);
-    differ = differ || (p1.m != p2.m);
-    differ = differ || (p1.r != p2.r);
-    differ = differ || (p1.lastcollision != p2.lastcollision);
-    differ = differ || (p1.hash != p2.hash);
-    return differ;
+// Location of a field in a binary buffer.
+struct reb_binary_diff_entry {
+    uint32_t type;
+    size_t pos;     // Position of the field contents
+    uint64_t size;
+};
+
+// Size of an entry in a REB_BINARY_FIELD_TYPE_PARTICLES_DIFF field: index followed by the particle.
+#define REB_BINARY_DIFF_PARTICLE_ENTRY (sizeof(uint32_t)+sizeof(struct reb_particle))
+
+// Creates a table of all fields in buf. Every field is visited once.
+static size_t reb_binary_diff_table(const char* buf, const size_t size, struct reb_binary_diff_entry** table, const char* name){
+    size_t N = 0;
+    size_t allocatedN = 64;
+    *table = malloc(sizeof(struct reb_binary_diff_entry)*allocatedN);
+    size_t pos = 64;
+    while (pos+sizeof(struct reb_binary_field)<=size){
+        struct reb_binary_field field;
+        memcpy(&field, buf+pos, sizeof(struct reb_binary_field));
+        pos += sizeof(struct reb_binary_field);
+        if (field.type==REB_BINARY_FIELD_TYPE_END){
+            break;
+        }
+        if (field.size>size-pos){
+            printf("Corrupt binary file %s.\n", name);
+            break;
+        }
+        if (N>=allocatedN){
+            allocatedN *= 2;
+            *table = realloc(*table, sizeof(struct reb_binary_diff_entry)*allocatedN);
+        }
+        (*table)[N].type = field.type;
+        (*table)[N].pos = pos;
+        (*table)[N].size = field.size;
+        N++;
+        pos += field.size;
+    }
+    return N;
+}
+
+static int reb_binary_diff_compare_entries(const void* a, const void* b){
+    const struct reb_binary_diff_entry* ea = a;
+    const struct reb_binary_diff_entry* eb = b;
+    if (ea->type!=eb->type) return ea->type<eb->type?-1:1;
+    if (ea->pos!=eb->pos) return ea->pos<eb->pos?-1:1;
+    return 0;
+}
+
+// Returns the first field of the given type in the sorted table or NULL.
+static const struct reb_binary_diff_entry* reb_binary_diff_find(const struct reb_binary_diff_entry* sorted, const size_t N, const uint32_t type){
+    size_t lo = 0;
+    size_t hi = N;
+    while (lo<hi){
+        const size_t mid = lo+(hi-lo)/2;
+        if (sorted[mid].type<type){
+            lo = mid+1;
+        }else{
+            hi = mid;
+        }
+    }
+    if (lo<N && sorted[lo].type==type){
+        return &sorted[lo];
+    }
+    return NULL;
+}
+
+// Compares the physical properties of two particles (everything but the pointers).
+// The doubles x through lastcollision are contiguous and compared as one block.
+static inline int reb_binary_diff_particle(const char* p1, const char* p2){
+    const size_t size = offsetof(struct reb_particle, c);
+    if (memcmp(p1, p2, size)!=0){
+        return 1;
+    }
+    return memcmp(p1+offsetof(struct reb_particle, hash), p2+offsetof(struct reb_particle, hash), sizeof(uint32_t))!=0;
+}
+
+static inline void reb_binary_diff_write(char** op, const void* src, const size_t size){
+    memcpy(*op, src, size);
+    *op += size;
 }
 
 // Wrapper for backwards compatibility
@@ -72,86 +137,69 @@ int reb_binary_diff_with_options(char* buf1, size_t size1, char* buf2, size_t si
         *bufp = NULL;
         *sizep = 0;
     }
-    size_t allocatedsize = 0;
 
     // Header.
     if(memcmp(buf1,buf2,64)!=0){
         printf("Header in binary files are different.\n");
     }
 
-    size_t pos1 = 64;
-    size_t pos2 = 64;
-    
-    while(1){
-        if (pos1+sizeof(struct reb_binary_field)>size1) break;
-        struct reb_binary_field field1 = *(struct reb_binary_field*)(buf1+pos1);
-        pos1 += sizeof(struct reb_binary_field);
-        if (field1.type==REB_BINARY_FIELD_TYPE_END){
-            break;
-        }
-        if (pos2+sizeof(struct reb_binary_field)>size2) pos2 = 64;
-        struct reb_binary_field field2 = *(struct reb_binary_field*)(buf2+pos2);
-        pos2 += sizeof(struct reb_binary_field);
-        
-        // Fields might not be in the same order.
-        if (field1.type!=field2.type){
-            // Will search for element in buf2, starting at beginning just past header
-            // Note that we ignore all ADDITIONAL fields in buf2 that were not present in buf1 
-            pos2 = 64;
-            int notfound = 0; 
-            while(1) {
-                if (pos2+sizeof(struct reb_binary_field)>size2){
-                    notfound = 1;
+    // Fields might not be in the same order. The tables are sorted by 
+    // type to find fields quickly.
+    struct reb_binary_diff_entry* table1;
+    struct reb_binary_diff_entry* table2;
+    const size_t N1 = reb_binary_diff_table(buf1, size1, &table1, "buf1");
+    const size_t N2 = reb_binary_diff_table(buf2, size2, &table2, "buf2");
+    struct reb_binary_diff_entry* sorted1 = malloc(sizeof(struct reb_binary_diff_entry)*(N1?N1:1));
+    struct reb_binary_diff_entry* sorted2 = malloc(sizeof(struct reb_binary_diff_entry)*(N2?N2:1));
+    memcpy(sorted1, table1, sizeof(struct reb_binary_diff_entry)*N1);
+    memcpy(sorted2, table2, sizeof(struct reb_binary_diff_entry)*N2);
+    qsort(sorted1, N1, sizeof(struct reb_binary_diff_entry), reb_binary_diff_compare_entries);
+    qsort(sorted2, N2, sizeof(struct reb_binary_diff_entry), reb_binary_diff_compare_entries);
+
+    // The output contains at most all fields of buf2 and an empty field 
+    // for every field of buf1. It is allocated once.
+    char* op = NULL;
+    if (output_option==0){
+        *bufp = malloc(size2 + N1*sizeof(struct reb_binary_field));
+        op = *bufp;
+    }
+
+    for (size_t k=0;k<N1;k++){
+        const struct reb_binary_diff_entry* const e1 = &table1[k];
+        const struct reb_binary_diff_entry* const e2 = reb_binary_diff_find(sorted2, N2, e1->type);
+        struct reb_binary_field field;
+        field.type = e1->type;
+        if (e2==NULL){
+            // Output field with size 0
+            are_different = 1;
+            switch(output_option){
+                case 0:
+                    field.size = 0;
+                    reb_binary_diff_write(&op, &field, sizeof(struct reb_binary_field));
                     break;
-                }
-                field2 = *(struct reb_binary_field*)(buf2+pos2);
-                pos2 += sizeof(struct reb_binary_field);
-                if(field2.type==REB_BINARY_FIELD_TYPE_END){
-                    notfound = 1;
+                case 1:
+                    printf("Field %d not in simulation 2.\n",field.type);
+                    break;
+                default:
                     break;
-                }
-                if (field2.type==field1.type){
-                    break; // found!!
-                }else{
-                    pos2 += field2.size; //skip
-                }
-            };
-            if (notfound == 1){
-                // Output field with size 0
-                pos1 += field1.size; // For next search
-                pos2 = 64; // For next search
-                field1.size = 0;
-                are_different = 1.;
-                switch(output_option){
-                    case 0:
-                        reb_output_stream_write(bufp, &allocatedsize, sizep, &field1,sizeof(struct reb_binary_field));
-                        break;
-                    case 1:
-                        printf("Field %d not in simulation 2.\n",field1.type);
-                        break;
-                    default:
-                        break;
-                }
-                continue;
             }
+            continue;
         }
-        // Can assume field1.type == field2.type from here on
-        if (pos1+field1.size>size1) printf("Corrupt binary file buf1.\n");
-        if (pos2+field2.size>size2) printf("Corrupt binary file buf2.\n");
         int fields_differ = 0;
-        if (field1.size==field2.size){
-            switch (field1.type){
+        size_t N_particles_differ = 0;
+        if (e1->size==e2->size){
+            switch (e1->type){
                 case REB_BINARY_FIELD_TYPE_PARTICLES:
                     {
-                        struct reb_particle* pb1 = (struct reb_particle*)(buf1+pos1);
-                        struct reb_particle* pb2 = (struct reb_particle*)(buf2+pos2);
-                        for (unsigned int i=0;i<field1.size/sizeof(struct reb_particle);i++){
-                            fields_differ |= reb_binary_diff_particle(pb1[i],pb2[i]);
+                        const size_t N = e1->size/sizeof(struct reb_particle);
+                        for (size_t i=0;i<N;i++){
+                            N_particles_differ += reb_binary_diff_particle(buf1+e1->pos+i*sizeof(struct reb_particle), buf2+e2->pos+i*sizeof(struct reb_particle));
                         }
+                        fields_differ = N_particles_differ>0;
                     }
                     break;
                 default:
-                    if (memcmp(buf1+pos1,buf2+pos2,field1.size)!=0){
+                    if (memcmp(buf1+e1->pos,buf2+e2->pos,e1->size)!=0){
                         fields_differ = 1;
                     }
                     break;
@@ -160,89 +208,78 @@ int reb_binary_diff_with_options(char* buf1, size_t size1, char* buf2, size_t si
             fields_differ = 1;
         }
         if(fields_differ){
-            if (field1.type!=REB_BINARY_FIELD_TYPE_WALLTIME){
+            if (e1->type!=REB_BINARY_FIELD_TYPE_WALLTIME){
                 // Ignore the walltime field for the return value.
                 // Typically we do not care about this field when comparing simulations.
-                are_different = 1.;
+                are_different = 1;
             }
             switch(output_option){
                 case 0:
-                    reb_output_stream_write(bufp, &allocatedsize, sizep, &field2,sizeof(struct reb_binary_field));
-                    reb_output_stream_write(bufp, &allocatedsize, sizep, buf2+pos2,field2.size);
+                    if (N_particles_differ && N_particles_differ*REB_BINARY_DIFF_PARTICLE_ENTRY < e2->size){
+                        // Only some particles changed. Output only these.
+                        field.type = REB_BINARY_FIELD_TYPE_PARTICLES_DIFF;
+                        field.size = N_particles_differ*REB_BINARY_DIFF_PARTICLE_ENTRY;
+                        reb_binary_diff_write(&op, &field, sizeof(struct reb_binary_field));
+                        const uint32_t N = e1->size/sizeof(struct reb_particle);
+                        for (uint32_t i=0;i<N;i++){
+                            const char* p2 = buf2+e2->pos+i*sizeof(struct reb_particle);
+                            if (reb_binary_diff_particle(buf1+e1->pos+i*sizeof(struct reb_particle), p2)){
+                                reb_binary_diff_write(&op, &i, sizeof(uint32_t));
+                                reb_binary_diff_write(&op, p2, sizeof(struct reb_particle));
+                            }
+                        }
+                    }else{
+                        field.size = e2->size;
+                        reb_binary_diff_write(&op, &field, sizeof(struct reb_binary_field));
+                        reb_binary_diff_write(&op, buf2+e2->pos, e2->size);
+                    }
                     break;
                 case 1:
-                    printf("Field %d differs.\n",field1.type);
+                    printf("Field %d differs.\n",field.type);
                     break;
                 default:
                     break;
             }
         }
-        pos1 += field1.size;
-        pos2 += field2.size;
     }
+
     // Search for fields which are present in buf2 but not in buf1
-    pos1 = 64;
-    pos2 = 64;
-    while(1){
-        if (pos2+sizeof(struct reb_binary_field)>size2) break;
-        struct reb_binary_field field2 = *(struct reb_binary_field*)(buf2+pos2);
-        pos2 += sizeof(struct reb_binary_field);
-        if (field2.type==REB_BINARY_FIELD_TYPE_END){
-            break;
-        }
-        if (pos1+sizeof(struct reb_binary_field)>size1) pos1 = 64;
-        struct reb_binary_field field1 = *(struct reb_binary_field*)(buf1+pos1);
-        pos1 += sizeof(struct reb_binary_field);
-        
-        if (field1.type==field2.type){
+    for (size_t k=0;k<N2;k++){
+        const struct reb_binary_diff_entry* const e2 = &table2[k];
+        if (reb_binary_diff_find(sorted1, N1, e2->type)){
             // Not a new field. Skip.
-            pos1 += field1.size;
-            pos2 += field2.size;
             continue;
         }
-        // Fields might not be in the same order.
-        // Will search for element in buf1, starting at beginning just past header
-        pos1 = 64;
-        int notfound = 0; 
-        while(1) {
-            if (pos1+sizeof(struct reb_binary_field)>size1){
-                notfound = 1;
-                break;
-            }
-            field1 = *(struct reb_binary_field*)(buf1+pos1);
-            pos1 += sizeof(struct reb_binary_field);
-            if(field1.type==REB_BINARY_FIELD_TYPE_END){
-                notfound = 1;
-                break;
-            }
-            if (field2.type==field1.type){
-                break; // found it, not new
-            }else{
-                // not found, try next
-                pos1 += field1.size;
-            }
-        };
-        if (notfound == 0){
-            // Not a new field. Skip.
-            pos1 = 64;
-            pos2 += field2.size;
-            continue;
-        }
-
-        are_different = 1.;
+        are_different = 1;
         switch(output_option){
             case 0:
-                reb_output_stream_write(bufp, &allocatedsize, sizep, &field2,sizeof(struct reb_binary_field));
-                reb_output_stream_write(bufp, &allocatedsize, sizep, buf2+pos2,field2.size);
+                {
+                    struct reb_binary_field field;
+                    memset(&field,0,sizeof(struct reb_binary_field));
+                    field.type = e2->type;
+                    field.size = e2->size;
+                    reb_binary_diff_write(&op, &field, sizeof(struct reb_binary_field));
+                    reb_binary_diff_write(&op, buf2+e2->pos, e2->size);
+                }
                 break;
             case 1:
-                printf("Field %d not in simulation 1.\n",field2.type);
+                printf("Field %d not in simulation 1.\n",e2->type);
                 break;
             default:
                 break;
         }
-        pos1 = 64;
-        pos2 += field2.size;
     }
+
+    if (output_option==0){
+        *sizep = op-*bufp;
+        if (*sizep==0){
+            free(*bufp);
+            *bufp = NULL;
+        }
+    }
+    free(sorted2);
+    free(sorted1);
+    free(table2);
+    free(table1);
     return are_different;
 }
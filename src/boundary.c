@@ -36,6 +36,14 @@
 #include "rebound.h"
 #include "boundary.h"
 #include "tree.h"
+#include "tools.h"
+
+void reb_boundary_shear_offsets(const struct reb_simulation* const r, double* offsetp1, double* offsetm1){
+	const double OMEGA = r->ri_sei.OMEGA;
+	const struct reb_vec3d boxsize = r->boxsize;
+	*offsetp1 = -fmod(-1.5*OMEGA*boxsize.x*r->t+boxsize.y/2.,boxsize.y)-boxsize.y/2.; 
+	*offsetm1 = -fmod( 1.5*OMEGA*boxsize.x*r->t-boxsize.y/2.,boxsize.y)+boxsize.y/2.; 
+}
 
 void reb_boundary_check(struct reb_simulation* const r){
 	struct reb_particle* const particles = r->particles;
@@ -43,7 +51,11 @@ void reb_boundary_check(struct reb_simulation* const r){
 	const struct reb_vec3d boxsize = r->boxsize;
 	switch(r->boundary){
 		case REB_BOUNDARY_OPEN:
-			for (int i=0;i<N;i++){ // run through loop backwards so we don't have to recheck same index after removing
+		{
+			// Particles outside the box are collected and then removed in a single pass.
+			int* to_remove = NULL;
+			int N_remove = 0;
+			for (int i=0;i<N;i++){
 				int removep = 0;
 				if(particles[i].x>boxsize.x/2.){
 					removep = 1;
@@ -64,62 +76,42 @@ void reb_boundary_check(struct reb_simulation* const r){
 					removep = 1;
 				}
 				if (removep==1){
-                    if(r->track_energy_offset){
-                        double Ei = reb_tools_energy(r);
-                        reb_remove(r, i,1);
-                        r->energy_offset += Ei - reb_tools_energy(r);
-                    } else {
-                    reb_remove(r, i,0); // keepSorted=0 by default in C version
-                    }
-                    if (r->tree_root==NULL){
-                        i--; // need to recheck the particle that replaced the removed one
-                        N--; // This is the local N
-                    }else{
-                        // particle just marked, will be removed later
-                        r->tree_needs_update= 1;
+                    if (to_remove==NULL){
+                        to_remove = malloc(sizeof(int)*N);
                     }
+                    to_remove[N_remove++] = i;
 				}
 			}
+            if (N_remove){
+                if(r->track_energy_offset){
+                    r->energy_offset += reb_tools_energy_of_particles(r, to_remove, N_remove);
+                    reb_remove_many(r, to_remove, N_remove, 1);
+                } else {
+                    reb_remove_many(r, to_remove, N_remove, 0); // keepSorted=0 by default in C version
+                }
+                if (r->tree_root){
+                    // particles just marked, will be removed later
+                    r->tree_needs_update= 1;
+                }
+            }
+            free(to_remove);
+		}
 			break;
 		case REB_BOUNDARY_SHEAR:
 		{
 			// The offset of ghostcell is time dependent.
 			const double OMEGA = r->ri_sei.OMEGA;
-			const double offsetp1 = -fmod(-1.5*OMEGA*boxsize.x*r->t+boxsize.y/2.,boxsize.y)-boxsize.y/2.; 
-			const double offsetm1 = -fmod( 1.5*OMEGA*boxsize.x*r->t-boxsize.y/2.,boxsize.y)+boxsize.y/2.; 
+			double offsetp1, offsetm1;
+			reb_boundary_shear_offsets(r, &offsetp1, &offsetm1);
 			struct reb_particle* const particles = r->particles;
-#pragma omp parallel for schedule(guided)
+#pragma omp parallel for if(N>=reb_omp_min_N) schedule(guided)
 			for (int i=0;i<N;i++){
-				// Radial
-				while(particles[i].x>boxsize.x/2.){
-					particles[i].x -= boxsize.x;
-					particles[i].y += offsetp1;
-					particles[i].vy += 3./2.*OMEGA*boxsize.x;
-				}
-				while(particles[i].x<-boxsize.x/2.){
-					particles[i].x += boxsize.x;
-					particles[i].y += offsetm1;
-					particles[i].vy -= 3./2.*OMEGA*boxsize.x;
-				}
-				// Azimuthal
-				while(particles[i].y>boxsize.y/2.){
-					particles[i].y -= boxsize.y;
-				}
-				while(particles[i].y<-boxsize.y/2.){
-					particles[i].y += boxsize.y;
-				}
-				// Vertical (there should be no boundary, but periodic makes life easier)
-				while(particles[i].z>boxsize.z/2.){
-					particles[i].z -= boxsize.z;
-				}
-				while(particles[i].z<-boxsize.z/2.){
-					particles[i].z += boxsize.z;
-				}
+				reb_boundary_shear_particle(&particles[i], boxsize, OMEGA, offsetp1, offsetm1);
 			}
 		}
 		break;
 		case REB_BOUNDARY_PERIODIC:
-#pragma omp parallel for schedule(guided)
+#pragma omp parallel for if(N>=reb_omp_min_N) schedule(guided)
 			for (int i=0;i<N;i++){
 				while(particles[i].x>boxsize.x/2.){
 					particles[i].x -= boxsize.x;
@@ -201,6 +193,22 @@ struct reb_ghostbox reb_boundary_get_ghostbox(struct reb_simulation* const r, in
 	}
 }
 
+int reb_boundary_get_ghostbox_shifts(struct reb_simulation* const r, double* const x, double* const y, double* const z){
+	int g = 0;
+	for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+	for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+	for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+		const struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx, gby, gbz);
+		x[g] = gb.shiftx;
+		y[g] = gb.shifty;
+		z[g] = gb.shiftz;
+		g++;
+	}
+	}
+	}
+	return g;
+}
+
 int reb_boundary_particle_is_in_box(const struct reb_simulation* const r, struct reb_particle p){
 	switch(r->boundary){
 		case REB_BOUNDARY_OPEN:
@@ -42,6 +42,20 @@ void reb_boundary_check(struct reb_simulation* r);
  */
 struct reb_ghostbox reb_boundary_get_ghostbox(struct reb_simulation* const r, int i, int j, int k);
 
+/**
+ * @brief Calculates the position shifts of all ghost boxes at the current time.
+ * @details The shifts are the same as those returned by reb_boundary_get_ghostbox() and
+ * are stored in the order of the loops over i, j and k (from -nghost to nghost, k fastest).
+ * The central box is therefore in the middle. Each array needs room for
+ * (2*nghostx+1)*(2*nghosty+1)*(2*nghostz+1) values.
+ * @param r REBOUND Simulation to consider
+ * @param x Shifts in the x direction (output).
+ * @param y Shifts in the y direction (output).
+ * @param z Shifts in the z direction (output).
+ * @return Number of ghost boxes.
+ */
+int reb_boundary_get_ghostbox_shifts(struct reb_simulation* const r, double* const x, double* const y, double* const z);
+
 /**
  * @details Return 1 if a particle is in the box, 0 otherwise.
  * @param r REBOUND Simulation to consider
@@ -49,4 +63,50 @@ struct reb_ghostbox reb_boundary_get_ghostbox(struct reb_simulation* const r, in
  */
 int reb_boundary_particle_is_in_box(const struct reb_simulation* const r, struct reb_particle p);
 
+/**
+ * @brief Calculates the azimuthal shifts of the radial ghostboxes of a shearing sheet at the current time.
+ * @param r REBOUND Simulation to consider
+ * @param offsetp1 Shift for particles leaving the box in the positive x direction.
+ * @param offsetm1 Shift for particles leaving the box in the negative x direction.
+ */
+void reb_boundary_shear_offsets(const struct reb_simulation* const r, double* offsetp1, double* offsetm1);
+
+/**
+ * @brief Shifts a single particle back into the main box of a shearing sheet.
+ * @details Used by reb_boundary_check() and by the SEI integrator which applies 
+ * the boundary conditions in the same pass as its last drift. 
+ * @param p Particle to shift
+ * @param boxsize Size of the box
+ * @param OMEGA Orbital frequency of the shearing sheet
+ * @param offsetp1 Shift calculated by reb_boundary_shear_offsets()
+ * @param offsetm1 Shift calculated by reb_boundary_shear_offsets()
+ */
+static inline void reb_boundary_shear_particle(struct reb_particle* const p, const struct reb_vec3d boxsize, const double OMEGA, const double offsetp1, const double offsetm1){
+	// Radial
+	while(p->x>boxsize.x/2.){
+		p->x -= boxsize.x;
+		p->y += offsetp1;
+		p->vy += 3./2.*OMEGA*boxsize.x;
+	}
+	while(p->x<-boxsize.x/2.){
+		p->x += boxsize.x;
+		p->y += offsetm1;
+		p->vy -= 3./2.*OMEGA*boxsize.x;
+	}
+	// Azimuthal
+	while(p->y>boxsize.y/2.){
+		p->y -= boxsize.y;
+	}
+	while(p->y<-boxsize.y/2.){
+		p->y += boxsize.y;
+	}
+	// Vertical (there should be no boundary, but periodic makes life easier)
+	while(p->z>boxsize.z/2.){
+		p->z -= boxsize.z;
+	}
+	while(p->z<-boxsize.z/2.){
+		p->z += boxsize.z;
+	}
+}
+
 #endif
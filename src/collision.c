@@ -31,6 +31,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
@@ -38,17 +39,281 @@
 #include "collision.h"
 #include "rebound.h"
 #include "boundary.h"
+#include "tools.h"
 #include "tree.h"
+#include "profiling.h"
+#include "interaction_groups.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif // MPI
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
 #define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
 #define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
 
-static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r,  double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c);
-static void reb_tree_check_for_overlapping_trajectories_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double p1_r_plus_dtv, struct reb_collision* collision_nearest, struct reb_treecell* c, double maxdrift);
+/**
+ * @brief Collisions found by one thread.
+ * @details Every thread appends to its own buffer, so no locks are needed during the search.
+ * The buffers are merged by reb_collision_buffers_merge().
+ */
+struct reb_collision_buffer {
+    int N;                              ///< Number of collisions in the buffer.
+    int allocatedN;                     ///< Size of the collisions array.
+    struct reb_collision* collisions;
+};
 
-void reb_collision_search(struct reb_simulation* const r){
+/**
+ * @brief Returns the index of the buffer of the calling thread.
+ */
+static inline int reb_collision_thread_num(void){
+#ifdef OPENMP
+    return omp_get_thread_num();
+#else // OPENMP
+    return 0;
+#endif // OPENMP
+}
+
+static void reb_collision_buffer_add(struct reb_collision_buffer* const buffer, const struct reb_collision c){
+    if (buffer->allocatedN<=buffer->N){
+        // Init to 32 if no space has been allocated yet, otherwise double it.
+        buffer->allocatedN = buffer->allocatedN ? buffer->allocatedN * 2 : 32;
+        buffer->collisions = realloc(buffer->collisions,sizeof(struct reb_collision)*buffer->allocatedN);
+    }
+    buffer->collisions[buffer->N++] = c;
+}
+
+/**
+ * @brief Orders collisions by particle indices, root box and ghostbox.
+ */
+static int reb_collision_compare(const void* a, const void* b){
+    const struct reb_collision* const ca = a;
+    const struct reb_collision* const cb = b;
+    if (ca->p1 != cb->p1) return ca->p1 < cb->p1 ? -1 : 1;
+    if (ca->p2 != cb->p2) return ca->p2 < cb->p2 ? -1 : 1;
+    if (ca->ri != cb->ri) return ca->ri < cb->ri ? -1 : 1;
+    if (ca->gb.shiftx != cb->gb.shiftx) return ca->gb.shiftx < cb->gb.shiftx ? -1 : 1;
+    if (ca->gb.shifty != cb->gb.shifty) return ca->gb.shifty < cb->gb.shifty ? -1 : 1;
+    if (ca->gb.shiftz != cb->gb.shiftz) return ca->gb.shiftz < cb->gb.shiftz ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Copies the collisions of all threads to r->collisions and frees the buffers.
+ * @details The collisions are sorted, so the order in which they are resolved does
+ * not depend on the number of threads or on the order in which they were found.
+ * @return Number of collisions.
+ */
+static int reb_collision_buffers_merge(struct reb_simulation* const r, struct reb_collision_buffer* const buffers, const int N_buffers){
+    int collisions_N = 0;
+    for (int t=0; t<N_buffers; t++){
+        collisions_N += buffers[t].N;
+    }
+    if (r->collisions_allocatedN<collisions_N){
+        while (r->collisions_allocatedN<collisions_N){
+            r->collisions_allocatedN = r->collisions_allocatedN ? r->collisions_allocatedN * 2 : 32;
+        }
+        r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
+    }
+    int offset = 0;
+    for (int t=0; t<N_buffers; t++){
+        if (buffers[t].N){
+            memcpy(r->collisions+offset, buffers[t].collisions, sizeof(struct reb_collision)*buffers[t].N);
+            offset += buffers[t].N;
+        }
+        free(buffers[t].collisions);
+    }
+    free(buffers);
+    if (r->N_interaction_groups){
+        // Particles in groups which do not interact do not collide. Collisions are rare, 
+        // so they are filtered here instead of in each search method.
+        int k = 0;
+        for (int c=0; c<collisions_N; c++){
+            if (reb_interaction_groups_particles(r, r->collisions[c].p1, r->collisions[c].p2)){
+                r->collisions[k++] = r->collisions[c];
+            }
+        }
+        collisions_N = k;
+    }
+    if (collisions_N>1){
+        qsort(r->collisions, collisions_N, sizeof(struct reb_collision), reb_collision_compare);
+    }
+    return collisions_N;
+}
+
+/**
+ * @brief Resolves one collision unless one of the particles has already been removed.
+ * @details Particles to be removed are only flagged in removed. With track_energy_offset,
+ * their mass is set to zero so that they no longer contribute to the potential energy 
+ * used by later mergers.
+ * @return 1 if the collision resolve function has been called, 0 otherwise.
+ */
+static int reb_collision_resolve_one(struct reb_simulation* const r, int (*resolve) (struct reb_simulation* const r, struct reb_collision c), const struct reb_collision c, char* const removed){
+    if (c.p1 == -1 || c.p2 == -1 || removed[c.p1] || removed[c.p2]){
+        return 0;
+    }
+    const int outcome = resolve(r, c);
+    if (outcome & 1){
+        removed[c.p1] = 1;
+    }
+    if (outcome & 2){
+        removed[c.p2] = 1;
+    }
+    if (r->track_energy_offset){
+        if ((outcome & 1) && c.p1<r->N) r->particles[c.p1].m = 0.;
+        if ((outcome & 2) && c.p2<r->N) r->particles[c.p2].m = 0.;
+    }
+    return 1;
+}
+
+#if defined(OPENMP) && !defined(MPI)
+static int reb_collision_component_find(int* const parent, int i){
+    while (parent[i]!=i){
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * @brief Resolves collisions in parallel, one connected component of the collision graph per task.
+ * @details Two collisions are in the same component if they share a particle, directly or 
+ * through other collisions. Within a component, collisions are resolved in the same order as 
+ * in r->collisions. Components do not share particles, so the result does not depend on 
+ * the number of threads. Only used for resolve functions which access nothing but the two 
+ * colliding particles.
+ * @return Number of collisions passed on to the collision resolve function.
+ */
+static uint64_t reb_collision_resolve_components(struct reb_simulation* const r, int (*resolve) (struct reb_simulation* const r, struct reb_collision c), const int collisions_N, char* const removed, const int N_flags){
+    const struct reb_collision* const collisions = r->collisions;
+    int* const parent = malloc(sizeof(int)*N_flags);
+    int* const component = malloc(sizeof(int)*N_flags);
+    for (int i=0;i<N_flags;i++){
+        parent[i] = i;
+        component[i] = -1;
+    }
+    for (int i=0;i<collisions_N;i++){
+        const struct reb_collision c = collisions[i];
+        if (c.p1 == -1 || c.p2 == -1) continue;
+        const int a = reb_collision_component_find(parent, c.p1);
+        const int b = reb_collision_component_find(parent, c.p2);
+        if (a<b){
+            parent[b] = a;
+        }else if (b<a){
+            parent[a] = b;
+        }
+    }
+    // Number components in order of their first collision and sort collisions by component.
+    int N_components = 0;
+    int* const offsets = calloc(collisions_N+1, sizeof(int));
+    int* const collision_component = malloc(sizeof(int)*collisions_N);
+    for (int i=0;i<collisions_N;i++){
+        const struct reb_collision c = collisions[i];
+        if (c.p1 == -1 || c.p2 == -1){
+            collision_component[i] = -1;
+            continue;
+        }
+        const int root = reb_collision_component_find(parent, c.p1);
+        if (component[root]==-1){
+            component[root] = N_components++;
+        }
+        collision_component[i] = component[root];
+        offsets[component[root]+1]++;
+    }
+    for (int k=0;k<N_components;k++){
+        offsets[k+1] += offsets[k];
+    }
+    int* const order = malloc(sizeof(int)*(offsets[N_components]?offsets[N_components]:1));
+    int* const next = malloc(sizeof(int)*(N_components?N_components:1));
+    for (int k=0;k<N_components;k++){
+        next[k] = offsets[k];
+    }
+    for (int i=0;i<collisions_N;i++){
+        if (collision_component[i]>=0){
+            order[next[collision_component[i]]++] = i;
+        }
+    }
+    uint64_t resolved = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:resolved)
+    for (int k=0;k<N_components;k++){
+        for (int l=offsets[k];l<offsets[k+1];l++){
+            resolved += reb_collision_resolve_one(r, resolve, collisions[order[l]], removed);
+        }
+    }
+    free(next);
+    free(order);
+    free(collision_component);
+    free(offsets);
+    free(component);
+    free(parent);
+    return resolved;
+}
+#endif // OPENMP && !MPI
+
+#ifdef MPI
+static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r,  double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c);
+static void reb_collision_search_tree_mpi(struct reb_simulation* const r, struct reb_collision_buffer* const buffers, const int* const roots, const int N_roots);
+#endif // MPI
+/**
+ * @brief Searches for collisions by walking the tree against itself.
+ * @details Pairs of cells are discarded as a whole if their bounding spheres, enlarged by 
+ * the largest possible sum of two particle radii (and, with line is 1, by the largest 
+ * distance a particle can have drifted during the last timestep), do not overlap. 
+ * Pairs of leaves which remain are collected in batches and then tested in a tight loop.
+ * Every collision is reported twice, once for each particle, as in the per particle search.
+ * @param r REBOUND simulation to work on.
+ * @param line 0 for REB_COLLISION_TREE (overlap), 1 for REB_COLLISION_LINETREE (overlapping trajectories). 
+ * @param maxdrift Largest distance a particle has moved during the last timestep (only used if line is 1).
+ * @param buffers Collision buffers, one per thread.
+ */
+static void reb_collision_search_dual_tree(struct reb_simulation* const r, const int line, const double maxdrift, struct reb_collision_buffer* const buffers);
+/**
+ * @brief Searches for overlapping particles using a uniform grid.
+ * @details Particles are sorted into cells at least as wide as the largest possible sum of 
+ * two particle radii. Every particle is then only tested against particles in the 
+ * neighbouring cells, for every ghostbox of the inner most ring. 
+ * @param r REBOUND simulation to work on.
+ * @param buffers Collision buffers, one per thread.
+ */
+static void reb_collision_search_grid(struct reb_simulation* const r, struct reb_collision_buffer* const buffers);
+/**
+ * @brief Searches for overlapping trajectories by sweeping along the x axis.
+ * @details Every particle covers an interval in x during the last timestep. The intervals 
+ * are kept sorted by their lower end between timesteps. Because particles move only a little
+ * during one timestep, the order is nearly unchanged and insertion sort is close to O(N).
+ * Only particles with overlapping intervals are tested, using the same test as REB_COLLISION_LINE.
+ * @param r REBOUND simulation to work on.
+ * @param buffers Collision buffers, one per thread.
+ */
+static void reb_collision_search_sweep(struct reb_simulation* const r, struct reb_collision_buffer* const buffers);
+/**
+ * @brief Searches for collisions using a neighbour list which is kept between timesteps.
+ * @details The list contains all pairs closer than the sum of the two largest radii plus a 
+ * skin distance. It is only rebuilt when particles could have moved by more than the skin 
+ * relative to each other (the shear flow is not counted), when the number of particles, 
+ * the largest radii or the ghost boxes change. Otherwise only the pairs in the list are tested.
+ * @param r REBOUND simulation to work on.
+ * @param line 0 for REB_COLLISION_VERLET (overlap, as REB_COLLISION_GRID), 1 for REB_COLLISION_LINEVERLET (overlapping trajectories, as REB_COLLISION_LINE). 
+ * @param buffers Collision buffers, one per thread.
+ */
+static void reb_collision_search_verlet(struct reb_simulation* const r, const int line, struct reb_collision_buffer* const buffers);
+
+#ifndef MPI
+/**
+ * @brief Searches for collisions among the candidate pairs collected during the gravity tree walk (tree_fused_walk).
+ * @details Finds the same collisions as the dual tree search of REB_COLLISION_TREE and 
+ * REB_COLLISION_LINETREE. The candidates are only used if no two particles could have come 
+ * closer by more than the skin distance since they were collected, the same test as for 
+ * REB_COLLISION_VERLET.
+ * @param r REBOUND simulation to work on.
+ * @param line 0 for REB_COLLISION_TREE, 1 for REB_COLLISION_LINETREE.
+ * @param buffers Collision buffers, one per thread.
+ * @return 1 if the candidates have been used, 0 if the tree needs to be searched.
+ */
+static int reb_collision_search_fused(struct reb_simulation* const r, const int line, struct reb_collision_buffer* const buffers);
+#endif // MPI
+
+int reb_collision_find(struct reb_simulation* const r){
     int N = r->N - r->N_var;
     int Ninner = N;
     int* mercurius_map = NULL;
@@ -63,9 +328,34 @@ void reb_collision_search(struct reb_simulation* const r){
             mercurius_map = r->ri_mercurius.encounter_map;
         }
     }
-    int collisions_N = 0;
+#ifdef OPENMP
+    const int N_buffers = omp_get_max_threads();
+#else // OPENMP
+    const int N_buffers = 1;
+#endif // OPENMP
+    struct reb_collision_buffer* const buffers = calloc(N_buffers, sizeof(struct reb_collision_buffer));
     const struct reb_particle* const particles = r->particles;
-    switch (r->collision){
+    int collision = r->collision;
+    if (mercurius_map){
+        // During a MERCURIUS encounter step only particles in the encounter map can collide.
+        // This subset is small, so a direct search over it is much cheaper than
+        // building a tree, grid or sweep list of all particles in every IAS15 substep.
+        switch (collision){
+            case REB_COLLISION_TREE:
+            case REB_COLLISION_GRID:
+            case REB_COLLISION_VERLET:
+                collision = REB_COLLISION_DIRECT;
+                break;
+            case REB_COLLISION_LINETREE:
+            case REB_COLLISION_SWEEP:
+            case REB_COLLISION_LINEVERLET:
+                collision = REB_COLLISION_LINE;
+                break;
+            default:
+                break;
+        }
+    }
+    switch (collision){
         case REB_COLLISION_NONE:
         break;
         case REB_COLLISION_DIRECT:
@@ -74,19 +364,19 @@ void reb_collision_search(struct reb_simulation* const r){
             int nghostxcol = (r->nghostx>1?1:r->nghostx);
             int nghostycol = (r->nghosty>1?1:r->nghosty);
             int nghostzcol = (r->nghostz>1?1:r->nghostz);
-            for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
-            for (int gby=-nghostycol; gby<=nghostycol; gby++){
-            for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
-                // Loop over all particles
-                for (int i=0;i<N;i++){
-#ifndef OPENMP
-                    if (reb_sigint) return;
-#endif // OPENMP
-                    int ip = i;
-                    if (mercurius_map){
-                        ip = mercurius_map[i];
-                    }
-                    struct reb_particle p1 = particles[ip];
+            // Loop over all particles
+#pragma omp parallel for schedule(guided)
+            for (int i=0;i<N;i++){
+                if (reb_sigint) continue;
+                struct reb_collision_buffer* const buffer = &buffers[reb_collision_thread_num()];
+                int ip = i;
+                if (mercurius_map){
+                    ip = mercurius_map[i];
+                }
+                struct reb_particle p1 = particles[ip];
+                for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+                for (int gby=-nghostycol; gby<=nghostycol; gby++){
+                for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
                     struct reb_ghostbox gborig = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
                     struct reb_ghostbox gb = gborig;
                     // Precalculate shifted position 
@@ -117,21 +407,12 @@ void reb_collision_search(struct reb_simulation* const r){
                         double dvz = gb.shiftvz - p2.vz; 
                         // Check if particles are approaching each other
                         if (dvx*dx + dvy*dy + dvz*dz >0) continue; 
-                        // Add particles to collision array.
-                        if (r->collisions_allocatedN<=collisions_N){
-                            // Allocate memory if there is no space in array.
-                            // Init to 32 if no space has been allocated yet, otherwise double it.
-                            r->collisions_allocatedN = r->collisions_allocatedN ? r->collisions_allocatedN * 2 : 32;
-                            r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
-                        }
-                        r->collisions[collisions_N].p1 = ip;
-                        r->collisions[collisions_N].p2 = jp;
-                        r->collisions[collisions_N].gb = gborig;
-                        collisions_N++;
+                        // Add particles to collision buffer of this thread.
+                        reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = ip, .p2 = jp, .gb = gborig});
                     }
                 }
-            }
-            }
+                }
+                }
             }
         }
         break;
@@ -142,15 +423,19 @@ void reb_collision_search(struct reb_simulation* const r){
             int nghostxcol = (r->nghostx>1?1:r->nghostx);
             int nghostycol = (r->nghosty>1?1:r->nghosty);
             int nghostzcol = (r->nghostz>1?1:r->nghostz);
-            for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
-            for (int gby=-nghostycol; gby<=nghostycol; gby++){
-            for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
-                // Loop over all particles
-                for (int i=0;i<N;i++){
-#ifndef OPENMP
-                    if (reb_sigint) return;
-#endif // OPENMP
-                    struct reb_particle p1 = particles[i];
+            // Loop over all particles
+#pragma omp parallel for schedule(guided)
+            for (int i=0;i<N;i++){
+                if (reb_sigint) continue;
+                struct reb_collision_buffer* const buffer = &buffers[reb_collision_thread_num()];
+                int ip = i;
+                if (mercurius_map){
+                    ip = mercurius_map[i];
+                }
+                struct reb_particle p1 = particles[ip];
+                for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+                for (int gby=-nghostycol; gby<=nghostycol; gby++){
+                for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
                     struct reb_ghostbox gborig = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
                     struct reb_ghostbox gb = gborig;
                     // Precalculate shifted position 
@@ -162,7 +447,11 @@ void reb_collision_search(struct reb_simulation* const r){
                     gb.shiftvz += p1.vz;
                     // Loop over all particles again
                     for (int j=i+1;j<N;j++){
-                        struct reb_particle p2 = particles[j];
+                        int jp = j;
+                        if (mercurius_map){
+                            jp = mercurius_map[j];
+                        }
+                        struct reb_particle p2 = particles[jp];
                         const double dx1 = gb.shiftx - p2.x; // distance at end
                         const double dy1 = gb.shifty - p2.y;
                         const double dz1 = gb.shiftz - p2.z;
@@ -187,17 +476,8 @@ void reb_collision_search(struct reb_simulation* const r){
                         double rsum = p1.r + p2.r;
                         if (rmin2_ab>rsum*rsum) continue;
 
-                        // Add particles to collision array.
-                        if (r->collisions_allocatedN<=collisions_N){
-                            // Allocate memory if there is no space in array.
-                            // Init to 32 if no space has been allocated yet, otherwise double it.
-                            r->collisions_allocatedN = r->collisions_allocatedN ? r->collisions_allocatedN * 2 : 32;
-                            r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
-                        }
-                        r->collisions[collisions_N].p1 = i;
-                        r->collisions[collisions_N].p2 = j;
-                        r->collisions[collisions_N].gb = gborig;
-                        collisions_N++;
+                        // Add particles to collision buffer of this thread.
+                        reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = ip, .p2 = jp, .gb = gborig});
                     }
                 }
             }
@@ -207,69 +487,52 @@ void reb_collision_search(struct reb_simulation* const r){
         break;
         case REB_COLLISION_TREE:
         {
+#ifndef MPI
+            if (reb_collision_search_fused(r, 0, buffers)) break;
+#endif // MPI
             // Update and simplify tree. 
             // Prepare particles for distribution to other nodes. 
             reb_tree_update(r);          
 
 #ifdef MPI
+            if (r->mpi_direct || r->mpi_root_owner==NULL){
+                // All particles are in the local tree.
+                reb_collision_search_tree_mpi(r, buffers, NULL, r->root_n);
+                break;
+            }
             // Distribute particles and add newly received particles to tree.
             reb_communication_mpi_distribute_particles(r);
             
             // Prepare essential tree (and particles close to the boundary needed for collisions) for distribution to other nodes.
             reb_tree_prepare_essential_tree_for_collisions(r);
 
-            // Transfer essential tree and particles needed for collisions.
-            reb_communication_mpi_distribute_essential_tree_for_collisions(r);
-#endif // MPI
-
-            // Loop over ghost boxes, but only the inner most ring.
-            int nghostxcol = (r->nghostx>1?1:r->nghostx);
-            int nghostycol = (r->nghosty>1?1:r->nghosty);
-            int nghostzcol = (r->nghostz>1?1:r->nghostz);
-            const struct reb_particle* const particles = r->particles;
-            const int N = r->N - r->N_var;
-            // Loop over all particles
-#pragma omp parallel for schedule(guided)
-            for (int i=0;i<N;i++){
-#ifndef OPENMP
-                if (reb_sigint) return;
-#endif // OPENMP
-                struct reb_particle p1 = particles[i];
-                struct reb_collision collision_nearest;
-                collision_nearest.p1 = i;
-                collision_nearest.p2 = -1;
-                double p1_r = p1.r;
-                double nearest_r2 = r->boxsize_max*r->boxsize_max/4.;
-                // Loop over ghost boxes.
-                for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
-                for (int gby=-nghostycol; gby<=nghostycol; gby++){
-                for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
-                    // Calculated shifted position (for speedup). 
-                    struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
-                    struct reb_ghostbox gbunmod = gb;
-                    gb.shiftx += p1.x; 
-                    gb.shifty += p1.y; 
-                    gb.shiftz += p1.z; 
-                    gb.shiftvx += p1.vx; 
-                    gb.shiftvy += p1.vy; 
-                    gb.shiftvz += p1.vz; 
-                    // Loop over all root boxes.
-                    for (int ri=0;ri<r->root_n;ri++){
-                        struct reb_treecell* rootcell = r->tree_root[ri];
-                        if (rootcell!=NULL){
-                            reb_tree_get_nearest_neighbour_in_cell(r, &collisions_N, gb, gbunmod,ri,p1_r,&nearest_r2,&collision_nearest,rootcell);
-                        }
-                    }
-                }
+            if (r->mpi_pipeline){
+                // Search the local tree while the essential tree is in transit,
+                // then search the essential tree of each node as it arrives.
+                int roots[r->root_n];
+                reb_communication_mpi_start_essential_tree(r, 1);
+                int N_roots = reb_communication_mpi_rootboxes_of_proc(r, r->mpi_id, roots);
+                reb_collision_search_tree_mpi(r, buffers, roots, N_roots);
+                int proc;
+                while((proc = reb_communication_mpi_wait_essential_tree(r, 1))>=0){
+                    N_roots = reb_communication_mpi_rootboxes_of_proc(r, proc, roots);
+                    reb_collision_search_tree_mpi(r, buffers, roots, N_roots);
                 }
-                }
-                // Continue if no collision was found
-                if (collision_nearest.p2==-1) continue;
+            }else{
+                // Transfer essential tree and particles needed for collisions.
+                reb_communication_mpi_distribute_essential_tree_for_collisions(r);
+                reb_collision_search_tree_mpi(r, buffers, NULL, r->root_n);
             }
+#else // MPI
+            reb_collision_search_dual_tree(r, 0, 0., buffers);
+#endif // MPI
         }
         break;
         case REB_COLLISION_LINETREE:
         {
+#ifndef MPI
+            if (reb_collision_search_fused(r, 1, buffers)) break;
+#endif // MPI
             // Calculate max drift (can also be stored in tree for further speedup)
             double vmax2 = 0.;
             for (int i=0;i<N;i++){
@@ -281,56 +544,44 @@ void reb_collision_search(struct reb_simulation* const r){
             // Prepare particles for distribution to other nodes. 
             reb_tree_update(r);          
 
-            // Loop over ghost boxes, but only the inner most ring.
-            int nghostxcol = (r->nghostx>1?1:r->nghostx);
-            int nghostycol = (r->nghosty>1?1:r->nghosty);
-            int nghostzcol = (r->nghostz>1?1:r->nghostz);
-            const struct reb_particle* const particles = r->particles;
-            const int N = r->N - r->N_var;
-            // Loop over all particles
-#pragma omp parallel for schedule(guided)
-            for (int i=0;i<N;i++){
-#ifndef OPENMP
-                if (reb_sigint) return;
-#endif // OPENMP
-                struct reb_particle p1 = particles[i];
-                struct reb_collision collision_nearest;
-                collision_nearest.p1 = i;
-                collision_nearest.p2 = -1;
-                double p1_r = p1.r;
-                // Add drift during last timestep
-                double p1_r_plus_dtv = p1_r + r->dt_last_done*sqrt(p1.vx*p1.vx + p1.vy*p1.vy + p1.vz*p1.vz);
-                // Loop over ghost boxes.
-                for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
-                for (int gby=-nghostycol; gby<=nghostycol; gby++){
-                for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
-                    // Calculated shifted position (for speedup). 
-                    struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
-                    struct reb_ghostbox gbunmod = gb;
-                    gb.shiftx += p1.x; 
-                    gb.shifty += p1.y; 
-                    gb.shiftz += p1.z; 
-                    gb.shiftvx += p1.vx; 
-                    gb.shiftvy += p1.vy; 
-                    gb.shiftvz += p1.vz; 
-                    // Loop over all root boxes.
-                    for (int ri=0;ri<r->root_n;ri++){
-                        struct reb_treecell* rootcell = r->tree_root[ri];
-                        if (rootcell!=NULL){
-                            reb_tree_check_for_overlapping_trajectories_in_cell(r, &collisions_N, gb, gbunmod,ri,p1_r,p1_r_plus_dtv,&collision_nearest,rootcell,maxdrift);
-                        }
-                    }
-                }
-                }
-                }
-                // Continue if no collision was found
-                if (collision_nearest.p2==-1) continue;
-            }
+            reb_collision_search_dual_tree(r, 1, maxdrift, buffers);
+        }
+        break;
+        case REB_COLLISION_GRID:
+        {
+#ifdef MPI
+            reb_exit("REB_COLLISION_GRID is not supported in combination with MPI. Use REB_COLLISION_TREE instead.");
+#endif // MPI
+            reb_collision_search_grid(r, buffers);
+        }
+        break;
+        case REB_COLLISION_SWEEP:
+        {
+#ifdef MPI
+            reb_exit("REB_COLLISION_SWEEP is not supported in combination with MPI. Use REB_COLLISION_LINETREE instead.");
+#endif // MPI
+            reb_collision_search_sweep(r, buffers);
+        }
+        break;
+        case REB_COLLISION_VERLET:
+        case REB_COLLISION_LINEVERLET:
+        {
+#ifdef MPI
+            reb_exit("REB_COLLISION_VERLET and REB_COLLISION_LINEVERLET are not supported in combination with MPI. Use REB_COLLISION_TREE or REB_COLLISION_LINETREE instead.");
+#endif // MPI
+            reb_collision_search_verlet(r, collision==REB_COLLISION_LINEVERLET, buffers);
         }
         break;
         default:
             reb_exit("Collision routine not implemented.");
     }
+    return reb_collision_buffers_merge(r, buffers, N_buffers);
+}
+
+void reb_collision_search(struct reb_simulation* const r){
+    const int collisions_N = reb_collision_find(r);
+    if (reb_sigint) return;
+    r->counters.collisions_detected += collisions_N;
 
     // randomize
     for (int i=0;i<collisions_N;i++){
@@ -339,7 +590,11 @@ void reb_collision_search(struct reb_simulation* const r){
         r->collisions[i] = r->collisions[new];
         r->collisions[new] = c1;
     }
+    if (collisions_N==0){
+        return;
+    }
     // Loop over all collisions previously found in reb_collision_search().
+    TRACE_BEGIN(r, REB_TRACE_PHASE_COLLISION_RESOLVE)
     
     int (*resolve) (struct reb_simulation* const r, struct reb_collision c) = r->collision_resolve;
     if (resolve==NULL){
@@ -351,110 +606,50 @@ void reb_collision_search(struct reb_simulation* const r){
         collision_resolve_keep_sorted = 1; // Force keep_sorted for hybrid integrator
     }
 
+    // Particles are only flagged while the collisions are resolved and removed 
+    // in one pass afterwards, so the indices in r->collisions remain valid.
+    int N_flags = r->N;
     for (int i=0;i<collisions_N;i++){
-        
-        struct reb_collision c = r->collisions[i];
-        if (c.p1 != -1 && c.p2 != -1){
-            // Resolve collision
-            int outcome = resolve(r, c);
-            // Force status to REB_EXIT_COLLISION
-            r->status = REB_EXIT_COLLISION;
-            
-            // Remove particles
-            if (outcome & 1){
-                // Remove p1
-                int removedp1 = reb_remove(r,c.p1,collision_resolve_keep_sorted);
-                if (removedp1){
-                    if (r->tree_root){ // In a tree, particles get removed later. 
-                        for (int j=i+1;j<collisions_N;j++){ // Update other collisions
-                            struct reb_collision* cp = &(r->collisions[j]);
-                            // Skip collisions which involved the removed particle
-                            if (cp->p1==c.p1 || cp->p2==c.p1){
-                                cp->p1 = -1;
-                                cp->p2 = -1;
-                            }
-                        }
-                    }else{ // Not in a tree, particles get removed immediately 
-                        // Update p2 of current collision
-                        if (collision_resolve_keep_sorted){
-                            if (c.p2 > c.p1){
-                                c.p2--;
-                            }
-                        }else{
-                            if (c.p2 == r->N-r->N_var){
-                                c.p2 = c.p1;
-                            }
-                        }
-                        for (int j=i+1;j<collisions_N;j++){ // Update other collisions
-                            struct reb_collision* cp = &(r->collisions[j]);
-                            // Skip collisions which involve the removed particle
-                            if (cp->p1==c.p1 || cp->p2==c.p1){
-                                cp->p1 = -1;
-                                cp->p2 = -1;
-                            }
-                            // Adjust collisions
-                            if (collision_resolve_keep_sorted){
-                                if (cp->p1 > c.p1){
-                                    cp->p1--;
-                                }
-                                if (cp->p2 > c.p1){
-                                    cp->p2--;
-                                }
-                            }else{
-                                if (cp->p1 == r->N-r->N_var){
-                                    cp->p1 = c.p1;
-                                }
-                                if (cp->p2 == r->N-r->N_var){
-                                    cp->p2 = c.p1;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-            if (outcome & 2){
-                // Remove p1
-                int removedp2 = reb_remove(r,c.p2,collision_resolve_keep_sorted);
-                if (removedp2){ // Update other collisions
-                    if (r->tree_root){ // In a tree, particles get removed later. 
-                        for (int j=i+1;j<collisions_N;j++){ // Update other collisions
-                            struct reb_collision* cp = &(r->collisions[j]);
-                            // Skip collisions which involved the removed particle
-                            if (cp->p1==c.p2 || cp->p2==c.p2){
-                                cp->p1 = -1;
-                                cp->p2 = -1;
-                            }
-                        }
-                    }else{ // Not in a tree, particles get removed immediately 
-                        for (int j=i+1;j<collisions_N;j++){
-                            struct reb_collision* cp = &(r->collisions[j]);
-                            // Skip collisions which involve the removed particle
-                            if (cp->p1==c.p2 || cp->p2==c.p2){
-                                cp->p1 = -1;
-                                cp->p2 = -1;
-                            }
-                            // Adjust collisions
-                            if (collision_resolve_keep_sorted){
-                                if (cp->p1 > c.p2){
-                                    cp->p1--;
-                                }
-                                if (cp->p2 > c.p2){
-                                    cp->p2--;
-                                }
-                            }else{
-                                if (cp->p1 == r->N-r->N_var){
-                                    cp->p1 = c.p2;
-                                }
-                                if (cp->p2 == r->N-r->N_var){
-                                    cp->p2 = c.p2;
-                                }
-                            }
-                        }
-                    }
-                }
+        const struct reb_collision c = r->collisions[i];
+        if (c.p1>=N_flags) N_flags = c.p1+1;
+        if (c.p2>=N_flags) N_flags = c.p2+1;
+    }
+    char* const removed = calloc(N_flags, sizeof(char));
+    uint64_t resolved = 0;
+#if defined(OPENMP) && !defined(MPI)
+    if (resolve==reb_collision_resolve_merge && !r->track_energy_offset){
+        resolved = reb_collision_resolve_components(r, resolve, collisions_N, removed, N_flags);
+    }else
+#endif // OPENMP && !MPI
+    {
+        for (int i=0;i<collisions_N;i++){
+            resolved += reb_collision_resolve_one(r, resolve, r->collisions[i], removed);
+        }
+    }
+    r->counters.collisions_resolved += resolved;
+    if (resolved){
+        // Force status to REB_EXIT_COLLISION
+        r->status = REB_EXIT_COLLISION;
+    }
+
+    // Remove particles
+    int removed_N = 0;
+    for (int i=0;i<N_flags;i++){
+        removed_N += removed[i];
+    }
+    if (removed_N){
+        int* const indices = malloc(sizeof(int)*removed_N);
+        int k = 0;
+        for (int i=0;i<N_flags;i++){
+            if (removed[i]){
+                indices[k++] = i;
             }
         }
+        reb_remove_many(r, indices, removed_N, collision_resolve_keep_sorted);
+        free(indices);
     }
+    free(removed);
+    TRACE_END(r, REB_TRACE_PHASE_COLLISION_RESOLVE)
 }
 
 /**
@@ -464,6 +659,7 @@ void reb_set_collision_resolve(struct reb_simulation* r, int (*resolve) (struct
     r->collision_resolve = resolve;
 }
 
+#ifdef MPI
 /**
  * @brief Find the nearest neighbour in a cell or its daughters.
  * @details The function only returns a positive result if the particles
@@ -476,10 +672,10 @@ void reb_set_collision_resolve(struct reb_simulation* r, int (*resolve) (struct
  * @param nearest_r2 Pointer to the nearest neighbour found so far.
  * @param collision_nearest Pointer to the nearest collision found so far.
  * @param c Pointer to the cell currently being searched in.
- * @param collisions_N Pointer to current number of collisions
+ * @param buffer Collision buffer of the calling thread.
  * @param gbunmod Ghostbox unmodified
  */
-static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c){
+static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c){
     const struct reb_particle* const particles = r->particles;
     if (c->pt>=0){     
         // c is a leaf node
@@ -507,8 +703,7 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
                 p2 = particles[c->pt];
 #ifdef MPI
             }else{
-                int root_n_per_node = r->root_n/r->mpi_num;
-                int proc_id = ri/root_n_per_node;
+                int proc_id = r->mpi_root_owner[ri];
                 p2 = r->particles_recv[proc_id][c->pt];
             }
 #endif // MPI
@@ -532,17 +727,8 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
             collision_nearest->ri = ri;
             collision_nearest->p2 = c->pt;
             collision_nearest->gb = gbunmod;
-            // Save collision in collisions array.
-#pragma omp critical
-            {
-                if (r->collisions_allocatedN<=(*collisions_N)){
-                    // Init to 32 if no space has been allocated yet, otherwise double it.
-                    r->collisions_allocatedN = r->collisions_allocatedN ? r->collisions_allocatedN * 2 : 32;
-                    r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
-                }
-                r->collisions[(*collisions_N)] = *collision_nearest;
-                (*collisions_N)++;
-            }
+            // Save collision in collision buffer of this thread.
+            reb_collision_buffer_add(buffer, *collision_nearest);
         }
     }else{        
         // c is not a leaf node
@@ -556,80 +742,1295 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
             for (int o=0;o<8;o++){
                 struct reb_treecell* d = c->oct[o];
                 if (d!=NULL){
-                    reb_tree_get_nearest_neighbour_in_cell(r, collisions_N, gb,gbunmod,ri,p1_r,nearest_r2,collision_nearest,d);
+                    reb_tree_get_nearest_neighbour_in_cell(r, buffer, gb,gbunmod,ri,p1_r,nearest_r2,collision_nearest,d);
                 }
             }
         }
     }
 }
 
-
-static void reb_tree_check_for_overlapping_trajectories_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double p1_r_plus_dtv, struct reb_collision* collision_nearest, struct reb_treecell* c, double maxdrift){
+/**
+ * @brief Searches for collisions of all particles with the cells in the given root boxes (REB_COLLISION_TREE with MPI).
+ * @param roots Indices of the root boxes. If NULL, the root boxes 0 to N_roots-1 are searched.
+ * @param N_roots Number of root boxes.
+ */
+static void reb_collision_search_tree_mpi(struct reb_simulation* const r, struct reb_collision_buffer* const buffers, const int* const roots, const int N_roots){
+    // Loop over ghost boxes, but only the inner most ring.
+    int nghostxcol = (r->nghostx>1?1:r->nghostx);
+    int nghostycol = (r->nghosty>1?1:r->nghosty);
+    int nghostzcol = (r->nghostz>1?1:r->nghostz);
     const struct reb_particle* const particles = r->particles;
-    if (c->pt>=0){     
-        // c is a leaf node
-        if (c->pt != collision_nearest->p1){
-            struct reb_particle p2 = particles[c->pt];
-            double dt_done_last = r->dt_last_done;
-            const double dx1 = gb.shiftx - p2.x; // distance at beginning
-            const double dy1 = gb.shifty - p2.y;
-            const double dz1 = gb.shiftz - p2.z;
-            const double r1 = (dx1*dx1 + dy1*dy1 + dz1*dz1);
-            const double dvx1 = gb.shiftvx - p2.vx; 
-            const double dvy1 = gb.shiftvy - p2.vy;
-            const double dvz1 = gb.shiftvz - p2.vz;
-            const double dx2 = dx1 -dt_done_last*dvx1; // distance at end
-            const double dy2 = dy1 -dt_done_last*dvy1;
-            const double dz2 = dz1 -dt_done_last*dvz1;
-            const double r2 = (dx2*dx2 + dy2*dy2 + dz2*dz2);
-            const double t_closest = (dx1*dvx1 + dy1*dvy1 + dz1*dvz1)/(dvx1*dvx1 + dvy1*dvy1 + dvz1*dvz1);
+    const int N = r->N - r->N_var;
+    // Loop over all particles
+#pragma omp parallel for schedule(guided)
+    for (int i=0;i<N;i++){
+        if (reb_sigint) continue;
+        struct reb_collision_buffer* const buffer = &buffers[reb_collision_thread_num()];
+        struct reb_particle p1 = particles[i];
+        struct reb_collision collision_nearest;
+        collision_nearest.p1 = i;
+        collision_nearest.p2 = -1;
+        double p1_r = p1.r;
+        double nearest_r2 = r->boxsize_max*r->boxsize_max/4.;
+        // Loop over ghost boxes.
+        for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+        for (int gby=-nghostycol; gby<=nghostycol; gby++){
+        for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+            // Calculated shifted position (for speedup). 
+            struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+            struct reb_ghostbox gbunmod = gb;
+            gb.shiftx += p1.x; 
+            gb.shifty += p1.y; 
+            gb.shiftz += p1.z; 
+            gb.shiftvx += p1.vx; 
+            gb.shiftvy += p1.vy; 
+            gb.shiftvz += p1.vz; 
+            // Loop over all root boxes.
+            for (int k=0;k<N_roots;k++){
+                const int ri = roots?roots[k]:k;
+                struct reb_treecell* rootcell = r->tree_root[ri];
+                if (rootcell!=NULL){
+                    reb_tree_get_nearest_neighbour_in_cell(r, buffer, gb, gbunmod,ri,p1_r,&nearest_r2,&collision_nearest,rootcell);
+                }
+            }
+        }
+        }
+        }
+        // Continue if no collision was found
+        if (collision_nearest.p2==-1) continue;
+    }
+}
+#endif // MPI
+
+/**
+ * @brief Number of candidate pairs collected by the dual tree search before they are tested.
+ */
+#define REB_COLLISION_BATCH 256
+
+/**
+ * @brief Pair of cells visited by the dual tree collision search.
+ */
+struct reb_collision_cell_pair {
+    const struct reb_treecell* a;   ///< Cell containing the first particle, seen in ghostbox gb.
+    const struct reb_treecell* b;   ///< Cell containing the second particle.
+    int ra;                         ///< Root box of a.
+    int rb;                         ///< Root box of b.
+    int gb;                         ///< Index of the ghostbox.
+    int self;                       ///< 1 if a and b are the same cell in the central box.
+};
 
+/**
+ * @brief Pair of particles which might collide.
+ */
+struct reb_collision_candidate {
+    int p1;
+    int p2;
+    int ra;                         ///< Root box of p1.
+    int rb;                         ///< Root box of p2.
+    int gb;                         ///< Index of the ghostbox in which p1 is seen.
+};
+
+/**
+ * @brief State of the dual tree collision search of one thread.
+ */
+struct reb_collision_dual_tree {
+    struct reb_simulation* r;
+    const struct reb_ghostbox* gbs;     ///< Ghostboxes of the inner most ring.
+    int gb_central;                     ///< Index of the central box in gbs.
+    int line;                           ///< 1 for REB_COLLISION_LINETREE, 0 for REB_COLLISION_TREE.
+    double rp;                          ///< Largest possible sum of two radii, plus twice the maximum drift for LINETREE.
+    struct reb_collision_buffer* buffer; ///< Collision buffer of this thread.
+    int N;                              ///< Number of candidates in the current batch.
+    struct reb_collision_candidate candidates[REB_COLLISION_BATCH];
+};
+
+/**
+ * @brief Tests all candidates of the current batch and adds the collisions found to the collision buffer.
+ * @details In the central box, the pair of cells is only visited once. The test is symmetric, so 
+ * the collision is then added for both particles.
+ */
+static void reb_collision_dual_tree_flush(struct reb_collision_dual_tree* const ctx){
+    struct reb_simulation* const r = ctx->r;
+    const struct reb_particle* const particles = r->particles;
+    const double dt_last_done = r->dt_last_done;
+    for (int k=0; k<ctx->N; k++){
+        const struct reb_collision_candidate c = ctx->candidates[k];
+        const struct reb_ghostbox gb = ctx->gbs[c.gb];
+        const struct reb_particle p1 = particles[c.p1];
+        const struct reb_particle p2 = particles[c.p2];
+        const double dx = gb.shiftx + p1.x - p2.x;
+        const double dy = gb.shifty + p1.y - p2.y;
+        const double dz = gb.shiftz + p1.z - p2.z;
+        const double dvx = gb.shiftvx + p1.vx - p2.vx;
+        const double dvy = gb.shiftvy + p1.vy - p2.vy;
+        const double dvz = gb.shiftvz + p1.vz - p2.vz;
+        const double r1 = dx*dx + dy*dy + dz*dz;
+        const double rsum = p1.r + p2.r;
+        if (ctx->line){
+            const double dx2 = dx - dt_last_done*dvx; // distance at beginning
+            const double dy2 = dy - dt_last_done*dvy;
+            const double dz2 = dz - dt_last_done*dvz;
+            const double r2 = dx2*dx2 + dy2*dy2 + dz2*dz2;
+            const double t_closest = (dx*dvx + dy*dvy + dz*dvz)/(dvx*dvx + dvy*dvy + dvz*dvz);
             double rmin2_ab = MIN(r1,r2);
-            if (t_closest/dt_done_last>=0. && t_closest/dt_done_last<=1.){
-                const double dx3 = dx1-t_closest*dvx1; // closest approach
-                const double dy3 = dy1-t_closest*dvy1;
-                const double dz3 = dz1-t_closest*dvz1;
+            if (t_closest/dt_last_done>=0. && t_closest/dt_last_done<=1.){
+                const double dx3 = dx-t_closest*dvx; // closest approach
+                const double dy3 = dy-t_closest*dvy;
+                const double dz3 = dz-t_closest*dvz;
                 const double r3 = (dx3*dx3 + dy3*dy3 + dz3*dz3);
                 rmin2_ab = MIN(rmin2_ab, r3);
             }
-            double rsum = p1_r + p2.r;
-            if (rmin2_ab>rsum*rsum) return;
-            collision_nearest->ri = ri;
-            collision_nearest->p2 = c->pt;
-            collision_nearest->gb = gbunmod;
-            // Save collision in collisions array.
-#pragma omp critical
-            {
-                if (r->collisions_allocatedN<=(*collisions_N)){
-                    // Init to 32 if no space has been allocated yet, otherwise double it.
-                    r->collisions_allocatedN = r->collisions_allocatedN ? r->collisions_allocatedN * 2 : 32;
-                    r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
+            if (rmin2_ab>rsum*rsum) continue;
+        }else{
+            // Particles are not overlapping
+            if (r1>rsum*rsum) continue;
+            // Particles are not approaching each other
+            if (dvx*dx + dvy*dy + dvz*dz >0) continue;
+        }
+        reb_collision_buffer_add(ctx->buffer, (struct reb_collision){.p1 = c.p1, .p2 = c.p2, .gb = gb, .ri = c.rb});
+        if (c.gb==ctx->gb_central){
+            reb_collision_buffer_add(ctx->buffer, (struct reb_collision){.p1 = c.p2, .p2 = c.p1, .gb = gb, .ri = c.ra});
+        }
+    }
+    ctx->N = 0;
+}
+
+/**
+ * @brief Returns 1 if particles in cell a (seen in ghostbox gb) and cell b might collide.
+ */
+static int reb_collision_cells_might_collide(const struct reb_collision_dual_tree* const ctx, const struct reb_collision_cell_pair p){
+    const struct reb_ghostbox gb = ctx->gbs[p.gb];
+    const double dx = gb.shiftx + p.a->x - p.b->x;
+    const double dy = gb.shifty + p.a->y - p.b->y;
+    const double dz = gb.shiftz + p.a->z - p.b->z;
+    const double rp = ctx->rp + 0.86602540378443*(p.a->w + p.b->w);
+    return dx*dx + dy*dy + dz*dz < rp*rp;
+}
+
+/**
+ * @brief Replaces a pair of cells by the pairs of its daughter cells.
+ * @details For a cell paired with itself, only pairs of different daughters with o1<o2 and 
+ * daughters paired with themselves are created. Otherwise the larger of the two cells is split.
+ * @param emit Function which is called for every new pair.
+ */
+static void reb_collision_cell_pair_split(const struct reb_collision_cell_pair p, void (*emit)(void* data, const struct reb_collision_cell_pair p), void* data){
+    if (p.self){
+        for (int o1=0; o1<8; o1++){
+            const struct reb_treecell* const d1 = p.a->oct[o1];
+            if (d1==NULL) continue;
+            if (d1->pt<0){
+                emit(data, (struct reb_collision_cell_pair){.a = d1, .b = d1, .ra = p.ra, .rb = p.rb, .gb = p.gb, .self = 1});
+            }
+            for (int o2=o1+1; o2<8; o2++){
+                const struct reb_treecell* const d2 = p.a->oct[o2];
+                if (d2!=NULL){
+                    emit(data, (struct reb_collision_cell_pair){.a = d1, .b = d2, .ra = p.ra, .rb = p.rb, .gb = p.gb, .self = 0});
                 }
-                r->collisions[(*collisions_N)] = *collision_nearest;
-                (*collisions_N)++;
             }
         }
-    }else{        
-        // c is not a leaf node
-        double dx = gb.shiftx - c->x;
-        double dy = gb.shifty - c->y;
-        double dz = gb.shiftz - c->z;
-        double r2 = dx*dx + dy*dy + dz*dz;
-        double rp  = p1_r_plus_dtv + maxdrift + 0.86602540378443*c->w;
-        // Check if we need to decent into daughter cells
-        if (r2 < rp*rp ){
-            for (int o=0;o<8;o++){
-                struct reb_treecell* d = c->oct[o];
-                if (d!=NULL){
-                    reb_tree_check_for_overlapping_trajectories_in_cell(r, collisions_N, gb,gbunmod,ri,p1_r,p1_r_plus_dtv,collision_nearest,d,maxdrift);
+    }else if (p.b->pt>=0 || (p.a->pt<0 && p.a->w>=p.b->w)){
+        for (int o=0; o<8; o++){
+            const struct reb_treecell* const d = p.a->oct[o];
+            if (d!=NULL){
+                emit(data, (struct reb_collision_cell_pair){.a = d, .b = p.b, .ra = p.ra, .rb = p.rb, .gb = p.gb, .self = 0});
+            }
+        }
+    }else{
+        for (int o=0; o<8; o++){
+            const struct reb_treecell* const d = p.b->oct[o];
+            if (d!=NULL){
+                emit(data, (struct reb_collision_cell_pair){.a = p.a, .b = d, .ra = p.ra, .rb = p.rb, .gb = p.gb, .self = 0});
+            }
+        }
+    }
+}
+
+/**
+ * @brief Walks a pair of cells recursively and collects candidate pairs of particles.
+ */
+static void reb_collision_dual_tree_walk(void* data, const struct reb_collision_cell_pair p){
+    struct reb_collision_dual_tree* const ctx = data;
+    if (!p.self && !reb_collision_cells_might_collide(ctx, p)) return;
+    if (p.a->pt>=0 && p.b->pt>=0){
+        // Do not collide particle with itself (or its own ghost).
+        if (p.a->pt==p.b->pt) return;
+        if (ctx->N==REB_COLLISION_BATCH){
+            reb_collision_dual_tree_flush(ctx);
+        }
+        ctx->candidates[ctx->N++] = (struct reb_collision_candidate){.p1 = p.a->pt, .p2 = p.b->pt, .ra = p.ra, .rb = p.rb, .gb = p.gb};
+        return;
+    }
+    reb_collision_cell_pair_split(p, reb_collision_dual_tree_walk, ctx);
+}
+
+/**
+ * @brief List of pairs of cells which are distributed over the OpenMP threads.
+ */
+struct reb_collision_cell_pairs {
+    int N;
+    int allocatedN;
+    struct reb_collision_cell_pair* pairs;
+    const struct reb_collision_dual_tree* ctx;
+};
+
+static void reb_collision_cell_pairs_add(void* data, const struct reb_collision_cell_pair p){
+    struct reb_collision_cell_pairs* const list = data;
+    if (!p.self && !reb_collision_cells_might_collide(list->ctx, p)) return;
+    if (list->N>=list->allocatedN){
+        list->allocatedN = list->allocatedN ? list->allocatedN*2 : 64;
+        list->pairs = realloc(list->pairs, sizeof(struct reb_collision_cell_pair)*list->allocatedN);
+    }
+    list->pairs[list->N++] = p;
+}
+
+static void reb_collision_search_dual_tree(struct reb_simulation* const r, const int line, const double maxdrift, struct reb_collision_buffer* const buffers){
+    if (r->tree_root==NULL) return;
+    // Loop over ghost boxes, but only the inner most ring.
+    const int nghostxcol = (r->nghostx>1?1:r->nghostx);
+    const int nghostycol = (r->nghosty>1?1:r->nghosty);
+    const int nghostzcol = (r->nghostz>1?1:r->nghostz);
+    struct reb_ghostbox gbs[27];
+    int N_gb = 0;
+    int gb_central = 0;
+    for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+    for (int gby=-nghostycol; gby<=nghostycol; gby++){
+    for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+        if (gbx==0 && gby==0 && gbz==0){
+            gb_central = N_gb;
+        }
+        gbs[N_gb++] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+    }
+    }
+    }
+    struct reb_collision_dual_tree ctx0 = {
+        .r = r,
+        .gbs = gbs,
+        .gb_central = gb_central,
+        .line = line,
+        .rp = r->max_radius[0] + r->max_radius[1] + (line ? 2.*maxdrift : 0.),
+    };
+
+    // Pairs of root boxes. In the central box every pair is only visited once.
+    struct reb_collision_cell_pairs list = {.ctx = &ctx0};
+    for (int g=0; g<N_gb; g++){
+        for (int ra=0; ra<r->root_n; ra++){
+            const struct reb_treecell* const a = r->tree_root[ra];
+            if (a==NULL) continue;
+            for (int rb=(g==gb_central?ra:0); rb<r->root_n; rb++){
+                const struct reb_treecell* const b = r->tree_root[rb];
+                if (b==NULL) continue;
+                reb_collision_cell_pairs_add(&list, (struct reb_collision_cell_pair){.a = a, .b = b, .ra = ra, .rb = rb, .gb = g, .self = (g==gb_central && ra==rb)});
+            }
+        }
+    }
+#ifdef OPENMP
+    // Split pairs until there is enough work for all threads.
+    const int N_target = 64*omp_get_max_threads();
+    for (int level=0; level<8 && list.N<N_target; level++){
+        struct reb_collision_cell_pairs next = {.ctx = &ctx0};
+        for (int k=0; k<list.N; k++){
+            const struct reb_collision_cell_pair p = list.pairs[k];
+            if (p.a->pt>=0 && p.b->pt>=0){
+                reb_collision_cell_pairs_add(&next, p);
+            }else{
+                reb_collision_cell_pair_split(p, reb_collision_cell_pairs_add, &next);
+            }
+        }
+        free(list.pairs);
+        list = next;
+    }
+#endif // OPENMP
+
+#pragma omp parallel
+    {
+        struct reb_collision_dual_tree* const ctx = malloc(sizeof(struct reb_collision_dual_tree));
+        *ctx = ctx0;
+        ctx->buffer = &buffers[reb_collision_thread_num()];
+#pragma omp for schedule(dynamic)
+        for (int k=0; k<list.N; k++){
+            reb_collision_dual_tree_walk(ctx, list.pairs[k]);
+        }
+        reb_collision_dual_tree_flush(ctx);
+        free(ctx);
+    }
+    free(list.pairs);
+}
+
+/**
+ * @brief Copy of the particle data needed by the grid search, stored in the order of the grid cells.
+ */
+struct reb_collision_grid_particle {
+    double x;
+    double y;
+    double z;
+    double r;
+    int i;                              ///< Index of the particle in r->particles.
+};
+
+/**
+ * @brief Uniform grid of particles, used by REB_COLLISION_GRID and to build the neighbour lists of REB_COLLISION_VERLET.
+ */
+struct reb_collision_grid {
+    double min[3];                      ///< Lower corner of the bounding box of all particles.
+    double max[3];                      ///< Upper corner of the bounding box of all particles.
+    double h;                           ///< Width of a cell.
+    double rsum;                        ///< Sum of the two largest particle radii.
+    int n[3];                           ///< Number of cells in each direction.
+    int* cell_start;                    ///< Index of the first particle of every cell in sorted (one more entry than cells).
+    struct reb_collision_grid_particle* sorted; ///< Particles in the order of the grid cells.
+};
+
+/**
+ * @brief Sorts the particles into a uniform grid.
+ * @details Cells are at least as wide as the sum of the two largest radii plus padding.
+ * If this results in more cells than about twice the number of particles, the cells are enlarged.
+ * @param r REBOUND simulation to work on.
+ * @param N Number of particles.
+ * @param padding Added to the minimum width of a cell.
+ * @param grid The grid. Free with reb_collision_grid_free().
+ */
+static void reb_collision_grid_build(const struct reb_simulation* const r, const int N, const double padding, struct reb_collision_grid* const grid){
+    const struct reb_particle* const particles = r->particles;
+    double* const min = grid->min;
+    double* const max = grid->max;
+    int* const n = grid->n;
+
+    // Bounding box of all particles and the two largest radii.
+    min[0] = max[0] = particles[0].x;
+    min[1] = max[1] = particles[0].y;
+    min[2] = max[2] = particles[0].z;
+    double rmax0 = 0.;
+    double rmax1 = 0.;
+    for (int i=0;i<N;i++){
+        const struct reb_particle p = particles[i];
+        min[0] = MIN(min[0], p.x); max[0] = MAX(max[0], p.x);
+        min[1] = MIN(min[1], p.y); max[1] = MAX(max[1], p.y);
+        min[2] = MIN(min[2], p.z); max[2] = MAX(max[2], p.z);
+        if (p.r>=rmax0){
+            rmax1 = rmax0;
+            rmax0 = p.r;
+        }else if (p.r>rmax1){
+            rmax1 = p.r;
+        }
+    }
+    grid->rsum = rmax0 + rmax1;
+
+    // Cells need to be at least as wide as the largest possible sum of two radii. 
+    // If this results in more cells than particles, the cells are enlarged.
+    const double Ncells_max = 2.*N + 64.;
+    double h = grid->rsum + padding;
+    const double wmax = MAX(max[0]-min[0], MAX(max[1]-min[1], max[2]-min[2]));
+    if (!(h>wmax/Ncells_max)){
+        h = wmax/Ncells_max;
+    }
+    if (!(h>0.)){
+        h = 1.; // All particles are at the same position.
+    }
+    while(1){
+        double Ncells = 1.;
+        for (int d=0;d<3;d++){
+            Ncells *= floor((max[d]-min[d])/h) + 1.;
+        }
+        if (Ncells<=Ncells_max) break;
+        h *= 1.25992104989487; // Halves the number of cells in 3D.
+    }
+    for (int d=0;d<3;d++){
+        n[d] = (int)floor((max[d]-min[d])/h) + 1;
+    }
+    grid->h = h;
+    const int Ncells = n[0]*n[1]*n[2];
+
+    // Sort particles into cells (counting sort).
+    int* const cell = malloc(sizeof(int)*N);
+    int* const cell_start = calloc(Ncells+1, sizeof(int));
+    struct reb_collision_grid_particle* const sorted = malloc(sizeof(struct reb_collision_grid_particle)*N);
+    for (int i=0;i<N;i++){
+        const struct reb_particle p = particles[i];
+        const int cx = MIN((int)((p.x-min[0])/h), n[0]-1);
+        const int cy = MIN((int)((p.y-min[1])/h), n[1]-1);
+        const int cz = MIN((int)((p.z-min[2])/h), n[2]-1);
+        cell[i] = (cx*n[1] + cy)*n[2] + cz;
+        cell_start[cell[i]+1]++;
+    }
+    for (int c=0;c<Ncells;c++){
+        cell_start[c+1] += cell_start[c];
+    }
+    int* const cell_fill = malloc(sizeof(int)*Ncells);
+    memcpy(cell_fill, cell_start, sizeof(int)*Ncells);
+    for (int i=0;i<N;i++){
+        const struct reb_particle p = particles[i];
+        sorted[cell_fill[cell[i]]++] = (struct reb_collision_grid_particle){.x = p.x, .y = p.y, .z = p.z, .r = p.r, .i = i};
+    }
+    free(cell_fill);
+    free(cell);
+    grid->cell_start = cell_start;
+    grid->sorted = sorted;
+}
+
+static void reb_collision_grid_free(struct reb_collision_grid* const grid){
+    free(grid->sorted);
+    free(grid->cell_start);
+}
+
+/**
+ * @brief Ghost boxes of the inner most ring, which are the only ones searched for collisions.
+ * @param r REBOUND simulation to work on.
+ * @param gbs Array with room for 27 ghost boxes.
+ * @param gb_central Index of the central box in gbs.
+ * @return Number of ghost boxes.
+ */
+static int reb_collision_ghostboxes(struct reb_simulation* const r, struct reb_ghostbox* const gbs, int* const gb_central){
+    const int nghostxcol = (r->nghostx>1?1:r->nghostx);
+    const int nghostycol = (r->nghosty>1?1:r->nghosty);
+    const int nghostzcol = (r->nghostz>1?1:r->nghostz);
+    int N_gb = 0;
+    *gb_central = 0;
+    for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+    for (int gby=-nghostycol; gby<=nghostycol; gby++){
+    for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+        if (gbx==0 && gby==0 && gbz==0){
+            *gb_central = N_gb;
+        }
+        gbs[N_gb++] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+    }
+    }
+    }
+    return N_gb;
+}
+
+static void reb_collision_search_grid(struct reb_simulation* const r, struct reb_collision_buffer* const buffers){
+    const int N = r->N - r->N_var;
+    if (N<2) return;
+    const struct reb_particle* const particles = r->particles;
+    struct reb_collision_grid grid;
+    reb_collision_grid_build(r, N, 0., &grid);
+    const double* const min = grid.min;
+    const double* const max = grid.max;
+    const double h = grid.h;
+    const int* const n = grid.n;
+    const int* const cell_start = grid.cell_start;
+    const struct reb_collision_grid_particle* const sorted = grid.sorted;
+
+    // Loop over ghost boxes, but only the inner most ring.
+    struct reb_ghostbox gbs[27];
+    int gb_central;
+    const int N_gb = reb_collision_ghostboxes(r, gbs, &gb_central);
+
+#pragma omp parallel for schedule(guided)
+    for (int k=0;k<N;k++){
+        if (reb_sigint) continue;
+        struct reb_collision_buffer* const buffer = &buffers[reb_collision_thread_num()];
+        const struct reb_collision_grid_particle s1 = sorted[k];
+        const struct reb_particle p1 = particles[s1.i];
+        for (int g=0;g<N_gb;g++){
+            const struct reb_ghostbox gb = gbs[g];
+            const int central = (g==gb_central);
+            const double x = s1.x + gb.shiftx;
+            const double y = s1.y + gb.shifty;
+            const double z = s1.z + gb.shiftz;
+            // Skip ghostboxes in which the particle is not close to the grid.
+            if (x<min[0]-h || x>max[0]+h || y<min[1]-h || y>max[1]+h || z<min[2]-h || z>max[2]+h) continue;
+            const int cx = (int)floor((x-min[0])/h);
+            const int cy = (int)floor((y-min[1])/h);
+            const int cz = (int)floor((z-min[2])/h);
+            for (int ix=MAX(cx-1,0); ix<=MIN(cx+1,n[0]-1); ix++){
+            for (int iy=MAX(cy-1,0); iy<=MIN(cy+1,n[1]-1); iy++){
+            for (int iz=MAX(cz-1,0); iz<=MIN(cz+1,n[2]-1); iz++){
+                const int c = (ix*n[1] + iy)*n[2] + iz;
+                // In the central box every pair is only tested once.
+                const int start = central ? MAX(cell_start[c], k+1) : cell_start[c];
+                for (int l=start; l<cell_start[c+1]; l++){
+                    const struct reb_collision_grid_particle s2 = sorted[l];
+                    // Do not collide particle with itself (or its own ghost).
+                    if (s2.i==s1.i) continue;
+                    const double dx = x - s2.x;
+                    const double dy = y - s2.y;
+                    const double dz = z - s2.z;
+                    const double sr = s1.r + s2.r;
+                    // Check if particles are overlapping 
+                    if (dx*dx + dy*dy + dz*dz > sr*sr) continue;
+                    const struct reb_particle p2 = particles[s2.i];
+                    const double dvx = gb.shiftvx + p1.vx - p2.vx;
+                    const double dvy = gb.shiftvy + p1.vy - p2.vy;
+                    const double dvz = gb.shiftvz + p1.vz - p2.vz;
+                    // Check if particles are approaching each other
+                    if (dvx*dx + dvy*dy + dvz*dz >0) continue;
+                    reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = s1.i, .p2 = s2.i, .gb = gb});
+                    if (central){
+                        reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = s2.i, .p2 = s1.i, .gb = gb});
+                    }
+                }
+            }
+            }
+            }
+        }
+    }
+    reb_collision_grid_free(&grid);
+}
+
+/**
+ * @brief Interval along the x axis which a particle has covered during the last timestep.
+ */
+struct reb_collision_sweep_interval {
+    double lo;
+    double hi;
+    int i;                              ///< Index of the particle in r->particles.
+};
+
+static int reb_collision_sweep_compare(const void* a, const void* b){
+    const double diff = ((const struct reb_collision_sweep_interval*)a)->lo - ((const struct reb_collision_sweep_interval*)b)->lo;
+    if (diff > 0) return 1;
+    if (diff < 0) return -1;
+    return 0;
+}
+
+/**
+ * @brief Tests if the trajectories of two particles came closer than the sum of their radii during the last timestep.
+ * @details Same test as in REB_COLLISION_LINE. p1 is seen in ghostbox gb.
+ */
+static int reb_collision_trajectories_overlap(const struct reb_particle p1, const struct reb_particle p2, const struct reb_ghostbox gb, const double dt_last_done){
+    const double dx1 = gb.shiftx + p1.x - p2.x; // distance at end
+    const double dy1 = gb.shifty + p1.y - p2.y;
+    const double dz1 = gb.shiftz + p1.z - p2.z;
+    const double r1 = (dx1*dx1 + dy1*dy1 + dz1*dz1);
+    const double dvx1 = gb.shiftvx + p1.vx - p2.vx; 
+    const double dvy1 = gb.shiftvy + p1.vy - p2.vy;
+    const double dvz1 = gb.shiftvz + p1.vz - p2.vz;
+    const double dx2 = dx1 -dt_last_done*dvx1; // distance at beginning
+    const double dy2 = dy1 -dt_last_done*dvy1;
+    const double dz2 = dz1 -dt_last_done*dvz1;
+    const double r2 = (dx2*dx2 + dy2*dy2 + dz2*dz2);
+    const double t_closest = (dx1*dvx1 + dy1*dvy1 + dz1*dvz1)/(dvx1*dvx1 + dvy1*dvy1 + dvz1*dvz1);
+
+    double rmin2_ab = MIN(r1,r2);
+    if (t_closest/dt_last_done>=0. && t_closest/dt_last_done<=1.){
+        const double dx3 = dx1-t_closest*dvx1; // closest approach
+        const double dy3 = dy1-t_closest*dvy1;
+        const double dz3 = dz1-t_closest*dvz1;
+        const double r3 = (dx3*dx3 + dy3*dy3 + dz3*dz3);
+        rmin2_ab = MIN(rmin2_ab, r3);
+    }
+    const double rsum = p1.r + p2.r;
+    return rmin2_ab<=rsum*rsum;
+}
+
+// Sorts the x intervals of all particles. The order of the last call is
+// used as a starting point, so that the sort is O(N) if particles move
+// coherently. Falls back to qsort if the intervals are far from sorted,
+// for example if particles have been reordered.
+static void reb_collision_sweep_sort(struct reb_simulation* const r, struct reb_collision_sweep_interval* const intervals, const int N, int sorted_before){
+    if (sorted_before){
+        long moves = 0;
+        const long moves_max = 8L*N + 1024;
+        for (int j=1;j<N && moves<=moves_max;j++){
+            const struct reb_collision_sweep_interval key = intervals[j];
+            int i = j - 1;
+            while(i >= 0 && intervals[i].lo > key.lo){
+                intervals[i+1] = intervals[i];
+                i--;
+            }
+            moves += j-1-i;
+            intervals[i+1] = key;
+        }
+        if (moves>moves_max){
+            sorted_before = 0;
+        }
+    }
+    if (!sorted_before){
+        qsort(intervals, N, sizeof(struct reb_collision_sweep_interval), reb_collision_sweep_compare);
+    }
+    for (int k=0;k<N;k++){
+        r->collision_sweep_order[k] = intervals[k].i;
+    }
+}
+
+// Returns 1 if the order of the last call to reb_collision_sweep_sort() can 
+// be used. Otherwise, the order is reset.
+static int reb_collision_sweep_order_prepare(struct reb_simulation* const r, const int N){
+    if (r->collision_sweep_N!=N){
+        r->collision_sweep_order = realloc(r->collision_sweep_order, sizeof(int)*N);
+        r->collision_sweep_N = N;
+        for (int i=0;i<N;i++){
+            r->collision_sweep_order[i] = i;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+int reb_collision_search_min_distance(struct reb_simulation* const r, const double d_min, struct reb_encounter* const encounter){
+    const int N = r->N - r->N_var;
+    if (N<2) return 0;
+    const struct reb_particle* const particles = r->particles;
+    const double dt_last_done = r->dt_last_done;
+    const int sorted_before = reb_collision_sweep_order_prepare(r, N);
+    const int* const order = r->collision_sweep_order;
+    struct reb_collision_sweep_interval* const intervals = malloc(sizeof(struct reb_collision_sweep_interval)*N);
+    const double padding = 0.5*d_min*1.0001; // Safety factor to avoid floating point issues.
+    for (int k=0;k<N;k++){
+        const int i = order[k];
+        const struct reb_particle p = particles[i];
+        const double x_begin = p.x - dt_last_done*p.vx;
+        intervals[k].lo = MIN(p.x, x_begin) - padding;
+        intervals[k].hi = MAX(p.x, x_begin) + padding;
+        intervals[k].i = i;
+    }
+    reb_collision_sweep_sort(r, intervals, N, sorted_before);
+
+    const double d_min2 = d_min*d_min;
+    int found = 0;
+    for (int k=0;k<N;k++){
+        const struct reb_collision_sweep_interval s1 = intervals[k];
+        const struct reb_particle p1 = particles[s1.i];
+        for (int l=k+1; l<N && intervals[l].lo<=s1.hi; l++){
+            const int j = intervals[l].i;
+            const struct reb_particle p2 = particles[j];
+            // Relative position at the end of the timestep and relative velocity.
+            const double dx = p1.x - p2.x;
+            const double dy = p1.y - p2.y;
+            const double dz = p1.z - p2.z;
+            const double dvx = p1.vx - p2.vx;
+            const double dvy = p1.vy - p2.vy;
+            const double dvz = p1.vz - p2.vz;
+            const double r2_end = dx*dx + dy*dy + dz*dz;
+            const double v2 = dvx*dvx + dvy*dvy + dvz*dvz;
+            const double rv = dx*dvx + dy*dvy + dz*dvz;
+            // Minimum distance on the path. s is the time before the end of the timestep.
+            double r2_min = r2_end;
+            if (v2>0. && dt_last_done>0.){
+                const double s_closest = MIN(MAX(rv/v2, 0.), dt_last_done);
+                r2_min = r2_end - 2.*s_closest*rv + s_closest*s_closest*v2;
+            }
+            if (r2_min>=d_min2){
+                continue;
+            }
+            // Time at which the distance fell below d_min (larger root of |d - s v| = d_min).
+            double s_enter = dt_last_done;
+            if (v2>0. && dt_last_done>0.){
+                const double disc = rv*rv - v2*(r2_end-d_min2);
+                s_enter = MIN((rv + sqrt(MAX(disc, 0.)))/v2, dt_last_done);
+            }
+            const double t_enter = r->t - s_enter;
+            const double d = sqrt(MAX(r2_min, 0.));
+            if (!found || t_enter<encounter->t || (t_enter==encounter->t && d<encounter->d)){
+                encounter->p1 = MIN(s1.i, j);
+                encounter->p2 = MAX(s1.i, j);
+                encounter->t = t_enter;
+                encounter->d = d;
+                found = 1;
+            }
+        }
+    }
+    free(intervals);
+    return found;
+}
+
+static void reb_collision_search_sweep(struct reb_simulation* const r, struct reb_collision_buffer* const buffers){
+    const int N = r->N - r->N_var;
+    if (N<2) return;
+    const struct reb_particle* const particles = r->particles;
+    const double dt_last_done = r->dt_last_done;
+
+    // Start from the order of the last timestep. If the number of particles 
+    // has changed, the order is reset.
+    const int sorted_before = reb_collision_sweep_order_prepare(r, N);
+    const int* const order = r->collision_sweep_order;
+    struct reb_collision_sweep_interval* const intervals = malloc(sizeof(struct reb_collision_sweep_interval)*N);
+    double wmax = 0.;
+    for (int k=0;k<N;k++){
+        const int i = order[k];
+        const struct reb_particle p = particles[i];
+        const double x_begin = p.x - dt_last_done*p.vx;
+        const double radius = p.r*1.0001; // Safety factor to avoid floating point issues.
+        intervals[k].lo = MIN(p.x, x_begin) - radius;
+        intervals[k].hi = MAX(p.x, x_begin) + radius;
+        intervals[k].i = i;
+        wmax = MAX(wmax, intervals[k].hi - intervals[k].lo);
+    }
+
+    reb_collision_sweep_sort(r, intervals, N, sorted_before);
+
+    // Loop over ghost boxes, but only the inner most ring.
+    struct reb_ghostbox gbs[27];
+    int gb_central;
+    const int N_gb = reb_collision_ghostboxes(r, gbs, &gb_central);
+
+#pragma omp parallel for schedule(guided)
+    for (int k=0;k<N;k++){
+        if (reb_sigint) continue;
+        struct reb_collision_buffer* const buffer = &buffers[reb_collision_thread_num()];
+        const struct reb_collision_sweep_interval s1 = intervals[k];
+        const struct reb_particle p1 = particles[s1.i];
+        for (int g=0;g<N_gb;g++){
+            const struct reb_ghostbox gb = gbs[g];
+            double lo = s1.lo;
+            double hi = s1.hi;
+            int start = k+1;
+            if (g!=gb_central){
+                // Interval of the particle seen in the ghostbox.
+                const double x_end = p1.x + gb.shiftx;
+                const double x_begin = x_end - dt_last_done*(p1.vx + gb.shiftvx);
+                const double radius = p1.r*1.0001;
+                lo = MIN(x_end, x_begin) - radius;
+                hi = MAX(x_end, x_begin) + radius;
+                // Find the first interval which might overlap (binary search).
+                int a = 0;
+                int b = N;
+                while (a<b){
+                    const int m = (a+b)/2;
+                    if (intervals[m].lo < lo - wmax){
+                        a = m+1;
+                    }else{
+                        b = m;
+                    }
                 }
+                start = a;
             }
+            for (int l=start; l<N && intervals[l].lo<=hi; l++){
+                const struct reb_collision_sweep_interval s2 = intervals[l];
+                if (s2.hi<lo) continue;
+                // Every pair is reported once, as in REB_COLLISION_LINE. 
+                // In the central box the order of the particles is arbitrary.
+                int i1 = s1.i;
+                int i2 = s2.i;
+                if (g==gb_central){
+                    if (i2<i1){
+                        i1 = s2.i;
+                        i2 = s1.i;
+                    }
+                }else if (i2<=i1){
+                    continue;
+                }
+                if (!reb_collision_trajectories_overlap(particles[i1], particles[i2], gb, dt_last_done)) continue;
+                reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = i1, .p2 = i2, .gb = gb});
+            }
+        }
+    }
+    free(intervals);
+}
+
+/**
+ * @brief Candidate pair in the neighbour list of REB_COLLISION_VERLET and REB_COLLISION_LINEVERLET.
+ * @details Every pair of particles is only stored once. If g is not the central box, i<j. 
+ */
+struct reb_collision_verlet_pair {
+    int i;                              ///< Index of the particle which is seen in the ghost box.
+    int j;                              ///< Index of the other particle.
+    int g;                              ///< Index of the ghost box (see reb_collision_ghostboxes()).
+};
+
+/**
+ * @brief Neighbour list which is kept between timesteps.
+ */
+struct reb_collision_verlet {
+    int N;                              ///< Number of particles when the list was built.
+    int line;                           ///< 1 if the list was built for REB_COLLISION_LINEVERLET.
+    double t;                           ///< Time when the list was built.
+    double skin;                        ///< Distance added to the sum of the two largest radii.
+    double rsum;                        ///< Sum of the two largest radii when the list was built.
+    double OMEGA;                       ///< Shear rate of the shear flow which is subtracted from the displacements (0 without shear boundaries).
+    double* x;                          ///< Positions of all particles when the list was built (3N values).
+    int* image;                         ///< Ghost box in which every particle is closest to its position when the list was built (N values).
+    int N_gb;                           ///< Number of ghost boxes.
+    int gb_central;                     ///< Index of the central box.
+    int nghostcol[3];                   ///< Number of ghost boxes in each direction (0 or 1).
+    struct reb_ghostbox gbs[27];        ///< Ghost boxes when the list was built.
+    int N_pairs;                        ///< Number of candidate pairs.
+    int allocatedN_pairs;
+    struct reb_collision_verlet_pair* pairs;
+};
+
+/**
+ * @brief Growable array of candidate pairs, one per thread while the neighbour list is built.
+ */
+struct reb_collision_verlet_pairs {
+    int N;
+    int allocatedN;
+    struct reb_collision_verlet_pair* pairs;
+};
+
+static void reb_collision_verlet_pairs_add(struct reb_collision_verlet_pairs* const list, const struct reb_collision_verlet_pair p){
+    if (list->N>=list->allocatedN){
+        list->allocatedN = list->allocatedN ? list->allocatedN*2 : 1024;
+        list->pairs = realloc(list->pairs, sizeof(struct reb_collision_verlet_pair)*list->allocatedN);
+    }
+    list->pairs[list->N++] = p;
+}
+
+void reb_collision_verlet_free(struct reb_simulation* const r){
+    struct reb_collision_verlet* const v = r->collision_verlet;
+    if (v){
+        free(v->x);
+        free(v->image);
+        free(v->pairs);
+        free(v);
+        r->collision_verlet = NULL;
+    }
+}
+
+/**
+ * @brief Sum of the two largest particle radii.
+ */
+static double reb_collision_verlet_rsum(const struct reb_particle* const particles, const int N){
+    double rmax0 = 0.;
+    double rmax1 = 0.;
+    for (int i=0;i<N;i++){
+        const double pr = particles[i].r;
+        if (pr>=rmax0){
+            rmax1 = rmax0;
+            rmax0 = pr;
+        }else if (pr>rmax1){
+            rmax1 = pr;
+        }
+    }
+    return rmax0 + rmax1;
+}
+
+/**
+ * @brief Returns the index of the ghost box which is shifted by the sum of the shifts of the boxes g and a minus the shift of the box b, or -1 if it is not in the inner most ring.
+ * @details The shear periodic shifts of the boxes in the inner most ring add up in the same way as the periodic shifts.
+ */
+static inline int reb_collision_verlet_gb_compose(const int* const nghostcol, const int g, const int a, const int b){
+    const int ny = 2*nghostcol[1]+1;
+    const int nz = 2*nghostcol[2]+1;
+    const int gx = g/(ny*nz) + a/(ny*nz) - b/(ny*nz) - nghostcol[0];
+    const int gy = (g/nz)%ny + (a/nz)%ny - (b/nz)%ny - nghostcol[1];
+    const int gz = g%nz + a%nz - b%nz - nghostcol[2];
+    if (gx<-nghostcol[0] || gx>nghostcol[0] || gy<-nghostcol[1] || gy>nghostcol[1] || gz<-nghostcol[2] || gz>nghostcol[2]) return -1;
+    return ((gx+nghostcol[0])*ny + gy+nghostcol[1])*nz + gz+nghostcol[2];
+}
+
+/**
+ * @brief Updates the images of all particles and returns an upper limit on how much closer any two particles can have come since the neighbour list was built.
+ * @details Particles which crossed the boundary are followed into the ghost box in which 
+ * they are closest to their position when the list was built. The shear flow is subtracted 
+ * from the displacements, so that particles which follow the shear flow do not lead to a 
+ * rebuild. Two neighbours which are separated by dx in the radial direction then approach 
+ * each other at most with 1.5*OMEGA*dx. Ghost boxes which did not move with their velocity 
+ * shift (the shear periodic shift wrapped around or the box has been changed) also count as 
+ * displacement. With line set to 1, the trajectories during the last timestep are included.
+ */
+static double reb_collision_verlet_displacement(const struct reb_simulation* const r, struct reb_collision_verlet* const v, const struct reb_ghostbox* const gbs, const int line){
+    const struct reb_particle* const particles = r->particles;
+    const double dt = r->t - v->t;
+    const double dt_line = line?fabs(r->dt_last_done):0.;
+    double gmax = 0.;
+    for (int g=0;g<v->N_gb;g++){
+        const double dx = gbs[g].shiftx - v->gbs[g].shiftx - v->gbs[g].shiftvx*dt;
+        const double dy = gbs[g].shifty - v->gbs[g].shifty - v->gbs[g].shiftvy*dt;
+        const double dz = gbs[g].shiftz - v->gbs[g].shiftz - v->gbs[g].shiftvz*dt;
+        const double dvx = gbs[g].shiftvx - v->gbs[g].shiftvx;
+        const double dvy = gbs[g].shiftvy - v->gbs[g].shiftvy;
+        const double dvz = gbs[g].shiftvz - v->gbs[g].shiftvz;
+        gmax = MAX(gmax, sqrt(dx*dx + dy*dy + dz*dz) + sqrt(dvx*dvx + dvy*dvy + dvz*dvz)*dt_line);
+    }
+    double dmax2 = 0.;
+    double vmax2 = 0.;
+    for (int i=0;i<v->N;i++){
+        const struct reb_particle p = particles[i];
+        const double* const x = v->x + 3*i;
+        const double u = -1.5*v->OMEGA*x[0]; // Shear flow at the position when the list was built.
+        int image = v->gb_central;
+        double dx = p.x - x[0];
+        double dy = p.y - x[1] - u*dt;
+        double dz = p.z - x[2];
+        double d2 = dx*dx + dy*dy + dz*dz;
+        if (d2>v->skin*v->skin){
+            // The particle might have crossed the boundary.
+            for (int g=0;g<v->N_gb;g++){
+                const double dxg = p.x + gbs[g].shiftx - x[0];
+                const double dyg = p.y + gbs[g].shifty - x[1] - u*dt;
+                const double dzg = p.z + gbs[g].shiftz - x[2];
+                const double d2g = dxg*dxg + dyg*dyg + dzg*dzg;
+                if (d2g<d2){
+                    d2 = d2g;
+                    image = g;
+                }
+            }
+        }
+        v->image[i] = image;
+        dmax2 = MAX(dmax2, d2);
+        const double dvx = p.vx + gbs[image].shiftvx;
+        const double dvy = p.vy + gbs[image].shiftvy - u;
+        const double dvz = p.vz + gbs[image].shiftvz;
+        vmax2 = MAX(vmax2, dvx*dvx + dvy*dvy + dvz*dvz);
+    }
+    const double dmax = sqrt(dmax2) + sqrt(vmax2)*dt_line;
+    return 2.*dmax + gmax + 1.5*fabs(v->OMEGA)*(v->rsum + 2.*dmax + gmax)*(fabs(dt) + dt_line);
+}
+
+/**
+ * @brief Stores the current positions and ghost boxes in the neighbour list, which is allocated if needed.
+ * @details The pairs are not changed. 
+ * @return Largest velocity of any particle relative to the shear flow.
+ */
+static double reb_collision_verlet_init(struct reb_simulation* const r, const int N, const int line, const struct reb_ghostbox* const gbs, const int N_gb, const int gb_central, const double OMEGA, const double rsum){
+    const struct reb_particle* const particles = r->particles;
+    struct reb_collision_verlet* v = r->collision_verlet;
+    if (v==NULL){
+        v = calloc(1, sizeof(struct reb_collision_verlet));
+        r->collision_verlet = v;
+    }
+    if (v->N!=N){
+        v->x = realloc(v->x, sizeof(double)*3*N);
+        v->image = realloc(v->image, sizeof(int)*N);
+    }
+    v->N = N;
+    v->line = line;
+    v->t = r->t;
+    v->rsum = rsum;
+    v->OMEGA = OMEGA;
+    v->N_gb = N_gb;
+    v->gb_central = gb_central;
+    v->nghostcol[0] = (r->nghostx>1?1:r->nghostx);
+    v->nghostcol[1] = (r->nghosty>1?1:r->nghosty);
+    v->nghostcol[2] = (r->nghostz>1?1:r->nghostz);
+    memcpy(v->gbs, gbs, sizeof(struct reb_ghostbox)*N_gb);
+    double vmax2 = 0.;
+    for (int i=0;i<N;i++){
+        const struct reb_particle p = particles[i];
+        v->x[3*i+0] = p.x;
+        v->x[3*i+1] = p.y;
+        v->x[3*i+2] = p.z;
+        v->image[i] = gb_central;
+        const double dvy = p.vy + 1.5*OMEGA*p.x;
+        vmax2 = MAX(vmax2, p.vx*p.vx + dvy*dvy + p.vz*p.vz);
+    }
+    return sqrt(vmax2);
+}
+
+/**
+ * @brief Replaces the pairs of the neighbour list by the pairs in lists and frees them.
+ */
+static void reb_collision_verlet_set_pairs(struct reb_collision_verlet* const v, struct reb_collision_verlet_pairs* const lists, const int N_lists){
+    v->N_pairs = 0;
+    for (int t=0;t<N_lists;t++){
+        if (v->N_pairs + lists[t].N > v->allocatedN_pairs){
+            v->allocatedN_pairs = v->N_pairs + lists[t].N;
+            v->pairs = realloc(v->pairs, sizeof(struct reb_collision_verlet_pair)*v->allocatedN_pairs);
         }
+        if (lists[t].N){
+            memcpy(v->pairs + v->N_pairs, lists[t].pairs, sizeof(struct reb_collision_verlet_pair)*lists[t].N);
+        }
+        v->N_pairs += lists[t].N;
+        free(lists[t].pairs);
     }
+    free(lists);
 }
 
+/**
+ * @brief Builds the neighbour list.
+ * @details All pairs which are closer than the sum of the two largest radii plus the skin
+ * distance are found with the same grid and the same ghost boxes as in REB_COLLISION_GRID. 
+ */
+static void reb_collision_verlet_build(struct reb_simulation* const r, const int N, const int line, const struct reb_ghostbox* const gbs, const int N_gb, const int gb_central, const double OMEGA, const double rsum){
+    const double vmax = reb_collision_verlet_init(r, N, line, gbs, N_gb, gb_central, OMEGA, rsum);
+    struct reb_collision_verlet* const v = r->collision_verlet;
+    if (r->collision_verlet_skin>0.){
+        v->skin = r->collision_verlet_skin;
+    }else{
+        // At least about ten timesteps before the list needs to be rebuilt.
+        v->skin = 0.5*rsum + 20.*(vmax + 0.75*fabs(OMEGA)*rsum)*fabs(r->dt);
+    }
+    r->counters.collision_verlet_builds++;
 
+    struct reb_collision_grid grid;
+    reb_collision_grid_build(r, N, v->skin, &grid);
+    const double* const min = grid.min;
+    const double* const max = grid.max;
+    const double h = grid.h;
+    const int* const n = grid.n;
+    const int* const cell_start = grid.cell_start;
+    const struct reb_collision_grid_particle* const sorted = grid.sorted;
+    const double cutoff = rsum + v->skin;
+    const double cutoff2 = cutoff*cutoff;
 
+#ifdef OPENMP
+    const int N_threads = omp_get_max_threads();
+#else // OPENMP
+    const int N_threads = 1;
+#endif // OPENMP
+    struct reb_collision_verlet_pairs* const lists = calloc(N_threads, sizeof(struct reb_collision_verlet_pairs));
+    // With a static schedule, the pairs are in the same order for a given number of threads.
+#pragma omp parallel for schedule(static)
+    for (int k=0;k<N;k++){
+        struct reb_collision_verlet_pairs* const list = &lists[reb_collision_thread_num()];
+        const struct reb_collision_grid_particle s1 = sorted[k];
+        for (int g=0;g<N_gb;g++){
+            const int central = (g==gb_central);
+            const double x = s1.x + gbs[g].shiftx;
+            const double y = s1.y + gbs[g].shifty;
+            const double z = s1.z + gbs[g].shiftz;
+            if (x<min[0]-h || x>max[0]+h || y<min[1]-h || y>max[1]+h || z<min[2]-h || z>max[2]+h) continue;
+            const int cx = (int)floor((x-min[0])/h);
+            const int cy = (int)floor((y-min[1])/h);
+            const int cz = (int)floor((z-min[2])/h);
+            for (int ix=MAX(cx-1,0); ix<=MIN(cx+1,n[0]-1); ix++){
+            for (int iy=MAX(cy-1,0); iy<=MIN(cy+1,n[1]-1); iy++){
+            for (int iz=MAX(cz-1,0); iz<=MIN(cz+1,n[2]-1); iz++){
+                const int c = (ix*n[1] + iy)*n[2] + iz;
+                const int start = central ? MAX(cell_start[c], k+1) : cell_start[c];
+                for (int l=start; l<cell_start[c+1]; l++){
+                    const struct reb_collision_grid_particle s2 = sorted[l];
+                    // Outside of the central box, the pair is also found the other way round.
+                    if (central ? s2.i==s1.i : s2.i<=s1.i) continue;
+                    const double dx = x - s2.x;
+                    const double dy = y - s2.y;
+                    const double dz = z - s2.z;
+                    if (dx*dx + dy*dy + dz*dz > cutoff2) continue;
+                    reb_collision_verlet_pairs_add(list, (struct reb_collision_verlet_pair){.i = s1.i, .j = s2.i, .g = g});
+                }
+            }
+            }
+            }
+        }
+    }
+    reb_collision_grid_free(&grid);
+    reb_collision_verlet_set_pairs(v, lists, N_threads);
+}
+
+/**
+ * @brief Same test as in REB_COLLISION_GRID, particle i is seen in the ghost box gb.
+ */
+static inline int reb_collision_verlet_overlap(const struct reb_particle p1, const struct reb_particle p2, const struct reb_ghostbox gb){
+    const double dx = gb.shiftx + p1.x - p2.x;
+    const double dy = gb.shifty + p1.y - p2.y;
+    const double dz = gb.shiftz + p1.z - p2.z;
+    const double sr = p1.r + p2.r;
+    // Check if particles are overlapping 
+    if (dx*dx + dy*dy + dz*dz > sr*sr) return 0;
+    const double dvx = gb.shiftvx + p1.vx - p2.vx;
+    const double dvy = gb.shiftvy + p1.vy - p2.vy;
+    const double dvz = gb.shiftvz + p1.vz - p2.vz;
+    // Check if particles are approaching each other
+    return dvx*dx + dvy*dy + dvz*dz <= 0;
+}
+
+static void reb_collision_search_verlet(struct reb_simulation* const r, const int line, struct reb_collision_buffer* const buffers){
+    const int N = r->N - r->N_var;
+    if (N<2) return;
+    const struct reb_particle* const particles = r->particles;
+    const double dt_last_done = r->dt_last_done;
+    struct reb_ghostbox gbs[27];
+    int gb_central;
+    const int N_gb = reb_collision_ghostboxes(r, gbs, &gb_central);
+    const double OMEGA = (r->boundary==REB_BOUNDARY_SHEAR)?r->ri_sei.OMEGA:0.;
+    const double rsum = reb_collision_verlet_rsum(particles, N);
+
+    struct reb_collision_verlet* v = r->collision_verlet;
+    int rebuild = (v==NULL || v->N!=N || v->line!=line || v->N_gb!=N_gb || v->gb_central!=gb_central || v->OMEGA!=OMEGA || rsum>v->rsum);
+    if (!rebuild){
+        // Also rebuilds if the displacement is NaN.
+        rebuild = !(reb_collision_verlet_displacement(r, v, gbs, line) < v->skin);
+    }
+    if (rebuild){
+        reb_collision_verlet_build(r, N, line, gbs, N_gb, gb_central, OMEGA, rsum);
+        v = r->collision_verlet;
+    }
+
+    const struct reb_collision_verlet_pair* const pairs = v->pairs;
+    const int* const image = v->image;
+    const int* const nghostcol = v->nghostcol;
+#pragma omp parallel for schedule(static)
+    for (int k=0;k<v->N_pairs;k++){
+        struct reb_collision_buffer* const buffer = &buffers[reb_collision_thread_num()];
+        const struct reb_collision_verlet_pair pair = pairs[k];
+        // Ghost box in which particle i is seen now (particles might have crossed the boundary)
+        // and the opposite box, in which particle j is seen.
+        const int g = reb_collision_verlet_gb_compose(nghostcol, pair.g, image[pair.i], image[pair.j]);
+        if (g<0) continue;
+        const int gopp = reb_collision_verlet_gb_compose(nghostcol, gb_central, gb_central, g);
+        const int i = pair.i;
+        const int j = pair.j;
+        if (g==gb_central){
+            if (line){
+                // Same test and same order as in REB_COLLISION_LINE.
+                const int i1 = MIN(i,j);
+                const int i2 = MAX(i,j);
+                if (!reb_collision_trajectories_overlap(particles[i1], particles[i2], gbs[g], dt_last_done)) continue;
+                reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = i1, .p2 = i2, .gb = gbs[g]});
+            }else{
+                if (!reb_collision_verlet_overlap(particles[i], particles[j], gbs[g])) continue;
+                reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = i, .p2 = j, .gb = gbs[g]});
+                reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = j, .p2 = i, .gb = gbs[g]});
+            }
+        }else{
+            if (line){
+                // REB_COLLISION_LINE only tests the particle with the lower index in the ghost box.
+                if (i<j){
+                    if (!reb_collision_trajectories_overlap(particles[i], particles[j], gbs[g], dt_last_done)) continue;
+                    reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = i, .p2 = j, .gb = gbs[g]});
+                }else{
+                    if (!reb_collision_trajectories_overlap(particles[j], particles[i], gbs[gopp], dt_last_done)) continue;
+                    reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = j, .p2 = i, .gb = gbs[gopp]});
+                }
+            }else{
+                // REB_COLLISION_GRID tests both particles in the ghost box.
+                if (reb_collision_verlet_overlap(particles[i], particles[j], gbs[g])){
+                    reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = i, .p2 = j, .gb = gbs[g]});
+                }
+                if (reb_collision_verlet_overlap(particles[j], particles[i], gbs[gopp])){
+                    reb_collision_buffer_add(buffer, (struct reb_collision){.p1 = j, .p2 = i, .gb = gbs[gopp]});
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns 1 if the gravity tree walk can collect the candidate pairs for the collision search.
+ */
+static int reb_collision_fused_supported(const struct reb_simulation* const r){
+#ifdef MPI
+    return 0;
+#else // MPI
+    return r->tree_fused_walk && r->gravity==REB_GRAVITY_TREE && r->tree_group_size<=1
+        && (r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE)
+        && r->integrator!=REB_INTEGRATOR_MERCURIUS && r->N_var==0;
+#endif // MPI
+}
+
+struct reb_collision_fused* reb_collision_fused_begin(struct reb_simulation* const r){
+    const int N = r->N;
+    if (!reb_collision_fused_supported(r) || N<2){
+        return NULL;
+    }
+    struct reb_ghostbox gbs[27];
+    int gb_central;
+    const int N_gb = reb_collision_ghostboxes(r, gbs, &gb_central);
+    const double OMEGA = (r->boundary==REB_BOUNDARY_SHEAR)?r->ri_sei.OMEGA:0.;
+    const double rsum = reb_collision_verlet_rsum(r->particles, N);
+    const double vmax = reb_collision_verlet_init(r, N, r->collision==REB_COLLISION_LINETREE, gbs, N_gb, gb_central, OMEGA, rsum);
+    struct reb_collision_verlet* const v = r->collision_verlet;
+    if (r->collision_verlet_skin>0.){
+        v->skin = r->collision_verlet_skin;
+    }else{
+        // The candidates only need to last until the collision search at the end of the timestep.
+        v->skin = 0.1*rsum + 4.*(vmax + 0.75*fabs(OMEGA)*rsum)*fabs(r->dt);
+    }
+
+    struct reb_collision_fused* const f = malloc(sizeof(struct reb_collision_fused));
+    f->cutoff = rsum + v->skin;
+    // Ghost boxes are in the same order as in reb_boundary_get_ghostbox_shifts().
+    f->gb_map = malloc(sizeof(int)*(2*r->nghostx+1)*(2*r->nghosty+1)*(2*r->nghostz+1));
+    const int* const nghostcol = v->nghostcol;
+    int g = 0;
+    for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+    for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+    for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+        if (abs(gbx)>nghostcol[0] || abs(gby)>nghostcol[1] || abs(gbz)>nghostcol[2]){
+            f->gb_map[g++] = -1;
+        }else{
+            f->gb_map[g++] = ((gbx+nghostcol[0])*(2*nghostcol[1]+1) + gby+nghostcol[1])*(2*nghostcol[2]+1) + gbz+nghostcol[2];
+        }
+    }
+    }
+    }
+#ifdef OPENMP
+    f->N_lists = omp_get_max_threads();
+#else // OPENMP
+    f->N_lists = 1;
+#endif // OPENMP
+    f->lists = calloc(f->N_lists, sizeof(struct reb_collision_verlet_pairs));
+    return f;
+}
+
+void reb_collision_fused_add(const struct reb_collision_fused* const f, const int pt, const int j, const int g){
+    reb_collision_verlet_pairs_add(&f->lists[reb_collision_thread_num()], (struct reb_collision_verlet_pair){.i = pt, .j = j, .g = g});
+}
+
+void reb_collision_fused_cell(const struct reb_collision_fused* const f, const int pt, const struct reb_treecell* const node, const struct reb_ghostbox* const gb, const int g){
+    if (node->pt>=0){
+        if (node->pt<=pt) return;
+        const double dx = gb->shiftx - node->mx;
+        const double dy = gb->shifty - node->my;
+        const double dz = gb->shiftz - node->mz;
+        if (dx*dx + dy*dy + dz*dz < f->cutoff*f->cutoff){
+            reb_collision_fused_add(f, pt, node->pt, g);
+        }
+        return;
+    }
+    const double dx = gb->shiftx - node->x;
+    const double dy = gb->shifty - node->y;
+    const double dz = gb->shiftz - node->z;
+    const double rp = f->cutoff + 0.86602540378443*node->w;
+    if (dx*dx + dy*dy + dz*dz >= rp*rp) return;
+    for (int o=0; o<8; o++){
+        if (node->oct[o]!=NULL){
+            reb_collision_fused_cell(f, pt, node->oct[o], gb, g);
+        }
+    }
+}
+
+void reb_collision_fused_end(struct reb_simulation* const r, struct reb_collision_fused* const f){
+    struct reb_collision_verlet* const v = r->collision_verlet;
+    reb_collision_verlet_set_pairs(v, f->lists, f->N_lists);
+    if (reb_sigint){
+        // The walk has been interrupted, so the list is incomplete. 
+        v->N = -1;
+    }
+    free(f->gb_map);
+    free(f);
+}
+
+#ifndef MPI
+static int reb_collision_search_fused(struct reb_simulation* const r, const int line, struct reb_collision_buffer* const buffers){
+    struct reb_collision_verlet* const v = r->collision_verlet;
+    if (!reb_collision_fused_supported(r) || v==NULL) return 0;
+    const int N = r->N;
+    const struct reb_particle* const particles = r->particles;
+    struct reb_ghostbox gbs[27];
+    int gb_central;
+    const int N_gb = reb_collision_ghostboxes(r, gbs, &gb_central);
+    const double OMEGA = (r->boundary==REB_BOUNDARY_SHEAR)?r->ri_sei.OMEGA:0.;
+    const double rsum = reb_collision_verlet_rsum(particles, N);
+    if (v->N!=N || v->line!=line || v->N_gb!=N_gb || v->gb_central!=gb_central || v->OMEGA!=OMEGA || rsum>v->rsum){
+        return 0;
+    }
+    // Also falls back to the tree if the displacement is NaN.
+    if (!(reb_collision_verlet_displacement(r, v, gbs, line) < v->skin)){
+        return 0;
+    }
+    r->counters.tree_fused_searches++;
+
+    const struct reb_collision_verlet_pair* const pairs = v->pairs;
+    const int* const image = v->image;
+    const int* const nghostcol = v->nghostcol;
+#pragma omp parallel
+    {
+        struct reb_collision_dual_tree* const ctx = malloc(sizeof(struct reb_collision_dual_tree));
+        *ctx = (struct reb_collision_dual_tree){
+            .r = r,
+            .gbs = gbs,
+            .gb_central = gb_central,
+            .line = line,
+            .buffer = &buffers[reb_collision_thread_num()],
+        };
+#pragma omp for schedule(static)
+        for (int k=0;k<v->N_pairs;k++){
+            const struct reb_collision_verlet_pair pair = pairs[k];
+            // Ghost box in which particle i is seen now (particles might have crossed the boundary).
+            const int g = reb_collision_verlet_gb_compose(nghostcol, pair.g, image[pair.i], image[pair.j]);
+            if (g<0) continue;
+            if (ctx->N+2>REB_COLLISION_BATCH){
+                reb_collision_dual_tree_flush(ctx);
+            }
+            const int ri = reb_get_rootbox_for_particle(r, particles[pair.i]);
+            const int rj = reb_get_rootbox_for_particle(r, particles[pair.j]);
+            // The dual tree search visits a pair in the central box once and tests it for 
+            // both particles. Outside of the central box, it also visits the opposite pair.
+            ctx->candidates[ctx->N++] = (struct reb_collision_candidate){.p1 = pair.i, .p2 = pair.j, .ra = ri, .rb = rj, .gb = g};
+            if (g!=gb_central){
+                const int gopp = reb_collision_verlet_gb_compose(nghostcol, gb_central, gb_central, g);
+                ctx->candidates[ctx->N++] = (struct reb_collision_candidate){.p1 = pair.j, .p2 = pair.i, .ra = rj, .rb = ri, .gb = gopp};
+            }
+        }
+        reb_collision_dual_tree_flush(ctx);
+        free(ctx);
+    }
+    return 1;
+}
+#endif // MPI
 
 int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_collision c){
     struct reb_particle* const particles = r->particles;
@@ -642,8 +2043,7 @@ int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_
         p2 = particles[c.p2];
 #ifdef MPI
     }else{
-        int root_n_per_node = r->root_n/r->mpi_num;
-        int proc_id = c.ri/root_n_per_node;
+        int proc_id = r->mpi_root_owner[c.ri];
         p2 = r->particles_recv[proc_id][c.p2];
     }
 #endif // MPI
@@ -792,6 +2192,8 @@ int reb_collision_resolve_merge(struct reb_simulation* const r, struct reb_colli
 
             Ei += - r->G*pi->m*pj->m/_r;
         }
+        // Interaction with all other particles. O(N) rather than recalculating the total energy.
+        Ei += reb_tools_potential_energy_of_particle(r, i, j) + reb_tools_potential_energy_of_particle(r, j, i);
     }
     
     // Merge by conserving mass, volume and momentum
@@ -820,6 +2222,8 @@ int reb_collision_resolve_merge(struct reb_simulation* const r, struct reb_colli
 
             Ef += 0.5*pi->m*(vx*vx + vy*vy + vz*vz);
         }
+        // Particle j still exists until the caller removes it.
+        Ef += reb_tools_potential_energy_of_particle(r, i, j);
         r->energy_offset += Ei - Ef;
     }
     
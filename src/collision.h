@@ -24,9 +24,73 @@
  */
 #ifndef _COLLISIONS_H
 #define _COLLISIONS_H
+struct reb_encounter;
 /**
  * @brief Search for collisions and resolve them.
  */
 void reb_collision_search(struct reb_simulation* const r);
 
+/**
+ * @brief Searches for collisions without resolving them.
+ * @details The collisions are stored in r->collisions, sorted by particle index.
+ * @return Number of collisions found.
+ */
+int reb_collision_find(struct reb_simulation* const r);
+
+/**
+ * @brief Searches for pairs of particles which came closer than d_min during the last timestep.
+ * @details Particles are assumed to move on straight lines during the last 
+ * timestep. Uses a sweep along the x axis, so the cost is O(N log N) or 
+ * better, rather than O(N^2). Ghost boxes are not taken into account.
+ * @param d_min Distance threshold.
+ * @param encounter If an encounter is found, the pair which crossed d_min first is stored here.
+ * @return 1 if an encounter has been found, 0 otherwise.
+ */
+int reb_collision_search_min_distance(struct reb_simulation* const r, const double d_min, struct reb_encounter* const encounter);
+
+/**
+ * @brief Frees the neighbour list of REB_COLLISION_VERLET and REB_COLLISION_LINEVERLET.
+ */
+void reb_collision_verlet_free(struct reb_simulation* const r);
+
+struct reb_treecell;
+struct reb_ghostbox;
+struct reb_collision_verlet_pairs;
+
+/**
+ * @brief Candidate pairs collected during the gravity tree walk (tree_fused_walk).
+ * @details The pairs are stored in the neighbour list of REB_COLLISION_VERLET,
+ * which REB_COLLISION_TREE and REB_COLLISION_LINETREE then use instead of walking the tree again.
+ */
+struct reb_collision_fused {
+    double cutoff;                      ///< Pairs closer than the sum of the two largest radii plus the skin distance are candidates.
+    int* gb_map;                        ///< Index of every gravity ghost box in the collision search, -1 if it is not in the inner most ring.
+    int N_lists;                        ///< Number of lists (threads).
+    struct reb_collision_verlet_pairs* lists; ///< Candidate pairs, one list per thread.
+};
+
+/**
+ * @brief Starts collecting candidate pairs during the gravity tree walk.
+ * @return NULL if the candidates are not collected (tree_fused_walk not set or not supported, or MPI).
+ */
+struct reb_collision_fused* reb_collision_fused_begin(struct reb_simulation* const r);
+
+/**
+ * @brief Adds the candidate pair of particle pt, seen in ghost box g, and particle j (pt<j).
+ * @details Thread-safe, every thread has its own list.
+ */
+void reb_collision_fused_add(const struct reb_collision_fused* const f, const int pt, const int j, const int g);
+
+/**
+ * @brief Adds all particles j>pt in a cell which the gravity walk did not open to the candidates of particle pt.
+ * @param gb Ghost box plus position of particle pt.
+ * @param g Index of the ghost box in the collision search.
+ */
+void reb_collision_fused_cell(const struct reb_collision_fused* const f, const int pt, const struct reb_treecell* const node, const struct reb_ghostbox* const gb, const int g);
+
+/**
+ * @brief Stores the candidate pairs in the neighbour list and frees f.
+ */
+void reb_collision_fused_end(struct reb_simulation* const r, struct reb_collision_fused* const f);
+
 #endif // _COLLISIONS_H
@@ -38,6 +38,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include "particle.h"
@@ -46,85 +49,67 @@
 #include "boundary.h"
 #include "communication_mpi.h"
 
+#define MAX(a, b) ((a) < (b) ? (b) : (a))       ///< Returns the maximum of a and b
+
+// Creates and commits an MPI datatype which only consists of the given blocks
+// but has the extent of the C struct, so that arrays of structs can be sent.
+static void reb_communication_mpi_type(int N, int* blen, MPI_Aint* indices, MPI_Datatype* types, size_t extent, MPI_Datatype* type){
+	MPI_Datatype blocks;
+	MPI_Type_create_struct(N, blen, indices, types, &blocks);
+	MPI_Type_create_resized(blocks, 0, extent, type);
+	MPI_Type_free(&blocks);
+	MPI_Type_commit(type);
+}
+
 void reb_communication_mpi_init(struct reb_simulation* const r, int argc, char** argv){
+#ifdef OPENMP
+	// OpenMP threads work on the force and collision loops, but only the 
+	// thread which called reb_mpi_init() makes MPI calls.
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_size(MPI_COMM_WORLD,&(r->mpi_num));
+	MPI_Comm_rank(MPI_COMM_WORLD,&(r->mpi_id));
+	if (provided<MPI_THREAD_FUNNELED && r->mpi_id==0){
+		fprintf(stderr,"WARNING: MPI library does not support MPI_THREAD_FUNNELED. Running OpenMP threads together with MPI may not be safe.\n");
+	}
+#else // OPENMP
 	MPI_Init(&argc,&argv);
 	MPI_Comm_size(MPI_COMM_WORLD,&(r->mpi_num));
 	MPI_Comm_rank(MPI_COMM_WORLD,&(r->mpi_id));
+#endif // OPENMP
 	
 	
-	// Setup MPI description of the particle structure 
-	int bnum = 0;
-	int blen[5];
-	MPI_Aint indices[5];
-	MPI_Datatype oldtypes[5];
-    {
-        blen[bnum] 	= 12;
-        indices[bnum] 	= 0; 
-        oldtypes[bnum] 	= MPI_DOUBLE;
-    }
-	bnum++;
-    {
-        struct reb_particle p;
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= (char*)&p.c - (char*)&p; 
-        oldtypes[bnum] 	= MPI_CHAR;
-    }
-	bnum++;
-    {
-        struct reb_particle p;
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= (char*)&p.hash - (char*)&p; 
-        oldtypes[bnum] 	= MPI_INT; // hash is a uint32_t, but not all MPI headers seem to have MPI_UINT32_T
-    }
-	bnum++;
-    {
-        struct reb_particle p;
-        blen[bnum] 	= 2; 
-        indices[bnum] 	= (char*)&p.ap - (char*)&p; 
-        oldtypes[bnum] 	= MPI_CHAR;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= sizeof(struct reb_particle); 
-        oldtypes[bnum] 	= MPI_UB;
-    }
-	bnum++;
-	MPI_Type_struct(bnum, blen, indices, oldtypes, &(r->mpi_particle) );
-	MPI_Type_commit(&(r->mpi_particle)); 
-
-	// Setup MPI description of the cell structure 
+	// Setup MPI descriptions of the particle and cell structures.
+	// Only the fields the receiving node needs are transferred.
+	struct reb_particle p;
 	struct reb_treecell c;
-	bnum = 0;
-    {
-        blen[bnum] 	= 8; 
-#ifdef QUADRUPOLE
-        blen[bnum] 	+= 6;
-#endif // QUADRUPOLE
-        indices[bnum] 	= 0; 
-        oldtypes[bnum] 	= MPI_DOUBLE;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 8; 
-        indices[bnum] 	= (char*)&c.oct - (char*)&c; 
-        oldtypes[bnum] 	= MPI_CHAR;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= (char*)&c.pt - (char*)&c; 
-        oldtypes[bnum] 	= MPI_INT;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= sizeof(struct reb_treecell); 
-        oldtypes[bnum] 	= MPI_UB;
-    }
-	bnum++;
-	MPI_Type_struct(bnum, blen, indices, oldtypes, &(r->mpi_cell) );
-	MPI_Type_commit(&(r->mpi_cell)); 
+	{
+		int blen[] 				= {12, 1};
+		MPI_Aint indices[] 		= {0, (char*)&p.hash - (char*)&p};
+		MPI_Datatype types[] 	= {MPI_DOUBLE, MPI_INT}; // hash is a uint32_t, but not all MPI headers seem to have MPI_UINT32_T
+		reb_communication_mpi_type(2, blen, indices, types, sizeof(struct reb_particle), &(r->mpi_particle));
+	}
+	{
+		int blen[] 				= {6, 2};
+		MPI_Aint indices[] 		= {0, (char*)&p.m - (char*)&p};
+		MPI_Datatype types[] 	= {MPI_DOUBLE, MPI_DOUBLE};
+		reb_communication_mpi_type(2, blen, indices, types, sizeof(struct reb_particle), &(r->mpi_particle_essential));
+	}
+	{
+		// x, y, z, w
+		int blen[] 				= {4, 1};
+		MPI_Aint indices[] 		= {0, (char*)&c.pt - (char*)&c};
+		MPI_Datatype types[] 	= {MPI_DOUBLE, MPI_INT};
+		reb_communication_mpi_type(2, blen, indices, types, sizeof(struct reb_treecell), &(r->mpi_cell));
+	}
+	for (int order=0; order<3; order++){
+		// x, y, z, w, m, mx, my, mz, then 6 quadrupole and 10 octupole components.
+		const int moments[] 	= {8, 14, 24};
+		int blen[] 				= {moments[order], 1};
+		MPI_Aint indices[] 		= {0, (char*)&c.pt - (char*)&c};
+		MPI_Datatype types[] 	= {MPI_DOUBLE, MPI_INT};
+		reb_communication_mpi_type(2, blen, indices, types, sizeof(struct reb_treecell), &(r->mpi_cell_gravity[order]));
+	}
 	
 	// Prepare send/recv buffers for particles
 	r->particles_send   	= calloc(r->mpi_num,sizeof(struct reb_particle*));
@@ -132,7 +117,6 @@ void reb_communication_mpi_init(struct reb_simulation* const r, int argc, char**
 	r->particles_send_Nmax 	= calloc(r->mpi_num,sizeof(int));
 	r->particles_recv   	= calloc(r->mpi_num,sizeof(struct reb_particle*));
 	r->particles_recv_N 	= calloc(r->mpi_num,sizeof(int));
-	r->particles_recv_Nmax 	= calloc(r->mpi_num,sizeof(int));
 
 	// Prepare send/recv buffers for essential tree
 	r->tree_essential_send   	= calloc(r->mpi_num,sizeof(struct reb_treecell*));
@@ -140,75 +124,206 @@ void reb_communication_mpi_init(struct reb_simulation* const r, int argc, char**
 	r->tree_essential_send_Nmax = calloc(r->mpi_num,sizeof(int));
 	r->tree_essential_recv   	= calloc(r->mpi_num,sizeof(struct reb_treecell*));
 	r->tree_essential_recv_N 	= calloc(r->mpi_num,sizeof(int));
-	r->tree_essential_recv_Nmax = calloc(r->mpi_num,sizeof(int));
+
+	// Requests for pipelined communication
+	r->mpi_requests 		= malloc(4*r->mpi_num*sizeof(MPI_Request));
+	r->mpi_requests_pending	= calloc(r->mpi_num,sizeof(int));
 }
 
 int reb_communication_mpi_rootbox_is_local(struct reb_simulation* const r, int i){
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int proc_id = i/root_n_per_node;
-	if (proc_id != r->mpi_id){
+	if (r->mpi_root_owner == NULL){
+		// reb_mpi_init() has not been called. All particles are local (e.g. simulations in an ensemble).
+		return 1;
+	}
+	if (r->mpi_root_owner[i] != r->mpi_id){
 		return 0;
 	}else{
 		return 1;
 	}
 }
 
+int reb_communication_mpi_rootboxes_of_proc(struct reb_simulation* const r, int proc_id, int* roots){
+	int N = 0;
+	for (int i=0;i<r->root_n;i++){
+		if (r->mpi_root_owner[i]==proc_id){
+			roots[N++] = i;
+		}
+	}
+	return N;
+}
+
+// Position of a root box along a Morton (Z-order) curve.
+static uint64_t reb_communication_mpi_morton_key(struct reb_simulation* const r, int index){
+	uint64_t i = index%r->root_nx;
+	uint64_t j = (index/r->root_nx)%r->root_ny;
+	uint64_t k = index/(r->root_nx*r->root_ny);
+	uint64_t key = 0;
+	for (int b=0;b<21;b++){
+		key |= ((i>>b)&1)<<(3*b);
+		key |= ((j>>b)&1)<<(3*b+1);
+		key |= ((k>>b)&1)<<(3*b+2);
+	}
+	return key;
+}
 
-void reb_communication_mpi_distribute_particles(struct reb_simulation* const r){
-	// Distribute the number of particles to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->particles_send_N, 1, MPI_INT, &(r->particles_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
+struct reb_communication_mpi_root_key {
+	uint64_t key;
+	int index;
+};
+
+static int reb_communication_mpi_compare_root_key(const void* a, const void* b){
+	const struct reb_communication_mpi_root_key* ka = a;
+	const struct reb_communication_mpi_root_key* kb = b;
+	if (ka->key < kb->key) return -1;
+	if (ka->key > kb->key) return 1;
+	return 0;
+}
+
+void reb_communication_mpi_load_balance(struct reb_simulation* const r){
+	const int root_n = r->root_n;
+	const int num = r->mpi_num;
+	// The cost of a root box is the number of particles in it.
+	int cost_local[root_n];
+	int cost[root_n];
+	memset(cost_local, 0, sizeof(int)*root_n);
+	for (int i=0;i<r->N;i++){
+		cost_local[reb_get_rootbox_for_particle(r, r->particles[i])]++;
+	}
+	MPI_Allreduce(cost_local, cost, root_n, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	long cost_total = 0;
+	for (int i=0;i<root_n;i++){
+		cost_total += cost[i];
+	}
+	if (cost_total==0) return;
+
+	// Cut the space filling curve through all root boxes into segments of equal cost.
+	// Every node does the same calculation, so no communication is needed.
+	struct reb_communication_mpi_root_key keys[root_n];
+	for (int i=0;i<root_n;i++){
+		keys[i].key = reb_communication_mpi_morton_key(r, i);
+		keys[i].index = i;
+	}
+	qsort(keys, root_n, sizeof(struct reb_communication_mpi_root_key), reb_communication_mpi_compare_root_key);
+	int owner_new[root_n];
+	long cost_before = 0;
+	for (int k=0;k<root_n;k++){
+		const int i = keys[k].index;
+		int proc = (int)(((double)cost_before + 0.5*cost[i])*num/cost_total);
+		if (proc>=num) proc = num-1;
+		owner_new[i] = proc;
+		cost_before += cost[i];
 	}
-	// Allocate memory for incoming particles
-	for (int i=0;i<r->mpi_num;i++){
-		if  (i==r->mpi_id) continue;
-		while (r->particles_recv_Nmax[i]<r->particles_recv_N[i]){
-			r->particles_recv_Nmax[i] += 32;
-			r->particles_recv[i] = realloc(r->particles_recv[i],sizeof(struct reb_particle)*r->particles_recv_Nmax[i]);
+
+	// Send particles in root boxes which this node no longer owns.
+	// Particles are removed from the end so that the particle moved into 
+	// an empty slot is always one that stays.
+	for (int i=r->N-1;i>=0;i--){
+		const struct reb_particle p = r->particles[i];
+		const int proc = owner_new[reb_get_rootbox_for_particle(r, p)];
+		if (proc==r->mpi_id) continue;
+		reb_communication_mpi_add_particle_to_send_queue(r, p, proc);
+		r->N--;
+		reb_particle_lookup_table_unset(r, p.hash, i);
+		if (i!=r->N){
+			r->particles[i] = r->particles[r->N];
+			if (r->particles[i].c){
+				r->particles[i].c->pt = i;
+			}
+			reb_particle_lookup_table_set(r, r->particles[i].hash, i);
 		}
 	}
+	for (int i=0;i<root_n;i++){
+		if (r->tree_root){
+			if (r->mpi_root_owner[i]==r->mpi_id && owner_new[i]!=r->mpi_id){
+				reb_tree_delete_root(r, i);
+			}
+			if (owner_new[i]!=r->mpi_id){
+				// Essential trees are received again before they are used.
+				r->tree_root[i] = NULL;
+			}else if (r->mpi_root_owner[i]!=r->mpi_id){
+				// Remove essential tree of a root box which is now local.
+				r->tree_root[i] = NULL;
+			}
+		}
+		r->mpi_root_owner[i] = owner_new[i];
+	}
+}
 
-	// Exchange particles via MPI.
-	// Using non-blocking receive call.
-	MPI_Request request[r->mpi_num];
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Irecv(r->particles_recv[i], r->particles_recv_N[i], r->mpi_particle, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
+
+// Returns the datatype for essential cells for gravity which includes the moments up to tree_order.
+static MPI_Datatype reb_communication_mpi_cell_gravity(struct reb_simulation* const r){
+	const int order = r->tree_order<0?0:(r->tree_order>2?2:r->tree_order);
+	return r->mpi_cell_gravity[order];
+}
+
+// Grows a buffer geometrically so that it can hold at least N elements of the given size.
+static void* reb_communication_mpi_grow(void* buffer, int* Nmax, int N, size_t size){
+	if (*Nmax<N){
+		*Nmax = MAX(2*(*Nmax), MAX(N,32));
+		buffer = realloc(buffer, size*(*Nmax));
 	}
-	// Using blocking send call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_send_N[i]==0) continue;
-		MPI_Send(r->particles_send[i], r->particles_send_N[i], r->mpi_particle, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
+	return buffer;
+}
+
+// Exchanges the per-node send buffers with all other nodes using two collective calls.
+// Received elements are stored in one contiguous buffer. recv[i] points to the elements
+// received from node i. No barrier is needed, MPI_Alltoallv only returns once the local
+// buffers can be reused.
+static void reb_communication_mpi_alltoallv(struct reb_simulation* const r, MPI_Datatype type, size_t size, void* const* send, int* send_N, int* recv_N, void** recv_buffer, int* recv_Nmax, void** recv){
+	const int num = r->mpi_num;
+	send_N[r->mpi_id] = 0;
+	MPI_Alltoall(send_N, 1, MPI_INT, recv_N, 1, MPI_INT, MPI_COMM_WORLD);
+	
+	int send_displ[num];
+	int recv_displ[num];
+	int send_total = 0;
+	int recv_total = 0;
+	for (int i=0;i<num;i++){
+		send_displ[i] = send_total;
+		recv_displ[i] = recv_total;
+		send_total += send_N[i];
+		recv_total += recv_N[i];
+	}
+
+	// Pack send buffers
+	r->mpi_send_buffer = reb_communication_mpi_grow(r->mpi_send_buffer, &r->mpi_send_buffer_Nmax, send_total*size, 1);
+	for (int i=0;i<num;i++){
+		if (send_N[i]){
+			memcpy(r->mpi_send_buffer+size*send_displ[i], send[i], size*send_N[i]);
+		}
+	}
+
+	*recv_buffer = reb_communication_mpi_grow(*recv_buffer, recv_Nmax, recv_total, size);
+	for (int i=0;i<num;i++){
+		recv[i] = (char*)(*recv_buffer) + size*recv_displ[i];
 	}
-	// Wait for all particles to be received.
+
+	MPI_Alltoallv(r->mpi_send_buffer, send_N, send_displ, type, *recv_buffer, recv_N, recv_displ, type, MPI_COMM_WORLD);
+}
+
+void reb_communication_mpi_distribute_particles(struct reb_simulation* const r){
+	reb_communication_mpi_alltoallv(r, r->mpi_particle, sizeof(struct reb_particle), (void* const*)r->particles_send, r->particles_send_N, r->particles_recv_N, (void**)&r->particles_recv_buffer, &r->particles_recv_Nmax, (void**)r->particles_recv);
+	// Clean up before adding particles to local tree. 
+	// Particles which need to be send on to another node are queued for the next call.
 	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
+		r->particles_send_N[i] = 0;
 	}
-	// Add particles to local tree
 	for (int i=0;i<r->mpi_num;i++){
 		for (int j=0;j<r->particles_recv_N[i];j++){
+			// Pointers are not transferred.
+			r->particles_recv[i][j].c = NULL;
+			r->particles_recv[i][j].ap = NULL;
 			reb_add(r,r->particles_recv[i][j]);
 		}
 	}
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
 	for (int i=0;i<r->mpi_num;i++){
-		r->particles_send_N[i] = 0;
 		r->particles_recv_N[i] = 0;
 	}
 }
 
 void reb_communication_mpi_add_particle_to_send_queue(struct reb_simulation* const r, struct reb_particle pt, int proc_id){
 	int send_N = r->particles_send_N[proc_id];
-	while (r->particles_send_Nmax[proc_id] <= send_N){
-		r->particles_send_Nmax[proc_id] += 128;
-		r->particles_send[proc_id] = realloc(r->particles_send[proc_id],sizeof(struct reb_particle)*r->particles_send_Nmax[proc_id]);
-	}
+	r->particles_send[proc_id] = reb_communication_mpi_grow(r->particles_send[proc_id], &(r->particles_send_Nmax[proc_id]), send_N+1, sizeof(struct reb_particle));
 	r->particles_send[proc_id][send_N] = pt;
 	r->particles_send_N[proc_id]++;
 }
@@ -240,23 +355,6 @@ struct reb_aabb communication_boundingbox_for_root(struct reb_simulation* const
 	return boundingbox;
 }
 
-struct reb_aabb reb_communication_boundingbox_for_proc(struct reb_simulation* const r, int proc_id){
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int root_start = proc_id*root_n_per_node;
-	int root_stop  = (proc_id+1)*root_n_per_node;
-	struct reb_aabb boundingbox = communication_boundingbox_for_root(r, root_start);
-	for (int i=root_start+1;i<root_stop;i++){
-		struct reb_aabb boundingbox2 = communication_boundingbox_for_root(r,i);
-		if (boundingbox.xmin > boundingbox2.xmin) boundingbox.xmin = boundingbox2.xmin;
-		if (boundingbox.ymin > boundingbox2.ymin) boundingbox.ymin = boundingbox2.ymin;
-		if (boundingbox.zmin > boundingbox2.zmin) boundingbox.zmin = boundingbox2.zmin;
-		if (boundingbox.xmax < boundingbox2.xmax) boundingbox.xmax = boundingbox2.xmax;
-		if (boundingbox.ymax < boundingbox2.ymax) boundingbox.ymax = boundingbox2.ymax;
-		if (boundingbox.zmax < boundingbox2.zmax) boundingbox.zmax = boundingbox2.zmax;
-	}
-	return boundingbox;
-}
-
 double reb_communication_distance2_of_aabb_to_cell(struct reb_aabb bb, struct reb_treecell* node){
 	double distancex = fabs(node->x - (bb.xmin+bb.xmax)/2.)  -  (node->w + bb.xmax-bb.xmin)/2.;
 	double distancey = fabs(node->y - (bb.ymin+bb.ymax)/2.)  -  (node->w + bb.ymax-bb.ymin)/2.;
@@ -277,16 +375,20 @@ double reb_communication_distance2_of_proc_to_node(struct reb_simulation* const
 	for (int gby=-nghostycol; gby<=nghostycol; gby++){
 	for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
 		struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
-		struct reb_aabb boundingbox = reb_communication_boundingbox_for_proc(r, proc_id);
-		boundingbox.xmin+=gb.shiftx;
-		boundingbox.xmax+=gb.shiftx;
-		boundingbox.ymin+=gb.shifty;
-		boundingbox.ymax+=gb.shifty;
-		boundingbox.zmin+=gb.shiftz;
-		boundingbox.zmax+=gb.shiftz;
-		// calculate distance
-		double distance2new = reb_communication_distance2_of_aabb_to_cell(boundingbox,node);
-		if (distance2 > distance2new) distance2 = distance2new;
+		// Root boxes of a node are not necessarily adjacent. Use the nearest one.
+		for (int i=0;i<r->root_n;i++){
+			if (r->mpi_root_owner[i]!=proc_id) continue;
+			struct reb_aabb boundingbox = communication_boundingbox_for_root(r, i);
+			boundingbox.xmin+=gb.shiftx;
+			boundingbox.xmax+=gb.shiftx;
+			boundingbox.ymin+=gb.shifty;
+			boundingbox.ymax+=gb.shifty;
+			boundingbox.zmin+=gb.shiftz;
+			boundingbox.zmax+=gb.shiftz;
+			// calculate distance
+			double distance2new = reb_communication_distance2_of_aabb_to_cell(boundingbox,node);
+			if (distance2 > distance2new) distance2 = distance2new;
+		}
 	}
 	}
 	}
@@ -295,19 +397,13 @@ double reb_communication_distance2_of_proc_to_node(struct reb_simulation* const
 
 void reb_communication_mpi_prepare_essential_cell_for_collisions_for_proc(struct reb_simulation* const r, struct reb_treecell* node, int proc){
 	// Add essential cell to tree_essential_send
-	if (r->tree_essential_send_N[proc]>=r->tree_essential_send_Nmax[proc]){
-		r->tree_essential_send_Nmax[proc] += 32;
-		r->tree_essential_send[proc] = realloc(r->tree_essential_send[proc],sizeof(struct reb_treecell)*r->tree_essential_send_Nmax[proc]);
-	}
+	r->tree_essential_send[proc] = reb_communication_mpi_grow(r->tree_essential_send[proc], &(r->tree_essential_send_Nmax[proc]), r->tree_essential_send_N[proc]+1, sizeof(struct reb_treecell));
 	// Copy node to send buffer
 	r->tree_essential_send[proc][r->tree_essential_send_N[proc]] = (*node);
 	r->tree_essential_send_N[proc]++;
 	if (node->pt>=0){ // Is leaf
 		// Also transmit particle (Here could be another check if the particle actually overlaps with the other box)
-		if (r->particles_send_N[proc]>=r->particles_send_Nmax[proc]){
-			r->particles_send_Nmax[proc] += 32;
-			r->particles_send[proc] = realloc(r->particles_send[proc],sizeof(struct reb_treecell)*r->particles_send_Nmax[proc]);
-		}
+		r->particles_send[proc] = reb_communication_mpi_grow(r->particles_send[proc], &(r->particles_send_Nmax[proc]), r->particles_send_N[proc]+1, sizeof(struct reb_particle));
 		// Copy particle to send buffer
 		r->particles_send[proc][r->particles_send_N[proc]] = r->particles[node->pt];
 		// Update reference from cell to particle
@@ -337,12 +433,14 @@ void reb_communication_mpi_prepare_essential_tree_for_collisions(struct reb_simu
 
 void reb_communication_mpi_prepare_essential_cell_for_gravity_for_proc(struct reb_simulation* const r, struct reb_treecell* node, int proc){
 	// Add essential cell to tree_essential_send
-	if (r->tree_essential_send_N[proc]>=r->tree_essential_send_Nmax[proc]){
-		r->tree_essential_send_Nmax[proc] += 32;
-		r->tree_essential_send[proc] = realloc(r->tree_essential_send[proc],sizeof(struct reb_treecell)*r->tree_essential_send_Nmax[proc]);
-	}
+	r->tree_essential_send[proc] = reb_communication_mpi_grow(r->tree_essential_send[proc], &(r->tree_essential_send_Nmax[proc]), r->tree_essential_send_N[proc]+1, sizeof(struct reb_treecell));
 	// Copy node to send buffer
 	r->tree_essential_send[proc][r->tree_essential_send_N[proc]] = (*node);
+	if (node->pt>=0){
+		// Leaves only mark that the cell is a single particle. The index 
+		// must not match a particle on the receiving node.
+		r->tree_essential_send[proc][r->tree_essential_send_N[proc]].pt = INT_MAX;
+	}
 	r->tree_essential_send_N[proc]++;
 	if (node->pt<0){		// Not a leaf. Check if we need to transfer daughters.
 		double width = node->w;
@@ -371,50 +469,14 @@ void reb_communication_mpi_distribute_essential_tree_for_gravity(struct reb_simu
 	///////////////////////////////////////////////////////////////
 	// Distribute essential tree needed for gravity and collisions
 	///////////////////////////////////////////////////////////////
-	
-	// Distribute the number of cells to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->tree_essential_send_N, 1, MPI_INT, &(r->tree_essential_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
-	}
-	// Allocate memory for incoming tree_essential
-	for (int i=0;i<r->mpi_num;i++){
-		if  (i==r->mpi_id) continue;
-		while (r->tree_essential_recv_Nmax[i]<r->tree_essential_recv_N[i]){
-			r->tree_essential_recv_Nmax[i] += 32;
-			r->tree_essential_recv[i] = realloc(r->tree_essential_recv[i],sizeof(struct reb_treecell)*r->tree_essential_recv_Nmax[i]);
-		}
-	}
-	
-	// Exchange tree_essential via MPI.
-	// Using non-blocking receive call.
-	MPI_Request request[r->mpi_num];
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Irecv(r->tree_essential_recv[i], r->tree_essential_recv_N[i], r->mpi_cell, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
-	}
-	// Using blocking send call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_send_N[i]==0) continue;
-		MPI_Send(r->tree_essential_send[i], r->tree_essential_send_N[i], r->mpi_cell, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
-	}
-	// Wait for all tree_essential to be received.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
-	}
+	reb_communication_mpi_alltoallv(r, reb_communication_mpi_cell_gravity(r), sizeof(struct reb_treecell), (void* const*)r->tree_essential_send, r->tree_essential_send_N, r->tree_essential_recv_N, (void**)&r->tree_essential_recv_buffer, &r->tree_essential_recv_Nmax, (void**)r->tree_essential_recv);
 	// Add tree_essential to local tree
 	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
 		for (int j=0;j<r->tree_essential_recv_N[i];j++){
 			reb_tree_add_essential_node(r, &(r->tree_essential_recv[i][j]));
 		}
 	}
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
+	// Clean up. 
 	for (int i=0;i<r->mpi_num;i++){
 		r->tree_essential_send_N[i] = 0;
 		r->tree_essential_recv_N[i] = 0;
@@ -425,49 +487,14 @@ void reb_communication_mpi_distribute_essential_tree_for_collisions(struct reb_s
 	///////////////////////////////////////////////////////////////
 	// Distribute essential tree needed for gravity and collisions
 	///////////////////////////////////////////////////////////////
-	
-	// Distribute the number of cells to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->tree_essential_send_N, 1, MPI_INT, &(r->tree_essential_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
-	}
-	// Allocate memory for incoming tree_essential
-	for (int i=0;i<r->mpi_num;i++){
-		if  (i==r->mpi_id) continue;
-		while (r->tree_essential_recv_Nmax[i]<r->tree_essential_recv_N[i]){
-			r->tree_essential_recv_Nmax[i] += 32;
-			r->tree_essential_recv[i] = realloc(r->tree_essential_recv[i],sizeof(struct reb_treecell)*r->tree_essential_recv_Nmax[i]);
-		}
-	}
-
-	// Exchange tree_essential via MPI.
-	// Using non-blocking receive call.
-	MPI_Request request[r->mpi_num];
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Irecv(r->tree_essential_recv[i], r->tree_essential_recv_N[i], r->mpi_cell, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
-	}
-	// Using blocking send call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_send_N[i]==0) continue;
-		MPI_Send(r->tree_essential_send[i], r->tree_essential_send_N[i], r->mpi_cell, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
-	}
-	// Wait for all tree_essential to be received.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
-	}
+	reb_communication_mpi_alltoallv(r, r->mpi_cell, sizeof(struct reb_treecell), (void* const*)r->tree_essential_send, r->tree_essential_send_N, r->tree_essential_recv_N, (void**)&r->tree_essential_recv_buffer, &r->tree_essential_recv_Nmax, (void**)r->tree_essential_recv);
 	// Add tree_essential to local tree
 	for (int i=0;i<r->mpi_num;i++){
 		for (int j=0;j<r->tree_essential_recv_N[i];j++){
 			reb_tree_add_essential_node(r, &(r->tree_essential_recv[i][j]));
 		}
 	}
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
+	// Clean up. 
 	for (int i=0;i<r->mpi_num;i++){
 		r->tree_essential_send_N[i] = 0;
 		r->tree_essential_recv_N[i] = 0;
@@ -476,48 +503,104 @@ void reb_communication_mpi_distribute_essential_tree_for_collisions(struct reb_s
 	//////////////////////////////////////////////////////
 	// Distribute particles needed for collisiosn search 
 	//////////////////////////////////////////////////////
-	
-	// Distribute the number of particles to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->particles_send_N, 1, MPI_INT, &(r->particles_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
-	}
-	// Allocate memory for incoming particles
-	for (int i=0;i<r->mpi_num;i++){
-		if  (i==r->mpi_id) continue;
-		while (r->particles_recv_Nmax[i]<r->particles_recv_N[i]){
-			r->particles_recv_Nmax[i] += 32;
-			r->particles_recv[i] = realloc(r->particles_recv[i],sizeof(struct reb_particle)*r->particles_recv_Nmax[i]);
-		}
-	}
-	
-	// Exchange particles via MPI.
-	// Using non-blocking receive call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Irecv(r->particles_recv[i], r->particles_recv_N[i], r->mpi_particle, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
-	}
-	// Using blocking send call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_send_N[i]==0) continue;
-		MPI_Send(r->particles_send[i], r->particles_send_N[i], r->mpi_particle, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
-	}
-	// Wait for all particles to be received.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
-	}
+	reb_communication_mpi_alltoallv(r, r->mpi_particle_essential, sizeof(struct reb_particle), (void* const*)r->particles_send, r->particles_send_N, r->particles_recv_N, (void**)&r->particles_recv_buffer, &r->particles_recv_Nmax, (void**)r->particles_recv);
 	// No need to add particles to tree as reference already set.
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
+	// Clean up. 
 	for (int i=0;i<r->mpi_num;i++){
 		r->particles_send_N[i] = 0;
 		r->particles_recv_N[i] = 0;
 	}
 }
 
+void reb_communication_mpi_start_essential_tree(struct reb_simulation* const r, int with_particles){
+	const int num = r->mpi_num;
+	r->tree_essential_send_N[r->mpi_id] = 0;
+	r->particles_send_N[r->mpi_id] = 0;
+	// Exchange the number of cells and particles in one call.
+	int send_N[2*num];
+	int recv_N[2*num];
+	for (int i=0;i<num;i++){
+		send_N[2*i]   = r->tree_essential_send_N[i];
+		send_N[2*i+1] = with_particles?r->particles_send_N[i]:0;
+	}
+	MPI_Alltoall(send_N, 2, MPI_INT, recv_N, 2, MPI_INT, MPI_COMM_WORLD);
+
+	int cells_total = 0;
+	int particles_total = 0;
+	for (int i=0;i<num;i++){
+		r->tree_essential_recv_N[i] = recv_N[2*i];
+		r->particles_recv_N[i] = recv_N[2*i+1];
+		cells_total += recv_N[2*i];
+		particles_total += recv_N[2*i+1];
+	}
+	r->tree_essential_recv_buffer = reb_communication_mpi_grow(r->tree_essential_recv_buffer, &r->tree_essential_recv_Nmax, cells_total, sizeof(struct reb_treecell));
+	r->particles_recv_buffer = reb_communication_mpi_grow(r->particles_recv_buffer, &r->particles_recv_Nmax, particles_total, sizeof(struct reb_particle));
+
+	// Post all receives and sends. Requests 0 to 2*num-1 are receives, the rest are sends.
+	MPI_Request* const requests = r->mpi_requests;
+	const MPI_Datatype cell_type = with_particles?r->mpi_cell:reb_communication_mpi_cell_gravity(r);
+	for (int k=0;k<4*num;k++){
+		requests[k] = MPI_REQUEST_NULL;
+	}
+	cells_total = 0;
+	particles_total = 0;
+	for (int i=0;i<num;i++){
+		r->tree_essential_recv[i] = r->tree_essential_recv_buffer + cells_total;
+		r->particles_recv[i] = r->particles_recv_buffer + particles_total;
+		cells_total += r->tree_essential_recv_N[i];
+		particles_total += r->particles_recv_N[i];
+		r->mpi_requests_pending[i] = 0;
+		if (r->tree_essential_recv_N[i]){
+			MPI_Irecv(r->tree_essential_recv[i], r->tree_essential_recv_N[i], cell_type, i, 0, MPI_COMM_WORLD, &requests[2*i]);
+			r->mpi_requests_pending[i]++;
+		}
+		if (r->particles_recv_N[i]){
+			MPI_Irecv(r->particles_recv[i], r->particles_recv_N[i], r->mpi_particle_essential, i, 1, MPI_COMM_WORLD, &requests[2*i+1]);
+			r->mpi_requests_pending[i]++;
+		}
+		if (r->tree_essential_send_N[i]){
+			MPI_Isend(r->tree_essential_send[i], r->tree_essential_send_N[i], cell_type, i, 0, MPI_COMM_WORLD, &requests[2*num+2*i]);
+		}
+		if (send_N[2*i+1]){
+			MPI_Isend(r->particles_send[i], r->particles_send_N[i], r->mpi_particle_essential, i, 1, MPI_COMM_WORLD, &requests[2*num+2*i+1]);
+		}
+	}
+}
+
+void reb_communication_mpi_progress(struct reb_simulation* const r){
+	// Many MPI libraries only move data of non-blocking calls forward while 
+	// an MPI function is being called. MPI_Iprobe does not change any requests.
+	int flag;
+	MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+}
+
+int reb_communication_mpi_wait_essential_tree(struct reb_simulation* const r, int with_particles){
+	const int num = r->mpi_num;
+	while(1){
+		int index;
+		MPI_Waitany(2*num, r->mpi_requests, &index, MPI_STATUS_IGNORE);
+		if (index==MPI_UNDEFINED){
+			// All data received. Wait for sends to complete before buffers are reused.
+			MPI_Waitall(2*num, r->mpi_requests+2*num, MPI_STATUSES_IGNORE);
+			for (int i=0;i<num;i++){
+				r->tree_essential_send_N[i] = 0;
+				r->tree_essential_recv_N[i] = 0;
+				if (with_particles){
+					r->particles_send_N[i] = 0;
+					r->particles_recv_N[i] = 0;
+				}
+			}
+			return -1;
+		}
+		const int proc = index/2;
+		r->mpi_requests_pending[proc]--;
+		if (r->mpi_requests_pending[proc]==0){
+			for (int j=0;j<r->tree_essential_recv_N[proc];j++){
+				reb_tree_add_essential_node(r, &(r->tree_essential_recv[proc][j]));
+			}
+			return proc;
+		}
+	}
+}
 
 #endif // MPI
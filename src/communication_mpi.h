@@ -80,6 +80,23 @@ void reb_communication_mpi_add_particle_to_send_queue(struct reb_simulation* con
  */ 
 int  reb_communication_mpi_rootbox_is_local(struct reb_simulation* const r, int i);
 
+/**
+ * Finds all root boxes owned by a node.
+ * @param proc_id Id of the node.
+ * @param roots Array of length root_n. The indices of the root boxes are stored here.
+ * @return Number of root boxes owned by the node.
+ */
+int  reb_communication_mpi_rootboxes_of_proc(struct reb_simulation* const r, int proc_id, int* roots);
+
+/**
+ * Reassigns root boxes to nodes so that every node has a similar number of particles.
+ * Root boxes are ordered along a Morton curve, which is cut into one segment per node.
+ * Particles in root boxes which move to another node are placed in the send queue 
+ * and sent with the next call of reb_communication_mpi_distribute_particles().
+ * Needs to be called by all nodes at the same time.
+ */
+void reb_communication_mpi_load_balance(struct reb_simulation* const r);
+
 /**
  * Send cells in buffer tree_essential_send to corresponding node. 
  * Receives cells from all nodes in buffer tree_essential_recv and adds them
@@ -107,6 +124,27 @@ void reb_communication_mpi_distribute_essential_tree_for_collisions(struct reb_s
  */
 void reb_communication_mpi_prepare_essential_tree_for_collisions(struct reb_simulation* const r, struct reb_treecell* root);
 
+/**
+ * Starts the non-blocking exchange of the cells/particles in tree_essential_send and
+ * particles_send. Used if mpi_pipeline is enabled. Call reb_communication_mpi_wait_essential_tree() 
+ * until it returns -1 to complete the exchange. Send buffers must not be modified in between.
+ * @param with_particles If 0, the particle send buffers are ignored (gravity). If 1, particles are also exchanged (collisions).
+ */
+void reb_communication_mpi_start_essential_tree(struct reb_simulation* const r, int with_particles);
+
+/**
+ * Lets the MPI library make progress on the communication started by 
+ * reb_communication_mpi_start_essential_tree() without waiting for it.
+ * Only call this from the thread which called reb_mpi_init().
+ */
+void reb_communication_mpi_progress(struct reb_simulation* const r);
+
+/**
+ * Waits until all cells/particles from one node have arrived and adds the cells to the local tree.
+ * @param with_particles Needs to be the same as in reb_communication_mpi_start_essential_tree().
+ * @return The id of the node whose data has arrived, or -1 if all data has arrived.
+ */
+int reb_communication_mpi_wait_essential_tree(struct reb_simulation* const r, int with_particles);
 
 #endif // MPI
 #endif // _COMMUNICATION_MPI_H
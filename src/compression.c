@@ -0,0 +1,240 @@
+/**
+ * @file    compression.c
+ * @brief   Lossless compression of binary snapshots.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details The data is first byte-shuffled: bytes of equal significance
+ * of consecutive 8 byte words (mostly doubles) are grouped together.
+ * Sign, exponent and leading mantissa bytes of similar numbers then
+ * form long repetitive runs. The shuffled data is compressed with a
+ * simple LZ77 scheme. The compression level only determines how hard
+ * the compressor searches for matches. All levels use the same format.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "compression.h"
+
+#define REB_COMPRESSION_HASH_BITS 16    ///< Size of the hash table used to find matches
+#define REB_COMPRESSION_MIN_MATCH 4     ///< Shortest match which is encoded
+
+// Format of the compressed data:
+//  uint64_t         size of the uncompressed data
+//  sequence[]       until the uncompressed size is reached
+// Each sequence consists of
+//  varint           number of literals
+//  char[]           literals
+//  varint           length of match (0 only for the last sequence)
+//  varint           distance of match (only if length>0)
+
+static void reb_compression_shuffle(const unsigned char* in, unsigned char* out, const size_t size){
+    const size_t n = size/8;
+    for (size_t i=0;i<n;i++){
+        for (int b=0;b<8;b++){
+            out[b*n+i] = in[8*i+b];
+        }
+    }
+    memcpy(out+8*n, in+8*n, size-8*n);
+}
+
+static void reb_compression_unshuffle(const unsigned char* in, unsigned char* out, const size_t size){
+    const size_t n = size/8;
+    for (size_t i=0;i<n;i++){
+        for (int b=0;b<8;b++){
+            out[8*i+b] = in[b*n+i];
+        }
+    }
+    memcpy(out+8*n, in+8*n, size-8*n);
+}
+
+static unsigned char* reb_compression_put_varint(unsigned char* p, uint64_t v){
+    while (v>=128){
+        *p++ = (unsigned char)(v|128);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+static int reb_compression_varint_size(uint64_t v){
+    int s = 1;
+    while (v>=128){
+        v >>= 7;
+        s++;
+    }
+    return s;
+}
+
+// Returns NULL if the varint extends beyond end.
+static const unsigned char* reb_compression_get_varint(const unsigned char* p, const unsigned char* end, uint64_t* v){
+    *v = 0;
+    for (int shift=0; p<end && shift<64; shift+=7){
+        const unsigned char c = *p++;
+        *v |= (uint64_t)(c&127) << shift;
+        if (c<128){
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t reb_compression_hash(const unsigned char* p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return (v*2654435761u) >> (32-REB_COMPRESSION_HASH_BITS);
+}
+
+void reb_compress(const char* buf, const size_t size, int level, char** bufp, size_t* sizep){
+    if (level<1) level = 1;
+    if (level>9) level = 9;
+    const int max_depth = 1<<(level-1);
+
+    unsigned char* in = malloc(size);
+    reb_compression_shuffle((const unsigned char*)buf, in, size);
+
+    // Matches are only used if they are shorter to encode than the literals.
+    // The output can therefore only grow by the length of the varints.
+    unsigned char* const out = malloc(sizeof(uint64_t) + size + size/64 + 32);
+    const uint64_t size64 = size;
+    memcpy(out, &size64, sizeof(uint64_t));
+    unsigned char* op = out + sizeof(uint64_t);
+
+    int64_t* head = malloc(sizeof(int64_t)<<REB_COMPRESSION_HASH_BITS);
+    for (size_t i=0;i<((size_t)1<<REB_COMPRESSION_HASH_BITS);i++){
+        head[i] = -1;
+    }
+    int64_t* prev = NULL;
+    if (max_depth>1){
+        prev = malloc(sizeof(int64_t)*(size?size:1));
+    }
+
+    size_t literal_start = 0;
+    size_t i = 0;
+    while (i+REB_COMPRESSION_MIN_MATCH<=size){
+        const uint32_t h = reb_compression_hash(in+i);
+        size_t best_len = 0;
+        size_t best_dist = 0;
+        int64_t candidate = head[h];
+        for (int depth=0; depth<max_depth && candidate>=0; depth++){
+            const size_t c = candidate;
+            size_t len = 0;
+            while (i+len<size && in[c+len]==in[i+len]){
+                len++;
+            }
+            if (len>best_len){
+                best_len = len;
+                best_dist = i-c;
+            }
+            candidate = prev?prev[c]:-1;
+        }
+        if (prev){
+            prev[i] = head[h];
+        }
+        head[h] = i;
+        // Only use matches which are shorter to encode than the literals
+        if (best_len>=REB_COMPRESSION_MIN_MATCH && best_len > (size_t)(reb_compression_varint_size(best_len)+reb_compression_varint_size(best_dist))){
+            op = reb_compression_put_varint(op, i-literal_start);
+            memcpy(op, in+literal_start, i-literal_start);
+            op += i-literal_start;
+            op = reb_compression_put_varint(op, best_len);
+            op = reb_compression_put_varint(op, best_dist);
+            // Insert the positions covered by the match into the hash table.
+            const size_t end = i+best_len;
+            for (i=i+1; i<end; i++){
+                if (i+REB_COMPRESSION_MIN_MATCH<=size){
+                    const uint32_t h2 = reb_compression_hash(in+i);
+                    if (prev){
+                        prev[i] = head[h2];
+                    }
+                    head[h2] = i;
+                }
+            }
+            literal_start = i;
+        }else{
+            i++;
+        }
+    }
+    op = reb_compression_put_varint(op, size-literal_start);
+    memcpy(op, in+literal_start, size-literal_start);
+    op += size-literal_start;
+    op = reb_compression_put_varint(op, 0);
+
+    free(prev);
+    free(head);
+    free(in);
+    *bufp = (char*)out;
+    *sizep = op-out;
+}
+
+int reb_decompress(const char* buf, const size_t size, char** bufp, size_t* sizep){
+    const unsigned char* p = (const unsigned char*)buf;
+    const unsigned char* const end = p+size;
+    if (size<sizeof(uint64_t)){
+        return 1;
+    }
+    uint64_t size_out;
+    memcpy(&size_out, p, sizeof(uint64_t));
+    p += sizeof(uint64_t);
+    unsigned char* out = malloc(size_out?size_out:1);
+    if (out==NULL){ // Corrupted size
+        return 1;
+    }
+    size_t o = 0;
+    while (o<size_out){
+        uint64_t n_literals, len, dist;
+        p = reb_compression_get_varint(p, end, &n_literals);
+        if (p==NULL || n_literals > (uint64_t)(end-p) || n_literals > size_out-o){
+            free(out);
+            return 1;
+        }
+        memcpy(out+o, p, n_literals);
+        p += n_literals;
+        o += n_literals;
+        p = reb_compression_get_varint(p, end, &len);
+        if (p==NULL || len > size_out-o){
+            free(out);
+            return 1;
+        }
+        if (len==0){
+            break;
+        }
+        p = reb_compression_get_varint(p, end, &dist);
+        if (p==NULL || dist==0 || dist>o){
+            free(out);
+            return 1;
+        }
+        // Matches may overlap with the data being written.
+        for (uint64_t k=0;k<len;k++){
+            out[o+k] = out[o-dist+k];
+        }
+        o += len;
+    }
+    if (o!=size_out){
+        free(out);
+        return 1;
+    }
+    unsigned char* unshuffled = malloc(size_out?size_out:1);
+    reb_compression_unshuffle(out, unshuffled, size_out);
+    free(out);
+    *bufp = (char*)unshuffled;
+    *sizep = size_out;
+    return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file    compression.h
+ * @brief   Lossless compression of binary snapshots.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * 
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _COMPRESSION_H
+#define _COMPRESSION_H
+#include <stddef.h>
+
+/**
+ * @brief Compresses size bytes of buf with the given level (1=fastest, 9=smallest).
+ * @details The compressed data is stored in a newly allocated buffer *bufp of size *sizep.
+ */
+void reb_compress(const char* buf, const size_t size, int level, char** bufp, size_t* sizep);
+
+/**
+ * @brief Decompresses data created with reb_compress().
+ * @details The result is stored in a newly allocated buffer *bufp of size *sizep.
+ * @return 0 on success, 1 if the data is corrupted. Nothing is allocated in the latter case.
+ */
+int reb_decompress(const char* buf, const size_t size, char** bufp, size_t* sizep);
+#endif // _COMPRESSION_H
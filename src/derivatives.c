@@ -32,36 +32,97 @@
 #include "tools.h"
 #include "derivatives.h"
 
-
-
-struct reb_particle reb_derivatives_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+/**
+ * @brief Quantities shared by all derivatives of one orbit.
+ * @details The Pal coordinates and the classical orbital elements are only
+ * calculated when a derivative requires them, and at most once per orbit.
+ */
+struct reb_derivatives_context {
+    double G;
+    struct reb_particle primary;
+    struct reb_particle po;
+    int pal;                        // 1 if the Pal terms below have been calculated
+    double a, lambda, k, h, ix, iy; // Pal coordinates
+    double p, q;                    // Solution of Kepler's equation in Pal coordinates
+    double slp, clp;                // sin(lambda+p), cos(lambda+p)
+    double l;                       // 1-sqrt(1-h^2-k^2)
+    double iz;                      // sqrt(|4-ix^2-iy^2|)
+    int orbit;                      // 1 if the classical terms below have been calculated
+    struct reb_orbit o;
+    double cO, sO, co, so, cf, sf, ci, si; // Cosines and sines of Omega, omega, f, inc
+};
+
+static struct reb_derivatives_context reb_derivatives_context_new(double G, struct reb_particle primary, struct reb_particle po){
+    struct reb_derivatives_context c = {0};
+    c.G = G;
+    c.primary = primary;
+    c.po = po;
+    return c;
+}
+
+static void reb_derivatives_context_pal(struct reb_derivatives_context* const c){
+    if (c->pal){
+        return;
+    }
+    reb_tools_particle_to_pal(c->G, c->po, c->primary, &c->a, &c->lambda, &c->k, &c->h, &c->ix, &c->iy);
+    c->p = 0.;
+    c->q = 0.;
+    reb_tools_solve_kepler_pal(c->h, c->k, c->lambda, &c->p, &c->q);
+    c->slp = sin(c->lambda+c->p);
+    c->clp = cos(c->lambda+c->p);
+    c->l = 1.-sqrt(1.-c->h*c->h-c->k*c->k);
+    c->iz = sqrt(fabs(4.-c->ix*c->ix-c->iy*c->iy));
+    c->pal = 1;
+}
+
+static void reb_derivatives_context_orbit(struct reb_derivatives_context* const c){
+    if (c->orbit){
+        return;
+    }
+    c->o = reb_tools_particle_to_orbit(c->G, c->po, c->primary);
+    c->cO = cos(c->o.Omega);
+    c->sO = sin(c->o.Omega);
+    c->co = cos(c->o.omega);
+    c->so = sin(c->o.omega);
+    c->cf = cos(c->o.f);
+    c->sf = sin(c->o.f);
+    c->ci = cos(c->o.inc);
+    c->si = sin(c->o.inc);
+    c->orbit = 1;
+}
+
+static struct reb_particle reb_derivatives_lambda_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dxi_dlambda = a*(dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dlambda = a*(dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dlambda = deta_dlambda*ix-dxi_dlambda*iy;
 
     np.x = dxi_dlambda+0.5*iy*dW_dlambda;
     np.y = deta_dlambda-0.5*ix*dW_dlambda;
     np.z = 0.5*iz*dW_dlambda;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dlambda  = an/((1.-q)*(1.-q))*dq_dlambda*(-slp+q/(2.-l)*h)
     + an/(1.-q)*(-dslp_dlambda+dq_dlambda/(2.-l)*h);
     double ddeta_dlambda = an/((1.-q)*(1.-q))*dq_dlambda*(+clp-q/(2.-l)*k)
@@ -74,26 +135,30 @@ struct reb_particle reb_derivatives_lambda(double G, struct reb_particle primary
     return np;
 }
 
-struct reb_particle reb_derivatives_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_h_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dh = a*(dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dh = a*(dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dh = deta_dh*ix-dxi_dh*iy;
 
     np.x = dxi_dh+0.5*iy*dW_dh;
@@ -102,7 +167,7 @@ struct reb_particle reb_derivatives_h(double G, struct reb_particle primary, str
 
     double dq_dh = 1./(1.-q)*(slp-h);
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dh  = dq_dh*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + an/(1.-q) * (-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l));
     double ddeta_dh = dq_dh*an/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -116,26 +181,30 @@ struct reb_particle reb_derivatives_h(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_k_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dk = a*(dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dk = a*(dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dk = deta_dk*ix-dxi_dk*iy;
 
     np.x = dxi_dk+0.5*iy*dW_dk;
@@ -144,7 +213,7 @@ struct reb_particle reb_derivatives_k(double G, struct reb_particle primary, str
 
     double dq_dk = 1./(1.-q)*(clp-k);
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dk  = dq_dk*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + an/(1.-q) * (-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h);
     double ddeta_dk = dq_dk*an/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -158,20 +227,24 @@ struct reb_particle reb_derivatives_k(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_k_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_k_k_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
     double dl_dkk = 1./sqrt(1.-h*h-k*k) + (k*k)/(sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k));
     double dp_dk = 1./(1.-q)*(slp);
@@ -185,14 +258,14 @@ struct reb_particle reb_derivatives_k_k(double G, struct reb_particle primary, s
     double deta_dkk = a*(dslp_dkk - dp_dkk/(2.-l)*k - dl_dk*dp_dk/((2.-l)*(2.-l))*k - dp_dk/(2.-l) - dp_dk/(2.-l) - dl_dk*p/((2.-l)*(2.-l)) 
                 - dp_dk/((2.-l)*(2.-l))*dl_dk*k - 2.*dl_dk*p/((2.-l)*(2.-l)*(2.-l))*dl_dk*k - p/((2.-l)*(2.-l))*dl_dkk*k - p/((2.-l)*(2.-l))*dl_dk);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dkk = deta_dkk*ix-dxi_dkk*iy;
 
     np.x = dxi_dkk+0.5*iy*dW_dkk;
     np.y = deta_dkk-0.5*ix*dW_dkk;
     np.z = 0.5*iz*dW_dkk;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dkk  = dq_dkk*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h) + 2.*dq_dk*dq_dk*an/((1.-q)*(1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + dq_dk*an/((1.-q)*(1.-q))*(-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h)
                 + dq_dk*an/((1.-q)*(1.-q))*(-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h)
@@ -212,20 +285,24 @@ struct reb_particle reb_derivatives_k_k(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_h_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_h_h_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
     double dl_dhh = 1./sqrt(1.-h*h-k*k) + (h*h)/(sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k));
     double dp_dh = 1./(1.-q)*(-clp);
@@ -239,14 +316,14 @@ struct reb_particle reb_derivatives_h_h(double G, struct reb_particle primary, s
         + (dp_dh/((2.-l)*(2.-l))*dl_dh*h + 2.*p/((2.-l)*(2.-l)*(2.-l))*dl_dh*dl_dh*h + p/((2.-l)*(2.-l))*dl_dhh*h + p/((2.-l)*(2.-l))*dl_dh));
     double deta_dhh = a*(dslp_dhh + (-dp_dhh/(2.-l)*k - dl_dh*dp_dh/((2.-l)*(2.-l))*k) +(- dp_dh/((2.-l)*(2.-l))*k*dl_dh - 2.*p/((2.-l)*(2.-l)*(2.-l))*k*dl_dh*dl_dh- p/((2.-l)*(2.-l))*k*dl_dhh ));
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dhh = deta_dhh*ix-dxi_dhh*iy;
 
     np.x = dxi_dhh+0.5*iy*dW_dhh;
     np.y = deta_dhh-0.5*ix*dW_dhh;
     np.z = 0.5*iz*dW_dhh;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dhh  = dq_dhh*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h) + 2.*dq_dh*dq_dh*an/((1.-q)*(1.-q)*(1.-q))*(-slp+q/(2.-l)*h) 
                 + dq_dh*an/((1.-q)*(1.-q))*(-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l))
                 + dq_dh*an/((1.-q)*(1.-q))*(-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l)) 
@@ -267,38 +344,42 @@ struct reb_particle reb_derivatives_h_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_lambda_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_lambda_lambda_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
     double dq_dlambdalambda = -dp_dlambda/(1.-q) - p/((1.-q)*(1.-q))*dq_dlambda ;
     double dp_dlambdalambda = dq_dlambda/(1.-q) + q/((1.-q)*(1.-q))*dq_dlambda ;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     double dclp_dlambdalambda = -1./((1.-q)*(1.-q))*dq_dlambda*slp -1./(1.-q)*dslp_dlambda;
     double dslp_dlambdalambda = 1./((1.-q)*(1.-q))*dq_dlambda*clp + 1./(1.-q)*dclp_dlambda;    
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dxi_dlambdalambda = a*(dclp_dlambdalambda + dp_dlambdalambda/(2.-l)*h);
     double deta_dlambdalambda = a*(dslp_dlambdalambda - dp_dlambdalambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dlambdalambda = deta_dlambdalambda*ix-dxi_dlambdalambda*iy;
 
     np.x = dxi_dlambdalambda+0.5*iy*dW_dlambdalambda;
     np.y = deta_dlambdalambda-0.5*ix*dW_dlambdalambda;
     np.z = 0.5*iz*dW_dlambdalambda;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dlambdalambda  = 2.*an/((1.-q)*(1.-q)*(1.-q))*dq_dlambda*dq_dlambda*(-slp+q/(2.-l)*h) 
                 + an/((1.-q)*(1.-q))*dq_dlambdalambda*(-slp+q/(2.-l)*h) + an/((1.-q)*(1.-q))*dq_dlambda*(-dslp_dlambda+dq_dlambda/(2.-l)*h)
                 + an/((1.-q)*(1.-q))*dq_dlambda*(-dslp_dlambda+dq_dlambda/(2.-l)*h) + an/(1.-q)*(-dslp_dlambdalambda+dq_dlambdalambda/(2.-l)*h);
@@ -314,22 +395,26 @@ struct reb_particle reb_derivatives_lambda_lambda(double G, struct reb_particle
     return np;
 }
 
-struct reb_particle reb_derivatives_k_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_k_lambda_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dq_dk = 1./(1.-q)*(clp-k);
@@ -344,14 +429,14 @@ struct reb_particle reb_derivatives_k_lambda(double G, struct reb_particle prima
     double dxi_dklambda = a*(dclp_dklambda + dp_dklambda/(2.-l)*h + dp_dlambda/((2.-l)*(2.-l))*dl_dk*h);
     double deta_dklambda = a*(dslp_dklambda - dp_dklambda/(2.-l)*k - dp_dlambda/(2.-l) - dp_dlambda/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dklambda = deta_dklambda*ix-dxi_dklambda*iy;
 
     np.x = dxi_dklambda+0.5*iy*dW_dklambda;
     np.y = deta_dklambda-0.5*ix*dW_dklambda;
     np.z = 0.5*iz*dW_dklambda;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dklambda  = dq_dklambda*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h) + 2.*dq_dk*dq_dlambda*an/((1.-q)*(1.-q)*(1.-q))*(-slp+q/(2.-l)*h) 
                 + dq_dk*an/((1.-q)*(1.-q))*(-dslp_dlambda+dq_dlambda/(2.-l)*h)
                 + dq_dlambda*an/((1.-q)*(1.-q))*(-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h)
@@ -369,22 +454,26 @@ struct reb_particle reb_derivatives_k_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_h_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_h_lambda_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dq_dh = 1./(1.-q)*(slp-h);
@@ -398,14 +487,14 @@ struct reb_particle reb_derivatives_h_lambda(double G, struct reb_particle prima
     double dxi_dhlambda = a*(dclp_dhlambda + dp_dhlambda/(2.-l)*h + dp_dlambda/(2.-l) + dp_dlambda/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dhlambda = a*(dslp_dhlambda - dp_dhlambda/(2.-l)*k - dp_dlambda/((2.-l)*(2.-l))*k*dl_dh);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dhlambda = deta_dhlambda*ix-dxi_dhlambda*iy;
 
     np.x = dxi_dhlambda+0.5*iy*dW_dhlambda;
     np.y = deta_dhlambda-0.5*ix*dW_dhlambda;
     np.z = 0.5*iz*dW_dhlambda;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dhlambda  = dq_dhlambda*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h) + 2.*dq_dlambda*dq_dh*an/((1.-q)*(1.-q)*(1.-q))*(-slp+q/(2.-l)*h) 
                 + dq_dh*an/((1.-q)*(1.-q))*(-dslp_dlambda+dq_dlambda/(2.-l)*h)
                 + dq_dlambda*an/((1.-q)*(1.-q))*(-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l)) 
@@ -423,22 +512,26 @@ struct reb_particle reb_derivatives_h_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_k_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_k_h_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dq_dh = 1./(1.-q)*(slp-h);
@@ -456,14 +549,14 @@ struct reb_particle reb_derivatives_k_h(double G, struct reb_particle primary, s
     double deta_dkh = a*(dslp_dkh - dp_dkh/(2.-l)*k - dl_dh*dp_dk/((2.-l)*(2.-l))*k - dp_dh/(2.-l)- dl_dh*p/((2.-l)*(2.-l)) 
                 - dp_dh/((2.-l)*(2.-l))*dl_dk*k - p/((2.-l)*(2.-l))*dl_dkh*k - 2.*p/((2.-l)*(2.-l)*(2.-l))*dl_dk*dl_dh*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dkh = deta_dkh*ix-dxi_dkh*iy;
 
     np.x = dxi_dkh+0.5*iy*dW_dkh;
     np.y = deta_dkh-0.5*ix*dW_dkh;
     np.z = 0.5*iz*dW_dkh;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dkh = dq_dkh*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h) + 2.*dq_dh*dq_dk*an/((1.-q)*(1.-q)*(1.-q))*(-slp+q/(2.-l)*h) 
                 + dq_dk*an/((1.-q)*(1.-q))*(-dslp_dh+dq_dh/(2.-l)*h + dl_dh*q/((2.-l)*(2.-l))*h + q/(2.-l))
                 + dq_dh*an/((1.-q)*(1.-q))*(-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h) 
@@ -483,30 +576,34 @@ struct reb_particle reb_derivatives_k_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_a(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_a_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dxi_da = clp + p/(2.-l)*h -k;
     double deta_da = slp - p/(2.-l)*k -h;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_da = deta_da*ix-dxi_da*iy;
 
     np.x = dxi_da+0.5*iy*dW_da;
     np.y = deta_da-0.5*ix*dW_da;
     np.z = 0.5*iz*dW_da;
 
-    double dan_da = -0.5*sqrt(G*(po.m+primary.m)/(a*a*a));
+    double dan_da = -0.5*sqrt(G*(c->po.m+c->primary.m)/(a*a*a));
     double ddxi_da  = dan_da/(1.-q)*(-slp+q/(2.-l)*h);
     double ddeta_da = dan_da/(1.-q)*(+clp-q/(2.-l)*k);
 
@@ -518,30 +615,33 @@ struct reb_particle reb_derivatives_a(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_a_a(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_a_a_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dxi_daa = 0.0;//clp + p/(2.-l)*h -k;
     double deta_daa = 0.0;//slp - p/(2.-l)*k -h;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_daa = deta_daa*ix-dxi_daa*iy;
 
     np.x = dxi_daa+0.5*iy*dW_daa;
     np.y = deta_daa-0.5*ix*dW_daa;
     np.z = 0.5*iz*dW_daa;
 
-    double dan_daa = 0.75*sqrt(G*(po.m+primary.m)/(a*a*a*a*a));
+    double dan_daa = 0.75*sqrt(G*(c->po.m+c->primary.m)/(a*a*a*a*a));
     double ddxi_daa  = dan_daa/(1.-q)*(-slp+q/(2.-l)*h);
     double ddeta_daa = dan_daa/(1.-q)*(+clp-q/(2.-l)*k);
 
@@ -553,23 +653,27 @@ struct reb_particle reb_derivatives_a_a(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_ix_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_dix = -ix/c->iz;
     double W = eta*ix-xi*iy;
     double dW_dix = eta;
 
@@ -577,7 +681,7 @@ struct reb_particle reb_derivatives_ix(double G, struct reb_particle primary, st
     np.y = -0.5*W-0.5*ix*dW_dix;
     np.z = 0.5*diz_dix*W + 0.5*iz*dW_dix;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double dxi  = an/(1.-q)*(-slp+q/(2.-l)*h);
     double deta = an/(1.-q)*(+clp-q/(2.-l)*k);
     double dW = deta*ix-dxi*iy;
@@ -590,18 +694,22 @@ struct reb_particle reb_derivatives_ix(double G, struct reb_particle primary, st
     return np;
 }
 
-struct reb_particle reb_derivatives_ix_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_ix_ix_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
@@ -616,7 +724,7 @@ struct reb_particle reb_derivatives_ix_ix(double G, struct reb_particle primary,
     np.y = -dW_dix-0.5*ix*dW_dixix;
     np.z = 0.5*diz_dixix*W+diz_dix*dW_dix;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double dxi  = an/(1.-q)*(-slp+q/(2.-l)*h);
     double deta = an/(1.-q)*(+clp-q/(2.-l)*k);
     double dW = deta*ix-dxi*iy;
@@ -630,23 +738,27 @@ struct reb_particle reb_derivatives_ix_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_diy = -iy/c->iz;
     double W = eta*ix-xi*iy;
     double dW_diy = -xi;
 
@@ -654,7 +766,7 @@ struct reb_particle reb_derivatives_iy(double G, struct reb_particle primary, st
     np.y = -0.5*ix*dW_diy;
     np.z = 0.5*diz_diy*W + 0.5*iz*dW_diy;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double dxi  = an/(1.-q)*(-slp+q/(2.-l)*h);
     double deta = an/(1.-q)*(+clp-q/(2.-l)*k);
     double dW = deta*ix-dxi*iy;
@@ -667,24 +779,28 @@ struct reb_particle reb_derivatives_iy(double G, struct reb_particle primary, st
     return np;
 }
 
-struct reb_particle reb_derivatives_iy_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_iy_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    //double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diyiy = -1./sqrt(fabs(4.-ix*ix-iy*iy)) -iy*iy/( sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy)) );
+    //double iz = c->iz;
+    double diz_diy = -iy/c->iz;
+    double diz_diyiy = -1./c->iz -iy*iy/( c->iz*c->iz*c->iz );
     double W = eta*ix-xi*iy;
     double dW_diy = -xi;
     double dW_diyiy = 0.0;
@@ -693,7 +809,7 @@ struct reb_particle reb_derivatives_iy_iy(double G, struct reb_particle primary,
     np.y = -0.5*ix*dW_diyiy;
     np.z = 0.5*diz_diyiy*W + diz_diy*dW_diy;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double dxi  = an/(1.-q)*(-slp+q/(2.-l)*h);
     double deta = an/(1.-q)*(+clp-q/(2.-l)*k);
     double dW = deta*ix-dxi*iy;
@@ -707,27 +823,31 @@ struct reb_particle reb_derivatives_iy_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_k_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_k_ix_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dk = a*(dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dk = a*(dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_dix = -ix/c->iz;
     double dW_dk = deta_dk*ix-dxi_dk*iy;
     double dW_dkix = deta_dk;
 
@@ -737,7 +857,7 @@ struct reb_particle reb_derivatives_k_ix(double G, struct reb_particle primary,
 
     double dq_dk = 1./(1.-q)*(clp-k);
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dk  = dq_dk*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + an/(1.-q) * (-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h);
     double ddeta_dk = dq_dk*an/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -752,27 +872,31 @@ struct reb_particle reb_derivatives_k_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_h_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_h_ix_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dh = a*(dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dh = a*(dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_dix = -ix/c->iz;
     double dW_dh = deta_dh*ix-dxi_dh*iy;
     double dW_dhix = deta_dh;
 
@@ -782,7 +906,7 @@ struct reb_particle reb_derivatives_h_ix(double G, struct reb_particle primary,
 
     double dq_dh = 1./(1.-q)*(slp-h);
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dh  = dq_dh*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + an/(1.-q) * (-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l));
     double ddeta_dh = dq_dh*an/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -797,28 +921,32 @@ struct reb_particle reb_derivatives_h_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_lambda_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_lambda_ix_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dxi_dlambda = a*(dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dlambda = a*(dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_dix = -ix/c->iz;
     double dW_dlambda = deta_dlambda*ix-dxi_dlambda*iy;
     double dW_dlambdaix = deta_dlambda;
 
@@ -826,7 +954,7 @@ struct reb_particle reb_derivatives_lambda_ix(double G, struct reb_particle prim
     np.y = -0.5*dW_dlambda-0.5*ix*dW_dlambdaix;
     np.z = 0.5*diz_dix*dW_dlambda+0.5*iz*dW_dlambdaix;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dlambda  = an/((1.-q)*(1.-q))*dq_dlambda*(-slp+q/(2.-l)*h)
     + an/(1.-q)*(-dslp_dlambda+dq_dlambda/(2.-l)*h);
     double ddeta_dlambda = an/((1.-q)*(1.-q))*dq_dlambda*(+clp-q/(2.-l)*k)
@@ -840,35 +968,39 @@ struct reb_particle reb_derivatives_lambda_ix(double G, struct reb_particle prim
     return np;
 }
 
-struct reb_particle reb_derivatives_lambda_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_lambda_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dxi_dlambda = a*(dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dlambda = a*(dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_diy = -iy/c->iz;
     double dW_dlambda = deta_dlambda*ix-dxi_dlambda*iy;
     double dW_dlambdaiy = -dxi_dlambda;
     np.x = 0.5*dW_dlambda+0.5*iy*dW_dlambdaiy;
     np.y = -0.5*ix*dW_dlambdaiy;
     np.z = 0.5*diz_diy*dW_dlambda+0.5*iz*dW_dlambdaiy;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dlambda  = an/((1.-q)*(1.-q))*dq_dlambda*(-slp+q/(2.-l)*h)
     + an/(1.-q)*(-dslp_dlambda+dq_dlambda/(2.-l)*h);
     double ddeta_dlambda = an/((1.-q)*(1.-q))*dq_dlambda*(+clp-q/(2.-l)*k)
@@ -882,27 +1014,31 @@ struct reb_particle reb_derivatives_lambda_iy(double G, struct reb_particle prim
     return np;
 }
 
-struct reb_particle reb_derivatives_h_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_h_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dh = a*(dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dh = a*(dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_diy = -iy/c->iz;
     double dW_dh = deta_dh*ix-dxi_dh*iy;
     double dW_dhiy = -dxi_dh;
     np.x = 0.5*dW_dh+0.5*iy*dW_dhiy;
@@ -911,7 +1047,7 @@ struct reb_particle reb_derivatives_h_iy(double G, struct reb_particle primary,
 
     double dq_dh = 1./(1.-q)*(slp-h);
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dh  = dq_dh*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + an/(1.-q) * (-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l));
     double ddeta_dh = dq_dh*an/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -925,27 +1061,31 @@ struct reb_particle reb_derivatives_h_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_k_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_k_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dk = a*(dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dk = a*(dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_diy = -iy/c->iz;
     double dW_dk = deta_dk*ix-dxi_dk*iy;
     double dW_dkiy = -dxi_dk;
     np.x = 0.5*dW_dk+0.5*iy*dW_dkiy;
@@ -954,7 +1094,7 @@ struct reb_particle reb_derivatives_k_iy(double G, struct reb_particle primary,
 
     double dq_dk = 1./(1.-q)*(clp-k);
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double ddxi_dk  = dq_dk*an/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + an/(1.-q) * (-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h);
     double ddeta_dk = dq_dk*an/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -968,25 +1108,29 @@ struct reb_particle reb_derivatives_k_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_ix_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_ix_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dixiy = -ix*iy/(sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy)));
+    double iz = c->iz;
+    double diz_dix = -ix/c->iz;
+    double diz_diy = -iy/c->iz;
+    double diz_dixiy = -ix*iy/(c->iz*c->iz*c->iz);
     double W = eta*ix-xi*iy;
     double dW_dix = eta;
     double dW_diy = -xi;
@@ -995,7 +1139,7 @@ struct reb_particle reb_derivatives_ix_iy(double G, struct reb_particle primary,
     np.y = -0.5*dW_diy-0.5*ix*dW_dixiy;
     np.z = 0.5*diz_dixiy*W+0.5*diz_dix*dW_diy + 0.5*diz_diy*dW_dix+0.5*iz*dW_dixiy;
 
-    double an = sqrt(G*(po.m+primary.m)/a);
+    double an = sqrt(G*(c->po.m+c->primary.m)/a);
     double dxi  = an/(1.-q)*(-slp+q/(2.-l)*h);
     double deta = an/(1.-q)*(+clp-q/(2.-l)*k);
     double dW = deta*ix-dxi*iy;
@@ -1010,21 +1154,25 @@ struct reb_particle reb_derivatives_ix_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_a_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_a_ix_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double deta_da = (slp - p/(2.-l)*k -h);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_dix = -ix/c->iz;
     double dW_daix = deta_da;
     double dxi_da = clp + p/(2.-l)*h -k;
     double dW_da = deta_da*ix-dxi_da*iy;
@@ -1033,7 +1181,7 @@ struct reb_particle reb_derivatives_a_ix(double G, struct reb_particle primary,
     np.y = -0.5*dW_da-0.5*ix*dW_daix;
     np.z = 0.5*diz_dix*dW_da + 0.5*iz*dW_daix;
 
-    double dan_da = -0.5*sqrt(G*(po.m+primary.m)/(a*a*a));
+    double dan_da = -0.5*sqrt(G*(c->po.m+c->primary.m)/(a*a*a));
     double ddeta_da = dan_da/(1.-q)*(+clp-q/(2.-l)*k);
     double ddW_daix = ddeta_da;
     double ddxi_da  = dan_da/(1.-q)*(-slp+q/(2.-l)*h);
@@ -1046,21 +1194,25 @@ struct reb_particle reb_derivatives_a_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_a_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_a_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
+    double diz_diy = -iy/c->iz;
     double dxi_da = clp + p/(2.-l)*h -k;
     double deta_da = slp - p/(2.-l)*k -h;
     double dW_da = deta_da*ix-dxi_da*iy;
@@ -1069,7 +1221,7 @@ struct reb_particle reb_derivatives_a_iy(double G, struct reb_particle primary,
     np.y = -0.5*ix*dW_daiy;
     np.z = 0.5*diz_diy*dW_da + 0.5*iz*dW_daiy;
 
-    double dan_da = -0.5*sqrt(G*(po.m+primary.m)/(a*a*a));
+    double dan_da = -0.5*sqrt(G*(c->po.m+c->primary.m)/(a*a*a));
     double ddxi_da  = dan_da/(1.-q)*(-slp+q/(2.-l)*h);
     double ddW_daiy = -ddxi_da;
     double ddeta_da = dan_da/(1.-q)*(+clp-q/(2.-l)*k);
@@ -1083,34 +1235,38 @@ struct reb_particle reb_derivatives_a_iy(double G, struct reb_particle primary,
 }
 
 
-struct reb_particle reb_derivatives_a_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_a_lambda_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dxi_dalambda = (dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dalambda = (dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dalambda = deta_dalambda*ix-dxi_dalambda*iy;
 
     np.x = dxi_dalambda+0.5*iy*dW_dalambda;
     np.y = deta_dalambda-0.5*ix*dW_dalambda;
     np.z = 0.5*iz*dW_dalambda;
 
-    double dan_da = -0.5*sqrt(G*(po.m+primary.m)/(a*a*a));
+    double dan_da = -0.5*sqrt(G*(c->po.m+c->primary.m)/(a*a*a));
     double ddxi_dalambda  = dan_da/((1.-q)*(1.-q))*dq_dlambda*(-slp+q/(2.-l)*h)
     + dan_da/(1.-q)*(-dslp_dlambda+dq_dlambda/(2.-l)*h);
     double ddeta_dalambda = dan_da/((1.-q)*(1.-q))*dq_dlambda*(+clp-q/(2.-l)*k)
@@ -1123,26 +1279,30 @@ struct reb_particle reb_derivatives_a_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_a_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_a_h_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dah = (dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dah = (dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dah = deta_dah*ix-dxi_dah*iy;
 
     np.x = dxi_dah+0.5*iy*dW_dah;
@@ -1151,7 +1311,7 @@ struct reb_particle reb_derivatives_a_h(double G, struct reb_particle primary, s
 
     double dq_dh = 1./(1.-q)*(slp-h);
 
-    double dan_da = -0.5*sqrt(G*(po.m+primary.m)/(a*a*a));
+    double dan_da = -0.5*sqrt(G*(c->po.m+c->primary.m)/(a*a*a));
     double ddxi_dah  = dq_dh*dan_da/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + dan_da/(1.-q) * (-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l));
     double ddeta_dah = dq_dh*dan_da/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -1165,26 +1325,30 @@ struct reb_particle reb_derivatives_a_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_a_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_a_k_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dak = (dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dak = (dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     double dW_dak = deta_dak*ix-dxi_dak*iy;
 
     np.x = dxi_dak+0.5*iy*dW_dak;
@@ -1193,7 +1357,7 @@ struct reb_particle reb_derivatives_a_k(double G, struct reb_particle primary, s
 
     double dq_dk = 1./(1.-q)*(clp-k);
 
-    double dan_da = -0.5*sqrt(G*(po.m+primary.m)/(a*a*a));
+    double dan_da = -0.5*sqrt(G*(c->po.m+c->primary.m)/(a*a*a));
     double ddxi_dak  = dq_dk*dan_da/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + dan_da/(1.-q) * (-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h);
     double ddeta_dak = dq_dk*dan_da/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -1207,25 +1371,28 @@ struct reb_particle reb_derivatives_a_k(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
     np.m = 1.;
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = c->l;
+    double iz = c->iz;
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
 
-    double dan_dm = 0.5*sqrt(G/(a*(po.m+primary.m)));
+    double dan_dm = 0.5*sqrt(G/(a*(c->po.m+c->primary.m)));
     double ddxi_dm  = dan_dm/(1.-q)*(-slp+q/(2.-l)*h);
     double ddeta_dm = dan_dm/(1.-q)*(+clp-q/(2.-l)*k);
 
@@ -1237,24 +1404,27 @@ struct reb_particle reb_derivatives_m(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_m_a(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_a_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double slp = c->slp;
+    double clp = c->clp;
+    double l = c->l;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
 
-    double dan_dma = -0.5*0.5*sqrt(G/(a*a*a*(po.m+primary.m)));
+    double dan_dma = -0.5*0.5*sqrt(G/(a*a*a*(c->po.m+c->primary.m)));
     double ddxi_dma  = dan_dma/(1.-q)*(-slp+q/(2.-l)*h);
     double ddeta_dma = dan_dma/(1.-q)*(+clp-q/(2.-l)*k);
 
@@ -1266,28 +1436,32 @@ struct reb_particle reb_derivatives_m_a(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_lambda_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = c->p;
+    const double q = c->q;
     double dq_dlambda = -p/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = c->l;
+    double iz = c->iz;
 
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
 
-    double dan_dm = 0.5*sqrt(G/(a*(po.m+primary.m)));
+    double dan_dm = 0.5*sqrt(G/(a*(c->po.m+c->primary.m)));
     double ddxi_dmlambda  = dan_dm/((1.-q)*(1.-q))*dq_dlambda*(-slp+q/(2.-l)*h)
     + dan_dm/(1.-q)*(-dslp_dlambda+dq_dlambda/(2.-l)*h);
     double ddeta_dmlambda = dan_dm/((1.-q)*(1.-q))*dq_dlambda*(+clp-q/(2.-l)*k)
@@ -1300,21 +1474,24 @@ struct reb_particle reb_derivatives_m_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_m_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_h_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = c->q;
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
 
     np.x = 0.0;
     np.y = 0.0;
@@ -1322,7 +1499,7 @@ struct reb_particle reb_derivatives_m_h(double G, struct reb_particle primary, s
 
     double dq_dh = 1./(1.-q)*(slp-h);
 
-    double dan_dm = 0.5*sqrt(G/(a*(po.m+primary.m)));
+    double dan_dm = 0.5*sqrt(G/(a*(c->po.m+c->primary.m)));
     double ddxi_dmh  = dq_dh*dan_dm/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + dan_dm/(1.-q) * (-dslp_dh+dq_dh/(2.-l)*h+dl_dh*q/((2.-l)*(2.-l))*h+q/(2.-l));
     double ddeta_dmh = dq_dh*dan_dm/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -1336,21 +1513,24 @@ struct reb_particle reb_derivatives_m_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_k_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = c->q;
+    double slp = c->slp;
+    double clp = c->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = c->l;
     double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = c->iz;
 
     np.x = 0.0;
     np.y = 0.0;
@@ -1358,7 +1538,7 @@ struct reb_particle reb_derivatives_m_k(double G, struct reb_particle primary, s
 
     double dq_dk = 1./(1.-q)*(clp-k);
 
-    double dan_dm = 0.5*sqrt(G/(a*(po.m+primary.m)));
+    double dan_dm = 0.5*sqrt(G/(a*(c->po.m+c->primary.m)));
     double ddxi_dmk  = dq_dk*dan_dm/((1.-q)*(1.-q))*(-slp+q/(2.-l)*h)
                 + dan_dm/(1.-q) * (-dslp_dk+dq_dk/(2.-l)*h+dl_dk*q/((2.-l)*(2.-l))*h);
     double ddeta_dmk = dq_dk*dan_dm/((1.-q)*(1.-q))*(+clp-q/(2.-l)*k)
@@ -1372,25 +1552,28 @@ struct reb_particle reb_derivatives_m_k(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_ix_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = c->q;
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = c->l;
+    double iz = c->iz;
+    double diz_dix = -ix/c->iz;
 
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
 
-    double dan_dm = 0.5*sqrt(G/(a*(po.m+primary.m)));
+    double dan_dm = 0.5*sqrt(G/(a*(c->po.m+c->primary.m)));
     double ddxi_dm  = dan_dm/(1.-q)*(-slp+q/(2.-l)*h);
     double ddeta_dm = dan_dm/(1.-q)*(+clp-q/(2.-l)*k);
     double ddW_dm = ddeta_dm*ix-ddxi_dm*iy;
@@ -1403,25 +1586,28 @@ struct reb_particle reb_derivatives_m_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_m_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_iy_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = c->q;
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = c->l;
+    double iz = c->iz;
+    double diz_diy = -iy/c->iz;
 
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
 
-    double dan_dm = 0.5*sqrt(G/(a*(po.m+primary.m)));
+    double dan_dm = 0.5*sqrt(G/(a*(c->po.m+c->primary.m)));
     double ddxi_dm  = dan_dm/(1.-q)*(-slp+q/(2.-l)*h);
     double ddeta_dm = dan_dm/(1.-q)*(+clp-q/(2.-l)*k);
     double ddW_dm = ddeta_dm*ix-ddxi_dm*iy;
@@ -1434,24 +1620,27 @@ struct reb_particle reb_derivatives_m_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_m_m(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_m_m_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const double a = c->a;
+    const double k = c->k;
+    const double h = c->h;
+    const double ix = c->ix;
+    const double iy = c->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = c->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = c->slp;
+    double clp = c->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = c->l;
+    double iz = c->iz;
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
 
-    double dan_dmm = -0.25*sqrt(G/(a*(po.m+primary.m)*(po.m+primary.m)*(po.m+primary.m)));
+    double dan_dmm = -0.25*sqrt(G/(a*(c->po.m+c->primary.m)*(c->po.m+c->primary.m)*(c->po.m+c->primary.m)));
     double ddxi_dmm  = dan_dmm/(1.-q)*(-slp+q/(2.-l)*h);
     double ddeta_dmm = dan_dmm/(1.-q)*(+clp-q/(2.-l)*k);
 
@@ -1463,22 +1652,23 @@ struct reb_particle reb_derivatives_m_m(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_e_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double cosf = c->cf;
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
-    double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
+    double dv0 = sqrt(G*(c->po.m+c->primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = dr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = dr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1497,23 +1687,24 @@ struct reb_particle reb_derivatives_e(double G, struct reb_particle primary, str
 
 
 
-struct reb_particle reb_derivatives_e_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_e_e_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = c->cf;
     double ddr = o.a*2.*(cosf*cosf-1.)/((cosf*o.e+1.)*(cosf*o.e+1.)*(cosf*o.e+1.));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
     double dv0 = o.e*v0/(1.-o.e*o.e); 
     double ddv0 = v0/((o.e*o.e-1.)*(o.e*o.e-1.)) * (2.*o.e*o.e+1.);
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = ddr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = ddr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1530,20 +1721,21 @@ struct reb_particle reb_derivatives_e_e(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_inc_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dci = -c->si;
+    double dsi = c->ci;
     
     p.x = r*(- sO*(so*cf+co*sf)*dci);
     p.y = r*(+ cO*(so*cf+co*sf)*dci);
@@ -1557,20 +1749,21 @@ struct reb_particle reb_derivatives_inc(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_inc_inc_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ddci = -cos(o.inc);
-    double ddsi = -sin(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ddci = -c->ci;
+    double ddsi = -c->si;
     
     p.x = r*(- sO*(so*cf+co*sf)*ddci);
     p.y = r*(+ cO*(so*cf+co*sf)*ddci);
@@ -1583,19 +1776,20 @@ struct reb_particle reb_derivatives_inc_inc(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_Omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -c->sO;
+    double dsO = c->cO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
     
     p.x = r*(dcO*(co*cf-so*sf) - dsO*(so*cf+co*sf)*ci);
     p.y = r*(dsO*(co*cf-so*sf) + dcO*(so*cf+co*sf)*ci);
@@ -1608,19 +1802,20 @@ struct reb_particle reb_derivatives_Omega(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_Omega_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_Omega_Omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double ddcO = -cos(o.Omega);
-    double ddsO = -sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double ddcO = -c->cO;
+    double ddsO = -c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
     
     p.x = r*(ddcO*(co*cf-so*sf) - ddsO*(so*cf+co*sf)*ci);
     p.y = r*(ddsO*(co*cf-so*sf) + ddcO*(so*cf+co*sf)*ci);
@@ -1633,20 +1828,21 @@ struct reb_particle reb_derivatives_Omega_Omega(double G, struct reb_particle pr
     return p;
 }
 
-struct reb_particle reb_derivatives_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double dco = -c->so;
+    double dso = c->co;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = r*(cO*(dco*cf-dso*sf) - sO*(dso*cf+dco*sf)*ci);
     p.y = r*(sO*(dco*cf-dso*sf) + cO*(dso*cf+dco*sf)*ci);
@@ -1659,20 +1855,21 @@ struct reb_particle reb_derivatives_omega(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_omega_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_omega_omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double ddco = -cos(o.omega);
-    double ddso = -sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double ddco = -c->co;
+    double ddso = -c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = r*(cO*(ddco*cf-ddso*sf) - sO*(ddso*cf+ddco*sf)*ci);
     p.y = r*(sO*(ddco*cf-ddso*sf) + cO*(ddso*cf+ddco*sf)*ci);
@@ -1685,23 +1882,24 @@ struct reb_particle reb_derivatives_omega_omega(double G, struct reb_particle pr
     return p;
 }
 
-struct reb_particle reb_derivatives_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)))*o.e*sin(o.f);
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*c->cf)*(1. + o.e*c->cf))*o.e*c->sf;
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = dr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = dr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1718,26 +1916,27 @@ struct reb_particle reb_derivatives_f(double G, struct reb_particle primary, str
     return p;
 }
 
-struct reb_particle reb_derivatives_f_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_f_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)))*o.e*sin(o.f);
-    double ddr = 2.*o.a*(1.-o.e*o.e)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)))*o.e*o.e*sin(o.f)*sin(o.f) + o.a*(1.-o.e*o.e)*o.e*cos(o.f)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double ddcf = -cos(o.f);
-    double ddsf = -sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*c->cf)*(1. + o.e*c->cf))*o.e*c->sf;
+    double ddr = 2.*o.a*(1.-o.e*o.e)/((1. + o.e*c->cf)*(1. + o.e*c->cf)*(1. + o.e*c->cf))*o.e*o.e*c->sf*c->sf + o.a*(1.-o.e*o.e)*o.e*c->cf/((1. + o.e*c->cf)*(1. + o.e*c->cf));
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double ddcf = -c->cf;
+    double ddsf = -c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = ddr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = ddr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1759,23 +1958,24 @@ struct reb_particle reb_derivatives_f_f(double G, struct reb_particle primary, s
 }
 
 
-struct reb_particle reb_derivatives_a_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_a_e_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = c->cf;
     double ddr = -(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
-    double dv0_da = -0.5/sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e))*G*(po.m+primary.m)/(o.a*o.a)/(1.-o.e*o.e); 
+    double dv0_da = -0.5/sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e))*G*(c->po.m+c->primary.m)/(o.a*o.a)/(1.-o.e*o.e); 
     
     double dv0_da_de = o.e*dv0_da/(1.-o.e*o.e); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = ddr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = ddr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1792,20 +1992,21 @@ struct reb_particle reb_derivatives_a_e(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_a_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_a_inc_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double dr = (1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(c->po.m+c->primary.m)/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dci = -c->si;
+    double dsi = c->ci;
     
     p.x = dr*(- sO*(so*cf+co*sf)*dci);
     p.y = dr*(+ cO*(so*cf+co*sf)*dci);
@@ -1818,19 +2019,20 @@ struct reb_particle reb_derivatives_a_inc(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_a_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_a_Omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e)); 
+    double dr = (1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(c->po.m+c->primary.m)/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -c->sO;
+    double dsO = c->cO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
     
     p.x = dr*(dcO*(co*cf-so*sf) - dsO*(so*cf+co*sf)*ci);
     p.y = dr*(dsO*(co*cf-so*sf) + dcO*(so*cf+co*sf)*ci);
@@ -1841,20 +2043,21 @@ struct reb_particle reb_derivatives_a_Omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_a_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_a_omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double dr = (1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(c->po.m+c->primary.m)/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double dco = -c->so;
+    double dso = c->co;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = dr*(cO*(dco*cf-dso*sf) - sO*(dso*cf+dco*sf)*ci);
     p.y = dr*(sO*(dco*cf-dso*sf) + cO*(dso*cf+dco*sf)*ci);
@@ -1867,23 +2070,24 @@ struct reb_particle reb_derivatives_a_omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_a_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_a_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double ddr = o.e*sin(o.f)*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
-    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e));
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double dr = (1.-o.e*o.e)/(1. + o.e*c->cf);
+    double ddr = o.e*c->sf*(1.-o.e*o.e)/(1. + o.e*c->cf)/(1. + o.e*c->cf);
+    double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(c->po.m+c->primary.m)/(1.-o.e*o.e));
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = dr*(cO*(co*dcf-so*dsf) - sO*(so*dcf+co*dsf)*ci);
     p.y = dr*(sO*(co*dcf-so*dsf) + cO*(so*dcf+co*dsf)*ci);
@@ -1900,22 +2104,23 @@ struct reb_particle reb_derivatives_a_f(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_e_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_e_inc_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double cosf = c->cf;
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
-    double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
+    double dv0 = sqrt(G*(c->po.m+c->primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dci = -c->si;
+    double dsi = c->ci;
     
     p.x = dr*(- sO*(so*cf+co*sf)*dci);
     p.y = dr*(+ cO*(so*cf+co*sf)*dci);
@@ -1933,21 +2138,22 @@ struct reb_particle reb_derivatives_e_inc(double G, struct reb_particle primary,
 }
 
 
-struct reb_particle reb_derivatives_e_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_e_Omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double cosf = c->cf;
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
-    double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
+    double dv0 = sqrt(G*(c->po.m+c->primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -c->sO;
+    double dsO = c->cO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
     
     p.x = dr*(dcO*(co*cf-so*sf) - dsO*(so*cf+co*sf)*ci);
     p.y = dr*(dsO*(co*cf-so*sf) + dcO*(so*cf+co*sf)*ci);
@@ -1961,22 +2167,23 @@ struct reb_particle reb_derivatives_e_Omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_e_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_e_omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double cosf = c->cf;
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
-    double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
+    double dv0 = sqrt(G*(c->po.m+c->primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double dco = -c->so;
+    double dso = c->co;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = dr*(cO*(dco*cf-dso*sf) - sO*(dso*cf+dco*sf)*ci);
     p.y = dr*(sO*(dco*cf-dso*sf) + cO*(dso*cf+dco*sf)*ci);
@@ -1992,25 +2199,26 @@ struct reb_particle reb_derivatives_e_omega(double G, struct reb_particle primar
 
     return p;
 }
-struct reb_particle reb_derivatives_e_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_e_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = c->cf;
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
-    double ddr = -o.a*(-sin(o.f)*o.e*o.e-sin(o.f))/((cosf*o.e+1.)*(cosf*o.e+1.))
-                -2.*o.e*sin(o.f) * o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.)*(cosf*o.e+1.));
-    double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double ddr = -o.a*(-c->sf*o.e*o.e-c->sf)/((cosf*o.e+1.)*(cosf*o.e+1.))
+                -2.*o.e*c->sf * o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.)*(cosf*o.e+1.));
+    double dv0 = sqrt(G*(c->po.m+c->primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = dr*(cO*(co*dcf-so*dsf) - sO*(so*dcf+co*dsf)*ci);
     p.y = dr*(sO*(co*dcf-so*dsf) + cO*(so*dcf+co*dsf)*ci);
@@ -2026,20 +2234,21 @@ struct reb_particle reb_derivatives_e_f(double G, struct reb_particle primary, s
     
     return p;
 }
-struct reb_particle reb_derivatives_m_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_m_e_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dv0m = 0.5*G/o.a/(1.-o.e*o.e)/sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-    double dv0ea = 0.5*G/o.a/sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double dv0m = 0.5*G/o.a/(1.-o.e*o.e)/sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+    double dv0ea = 0.5*G/o.a/sqrt(G*(c->po.m+c->primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.vx = dv0ea*((o.e+cf)*(-ci*co*sO - cO*so) - sf*(co*cO - ci*so*sO));
     p.vy = dv0ea*((o.e+cf)*(ci*co*cO - sO*so)  - sf*(co*sO + ci*so*cO));
@@ -2052,19 +2261,20 @@ struct reb_particle reb_derivatives_m_e(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_inc_Omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
+    double dcO = -c->sO;
+    double dsO = c->cO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dci = -c->si;
     
     p.x = r*(- dsO*(so*cf+co*sf)*dci);
     p.y = r*(+ dcO*(so*cf+co*sf)*dci);
@@ -2075,20 +2285,21 @@ struct reb_particle reb_derivatives_inc_Omega(double G, struct reb_particle prim
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_inc_omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double dco = -c->so;
+    double dso = c->co;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dci = -c->si;
+    double dsi = c->ci;
     
     p.x = r*(- sO*(dso*cf+dco*sf)*dci);
     p.y = r*(+ cO*(dso*cf+dco*sf)*dci);
@@ -2101,23 +2312,24 @@ struct reb_particle reb_derivatives_inc_omega(double G, struct reb_particle prim
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_inc_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.e*sin(o.f)*o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dr = o.e*c->sf*o.a*(1.-o.e*o.e)/(1. + o.e*c->cf)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dci = -c->si;
+    double dsi = c->ci;
     
     p.x = r*(- sO*(so*dcf+co*dsf)*dci);
     p.y = r*(+ cO*(so*dcf+co*dsf)*dci);
@@ -2134,19 +2346,20 @@ struct reb_particle reb_derivatives_inc_f(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_m_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_m_inc_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dv0 = 0.5/sqrt(po.m+primary.m)*sqrt(G/o.a/(1.-o.e*o.e)); 
+    double dv0 = 0.5/sqrt(c->po.m+c->primary.m)*sqrt(G/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double dci = -c->si;
+    double dsi = c->ci;
     
     p.vx = dv0*((o.e+cf)*(-dci*co*sO) - sf*(- dci*so*sO));
     p.vy = dv0*((o.e+cf)*(dci*co*cO)  - sf*(dci*so*cO));
@@ -2155,19 +2368,20 @@ struct reb_particle reb_derivatives_m_inc(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_omega_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_omega_Omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -c->sO;
+    double dsO = c->cO;
+    double dco = -c->so;
+    double dso = c->co;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
     
     p.x = r*(dcO*(dco*cf-dso*sf) - dsO*(dso*cf+dco*sf)*ci);
     p.y = r*(dsO*(dco*cf-dso*sf) + dcO*(dso*cf+dco*sf)*ci);
@@ -2178,22 +2392,23 @@ struct reb_particle reb_derivatives_omega_Omega(double G, struct reb_particle pr
     return p;
 }
 
-struct reb_particle reb_derivatives_Omega_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_Omega_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.e*sin(o.f)*o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dr = o.e*c->sf*o.a*(1.-o.e*o.e)/(1. + o.e*c->cf)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double dcO = -c->sO;
+    double dsO = c->cO;
+    double co = c->co;
+    double so = c->so;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
     
     p.x = r*(dcO*(co*dcf-so*dsf) - dsO*(so*dcf+co*dsf)*ci);
     p.y = r*(dsO*(co*dcf-so*dsf) + dcO*(so*dcf+co*dsf)*ci);
@@ -2207,18 +2422,19 @@ struct reb_particle reb_derivatives_Omega_f(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_m_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_m_Omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dv0 = 0.5/sqrt(po.m+primary.m)*sqrt(G/o.a/(1.-o.e*o.e)); 
+    double dv0 = 0.5/sqrt(c->po.m+c->primary.m)*sqrt(G/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -c->sO;
+    double dsO = c->cO;
+    double co = c->co;
+    double so = c->so;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
     
     p.vx = dv0*((o.e+cf)*(-ci*co*dsO - dcO*so) - sf*(co*dcO - ci*so*dsO));
     p.vy = dv0*((o.e+cf)*(ci*co*dcO - dsO*so)  - sf*(co*dsO + ci*so*dcO));
@@ -2226,23 +2442,24 @@ struct reb_particle reb_derivatives_m_Omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_omega_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_omega_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.e*sin(o.f)*o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
-    double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
-
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*c->cf);
+    double dr = o.e*c->sf*o.a*(1.-o.e*o.e)/(1. + o.e*c->cf)/(1. + o.e*c->cf);
+    double v0 = sqrt(G*(c->po.m+c->primary.m)/o.a/(1.-o.e*o.e)); 
+
+    double cO = c->cO;
+    double sO = c->sO;
+    double dco = -c->so;
+    double dso = c->co;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.x = r*(cO*(dco*dcf-dso*dsf) - sO*(dso*dcf+dco*dsf)*ci);
     p.y = r*(sO*(dco*dcf-dso*dsf) + cO*(dso*dcf+dco*dsf)*ci);
@@ -2259,19 +2476,20 @@ struct reb_particle reb_derivatives_omega_f(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_m_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_m_omega_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dv0 = 0.5*sqrt(G/o.a/(1.-o.e*o.e))/sqrt(po.m+primary.m); 
+    double dv0 = 0.5*sqrt(G/o.a/(1.-o.e*o.e))/sqrt(c->po.m+c->primary.m); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double dco = -c->so;
+    double dso = c->co;
+    double cf = c->cf;
+    double sf = c->sf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.vx = dv0*((o.e+cf)*(-ci*dco*sO - cO*dso) - sf*(dco*cO - ci*dso*sO));
     p.vy = dv0*((o.e+cf)*(ci*dco*cO - sO*dso)  - sf*(dco*sO + ci*dso*cO));
@@ -2280,19 +2498,20 @@ struct reb_particle reb_derivatives_m_omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_m_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_m_f_context(const struct reb_derivatives_context* const c){
+    const double G = c->G;
+    const struct reb_orbit o = c->o;
     struct reb_particle p = {0};
-    double dv0 = 0.5*sqrt(G/o.a/(1.-o.e*o.e))/sqrt(po.m+primary.m); 
+    double dv0 = 0.5*sqrt(G/o.a/(1.-o.e*o.e))/sqrt(c->po.m+c->primary.m); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = c->cO;
+    double sO = c->sO;
+    double co = c->co;
+    double so = c->so;
+    double dcf = -c->sf;
+    double dsf = c->cf;
+    double ci = c->ci;
+    double si = c->si;
     
     p.vx = dv0*(dcf*(-ci*co*sO - cO*so) - dsf*(co*cO - ci*so*sO));
     p.vy = dv0*(dcf*(ci*co*cO - sO*so)  - dsf*(co*sO + ci*so*cO));
@@ -2300,3 +2519,120 @@ struct reb_particle reb_derivatives_m_f(double G, struct reb_particle primary, s
     
     return p;
 }
+
+// List of all implemented derivatives: function name, parameters (ordered as
+// in enum REB_DERIVATIVES_PARAMETER) and the family of coordinates used.
+#define REB_DERIVATIVES_LIST \
+    X(lambda, lambda, NONE, pal) \
+    X(h, h, NONE, pal) \
+    X(k, k, NONE, pal) \
+    X(k_k, k, k, pal) \
+    X(h_h, h, h, pal) \
+    X(lambda_lambda, lambda, lambda, pal) \
+    X(k_lambda, k, lambda, pal) \
+    X(h_lambda, h, lambda, pal) \
+    X(k_h, k, h, pal) \
+    X(a, a, NONE, pal) \
+    X(a_a, a, a, pal) \
+    X(ix, ix, NONE, pal) \
+    X(ix_ix, ix, ix, pal) \
+    X(iy, iy, NONE, pal) \
+    X(iy_iy, iy, iy, pal) \
+    X(k_ix, k, ix, pal) \
+    X(h_ix, h, ix, pal) \
+    X(lambda_ix, lambda, ix, pal) \
+    X(lambda_iy, lambda, iy, pal) \
+    X(h_iy, h, iy, pal) \
+    X(k_iy, k, iy, pal) \
+    X(ix_iy, ix, iy, pal) \
+    X(a_ix, a, ix, pal) \
+    X(a_iy, a, iy, pal) \
+    X(a_lambda, a, lambda, pal) \
+    X(a_h, a, h, pal) \
+    X(a_k, a, k, pal) \
+    X(m, m, NONE, pal) \
+    X(m_a, m, a, pal) \
+    X(m_lambda, m, lambda, pal) \
+    X(m_h, m, h, pal) \
+    X(m_k, m, k, pal) \
+    X(m_ix, m, ix, pal) \
+    X(m_iy, m, iy, pal) \
+    X(m_m, m, m, pal) \
+    X(e, e, NONE, orbit) \
+    X(e_e, e, e, orbit) \
+    X(inc, inc, NONE, orbit) \
+    X(inc_inc, inc, inc, orbit) \
+    X(Omega, Omega, NONE, orbit) \
+    X(Omega_Omega, Omega, Omega, orbit) \
+    X(omega, omega, NONE, orbit) \
+    X(omega_omega, omega, omega, orbit) \
+    X(f, f, NONE, orbit) \
+    X(f_f, f, f, orbit) \
+    X(a_e, a, e, orbit) \
+    X(a_inc, a, inc, orbit) \
+    X(a_Omega, a, Omega, orbit) \
+    X(a_omega, a, omega, orbit) \
+    X(a_f, a, f, orbit) \
+    X(e_inc, e, inc, orbit) \
+    X(e_Omega, e, Omega, orbit) \
+    X(e_omega, e, omega, orbit) \
+    X(e_f, e, f, orbit) \
+    X(m_e, m, e, orbit) \
+    X(inc_Omega, inc, Omega, orbit) \
+    X(inc_omega, inc, omega, orbit) \
+    X(inc_f, inc, f, orbit) \
+    X(m_inc, m, inc, orbit) \
+    X(omega_Omega, omega, Omega, orbit) \
+    X(Omega_f, Omega, f, orbit) \
+    X(m_Omega, m, Omega, orbit) \
+    X(omega_f, omega, f, orbit) \
+    X(m_omega, m, omega, orbit) \
+    X(m_f, m, f, orbit)
+
+#define X(name, v1, v2, family) \
+struct reb_particle reb_derivatives_##name(double G, struct reb_particle primary, struct reb_particle po){ \
+    struct reb_derivatives_context c = reb_derivatives_context_new(G, primary, po); \
+    reb_derivatives_context_##family(&c); \
+    return reb_derivatives_##name##_context(&c); \
+}
+REB_DERIVATIVES_LIST
+#undef X
+
+static const struct {
+    enum REB_DERIVATIVES_PARAMETER v1;
+    enum REB_DERIVATIVES_PARAMETER v2;
+    void (*init)(struct reb_derivatives_context* const c);
+    struct reb_particle (*f)(const struct reb_derivatives_context* const c);
+} reb_derivatives_table[] = {
+#define X(name, v1, v2, family) {REB_DERIVATIVES_##v1, REB_DERIVATIVES_##v2, reb_derivatives_context_##family, reb_derivatives_##name##_context},
+REB_DERIVATIVES_LIST
+#undef X
+};
+
+int reb_derivatives_many(double G, struct reb_particle primary, struct reb_particle po, int N, const enum REB_DERIVATIVES_PARAMETER* const v1, const enum REB_DERIVATIVES_PARAMETER* const v2, struct reb_particle* const derivatives){
+    struct reb_derivatives_context c = reb_derivatives_context_new(G, primary, po);
+    const int N_table = sizeof(reb_derivatives_table)/sizeof(reb_derivatives_table[0]);
+    int N_unsupported = 0;
+    for (int i=0; i<N; i++){
+        enum REB_DERIVATIVES_PARAMETER p1 = v1[i];
+        enum REB_DERIVATIVES_PARAMETER p2 = v2?v2[i]:REB_DERIVATIVES_NONE;
+        if (p1==REB_DERIVATIVES_NONE || (p2!=REB_DERIVATIVES_NONE && p2<p1)){
+            // Mixed derivatives are symmetric.
+            enum REB_DERIVATIVES_PARAMETER tmp = p1;
+            p1 = p2;
+            p2 = tmp;
+        }
+        int j = 0;
+        while (j<N_table && (reb_derivatives_table[j].v1!=p1 || reb_derivatives_table[j].v2!=p2)){
+            j++;
+        }
+        if (j==N_table){
+            derivatives[i] = (struct reb_particle){0};
+            N_unsupported++;
+            continue;
+        }
+        reb_derivatives_table[j].init(&c);
+        derivatives[i] = reb_derivatives_table[j].f(&c);
+    }
+    return N_unsupported;
+}
@@ -41,6 +41,7 @@
 #include "display.h"
 #include "output.h"
 #include "integrator.h"
+#include "allocator.h"
 #define MAX(a, b) ((a) < (b) ? (b) : (a))       ///< Returns the maximum of a and b
 
 #ifdef OPENGL
@@ -75,6 +76,7 @@ static const char* onscreenhelp[] = {
                 " c       | Toggle clear screen after each time-step",
                 " m       | Toggle multisampling",
                 " w       | Draw orbits as wires",
+                " l/L     | Draw fewer/more particles (for large N)",
                 " t       | Show/hide logo, time, timestep and number ",
                 "         | of particles.",
                 "----------------------------------------------------"
@@ -374,6 +376,15 @@ static void reb_display_keyboard(GLFWwindow* window, int key, int scancode, int
             case 'W':
                 data->wire = !data->wire;
                 break;
+            case 'L':
+                data->lod_auto = 0;
+                if (mods!=GLFW_MOD_SHIFT){
+                    if (data->lod<30) data->lod++;
+                }else{
+                    if (data->lod>0) data->lod--;
+                }
+                printf("Drawing every %d-th particle.\n",1<<data->lod);
+                break;
             case 'T':
                 data->onscreentext = !data->onscreentext;
                 break;
@@ -425,7 +436,7 @@ static void reb_display(GLFWwindow* window){
     float tmp2[16];
     float tmp3[16];
     if (data->reference>=0){
-        struct reb_particle p = data->particles_copy[data->reference];
+        struct reb_particle p = data->r_copy->particles[data->reference];
         mattranslate(tmp2,-p.x,-p.y,-p.z);
         quat2mat(data->view,tmp1);
         matmult(tmp1,tmp2,view);
@@ -447,7 +458,7 @@ static void reb_display(GLFWwindow* window){
                 glUseProgram(data->sphere_shader_program);
                 glBindVertexArray(data->sphere_shader_particle_vao);
                 glUniformMatrix4fv(data->sphere_shader_mvp_location, 1, GL_TRUE, (GLfloat*) tmp2);
-                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, data->sphere_shader_vertex_count, data->r_copy->N);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, data->sphere_shader_vertex_count, data->N_draw);
                 glBindVertexArray(0);
                 glDisable(GL_DEPTH_TEST);
             }
@@ -458,7 +469,7 @@ static void reb_display(GLFWwindow* window){
                 glBindVertexArray(data->point_shader_particle_vao);
                 glUniform4f(data->point_shader_color_location, 1.,1.,0.,0.8);
                 glUniformMatrix4fv(data->point_shader_mvp_location, 1, GL_TRUE, (GLfloat*) tmp2);
-                glDrawArrays(GL_POINTS, 0, data->r_copy->N);
+                glDrawArrays(GL_POINTS, 0, data->N_draw);
                 glBindVertexArray(0);
             }
             if (data->wire){
@@ -466,7 +477,7 @@ static void reb_display(GLFWwindow* window){
                 glUseProgram(data->orbit_shader_program);
                 glBindVertexArray(data->orbit_shader_particle_vao);
                 glUniformMatrix4fv(data->orbit_shader_mvp_location, 1, GL_TRUE, (GLfloat*) tmp2);
-                glDrawArraysInstanced(GL_LINE_STRIP, 0, data->orbit_shader_vertex_count, data->r_copy->N-1);
+                glDrawArraysInstanced(GL_LINE_STRIP, 0, data->orbit_shader_vertex_count, data->N_orbits_draw);
                 glBindVertexArray(0);
             }
         }
@@ -517,9 +528,10 @@ static void reb_display(GLFWwindow* window){
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(val), val);
         glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, j);
         
-        if (data->r_copy->status == REB_RUNNING){
+        // The snapshot is not updated while the simulation is paused.
+        if (data->r->status == REB_RUNNING){
             sprintf(str, "Simulation is running  ");
-        }else if (data->r_copy->status == REB_RUNNING_PAUSED){
+        }else if (data->r->status == REB_RUNNING_PAUSED){
             sprintf(str, "Simulation is paused   ");
         }
         glUniform1f(data->simplefont_shader_ypos_location, ypos++);
@@ -533,7 +545,11 @@ static void reb_display(GLFWwindow* window){
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(val), val);
         glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, j);
         
-        sprintf(str, "N = %d ",data->r_copy->N);
+        if (data->lod>0){
+            sprintf(str, "N = %d (every %d-th drawn) ",data->r_copy->N,1<<data->lod);
+        }else{
+            sprintf(str, "N = %d ",data->r_copy->N);
+        }
         glUniform1f(data->simplefont_shader_ypos_location, ypos++);
         j = convertLine(str,val);
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(val), val);
@@ -621,9 +637,9 @@ void reb_display_init(struct reb_simulation * const r){
     data->clear         = 1; 
     data->ghostboxes    = 0; 
     data->reference     = -1;
+    data->lod           = 0;
+    data->lod_auto      = 1;
     data->view.w        = 1.;
-    data->p_jh_copy      = NULL;
-    data->allocated_N_whfast = 0;
 
     glfwSetKeyCallback(window,reb_display_keyboard);
     glfwGetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS);
@@ -777,36 +793,30 @@ void reb_display_init(struct reb_simulation * const r){
         const char* vertex_shader =
             "#version 330\n"
             "in vec3 focus;\n"
-            "in vec3 aef;\n"
-            "in vec3 omegaOmegainc;\n"
+            "in vec3 dx;\n"
+            "in vec3 dv;\n"
+            "in float gm;\n"
             "in float lintwopi;\n"
             "out float lin;\n"
             "uniform mat4 mvp;\n"
             "const float M_PI = 3.14159265359;\n"
             "void main() {\n"
-            "   float a = aef.x;\n"
-            "   float e = aef.y;\n"
-            "   float f = aef.z+lintwopi;\n"
+            "   vec3 h = cross(dx,dv);\n"
+            "   float d = length(dx);\n"
+            "   vec3 ev = cross(dv,h)/gm - dx/d;\n"          // Eccentricity vector
+            "   float e = length(ev);\n"
+            "   float p = dot(h,h)/gm;\n"                   // Semi-latus rectum a(1-e^2)
+            "   vec3 P = e>1e-6 ? ev/e : dx/d;\n"           // Basis of the orbital plane, P points to pericentre
+            "   vec3 Q = normalize(cross(h,P));\n"
+            "   float f = atan(dot(dx,Q),dot(dx,P))+lintwopi;\n"
             "   lin = lintwopi/(M_PI*2.);\n"
             "   if (e>1.){\n"
             "       float theta_max = acos(-1./e);\n"
             "       f = 0.0001-theta_max+1.9998*lin*theta_max;\n"
             "       lin = sqrt(min(0.5,lin));\n"
             "   }\n"
-            "   float omega = omegaOmegainc.x;\n"
-            "   float Omega = omegaOmegainc.y;\n"
-            "   float inc = omegaOmegainc.z;\n"
-            "   float r = a*(1.-e*e)/(1. + e*cos(f));\n"
-            "   float cO = cos(Omega);\n"
-            "   float sO = sin(Omega);\n"
-            "   float co = cos(omega);\n"
-            "   float so = sin(omega);\n"
-            "   float cf = cos(f);\n"
-            "   float sf = sin(f);\n"
-            "   float ci = cos(inc);\n"
-            "   float si = sin(inc);\n"
-            "   vec3 pos = vec3(r*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci),r*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci),+ r*(so*cf+co*sf)*si);\n"
-            "    gl_Position = mvp*(vec4(focus+pos, 1.0));\n"
+            "   float r = p/(1. + e*cos(f));\n"
+            "   gl_Position = mvp*(vec4(focus+r*(cos(f)*P+sin(f)*Q), 1.0));\n"
             "}\n";
         const char* fragment_shader =
             "#version 330\n"
@@ -977,10 +987,12 @@ void reb_display_init(struct reb_simulation * const r){
     glEnableVertexAttribArray(olintwopip);
     GLuint ofocusp = glGetAttribLocation(data->orbit_shader_program,"focus");
     glEnableVertexAttribArray(ofocusp);
-    GLuint oaefp = glGetAttribLocation(data->orbit_shader_program,"aef");
-    glEnableVertexAttribArray(oaefp);
-    GLuint oomegaOmegaincp = glGetAttribLocation(data->orbit_shader_program,"omegaOmegainc");
-    glEnableVertexAttribArray(oomegaOmegaincp);
+    GLuint odxp = glGetAttribLocation(data->orbit_shader_program,"dx");
+    glEnableVertexAttribArray(odxp);
+    GLuint odvp = glGetAttribLocation(data->orbit_shader_program,"dv");
+    glEnableVertexAttribArray(odvp);
+    GLuint ogmp = glGetAttribLocation(data->orbit_shader_program,"gm");
+    glEnableVertexAttribArray(ogmp);
    
     data->orbit_shader_vertex_count = 500;
     float* lin_data = malloc(sizeof(float)*data->orbit_shader_vertex_count);
@@ -998,15 +1010,17 @@ void reb_display_init(struct reb_simulation * const r){
     GLuint orbit_buffer;
     glGenBuffers(1, &orbit_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, orbit_buffer);
-    glVertexAttribPointer(ofocusp, 3, GL_FLOAT, GL_FALSE, sizeof(float)*9, NULL);
-    glVertexAttribPointer(oaefp, 3, GL_FLOAT, GL_FALSE, sizeof(float)*9, (void*)(sizeof(float)*3));
-    glVertexAttribPointer(oomegaOmegaincp, 3, GL_FLOAT, GL_FALSE, sizeof(float)*9, (void*)(sizeof(float)*6));
+    glVertexAttribPointer(ofocusp, 3, GL_FLOAT, GL_FALSE, sizeof(struct reb_orbit_opengl), NULL);
+    glVertexAttribPointer(odxp, 3, GL_FLOAT, GL_FALSE, sizeof(struct reb_orbit_opengl), (void*)(sizeof(float)*3));
+    glVertexAttribPointer(odvp, 3, GL_FLOAT, GL_FALSE, sizeof(struct reb_orbit_opengl), (void*)(sizeof(float)*6));
+    glVertexAttribPointer(ogmp, 1, GL_FLOAT, GL_FALSE, sizeof(struct reb_orbit_opengl), (void*)(sizeof(float)*9));
 
     glVertexAttribDivisor(olintwopip, 0); 
     glVertexAttribDivisor(data->orbit_shader_mvp_location, 0); 
     glVertexAttribDivisor(ofocusp, 1);
-    glVertexAttribDivisor(oaefp, 1);
-    glVertexAttribDivisor(oomegaOmegaincp, 1);
+    glVertexAttribDivisor(odxp, 1);
+    glVertexAttribDivisor(odvp, 1);
+    glVertexAttribDivisor(ogmp, 1);
     
     glBindVertexArray(0);
 
@@ -1014,10 +1028,8 @@ void reb_display_init(struct reb_simulation * const r){
 
     // Main display loop
     while(!glfwWindowShouldClose(window) && r->status<0){
-        // lock mutex for update
-        pthread_mutex_lock(&(data->mutex));    
+        // Take the latest snapshot published by the compute thread (never waits).
         int size_changed = reb_display_copy_data(r);
-        pthread_mutex_unlock(&(data->mutex));  
 
         // prepare data (incl orbit calculation)
         reb_display_prepare_data(r, data->wire);
@@ -1030,9 +1042,9 @@ void reb_display_init(struct reb_simulation * const r){
             glBufferData(GL_ARRAY_BUFFER, data->allocated_N*sizeof(struct reb_orbit_opengl), NULL, GL_STATIC_DRAW);
         }
         glBindBuffer(GL_ARRAY_BUFFER, particle_buffer);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, data->r_copy->N*sizeof(struct reb_particle_opengl), data->particle_data);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, data->N_draw*sizeof(struct reb_particle_opengl), data->particle_data);
         glBindBuffer(GL_ARRAY_BUFFER, orbit_buffer);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, (data->r_copy->N-1)*sizeof(struct reb_orbit_opengl), data->orbit_data);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, data->N_orbits_draw*sizeof(struct reb_orbit_opengl), data->orbit_data);
 
         // Do actual drawing
         reb_display(window);
@@ -1069,77 +1081,115 @@ void reb_display_init_data(struct reb_simulation* const r){
     if (r->display_data==NULL){
         r->display_data = calloc(sizeof(struct reb_display_data),1);
         r->display_data->r = r;
-        if (pthread_mutex_init(&(r->display_data->mutex), NULL)){
-            reb_error(r,"Mutex creation failed.");
-        }
+        r->display_data->buffer_back = 0;
+        r->display_data->buffer_front = 1;
+        r->display_data->buffer_ready = 2;
+        r->display_data->frame_interval = REB_DISPLAY_FRAME_INTERVAL;
         reb_display_set_default_scale(r);
     }
+    // The compute thread has not started yet. Make sure there is something to draw.
+    reb_display_publish_data(r, 1);
+}
+
+static void reb_display_buffer_copy(struct reb_display_buffer* const b, const struct reb_simulation* const r){
+    if (r->N>b->allocated_N){
+        b->allocated_N = r->N;
+        b->particles = reb_reserve(b->particles,b->allocated_N*sizeof(struct reb_particle));
+    }
+    memcpy(&b->r, r, sizeof(struct reb_simulation));
+    memcpy(b->particles, r->particles, sizeof(struct reb_particle)*r->N);
+    b->r.particles = b->particles;
+    if (r->integrator==REB_INTEGRATOR_WHFAST && r->ri_whfast.is_synchronized==0){
+        // The display thread synchronizes its copy.
+        if (r->ri_whfast.allocated_N > b->allocated_N_whfast){
+            b->allocated_N_whfast = r->ri_whfast.allocated_N;
+            b->p_jh = reb_reserve(b->p_jh,b->allocated_N_whfast*sizeof(struct reb_particle));
+        }
+        memcpy(b->p_jh, r->ri_whfast.p_jh, r->ri_whfast.allocated_N*sizeof(struct reb_particle));
+    }
+    b->r.ri_whfast.p_jh = b->p_jh;
+}
+
+void reb_display_publish_data(struct reb_simulation* const r, int force){
+    struct reb_display_data* data = r->display_data;
+    struct timeval tim;
+    gettimeofday(&tim, NULL);
+    unsigned long milis = (tim.tv_sec+(tim.tv_usec/1000000.0))*1000;
+    if (!force && milis - data->buffer_clock < REB_DISPLAY_BUFFER_INTERVAL){
+        // The display thread would not draw more frames than this anyway.
+        return;
+    }
+    data->buffer_clock = milis;
+    reb_display_buffer_copy(&data->buffers[data->buffer_back], r);
+    // Swap the back buffer with the ready buffer. The display thread picks it up with its next frame.
+    data->buffer_back = __atomic_exchange_n(&data->buffer_ready, data->buffer_back | REB_DISPLAY_BUFFER_NEW, __ATOMIC_ACQ_REL) & ~REB_DISPLAY_BUFFER_NEW;
 }
 
 int reb_display_copy_data(struct reb_simulation* const r){
-    if (r->N==0) return 0;
     struct reb_display_data* data = r->display_data;
+    if (__atomic_load_n(&data->buffer_ready, __ATOMIC_ACQUIRE) & REB_DISPLAY_BUFFER_NEW){
+        // Swap the front buffer with the ready buffer. The compute thread never writes to the front buffer.
+        data->buffer_front = __atomic_exchange_n(&data->buffer_ready, data->buffer_front, __ATOMIC_ACQ_REL) & ~REB_DISPLAY_BUFFER_NEW;
+    }
+    data->r_copy = &data->buffers[data->buffer_front].r;
     int size_changed = 0;
-    if (r->N>data->allocated_N){
+    if (data->r_copy->N>data->allocated_N){
         size_changed = 1;
-        data->allocated_N = r->N;
-        data->r_copy = realloc(data->r_copy,sizeof(struct reb_simulation));
-        data->particles_copy = realloc(data->particles_copy,r->N*sizeof(struct reb_particle));
+        data->allocated_N = data->r_copy->N;
         data->particle_data = realloc(data->particle_data, data->allocated_N*sizeof(struct reb_particle_opengl));
         data->orbit_data = realloc(data->orbit_data, data->allocated_N*sizeof(struct reb_orbit_opengl));
     }
-    memcpy(data->r_copy, r, sizeof(struct reb_simulation));
-    memcpy(data->particles_copy, r->particles, sizeof(struct reb_particle)*r->N);
-    data->r_copy->particles = data->particles_copy;
-    if (
-            (r->integrator==REB_INTEGRATOR_WHFAST && r->ri_whfast.is_synchronized==0)
-       )
-       {
-        if (r->ri_whfast.allocated_N > data->allocated_N_whfast){
-            size_changed = 1;
-            data->allocated_N_whfast = r->ri_whfast.allocated_N;
-            data->p_jh_copy = realloc(data->p_jh_copy,data->allocated_N_whfast*sizeof(struct reb_particle));
-        }
-        memcpy(data->p_jh_copy, r->ri_whfast.p_jh, data->allocated_N_whfast*sizeof(struct reb_particle));
-    }
-    data->r_copy->ri_whfast.p_jh= data->p_jh_copy;
-    
     return size_changed;
 }
 
 void reb_display_prepare_data(struct reb_simulation* const r, int orbits){
-    if (r->N==0) return;
     struct reb_display_data* data = r->display_data;
     struct reb_simulation* const r_copy = data->r_copy;
+    data->N_draw = 0;
+    data->N_orbits_draw = 0;
+    if (r_copy->N==0) return;
 
     // this only does something for WHFAST
     reb_integrator_synchronize(r_copy);
+
+    if (data->lod_auto){
+        data->lod = 0;
+        while ((r_copy->N>>data->lod) > REB_DISPLAY_N_MAX){
+            data->lod++;
+        }
+    }
+    const int stride = 1<<data->lod;
        
     // Update data on GPU 
-    for (int i=0;i<r_copy->N;i++){
+    for (int i=0;i<r_copy->N;i+=stride){
         struct reb_particle p = r_copy->particles[i];
-        data->particle_data[i].x  = p.x;
-        data->particle_data[i].y  = p.y;
-        data->particle_data[i].z  = p.z;
-        data->particle_data[i].vx = p.vx;
-        data->particle_data[i].vy = p.vy;
-        data->particle_data[i].vz = p.vz;
-        data->particle_data[i].r  = p.r;
+        struct reb_particle_opengl* const pd = &data->particle_data[data->N_draw++];
+        pd->x  = p.x;
+        pd->y  = p.y;
+        pd->z  = p.z;
+        pd->vx = p.vx;
+        pd->vy = p.vy;
+        pd->vz = p.vz;
+        pd->r  = p.r;
     }
     if (orbits){
+        // Only the state vectors are uploaded. The orbits are calculated in the vertex shader.
         struct reb_particle com = r_copy->particles[0];
         for (int i=1;i<r_copy->N;i++){
             struct reb_particle p = r_copy->particles[i];
-            data->orbit_data[i-1].x  = com.x;
-            data->orbit_data[i-1].y  = com.y;
-            data->orbit_data[i-1].z  = com.z;
-            struct reb_orbit o = reb_tools_particle_to_orbit(r_copy->G, p,com);
-            data->orbit_data[i-1].a = o.a;
-            data->orbit_data[i-1].e = o.e;
-            data->orbit_data[i-1].f = o.f;
-            data->orbit_data[i-1].omega = o.omega;
-            data->orbit_data[i-1].Omega = o.Omega;
-            data->orbit_data[i-1].inc = o.inc;
+            if (i%stride==0){
+                struct reb_orbit_opengl* const od = &data->orbit_data[data->N_orbits_draw++];
+                od->x  = com.x;
+                od->y  = com.y;
+                od->z  = com.z;
+                od->dx  = p.x-com.x;
+                od->dy  = p.y-com.y;
+                od->dz  = p.z-com.z;
+                od->dvx = p.vx-com.vx;
+                od->dvy = p.vy-com.vy;
+                od->dvz = p.vz-com.vz;
+                od->gm = r_copy->G*(p.m+com.m);
+            }
             com = reb_get_com_of_pair(p,com);
         }
     }
@@ -1147,6 +1197,46 @@ void reb_display_prepare_data(struct reb_simulation* const r, int orbits){
 
 
 
+int reb_display_prepare_frame(struct reb_simulation* const r, int orbits, int max_N, int force){
+    struct reb_display_data* data = r->display_data;
+    struct timeval tim;
+    gettimeofday(&tim, NULL);
+    unsigned long milis = (tim.tv_sec+(tim.tv_usec/1000000.0))*1000;
+    if (!force && milis - data->frame_clock < data->frame_interval){
+        // Frames are not sent more often than they can be shown. The 
+        // integration continues without copying any data.
+        return 0;
+    }
+    data->frame_clock = milis;
+    // There is no separate display thread. Publish a snapshot and take it right away.
+    reb_display_publish_data(r, 1);
+    reb_display_copy_data(r);
+    data->lod_auto = 0;
+    data->lod = 0;
+    while (max_N>0 && (data->r_copy->N>>data->lod) > max_N){
+        data->lod++;
+    }
+    reb_display_prepare_data(r, orbits);
+
+    const uint32_t N_draw = data->N_draw;
+    const uint32_t N_orbits_draw = orbits?data->N_orbits_draw:0;
+    data->frame_size = 2*sizeof(uint32_t) + sizeof(float)*(3*N_draw + 10*N_orbits_draw);
+    if (data->frame_size>data->frame_allocated){
+        data->frame_allocated = data->frame_size;
+        data->frame = realloc(data->frame, data->frame_allocated);
+    }
+    memcpy(data->frame, &N_draw, sizeof(uint32_t));
+    memcpy(data->frame+sizeof(uint32_t), &N_orbits_draw, sizeof(uint32_t));
+    float* const pos = (float*)(data->frame+2*sizeof(uint32_t));
+    for (unsigned int i=0;i<N_draw;i++){
+        pos[3*i+0] = data->particle_data[i].x;
+        pos[3*i+1] = data->particle_data[i].y;
+        pos[3*i+2] = data->particle_data[i].z;
+    }
+    memcpy(pos+3*N_draw, data->orbit_data, sizeof(float)*10*N_orbits_draw);
+    return 1;
+}
+
 void reb_check_for_display_heartbeat(struct reb_simulation* const r){
     if (r->display_heartbeat){                          // Display Heartbeat
         struct timeval tim;
@@ -38,8 +38,48 @@ void reb_check_for_display_heartbeat(struct reb_simulation* const r);
  */
 void reb_display_init(struct reb_simulation* const r);
 
+/**
+ * @brief Flag set in reb_display_data.buffer_ready if the buffer holds a snapshot not yet drawn.
+ */
+#define REB_DISPLAY_BUFFER_NEW 4
+
+/**
+ * @brief Minimum time in ms between two snapshots published by the compute thread.
+ */
+#define REB_DISPLAY_BUFFER_INTERVAL 16
+
+/**
+ * @brief Maximum number of particles drawn if the level of detail is chosen automatically.
+ */
+#ifndef REB_DISPLAY_N_MAX
+#define REB_DISPLAY_N_MAX 100000
+#endif // REB_DISPLAY_N_MAX
+
 void reb_display_init_data(struct reb_simulation* const r);
+/**
+ * @brief Copies the simulation into the back buffer and hands it to the display thread.
+ * @details Called by the compute thread. Does nothing if the last snapshot is less than 
+ * REB_DISPLAY_BUFFER_INTERVAL ms old, unless force is set. Never waits for the display thread.
+ */
+void reb_display_publish_data(struct reb_simulation* const r, int force);
+/**
+ * @brief Makes the latest published snapshot available in r_copy.
+ * @details Called by the display thread. Returns 1 if the particle buffers had to be reallocated.
+ */
 int reb_display_copy_data(struct reb_simulation* const r);
 void reb_display_prepare_data(struct reb_simulation* const r, int orbits);
+/**
+ * @brief Default minimum time in ms between two frames prepared for the WebGL widget.
+ */
+#define REB_DISPLAY_FRAME_INTERVAL 50
+/**
+ * @brief Prepares a compact frame for the WebGL widget in frame.
+ * @details The frame consists of two uint32 (number of particles and orbits), 
+ * the float32 positions of the particles (3 per particle) and the orbit data 
+ * (10 float32 per orbit, only if orbits is set). At most max_N particles are 
+ * included (every 2^lod-th particle, 0: no limit). Returns 0 and does nothing 
+ * if the last frame is less than frame_interval ms old, unless force is set.
+ */
+int reb_display_prepare_frame(struct reb_simulation* const r, int orbits, int max_N, int force);
 
 #endif
@@ -0,0 +1,744 @@
+/**
+ * @file    ensemble.c
+ * @brief   Integrate many simulations in lockstep.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details An ensemble advances many independent simulations together.
+ * This is useful when each simulation has only a few particles, for example
+ * when creating stability maps. WHFast simulations which use the same
+ * settings are advanced in lockstep and their Kepler steps are solved
+ * for several simulations at a time. All other simulations are advanced
+ * one after the other with reb_step().
+ * reb_ensemble_run() creates and integrates many simulations on a pool
+ * of threads. This is useful for parameter sweeps.
+ *
+ * @section LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rebound.h"
+#include "ensemble.h"
+#include "gravity.h"
+#include "particle.h"
+#include "display.h"
+#include "simulationarchive.h"
+#include "integrator.h"
+#include "integrator_whfast.h"
+#include "forces.h"
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
+#define REB_ENSEMBLE_CHUNK 64   ///< Number of simulations integrated together by reb_ensemble_integrate
+
+struct reb_ensemble* reb_create_ensemble(struct reb_simulation** const simulations, const int N){
+    struct reb_ensemble* e = calloc(1,sizeof(struct reb_ensemble));
+    reb_init_ensemble(e, simulations, N);
+    return e;
+}
+
+void reb_init_ensemble(struct reb_ensemble* const e, struct reb_simulation** const simulations, const int N){
+    e->N = N;
+    e->simulations = malloc(sizeof(struct reb_simulation*)*N);
+    memcpy(e->simulations, simulations, sizeof(struct reb_simulation*)*N);
+    e->running = malloc(sizeof(struct reb_simulation*)*N);
+}
+
+void reb_free_ensemble_pointers(struct reb_ensemble* const e){
+    free(e->simulations);
+    e->simulations = NULL;
+    free(e->running);
+    e->running = NULL;
+    e->N = 0;
+}
+
+void reb_free_ensemble(struct reb_ensemble* const e){
+    reb_free_ensemble_pointers(e);
+    free(e);
+}
+
+// Returns 1 if the simulation does not need anything from reb_step()
+// beyond what the lockstep WHFast step provides.
+static int reb_ensemble_lockstep_possible(struct reb_simulation* const r){
+    return r->pre_timestep_modifications == NULL
+        && r->post_timestep_modifications == NULL
+        && r->boundary == REB_BOUNDARY_NONE
+        && r->collision == REB_COLLISION_NONE
+        && r->gravity != REB_GRAVITY_TREE
+        && r->gravity != REB_GRAVITY_FMM
+        && r->tree_needs_update == 0
+        && r->N > 0;
+}
+
+// Advances the N simulations rs by one step each. The array rs is reordered.
+static void reb_ensemble_step_simulations(struct reb_simulation** const rs, const int N){
+    // Move all simulations which can be advanced in lockstep with the first
+    // compatible simulation to the front.
+    struct reb_simulation* r0 = NULL;
+    int K = 0;
+    for (int k=0;k<N;k++){
+        struct reb_simulation* const r = rs[k];
+        if (reb_ensemble_lockstep_possible(r) && reb_integrator_whfast_ensemble_compatible(r, r0)){
+            if (r0 == NULL){
+                r0 = r;
+            }
+            rs[k] = rs[K];
+            rs[K] = r;
+            K++;
+        }
+    }
+
+    if (K>1){
+        struct timeval time_beginning;
+        gettimeofday(&time_beginning,NULL);
+
+        reb_integrator_whfast_part1_ensemble(rs, K);
+        for (int k=0;k<K;k++){
+            struct reb_simulation* const r = rs[k];
+            reb_calculate_acceleration(r);
+            if (r->additional_forces) r->additional_forces(r);
+            reb_calculate_registered_forces(r);
+        }
+        reb_integrator_whfast_part2_ensemble(rs, K);
+
+        struct timeval time_end;
+        gettimeofday(&time_end,NULL);
+        const double walltime = time_end.tv_sec-time_beginning.tv_sec+(time_end.tv_usec-time_beginning.tv_usec)/1e6;
+        for (int k=0;k<K;k++){
+            rs[k]->walltime += walltime/K;
+            rs[k]->steps_done++;
+        }
+    }else{
+        K = 0;
+    }
+
+    for (int k=K;k<N;k++){
+        reb_step(rs[k]);
+    }
+}
+
+void reb_ensemble_step(struct reb_ensemble* const e){
+    memcpy(e->running, e->simulations, sizeof(struct reb_simulation*)*e->N);
+    reb_ensemble_step_simulations(e->running, e->N);
+}
+
+// Integrates the N simulations to tmax. running is a work array of size N.
+// Does not reset reb_sigint, so it can be called from several threads.
+static void reb_ensemble_integrate_simulations(struct reb_simulation** const simulations, struct reb_simulation** const running, const int N, const double tmax){
+    double* const last_full_dt = malloc(sizeof(double)*N);
+    for (int k=0;k<N;k++){
+        struct reb_simulation* const r = simulations[k];
+        last_full_dt[k] = r->dt; // need to store r->dt in case timestep gets artificially shrunk to meet exact_finish_time=1
+        r->dt_last_done = 0.; // Reset in case first timestep attempt will fail
+        if (r->testparticle_hidewarnings==0 && reb_particle_check_testparticles(r)){
+            reb_warning(r,"At least one test particle (type 0) has finite mass. This might lead to unexpected behaviour. Set testparticle_hidewarnings=1 to hide this warning.");
+        }
+        r->status = REB_RUNNING;
+        reb_run_heartbeat(r);
+    }
+
+    // The simulations are independent. Integrating a few of them at a time 
+    // all the way to tmax keeps them in the cache.
+    for (int k_start=0;k_start<N;k_start+=REB_ENSEMBLE_CHUNK){
+        const int k_end = MIN(k_start+REB_ENSEMBLE_CHUNK, N);
+        while(1){
+            // Simulations which have finished or encountered an error are not advanced any further.
+            int N_running = 0;
+            for (int k=k_start;k<k_end;k++){
+                struct reb_simulation* const r = simulations[k];
+                if (reb_sigint == 1 && r->status < 0){
+                    r->status = REB_EXIT_SIGINT;
+                }
+                if (reb_check_exit(r,tmax,&last_full_dt[k])<0){
+                    running[N_running++] = r;
+                }
+            }
+            if (N_running==0){
+                break;
+            }
+            for (int k=0;k<N_running;k++){
+                struct reb_simulation* const r = running[k];
+                if (r->simulationarchive_filename || r->simulationarchive_checkpoint_filename){ reb_simulationarchive_heartbeat(r);}
+            }
+            reb_ensemble_step_simulations(running, N_running);
+            for (int k=0;k<N_running;k++){
+                reb_run_heartbeat(running[k]);
+            }
+        }
+    }
+
+    for (int k=0;k<N;k++){
+        struct reb_simulation* const r = simulations[k];
+        reb_integrator_synchronize(r);
+        if(r->exact_finish_time==1){ // if finish_time = 1, r->dt could have been shrunk, so set to the last full timestep
+            r->dt = last_full_dt[k];
+        }
+        if (r->simulationarchive_filename || r->simulationarchive_checkpoint_filename){ reb_simulationarchive_heartbeat(r);}
+        reb_simulationarchive_writer_flush(r);
+    }
+    free(last_full_dt);
+}
+
+void reb_ensemble_integrate(struct reb_ensemble* const e, const double tmax){
+    reb_sigint = 0;
+    signal(SIGINT, reb_sigint_handler);
+    reb_ensemble_integrate_simulations(e->simulations, e->running, e->N, tmax);
+}
+
+// Thread pool for reb_ensemble_run
+struct reb_ensemble_pool {
+    const struct reb_simulation* template_simulation; // Copied for each simulation (NULL if there is none)
+    int N;
+    void (*setup)(struct reb_simulation* const r, const int index, void* data);
+    void* data;
+    double tmax;
+    struct reb_ensemble_result* results;
+    struct reb_simulation** simulations;
+    pthread_mutex_t mutex;  // Protects next and N_done
+    int next;               // Index of the next simulation to be integrated
+    int N_done;
+};
+
+// Same as reb_integrate() but reb_sigint is not reset, so that an
+// interrupt stops all threads of the pool.
+void reb_ensemble_run_simulation(struct reb_simulation* const r, const double tmax){
+    double last_full_dt = r->dt; // need to store r->dt in case timestep gets artificially shrunk to meet exact_finish_time=1
+    r->dt_last_done = 0.; // Reset in case first timestep attempt will fail
+    if (r->testparticle_hidewarnings==0 && reb_particle_check_testparticles(r)){
+        reb_warning(r,"At least one test particle (type 0) has finite mass. This might lead to unexpected behaviour. Set testparticle_hidewarnings=1 to hide this warning.");
+    }
+    r->status = REB_RUNNING;
+    reb_run_heartbeat(r);
+    while(reb_check_exit(r,tmax,&last_full_dt)<0){
+        if (r->simulationarchive_filename || r->simulationarchive_checkpoint_filename){ reb_simulationarchive_heartbeat(r);}
+        reb_step_batch(r, tmax); 
+        reb_run_heartbeat(r);
+        if (reb_sigint == 1){
+            r->status = REB_EXIT_SIGINT;
+        }
+    }
+    reb_integrator_synchronize(r);
+    if(r->exact_finish_time==1){ // if finish_time = 1, r->dt could have been shrunk, so set to the last full timestep
+        r->dt = last_full_dt; 
+    }
+    if (r->simulationarchive_filename || r->simulationarchive_checkpoint_filename){ reb_simulationarchive_heartbeat(r);}
+    reb_simulationarchive_writer_flush(r);
+}
+
+static void reb_ensemble_set_result(struct reb_ensemble_result* const result, struct reb_simulation* const r, const double walltime){
+    result->status = r->status;
+    result->t = r->t;
+    result->megno = r->calculate_megno?reb_tools_calculate_megno(r):nan("");
+    result->lyapunov = r->calculate_megno?reb_tools_calculate_lyapunov(r):nan("");
+    result->walltime = walltime;
+}
+
+static void reb_ensemble_init_results(struct reb_ensemble_result* const results, const int N){
+    for (int i=0;i<N;i++){
+        results[i].status = REB_EXIT_SIGINT;
+        results[i].t = nan("");
+        results[i].megno = nan("");
+        results[i].lyapunov = nan("");
+        results[i].walltime = 0.;
+    }
+}
+
+static void* reb_ensemble_run_thread(void* args){
+    struct reb_ensemble_pool* const pool = (struct reb_ensemble_pool*)args;
+    while (1){
+        // Simulations are handed out one at a time, so threads which 
+        // finish early pick up the remaining work.
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->next>=pool->N || reb_sigint){
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        const int i = pool->next++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        struct reb_simulation* r = pool->simulations?pool->simulations[i]:NULL;
+        const int owned = (r==NULL);
+        if (owned){
+            r = reb_create_simulation();
+        }
+
+        if (pool->template_simulation){
+            // The template is only read. Threads can copy it concurrently.
+            // Function pointers are not copied and need to be set in the setup function.
+            reb_copy_simulation_into(r, pool->template_simulation);
+        }
+
+        if (pool->setup){
+            pool->setup(r, i, pool->data);
+        }
+        if (reb_sigint){ // Interrupted during setup
+            if (pool->simulations){
+                pool->simulations[i] = r;
+            }else if (owned){
+                reb_free_simulation(r);
+            }
+            return NULL;
+        }
+        struct timeval time_beginning;
+        gettimeofday(&time_beginning,NULL);
+        reb_ensemble_run_simulation(r, pool->tmax);
+        struct timeval time_end;
+        gettimeofday(&time_end,NULL);
+
+        if (pool->results){
+            reb_ensemble_set_result(&pool->results[i], r, time_end.tv_sec-time_beginning.tv_sec+(time_end.tv_usec-time_beginning.tv_usec)/1e6);
+        }
+        if (pool->simulations){
+            pool->simulations[i] = r;
+        }else if (owned){
+            reb_free_simulation(r);
+        }
+        pthread_mutex_lock(&pool->mutex);
+        pool->N_done++;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+int reb_ensemble_run(struct reb_simulation* const template_simulation, const int N, void (*setup)(struct reb_simulation* const r, const int index, void* data), void* data, const double tmax, int N_threads, struct reb_ensemble_result* const results, struct reb_simulation** const simulations){
+    if (N<=0){
+        return 0;
+    }
+    struct reb_ensemble_pool pool = {
+        .template_simulation = template_simulation,
+        .N = N,
+        .setup = setup,
+        .data = data,
+        .tmax = tmax,
+        .results = results,
+        .simulations = simulations,
+        .next = 0,
+        .N_done = 0,
+    };
+    if (results){
+        reb_ensemble_init_results(results, N);
+    }
+    pthread_mutex_init(&pool.mutex, NULL);
+    reb_sigint = 0;
+    signal(SIGINT, reb_sigint_handler);
+
+    if (N_threads<=0){
+        N_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    N_threads = MIN(N_threads, N);
+    if (N_threads<1) N_threads = 1;
+    pthread_t* const pthreads = malloc(sizeof(pthread_t)*N_threads);
+    int* const started = calloc(N_threads, sizeof(int));
+    for (int k=1;k<N_threads;k++){
+        started[k] = pthread_create(&pthreads[k], NULL, reb_ensemble_run_thread, &pool)==0;
+    }
+    // The calling thread works as well. If a thread could not be 
+    // created, the other threads do its work.
+    reb_ensemble_run_thread(&pool);
+    for (int k=1;k<N_threads;k++){
+        if (started[k]){
+            pthread_join(pthreads[k], NULL);
+        }
+    }
+    free(started);
+    free(pthreads);
+    pthread_mutex_destroy(&pool.mutex);
+    return pool.N_done;
+}
+
+// Copies the first N_particles real particles of r. Missing particles are zero.
+static void reb_ensemble_store_particles(const struct reb_simulation* const r, struct reb_particle* const particles, const int N_particles){
+    for (int j=0;j<N_particles;j++){
+        particles[j] = j<r->N-r->N_var?r->particles[j]:(struct reb_particle){0};
+        particles[j].sim = NULL;
+        particles[j].ap = NULL;
+    }
+}
+
+// Reads the result of a simulation which has been saved to the SimulationArchive 
+// name by an earlier run. If particles is not NULL, the first N_particles 
+// particles are stored there. Returns 0 if there is no such SimulationArchive.
+static int reb_ensemble_result_from_file(const char* const name, struct reb_ensemble_result* const result, struct reb_particle* const particles, const int N_particles){
+    if (access(name, F_OK)!=0){
+        return 0;
+    }
+    struct reb_simulation* const r = reb_create_simulation_from_binary((char*)name);
+    if (r==NULL){
+        return 0;
+    }
+    reb_ensemble_set_result(result, r, 0.);
+    if (particles){
+        reb_ensemble_store_particles(r, particles, N_particles);
+    }
+    reb_free_simulation(r);
+    return 1;
+}
+
+// Work shared by the threads of reb_ensemble_sweep
+struct reb_ensemble_sweep {
+    const struct reb_simulation* template_simulation;
+    int N;
+    const struct reb_ensemble_parameter* parameters;
+    int N_parameters;
+    double tmax;
+    struct reb_ensemble_result* results;
+    struct reb_particle* particles;
+    int N_particles;        // Number of real particles in the template
+    const char* filename;
+    pthread_mutex_t mutex;  // Protects next and N_done
+    int next;               // Index of the first simulation of the next chunk
+    int N_done;
+};
+
+// Sets the parameters of the i-th simulation. Masses, radii and coordinates
+// are set first, so that orbital elements use the new masses. Returns 0 on 
+// success and the error code of reb_tools_orbit_to_particle_err otherwise.
+static int reb_ensemble_set_parameters(struct reb_simulation* const r, const struct reb_ensemble_parameter* const parameters, const int N_parameters, const int i){
+    // The coordinates of the integrator are recalculated from the new particles.
+    reb_integrator_synchronize(r);
+    for (int k=0;k<N_parameters;k++){
+        const struct reb_ensemble_parameter* const parameter = &parameters[k];
+        struct reb_particle* const p = &r->particles[parameter->particle];
+        const double value = parameter->values[i];
+        switch (parameter->type){
+            case REB_ENSEMBLE_PARAMETER_MASS:   p->m  = value; break;
+            case REB_ENSEMBLE_PARAMETER_RADIUS: p->r  = value; break;
+            case REB_ENSEMBLE_PARAMETER_X:      p->x  = value; break;
+            case REB_ENSEMBLE_PARAMETER_Y:      p->y  = value; break;
+            case REB_ENSEMBLE_PARAMETER_Z:      p->z  = value; break;
+            case REB_ENSEMBLE_PARAMETER_VX:     p->vx = value; break;
+            case REB_ENSEMBLE_PARAMETER_VY:     p->vy = value; break;
+            case REB_ENSEMBLE_PARAMETER_VZ:     p->vz = value; break;
+            default: break;
+        }
+    }
+    const int N_real = r->N-r->N_var;
+    for (int j=1;j<N_real;j++){
+        int found = 0;
+        for (int k=0;k<N_parameters;k++){
+            found |= parameters[k].particle==j && parameters[k].type>=REB_ENSEMBLE_PARAMETER_A;
+        }
+        if (!found){
+            continue;
+        }
+        const struct reb_particle primary = reb_get_com_range(r, 0, j);
+        struct reb_particle* const p = &r->particles[j];
+        int err = 0;
+        const struct reb_orbit o = reb_tools_particle_to_orbit_err(r->G, *p, primary, &err);
+        if (err){
+            return err;
+        }
+        double a = o.a, e = o.e, inc = o.inc, Omega = o.Omega, omega = o.omega, f = o.f;
+        double M = NAN;
+        for (int k=0;k<N_parameters;k++){
+            if (parameters[k].particle!=j){
+                continue;
+            }
+            const double value = parameters[k].values[i];
+            switch (parameters[k].type){
+                case REB_ENSEMBLE_PARAMETER_A:      a = value; break;
+                case REB_ENSEMBLE_PARAMETER_E:      e = value; break;
+                case REB_ENSEMBLE_PARAMETER_INC:    inc = value; break;
+                case REB_ENSEMBLE_PARAMETER_OMEGA:  Omega = value; break;
+                case REB_ENSEMBLE_PARAMETER_PERI:   omega = value; break;
+                case REB_ENSEMBLE_PARAMETER_F:      f = value; break;
+                case REB_ENSEMBLE_PARAMETER_M:      M = value; break;
+                default: break;
+            }
+        }
+        if (!isnan(M)){
+            f = reb_tools_M_to_f(e, M);
+        }
+        const struct reb_particle q = reb_tools_orbit_to_particle_err(r->G, primary, p->m, a, e, inc, Omega, omega, f, &err);
+        if (err){
+            return err;
+        }
+        p->x = q.x;     p->y = q.y;     p->z = q.z;
+        p->vx = q.vx;   p->vy = q.vy;   p->vz = q.vz;
+    }
+    r->ri_whfast.recalculate_coordinates_this_timestep = 1;
+    r->ri_mercurius.recalculate_coordinates_this_timestep = 1;
+    r->ri_mercurius.recalculate_dcrit_this_timestep = 1;
+    return 0;
+}
+
+static void* reb_ensemble_sweep_thread(void* args){
+    struct reb_ensemble_sweep* const sweep = (struct reb_ensemble_sweep*)args;
+    struct reb_simulation* rs[REB_ENSEMBLE_CHUNK];
+    struct reb_simulation* running[REB_ENSEMBLE_CHUNK];
+    int index[REB_ENSEMBLE_CHUNK];
+    double walltime[REB_ENSEMBLE_CHUNK];
+    char name[1024];
+    while (1){
+        // Chunks of simulations are handed out one at a time. Each chunk 
+        // is integrated as an ensemble, so that the Kepler steps of all 
+        // compatible simulations in the chunk are solved together.
+        pthread_mutex_lock(&sweep->mutex);
+        if (sweep->next>=sweep->N || reb_sigint){
+            pthread_mutex_unlock(&sweep->mutex);
+            return NULL;
+        }
+        const int i_start = sweep->next;
+        const int i_end = MIN(i_start+REB_ENSEMBLE_CHUNK, sweep->N);
+        sweep->next = i_end;
+        pthread_mutex_unlock(&sweep->mutex);
+
+        int K = 0;
+        int N_done = 0;
+        for (int i=i_start;i<i_end;i++){
+            struct reb_ensemble_result result;
+            reb_ensemble_init_results(&result, 1);
+            struct reb_particle* const particles = sweep->particles?sweep->particles+(size_t)i*sweep->N_particles:NULL;
+            if (sweep->filename){
+                snprintf(name, 1024, sweep->filename, i);
+                if (reb_ensemble_result_from_file(name, &result, particles, sweep->N_particles)){
+                    if (sweep->results){
+                        sweep->results[i] = result;
+                    }
+                    N_done++;
+                    continue;
+                }
+            }
+            struct reb_simulation* const r = reb_create_simulation();
+            // The template is only read. Threads can copy it concurrently.
+            reb_copy_simulation_into(r, sweep->template_simulation);
+            if (reb_ensemble_set_parameters(r, sweep->parameters, sweep->N_parameters, i)){
+                reb_error(r, "Invalid orbital elements in parameter sweep.");
+                r->status = REB_EXIT_ERROR;
+                reb_ensemble_set_result(&result, r, 0.);
+                if (sweep->results){
+                    sweep->results[i] = result;
+                }
+                reb_free_simulation(r);
+                N_done++;
+                continue;
+            }
+            index[K] = i;
+            walltime[K] = r->walltime;
+            rs[K++] = r;
+        }
+
+        reb_ensemble_integrate_simulations(rs, running, K, sweep->tmax);
+
+        for (int k=0;k<K;k++){
+            struct reb_simulation* const r = rs[k];
+            const int i = index[k];
+            if (r->status!=REB_EXIT_SIGINT){
+                if (sweep->results){
+                    reb_ensemble_set_result(&sweep->results[i], r, r->walltime-walltime[k]);
+                }
+                if (sweep->particles){
+                    reb_ensemble_store_particles(r, sweep->particles+(size_t)i*sweep->N_particles, sweep->N_particles);
+                }
+                if (sweep->filename){
+                    snprintf(name, 1024, sweep->filename, i);
+                    reb_simulationarchive_snapshot(r, name);
+                }
+                N_done++;
+            }
+            reb_free_simulation(r);
+        }
+        pthread_mutex_lock(&sweep->mutex);
+        sweep->N_done += N_done;
+        pthread_mutex_unlock(&sweep->mutex);
+    }
+}
+
+int reb_ensemble_sweep(const struct reb_simulation* const template_simulation, const int N, const struct reb_ensemble_parameter* const parameters, const int N_parameters, const double tmax, int N_threads, struct reb_ensemble_result* const results, struct reb_particle* const particles, const char* filename){
+    if (N<=0){
+        return 0;
+    }
+    const int N_real = template_simulation->N-template_simulation->N_var;
+    for (int k=0;k<N_parameters;k++){
+        const struct reb_ensemble_parameter* const parameter = &parameters[k];
+        const int orbital = parameter->type>=REB_ENSEMBLE_PARAMETER_A;
+        if (parameter->particle<(orbital?1:0) || parameter->particle>=N_real
+                || parameter->type<REB_ENSEMBLE_PARAMETER_MASS || parameter->type>REB_ENSEMBLE_PARAMETER_M
+                || parameter->values==NULL){
+            // The template is only modified here, before any thread has been started.
+            reb_error((struct reb_simulation*)template_simulation, "Invalid parameter for reb_ensemble_sweep. Check the particle index and type. Orbital elements cannot be set for particle 0.");
+            return 0;
+        }
+    }
+    struct reb_ensemble_sweep sweep = {
+        .template_simulation = template_simulation,
+        .N = N,
+        .parameters = parameters,
+        .N_parameters = N_parameters,
+        .tmax = tmax,
+        .results = results,
+        .particles = particles,
+        .N_particles = N_real,
+        .filename = filename,
+        .next = 0,
+        .N_done = 0,
+    };
+    if (results){
+        reb_ensemble_init_results(results, N);
+    }
+    pthread_mutex_init(&sweep.mutex, NULL);
+    reb_sigint = 0;
+    signal(SIGINT, reb_sigint_handler);
+
+    if (N_threads<=0){
+        N_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    N_threads = MIN(N_threads, (N+REB_ENSEMBLE_CHUNK-1)/REB_ENSEMBLE_CHUNK);
+    if (N_threads<1) N_threads = 1;
+    pthread_t* const pthreads = malloc(sizeof(pthread_t)*N_threads);
+    int* const started = calloc(N_threads, sizeof(int));
+    for (int k=1;k<N_threads;k++){
+        started[k] = pthread_create(&pthreads[k], NULL, reb_ensemble_sweep_thread, &sweep)==0;
+    }
+    reb_ensemble_sweep_thread(&sweep);
+    for (int k=1;k<N_threads;k++){
+        if (started[k]){
+            pthread_join(pthreads[k], NULL);
+        }
+    }
+    free(started);
+    free(pthreads);
+    pthread_mutex_destroy(&sweep.mutex);
+    return sweep.N_done;
+}
+
+#ifdef MPI
+// Messages between the node which hands out the work (node 0) and the workers.
+enum {
+    REB_ENSEMBLE_MPI_TAG_RESULT = 1,    // Worker to node 0: result of a simulation (index -1 if there is none yet)
+    REB_ENSEMBLE_MPI_TAG_WORK = 2,      // Node 0 to worker: index of the next simulation (-1 if there is no more work)
+};
+
+struct reb_ensemble_mpi_message {
+    int index;
+    struct reb_ensemble_result result;
+};
+
+// Integrates the i-th simulation and, if filename is set, saves it to a SimulationArchive.
+// If the SimulationArchive already exists, the simulation has been integrated by an 
+// earlier run and its result is read from the file instead.
+static void reb_ensemble_run_mpi_member(struct reb_simulation* const template_simulation, void (*setup)(struct reb_simulation* const r, const int index, void* data), void* data, const double tmax, const char* filename, const int i, struct reb_ensemble_result* const result){
+    char name[1024];
+    if (filename){
+        snprintf(name, 1024, filename, i);
+        if (reb_ensemble_result_from_file(name, result, NULL, 0)){
+            return;
+        }
+    }
+    struct reb_simulation* const r = reb_create_simulation();
+    if (template_simulation){
+        reb_copy_simulation_into(r, template_simulation);
+    }
+    if (setup){
+        setup(r, i, data);
+    }
+    if (reb_sigint){ // Interrupted during setup
+        reb_free_simulation(r);
+        return;
+    }
+    struct timeval time_beginning;
+    gettimeofday(&time_beginning,NULL);
+    reb_ensemble_run_simulation(r, tmax);
+    struct timeval time_end;
+    gettimeofday(&time_end,NULL);
+    reb_ensemble_set_result(result, r, time_end.tv_sec-time_beginning.tv_sec+(time_end.tv_usec-time_beginning.tv_usec)/1e6);
+    if (filename && r->status!=REB_EXIT_SIGINT){
+        reb_simulationarchive_snapshot(r, name);
+    }
+    reb_free_simulation(r);
+}
+
+int reb_ensemble_run_mpi(struct reb_simulation* const template_simulation, const int N, void (*setup)(struct reb_simulation* const r, const int index, void* data), void* data, const double tmax, struct reb_ensemble_result* const results, const char* filename){
+    int initialized;
+    MPI_Initialized(&initialized);
+    if (!initialized){
+        MPI_Init(NULL, NULL);
+    }
+    int mpi_id, mpi_num;
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpi_id);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_num);
+    if (N<=0){
+        return 0;
+    }
+    struct reb_ensemble_result* const res = results?results:malloc(sizeof(struct reb_ensemble_result)*N);
+    reb_ensemble_init_results(res, N);
+    reb_sigint = 0;
+    signal(SIGINT, reb_sigint_handler);
+
+    if (mpi_num==1){
+        // Nobody to hand out work to.
+        for (int i=0; i<N && !reb_sigint; i++){
+            reb_ensemble_run_mpi_member(template_simulation, setup, data, tmax, filename, i, &res[i]);
+        }
+    }else if (mpi_id==0){
+        // Hand out one simulation at a time, so that workers which finish 
+        // early pick up the remaining work.
+        int next = 0;
+        int workers = mpi_num-1;
+        while (workers>0){
+            struct reb_ensemble_mpi_message message;
+            MPI_Status status;
+            MPI_Recv(&message, sizeof(struct reb_ensemble_mpi_message), MPI_BYTE, MPI_ANY_SOURCE, REB_ENSEMBLE_MPI_TAG_RESULT, MPI_COMM_WORLD, &status);
+            if (message.index>=0){
+                res[message.index] = message.result;
+                if (message.result.status==REB_EXIT_SIGINT){
+                    // A worker which has been interrupted stops all other workers.
+                    reb_sigint = 1;
+                }
+            }
+            int index = -1;
+            if (next<N && !reb_sigint){
+                index = next++;
+            }else{
+                workers--;
+            }
+            MPI_Send(&index, 1, MPI_INT, status.MPI_SOURCE, REB_ENSEMBLE_MPI_TAG_WORK, MPI_COMM_WORLD);
+        }
+    }else{
+        struct reb_ensemble_mpi_message message = {.index = -1};
+        message.result.status = REB_RUNNING;
+        while (1){
+            MPI_Send(&message, sizeof(struct reb_ensemble_mpi_message), MPI_BYTE, 0, REB_ENSEMBLE_MPI_TAG_RESULT, MPI_COMM_WORLD);
+            int index;
+            MPI_Recv(&index, 1, MPI_INT, 0, REB_ENSEMBLE_MPI_TAG_WORK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            if (index<0){
+                break;
+            }
+            message.index = index;
+            reb_ensemble_init_results(&message.result, 1);
+            reb_ensemble_run_mpi_member(template_simulation, setup, data, tmax, filename, index, &message.result);
+        }
+    }
+
+    // All nodes return all results.
+    MPI_Bcast(res, N*sizeof(struct reb_ensemble_result), MPI_BYTE, 0, MPI_COMM_WORLD);
+    int N_done = 0;
+    for (int i=0;i<N;i++){
+        if (res[i].status!=REB_EXIT_SIGINT){
+            N_done++;
+        }
+    }
+    if (res!=results){
+        free(res);
+    }
+    return N_done;
+}
+#endif // MPI
@@ -0,0 +1,29 @@
+/**
+ * @file    ensemble.h
+ * @brief   Integrate many simulations in lockstep.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _ENSEMBLE_H
+#define _ENSEMBLE_H
+void reb_ensemble_run_simulation(struct reb_simulation* const r, const double tmax); ///< Same as reb_integrate() but safe to call from several threads. Does not reset reb_sigint.
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file    forces.c
+ * @brief   Registered additional forces.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details Forces registered with reb_add_force() declare the range of 
+ * particles they act on. Instead of each force looping over all particles,
+ * the particles are split into chunks. For each chunk, all forces are 
+ * evaluated one after the other on structure-of-arrays slices while the 
+ * chunk is in cache. Chunks are distributed over threads with OpenMP.
+ * 
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "rebound.h"
+#include "particle.h"
+#include "forces.h"
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
+#define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
+
+/**
+ * @brief Number of particles processed by all forces before moving on to the next particles.
+ */
+#define REB_FORCES_CHUNK 512
+
+int reb_add_force(struct reb_simulation* const r, void (*force)(struct reb_simulation* const r, const struct reb_force* const f, struct reb_particles_soa* const soa, const int istart, const int iend), const int istart, const int iend, const unsigned int velocity_dependent, void* data){
+    if (force==NULL || istart<0 || (iend>=0 && iend<istart)){
+        reb_error(r, "Invalid arguments passed to reb_add_force().");
+        return -1;
+    }
+    if (r->forces_allocatedN<=r->forces_N){
+        r->forces_allocatedN = r->forces_allocatedN?2*r->forces_allocatedN:4;
+        r->forces = realloc(r->forces, sizeof(struct reb_force)*r->forces_allocatedN);
+    }
+    r->forces[r->forces_N] = (struct reb_force){
+        .force = force,
+        .istart = istart,
+        .iend = iend,
+        .velocity_dependent = velocity_dependent,
+        .data = data,
+    };
+    if (velocity_dependent){
+        r->force_is_velocity_dependent = 1;
+    }
+    return r->forces_N++;
+}
+
+void reb_remove_forces(struct reb_simulation* const r){
+    free(r->forces);
+    r->forces = NULL;
+    r->forces_N = 0;
+    r->forces_allocatedN = 0;
+}
+
+int reb_forces_used(const struct reb_simulation* const r){
+    return r->additional_forces!=NULL || r->forces_N>0;
+}
+
+void reb_calculate_registered_forces(struct reb_simulation* const r){
+    // Variational particles are not affected by registered forces.
+    const int N = r->N - r->N_var;
+    const int forces_N = r->forces_N;
+    if (forces_N==0 || N<=0){
+        return;
+    }
+    struct reb_particle* const particles = r->particles;
+    const struct reb_force* const forces = r->forces;
+    struct reb_particles_soa* const soa = &(r->particles_soa);
+    reb_particles_soa_update(soa, particles, N);
+#pragma omp parallel for schedule(guided)
+    for (int cstart=0; cstart<N; cstart+=REB_FORCES_CHUNK){
+        const int cend = MIN(cstart+REB_FORCES_CHUNK, N);
+        for (int i=cstart; i<cend; i++){
+            soa->ax[i] = 0.;
+            soa->ay[i] = 0.;
+            soa->az[i] = 0.;
+        }
+        for (int k=0; k<forces_N; k++){
+            const int istart = MAX(cstart, forces[k].istart);
+            const int iend = MIN(cend, forces[k].iend<0?N:forces[k].iend);
+            if (istart<iend){
+                forces[k].force(r, &forces[k], soa, istart, iend);
+            }
+        }
+        for (int i=cstart; i<cend; i++){
+            particles[i].ax += soa->ax[i];
+            particles[i].ay += soa->ay[i];
+            particles[i].az += soa->az[i];
+        }
+    }
+}
@@ -0,0 +1,40 @@
+/**
+ * @file    forces.h
+ * @brief   Registered additional forces.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _FORCES_H
+#define _FORCES_H
+struct reb_simulation;
+
+/**
+ * @brief Adds the accelerations of all forces registered with reb_add_force() to the particles.
+ * @details Does nothing if no forces are registered. Called wherever additional_forces is called.
+ */
+void reb_calculate_registered_forces(struct reb_simulation* const r);
+
+/**
+ * @brief Returns 1 if additional_forces is set or forces are registered.
+ */
+int reb_forces_used(const struct reb_simulation* const r);
+
+#endif // _FORCES_H
@@ -39,24 +39,671 @@
 #include "tree.h"
 #include "boundary.h"
 #include "integrator_mercurius.h"
+#include "gravity_fft.h"
+#include "profiling.h"
+#include "tools.h"
+#include "interaction_groups.h"
+#include "collision.h"
 #define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
+#define MIN(a, b) ((a) < (b) ? (a) : (b))    ///< Returns the minimum of a and b
 
 #ifdef MPI
 #include "communication_mpi.h"
 #endif
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+/**
+  * @brief Work done during a tree walk. Each thread counts separately, the totals are added to r->counters.
+  */
+struct reb_gravity_walk_counts {
+    uint64_t interactions;      ///< Particle-particle and particle-cell interactions
+    uint64_t cells_opened;      ///< Cells which were opened
+};
 
 /**
   * @brief The function loops over all trees to call calculate_forces_for_particle_from_cell() tree to calculate forces for each particle.
   * @param r REBOUND simulation to consider
   * @param pt Index of the particle the force is calculated for.
   * @param gb Ghostbox plus position of the particle (precalculated). 
+  * @param ghost 1 if gb is not the central box. Root cells may then be skipped (see gravity_ghostbox_tolerance).
+  * @param counts Work done in the walk is added here.
+  * @param fused Collision candidates are added here (tree_fused_walk). NULL if they are not collected.
+  * @param gc Index of the ghost box in the collision search, -1 if no candidates are collected in this ghost box.
+  */
+static void reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, const int ghost, struct reb_gravity_walk_counts* const counts, const struct reb_collision_fused* const fused, const int gc);
+
+/**
+  * @brief Same as reb_calculate_acceleration_for_particle() but only includes the given root boxes.
+  * @param roots Indices of the root boxes. If NULL, the root boxes 0 to N_roots-1 are used.
+  * @param N_roots Number of root boxes.
+  */
+static void reb_calculate_acceleration_for_particle_from_roots(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, const int ghost, const int* const roots, const int N_roots, struct reb_gravity_walk_counts* const counts, const struct reb_collision_fused* const fused, const int gc);
+
+/**
+  * @brief Calculates the acceleration of all particles in the tree using the fast multipole method (REB_GRAVITY_FMM).
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_fmm(struct reb_simulation* r);
+
+/**
+  * @brief Calculates the acceleration of all particles in the tree with one tree walk per group of particles.
+  * @details Every cell with at most tree_group_size particles forms a group. The tree is 
+  * walked once per group and ghostbox. A cell is used as a whole if it is well separated 
+  * from the bounding box of all particles in the group, so the resulting interaction list
+  * can be applied to every particle in the group in a loop which the compiler turns into
+  * SIMD instructions. Interactions within a group are calculated directly. Groups run in 
+  * parallel with OpenMP. Used by REB_GRAVITY_TREE if tree_group_size>1.
+  * @param r REBOUND simulation to consider
+  */
+#ifndef MPI
+static void reb_calculate_acceleration_tree_groups(struct reb_simulation* r);
+#endif // MPI
+
+/**
+  * @brief Returns the block size used by the tiled direct summation loops.
+  * @details The loops over particle pairs are split into blocks of i and j particles 
+  * so that both blocks stay in cache while their pairs are evaluated. 
+  * A non-positive gravity_tile_size disables tiling (one block containing all particles).
+  * @param r REBOUND simulation to consider
+  */
+static int reb_gravity_tile_size(const struct reb_simulation* const r){
+    if (r->gravity_tile_size<=0 || r->gravity_tile_size>r->N){
+        return MAX(r->N,1);
+    }
+    return r->gravity_tile_size;
+}
+
+/**
+  * @brief Position shifts of all ghost boxes, stored in r->gravity_ghostboxes.
+  */
+struct reb_gravity_ghostboxes {
+    int N;              // Number of ghost boxes
+    int central;        // Index of the central box
+    const double* x;    // Shifts in the x direction
+    const double* y;    // Shifts in the y direction
+    const double* z;    // Shifts in the z direction
+};
+
+/**
+  * @brief Returns the ghost box shifts calculated by the last call of reb_gravity_ghostboxes_update().
+  */
+static struct reb_gravity_ghostboxes reb_gravity_ghostboxes(const struct reb_simulation* const r){
+    const int N_gb = (2*r->nghostx+1)*(2*r->nghosty+1)*(2*r->nghostz+1);
+    const double* const x = r->gravity_ghostboxes;
+    return (struct reb_gravity_ghostboxes){.N = N_gb, .central = (N_gb-1)/2, .x = x, .y = x+N_gb, .z = x+2*N_gb};
+}
+
+/**
+  * @brief Calculates the shifts of all ghost boxes at the current time.
+  * @details Called once per force calculation. The loops over ghost boxes then only 
+  * read the shifts instead of calling reb_boundary_get_ghostbox() for every box 
+  * (and, in some routines, for every particle). 
+  */
+static struct reb_gravity_ghostboxes reb_gravity_ghostboxes_update(struct reb_simulation* const r){
+    const int N_gb = (2*r->nghostx+1)*(2*r->nghosty+1)*(2*r->nghostz+1);
+    if (r->gravity_ghostboxes_allocatedN<N_gb){
+        // The second half is used by reb_gravity_ghostboxes_select() 
+        r->gravity_ghostboxes = realloc(r->gravity_ghostboxes, sizeof(double)*6*N_gb);
+        r->gravity_ghostboxes_allocatedN = N_gb;
+    }
+    double* const x = r->gravity_ghostboxes;
+    reb_boundary_get_ghostbox_shifts(r, x, x+N_gb, x+2*N_gb);
+    return reb_gravity_ghostboxes(r);
+}
+
+/**
+  * @brief Returns the shift of ghost box g. The velocity shifts are not needed for gravity and set to 0.
+  */
+static inline struct reb_ghostbox reb_gravity_ghostbox(const struct reb_gravity_ghostboxes* const gbs, const int g){
+    return (struct reb_ghostbox){.shiftx = gbs->x[g], .shifty = gbs->y[g], .shiftz = gbs->z[g]};
+}
+
+/**
+  * @brief Checks if the contribution of a group of sources in a ghost box can be skipped.
+  * @details The sources are inside the box slo..shi and have the mass m, the targets are inside 
+  * the box tlo..thi (both including the ghost box shift). The acceleration of any target is 
+  * at most G*m/d^2, where d is the minimum distance between the two boxes. The sources are 
+  * skipped if this bound is smaller than gravity_ghostbox_tolerance. 
+  */
+static inline int reb_gravity_ghostbox_prune(const double tolerance, const double Gm, const double* const tlo, const double* const thi, const double* const slo, const double* const shi){
+    double d2 = 0.;
+    for (int k=0; k<3; k++){
+        const double d = MAX(0., MAX(slo[k]-thi[k], tlo[k]-shi[k]));
+        d2 += d*d;
+    }
+    return Gm < tolerance*d2;
+}
+
+/**
+  * @brief Same as reb_gravity_ghostbox_prune() for all particles in the simulation box (with the total mass m).
+  */
+static inline int reb_gravity_ghostbox_prune_box(const struct reb_simulation* const r, const double m, const double* const tlo, const double* const thi){
+    const double slo[3] = {-r->boxsize.x/2., -r->boxsize.y/2., -r->boxsize.z/2.};
+    const double shi[3] = {r->boxsize.x/2., r->boxsize.y/2., r->boxsize.z/2.};
+    return reb_gravity_ghostbox_prune(r->gravity_ghostbox_tolerance, r->G*m, tlo, thi, slo, shi);
+}
+
+/**
+  * @brief Same as reb_gravity_ghostbox_prune() for all particles in a tree cell.
+  */
+static inline int reb_gravity_ghostbox_prune_cell(const struct reb_simulation* const r, const struct reb_treecell* const node, const double* const tlo, const double* const thi){
+    const double w2 = node->w/2.;
+    const double slo[3] = {node->x-w2, node->y-w2, node->z-w2};
+    const double shi[3] = {node->x+w2, node->y+w2, node->z+w2};
+    return reb_gravity_ghostbox_prune(r->gravity_ghostbox_tolerance, r->G*node->m, tlo, thi, slo, shi);
+}
+
+#if !defined(GPU) && !defined(SIMD) && !defined(OPENMP)
+// Helper routines for the ghost boxes of the serial REB_GRAVITY_BASIC kernel
+
+/**
+  * @brief Bounding box and total mass of the particles istart to iend-1.
+  */
+static void reb_gravity_block_bounds(const struct reb_particle* const particles, const int istart, const int iend, double* const lo, double* const hi, double* const m){
+    lo[0] = hi[0] = particles[istart].x;
+    lo[1] = hi[1] = particles[istart].y;
+    lo[2] = hi[2] = particles[istart].z;
+    *m = 0.;
+    for (int i=istart; i<iend; i++){
+        lo[0] = MIN(lo[0], particles[i].x); hi[0] = MAX(hi[0], particles[i].x);
+        lo[1] = MIN(lo[1], particles[i].y); hi[1] = MAX(hi[1], particles[i].y);
+        lo[2] = MIN(lo[2], particles[i].z); hi[2] = MAX(hi[2], particles[i].z);
+        *m += particles[i].m;
+    }
+}
+
+/**
+  * @brief Selects the ghost boxes needed for the interactions between two blocks of particles.
+  * @details The particles ib to iend-1 are shifted by the ghost box, the particles jb to jend-1 are not. 
+  * Boxes in which the acceleration of either block on the other is below gravity_ghostbox_tolerance 
+  * are skipped. The central box is always included. The shifts of the selected boxes are stored in
+  * the scratch space after the ghost box shifts. 
+  * @return The selected ghost boxes.
+  */
+static struct reb_gravity_ghostboxes reb_gravity_ghostboxes_select(struct reb_simulation* const r, const struct reb_gravity_ghostboxes* const gbs, const int ib, const int iend, const int jb, const int jend){
+    struct reb_particle* const particles = r->particles;
+    double ilo[3], ihi[3], jlo[3], jhi[3], mi, mj;
+    reb_gravity_block_bounds(particles, ib, iend, ilo, ihi, &mi);
+    reb_gravity_block_bounds(particles, jb, jend, jlo, jhi, &mj);
+    const double Gm = r->G*MAX(mi, mj);
+    double* const x = r->gravity_ghostboxes + 3*gbs->N;
+    double* const y = x + gbs->N;
+    double* const z = y + gbs->N;
+    struct reb_gravity_ghostboxes sel = {.N = 0, .central = -1, .x = x, .y = y, .z = z};
+    for (int g=0; g<gbs->N; g++){
+        if (g!=gbs->central){
+            const double lo[3] = {ilo[0]+gbs->x[g], ilo[1]+gbs->y[g], ilo[2]+gbs->z[g]};
+            const double hi[3] = {ihi[0]+gbs->x[g], ihi[1]+gbs->y[g], ihi[2]+gbs->z[g]};
+            if (reb_gravity_ghostbox_prune(r->gravity_ghostbox_tolerance, Gm, lo, hi, jlo, jhi)) continue;
+        }else{
+            sel.central = sel.N;
+        }
+        x[sel.N] = gbs->x[g];
+        y[sel.N] = gbs->y[g];
+        z[sel.N] = gbs->z[g];
+        sel.N++;
+    }
+    return sel;
+}
+
+/**
+  * @brief Direct summation of the interactions between particles i (ib<=i<iend) and j (jb<=j<min(jend,i)) in N_gb ghost boxes.
+  * @details Particle i is shifted by the ghost box. The loop over ghost boxes is the innermost 
+  * loop and is vectorized. With a single box, the accelerations are accumulated in the same 
+  * order as without ghost boxes.
+  * The function is always called with constant N_gb and softened arguments so that the 
+  * compiler generates one specialized kernel for each combination. Without softening, the 
+  * addition of softening2 is removed from the innermost loop (the result is the same).
+  * @return Number of pairs.
+  */
+static inline uint64_t reb_gravity_basic_block(struct reb_particle* const particles, const int ib, const int iend, const int jb, const int jend, const struct reb_gravity_ghostboxes* const gbs, const int N_gb, const double G, const int softened, const double softening2){
+    const double* const gx = gbs->x;
+    const double* const gy = gbs->y;
+    const double* const gz = gbs->z;
+    uint64_t pairs = 0;
+    for (int i=MAX(ib,jb+1); i<iend; i++){
+    if (reb_sigint) return pairs;
+    const double xi = particles[i].x;
+    const double yi = particles[i].y;
+    const double zi = particles[i].z;
+    const double mi = particles[i].m;
+    const int jmax = MIN(jend,i);
+    pairs += MAX(jmax-jb, 0);
+    for (int j=jb; j<jmax; j++){
+        const double xj = particles[j].x;
+        const double yj = particles[j].y;
+        const double zj = particles[j].z;
+        const double mj = particles[j].m;
+        double aix = 0.;
+        double aiy = 0.;
+        double aiz = 0.;
+        double ajx = 0.;
+        double ajy = 0.;
+        double ajz = 0.;
+#pragma omp simd reduction(+:aix,aiy,aiz,ajx,ajy,ajz)
+        for (int g=0; g<N_gb; g++){
+            const double dx = (gx[g]+xi) - xj;
+            const double dy = (gy[g]+yi) - yj;
+            const double dz = (gz[g]+zi) - zj;
+            const double r2 = dx*dx + dy*dy + dz*dz;
+            const double _r = sqrt(softened?(r2 + softening2):r2);
+            const double prefact = G/(_r*_r*_r);
+            const double prefactj = -prefact*mj;
+            const double prefacti = prefact*mi;
+            aix += prefactj*dx;
+            aiy += prefactj*dy;
+            aiz += prefactj*dz;
+            ajx += prefacti*dx;
+            ajy += prefacti*dy;
+            ajz += prefacti*dz;
+        }
+        particles[i].ax += aix;
+        particles[i].ay += aiy;
+        particles[i].az += aiz;
+        particles[j].ax += ajx;
+        particles[j].ay += ajy;
+        particles[j].az += ajz;
+    }
+    }
+    return pairs;
+}
+
+/**
+  * @brief Calls reb_gravity_basic_block() for the ghost boxes which are not pruned and removes 
+  * the pruned pairs from r->counters (reb_gravity_count_direct() counts all pairs in all boxes).
+  * @details The kernel is selected here, once per block, and not inside the loops over pairs.
+  */
+REB_TARGET_CLONES static void reb_gravity_basic_blocks(struct reb_simulation* const r, const int ib, const int iend, const int jb, const int jend, const struct reb_gravity_ghostboxes* const gbs, const int prune, const double G, const double softening2){
+    struct reb_particle* const particles = r->particles;
+    if (gbs->N==1){
+        // Specialized for a single box (the most common case). 
+        if (softening2==0.){
+            reb_gravity_basic_block(particles, ib, iend, jb, jend, gbs, 1, G, 0, 0.);
+        }else{
+            reb_gravity_basic_block(particles, ib, iend, jb, jend, gbs, 1, G, 1, softening2);
+        }
+    }else if (prune){
+        const struct reb_gravity_ghostboxes sel = reb_gravity_ghostboxes_select(r, gbs, ib, iend, jb, jend);
+        const uint64_t pairs = reb_gravity_basic_block(particles, ib, iend, jb, jend, &sel, sel.N, G, 1, softening2);
+        r->counters.gravity_interactions -= pairs*(gbs->N-sel.N);
+    }else{
+        reb_gravity_basic_block(particles, ib, iend, jb, jend, gbs, gbs->N, G, 1, softening2);
+    }
+}
+#endif // !GPU && !SIMD && !OPENMP
+
+/**
+  * @brief Direct summation with compensated (Kahan) summation used by REB_GRAVITY_COMPENSATED.
+  * @details Each particle sums up the forces from all sources itself, so there are no 
+  * write conflicts and the loop over particles runs in parallel with OpenMP. The result 
+  * does not depend on the number of threads. The sum over sources is split into 
+  * REB_GRAVITY_CS_LANES independently compensated partial sums which the compiler 
+  * can evaluate with SIMD instructions. The partial sums and their error terms are 
+  * combined with compensated summation at the end. The remaining error term is 
+  * stored in gravity_cs.
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_compensated(struct reb_simulation* r);
+
+/**
+  * @brief Calculates the accelerations of test particles (testparticle_type 0) due to the active particles.
+  * @details Test particles are processed in batches of REB_GRAVITY_TP_BATCH. For each
+  * active particle, the force on all test particles in a batch is evaluated in one
+  * loop which the compiler turns into SIMD instructions. Batches run in parallel with
+  * OpenMP. The accelerations of the test particles are overwritten, the active
+  * particles are not modified. The result does not depend on the number of threads
+  * and is the same as the one of the serial loop in REB_GRAVITY_BASIC.
+  * If gravity_testparticle_float is set, only the first active particle (the primary) 
+  * is summed up in double precision, see reb_gravity_tp_batch_float().
+  * @param r REBOUND simulation to consider
+  * @param jstart Index of the first active particle.
+  * @param jend Index one past the last active particle.
+  * @param istart Index of the first test particle.
+  * @param iend Index one past the last test particle.
+  */
+#ifndef GPU
+static void reb_calculate_acceleration_testparticles(struct reb_simulation* r, const int jstart, const int jend, const int istart, const int iend);
+#endif // GPU
+
+/**
+  * @brief Same as reb_calculate_acceleration_testparticles() but for REB_GRAVITY_JACOBI.
+  * @details Test particles do not contribute to the Jacobi coordinates, so all of them
+  * feel the same Jacobi centre of mass of the active particles.
+  * @param r REBOUND simulation to consider
+  * @param N_active Number of active particles. All particles with a larger index are test particles.
+  * @param Rjx Mass weighted x position of the active particles.
+  * @param Rjy Mass weighted y position of the active particles.
+  * @param Rjz Mass weighted z position of the active particles.
+  * @param Mj Total mass of the active particles.
+  */
+static void reb_calculate_acceleration_jacobi_testparticles(struct reb_simulation* r, const int N_active, const double Rjx, const double Rjy, const double Rjz, const double Mj);
+
+#if defined(SIMD) && !defined(GPU)
+/**
+  * @brief Vectorized direct summation used by REB_GRAVITY_BASIC if the SIMD compiler flag is set.
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_basic_simd(struct reb_simulation* r);
+#endif // SIMD
+
+#ifdef GPU
+/**
+  * @brief Direct summation used by REB_GRAVITY_BASIC if the GPU compiler flag is set.
+  * @details Runs on the OpenMP offload device. The device keeps its own copy of the 
+  * structure-of-arrays mirror between calls. Only positions and masses are copied to 
+  * the device and only accelerations are copied back.
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_basic_gpu(struct reb_simulation* r);
+#endif // GPU
+
+#ifdef OPENMP
+#if !defined(GPU) && !defined(SIMD)
+/**
+  * @brief Direct summation used by REB_GRAVITY_BASIC if the OPENMP compiler flag is set.
+  * @details Every pair is only evaluated once. Each thread accumulates into its own 
+  * acceleration buffer. The buffers are summed up in a fixed order at the end, so the 
+  * result is bitwise reproducible for a fixed number of threads.
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_basic_omp(struct reb_simulation* r);
+#endif // GPU, SIMD
+
+/**
+  * @brief Same as reb_calculate_acceleration_basic_omp() but for the WHFast part of REB_GRAVITY_MERCURIUS.
+  * @param r REBOUND simulation to consider
+  * @param L_type Switching function
+  */
+static inline void reb_calculate_acceleration_mercurius_omp(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type);
+#endif // OPENMP
+
+#ifdef MPI
+/**
+  * @brief Direct summation used by REB_GRAVITY_BASIC if mpi_direct is set.
+  * @details Every node holds all particles. Rows of the force matrix are assigned 
+  * to the nodes cyclically. Every pair is only evaluated once. The partial 
+  * accelerations of all nodes are then summed up with MPI_Allreduce.
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_basic_mpi(struct reb_simulation* r);
+
+/**
+  * @brief Same as reb_calculate_acceleration_basic_mpi() but for the WHFast part of REB_GRAVITY_MERCURIUS.
+  * @param r REBOUND simulation to consider
+  * @param L_type Switching function
+  */
+static inline void reb_calculate_acceleration_mercurius_mpi(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type);
+#endif // MPI
+
+/**
+  * @brief Calculates the accelerations for REB_GRAVITY_MERCURIUS.
+  * @details The built-in switching functions are evaluated inline. Only user 
+  * supplied switching functions (REB_MERCURIUS_L_CUSTOM) are called through 
+  * the function pointer ri_mercurius.L.
+  * @param r REBOUND simulation to consider
+  * @param L_type Switching function. Should be a constant so that the kernels are specialized.
   */
-static void reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb);
+static inline void reb_calculate_acceleration_mercurius(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type);
 
 
 /**
  * Main Gravity Routine
  */
+/**
+  * @brief Adds the number of pair interactions of the direct summation methods to r->counters.
+  * @details The tree and FMM walks count their interactions themselves.
+  */
+static void reb_gravity_count_direct(struct reb_simulation* const r){
+    int N = r->N - r->N_var;
+    int N_active = r->N_active==-1 ? N : MIN(r->N_active, N);
+    switch (r->gravity){
+        case REB_GRAVITY_BASIC:
+        case REB_GRAVITY_COMPENSATED:
+        case REB_GRAVITY_JACOBI:
+            break;
+        case REB_GRAVITY_MERCURIUS:
+            if (r->ri_mercurius.mode==1){
+                // Only particles having a close encounter are integrated by IAS15
+                N = r->ri_mercurius.encounterN;
+                N_active = MIN((int)r->ri_mercurius.encounterNactive, N);
+            }else if (r->ri_mercurius.mode==2){
+                return;
+            }
+            break;
+        default:
+            return;
+    }
+    const uint64_t Na = N_active;
+    const uint64_t Nt = N - N_active;
+    const uint64_t N_ghostboxes = (uint64_t)(2*r->nghostx+1)*(2*r->nghosty+1)*(2*r->nghostz+1);
+    r->counters.gravity_interactions += (Na*(Na-1)/2 + Na*Nt)*N_ghostboxes;
+}
+
+/**
+  * @brief Kernels of reb_calculate_acceleration_groups().
+  */
+enum reb_gravity_groups_kernel {
+    REB_GRAVITY_GROUPS_BASIC = 0,           ///< Newtonian gravity summed over all ghost boxes (REB_GRAVITY_BASIC)
+    REB_GRAVITY_GROUPS_MERCURIUS_L = 1,     ///< Scaled by the switching function L (WHFast part of REB_GRAVITY_MERCURIUS)
+    REB_GRAVITY_GROUPS_MERCURIUS_1ML = 2,   ///< Scaled by 1-L (IAS15 part of REB_GRAVITY_MERCURIUS)
+};
+
+/**
+  * @brief Pairs of particles at the positions a in [ia,iend) and b in [jb,jend) with b<a.
+  * @details fi (fj) is 1 if particle i (j) feels particle j (i). If full is set, all groups 
+  * in both blocks feel each other and the groups are not tested for each pair.
+  * @return Number of pairs.
+  */
+static inline uint64_t reb_gravity_groups_block(struct reb_simulation* const r, const enum reb_gravity_groups_kernel kernel, const enum reb_integrator_mercurius_L_type L_type, const int* const map, const int ia, const int iend, const int jb, const int jend, const int N_active, const int full, const struct reb_gravity_ghostboxes* const gbs){
+    struct reb_particle* const particles = r->particles;
+    const uint64_t* const interaction_groups = r->interaction_groups;
+    const double* const dcrit = r->ri_mercurius.dcrit;
+    const int _testparticle_type = r->testparticle_type;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    uint64_t pairs = 0;
+    for (int a=MAX(ia,jb+1); a<iend; a++){
+        const int i = map?map[a]:a;
+        const uint32_t gi = particles[i].group;
+        const double xi = particles[i].x;
+        const double yi = particles[i].y;
+        const double zi = particles[i].z;
+        const double mi = particles[i].m;
+        // Test particles only act on active particles if testparticle_type is set.
+        const int fj_active = a<N_active || _testparticle_type;
+        for (int b=jb; b<MIN(jend,a); b++){
+            if (b>=N_active) break; // Test particles do not interact with each other
+            const int j = map?map[b]:b;
+            const uint32_t gj = particles[j].group;
+            int fi = 1;
+            int fj = fj_active;
+            if (!full){
+                fi = (interaction_groups[gi]>>gj)&1;
+                fj = fj && ((interaction_groups[gj]>>gi)&1);
+                if (!fi && !fj) continue;
+            }
+            pairs++;
+            const double mj = particles[j].m;
+            double aix = 0.;
+            double aiy = 0.;
+            double aiz = 0.;
+            double ajx = 0.;
+            double ajy = 0.;
+            double ajz = 0.;
+            if (kernel==REB_GRAVITY_GROUPS_BASIC){
+                for (int g=0; g<gbs->N; g++){
+                    const double dx = (gbs->x[g]+xi) - particles[j].x;
+                    const double dy = (gbs->y[g]+yi) - particles[j].y;
+                    const double dz = (gbs->z[g]+zi) - particles[j].z;
+                    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                    const double prefact = G/(_r*_r*_r);
+                    aix -= prefact*mj*dx;
+                    aiy -= prefact*mj*dy;
+                    aiz -= prefact*mj*dz;
+                    ajx += prefact*mi*dx;
+                    ajy += prefact*mi*dy;
+                    ajz += prefact*mi*dz;
+                }
+            }else{
+                const double dx = xi - particles[j].x;
+                const double dy = yi - particles[j].y;
+                const double dz = zi - particles[j].z;
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double dcritmax = MAX(dcrit[i],dcrit[j]);
+                const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+                const double prefact = G*(kernel==REB_GRAVITY_GROUPS_MERCURIUS_L?L:(1.-L))/(_r*_r*_r);
+                aix = -prefact*mj*dx;
+                aiy = -prefact*mj*dy;
+                aiz = -prefact*mj*dz;
+                ajx = prefact*mi*dx;
+                ajy = prefact*mi*dy;
+                ajz = prefact*mi*dz;
+            }
+            if (fi){
+                particles[i].ax += aix;
+                particles[i].ay += aiy;
+                particles[i].az += aiz;
+            }
+            if (fj){
+                particles[j].ax += ajx;
+                particles[j].ay += ajy;
+                particles[j].az += ajz;
+            }
+        }
+    }
+    return pairs;
+}
+
+/**
+  * @brief Direct summation restricted by interaction groups (see reb_set_interaction_groups()).
+  * @details The particles at the positions start,...,end-1 of map (the particles with these 
+  * indices if map is NULL) are split into blocks of gravity_tile_size particles. The first 
+  * N_active positions are active particles. Pairs of blocks are skipped if none of their 
+  * groups interact. The groups of individual pairs are only tested if some, but not all 
+  * groups in the two blocks interact. The loops run in serial.
+  * Accelerations are added to the existing values. 
+  * @return 0 on success, -1 if a particle is not in a valid group.
+  */
+static int reb_calculate_acceleration_groups(struct reb_simulation* const r, const enum reb_gravity_groups_kernel kernel, const enum reb_integrator_mercurius_L_type L_type, const int* const map, const int start, const int end, const int N_active){
+    const int tile = reb_gravity_tile_size(r);
+    struct reb_interaction_groups_blocks blocks;
+    if (reb_interaction_groups_blocks_init(r, map, start, end, tile, &blocks)){
+        return -1;
+    }
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    uint64_t pairs = 0;
+    for (int kb=0; kb<blocks.N; kb++){
+    const int ib = start+kb*tile;
+    const int iend = MIN(ib+tile, end);
+    for (int lb=0; lb<=kb; lb++){
+        const int jb = start+lb*tile;
+        const int jend = MIN(jb+tile, end);
+        if (jb>=N_active) break; // Only test particles
+        const uint64_t gi = blocks.groups[kb];
+        const uint64_t gj = blocks.groups[lb];
+        if (!(blocks.any[kb] & gj) && !(blocks.any[lb] & gi)) continue;
+        if ((blocks.all[kb] & gj)==gj && (blocks.all[lb] & gi)==gi){
+            pairs += reb_gravity_groups_block(r, kernel, L_type, map, ib, iend, jb, jend, N_active, 1, &gbs);
+        }else{
+            pairs += reb_gravity_groups_block(r, kernel, L_type, map, ib, iend, jb, jend, N_active, 0, &gbs);
+        }
+        if (reb_sigint) break;
+    }
+    }
+    reb_interaction_groups_blocks_free(&blocks);
+    r->counters.gravity_interactions += pairs*(kernel==REB_GRAVITY_GROUPS_BASIC?gbs.N:1);
+    return 0;
+}
+
+/**
+  * @brief Calculates the accelerations with interaction groups for REB_GRAVITY_BASIC and REB_GRAVITY_MERCURIUS.
+  * @return 1 if the accelerations have been calculated. 0 if interaction groups are not supported 
+  * in this configuration. In that case an error is set and all particles interact.
+  */
+static int reb_calculate_acceleration_with_groups(struct reb_simulation* const r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const int _N_real = N - r->N_var;
+    const int _N_active = (r->N_active==-1)?_N_real:MIN(r->N_active,_N_real);
+    if (r->N_var){
+        reb_error(r, "Interaction groups do not support variational particles.");
+        r->status = REB_EXIT_ERROR;
+        return 0;
+    }
+    switch (r->gravity){
+        case REB_GRAVITY_BASIC:
+            if (r->gravity_ignore_terms==1){
+                reb_error(r, "Interaction groups are not supported in Jacobi coordinates. Use democratic heliocentric coordinates.");
+                r->status = REB_EXIT_ERROR;
+                return 0;
+            }
+            for (int i=0; i<N; i++){
+                particles[i].ax = 0; 
+                particles[i].ay = 0; 
+                particles[i].az = 0; 
+            }
+            // The central object is not included if gravity_ignore_terms==2.
+            reb_calculate_acceleration_groups(r, REB_GRAVITY_GROUPS_BASIC, REB_MERCURIUS_L_CUSTOM, NULL, r->gravity_ignore_terms==2?1:0, _N_real, _N_active);
+            break;
+        case REB_GRAVITY_MERCURIUS:
+        {
+            double (*_L) (const struct reb_simulation* const r, double d, double dcrit) = r->ri_mercurius.L;
+            const enum reb_integrator_mercurius_L_type L_type = 
+                _L==reb_integrator_mercurius_L_mercury?REB_MERCURIUS_L_MERCURY:
+                _L==reb_integrator_mercurius_L_infinity?REB_MERCURIUS_L_INFINITY:
+                _L==reb_integrator_mercurius_L_C4?REB_MERCURIUS_L_C4:
+                _L==reb_integrator_mercurius_L_C5?REB_MERCURIUS_L_C5:
+                REB_MERCURIUS_L_CUSTOM;
+            // The star (particle 0) is not included, we're in democratic heliocentric coordinates.
+            if (r->ri_mercurius.mode==0){
+                for (int i=0; i<_N_real; i++){
+                    particles[i].ax = 0; 
+                    particles[i].ay = 0; 
+                    particles[i].az = 0; 
+                }
+                reb_calculate_acceleration_groups(r, REB_GRAVITY_GROUPS_MERCURIUS_L, L_type, NULL, 1, _N_real, _N_active);
+            }else if (r->ri_mercurius.mode==1){
+                const int* const map = r->ri_mercurius.encounter_map;
+                const int encounterN = r->ri_mercurius.encounterN;
+                const double softening2 = r->softening*r->softening;
+                const double G = r->G;
+                const double m0 = particles[0].m;
+                particles[0].ax = 0; // map[0] is always 0 
+                particles[0].ay = 0; 
+                particles[0].az = 0; 
+                // Acceleration due to star
+                for (int i=1; i<encounterN; i++){
+                    const int mi = map[i];
+                    const double x = particles[mi].x;
+                    const double y = particles[mi].y;
+                    const double z = particles[mi].z;
+                    const double _r = sqrt(x*x + y*y + z*z + softening2);
+                    const double prefact = -G/(_r*_r*_r)*m0;
+                    particles[mi].ax = prefact*x;
+                    particles[mi].ay = prefact*y;
+                    particles[mi].az = prefact*z;
+                }
+                reb_calculate_acceleration_groups(r, REB_GRAVITY_GROUPS_MERCURIUS_1ML, L_type, map, 1, encounterN, r->ri_mercurius.encounterNactive);
+            }
+        }
+            break;
+        case REB_GRAVITY_NONE:
+            for (int i=0; i<N; i++){
+                particles[i].ax = 0; 
+                particles[i].ay = 0; 
+                particles[i].az = 0; 
+            }
+            break;
+        default:
+            reb_error(r, "Interaction groups are only supported by REB_GRAVITY_BASIC and REB_GRAVITY_MERCURIUS.");
+            r->status = REB_EXIT_ERROR;
+            return 0;
+    }
+    return 1;
+}
+
 void reb_calculate_acceleration(struct reb_simulation* r){
     if (r->integrator != REB_INTEGRATOR_MERCURIUS && r->gravity == REB_GRAVITY_MERCURIUS){
         reb_warning(r,"You are using the Mercurius gravity routine with a non-Mercurius integrator. This will probably lead to unexpected behaviour. REBOUND is now setting the gravity routine back to rEB_GRAVITY_BASIC. To avoid this warning message, consider manually setting the gravity routine after changing integrators.");
@@ -65,13 +712,12 @@ void reb_calculate_acceleration(struct reb_simulation* r){
     }
     struct reb_particle* const particles = r->particles;
     const int N = r->N;
-    const int N_active = r->N_active;
     const double G = r->G;
-    const double softening2 = r->softening*r->softening;
-    const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
-    const int _N_real   = N  - r->N_var;
-    const int _N_active = ((N_active==-1)?_N_real:N_active);
-    const int _testparticle_type   = r->testparticle_type;
+    reb_gravity_ghostboxes_update(r);
+    if (r->N_interaction_groups && reb_calculate_acceleration_with_groups(r)){
+        // Interactions are counted by reb_calculate_acceleration_groups().
+        return;
+    }
     switch (r->gravity){
         case REB_GRAVITY_NONE: // Do nothing.
         for (int j=0; j<N; j++){
@@ -85,36 +731,34 @@ void reb_calculate_acceleration(struct reb_simulation* r){
             if (r->integrator != REB_INTEGRATOR_WHFAST && r->integrator != REB_INTEGRATOR_SABA ){
                 reb_warning(r, "An integrator other than WHFast/SABA is being used with REB_GRAVITY_JACOBI. This is probably not correct. Use another gravity routine such as REB_GRAVITY_BASIC.");
             }
+            // Test particles of type 0 do not contribute to the Jacobi coordinates 
+            // and are calculated separately after all the active particles.
+            const int _N_jacobi = (r->N_active==-1 || r->testparticle_type==1)?N:MIN(N, MAX(r->N_active,2));
             double Rjx = 0.;
             double Rjy = 0.;
             double Rjz = 0.;
             double Mj = 0.;
-            for (int j=0; j<N; j++){
+            for (int j=0; j<_N_jacobi; j++){
                 particles[j].ax = 0; 
                 particles[j].ay = 0; 
                 particles[j].az = 0; 
-                for (int i=0; i<j+1; i++){
-                    if (j>1){
+                if (j>1){
+                    // Note: ignoring the Jacobi term for j==1 and the direct term for 
+                    // i==0 && j==1 as they cancel. The terms for i<j are summed up in 
+                    // a loop without branches, the Jacobi term for i==j is added last.
+                    const double Qjx = particles[j].x - Rjx/Mj; 
+                    const double Qjy = particles[j].y - Rjy/Mj;
+                    const double Qjz = particles[j].z - Rjz/Mj;
+                    const double drj = sqrt(Qjx*Qjx + Qjy*Qjy + Qjz*Qjz);
+                    const double prefactQ = G*(-particles[j].m)/(drj*drj*drj); //rearranged such that m==0 does not diverge
+                    for (int i=0; i<j; i++){
                         ////////////////
                         // Jacobi Term
-                        // Note: ignoring j==1 term here and below as they cancel
-                        const double Qjx = particles[j].x - Rjx/Mj; 
-                        const double Qjy = particles[j].y - Rjy/Mj;
-                        const double Qjz = particles[j].z - Rjz/Mj;
-                        const double dr = sqrt(Qjx*Qjx + Qjy*Qjy + Qjz*Qjz);
-                        double dQjdri = Mj; 
-                        if (i<j){
-                            dQjdri = -particles[j].m; //rearranged such that m==0 does not diverge
-                        }
-                        const double prefact = G*dQjdri/(dr*dr*dr);
-                        particles[i].ax    += prefact*Qjx;
-                        particles[i].ay    += prefact*Qjy;
-                        particles[i].az    += prefact*Qjz;
-                    }
-                    if (i!=j && (i!=0 || j!=1)){
+                        particles[i].ax    += prefactQ*Qjx;
+                        particles[i].ay    += prefactQ*Qjy;
+                        particles[i].az    += prefactQ*Qjz;
                         ////////////////
                         // Direct Term
-                        // Note: ignoring i==0 && j==1 term here and above as they cancel 
                         const double dx = particles[i].x - particles[j].x;
                         const double dy = particles[i].y - particles[j].y;
                         const double dz = particles[i].z - particles[j].z;
@@ -130,646 +774,574 @@ void reb_calculate_acceleration(struct reb_simulation* r){
                         particles[j].ay    += prefacti*dy;
                         particles[j].az    += prefacti*dz;
                     }
+                    const double prefactQj = G*Mj/(drj*drj*drj);
+                    particles[j].ax    += prefactQj*Qjx;
+                    particles[j].ay    += prefactQj*Qjy;
+                    particles[j].az    += prefactQj*Qjz;
                 }
                 Rjx += particles[j].m*particles[j].x;
                 Rjy += particles[j].m*particles[j].y;
                 Rjz += particles[j].m*particles[j].z;
                 Mj += particles[j].m;
             }
+            if (_N_jacobi<N){
+                reb_calculate_acceleration_jacobi_testparticles(r, _N_jacobi, Rjx, Rjy, Rjz, Mj);
+            }
         }
         break;
         case REB_GRAVITY_BASIC:
+#ifdef MPI
+            if (r->mpi_direct && r->mpi_root_owner){
+                reb_calculate_acceleration_basic_mpi(r);
+                break;
+            }
+#endif // MPI
+#if defined(GPU)
+            reb_calculate_acceleration_basic_gpu(r);
+#elif defined(SIMD)
+            reb_calculate_acceleration_basic_simd(r);
+#elif defined(OPENMP)
+            reb_calculate_acceleration_basic_omp(r);
+#else // SIMD
         {
-            const int nghostx = r->nghostx;
-            const int nghosty = r->nghosty;
-            const int nghostz = r->nghostz;
-#ifndef OPENMP // OPENMP off
+            const double softening2 = r->softening*r->softening;
+            const int _N_real   = N  - r->N_var;
+            const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+            const int _testparticle_type   = r->testparticle_type;
+            const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
             const int starti = (_gravity_ignore_terms==0)?1:2;
             const int startj = (_gravity_ignore_terms==2)?1:0;
-#endif // OPENMP
-#pragma omp parallel for 
+            const int tile = reb_gravity_tile_size(r);
+            const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+            const int prune = r->gravity_ghostbox_tolerance>0.;
             for (int i=0; i<N; i++){
                 particles[i].ax = 0; 
                 particles[i].ay = 0; 
                 particles[i].az = 0; 
             }
-            // Summing over all Ghost Boxes
-            for (int gbx=-nghostx; gbx<=nghostx; gbx++){
-            for (int gby=-nghosty; gby<=nghosty; gby++){
-            for (int gbz=-nghostz; gbz<=nghostz; gbz++){
-                struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
-                // All active particle pairs
-#ifndef OPENMP // OPENMP off, do O(1/2*N^2)
-                for (int i=starti; i<_N_active; i++){
+            // All active particle pairs, O(1/2*N^2), summed over all ghost boxes
+            for (int ib=starti; ib<_N_active; ib+=tile){
+            const int iend = MIN(ib+tile, _N_active);
+            for (int jb=startj; jb<iend; jb+=tile){
+                const int jend = MIN(jb+tile, iend);
+                reb_gravity_basic_blocks(r, ib, iend, jb, jend, &gbs, prune, G, softening2);
                 if (reb_sigint) return;
-                for (int j=startj; j<i; j++){
-                    const double dx = (gb.shiftx+particles[i].x) - particles[j].x;
-                    const double dy = (gb.shifty+particles[i].y) - particles[j].y;
-                    const double dz = (gb.shiftz+particles[i].z) - particles[j].z;
-                    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                    const double prefact = G/(_r*_r*_r);
-                    const double prefactj = -prefact*particles[j].m;
-                    const double prefacti = prefact*particles[i].m;
-                    
-                    particles[i].ax    += prefactj*dx;
-                    particles[i].ay    += prefactj*dy;
-                    particles[i].az    += prefactj*dz;
-                    particles[j].ax    += prefacti*dx;
-                    particles[j].ay    += prefacti*dy;
-                    particles[j].az    += prefacti*dz;
-                }
-                }
-#else // OPENMP on, do O(N^2)
-#pragma omp parallel for
-                for (int i=0; i<_N_real; i++){
-                for (int j=0; j<_N_active; j++){
-                    if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0) )) continue;
-                    if (_gravity_ignore_terms==2 && ((j==0 || i==0) )) continue;
-                    if (i==j) continue;
-                    const double dx = (gb.shiftx+particles[i].x) - particles[j].x;
-                    const double dy = (gb.shifty+particles[i].y) - particles[j].y;
-                    const double dz = (gb.shiftz+particles[i].z) - particles[j].z;
-                    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                    const double prefact = -G/(_r*_r*_r)*particles[j].m;
-                    
-                    particles[i].ax    += prefact*dx;
-                    particles[i].ay    += prefact*dy;
-                    particles[i].az    += prefact*dz;
-                }
-                }
-#endif // OPENMP
-                // Interactions of test particles with active particles
-#ifndef OPENMP // OPENMP off
-                const int startitestp = MAX(_N_active, starti);
-                for (int i=startitestp; i<_N_real; i++){
+            }
+            }
+            // Interactions of test particles with active particles
+            // (test particles of type 0 are calculated separately below)
+            const int startitestp = MAX(_N_active, starti);
+            if (_testparticle_type){
+            for (int ib=startitestp; ib<_N_real; ib+=tile){
+            const int iend = MIN(ib+tile, _N_real);
+            for (int jb=startj; jb<_N_active; jb+=tile){
+                const int jend = MIN(jb+tile, _N_active);
+                reb_gravity_basic_blocks(r, ib, iend, jb, jend, &gbs, prune, G, softening2);
                 if (reb_sigint) return;
-                for (int j=startj; j<_N_active; j++){
-                    const double dx = (gb.shiftx+particles[i].x) - particles[j].x;
-                    const double dy = (gb.shifty+particles[i].y) - particles[j].y;
-                    const double dz = (gb.shiftz+particles[i].z) - particles[j].z;
-                    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                    const double prefact = G/(_r*_r*_r);
-                    const double prefactj = -prefact*particles[j].m;
-                    
-                    particles[i].ax    += prefactj*dx;
-                    particles[i].ay    += prefactj*dy;
-                    particles[i].az    += prefactj*dz;
-                    if (_testparticle_type){
-                        const double prefacti = prefact*particles[i].m;
-                        particles[j].ax    += prefacti*dx;
-                        particles[j].ay    += prefacti*dy;
-                        particles[j].az    += prefacti*dz;
-                    }
-                }
-                }
-#else // OPENMP on
-                if (_testparticle_type){
-#pragma omp parallel for
-				for (int i=0; i<_N_active; i++){
-				for (int j=_N_active; j<_N_real; j++){
-					if (_gravity_ignore_terms==1 && ((j==1 && i==0) )) continue;
-					if (_gravity_ignore_terms==2 && ((j==0 || i==0) )) continue;
-					const double dx = (gb.shiftx+particles[i].x) - particles[j].x;
-					const double dy = (gb.shifty+particles[i].y) - particles[j].y;
-					const double dz = (gb.shiftz+particles[i].z) - particles[j].z;
-					const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-					const double prefact = -G/(_r*_r*_r)*particles[j].m;
-					
-					particles[i].ax    += prefact*dx;
-					particles[i].ay    += prefact*dy;
-					particles[i].az    += prefact*dz;
-				}
-				}
-                }
-#endif // OPENMP
             }
             }
             }
+            if (!_testparticle_type){
+                reb_calculate_acceleration_testparticles(r, startj, _N_active, MAX(_N_active, starti), _N_real);
+            }
         }
+#endif // SIMD
         break;
         case REB_GRAVITY_COMPENSATED:
+            reb_calculate_acceleration_compensated(r);
+        break;
+        case REB_GRAVITY_TREE:
         {
-            if (r->gravity_cs_allocatedN<N){
-                r->gravity_cs = realloc(r->gravity_cs,N*sizeof(struct reb_vec3d));
-                r->gravity_cs_allocatedN = N;
+            PROFILING_START(r)
+#ifndef MPI
+            if (r->tree_group_size>1){
+                reb_calculate_acceleration_tree_groups(r);
+                PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+                break;
             }
-            struct reb_vec3d* restrict const cs = r->gravity_cs;
+#endif // MPI
 #pragma omp parallel for schedule(guided)
-            for (int i=0; i<_N_real; i++){
-                particles[i].ax = 0.; 
-                particles[i].ay = 0.; 
-                particles[i].az = 0.; 
-                cs[i].x = 0.;
-                cs[i].y = 0.;
-                cs[i].z = 0.;
+            for (int i=0; i<N; i++){
+                particles[i].ax = 0; 
+                particles[i].ay = 0; 
+                particles[i].az = 0; 
             }
-            // Summing over all massive particle pairs
-#ifdef OPENMP
-#pragma omp parallel for schedule(guided)
-            for (int i=0; i<_N_active; i++){
-            for (int j=0; j<_N_active; j++){
-                if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                if (i==j) continue;
-                const double dx = particles[i].x - particles[j].x;
-                const double dy = particles[i].y - particles[j].y;
-                const double dz = particles[i].z - particles[j].z;
-                const double r2 = dx*dx + dy*dy + dz*dz + softening2;
-                const double r = sqrt(r2);
-                const double prefact  = G/(r2*r);
-                const double prefactj = -prefact*particles[j].m;
-                
-                {
-                double ix = prefactj*dx;
-                double yx = ix - cs[i].x;
-                double tx = particles[i].ax + yx;
-                cs[i].x = (tx - particles[i].ax) - yx;
-                particles[i].ax = tx;
-
-                double iy = prefactj*dy;
-                double yy = iy- cs[i].y;
-                double ty = particles[i].ay + yy;
-                cs[i].y = (ty - particles[i].ay) - yy;
-                particles[i].ay = ty;
-                
-                double iz = prefactj*dz;
-                double yz = iz - cs[i].z;
-                double tz = particles[i].az + yz;
-                cs[i].z = (tz - particles[i].az) - yz;
-                particles[i].az = tz;
+            uint64_t interactions = 0;
+            uint64_t cells_opened = 0;
+            const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+            const int prune = gbs.N>1 && r->gravity_ghostbox_tolerance>0.;
+            double m_box = 0.;
+            if (prune){
+                for (int k=0; k<r->root_n; k++){
+                    if (r->tree_root[k]!=NULL) m_box += r->tree_root[k]->m;
                 }
             }
-            }
-
-            // Testparticles
-#pragma omp parallel for schedule(guided)
-            for (int i=_N_active; i<_N_real; i++){
-            for (int j=0; j<_N_active; j++){
-                if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                const double dx = particles[i].x - particles[j].x;
-                const double dy = particles[i].y - particles[j].y;
-                const double dz = particles[i].z - particles[j].z;
-                const double r2 = dx*dx + dy*dy + dz*dz + softening2;
-                const double r = sqrt(r2);
-                const double prefact  = G/(r2*r);
-                const double prefactj = -prefact*particles[j].m;
-                
-                {
-                double ix = prefactj*dx;
-                double yx = ix - cs[i].x;
-                double tx = particles[i].ax + yx;
-                cs[i].x = (tx - particles[i].ax) - yx;
-                particles[i].ax = tx;
-
-                double iy = prefactj*dy;
-                double yy = iy- cs[i].y;
-                double ty = particles[i].ay + yy;
-                cs[i].y = (ty - particles[i].ay) - yy;
-                particles[i].ay = ty;
-                
-                double iz = prefactj*dz;
-                double yz = iz - cs[i].z;
-                double tz = particles[i].az + yz;
-                cs[i].z = (tz - particles[i].az) - yz;
-                particles[i].az = tz;
-                }
-            }
-            }
-            if (_testparticle_type){
-#pragma omp parallel for schedule(guided)
-                for (int j=0; j<_N_active; j++){
-                for (int i=_N_active; i<_N_real; i++){
-                    if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                    if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                    const double dx = particles[i].x - particles[j].x;
-                    const double dy = particles[i].y - particles[j].y;
-                    const double dz = particles[i].z - particles[j].z;
-                    const double r2 = dx*dx + dy*dy + dz*dz + softening2;
-                    const double r = sqrt(r2);
-                    const double prefact  = G/(r2*r);
-                    const double prefacti = prefact*particles[i].m;
-                    {
-                    double ix = prefacti*dx;
-                    double yx = ix - cs[j].x;
-                    double tx = particles[j].ax + yx;
-                    cs[j].x = (tx - particles[j].ax) - yx;
-                    particles[j].ax = tx;
-
-                    double iy = prefacti*dy;
-                    double yy = iy - cs[j].y;
-                    double ty = particles[j].ay + yy;
-                    cs[j].y = (ty - particles[j].ay) - yy;
-                    particles[j].ay = ty;
-                    
-                    double iz = prefacti*dz;
-                    double yz = iz - cs[j].z;
-                    double tz = particles[j].az + yz;
-                    cs[j].z = (tz - particles[j].az) - yz;
-                    particles[j].az = tz;
-                    }
-                }
-                }
-            }
-#else // OPENMP
-            for (int i=0; i<_N_active; i++){
-            if (reb_sigint) return;
-            for (int j=i+1; j<_N_active; j++){
-                if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                const double dx = particles[i].x - particles[j].x;
-                const double dy = particles[i].y - particles[j].y;
-                const double dz = particles[i].z - particles[j].z;
-                const double r2 = dx*dx + dy*dy + dz*dz + softening2;
-                const double r = sqrt(r2);
-                const double prefact  = G/(r2*r);
-                const double prefacti = prefact*particles[i].m;
-                const double prefactj = -prefact*particles[j].m;
-                
-                {
-                double ix = prefactj*dx;
-                double yx = ix - cs[i].x;
-                double tx = particles[i].ax + yx;
-                cs[i].x = (tx - particles[i].ax) - yx;
-                particles[i].ax = tx;
-
-                double iy = prefactj*dy;
-                double yy = iy- cs[i].y;
-                double ty = particles[i].ay + yy;
-                cs[i].y = (ty - particles[i].ay) - yy;
-                particles[i].ay = ty;
-                
-                double iz = prefactj*dz;
-                double yz = iz - cs[i].z;
-                double tz = particles[i].az + yz;
-                cs[i].z = (tz - particles[i].az) - yz;
-                particles[i].az = tz;
-                }
-                
-                {
-                double ix = prefacti*dx;
-                double yx = ix - cs[j].x;
-                double tx = particles[j].ax + yx;
-                cs[j].x = (tx - particles[j].ax) - yx;
-                particles[j].ax = tx;
-
-                double iy = prefacti*dy;
-                double yy = iy - cs[j].y;
-                double ty = particles[j].ay + yy;
-                cs[j].y = (ty - particles[j].ay) - yy;
-                particles[j].ay = ty;
-                
-                double iz = prefacti*dz;
-                double yz = iz - cs[j].z;
-                double tz = particles[j].az + yz;
-                cs[j].z = (tz - particles[j].az) - yz;
-                particles[j].az = tz;
-                }
-            }
-            }
-
-            // Testparticles
-            for (int i=_N_active; i<_N_real; i++){
-            if (reb_sigint) return;
-            for (int j=0; j<_N_active; j++){
-                if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                const double dx = particles[i].x - particles[j].x;
-                const double dy = particles[i].y - particles[j].y;
-                const double dz = particles[i].z - particles[j].z;
-                const double r2 = dx*dx + dy*dy + dz*dz + softening2;
-                const double r = sqrt(r2);
-                const double prefact  = G/(r2*r);
-                const double prefactj = -prefact*particles[j].m;
-                
-                {
-                double ix = prefactj*dx;
-                double yx = ix - cs[i].x;
-                double tx = particles[i].ax + yx;
-                cs[i].x = (tx - particles[i].ax) - yx;
-                particles[i].ax = tx;
-
-                double iy = prefactj*dy;
-                double yy = iy- cs[i].y;
-                double ty = particles[i].ay + yy;
-                cs[i].y = (ty - particles[i].ay) - yy;
-                particles[i].ay = ty;
-                
-                double iz = prefactj*dz;
-                double yz = iz - cs[i].z;
-                double tz = particles[i].az + yz;
-                cs[i].z = (tz - particles[i].az) - yz;
-                particles[i].az = tz;
-                }
-                if (_testparticle_type){
-                    const double prefacti = prefact*particles[i].m;
-                    {
-                    double ix = prefacti*dx;
-                    double yx = ix - cs[j].x;
-                    double tx = particles[j].ax + yx;
-                    cs[j].x = (tx - particles[j].ax) - yx;
-                    particles[j].ax = tx;
-
-                    double iy = prefacti*dy;
-                    double yy = iy - cs[j].y;
-                    double ty = particles[j].ay + yy;
-                    cs[j].y = (ty - particles[j].ay) - yy;
-                    particles[j].ay = ty;
-                    
-                    double iz = prefacti*dz;
-                    double yz = iz - cs[j].z;
-                    double tz = particles[j].az + yz;
-                    cs[j].z = (tz - particles[j].az) - yz;
-                    particles[j].az = tz;
-                    }
-                }
-            }
-            }
-#endif // OPENMP
-        }
-        break;
-        case REB_GRAVITY_TREE:
-        {
-#pragma omp parallel for schedule(guided)
+            // Collision candidates are collected during the walk (tree_fused_walk), 
+            // unless ghost boxes are skipped.
+            struct reb_collision_fused* const fused = prune ? NULL : reb_collision_fused_begin(r);
+            // Summing over all particles. The loop over ghost boxes is inside, 
+            // so that every particle accumulates its acceleration in the same order as before.
+#pragma omp parallel reduction(+:interactions,cells_opened)
+            {
+            TRACE_BEGIN(r, REB_TRACE_PHASE_GRAVITY_WALK)
+#pragma omp for schedule(guided)
             for (int i=0; i<N; i++){
-                particles[i].ax = 0; 
-                particles[i].ay = 0; 
-                particles[i].az = 0; 
-            }
-            // Summing over all Ghost Boxes
-            for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
-            for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
-            for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
-                // Summing over all particle pairs
-#pragma omp parallel for schedule(guided)
-                for (int i=0; i<N; i++){
 #ifndef OPENMP
-                    if (reb_sigint) return;
+                if (reb_sigint) break;
 #endif // OPENMP
-                    struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+#if defined(MPI) && defined(OPENMP)
+                // The essential trees are in transit. Thread 0 is the 
+                // thread which makes the MPI calls (MPI_THREAD_FUNNELED).
+                if (r->mpi_pipeline && i%64==0 && omp_get_thread_num()==0){
+                    reb_communication_mpi_progress(r);
+                }
+#endif // MPI && OPENMP
+                struct reb_gravity_walk_counts counts = {0};
+                for (int g=0; g<gbs.N; g++){
+                    struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
                     // Precalculated shifted position
                     gb.shiftx += particles[i].x;
                     gb.shifty += particles[i].y;
                     gb.shiftz += particles[i].z;
-                    reb_calculate_acceleration_for_particle(r, i, gb);
+                    if (prune && g!=gbs.central){
+                        // Skip the entire ghost box before testing its root cells
+                        const double p[3] = {gb.shiftx, gb.shifty, gb.shiftz};
+                        if (reb_gravity_ghostbox_prune_box(r, m_box, p, p)) continue;
+                    }
+                    reb_calculate_acceleration_for_particle(r, i, gb, g!=gbs.central, &counts, fused, fused?fused->gb_map[g]:-1);
                 }
+                interactions += counts.interactions;
+                cells_opened += counts.cells_opened;
             }
+            TRACE_END(r, REB_TRACE_PHASE_GRAVITY_WALK)
             }
+            if (fused){
+                reb_collision_fused_end(r, fused);
             }
+            r->counters.gravity_interactions += interactions;
+            r->counters.tree_cells_opened += cells_opened;
+            PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
         }
         break;
+        case REB_GRAVITY_FMM:
+#ifdef MPI
+            reb_exit("REB_GRAVITY_FMM is not supported with MPI. Use REB_GRAVITY_TREE instead.");
+#endif // MPI
+            reb_calculate_acceleration_fmm(r);
+        break;
+        case REB_GRAVITY_FFT:
+#ifdef MPI
+            reb_exit("REB_GRAVITY_FFT is not supported with MPI.");
+#endif // MPI
+            reb_gravity_fft_calculate_acceleration(r);
+        break;
         case REB_GRAVITY_MERCURIUS:
         {
+            // The switching function is passed on as a constant, so that the compiler 
+            // generates a specialized kernel for each built-in switching function.
             double (*_L) (const struct reb_simulation* const r, double d, double dcrit) = r->ri_mercurius.L;
-            switch (r->ri_mercurius.mode){
-                case 0: // WHFAST part
-                {
-                    const double* const dcrit = r->ri_mercurius.dcrit;
-#ifndef OPENMP
-                    for (int i=0; i<_N_real; i++){
-                        particles[i].ax = 0; 
-                        particles[i].ay = 0; 
-                        particles[i].az = 0; 
-                    }
-                    for (int i=2; i<_N_active; i++){
-                        if (reb_sigint) return;
-                        for (int j=1; j<i; j++){
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[i],dcrit[j]);
-                            const double L = _L(r,_r,dcritmax);
-                            const double prefact = G*L/(_r*_r*_r);
-                            const double prefactj = -prefact*particles[j].m;
-                            const double prefacti = prefact*particles[i].m;
-                            particles[i].ax    += prefactj*dx;
-                            particles[i].ay    += prefactj*dy;
-                            particles[i].az    += prefactj*dz;
-                            particles[j].ax    += prefacti*dx;
-                            particles[j].ay    += prefacti*dy;
-                            particles[j].az    += prefacti*dz;
-                        }
-                    }
-                    const int startitestp = MAX(_N_active,2);
-                    for (int i=startitestp; i<_N_real; i++){
-                        if (reb_sigint) return;
-                        for (int j=1; j<_N_active; j++){
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[i],dcrit[j]);
-                            const double L = _L(r,_r,dcritmax);
-                            const double prefact = G*L/(_r*_r*_r);
-                            const double prefactj = -prefact*particles[j].m;
-                            particles[i].ax    += prefactj*dx;
-                            particles[i].ay    += prefactj*dy;
-                            particles[i].az    += prefactj*dz;
-                            if (_testparticle_type){
-                                const double prefacti = prefact*particles[i].m;
-                                particles[j].ax    += prefacti*dx;
-                                particles[j].ay    += prefacti*dy;
-                                particles[j].az    += prefacti*dz;
-                            }
-                        }
-                    }
-#else // OPENMP
-                    particles[0].ax = 0; 
-                    particles[0].ay = 0; 
-                    particles[0].az = 0; 
-#pragma omp parallel for schedule(guided)
-                    for (int i=1; i<_N_real; i++){
-                        particles[i].ax = 0; 
-                        particles[i].ay = 0; 
-                        particles[i].az = 0; 
-                        for (int j=1; j<_N_active; j++){
-                            if (i==j) continue;
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[i],dcrit[j]);
-                            const double L = _L(r,_r,dcritmax);
-                            const double prefact = -G*particles[j].m*L/(_r*_r*_r);
-                            particles[i].ax    += prefact*dx;
-                            particles[i].ay    += prefact*dy;
-                            particles[i].az    += prefact*dz;
-                        }
-                    }
-                    if (_testparticle_type){
-                    for (int i=1; i<_N_active; i++){
-                        for (int j=_N_active; j<_N_real; j++){
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[i],dcrit[j]);
-                            const double L = _L(r,_r,dcritmax);
-                            const double prefact = -G*particles[j].m*L/(_r*_r*_r);
-                            particles[i].ax    += prefact*dx;
-                            particles[i].ay    += prefact*dy;
-                            particles[i].az    += prefact*dz;
-                        }
-                    }
-                    }
-#endif // OPENMP
-                }
-                break;
-                case 1: // IAS15 part
-                {
-                    const double m0 = r->particles[0].m;
-                    const double* const dcrit = r->ri_mercurius.dcrit;
-                    const int encounterN = r->ri_mercurius.encounterN;
-                    const int encounterNactive = r->ri_mercurius.encounterNactive;
-                    int* map = r->ri_mercurius.encounter_map;
-#ifndef OPENMP
-                    particles[0].ax = 0; // map[0] is always 0 
-                    particles[0].ay = 0; 
-                    particles[0].az = 0; 
-                    // Acceleration due to star
-                    for (int i=1; i<encounterN; i++){
-                        int mi = map[i];
-                        const double x = particles[mi].x;
-                        const double y = particles[mi].y;
-                        const double z = particles[mi].z;
-                        const double _r = sqrt(x*x + y*y + z*z + softening2);
-                        double prefact = -G/(_r*_r*_r)*m0;
-                        particles[mi].ax    = prefact*x;
-                        particles[mi].ay    = prefact*y;
-                        particles[mi].az    = prefact*z;
-                    }
-                    // We're in a heliocentric coordinate system.
-                    // The star feels no acceleration
-                    // Interactions between active-active
-                    for (int i=2; i<encounterNactive; i++){
-                        int mi = map[i];
-                        for (int j=1; j<i; j++){
-                            int mj = map[j];
-                            const double dx = particles[mi].x - particles[mj].x;
-                            const double dy = particles[mi].y - particles[mj].y;
-                            const double dz = particles[mi].z - particles[mj].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
-                            const double L = _L(r,_r,dcritmax);
-                            double prefact = G*(1.-L)/(_r*_r*_r);
-                            double prefactj = -prefact*particles[mj].m;
-                            double prefacti = prefact*particles[mi].m;
-                            particles[mi].ax    += prefactj*dx;
-                            particles[mi].ay    += prefactj*dy;
-                            particles[mi].az    += prefactj*dz;
-                            particles[mj].ax    += prefacti*dx;
-                            particles[mj].ay    += prefacti*dy;
-                            particles[mj].az    += prefacti*dz;
-                        }
-                    }
-                    // Interactions between active-testparticle
-                    const int startitestp = MAX(encounterNactive,2);
-                    for (int i=startitestp; i<encounterN; i++){
-                        int mi = map[i];
-                        for (int j=1; j<encounterNactive; j++){
-                            int mj = map[j];
-                            const double dx = particles[mi].x - particles[mj].x;
-                            const double dy = particles[mi].y - particles[mj].y;
-                            const double dz = particles[mi].z - particles[mj].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
-                            const double L = _L(r,_r,dcritmax);
-                            double prefact = G*(1.-L)/(_r*_r*_r);
-                            double prefactj = -prefact*particles[mj].m;
-                            particles[mi].ax    += prefactj*dx;
-                            particles[mi].ay    += prefactj*dy;
-                            particles[mi].az    += prefactj*dz;
-                            if (_testparticle_type){
-                                double prefacti = prefact*particles[mi].m;
-                                particles[mj].ax    += prefacti*dx;
-                                particles[mj].ay    += prefacti*dy;
-                                particles[mj].az    += prefacti*dz;
-                            }
-                        }
-                    }
-#else // OPENMP
-                    particles[0].ax = 0; // map[0] is always 0 
-                    particles[0].ay = 0; 
-                    particles[0].az = 0; 
-                    // We're in a heliocentric coordinate system.
-                    // The star feels no acceleration
-#pragma omp parallel for schedule(guided)
-                    for (int i=1; i<encounterN; i++){
-                        int mi = map[i];
-                        particles[mi].ax = 0; 
-                        particles[mi].ay = 0; 
-                        particles[mi].az = 0; 
-                        // Acceleration due to star
-                        const double x = particles[mi].x;
-                        const double y = particles[mi].y;
-                        const double z = particles[mi].z;
-                        const double _r = sqrt(x*x + y*y + z*z + softening2);
-                        double prefact = -G/(_r*_r*_r)*m0;
-                        particles[mi].ax    += prefact*x;
-                        particles[mi].ay    += prefact*y;
-                        particles[mi].az    += prefact*z;
-                        for (int j=1; j<encounterNactive; j++){
-                            if (i==j) continue;
-                            int mj = map[j];
-                            const double dx = x - particles[mj].x;
-                            const double dy = y - particles[mj].y;
-                            const double dz = z - particles[mj].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
-                            const double L = _L(r,_r,dcritmax);
-                            double prefact = -G*particles[mj].m*(1.-L)/(_r*_r*_r);
-                            particles[mi].ax    += prefact*dx;
-                            particles[mi].ay    += prefact*dy;
-                            particles[mi].az    += prefact*dz;
-                        }
-                    }
-                    if (_testparticle_type){
-#pragma omp parallel for schedule(guided)
-                    for (int i=1; i<encounterNactive; i++){
-                        int mi = map[i];
-                        const double x = particles[mi].x;
-                        const double y = particles[mi].y;
-                        const double z = particles[mi].z;
-                        for (int j=encounterNactive; j<encounterN; j++){
-                            int mj = map[j];
-                            const double dx = x - particles[mj].x;
-                            const double dy = y - particles[mj].y;
-                            const double dz = z - particles[mj].z;
-                            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-                            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
-                            const double L = _L(r,_r,dcritmax);
-                            double prefact = -G*particles[mj].m*(1.-L)/(_r*_r*_r);
-                            particles[mi].ax    += prefact*dx;
-                            particles[mi].ay    += prefact*dy;
-                            particles[mi].az    += prefact*dz;
-                        }
-                    }
-                    }
-#endif // OPENMP
-                }
-                break;
-                case 2: // Skipp WHFAST part because of synchronization
-                break;
+            if (_L==reb_integrator_mercurius_L_mercury){
+                reb_calculate_acceleration_mercurius(r, REB_MERCURIUS_L_MERCURY);
+            }else if (_L==reb_integrator_mercurius_L_infinity){
+                reb_calculate_acceleration_mercurius(r, REB_MERCURIUS_L_INFINITY);
+            }else if (_L==reb_integrator_mercurius_L_C4){
+                reb_calculate_acceleration_mercurius(r, REB_MERCURIUS_L_C4);
+            }else if (_L==reb_integrator_mercurius_L_C5){
+                reb_calculate_acceleration_mercurius(r, REB_MERCURIUS_L_C5);
+            }else{
+                reb_calculate_acceleration_mercurius(r, REB_MERCURIUS_L_CUSTOM);
             }
         }
         break;
         default:
             reb_exit("Gravity calculation not yet implemented.");
     }
+    reb_gravity_count_direct(r);
+}
+
+// Helper routines for the variational equations with REB_GRAVITY_BASIC and REB_GRAVITY_COMPENSATED
 
+/**
+  * @brief Separations and inverse distances of all pairs of real particles.
+  * @details Pair (i,j) with j<i is stored at index i*(i-1)/2+j. The separation is 
+  * dx = x_i - x_j. The arrays point into r->gravity_var_pairs.
+  */
+struct reb_gravity_var_pairs {
+    const double* dx;
+    const double* dy;
+    const double* dz;
+    const double* r2inv;    ///< 1/r^2
+    const double* r3inv;    ///< 1/r^3
+};
+
+static inline size_t reb_gravity_var_pairs_row(const int i){
+    return (size_t)i*(i-1)/2;
 }
 
-void reb_calculate_acceleration_var(struct reb_simulation* r){
+/**
+  * @brief Calculates the separations and inverse distances of all pairs of real particles.
+  * @details The rows are distributed over OpenMP threads, each row is vectorized.
+  */
+static struct reb_gravity_var_pairs reb_gravity_var_pairs_update(struct reb_simulation* const r, const int N_real){
+    const struct reb_particle* const particles = r->particles;
+    const size_t N_pairs = N_real>1?reb_gravity_var_pairs_row(N_real):0;
+    if (r->gravity_var_pairs_allocatedN<N_pairs){
+        r->gravity_var_pairs = realloc(r->gravity_var_pairs, sizeof(double)*5*N_pairs);
+        r->gravity_var_pairs_allocatedN = N_pairs;
+    }
+    double* const buf = r->gravity_var_pairs;
+    double* const pdx = buf;
+    double* const pdy = buf + N_pairs;
+    double* const pdz = buf + 2*N_pairs;
+    double* const pr2inv = buf + 3*N_pairs;
+    double* const pr3inv = buf + 4*N_pairs;
+#pragma omp parallel for schedule(guided)
+    for (int i=1; i<N_real; i++){
+        const size_t o = reb_gravity_var_pairs_row(i);
+        double* const restrict dx = pdx + o;
+        double* const restrict dy = pdy + o;
+        double* const restrict dz = pdz + o;
+        double* const restrict r2inv = pr2inv + o;
+        double* const restrict r3inv = pr3inv + o;
+        const double xi = particles[i].x;
+        const double yi = particles[i].y;
+        const double zi = particles[i].z;
+#pragma omp simd
+        for (int j=0; j<i; j++){
+            dx[j] = xi - particles[j].x;
+            dy[j] = yi - particles[j].y;
+            dz[j] = zi - particles[j].z;
+            const double r2 = dx[j]*dx[j] + dy[j]*dy[j] + dz[j]*dz[j];
+            r2inv[j] = 1./r2;
+            r3inv[j] = 1./(r2*sqrt(r2));
+        }
+    }
+    struct reb_gravity_var_pairs pairs = {
+        .dx = pdx, 
+        .dy = pdy, 
+        .dz = pdz, 
+        .r2inv = pr2inv, 
+        .r3inv = pr3inv,
+    };
+    return pairs;
+}
+
+/**
+  * @brief First order variational equations for the interactions of particle i with particles jstart to jend-1 (jend<=i).
+  * @param update_j If 1, the back reaction on particle j is added.
+  */
+static inline void reb_calculate_acceleration_var1_row(const struct reb_particle* const particles, struct reb_particle* const particles_var1, const struct reb_gravity_var_pairs* const pairs, const double G, const int i, const int jstart, const int jend, const int update_j){
+    const size_t o = reb_gravity_var_pairs_row(i);
+    const double* const restrict pdx = pairs->dx + o;
+    const double* const restrict pdy = pairs->dy + o;
+    const double* const restrict pdz = pairs->dz + o;
+    const double* const restrict pr2inv = pairs->r2inv + o;
+    const double* const restrict pr3inv = pairs->r3inv + o;
+    const double Gmi = G * particles[i].m;
+    const double dGmi = G*particles_var1[i].m;
+    const double dxi = particles_var1[i].x;
+    const double dyi = particles_var1[i].y;
+    const double dzi = particles_var1[i].z;
+    double aix = 0.;
+    double aiy = 0.;
+    double aiz = 0.;
+#pragma omp simd reduction(+:aix,aiy,aiz)
+    for (int j=jstart; j<jend; j++){
+        const double dx = pdx[j];
+        const double dy = pdy[j];
+        const double dz = pdz[j];
+        const double r3inv = pr3inv[j];
+        const double r5inv = 3.*r3inv*pr2inv[j];
+        const double ddx = dxi - particles_var1[j].x;
+        const double ddy = dyi - particles_var1[j].y;
+        const double ddz = dzi - particles_var1[j].z;
+        const double Gmj = G * particles[j].m;
+
+        // Variational equations
+        const double dxdx = dx*dx*r5inv - r3inv;
+        const double dydy = dy*dy*r5inv - r3inv;
+        const double dzdz = dz*dz*r5inv - r3inv;
+        const double dxdy = dx*dy*r5inv;
+        const double dxdz = dx*dz*r5inv;
+        const double dydz = dy*dz*r5inv;
+        const double dax =   ddx * dxdx + ddy * dxdy + ddz * dxdz;
+        const double day =   ddx * dxdy + ddy * dydy + ddz * dydz;
+        const double daz =   ddx * dxdz + ddy * dydz + ddz * dzdz;
+
+        // Variational mass contributions
+        const double dGmj = G*particles_var1[j].m;
+
+        aix += Gmj * dax - dGmj*r3inv*dx;
+        aiy += Gmj * day - dGmj*r3inv*dy;
+        aiz += Gmj * daz - dGmj*r3inv*dz;
+
+        if (update_j){
+            particles_var1[j].ax -= Gmi * dax - dGmi*r3inv*dx;
+            particles_var1[j].ay -= Gmi * day - dGmi*r3inv*dy;
+            particles_var1[j].az -= Gmi * daz - dGmi*r3inv*dz; 
+        }
+    }
+    particles_var1[i].ax += aix;
+    particles_var1[i].ay += aiy;
+    particles_var1[i].az += aiz;
+}
+
+static void reb_calculate_acceleration_var1(struct reb_simulation* const r, const struct reb_gravity_var_pairs* const pairs, const struct reb_variational_configuration vc){
+    const struct reb_particle* const particles = r->particles;
+    struct reb_particle* const particles_var1 = r->particles + vc.index;
+    const double G = r->G;
+    const int _N_real   = r->N - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int starti = (r->gravity_ignore_terms==0)?1:2;
+    const int startj = (r->gravity_ignore_terms==2)?1:0;
+    for (int i=0; i<_N_real; i++){
+        particles_var1[i].ax = 0.; 
+        particles_var1[i].ay = 0.; 
+        particles_var1[i].az = 0.; 
+    }
+    for (int i=starti; i<_N_active; i++){
+        reb_calculate_acceleration_var1_row(particles, particles_var1, pairs, G, i, startj, i, 1);
+    }
+    // Warning! The back reaction of test particles of type 1 does not make sense when the mass is varied!
+    for (int i=_N_active; i<_N_real; i++){
+        reb_calculate_acceleration_var1_row(particles, particles_var1, pairs, G, i, startj, _N_active, r->testparticle_type);
+    }
+}
+
+static void reb_calculate_acceleration_var1_testparticle(struct reb_simulation* const r, const struct reb_variational_configuration vc){
     struct reb_particle* const particles = r->particles;
+    struct reb_particle* const particles_var1 = particles + vc.index;
     const double G = r->G;
     const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
-    const int _testparticle_type   = r->testparticle_type;
+    const int _N_real   = r->N - r->N_var;
+    int i = vc.testparticle;
+    particles_var1[0].ax = 0.; 
+    particles_var1[0].ay = 0.; 
+    particles_var1[0].az = 0.; 
+    for (int j=0; j<_N_real; j++){
+        if (i==j) continue;
+        if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
+        if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
+        const double dx = particles[i].x - particles[j].x;
+        const double dy = particles[i].y - particles[j].y;
+        const double dz = particles[i].z - particles[j].z;
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double _r  = sqrt(r2);
+        const double r3inv = 1./(r2*_r);
+        const double r5inv = 3.*r3inv/r2;
+        const double ddx = particles_var1[0].x;
+        const double ddy = particles_var1[0].y;
+        const double ddz = particles_var1[0].z;
+        const double Gmj = G * particles[j].m;
+
+        // Variational equations
+        const double dxdx = dx*dx*r5inv - r3inv;
+        const double dydy = dy*dy*r5inv - r3inv;
+        const double dzdz = dz*dz*r5inv - r3inv;
+        const double dxdy = dx*dy*r5inv;
+        const double dxdz = dx*dz*r5inv;
+        const double dydz = dy*dz*r5inv;
+        const double dax =   ddx * dxdx + ddy * dxdy + ddz * dxdz;
+        const double day =   ddx * dxdy + ddy * dydy + ddz * dydz;
+        const double daz =   ddx * dxdz + ddy * dydz + ddz * dzdz;
+
+        // No variational mass contributions for test particles!
+
+        particles_var1[0].ax += Gmj * dax;
+        particles_var1[0].ay += Gmj * day;
+        particles_var1[0].az += Gmj * daz;
+
+    }
+}
+
+static void reb_calculate_acceleration_var2(struct reb_simulation* const r, const struct reb_gravity_var_pairs* const pairs, const struct reb_variational_configuration vc){
+    const struct reb_particle* const particles = r->particles;
+    struct reb_particle* const particles_var2 = r->particles + vc.index;
+    const struct reb_particle* const particles_var1a = r->particles + vc.index_1st_order_a;
+    const struct reb_particle* const particles_var1b = r->particles + vc.index_1st_order_b;
+    const double G = r->G;
+    const int _N_real   = r->N - r->N_var;
+    for (int i=0; i<_N_real; i++){
+        particles_var2[i].ax = 0.; 
+        particles_var2[i].ay = 0.; 
+        particles_var2[i].az = 0.; 
+    }
+    for (int i=1; i<_N_real; i++){
+        // TODO: Need to implement WH skipping
+        const size_t o = reb_gravity_var_pairs_row(i);
+        const double* const restrict pdx = pairs->dx + o;
+        const double* const restrict pdy = pairs->dy + o;
+        const double* const restrict pdz = pairs->dz + o;
+        const double* const restrict pr2inv = pairs->r2inv + o;
+        const double* const restrict pr3inv = pairs->r3inv + o;
+        const double Gmi = G * particles[i].m;
+        const double ddGmi = G*particles_var2[i].m;
+        const double dk1Gmi = G * particles_var1a[i].m;
+        const double dk2Gmi = G * particles_var1b[i].m;
+        double aix = 0.;
+        double aiy = 0.;
+        double aiz = 0.;
+#pragma omp simd reduction(+:aix,aiy,aiz)
+        for (int j=0; j<i; j++){
+            const double dx = pdx[j];
+            const double dy = pdy[j];
+            const double dz = pdz[j];
+            const double r3inv = pr3inv[j];
+            const double r5inv = r3inv*pr2inv[j];
+            const double r7inv = r5inv*pr2inv[j];
+            const double ddx = particles_var2[i].x - particles_var2[j].x;
+            const double ddy = particles_var2[i].y - particles_var2[j].y;
+            const double ddz = particles_var2[i].z - particles_var2[j].z;
+            const double Gmj = G * particles[j].m;
+            const double ddGmj = G*particles_var2[j].m;
+            
+            // Variational equations
+            // delta^(2) terms
+            double dax =         ddx * ( 3.*dx*dx*r5inv - r3inv )
+                       + ddy * ( 3.*dx*dy*r5inv )
+                       + ddz * ( 3.*dx*dz*r5inv );
+            double day =         ddx * ( 3.*dy*dx*r5inv )
+                       + ddy * ( 3.*dy*dy*r5inv - r3inv )
+                       + ddz * ( 3.*dy*dz*r5inv );
+            double daz =         ddx * ( 3.*dz*dx*r5inv )
+                       + ddy * ( 3.*dz*dy*r5inv )
+                       + ddz * ( 3.*dz*dz*r5inv - r3inv );
+            
+            // delta^(1) delta^(1) terms
+            const double dk1dx = particles_var1a[i].x - particles_var1a[j].x;
+            const double dk1dy = particles_var1a[i].y - particles_var1a[j].y;
+            const double dk1dz = particles_var1a[i].z - particles_var1a[j].z;
+            const double dk2dx = particles_var1b[i].x - particles_var1b[j].x;
+            const double dk2dy = particles_var1b[i].y - particles_var1b[j].y;
+            const double dk2dz = particles_var1b[i].z - particles_var1b[j].z;
+
+            const double rdk1 =  dx*dk1dx + dy*dk1dy + dz*dk1dz;
+            const double rdk2 =  dx*dk2dx + dy*dk2dy + dz*dk2dz;
+            const double dk1dk2 =  dk1dx*dk2dx + dk1dy*dk2dy + dk1dz*dk2dz;
+            dax     +=        3.* r5inv * dk2dx * rdk1
+                    + 3.* r5inv * dk1dx * rdk2
+                    + 3.* r5inv    * dx * dk1dk2  
+                        - 15.      * dx * r7inv * rdk1 * rdk2;
+            day     +=        3.* r5inv * dk2dy * rdk1
+                    + 3.* r5inv * dk1dy * rdk2
+                    + 3.* r5inv    * dy * dk1dk2  
+                        - 15.      * dy * r7inv * rdk1 * rdk2;
+            daz     +=        3.* r5inv * dk2dz * rdk1
+                    + 3.* r5inv * dk1dz * rdk2
+                    + 3.* r5inv    * dz * dk1dk2  
+                        - 15.      * dz * r7inv * rdk1 * rdk2;
+            
+            const double dk1Gmj = G * particles_var1a[j].m;
+            const double dk2Gmj = G * particles_var1b[j].m;
+
+            aix += Gmj * dax 
+                - ddGmj*r3inv*dx 
+                - dk2Gmj*r3inv*dk1dx + 3.*dk2Gmj*r5inv*dx*rdk1
+                - dk1Gmj*r3inv*dk2dx + 3.*dk1Gmj*r5inv*dx*rdk2;
+            aiy += Gmj * day 
+                - ddGmj*r3inv*dy
+                - dk2Gmj*r3inv*dk1dy + 3.*dk2Gmj*r5inv*dy*rdk1
+                - dk1Gmj*r3inv*dk2dy + 3.*dk1Gmj*r5inv*dy*rdk2;
+            aiz += Gmj * daz 
+                - ddGmj*r3inv*dz
+                - dk2Gmj*r3inv*dk1dz + 3.*dk2Gmj*r5inv*dz*rdk1
+                - dk1Gmj*r3inv*dk2dz + 3.*dk1Gmj*r5inv*dz*rdk2;
+                                                             
+            particles_var2[j].ax -= Gmi * dax 
+                - ddGmi*r3inv*dx
+                - dk2Gmi*r3inv*dk1dx + 3.*dk2Gmi*r5inv*dx*rdk1
+                - dk1Gmi*r3inv*dk2dx + 3.*dk1Gmi*r5inv*dx*rdk2;
+            particles_var2[j].ay -= Gmi * day 
+                - ddGmi*r3inv*dy
+                - dk2Gmi*r3inv*dk1dy + 3.*dk2Gmi*r5inv*dy*rdk1
+                - dk1Gmi*r3inv*dk2dy + 3.*dk1Gmi*r5inv*dy*rdk2;
+            particles_var2[j].az -= Gmi * daz 
+                - ddGmi*r3inv*dz
+                - dk2Gmi*r3inv*dk1dz + 3.*dk2Gmi*r5inv*dz*rdk1
+                - dk1Gmi*r3inv*dk2dz + 3.*dk1Gmi*r5inv*dz*rdk2;
+        }
+        particles_var2[i].ax += aix;
+        particles_var2[i].ay += aiy;
+        particles_var2[i].az += aiz;
+    }
+}
+
+static void reb_calculate_acceleration_var2_testparticle(struct reb_simulation* const r, const struct reb_variational_configuration vc){
+    struct reb_particle* const particles = r->particles;
+    struct reb_particle* const particles_var2 = particles + vc.index;
+    const struct reb_particle* const particles_var1a = particles + vc.index_1st_order_a;
+    const struct reb_particle* const particles_var1b = particles + vc.index_1st_order_b;
+    const double G = r->G;
+    const int _N_real   = r->N - r->N_var;
+    int i = vc.testparticle;
+    particles_var2[0].ax = 0.; 
+    particles_var2[0].ay = 0.; 
+    particles_var2[0].az = 0.; 
+    for (int j=0; j<_N_real; j++){
+        if (i==j) continue;
+        // TODO: Need to implement WH skipping
+        //if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
+        //if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
+        const double dx = particles[i].x - particles[j].x;
+        const double dy = particles[i].y - particles[j].y;
+        const double dz = particles[i].z - particles[j].z;
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double r  = sqrt(r2);
+        const double r3inv = 1./(r2*r);
+        const double r5inv = r3inv/r2;
+        const double r7inv = r5inv/r2;
+        const double ddx = particles_var2[0].x;
+        const double ddy = particles_var2[0].y;
+        const double ddz = particles_var2[0].z;
+        const double Gmj = G * particles[j].m;
+        
+        // Variational equations
+        // delta^(2) terms
+        double dax =         ddx * ( 3.*dx*dx*r5inv - r3inv )
+                   + ddy * ( 3.*dx*dy*r5inv )
+                   + ddz * ( 3.*dx*dz*r5inv );
+        double day =         ddx * ( 3.*dy*dx*r5inv )
+                   + ddy * ( 3.*dy*dy*r5inv - r3inv )
+                   + ddz * ( 3.*dy*dz*r5inv );
+        double daz =         ddx * ( 3.*dz*dx*r5inv )
+                   + ddy * ( 3.*dz*dy*r5inv )
+                   + ddz * ( 3.*dz*dz*r5inv - r3inv );
+        
+        // delta^(1) delta^(1) terms
+        const double dk1dx = particles_var1a[0].x;
+        const double dk1dy = particles_var1a[0].y;
+        const double dk1dz = particles_var1a[0].z;
+        const double dk2dx = particles_var1b[0].x;
+        const double dk2dy = particles_var1b[0].y;
+        const double dk2dz = particles_var1b[0].z;
+
+        const double rdk1 =  dx*dk1dx + dy*dk1dy + dz*dk1dz;
+        const double rdk2 =  dx*dk2dx + dy*dk2dy + dz*dk2dz;
+        const double dk1dk2 =  dk1dx*dk2dx + dk1dy*dk2dy + dk1dz*dk2dz;
+        dax     +=        3.* r5inv * dk2dx * rdk1
+                + 3.* r5inv * dk1dx * rdk2
+                + 3.* r5inv    * dx * dk1dk2  
+                    - 15.      * dx * r7inv * rdk1 * rdk2;
+        day     +=        3.* r5inv * dk2dy * rdk1
+                + 3.* r5inv * dk1dy * rdk2
+                + 3.* r5inv    * dy * dk1dk2  
+                    - 15.      * dy * r7inv * rdk1 * rdk2;
+        daz     +=        3.* r5inv * dk2dz * rdk1
+                + 3.* r5inv * dk1dz * rdk2
+                + 3.* r5inv    * dz * dk1dk2  
+                    - 15.      * dz * r7inv * rdk1 * rdk2;
+        
+        // No variational mass contributions for test particles!
+
+        particles_var2[0].ax += Gmj * dax; 
+        particles_var2[0].ay += Gmj * day;
+        particles_var2[0].az += Gmj * daz;
+    }
+}
+
+void reb_calculate_acceleration_var(struct reb_simulation* r){
     const int N = r->N;
     const int _N_real   = N - r->N_var;
-    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
-    const int starti = (r->gravity_ignore_terms==0)?1:2;
-    const int startj = (r->gravity_ignore_terms==2)?1:0;
     switch (r->gravity){
         case REB_GRAVITY_NONE: // Do nothing.
         break;
@@ -784,312 +1356,37 @@ void reb_calculate_acceleration_var(struct reb_simulation* r){
             }
         }
         case REB_GRAVITY_BASIC:
+        {
+            if (r->testparticle_type){
+                for (int v=0;v<r->var_config_N;v++){
+                    if (r->var_config[v].order==2){
+                        reb_error(r,"testparticletype=1 not implemented for second order variational equations.");
+                        break;
+                    }
+                }
+            }
+            // The separations and inverse distances of all pairs are calculated once 
+            // and then shared by all variational configurations.
+            const struct reb_gravity_var_pairs pairs = reb_gravity_var_pairs_update(r, _N_real);
+            // Each configuration only writes to its own variational particles.
+#pragma omp parallel for schedule(dynamic)
             for (int v=0;v<r->var_config_N;v++){
                 struct reb_variational_configuration const vc = r->var_config[v];
                 if (vc.order==1){
-                    //////////////////
-                    /// 1st order  ///
-                    //////////////////
-                    struct reb_particle* const particles_var1 = particles + vc.index;
                     if (vc.testparticle<0){
-                        for (int i=0; i<_N_real; i++){
-                            particles_var1[i].ax = 0.; 
-                            particles_var1[i].ay = 0.; 
-                            particles_var1[i].az = 0.; 
-                        }
-                        for (int i=starti; i<_N_active; i++){
-                        for (int j=startj; j<i; j++){
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double r2 = dx*dx + dy*dy + dz*dz;
-                            const double _r  = sqrt(r2);
-                            const double r3inv = 1./(r2*_r);
-                            const double r5inv = 3.*r3inv/r2;
-                            const double ddx = particles_var1[i].x - particles_var1[j].x;
-                            const double ddy = particles_var1[i].y - particles_var1[j].y;
-                            const double ddz = particles_var1[i].z - particles_var1[j].z;
-                            const double Gmi = G * particles[i].m;
-                            const double Gmj = G * particles[j].m;
-
-                            // Variational equations
-                            const double dxdx = dx*dx*r5inv - r3inv;
-                            const double dydy = dy*dy*r5inv - r3inv;
-                            const double dzdz = dz*dz*r5inv - r3inv;
-                            const double dxdy = dx*dy*r5inv;
-                            const double dxdz = dx*dz*r5inv;
-                            const double dydz = dy*dz*r5inv;
-                            const double dax =   ddx * dxdx + ddy * dxdy + ddz * dxdz;
-                            const double day =   ddx * dxdy + ddy * dydy + ddz * dydz;
-                            const double daz =   ddx * dxdz + ddy * dydz + ddz * dzdz;
-
-                            // Variational mass contributions
-                            const double dGmi = G*particles_var1[i].m;
-                            const double dGmj = G*particles_var1[j].m;
-
-                            particles_var1[i].ax += Gmj * dax - dGmj*r3inv*dx;
-                            particles_var1[i].ay += Gmj * day - dGmj*r3inv*dy;
-                            particles_var1[i].az += Gmj * daz - dGmj*r3inv*dz;
-
-                            particles_var1[j].ax -= Gmi * dax - dGmi*r3inv*dx;
-                            particles_var1[j].ay -= Gmi * day - dGmi*r3inv*dy;
-                            particles_var1[j].az -= Gmi * daz - dGmi*r3inv*dz; 
-                        }
-                        }
-                        for (int i=_N_active; i<_N_real; i++){
-                        for (int j=startj; j<_N_active; j++){
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double r2 = dx*dx + dy*dy + dz*dz;
-                            const double _r  = sqrt(r2);
-                            const double r3inv = 1./(r2*_r);
-                            const double r5inv = 3.*r3inv/r2;
-                            const double ddx = particles_var1[i].x - particles_var1[j].x;
-                            const double ddy = particles_var1[i].y - particles_var1[j].y;
-                            const double ddz = particles_var1[i].z - particles_var1[j].z;
-                            const double Gmi = G * particles[i].m;
-                            const double Gmj = G * particles[j].m;
-
-                            // Variational equations
-                            const double dxdx = dx*dx*r5inv - r3inv;
-                            const double dydy = dy*dy*r5inv - r3inv;
-                            const double dzdz = dz*dz*r5inv - r3inv;
-                            const double dxdy = dx*dy*r5inv;
-                            const double dxdz = dx*dz*r5inv;
-                            const double dydz = dy*dz*r5inv;
-                            const double dax =   ddx * dxdx + ddy * dxdy + ddz * dxdz;
-                            const double day =   ddx * dxdy + ddy * dydy + ddz * dydz;
-                            const double daz =   ddx * dxdz + ddy * dydz + ddz * dzdz;
-
-                            // Variational mass contributions
-                            const double dGmi = G*particles_var1[i].m;
-                            const double dGmj = G*particles_var1[j].m;
-
-                            particles_var1[i].ax += Gmj * dax - dGmj*r3inv*dx;
-                            particles_var1[i].ay += Gmj * day - dGmj*r3inv*dy;
-                            particles_var1[i].az += Gmj * daz - dGmj*r3inv*dz;
-                            if (_testparticle_type){
-                                // Warning! This does not make sense when the mass is varied!
-                                particles_var1[j].ax -= Gmi * dax - dGmi*r3inv*dx;
-                                particles_var1[j].ay -= Gmi * day - dGmi*r3inv*dy;
-                                particles_var1[j].az -= Gmi * daz - dGmi*r3inv*dz; 
-                            }
-                        }
-                        }
-                    }else{ //testparticle
-                        int i = vc.testparticle;
-                        particles_var1[0].ax = 0.; 
-                        particles_var1[0].ay = 0.; 
-                        particles_var1[0].az = 0.; 
-                        for (int j=0; j<_N_real; j++){
-                            if (i==j) continue;
-                            if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                            if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double r2 = dx*dx + dy*dy + dz*dz;
-                            const double _r  = sqrt(r2);
-                            const double r3inv = 1./(r2*_r);
-                            const double r5inv = 3.*r3inv/r2;
-                            const double ddx = particles_var1[0].x;
-                            const double ddy = particles_var1[0].y;
-                            const double ddz = particles_var1[0].z;
-                            const double Gmj = G * particles[j].m;
-
-                            // Variational equations
-                            const double dxdx = dx*dx*r5inv - r3inv;
-                            const double dydy = dy*dy*r5inv - r3inv;
-                            const double dzdz = dz*dz*r5inv - r3inv;
-                            const double dxdy = dx*dy*r5inv;
-                            const double dxdz = dx*dz*r5inv;
-                            const double dydz = dy*dz*r5inv;
-                            const double dax =   ddx * dxdx + ddy * dxdy + ddz * dxdz;
-                            const double day =   ddx * dxdy + ddy * dydy + ddz * dydz;
-                            const double daz =   ddx * dxdz + ddy * dydz + ddz * dzdz;
-
-                            // No variational mass contributions for test particles!
-
-                            particles_var1[0].ax += Gmj * dax;
-                            particles_var1[0].ay += Gmj * day;
-                            particles_var1[0].az += Gmj * daz;
-
-                        }
+                        reb_calculate_acceleration_var1(r, &pairs, vc);
+                    }else{
+                        reb_calculate_acceleration_var1_testparticle(r, vc);
                     }
                 }else if (vc.order==2){
-                    if (_testparticle_type){
-                        reb_error(r,"testparticletype=1 not implemented for second order variational equations.");
-                    }
-                    //////////////////
-                    /// 2nd order  ///
-                    //////////////////
-                    struct reb_particle* const particles_var2 = particles + vc.index;
-                    struct reb_particle* const particles_var1a = particles + vc.index_1st_order_a;
-                    struct reb_particle* const particles_var1b = particles + vc.index_1st_order_b;
                     if (vc.testparticle<0){
-                        for (int i=0; i<_N_real; i++){
-                            particles_var2[i].ax = 0.; 
-                            particles_var2[i].ay = 0.; 
-                            particles_var2[i].az = 0.; 
-                        }
-                        for (int i=0; i<_N_real; i++){
-                        for (int j=i+1; j<_N_real; j++){
-                            // TODO: Need to implement WH skipping
-                            //if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                            //if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double r2 = dx*dx + dy*dy + dz*dz;
-                            const double r  = sqrt(r2);
-                            const double r3inv = 1./(r2*r);
-                            const double r5inv = r3inv/r2;
-                            const double r7inv = r5inv/r2;
-                            const double ddx = particles_var2[i].x - particles_var2[j].x;
-                            const double ddy = particles_var2[i].y - particles_var2[j].y;
-                            const double ddz = particles_var2[i].z - particles_var2[j].z;
-                            const double Gmi = G * particles[i].m;
-                            const double Gmj = G * particles[j].m;
-                            const double ddGmi = G*particles_var2[i].m;
-                            const double ddGmj = G*particles_var2[j].m;
-                            
-                            // Variational equations
-                            // delta^(2) terms
-                            double dax =         ddx * ( 3.*dx*dx*r5inv - r3inv )
-                                       + ddy * ( 3.*dx*dy*r5inv )
-                                       + ddz * ( 3.*dx*dz*r5inv );
-                            double day =         ddx * ( 3.*dy*dx*r5inv )
-                                       + ddy * ( 3.*dy*dy*r5inv - r3inv )
-                                       + ddz * ( 3.*dy*dz*r5inv );
-                            double daz =         ddx * ( 3.*dz*dx*r5inv )
-                                       + ddy * ( 3.*dz*dy*r5inv )
-                                       + ddz * ( 3.*dz*dz*r5inv - r3inv );
-                            
-                            // delta^(1) delta^(1) terms
-                            const double dk1dx = particles_var1a[i].x - particles_var1a[j].x;
-                            const double dk1dy = particles_var1a[i].y - particles_var1a[j].y;
-                            const double dk1dz = particles_var1a[i].z - particles_var1a[j].z;
-                            const double dk2dx = particles_var1b[i].x - particles_var1b[j].x;
-                            const double dk2dy = particles_var1b[i].y - particles_var1b[j].y;
-                            const double dk2dz = particles_var1b[i].z - particles_var1b[j].z;
-
-                            const double rdk1 =  dx*dk1dx + dy*dk1dy + dz*dk1dz;
-                            const double rdk2 =  dx*dk2dx + dy*dk2dy + dz*dk2dz;
-                            const double dk1dk2 =  dk1dx*dk2dx + dk1dy*dk2dy + dk1dz*dk2dz;
-                            dax     +=        3.* r5inv * dk2dx * rdk1
-                                    + 3.* r5inv * dk1dx * rdk2
-                                    + 3.* r5inv    * dx * dk1dk2  
-                                        - 15.      * dx * r7inv * rdk1 * rdk2;
-                            day     +=        3.* r5inv * dk2dy * rdk1
-                                    + 3.* r5inv * dk1dy * rdk2
-                                    + 3.* r5inv    * dy * dk1dk2  
-                                        - 15.      * dy * r7inv * rdk1 * rdk2;
-                            daz     +=        3.* r5inv * dk2dz * rdk1
-                                    + 3.* r5inv * dk1dz * rdk2
-                                    + 3.* r5inv    * dz * dk1dk2  
-                                        - 15.      * dz * r7inv * rdk1 * rdk2;
-                            
-                            const double dk1Gmi = G * particles_var1a[i].m;
-                            const double dk1Gmj = G * particles_var1a[j].m;
-                            const double dk2Gmi = G * particles_var1b[i].m;
-                            const double dk2Gmj = G * particles_var1b[j].m;
-
-                            particles_var2[i].ax += Gmj * dax 
-                                - ddGmj*r3inv*dx 
-                                - dk2Gmj*r3inv*dk1dx + 3.*dk2Gmj*r5inv*dx*rdk1
-                                - dk1Gmj*r3inv*dk2dx + 3.*dk1Gmj*r5inv*dx*rdk2;
-                            particles_var2[i].ay += Gmj * day 
-                                - ddGmj*r3inv*dy
-                                - dk2Gmj*r3inv*dk1dy + 3.*dk2Gmj*r5inv*dy*rdk1
-                                - dk1Gmj*r3inv*dk2dy + 3.*dk1Gmj*r5inv*dy*rdk2;
-                            particles_var2[i].az += Gmj * daz 
-                                - ddGmj*r3inv*dz
-                                - dk2Gmj*r3inv*dk1dz + 3.*dk2Gmj*r5inv*dz*rdk1
-                                - dk1Gmj*r3inv*dk2dz + 3.*dk1Gmj*r5inv*dz*rdk2;
-                                                                                 
-                            particles_var2[j].ax -= Gmi * dax 
-                                - ddGmi*r3inv*dx
-                                - dk2Gmi*r3inv*dk1dx + 3.*dk2Gmi*r5inv*dx*rdk1
-                                - dk1Gmi*r3inv*dk2dx + 3.*dk1Gmi*r5inv*dx*rdk2;
-                            particles_var2[j].ay -= Gmi * day 
-                                - ddGmi*r3inv*dy
-                                - dk2Gmi*r3inv*dk1dy + 3.*dk2Gmi*r5inv*dy*rdk1
-                                - dk1Gmi*r3inv*dk2dy + 3.*dk1Gmi*r5inv*dy*rdk2;
-                            particles_var2[j].az -= Gmi * daz 
-                                - ddGmi*r3inv*dz
-                                - dk2Gmi*r3inv*dk1dz + 3.*dk2Gmi*r5inv*dz*rdk1
-                                - dk1Gmi*r3inv*dk2dz + 3.*dk1Gmi*r5inv*dz*rdk2;
-                        }
-                        }
-                    }else{ //testparticle
-                        int i = vc.testparticle;
-                        particles_var2[0].ax = 0.; 
-                        particles_var2[0].ay = 0.; 
-                        particles_var2[0].az = 0.; 
-                        for (int j=0; j<_N_real; j++){
-                            if (i==j) continue;
-                            // TODO: Need to implement WH skipping
-                            //if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                            //if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double r2 = dx*dx + dy*dy + dz*dz;
-                            const double r  = sqrt(r2);
-                            const double r3inv = 1./(r2*r);
-                            const double r5inv = r3inv/r2;
-                            const double r7inv = r5inv/r2;
-                            const double ddx = particles_var2[0].x;
-                            const double ddy = particles_var2[0].y;
-                            const double ddz = particles_var2[0].z;
-                            const double Gmj = G * particles[j].m;
-                            
-                            // Variational equations
-                            // delta^(2) terms
-                            double dax =         ddx * ( 3.*dx*dx*r5inv - r3inv )
-                                       + ddy * ( 3.*dx*dy*r5inv )
-                                       + ddz * ( 3.*dx*dz*r5inv );
-                            double day =         ddx * ( 3.*dy*dx*r5inv )
-                                       + ddy * ( 3.*dy*dy*r5inv - r3inv )
-                                       + ddz * ( 3.*dy*dz*r5inv );
-                            double daz =         ddx * ( 3.*dz*dx*r5inv )
-                                       + ddy * ( 3.*dz*dy*r5inv )
-                                       + ddz * ( 3.*dz*dz*r5inv - r3inv );
-                            
-                            // delta^(1) delta^(1) terms
-                            const double dk1dx = particles_var1a[0].x;
-                            const double dk1dy = particles_var1a[0].y;
-                            const double dk1dz = particles_var1a[0].z;
-                            const double dk2dx = particles_var1b[0].x;
-                            const double dk2dy = particles_var1b[0].y;
-                            const double dk2dz = particles_var1b[0].z;
-
-                            const double rdk1 =  dx*dk1dx + dy*dk1dy + dz*dk1dz;
-                            const double rdk2 =  dx*dk2dx + dy*dk2dy + dz*dk2dz;
-                            const double dk1dk2 =  dk1dx*dk2dx + dk1dy*dk2dy + dk1dz*dk2dz;
-                            dax     +=        3.* r5inv * dk2dx * rdk1
-                                    + 3.* r5inv * dk1dx * rdk2
-                                    + 3.* r5inv    * dx * dk1dk2  
-                                        - 15.      * dx * r7inv * rdk1 * rdk2;
-                            day     +=        3.* r5inv * dk2dy * rdk1
-                                    + 3.* r5inv * dk1dy * rdk2
-                                    + 3.* r5inv    * dy * dk1dk2  
-                                        - 15.      * dy * r7inv * rdk1 * rdk2;
-                            daz     +=        3.* r5inv * dk2dz * rdk1
-                                    + 3.* r5inv * dk1dz * rdk2
-                                    + 3.* r5inv    * dz * dk1dk2  
-                                        - 15.      * dz * r7inv * rdk1 * rdk2;
-                            
-                            // No variational mass contributions for test particles!
-
-                            particles_var2[0].ax += Gmj * dax; 
-                            particles_var2[0].ay += Gmj * day;
-                            particles_var2[0].az += Gmj * daz;
-                        }
+                        reb_calculate_acceleration_var2(r, &pairs, vc);
+                    }else{
+                        reb_calculate_acceleration_var2_testparticle(r, vc);
                     }
                 }
             }
+        }
             break;
         default:
             reb_exit("Variational gravity calculation not yet implemented.");
@@ -1098,6 +1395,11 @@ void reb_calculate_acceleration_var(struct reb_simulation* r){
 }
 
 void reb_calculate_and_apply_jerk(struct reb_simulation* r, const double v){
+    if (r->N_interaction_groups){
+        reb_error(r, "Interaction groups do not support the modified kicks (jerk terms) of EOS.");
+        r->status = REB_EXIT_ERROR;
+        return;
+    }
     struct reb_particle* const particles = r->particles;
     const int N = r->N;
     const int N_active = r->N_active;
@@ -1182,71 +1484,2280 @@ void reb_calculate_and_apply_jerk(struct reb_simulation* r, const double v){
     }
 }
 
-// Helper routines for REB_GRAVITY_TREE
+// Helper routines for REB_GRAVITY_COMPENSATED
 
+/**
+  * @brief Number of independent compensated partial sums per particle and component.
+  */
+#define REB_GRAVITY_CS_LANES 4
 
 /**
-  * @brief The function calls itself recursively using cell breaking criterion to check whether it can use center of mass (and mass quadrupole tensor) to calculate forces.
-  * Calculate the acceleration for a particle from a given cell and all its daughter cells.
-  *
-  * @param r REBOUND simulation to consider
-  * @param pt Index of the particle the force is calculated for.
-  * @param node Pointer to the cell the force is calculated from.
-  * @param gb Ghostbox plus position of the particle (precalculated). 
+  * @brief Partial sums and error terms of the compensated summation for one particle.
   */
-static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* const r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb);
+struct reb_gravity_cs_lanes {
+    double ax[REB_GRAVITY_CS_LANES];
+    double ay[REB_GRAVITY_CS_LANES];
+    double az[REB_GRAVITY_CS_LANES];
+    double cx[REB_GRAVITY_CS_LANES];
+    double cy[REB_GRAVITY_CS_LANES];
+    double cz[REB_GRAVITY_CS_LANES];
+};
 
-static void reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb) {
-    for(int i=0;i<r->root_n;i++){
-        struct reb_treecell* node = r->tree_root[i];
-        if (node!=NULL){
-            reb_calculate_acceleration_for_particle_from_cell(r, pt, node, gb);
+/**
+  * @brief Adds v to the sum a with error term c (Kahan summation).
+  */
+static inline void reb_gravity_cs_add(double* const a, double* const c, const double v){
+    const double y = v - *c;
+    const double t = *a + y;
+    *c = (t - *a) - y;
+    *a = t;
+}
+
+/**
+  * @brief Adds the acceleration from a contiguous range of source particles to the partial sums.
+  * @details Source j is added to partial sum j%REB_GRAVITY_CS_LANES. Every partial sum 
+  * is compensated on its own, so the inner loop has no dependencies between lanes.
+  * @param soa Structure-of-arrays mirror of the particles.
+  * @param jstart Index of the first source particle.
+  * @param jend Index one past the last source particle.
+  * @param xi Position of the particle feeling the force.
+  * @param G Gravitational constant.
+  * @param softening2 Square of the gravitational softening length.
+  * @param s Partial sums which get incremented.
+  */
+static inline void reb_gravity_cs_sum(const struct reb_particles_soa* const soa, const int jstart, const int jend, const double xi, const double yi, const double zi, const double G, const double softening2, struct reb_gravity_cs_lanes* const s){
+    const double* const restrict x = soa->x;
+    const double* const restrict y = soa->y;
+    const double* const restrict z = soa->z;
+    const double* const restrict m = soa->m;
+    // Local copies of the partial sums so that the compiler can keep them in vector registers.
+    double ax[REB_GRAVITY_CS_LANES], ay[REB_GRAVITY_CS_LANES], az[REB_GRAVITY_CS_LANES];
+    double cx[REB_GRAVITY_CS_LANES], cy[REB_GRAVITY_CS_LANES], cz[REB_GRAVITY_CS_LANES];
+    for (int k=0; k<REB_GRAVITY_CS_LANES; k++){
+        ax[k] = s->ax[k]; ay[k] = s->ay[k]; az[k] = s->az[k];
+        cx[k] = s->cx[k]; cy[k] = s->cy[k]; cz[k] = s->cz[k];
+    }
+    int j = jstart;
+    for (; j+REB_GRAVITY_CS_LANES<=jend; j+=REB_GRAVITY_CS_LANES){
+#pragma omp simd
+        for (int k=0; k<REB_GRAVITY_CS_LANES; k++){
+            const double dx = xi - x[j+k];
+            const double dy = yi - y[j+k];
+            const double dz = zi - z[j+k];
+            const double r2 = dx*dx + dy*dy + dz*dz + softening2;
+            const double _r = sqrt(r2);
+            const double prefact = -G/(r2*_r)*m[j+k];
+
+            const double yx = prefact*dx - cx[k];
+            const double tx = ax[k] + yx;
+            cx[k] = (tx - ax[k]) - yx;
+            ax[k] = tx;
+
+            const double yy = prefact*dy - cy[k];
+            const double ty = ay[k] + yy;
+            cy[k] = (ty - ay[k]) - yy;
+            ay[k] = ty;
+
+            const double yz = prefact*dz - cz[k];
+            const double tz = az[k] + yz;
+            cz[k] = (tz - az[k]) - yz;
+            az[k] = tz;
         }
     }
+    for (int k=0; k<REB_GRAVITY_CS_LANES; k++){
+        s->ax[k] = ax[k]; s->ay[k] = ay[k]; s->az[k] = az[k];
+        s->cx[k] = cx[k]; s->cy[k] = cy[k]; s->cz[k] = cz[k];
+    }
+    // Remaining sources
+    for (; j<jend; j++){
+        const int k = j%REB_GRAVITY_CS_LANES;
+        const double dx = xi - x[j];
+        const double dy = yi - y[j];
+        const double dz = zi - z[j];
+        const double r2 = dx*dx + dy*dy + dz*dz + softening2;
+        const double _r = sqrt(r2);
+        const double prefact = -G/(r2*_r)*m[j];
+        reb_gravity_cs_add(&s->ax[k], &s->cx[k], prefact*dx);
+        reb_gravity_cs_add(&s->ay[k], &s->cy[k], prefact*dy);
+        reb_gravity_cs_add(&s->az[k], &s->cz[k], prefact*dz);
+    }
 }
 
-static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb) {
+static void reb_calculate_acceleration_compensated(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
     const double G = r->G;
     const double softening2 = r->softening*r->softening;
+    const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    // Test particles only act as sources if testparticle_type is set.
+    const int _N_sources = r->testparticle_type?_N_real:_N_active;
+    if (r->gravity_cs_allocatedN<N){
+        r->gravity_cs = realloc(r->gravity_cs,N*sizeof(struct reb_vec3d));
+        r->gravity_cs_allocatedN = N;
+    }
+    struct reb_vec3d* restrict const cs = r->gravity_cs;
+    struct reb_particles_soa* const soa = &(r->particles_soa);
+    reb_particles_soa_update(soa, particles, _N_real);
+#pragma omp parallel for schedule(static)
+    for (int i=0; i<_N_real; i++){
+#ifndef OPENMP
+        if (reb_sigint) return;
+#endif // OPENMP
+        // Source ranges. The excluded pairs (self-interaction and gravity_ignore_terms) 
+        // are skipped by splitting the range of sources, not by testing each pair.
+        int jlo[3];
+        int jhi[3];
+        int nranges = 0;
+        if (_gravity_ignore_terms!=2 || i!=0){
+            const int jmax = i<_N_active?_N_sources:_N_active;
+            int skip1 = i<_N_active?i:-1;
+            int skip2 = -1;
+            if (_gravity_ignore_terms==1 && i<2){
+                skip2 = 1-i;
+            }
+            if (_gravity_ignore_terms==2){
+                skip2 = 0;
+            }
+            if (skip2>=0 && skip2<skip1){
+                const int tmp = skip1;
+                skip1 = skip2;
+                skip2 = tmp;
+            }
+            int j = 0;
+            if (skip1>=0){
+                jlo[nranges] = j;
+                jhi[nranges++] = MIN(skip1,jmax);
+                j = skip1+1;
+            }
+            if (skip2>=0){
+                jlo[nranges] = j;
+                jhi[nranges++] = MIN(skip2,jmax);
+                j = skip2+1;
+            }
+            jlo[nranges] = j;
+            jhi[nranges++] = jmax;
+        }
+        struct reb_gravity_cs_lanes s = {{0}};
+        for (int n=0; n<nranges; n++){
+            reb_gravity_cs_sum(soa, jlo[n], jhi[n], particles[i].x, particles[i].y, particles[i].z, G, softening2, &s);
+        }
+        // Combine the partial sums and their error terms.
+        double ax = 0., ay = 0., az = 0.;
+        double cx = 0., cy = 0., cz = 0.;
+        for (int l=0; l<REB_GRAVITY_CS_LANES; l++){
+            reb_gravity_cs_add(&ax, &cx, s.ax[l]);
+            reb_gravity_cs_add(&ax, &cx, -s.cx[l]);
+            reb_gravity_cs_add(&ay, &cy, s.ay[l]);
+            reb_gravity_cs_add(&ay, &cy, -s.cy[l]);
+            reb_gravity_cs_add(&az, &cz, s.az[l]);
+            reb_gravity_cs_add(&az, &cz, -s.cz[l]);
+        }
+        particles[i].ax = ax;
+        particles[i].ay = ay;
+        particles[i].az = az;
+        cs[i].x = cx;
+        cs[i].y = cy;
+        cs[i].z = cz;
+    }
+}
+
+// Helper routines for test particles of type 0
+
+#define REB_GRAVITY_TP_BATCH 32   ///< Number of test particles processed together by the test particle kernels
+
+/**
+  * @brief Positions and accelerations of one batch of test particles.
+  */
+struct reb_gravity_tp_batch {
+    double x[REB_GRAVITY_TP_BATCH];
+    double y[REB_GRAVITY_TP_BATCH];
+    double z[REB_GRAVITY_TP_BATCH];
+    double ax[REB_GRAVITY_TP_BATCH];
+    double ay[REB_GRAVITY_TP_BATCH];
+    double az[REB_GRAVITY_TP_BATCH];
+};
+
+/**
+  * @brief Copies the positions of n test particles starting at ib into a batch and zeroes the accelerations.
+  */
+static inline void reb_gravity_tp_batch_load(struct reb_gravity_tp_batch* const b, const struct reb_particle* const particles, const int ib, const int n){
+    for (int k=0; k<n; k++){
+        b->x[k] = particles[ib+k].x;
+        b->y[k] = particles[ib+k].y;
+        b->z[k] = particles[ib+k].z;
+        b->ax[k] = 0.;
+        b->ay[k] = 0.;
+        b->az[k] = 0.;
+    }
+}
+
+/**
+  * @brief Copies the accelerations of a batch back to the n test particles starting at ib.
+  */
+static inline void reb_gravity_tp_batch_store(const struct reb_gravity_tp_batch* const b, struct reb_particle* const particles, const int ib, const int n){
+    for (int k=0; k<n; k++){
+        particles[ib+k].ax = b->ax[k];
+        particles[ib+k].ay = b->ay[k];
+        particles[ib+k].az = b->az[k];
+    }
+}
+
+#ifndef GPU
+/**
+  * @brief Adds the accelerations due to the active particles jp+1 to jend-1 on a batch of n test particles, calculated in single precision.
+  * @details The positions are taken relative to the active particle jp (the primary) in double 
+  * precision before they are rounded. The rounding error is therefore relative to the distance 
+  * from the primary, not to the distance from the origin. The accelerations are summed up in 
+  * single precision and then added to ax, ay and az. Twice as many test particles fit into 
+  * one SIMD register and the batch takes up half the space in the cache.
+  */
+static inline void reb_gravity_tp_batch_float(const struct reb_particle* const particles, const int jp, const int jend, const int n, const double* const xi, const double* const yi, const double* const zi, double* const restrict ax, double* const restrict ay, double* const restrict az, const double G, const double softening2){
+    const double xp = particles[jp].x;
+    const double yp = particles[jp].y;
+    const double zp = particles[jp].z;
+    const float softening2f = softening2;
+    float xf[REB_GRAVITY_TP_BATCH];
+    float yf[REB_GRAVITY_TP_BATCH];
+    float zf[REB_GRAVITY_TP_BATCH];
+    float axf[REB_GRAVITY_TP_BATCH];
+    float ayf[REB_GRAVITY_TP_BATCH];
+    float azf[REB_GRAVITY_TP_BATCH];
+    for (int k=0; k<n; k++){
+        xf[k] = xi[k] - xp;
+        yf[k] = yi[k] - yp;
+        zf[k] = zi[k] - zp;
+        axf[k] = 0.f;
+        ayf[k] = 0.f;
+        azf[k] = 0.f;
+    }
+    for (int j=jp+1; j<jend; j++){
+        const float xj = particles[j].x - xp;
+        const float yj = particles[j].y - yp;
+        const float zj = particles[j].z - zp;
+        const float Gmj = G*particles[j].m;
+#pragma omp simd
+        for (int k=0; k<n; k++){
+            const float dx = xf[k] - xj;
+            const float dy = yf[k] - yj;
+            const float dz = zf[k] - zj;
+            const float _r = sqrtf(dx*dx + dy*dy + dz*dz + softening2f);
+            const float prefactj = -Gmj/(_r*_r*_r);
+            axf[k] += prefactj*dx;
+            ayf[k] += prefactj*dy;
+            azf[k] += prefactj*dz;
+        }
+    }
+    for (int k=0; k<n; k++){
+        ax[k] += axf[k];
+        ay[k] += ayf[k];
+        az[k] += azf[k];
+    }
+}
+
+REB_TARGET_CLONES static void reb_calculate_acceleration_testparticles(struct reb_simulation* r, const int jstart, const int jend, const int istart, const int iend){
     struct reb_particle* const particles = r->particles;
-    const double dx = gb.shiftx - node->mx;
-    const double dy = gb.shifty - node->my;
-    const double dz = gb.shiftz - node->mz;
-    const double r2 = dx*dx + dy*dy + dz*dz;
-    if ( node->pt < 0 ) { // Not a leaf
-        if ( node->w*node->w > r->opening_angle2*r2 ){
-            for (int o=0; o<8; o++) {
-                if (node->oct[o] != NULL) {
-                    reb_calculate_acceleration_for_particle_from_cell(r, pt, node->oct[o], gb);
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    // Active particles after jdouble are summed up in single precision
+    const int tp_float = r->gravity_testparticle_float && jend-jstart>1;
+    const int jdouble = tp_float?jstart+1:jend;
+    const int Nbatches = (iend-istart+REB_GRAVITY_TP_BATCH-1)/REB_GRAVITY_TP_BATCH;
+#pragma omp parallel for schedule(static)
+    for (int ibatch=0; ibatch<Nbatches; ibatch++){
+#ifndef OPENMP
+        if (reb_sigint) return;
+#endif // OPENMP
+        const int ib = istart + ibatch*REB_GRAVITY_TP_BATCH;
+        const int n = MIN(REB_GRAVITY_TP_BATCH, iend-ib);
+        struct reb_gravity_tp_batch b;
+        reb_gravity_tp_batch_load(&b, particles, ib, n);
+        double* const restrict ax = b.ax;
+        double* const restrict ay = b.ay;
+        double* const restrict az = b.az;
+        // Summing over all Ghost Boxes
+        for (int g=0; g<gbs.N; g++){
+            struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
+            double xi[REB_GRAVITY_TP_BATCH];
+            double yi[REB_GRAVITY_TP_BATCH];
+            double zi[REB_GRAVITY_TP_BATCH];
+            for (int k=0; k<n; k++){
+                xi[k] = gb.shiftx+b.x[k];
+                yi[k] = gb.shifty+b.y[k];
+                zi[k] = gb.shiftz+b.z[k];
+            }
+            for (int j=jstart; j<jdouble; j++){
+                const double xj = particles[j].x;
+                const double yj = particles[j].y;
+                const double zj = particles[j].z;
+                const double mj = particles[j].m;
+#pragma omp simd
+                for (int k=0; k<n; k++){
+                    const double dx = xi[k] - xj;
+                    const double dy = yi[k] - yj;
+                    const double dz = zi[k] - zj;
+                    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                    const double prefact = G/(_r*_r*_r);
+                    const double prefactj = -prefact*mj;
+                    ax[k] += prefactj*dx;
+                    ay[k] += prefactj*dy;
+                    az[k] += prefactj*dz;
                 }
             }
-        } else {
-            double _r = sqrt(r2 + softening2);
-            double prefact = -G/(_r*_r*_r)*node->m;
-#ifdef QUADRUPOLE
-            double qprefact = G/(_r*_r*_r*_r*_r);
-            particles[pt].ax += qprefact*(dx*node->mxx + dy*node->mxy + dz*node->mxz); 
-            particles[pt].ay += qprefact*(dx*node->mxy + dy*node->myy + dz*node->myz); 
-            particles[pt].az += qprefact*(dx*node->mxz + dy*node->myz + dz*node->mzz); 
-            double mrr     = dx*dx*node->mxx     + dy*dy*node->myy     + dz*dz*node->mzz
-                    + 2.*dx*dy*node->mxy     + 2.*dx*dz*node->mxz     + 2.*dy*dz*node->myz; 
-            qprefact *= -5.0/(2.0*_r*_r)*mrr;
-            particles[pt].ax += (qprefact + prefact) * dx; 
-            particles[pt].ay += (qprefact + prefact) * dy; 
-            particles[pt].az += (qprefact + prefact) * dz; 
-#else
-            particles[pt].ax += prefact*dx; 
-            particles[pt].ay += prefact*dy; 
-            particles[pt].az += prefact*dz; 
-#endif
+            if (tp_float){
+                reb_gravity_tp_batch_float(particles, jstart, jend, n, xi, yi, zi, ax, ay, az, G, softening2);
+            }
         }
-    } else { // It's a leaf node
-        if (node->pt == pt) return;
-        double _r = sqrt(r2 + softening2);
-        double prefact = -G/(_r*_r*_r)*node->m;
-        particles[pt].ax += prefact*dx; 
-        particles[pt].ay += prefact*dy; 
-        particles[pt].az += prefact*dz; 
+        reb_gravity_tp_batch_store(&b, particles, ib, n);
+    }
+}
+#endif // GPU
+
+REB_TARGET_CLONES static void reb_calculate_acceleration_jacobi_testparticles(struct reb_simulation* r, const int N_active, const double Rjx, const double Rjy, const double Rjz, const double Mj){
+    struct reb_particle* const particles = r->particles;
+    const double G = r->G;
+    const int N = r->N;
+    const double Rx = Rjx/Mj;
+    const double Ry = Rjy/Mj;
+    const double Rz = Rjz/Mj;
+    const int Nbatches = (N-N_active+REB_GRAVITY_TP_BATCH-1)/REB_GRAVITY_TP_BATCH;
+#pragma omp parallel for schedule(static)
+    for (int ibatch=0; ibatch<Nbatches; ibatch++){
+        const int ib = N_active + ibatch*REB_GRAVITY_TP_BATCH;
+        const int n = MIN(REB_GRAVITY_TP_BATCH, N-ib);
+        struct reb_gravity_tp_batch b;
+        reb_gravity_tp_batch_load(&b, particles, ib, n);
+        const double* const restrict x = b.x;
+        const double* const restrict y = b.y;
+        const double* const restrict z = b.z;
+        double* const restrict ax = b.ax;
+        double* const restrict ay = b.ay;
+        double* const restrict az = b.az;
+        // Direct Term
+        for (int i=0; i<N_active; i++){
+            const double xi = particles[i].x;
+            const double yi = particles[i].y;
+            const double zi = particles[i].z;
+            const double mi = particles[i].m;
+#pragma omp simd
+            for (int k=0; k<n; k++){
+                const double dx = xi - x[k];
+                const double dy = yi - y[k];
+                const double dz = zi - z[k];
+                const double dr = sqrt(dx*dx + dy*dy + dz*dz);
+                const double prefact = G /(dr*dr*dr);
+                const double prefacti = prefact*mi;
+                ax[k] += prefacti*dx;
+                ay[k] += prefacti*dy;
+                az[k] += prefacti*dz;
+            }
+        }
+        // Jacobi Term
+#pragma omp simd
+        for (int k=0; k<n; k++){
+            const double Qjx = x[k] - Rx;
+            const double Qjy = y[k] - Ry;
+            const double Qjz = z[k] - Rz;
+            const double dr = sqrt(Qjx*Qjx + Qjy*Qjy + Qjz*Qjz);
+            const double prefact = G*Mj/(dr*dr*dr);
+            ax[k] += prefact*Qjx;
+            ay[k] += prefact*Qjy;
+            az[k] += prefact*Qjz;
+        }
+        reb_gravity_tp_batch_store(&b, particles, ib, n);
+    }
+}
+
+#if defined(SIMD) && !defined(GPU)
+// Helper routines for the vectorized REB_GRAVITY_BASIC kernel
+
+/**
+  * @brief Sums up the acceleration on a single particle from a contiguous range of source particles.
+  * @details The loop has no dependencies other than the reduction. The compiler 
+  * turns it into SIMD instructions (SSE2, AVX2, AVX-512 or NEON, depending on the 
+  * target architecture), processing 2 to 8 source particles per instruction.
+  * @param soa Structure-of-arrays mirror of the particles.
+  * @param jstart Index of the first source particle.
+  * @param jend Index one past the last source particle.
+  * @param xi Position of the particle feeling the force (including ghostbox shift).
+  * @param G Gravitational constant.
+  * @param softening2 Square of the gravitational softening length.
+  * @param a Acceleration which gets incremented.
+  */
+static inline void reb_gravity_simd_sum(const struct reb_particles_soa* const soa, const int jstart, const int jend, const double xi, const double yi, const double zi, const double G, const double softening2, struct reb_vec3d* const a){
+    const double* const restrict x = soa->x;
+    const double* const restrict y = soa->y;
+    const double* const restrict z = soa->z;
+    const double* const restrict m = soa->m;
+    double ax = 0.;
+    double ay = 0.;
+    double az = 0.;
+#pragma omp simd reduction(+:ax,ay,az)
+    for (int j=jstart; j<jend; j++){
+        const double dx = xi - x[j];
+        const double dy = yi - y[j];
+        const double dz = zi - z[j];
+        const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+        const double prefact = -G/(_r*_r*_r)*m[j];
+        ax += prefact*dx;
+        ay += prefact*dy;
+        az += prefact*dz;
     }
+    a->x += ax;
+    a->y += ay;
+    a->z += az;
 }
 
+static void reb_calculate_acceleration_basic_simd(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int _testparticle_type   = r->testparticle_type;
+    const int starti = (_gravity_ignore_terms==0)?1:2;
+    const int startj = (_gravity_ignore_terms==2)?1:0;
+    const int startitestp = MAX(_N_active, starti);
+    const int _N_iend = _testparticle_type?_N_real:_N_active;
+    struct reb_particles_soa* const soa = &(r->particles_soa);
+    reb_particles_soa_update(soa, particles, _N_real);
+#pragma omp parallel for
+    for (int i=0; i<N; i++){
+        particles[i].ax = 0; 
+        particles[i].ay = 0; 
+        particles[i].az = 0; 
+    }
+    // Summing over all Ghost Boxes
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    for (int g=0; g<gbs.N; g++){
+        struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
+        // Forces from active particles on all particles (test particles of type 0 are calculated separately below).
+        // Each particle sums over all sources. The excluded pairs (self-interaction and 
+        // gravity_ignore_terms) are skipped by splitting the source range, not by testing each pair.
+#pragma omp parallel for
+        for (int i=0; i<_N_iend; i++){
+#ifndef OPENMP
+            if (reb_sigint) return;
+#endif // OPENMP
+            if (_gravity_ignore_terms==2 && i==0) continue;
+            if (i>=_N_active && i<startitestp) continue;
+            int jlo = startj;
+            int jhi = i+1;
+            if (_gravity_ignore_terms==1 && i<2){
+                jlo = 2;
+                jhi = 2;
+            }
+            const double xi = gb.shiftx+particles[i].x;
+            const double yi = gb.shifty+particles[i].y;
+            const double zi = gb.shiftz+particles[i].z;
+            struct reb_vec3d a = {0};
+            reb_gravity_simd_sum(soa, jlo, i<_N_active?i:_N_active, xi, yi, zi, G, softening2, &a);
+            reb_gravity_simd_sum(soa, jhi, _N_active, xi, yi, zi, G, softening2, &a);
+            particles[i].ax += a.x;
+            particles[i].ay += a.y;
+            particles[i].az += a.z;
+        }
+        // Forces from test particles on active particles
+        if (_testparticle_type){
+#pragma omp parallel for
+            for (int j=startj; j<_N_active; j++){
+                const double xj = particles[j].x-gb.shiftx;
+                const double yj = particles[j].y-gb.shifty;
+                const double zj = particles[j].z-gb.shiftz;
+                struct reb_vec3d a = {0};
+                reb_gravity_simd_sum(soa, startitestp, _N_real, xj, yj, zj, G, softening2, &a);
+                particles[j].ax += a.x;
+                particles[j].ay += a.y;
+                particles[j].az += a.z;
+            }
+        }
+    }
+    if (!_testparticle_type){
+        reb_calculate_acceleration_testparticles(r, startj, _N_active, startitestp, _N_real);
+    }
+}
+#endif // SIMD
+
+#ifdef GPU
+// Helper routines for the offloaded REB_GRAVITY_BASIC kernel
+
+static void reb_calculate_acceleration_basic_gpu(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int _testparticle_type   = r->testparticle_type;
+    const int starti = (_gravity_ignore_terms==0)?1:2;
+    const int startj = (_gravity_ignore_terms==2)?1:0;
+    const int startitestp = MAX(_N_active, starti);
+    struct reb_particles_soa* const soa = &(r->particles_soa);
+    reb_particles_soa_update(soa, particles, _N_real);
+    reb_particles_soa_device_alloc(soa);
+
+    // Ghostbox shifts are precalculated on the host.
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    const int N_gb = gbs.N;
+    const double* const gx = gbs.x;
+    const double* const gy = gbs.y;
+    const double* const gz = gbs.z;
+
+    double* const x  = soa->x;
+    double* const y  = soa->y;
+    double* const z  = soa->z;
+    double* const m  = soa->m;
+    double* const ax = soa->ax;
+    double* const ay = soa->ay;
+    double* const az = soa->az;
+    if (_N_real>0){
+#pragma omp target update to(x[0:_N_real], y[0:_N_real], z[0:_N_real], m[0:_N_real])
+    }
+    // One device thread per particle. Each thread sums over all sources (O(N^2)), 
+    // there are no concurrent writes.
+#pragma omp target teams distribute parallel for map(to: gx[0:N_gb], gy[0:N_gb], gz[0:N_gb])
+    for (int i=0; i<_N_real; i++){
+        double aix = 0.;
+        double aiy = 0.;
+        double aiz = 0.;
+        if (!(_gravity_ignore_terms==2 && i==0) && !(i>=_N_active && i<startitestp)){
+            // Forces from active particles
+            int jlo = startj;
+            int jhi = i+1;
+            if (_gravity_ignore_terms==1 && i<2){
+                jlo = 2;
+                jhi = 2;
+            }
+            const int jmid = i<_N_active?i:_N_active;
+            for (int g=0; g<N_gb; g++){
+                const double xi = gx[g]+x[i];
+                const double yi = gy[g]+y[i];
+                const double zi = gz[g]+z[i];
+                for (int j=jlo; j<_N_active; j++){
+                    if (j>=jmid && j<jhi) continue;
+                    const double dx = xi - x[j];
+                    const double dy = yi - y[j];
+                    const double dz = zi - z[j];
+                    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                    const double prefact = -G/(_r*_r*_r)*m[j];
+                    aix += prefact*dx;
+                    aiy += prefact*dy;
+                    aiz += prefact*dz;
+                }
+            }
+        }
+        // Forces from test particles on active particles
+        if (_testparticle_type && i>=startj && i<_N_active){
+            for (int g=0; g<N_gb; g++){
+                const double xi = x[i]-gx[g];
+                const double yi = y[i]-gy[g];
+                const double zi = z[i]-gz[g];
+                for (int j=startitestp; j<_N_real; j++){
+                    const double dx = xi - x[j];
+                    const double dy = yi - y[j];
+                    const double dz = zi - z[j];
+                    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                    const double prefact = -G/(_r*_r*_r)*m[j];
+                    aix += prefact*dx;
+                    aiy += prefact*dy;
+                    aiz += prefact*dz;
+                }
+            }
+        }
+        ax[i] = aix;
+        ay[i] = aiy;
+        az[i] = aiz;
+    }
+    if (_N_real>0){
+#pragma omp target update from(ax[0:_N_real], ay[0:_N_real], az[0:_N_real])
+    }
+#pragma omp parallel for
+    for (int i=0; i<N; i++){
+        particles[i].ax = i<_N_real?ax[i]:0.;
+        particles[i].ay = i<_N_real?ay[i]:0.;
+        particles[i].az = i<_N_real?az[i]:0.;
+    }
+}
+#endif // GPU
+
+#ifdef OPENMP
+// Helper routines for the symmetric OpenMP direct summation
+
+/**
+  * @brief Returns per-thread acceleration buffers with room for N particles for each thread.
+  * @details The buffer of thread t starts at 3*N*t and stores ax, ay, az interleaved. 
+  * The buffers are not initialized; each thread zeroes its own buffer.
+  */
+static double* reb_gravity_omp_buffers(struct reb_simulation* r, const int N){
+    const int size = 3*N*omp_get_max_threads();
+    if (r->gravity_omp_a_allocatedN<size){
+        r->gravity_omp_a = realloc(r->gravity_omp_a, sizeof(double)*size);
+        r->gravity_omp_a_allocatedN = size;
+    }
+    return r->gravity_omp_a;
+}
+
+/**
+  * @brief Sums up the per-thread acceleration buffers and stores the result in the particle array.
+  * @details Needs to be called by all threads of a parallel region, after a barrier. 
+  * The buffers are always added up in the order of the thread number.
+  */
+static void reb_gravity_omp_reduce(struct reb_particle* const particles, const double* const a_threads, const int N){
+    const int nthreads = omp_get_num_threads();
+#pragma omp for schedule(static)
+    for (int k=0; k<N; k++){
+        double ax = 0.;
+        double ay = 0.;
+        double az = 0.;
+        for (int t=0; t<nthreads; t++){
+            const double* const a = a_threads + 3*(N*t+k);
+            ax += a[0];
+            ay += a[1];
+            az += a[2];
+        }
+        particles[k].ax = ax;
+        particles[k].ay = ay;
+        particles[k].az = az;
+    }
+}
+
+#if !defined(GPU) && !defined(SIMD)
+/**
+  * @brief Returns the number of particles for which reb_calculate_acceleration_basic_omp_threads() needs per-thread buffers.
+  */
+static int reb_calculate_acceleration_basic_omp_N_buf(const struct reb_simulation* const r){
+    const int N = r->N;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int starti = (r->gravity_ignore_terms==0)?1:2;
+    const int startitestp = MAX(_N_active, starti);
+    // Test particles of type 0 do not need per-thread buffers.
+    return r->testparticle_type?N:MIN(startitestp,N);
+}
+
+/**
+  * @brief Direct summation of reb_calculate_acceleration_basic_omp(). Needs to be called by all threads of a parallel region.
+  * @details Test particles of type 0 are not calculated here.
+  */
+static void reb_calculate_acceleration_basic_omp_threads(struct reb_simulation* r, double* const a_threads){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int _testparticle_type   = r->testparticle_type;
+    const int starti = (_gravity_ignore_terms==0)?1:2;
+    const int startj = (_gravity_ignore_terms==2)?1:0;
+    const int startitestp = MAX(_N_active, starti);
+    const int _N_iend = _testparticle_type?_N_real:startitestp;
+    const int _N_buf = reb_calculate_acceleration_basic_omp_N_buf(r);
+    double* const a = a_threads + 3*_N_buf*omp_get_thread_num();
+    for (int k=0; k<3*_N_buf; k++){
+        a[k] = 0.;
+    }
+    // Summing over all Ghost Boxes
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    for (int g=0; g<gbs.N; g++){
+        struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
+        // All active particle pairs, O(1/2*N^2). 
+        // Rows get shorter with i, a cyclic schedule balances the work.
+#pragma omp for schedule(static,1) nowait
+        for (int i=starti; i<_N_active; i++){
+            const double xi = gb.shiftx+particles[i].x;
+            const double yi = gb.shifty+particles[i].y;
+            const double zi = gb.shiftz+particles[i].z;
+            const double mi = particles[i].m;
+            double aix = 0.;
+            double aiy = 0.;
+            double aiz = 0.;
+            for (int j=startj; j<i; j++){
+                const double dx = xi - particles[j].x;
+                const double dy = yi - particles[j].y;
+                const double dz = zi - particles[j].z;
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double prefact = G/(_r*_r*_r);
+                const double prefactj = -prefact*particles[j].m;
+                const double prefacti = prefact*mi;
+                aix      += prefactj*dx;
+                aiy      += prefactj*dy;
+                aiz      += prefactj*dz;
+                a[3*j+0] += prefacti*dx;
+                a[3*j+1] += prefacti*dy;
+                a[3*j+2] += prefacti*dz;
+            }
+            a[3*i+0] += aix;
+            a[3*i+1] += aiy;
+            a[3*i+2] += aiz;
+        }
+        // Interactions of test particles with active particles
+        // (test particles of type 0 are calculated separately below)
+#pragma omp for schedule(static) nowait
+        for (int i=startitestp; i<_N_iend; i++){
+            const double xi = gb.shiftx+particles[i].x;
+            const double yi = gb.shifty+particles[i].y;
+            const double zi = gb.shiftz+particles[i].z;
+            const double mi = particles[i].m;
+            double aix = 0.;
+            double aiy = 0.;
+            double aiz = 0.;
+            for (int j=startj; j<_N_active; j++){
+                const double dx = xi - particles[j].x;
+                const double dy = yi - particles[j].y;
+                const double dz = zi - particles[j].z;
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double prefact = G/(_r*_r*_r);
+                const double prefactj = -prefact*particles[j].m;
+                aix += prefactj*dx;
+                aiy += prefactj*dy;
+                aiz += prefactj*dz;
+                if (_testparticle_type){
+                    const double prefacti = prefact*mi;
+                    a[3*j+0] += prefacti*dx;
+                    a[3*j+1] += prefacti*dy;
+                    a[3*j+2] += prefacti*dz;
+                }
+            }
+            a[3*i+0] += aix;
+            a[3*i+1] += aiy;
+            a[3*i+2] += aiz;
+        }
+    }
+#pragma omp barrier
+    reb_gravity_omp_reduce(particles, a_threads, _N_buf);
+}
+
+static void reb_calculate_acceleration_basic_omp(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int starti = (r->gravity_ignore_terms==0)?1:2;
+    const int startj = (r->gravity_ignore_terms==2)?1:0;
+    const int startitestp = MAX(_N_active, starti);
+    double* const a_threads = reb_gravity_omp_buffers(r, reb_calculate_acceleration_basic_omp_N_buf(r));
+#pragma omp parallel if(_N_real>=reb_omp_min_N)
+    reb_calculate_acceleration_basic_omp_threads(r, a_threads);
+    if (!r->testparticle_type){
+        reb_calculate_acceleration_testparticles(r, startj, _N_active, startitestp, _N_real);
+        for (int i=_N_real; i<N; i++){
+            particles[i].ax = 0; 
+            particles[i].ay = 0; 
+            particles[i].az = 0; 
+        }
+    }
+}
+
+int reb_calculate_acceleration_team_supported(const struct reb_simulation* const r){
+    if (r->gravity==REB_GRAVITY_NONE){
+        return 1;
+    }
+    return r->gravity==REB_GRAVITY_BASIC && r->N_var==0 && r->N_interaction_groups==0
+        && (r->N_active==-1 || r->testparticle_type==1)
+#ifdef MPI
+        && !r->mpi_direct
+#endif // MPI
+        ;
+}
+
+void reb_calculate_acceleration_team(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    if (r->gravity==REB_GRAVITY_NONE){
+#pragma omp for schedule(static)
+        for (int i=0; i<N; i++){
+            particles[i].ax = 0;  
+            particles[i].ay = 0;  
+            particles[i].az = 0;  
+        }  
+        return;
+    }
+#pragma omp single
+    {
+        reb_gravity_ghostboxes_update(r);
+        reb_gravity_omp_buffers(r, reb_calculate_acceleration_basic_omp_N_buf(r));
+        reb_gravity_count_direct(r);
+    }
+    reb_calculate_acceleration_basic_omp_threads(r, r->gravity_omp_a);
+}
+#endif // GPU, SIMD
+
+static inline void reb_calculate_acceleration_mercurius_omp(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int _testparticle_type   = r->testparticle_type;
+    const double* const dcrit = r->ri_mercurius.dcrit;
+    const int startitestp = MAX(_N_active,2);
+    double* const a_threads = reb_gravity_omp_buffers(r, _N_real);
+#pragma omp parallel
+    {
+        double* const a = a_threads + 3*_N_real*omp_get_thread_num();
+        for (int k=0; k<3*_N_real; k++){
+            a[k] = 0.;
+        }
+        // The star (particle 0) is not included, we're in democratic heliocentric coordinates.
+#pragma omp for schedule(static,1) nowait
+        for (int i=2; i<_N_active; i++){
+            const double xi = particles[i].x;
+            const double yi = particles[i].y;
+            const double zi = particles[i].z;
+            const double mi = particles[i].m;
+            double aix = 0.;
+            double aiy = 0.;
+            double aiz = 0.;
+            for (int j=1; j<i; j++){
+                const double dx = xi - particles[j].x;
+                const double dy = yi - particles[j].y;
+                const double dz = zi - particles[j].z;
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double dcritmax = MAX(dcrit[i],dcrit[j]);
+                const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+                const double prefact = G*L/(_r*_r*_r);
+                const double prefactj = -prefact*particles[j].m;
+                const double prefacti = prefact*mi;
+                aix      += prefactj*dx;
+                aiy      += prefactj*dy;
+                aiz      += prefactj*dz;
+                a[3*j+0] += prefacti*dx;
+                a[3*j+1] += prefacti*dy;
+                a[3*j+2] += prefacti*dz;
+            }
+            a[3*i+0] += aix;
+            a[3*i+1] += aiy;
+            a[3*i+2] += aiz;
+        }
+#pragma omp for schedule(static) nowait
+        for (int i=startitestp; i<_N_real; i++){
+            const double xi = particles[i].x;
+            const double yi = particles[i].y;
+            const double zi = particles[i].z;
+            const double mi = particles[i].m;
+            double aix = 0.;
+            double aiy = 0.;
+            double aiz = 0.;
+            for (int j=1; j<_N_active; j++){
+                const double dx = xi - particles[j].x;
+                const double dy = yi - particles[j].y;
+                const double dz = zi - particles[j].z;
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double dcritmax = MAX(dcrit[i],dcrit[j]);
+                const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+                const double prefact = G*L/(_r*_r*_r);
+                const double prefactj = -prefact*particles[j].m;
+                aix += prefactj*dx;
+                aiy += prefactj*dy;
+                aiz += prefactj*dz;
+                if (_testparticle_type){
+                    const double prefacti = prefact*mi;
+                    a[3*j+0] += prefacti*dx;
+                    a[3*j+1] += prefacti*dy;
+                    a[3*j+2] += prefacti*dz;
+                }
+            }
+            a[3*i+0] += aix;
+            a[3*i+1] += aiy;
+            a[3*i+2] += aiz;
+        }
+#pragma omp barrier
+        reb_gravity_omp_reduce(particles, a_threads, _N_real);
+    }
+}
+#endif // OPENMP
+
+#ifdef MPI
+// Helper routines for the direct summation distributed over MPI nodes
+
+/**
+  * @brief Returns an acceleration buffer with room for N particles, set to zero.
+  * @details Uses the same memory as the OpenMP buffers. The two are never used at the same time.
+  */
+static double* reb_gravity_mpi_buffer(struct reb_simulation* r, const int N){
+    if (r->gravity_omp_a_allocatedN<3*N){
+        r->gravity_omp_a = realloc(r->gravity_omp_a, sizeof(double)*3*N);
+        r->gravity_omp_a_allocatedN = 3*N;
+    }
+    for (int k=0; k<3*N; k++){
+        r->gravity_omp_a[k] = 0.;
+    }
+    return r->gravity_omp_a;
+}
+
+/**
+  * @brief Sums up the acceleration buffers of all nodes and stores the result in the particle array.
+  */
+static void reb_gravity_mpi_reduce(struct reb_particle* const particles, double* const a, const int N){
+    MPI_Allreduce(MPI_IN_PLACE, a, 3*N, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    for (int k=0; k<N; k++){
+        particles[k].ax = a[3*k+0];
+        particles[k].ay = a[3*k+1];
+        particles[k].az = a[3*k+2];
+    }
+}
+
+static void reb_calculate_acceleration_basic_mpi(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int _testparticle_type   = r->testparticle_type;
+    const int starti = (_gravity_ignore_terms==0)?1:2;
+    const int startj = (_gravity_ignore_terms==2)?1:0;
+    const int startitestp = MAX(_N_active, starti);
+    const int mpi_id = r->mpi_id;
+    const int mpi_num = r->mpi_num;
+    double* const a = reb_gravity_mpi_buffer(r, _N_real);
+    // Summing over all Ghost Boxes
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    for (int g=0; g<gbs.N; g++){
+        struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
+        // All active particle pairs, O(1/2*N^2). 
+        // Rows get shorter with i, a cyclic assignment balances the work.
+        for (int i=starti+mpi_id; i<_N_active; i+=mpi_num){
+            if (reb_sigint) return;
+            const double xi = gb.shiftx+particles[i].x;
+            const double yi = gb.shifty+particles[i].y;
+            const double zi = gb.shiftz+particles[i].z;
+            const double mi = particles[i].m;
+            double aix = 0.;
+            double aiy = 0.;
+            double aiz = 0.;
+            for (int j=startj; j<i; j++){
+                const double dx = xi - particles[j].x;
+                const double dy = yi - particles[j].y;
+                const double dz = zi - particles[j].z;
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double prefact = G/(_r*_r*_r);
+                const double prefactj = -prefact*particles[j].m;
+                const double prefacti = prefact*mi;
+                aix      += prefactj*dx;
+                aiy      += prefactj*dy;
+                aiz      += prefactj*dz;
+                a[3*j+0] += prefacti*dx;
+                a[3*j+1] += prefacti*dy;
+                a[3*j+2] += prefacti*dz;
+            }
+            a[3*i+0] += aix;
+            a[3*i+1] += aiy;
+            a[3*i+2] += aiz;
+        }
+        // Interactions of test particles with active particles
+        for (int i=startitestp+mpi_id; i<_N_real; i+=mpi_num){
+            const double xi = gb.shiftx+particles[i].x;
+            const double yi = gb.shifty+particles[i].y;
+            const double zi = gb.shiftz+particles[i].z;
+            const double mi = particles[i].m;
+            double aix = 0.;
+            double aiy = 0.;
+            double aiz = 0.;
+            for (int j=startj; j<_N_active; j++){
+                const double dx = xi - particles[j].x;
+                const double dy = yi - particles[j].y;
+                const double dz = zi - particles[j].z;
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double prefact = G/(_r*_r*_r);
+                const double prefactj = -prefact*particles[j].m;
+                aix += prefactj*dx;
+                aiy += prefactj*dy;
+                aiz += prefactj*dz;
+                if (_testparticle_type){
+                    const double prefacti = prefact*mi;
+                    a[3*j+0] += prefacti*dx;
+                    a[3*j+1] += prefacti*dy;
+                    a[3*j+2] += prefacti*dz;
+                }
+            }
+            a[3*i+0] += aix;
+            a[3*i+1] += aiy;
+            a[3*i+2] += aiz;
+        }
+    }
+    reb_gravity_mpi_reduce(particles, a, _N_real);
+    for (int i=_N_real; i<N; i++){
+        particles[i].ax = 0; 
+        particles[i].ay = 0; 
+        particles[i].az = 0; 
+    }
+}
+
+static inline void reb_calculate_acceleration_mercurius_mpi(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const int _N_real   = N  - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const int _testparticle_type   = r->testparticle_type;
+    const double* const dcrit = r->ri_mercurius.dcrit;
+    const int startitestp = MAX(_N_active,2);
+    const int mpi_id = r->mpi_id;
+    const int mpi_num = r->mpi_num;
+    double* const a = reb_gravity_mpi_buffer(r, _N_real);
+    // The star (particle 0) is not included, we're in democratic heliocentric coordinates.
+    for (int i=2+mpi_id; i<_N_active; i+=mpi_num){
+        if (reb_sigint) return;
+        const double xi = particles[i].x;
+        const double yi = particles[i].y;
+        const double zi = particles[i].z;
+        const double mi = particles[i].m;
+        double aix = 0.;
+        double aiy = 0.;
+        double aiz = 0.;
+        for (int j=1; j<i; j++){
+            const double dx = xi - particles[j].x;
+            const double dy = yi - particles[j].y;
+            const double dz = zi - particles[j].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[i],dcrit[j]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            const double prefact = G*L/(_r*_r*_r);
+            const double prefactj = -prefact*particles[j].m;
+            const double prefacti = prefact*mi;
+            aix      += prefactj*dx;
+            aiy      += prefactj*dy;
+            aiz      += prefactj*dz;
+            a[3*j+0] += prefacti*dx;
+            a[3*j+1] += prefacti*dy;
+            a[3*j+2] += prefacti*dz;
+        }
+        a[3*i+0] += aix;
+        a[3*i+1] += aiy;
+        a[3*i+2] += aiz;
+    }
+    for (int i=startitestp+mpi_id; i<_N_real; i+=mpi_num){
+        const double xi = particles[i].x;
+        const double yi = particles[i].y;
+        const double zi = particles[i].z;
+        const double mi = particles[i].m;
+        double aix = 0.;
+        double aiy = 0.;
+        double aiz = 0.;
+        for (int j=1; j<_N_active; j++){
+            const double dx = xi - particles[j].x;
+            const double dy = yi - particles[j].y;
+            const double dz = zi - particles[j].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[i],dcrit[j]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            const double prefact = G*L/(_r*_r*_r);
+            const double prefactj = -prefact*particles[j].m;
+            aix += prefactj*dx;
+            aiy += prefactj*dy;
+            aiz += prefactj*dz;
+            if (_testparticle_type){
+                const double prefacti = prefact*mi;
+                a[3*j+0] += prefacti*dx;
+                a[3*j+1] += prefacti*dy;
+                a[3*j+2] += prefacti*dz;
+            }
+        }
+        a[3*i+0] += aix;
+        a[3*i+1] += aiy;
+        a[3*i+2] += aiz;
+    }
+    reb_gravity_mpi_reduce(particles, a, _N_real);
+}
+#endif // MPI
+
+// Helper routines for REB_GRAVITY_MERCURIUS
+
+#ifndef OPENMP
+/**
+  * @brief WHFast part (mode 0) of REB_GRAVITY_MERCURIUS. Only interactions scaled by the switching function L are included.
+  */
+static inline void reb_calculate_acceleration_mercurius_whfast(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type){
+    struct reb_particle* const particles = r->particles;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const int _testparticle_type   = r->testparticle_type;
+    const int _N_real   = r->N - r->N_var;
+    const int _N_active = ((r->N_active==-1)?_N_real:r->N_active);
+    const double* const dcrit = r->ri_mercurius.dcrit;
+    const int tile = reb_gravity_tile_size(r);
+    for (int i=0; i<_N_real; i++){
+        particles[i].ax = 0; 
+        particles[i].ay = 0; 
+        particles[i].az = 0; 
+    }
+    for (int ib=2; ib<_N_active; ib+=tile){
+    const int iend = MIN(ib+tile, _N_active);
+    for (int jb=1; jb<iend; jb+=tile){
+    const int jend = MIN(jb+tile, iend);
+    for (int i=MAX(ib,jb+1); i<iend; i++){
+        if (reb_sigint) return;
+        for (int j=jb; j<MIN(jend,i); j++){
+            const double dx = particles[i].x - particles[j].x;
+            const double dy = particles[i].y - particles[j].y;
+            const double dz = particles[i].z - particles[j].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[i],dcrit[j]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            const double prefact = G*L/(_r*_r*_r);
+            const double prefactj = -prefact*particles[j].m;
+            const double prefacti = prefact*particles[i].m;
+            particles[i].ax    += prefactj*dx;
+            particles[i].ay    += prefactj*dy;
+            particles[i].az    += prefactj*dz;
+            particles[j].ax    += prefacti*dx;
+            particles[j].ay    += prefacti*dy;
+            particles[j].az    += prefacti*dz;
+        }
+    }
+    }
+    }
+    const int startitestp = MAX(_N_active,2);
+    for (int ib=startitestp; ib<_N_real; ib+=tile){
+    const int iend = MIN(ib+tile, _N_real);
+    for (int jb=1; jb<_N_active; jb+=tile){
+    const int jend = MIN(jb+tile, _N_active);
+    for (int i=ib; i<iend; i++){
+        if (reb_sigint) return;
+        for (int j=jb; j<jend; j++){
+            const double dx = particles[i].x - particles[j].x;
+            const double dy = particles[i].y - particles[j].y;
+            const double dz = particles[i].z - particles[j].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[i],dcrit[j]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            const double prefact = G*L/(_r*_r*_r);
+            const double prefactj = -prefact*particles[j].m;
+            particles[i].ax    += prefactj*dx;
+            particles[i].ay    += prefactj*dy;
+            particles[i].az    += prefactj*dz;
+            if (_testparticle_type){
+                const double prefacti = prefact*particles[i].m;
+                particles[j].ax    += prefacti*dx;
+                particles[j].ay    += prefacti*dy;
+                particles[j].az    += prefacti*dz;
+            }
+        }
+    }
+    }
+    }
+}
+#endif // OPENMP
+
+/**
+  * @brief IAS15 part (mode 1) of REB_GRAVITY_MERCURIUS. Only particles in the encounter map are included, scaled by 1-L.
+  */
+static inline void reb_calculate_acceleration_mercurius_ias15(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type){
+    struct reb_particle* const particles = r->particles;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const int _testparticle_type   = r->testparticle_type;
+    const double m0 = r->particles[0].m;
+    const double* const dcrit = r->ri_mercurius.dcrit;
+    const int encounterN = r->ri_mercurius.encounterN;
+    const int encounterNactive = r->ri_mercurius.encounterNactive;
+    int* map = r->ri_mercurius.encounter_map;
+#ifndef OPENMP
+    particles[0].ax = 0; // map[0] is always 0 
+    particles[0].ay = 0; 
+    particles[0].az = 0; 
+    // Acceleration due to star
+    for (int i=1; i<encounterN; i++){
+        int mi = map[i];
+        const double x = particles[mi].x;
+        const double y = particles[mi].y;
+        const double z = particles[mi].z;
+        const double _r = sqrt(x*x + y*y + z*z + softening2);
+        double prefact = -G/(_r*_r*_r)*m0;
+        particles[mi].ax    = prefact*x;
+        particles[mi].ay    = prefact*y;
+        particles[mi].az    = prefact*z;
+    }
+    // We're in a heliocentric coordinate system.
+    // The star feels no acceleration
+    // Interactions between active-active
+    for (int i=2; i<encounterNactive; i++){
+        int mi = map[i];
+        for (int j=1; j<i; j++){
+            int mj = map[j];
+            const double dx = particles[mi].x - particles[mj].x;
+            const double dy = particles[mi].y - particles[mj].y;
+            const double dz = particles[mi].z - particles[mj].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            double prefact = G*(1.-L)/(_r*_r*_r);
+            double prefactj = -prefact*particles[mj].m;
+            double prefacti = prefact*particles[mi].m;
+            particles[mi].ax    += prefactj*dx;
+            particles[mi].ay    += prefactj*dy;
+            particles[mi].az    += prefactj*dz;
+            particles[mj].ax    += prefacti*dx;
+            particles[mj].ay    += prefacti*dy;
+            particles[mj].az    += prefacti*dz;
+        }
+    }
+    // Interactions between active-testparticle
+    const int startitestp = MAX(encounterNactive,2);
+    for (int i=startitestp; i<encounterN; i++){
+        int mi = map[i];
+        for (int j=1; j<encounterNactive; j++){
+            int mj = map[j];
+            const double dx = particles[mi].x - particles[mj].x;
+            const double dy = particles[mi].y - particles[mj].y;
+            const double dz = particles[mi].z - particles[mj].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            double prefact = G*(1.-L)/(_r*_r*_r);
+            double prefactj = -prefact*particles[mj].m;
+            particles[mi].ax    += prefactj*dx;
+            particles[mi].ay    += prefactj*dy;
+            particles[mi].az    += prefactj*dz;
+            if (_testparticle_type){
+                double prefacti = prefact*particles[mi].m;
+                particles[mj].ax    += prefacti*dx;
+                particles[mj].ay    += prefacti*dy;
+                particles[mj].az    += prefacti*dz;
+            }
+        }
+    }
+#else // OPENMP
+    particles[0].ax = 0; // map[0] is always 0 
+    particles[0].ay = 0; 
+    particles[0].az = 0; 
+    // We're in a heliocentric coordinate system.
+    // The star feels no acceleration
+#pragma omp parallel for schedule(guided)
+    for (int i=1; i<encounterN; i++){
+        int mi = map[i];
+        particles[mi].ax = 0; 
+        particles[mi].ay = 0; 
+        particles[mi].az = 0; 
+        // Acceleration due to star
+        const double x = particles[mi].x;
+        const double y = particles[mi].y;
+        const double z = particles[mi].z;
+        const double _r = sqrt(x*x + y*y + z*z + softening2);
+        double prefact = -G/(_r*_r*_r)*m0;
+        particles[mi].ax    += prefact*x;
+        particles[mi].ay    += prefact*y;
+        particles[mi].az    += prefact*z;
+        for (int j=1; j<encounterNactive; j++){
+            if (i==j) continue;
+            int mj = map[j];
+            const double dx = x - particles[mj].x;
+            const double dy = y - particles[mj].y;
+            const double dz = z - particles[mj].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            double prefact = -G*particles[mj].m*(1.-L)/(_r*_r*_r);
+            particles[mi].ax    += prefact*dx;
+            particles[mi].ay    += prefact*dy;
+            particles[mi].az    += prefact*dz;
+        }
+    }
+    if (_testparticle_type){
+#pragma omp parallel for schedule(guided)
+    for (int i=1; i<encounterNactive; i++){
+        int mi = map[i];
+        const double x = particles[mi].x;
+        const double y = particles[mi].y;
+        const double z = particles[mi].z;
+        for (int j=encounterNactive; j<encounterN; j++){
+            int mj = map[j];
+            const double dx = x - particles[mj].x;
+            const double dy = y - particles[mj].y;
+            const double dz = z - particles[mj].z;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double dcritmax = MAX(dcrit[mi],dcrit[mj]);
+            const double L = reb_integrator_mercurius_L(r, L_type, _r, dcritmax);
+            double prefact = -G*particles[mj].m*(1.-L)/(_r*_r*_r);
+            particles[mi].ax    += prefact*dx;
+            particles[mi].ay    += prefact*dy;
+            particles[mi].az    += prefact*dz;
+        }
+    }
+    }
+#endif // OPENMP
+}
+
+static inline void reb_calculate_acceleration_mercurius(struct reb_simulation* r, const enum reb_integrator_mercurius_L_type L_type){
+    switch (r->ri_mercurius.mode){
+        case 0: // WHFAST part
+#ifdef MPI
+            if (r->mpi_direct && r->mpi_root_owner){
+                reb_calculate_acceleration_mercurius_mpi(r, L_type);
+                break;
+            }
+#endif // MPI
+#ifdef OPENMP
+            reb_calculate_acceleration_mercurius_omp(r, L_type);
+#else // OPENMP
+            reb_calculate_acceleration_mercurius_whfast(r, L_type);
+#endif // OPENMP
+            break;
+        case 1: // IAS15 part
+            reb_calculate_acceleration_mercurius_ias15(r, L_type);
+            break;
+        case 2: // Skipp WHFAST part because of synchronization
+            break;
+    }
+}
+
+// Helper routines for REB_GRAVITY_TREE
+
+
+/**
+  * @brief The function calls itself recursively using cell breaking criterion to check whether it can use center of mass (and mass quadrupole tensor) to calculate forces.
+  * Calculate the acceleration for a particle from a given cell and all its daughter cells.
+  *
+  * @param r REBOUND simulation to consider
+  * @param pt Index of the particle the force is calculated for.
+  * @param node Pointer to the cell the force is calculated from.
+  * @param gb Ghostbox plus position of the particle (precalculated). 
+  * @param counts Work done in the walk is added here.
+  * @param fused Collision candidates are added here (tree_fused_walk). 
+  * @param gc Index of the ghost box in the collision search, -1 if no candidates are collected.
+  */
+static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* const r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb, struct reb_gravity_walk_counts* const counts, const struct reb_collision_fused* const fused, const int gc);
+
+/**
+  * @brief Calculates the acceleration due to the multipole expansion of a cell.
+  * @details The expansion includes the monopole (order 0), the quadrupole (order 1) 
+  * and the octupole (order 2) moment of the cell. The dipole moment vanishes because the
+  * expansion is done around the centre of mass.
+  * @param node Pointer to the cell.
+  * @param order Order of the expansion, tree_order.
+  * @param dx Position of the particle relative to the centre of mass of the cell (x).
+  * @param dy Position of the particle relative to the centre of mass of the cell (y).
+  * @param dz Position of the particle relative to the centre of mass of the cell (z).
+  * @param a Acceleration to which the contribution of the cell is added.
+  */
+static inline void reb_tree_cell_acceleration(const struct reb_treecell* const node, const unsigned int order, const double G, const double softening2, const double dx, const double dy, const double dz, double* const a){
+    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+    const double _r2 = _r*_r;
+    const double _r3 = _r2*_r;
+    double prefact = -G/_r3*node->m;
+    if (order>=1){
+        const double qprefact = G/(_r3*_r2);
+        a[0] += qprefact*(dx*node->mxx + dy*node->mxy + dz*node->mxz); 
+        a[1] += qprefact*(dx*node->mxy + dy*node->myy + dz*node->myz); 
+        a[2] += qprefact*(dx*node->mxz + dy*node->myz + dz*node->mzz); 
+        const double mrr = dx*dx*node->mxx     + dy*dy*node->myy     + dz*dz*node->mzz
+                + 2.*dx*dy*node->mxy     + 2.*dx*dz*node->mxz     + 2.*dy*dz*node->myz; 
+        prefact += -5.0/(2.0*_r2)*qprefact*mrr;
+    }
+    if (order>=2){
+        const double oprefact = G/(_r3*_r2*_r2);
+        const double mrx = dx*dx*node->mxxx + dy*dy*node->mxyy + dz*dz*node->mxzz
+                + 2.*(dx*dy*node->mxxy + dx*dz*node->mxxz + dy*dz*node->mxyz);
+        const double mry = dx*dx*node->mxxy + dy*dy*node->myyy + dz*dz*node->myzz
+                + 2.*(dx*dy*node->mxyy + dx*dz*node->mxyz + dy*dz*node->myyz);
+        const double mrz = dx*dx*node->mxxz + dy*dy*node->myyz + dz*dz*node->mzzz
+                + 2.*(dx*dy*node->mxyz + dx*dz*node->mxzz + dy*dz*node->myzz);
+        const double mrrr = dx*mrx + dy*mry + dz*mrz;
+        a[0] += 0.5*oprefact*mrx;
+        a[1] += 0.5*oprefact*mry;
+        a[2] += 0.5*oprefact*mrz;
+        prefact += -7.0/(6.0*_r2)*oprefact*mrrr;
+    }
+    a[0] += prefact*dx; 
+    a[1] += prefact*dy; 
+    a[2] += prefact*dz; 
+}
+
+static void reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, const int ghost, struct reb_gravity_walk_counts* const counts, const struct reb_collision_fused* const fused, const int gc) {
+    reb_calculate_acceleration_for_particle_from_roots(r, pt, gb, ghost, NULL, r->root_n, counts, fused, gc);
+}
+
+static void reb_calculate_acceleration_for_particle_from_roots(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, const int ghost, const int* const roots, const int N_roots, struct reb_gravity_walk_counts* const counts, const struct reb_collision_fused* const fused, const int gc) {
+    const int prune = ghost && r->gravity_ghostbox_tolerance>0.;
+    const double p[3] = {gb.shiftx, gb.shifty, gb.shiftz};
+    for(int k=0;k<N_roots;k++){
+        struct reb_treecell* node = r->tree_root[roots?roots[k]:k];
+        if (node!=NULL){
+            if (prune && reb_gravity_ghostbox_prune_cell(r, node, p, p)) continue;
+            reb_calculate_acceleration_for_particle_from_cell(r, pt, node, gb, counts, fused, gc);
+        }
+    }
+}
+
+void reb_calculate_acceleration_tree_from_roots(struct reb_simulation* r, const int* const roots, const int N_roots){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    PROFILING_START(r)
+    uint64_t interactions = 0;
+    uint64_t cells_opened = 0;
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r); // Calculated by reb_calculate_acceleration() in this step
+#pragma omp parallel for schedule(guided) reduction(+:interactions,cells_opened)
+    for (int i=0; i<N; i++){
+        struct reb_gravity_walk_counts counts = {0};
+        for (int g=0; g<gbs.N; g++){
+            struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
+            gb.shiftx += particles[i].x;
+            gb.shifty += particles[i].y;
+            gb.shiftz += particles[i].z;
+            reb_calculate_acceleration_for_particle_from_roots(r, i, gb, g!=gbs.central, roots, N_roots, &counts, NULL, -1);
+        }
+        interactions += counts.interactions;
+        cells_opened += counts.cells_opened;
+    }
+    r->counters.gravity_interactions += interactions;
+    r->counters.tree_cells_opened += cells_opened;
+    PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+}
+
+static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb, struct reb_gravity_walk_counts* const counts, const struct reb_collision_fused* const fused, const int gc) {
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    struct reb_particle* const particles = r->particles;
+    const double dx = gb.shiftx - node->mx;
+    const double dy = gb.shifty - node->my;
+    const double dz = gb.shiftz - node->mz;
+    const double r2 = dx*dx + dy*dy + dz*dz;
+    if ( node->pt < 0 ) { // Not a leaf
+        if ( node->w*node->w > r->opening_angle2*r2 ){
+            counts->cells_opened++;
+            for (int o=0; o<8; o++) {
+                if (node->oct[o] != NULL) {
+                    reb_calculate_acceleration_for_particle_from_cell(r, pt, node->oct[o], gb, counts, fused, gc);
+                }
+            }
+        } else {
+            counts->interactions++;
+            double a[3] = {0., 0., 0.};
+            reb_tree_cell_acceleration(node, r->tree_order, G, softening2, dx, dy, dz, a);
+            particles[pt].ax += a[0]; 
+            particles[pt].ay += a[1]; 
+            particles[pt].az += a[2]; 
+            if (gc>=0){
+                // The cell might still contain collision candidates.
+                reb_collision_fused_cell(fused, pt, node, &gb, gc);
+            }
+        }
+    } else { // It's a leaf node
+        if (node->pt == pt) return;
+        if (gc>=0 && node->pt>pt && r2<fused->cutoff*fused->cutoff){
+            reb_collision_fused_add(fused, pt, node->pt, gc);
+        }
+        counts->interactions++;
+        double _r = sqrt(r2 + softening2);
+        double prefact = -G/(_r*_r*_r)*node->m;
+        particles[pt].ax += prefact*dx; 
+        particles[pt].ay += prefact*dy; 
+        particles[pt].az += prefact*dz; 
+    }
+}
+
+/**
+  * @brief Gravitational potential of the multipole expansion of a cell.
+  * @details The negative gradient of this potential is the acceleration 
+  * calculated in reb_tree_cell_acceleration().
+  */
+static inline double reb_tree_cell_potential(const struct reb_treecell* const node, const unsigned int order, const double G, const double softening2, const double dx, const double dy, const double dz){
+    const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+    const double _r2 = _r*_r;
+    double phi = -G*node->m/_r;
+    if (order>=1){
+        const double mrr = dx*dx*node->mxx     + dy*dy*node->myy     + dz*dz*node->mzz
+                + 2.*dx*dy*node->mxy     + 2.*dx*dz*node->mxz     + 2.*dy*dz*node->myz; 
+        phi += -0.5*G*mrr/(_r2*_r2*_r);
+    }
+    if (order>=2){
+        const double mrrr = dx*dx*dx*node->mxxx + dy*dy*dy*node->myyy + dz*dz*dz*node->mzzz
+                + 3.*(dx*dx*dy*node->mxxy + dx*dx*dz*node->mxxz + dx*dy*dy*node->mxyy
+                    + dx*dz*dz*node->mxzz + dy*dy*dz*node->myyz + dy*dz*dz*node->myzz)
+                + 6.*dx*dy*dz*node->mxyz;
+        phi += -G*mrrr/(6.*_r2*_r2*_r2*_r);
+    }
+    return phi;
+}
+
+/**
+  * @brief Potential at the position of particle pt due to all particles in a cell.
+  * @details Uses the same opening criterion as the force calculation.
+  */
+static double reb_calculate_potential_for_particle_from_cell(const struct reb_simulation* const r, const int pt, const struct reb_treecell* const node, const double x, const double y, const double z){
+    const double dx = x - node->mx;
+    const double dy = y - node->my;
+    const double dz = z - node->mz;
+    const double r2 = dx*dx + dy*dy + dz*dz;
+    const double softening2 = r->softening*r->softening;
+    if ( node->pt < 0 ) { // Not a leaf
+        if ( node->w*node->w > r->opening_angle2*r2 ){
+            double phi = 0.;
+            for (int o=0; o<8; o++) {
+                if (node->oct[o] != NULL) {
+                    phi += reb_calculate_potential_for_particle_from_cell(r, pt, node->oct[o], x, y, z);
+                }
+            }
+            return phi;
+        } else {
+            return reb_tree_cell_potential(node, r->tree_order, r->G, softening2, dx, dy, dz);
+        }
+    } else { // It's a leaf node
+        if (node->pt == pt) return 0.;
+        return -r->G*node->m/sqrt(r2 + softening2);
+    }
+}
+
+double reb_calculate_potential_energy_tree(struct reb_simulation* r){
+    const struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    // Positions have changed since the last force calculation. Only the moments of cells containing particles which moved are recalculated.
+    reb_tree_update_gravity_data(r);
+    double e_pot = 0.;
+#pragma omp parallel for schedule(guided) reduction(+:e_pot)
+    for (int i=0; i<N; i++){
+        double phi = 0.;
+        for(int k=0;k<r->root_n;k++){
+            const struct reb_treecell* node = r->tree_root[k];
+            if (node!=NULL){
+                phi += reb_calculate_potential_for_particle_from_cell(r, i, node, particles[i].x, particles[i].y, particles[i].z);
+            }
+        }
+        e_pot += 0.5*particles[i].m*phi;
+    }
+    return e_pot;
+}
+
+#ifndef MPI
+// Helper routines for group walks in REB_GRAVITY_TREE
+
+/**
+  * @brief Node in a kept interaction list.
+  */
+struct reb_tree_list_entry {
+    const struct reb_treecell* node;
+    uint64_t id;                        ///< Id of the node when the list was built.
+    int leaf;                           ///< 1 if the node was a leaf when the list was built.
+};
+
+/**
+  * @brief Interaction list of one group for all ghost boxes, kept between force calculations.
+  */
+struct reb_tree_list {
+    const struct reb_treecell* group;   ///< Cell containing the particles of the group.
+    uint64_t group_id;                  ///< Id of the group cell when the list was built.
+    unsigned long long steps_done;      ///< Value of steps_done when the list was built.
+    int N_gb;                           ///< Number of ghost boxes.
+    int* start;                         ///< The nodes for ghost box g are entries[start[g]] to entries[start[g+1]-1].
+    int N;
+    int allocatedN;
+    struct reb_tree_list_entry* entries;
+};
+
+/**
+  * @brief Kept interaction lists, one for each group.
+  */
+struct reb_tree_lists {
+    int N;
+    struct reb_tree_list* lists;
+};
+
+static void reb_tree_list_add(struct reb_tree_list* const list, const struct reb_treecell* const node){
+    if (list->N>=list->allocatedN){
+        list->allocatedN = list->allocatedN ? list->allocatedN*2 : 256;
+        list->entries = realloc(list->entries, sizeof(struct reb_tree_list_entry)*list->allocatedN);
+    }
+    list->entries[list->N++] = (struct reb_tree_list_entry){.node = node, .id = node->id, .leaf = node->pt>=0};
+}
+
+void reb_tree_lists_free(struct reb_simulation* r){
+    struct reb_tree_lists* const lists = r->tree_lists;
+    if (lists){
+        for (int k=0; k<lists->N; k++){
+            free(lists->lists[k].start);
+            free(lists->lists[k].entries);
+        }
+        free(lists->lists);
+        free(lists);
+        r->tree_lists = NULL;
+    }
+}
+
+/**
+  * @brief Assigns the kept interaction lists to the current groups.
+  * @details A list is identified by the id of its group cell, which is stored in the cell. 
+  * Lists of cells which are no longer groups are freed.
+  */
+static struct reb_tree_lists* reb_tree_lists_update(struct reb_simulation* const r, const struct reb_treecell** const groups, const int N_groups){
+    struct reb_tree_lists* const old = r->tree_lists;
+    struct reb_tree_lists* const lists = malloc(sizeof(struct reb_tree_lists));
+    lists->N = N_groups;
+    lists->lists = calloc(N_groups, sizeof(struct reb_tree_list));
+    for (int k=0; k<N_groups; k++){
+        struct reb_treecell* const group = (struct reb_treecell*)groups[k];
+        const int l = group->list-1;
+        if (old && l>=0 && l<old->N && old->lists[l].group==group && old->lists[l].group_id==group->id){
+            lists->lists[k] = old->lists[l];
+            old->lists[l] = (struct reb_tree_list){0};
+        }
+        group->list = k+1;
+    }
+    reb_tree_lists_free(r);
+    r->tree_lists = lists;
+    return lists;
+}
+
+/**
+  * @brief Interaction list and particles of the group currently processed by one thread.
+  * @details Sources which are used with their monopole moment only (leaves and, if 
+  * tree_order is 0, all cells) are stored as arrays so that they can be applied to all particles 
+  * in the group with SIMD instructions. 
+  */
+struct reb_tree_group_context {
+    struct reb_simulation* r;
+    double opening_angle2;              ///< Opening criterion used in the walk.
+    int N_tree;                         ///< Number of particles in the tree.
+    const struct reb_treecell* group;   ///< Cell containing the particles of the group.
+    struct reb_tree_list* list;         ///< Kept interaction list of the group, NULL if lists are not kept.
+    struct reb_tree_list* record;       ///< List to which the nodes found in the walk are added, NULL if they are not recorded.
+    int central;                        ///< 1 if the walk is done for the central box.
+    double lo[3];                       ///< Lower corner of the bounding box of the group particles (shifted to the ghostbox).
+    double hi[3];                       ///< Upper corner of the bounding box of the group particles (shifted to the ghostbox).
+    int N_group;                        ///< Number of particles in the group.
+    int allocatedN_group;
+    int* pt;                            ///< Indices of the particles in the group.
+    double* gx;                         ///< Positions of the particles in the group.
+    double* gy;
+    double* gz;
+    double* gax;                        ///< Accelerations of the particles in the group.
+    double* gay;
+    double* gaz;
+    int N;                              ///< Number of monopole sources.
+    int allocatedN;
+    double* sx;                         ///< Positions of the monopole sources.
+    double* sy;
+    double* sz;
+    double* sm;                         ///< Masses of the monopole sources.
+    int* spt;                           ///< Index of the particle for leaves, -1 for cells.
+    int N_cells;                        ///< Number of cells used with their higher order moments.
+    int allocatedN_cells;
+    const struct reb_treecell** cells;
+    struct reb_gravity_walk_counts counts;  ///< Work done by this thread.
+    uint64_t lists_reused;              ///< Number of kept interaction lists reused by this thread.
+};
+
+static void reb_tree_group_push(struct reb_tree_group_context* const ctx, const struct reb_treecell* const node){
+    if (node->pt<0 && ctx->r->tree_order>=1){
+        if (ctx->N_cells>=ctx->allocatedN_cells){
+            ctx->allocatedN_cells = ctx->allocatedN_cells ? ctx->allocatedN_cells*2 : 256;
+            ctx->cells = realloc(ctx->cells, sizeof(struct reb_treecell*)*ctx->allocatedN_cells);
+        }
+        ctx->cells[ctx->N_cells++] = node;
+        return;
+    }
+    if (ctx->N>=ctx->allocatedN){
+        ctx->allocatedN = ctx->allocatedN ? ctx->allocatedN*2 : 1024;
+        ctx->sx = realloc(ctx->sx, sizeof(double)*ctx->allocatedN);
+        ctx->sy = realloc(ctx->sy, sizeof(double)*ctx->allocatedN);
+        ctx->sz = realloc(ctx->sz, sizeof(double)*ctx->allocatedN);
+        ctx->sm = realloc(ctx->sm, sizeof(double)*ctx->allocatedN);
+        ctx->spt = realloc(ctx->spt, sizeof(int)*ctx->allocatedN);
+    }
+    ctx->sx[ctx->N] = node->mx;
+    ctx->sy[ctx->N] = node->my;
+    ctx->sz[ctx->N] = node->mz;
+    ctx->sm[ctx->N] = node->m;
+    ctx->spt[ctx->N] = node->pt<0 ? -1 : node->pt;
+    ctx->N++;
+}
+
+/**
+  * @brief Adds the indices of all particles in a cell to the current group.
+  */
+static void reb_tree_group_collect(struct reb_tree_group_context* const ctx, const struct reb_treecell* const node){
+    if (node->pt<0){
+        for (int o=0; o<8; o++){
+            if (node->oct[o]!=NULL){
+                reb_tree_group_collect(ctx, node->oct[o]);
+            }
+        }
+    }else{
+        if (ctx->N_group>=ctx->allocatedN_group){
+            ctx->allocatedN_group = ctx->allocatedN_group ? ctx->allocatedN_group*2 : 64;
+            ctx->pt = realloc(ctx->pt, sizeof(int)*ctx->allocatedN_group);
+            ctx->gx = realloc(ctx->gx, sizeof(double)*ctx->allocatedN_group);
+            ctx->gy = realloc(ctx->gy, sizeof(double)*ctx->allocatedN_group);
+            ctx->gz = realloc(ctx->gz, sizeof(double)*ctx->allocatedN_group);
+            ctx->gax = realloc(ctx->gax, sizeof(double)*ctx->allocatedN_group);
+            ctx->gay = realloc(ctx->gay, sizeof(double)*ctx->allocatedN_group);
+            ctx->gaz = realloc(ctx->gaz, sizeof(double)*ctx->allocatedN_group);
+        }
+        ctx->pt[ctx->N_group++] = node->pt;
+    }
+}
+
+/**
+  * @brief Squared distance between the centre of mass of a cell and the bounding box of the group.
+  */
+static inline double reb_tree_group_distance2(const struct reb_tree_group_context* const ctx, const struct reb_treecell* const node){
+    const double dx = MAX(MAX(ctx->lo[0]-node->mx, node->mx-ctx->hi[0]), 0.);
+    const double dy = MAX(MAX(ctx->lo[1]-node->my, node->my-ctx->hi[1]), 0.);
+    const double dz = MAX(MAX(ctx->lo[2]-node->mz, node->mz-ctx->hi[2]), 0.);
+    return dx*dx + dy*dy + dz*dz;
+}
+
+/**
+  * @brief Builds the interaction list of the current group.
+  * @details A cell is opened if w^2 > opening_angle2*d^2 where d is the distance between the 
+  * centre of mass of the cell and the bounding box of the group. Each particle in the group
+  * is at least a distance d away, so every cell which is not opened would also not have 
+  * been opened in the walk for a single particle.
+  */
+static void reb_tree_group_walk(struct reb_tree_group_context* const ctx, const struct reb_treecell* const node){
+    if (node==ctx->group && ctx->central){
+        return; // Interactions within the group are calculated directly
+    }
+    if (node->pt<0){
+        const double d2 = reb_tree_group_distance2(ctx, node);
+        // Cells containing the group are always opened so that the group does not interact with itself
+        const struct reb_treecell* const group = ctx->group;
+        const int contains_group = ctx->central && node->w>group->w
+            && fabs(group->x-node->x)<0.5*node->w && fabs(group->y-node->y)<0.5*node->w && fabs(group->z-node->z)<0.5*node->w;
+        if (contains_group || node->w*node->w > ctx->opening_angle2*d2){
+            ctx->counts.cells_opened++;
+            for (int o=0; o<8; o++){
+                if (node->oct[o]!=NULL){
+                    reb_tree_group_walk(ctx, node->oct[o]);
+                }
+            }
+            return;
+        }
+    }
+    reb_tree_group_push(ctx, node);
+    if (ctx->record){
+        reb_tree_list_add(ctx->record, node);
+    }
+}
+
+/**
+  * @brief Checks if the kept interaction list of the current group can be used for the ghost box g.
+  * @details Cells which have been freed since the list was built have a different id. The
+  * nodes in the list do not overlap, so they contain every particle outside of the group exactly 
+  * once if their numbers of particles add up to the number of particles outside of the group. 
+  * Every cell in the list also needs to pass the opening criterion for the current positions.
+  */
+static int reb_tree_group_list_valid(const struct reb_tree_group_context* const ctx, const struct reb_tree_list* const list, const int g){
+    const double opening_angle2 = ctx->r->opening_angle2;
+    int N_nodes = 0;
+    for (int k=list->start[g]; k<list->start[g+1]; k++){
+        const struct reb_tree_list_entry e = list->entries[k];
+        const struct reb_treecell* const node = e.node;
+        if (node->id!=e.id || (node->pt>=0)!=e.leaf){
+            return 0;
+        }
+        if (e.leaf){
+            N_nodes++;
+            continue;
+        }
+        N_nodes -= node->pt;
+        if (node->w*node->w > opening_angle2*reb_tree_group_distance2(ctx, node)){
+            return 0;
+        }
+    }
+    return N_nodes==ctx->N_tree-(ctx->central?ctx->N_group:0);
+}
+
+/**
+  * @brief Calculates the accelerations of all particles in one group.
+  */
+static void reb_tree_group_calculate(struct reb_tree_group_context* const ctx, const struct reb_treecell* const group){
+    struct reb_simulation* const r = ctx->r;
+    struct reb_particle* const particles = r->particles;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    ctx->group = group;
+    ctx->N_group = 0;
+    reb_tree_group_collect(ctx, group);
+    const int N_group = ctx->N_group;
+    for (int i=0; i<N_group; i++){
+        const struct reb_particle p = particles[ctx->pt[i]];
+        ctx->gx[i] = p.x;
+        ctx->gy[i] = p.y;
+        ctx->gz[i] = p.z;
+        ctx->gax[i] = 0.;
+        ctx->gay[i] = 0.;
+        ctx->gaz[i] = 0.;
+    }
+    // Interactions within the group
+    ctx->counts.interactions += (uint64_t)N_group*(N_group-1);
+    for (int i=0; i<N_group; i++){
+        const double px = ctx->gx[i];
+        const double py = ctx->gy[i];
+        const double pz = ctx->gz[i];
+        for (int j=0; j<N_group; j++){
+            if (i==j) continue;
+            const double dx = px - ctx->gx[j];
+            const double dy = py - ctx->gy[j];
+            const double dz = pz - ctx->gz[j];
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double prefact = -G/(_r*_r*_r)*particles[ctx->pt[j]].m;
+            ctx->gax[i] += prefact*dx;
+            ctx->gay[i] += prefact*dy;
+            ctx->gaz[i] += prefact*dz;
+        }
+    }
+    double lo[3] = {ctx->gx[0], ctx->gy[0], ctx->gz[0]};
+    double hi[3] = {ctx->gx[0], ctx->gy[0], ctx->gz[0]};
+    for (int i=1; i<N_group; i++){
+        lo[0] = MIN(lo[0], ctx->gx[i]); hi[0] = MAX(hi[0], ctx->gx[i]);
+        lo[1] = MIN(lo[1], ctx->gy[i]); hi[1] = MAX(hi[1], ctx->gy[i]);
+        lo[2] = MIN(lo[2], ctx->gz[i]); hi[2] = MAX(hi[2], ctx->gz[i]);
+    }
+    // Summing over all Ghost Boxes
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    const int prune = gbs.N>1 && r->gravity_ghostbox_tolerance>0.;
+    double m_box = 0.;
+    if (prune){
+        for (int i=0; i<r->root_n; i++){
+            if (r->tree_root[i]!=NULL) m_box += r->tree_root[i]->m;
+        }
+    }
+    // A kept interaction list is rebuilt if it belongs to a different cell, or after tree_list_interval 
+    // steps. Otherwise it is checked for every ghost box and rebuilt from the first invalid one on.
+    struct reb_tree_list* const list = ctx->list;
+    int rebuild = 1;
+    if (list){
+        rebuild = !(list->group==group && list->group_id==group->id && list->N_gb==gbs.N
+                && r->steps_done-list->steps_done < (unsigned long long)r->tree_list_interval);
+        if (rebuild){
+            list->group = group;
+            list->group_id = group->id;
+            list->steps_done = r->steps_done;
+            list->N = 0;
+            if (list->N_gb!=gbs.N){
+                list->N_gb = gbs.N;
+                list->start = realloc(list->start, sizeof(int)*(gbs.N+1));
+            }
+            list->start[0] = 0;
+        }
+    }
+    const int reused = !rebuild;
+    for (int g=0; g<gbs.N; g++){
+        const struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
+        ctx->central = (g==gbs.central);
+        ctx->lo[0] = lo[0] + gb.shiftx; ctx->hi[0] = hi[0] + gb.shiftx;
+        ctx->lo[1] = lo[1] + gb.shifty; ctx->hi[1] = hi[1] + gb.shifty;
+        ctx->lo[2] = lo[2] + gb.shiftz; ctx->hi[2] = hi[2] + gb.shiftz;
+        const int prune_roots = prune && !ctx->central;
+        if (prune_roots && reb_gravity_ghostbox_prune_box(r, m_box, ctx->lo, ctx->hi)) continue;
+        ctx->N = 0;
+        ctx->N_cells = 0;
+        if (!rebuild && !reb_tree_group_list_valid(ctx, list, g)){
+            rebuild = 1;
+            list->N = list->start[g];
+        }
+        if (rebuild){
+            ctx->record = list;
+            for (int i=0; i<r->root_n; i++){
+                if (r->tree_root[i]!=NULL){
+                    if (prune_roots && reb_gravity_ghostbox_prune_cell(r, r->tree_root[i], ctx->lo, ctx->hi)) continue;
+                    reb_tree_group_walk(ctx, r->tree_root[i]);
+                }
+            }
+            ctx->record = NULL;
+            if (list){
+                list->start[g+1] = list->N;
+            }
+        }else{
+            for (int k=list->start[g]; k<list->start[g+1]; k++){
+                reb_tree_group_push(ctx, list->entries[k].node);
+            }
+        }
+        const int N = ctx->N;
+        ctx->counts.interactions += (uint64_t)N_group*(N + ctx->N_cells);
+        const double* const sx = ctx->sx;
+        const double* const sy = ctx->sy;
+        const double* const sz = ctx->sz;
+        const double* const sm = ctx->sm;
+        const int* const spt = ctx->spt;
+        for (int i=0; i<N_group; i++){
+            const int pt = ctx->pt[i];
+            const double px = ctx->gx[i] + gb.shiftx;
+            const double py = ctx->gy[i] + gb.shifty;
+            const double pz = ctx->gz[i] + gb.shiftz;
+            double ax = 0.;
+            double ay = 0.;
+            double az = 0.;
+#pragma omp simd reduction(+:ax,ay,az)
+            for (int j=0; j<N; j++){
+                const double dx = px - sx[j];
+                const double dy = py - sy[j];
+                const double dz = pz - sz[j];
+                const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+                const double m = spt[j]==pt ? 0. : sm[j]; // A particle does not feel its own ghosts
+                const double prefact = -G/(_r*_r*_r)*m;
+                ax += prefact*dx;
+                ay += prefact*dy;
+                az += prefact*dz;
+            }
+            double a[3] = {ax, ay, az};
+            for (int j=0; j<ctx->N_cells; j++){
+                const struct reb_treecell* const node = ctx->cells[j];
+                reb_tree_cell_acceleration(node, r->tree_order, G, softening2, px - node->mx, py - node->my, pz - node->mz, a);
+            }
+            ctx->gax[i] += a[0];
+            ctx->gay[i] += a[1];
+            ctx->gaz[i] += a[2];
+        }
+    }
+    if (reused && !rebuild){
+        ctx->lists_reused++;
+    }
+    for (int i=0; i<N_group; i++){
+        particles[ctx->pt[i]].ax = ctx->gax[i];
+        particles[ctx->pt[i]].ay = ctx->gay[i];
+        particles[ctx->pt[i]].az = ctx->gaz[i];
+    }
+}
+
+/**
+  * @brief Adds all cells with at most group_size particles to the list of groups.
+  */
+static void reb_tree_group_find(const struct reb_treecell* const node, const int group_size, const struct reb_treecell*** groups, int* N_groups, int* allocatedN_groups){
+    if (node->pt<0 && -node->pt>group_size){
+        for (int o=0; o<8; o++){
+            if (node->oct[o]!=NULL){
+                reb_tree_group_find(node->oct[o], group_size, groups, N_groups, allocatedN_groups);
+            }
+        }
+        return;
+    }
+    if (*N_groups>=*allocatedN_groups){
+        *allocatedN_groups = *allocatedN_groups ? *allocatedN_groups*2 : 1024;
+        *groups = realloc(*groups, sizeof(struct reb_treecell*)*(*allocatedN_groups));
+    }
+    (*groups)[(*N_groups)++] = node;
+}
+
+REB_TARGET_CLONES static void reb_calculate_acceleration_tree_groups(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    for (int i=0; i<N; i++){
+        particles[i].ax = 0; 
+        particles[i].ay = 0; 
+        particles[i].az = 0; 
+    }
+    if (r->tree_root==NULL){
+        return;
+    }
+    const struct reb_treecell** groups = NULL;
+    int N_groups = 0;
+    int allocatedN_groups = 0;
+    for (int i=0; i<r->root_n; i++){
+        if (r->tree_root[i]!=NULL){
+            reb_tree_group_find(r->tree_root[i], r->tree_group_size, &groups, &N_groups, &allocatedN_groups);
+        }
+    }
+    // Interaction lists are only kept if no ghost boxes are skipped, because the skipped 
+    // ghost boxes change as the particles move.
+    struct reb_tree_lists* lists = NULL;
+    const int prune = reb_gravity_ghostboxes(r).N>1 && r->gravity_ghostbox_tolerance>0.;
+    if (r->tree_list_interval>0 && !prune){
+        lists = reb_tree_lists_update(r, groups, N_groups);
+    }else{
+        reb_tree_lists_free(r);
+    }
+    int N_tree = 0;
+    for (int i=0; i<r->root_n; i++){
+        const struct reb_treecell* const root = r->tree_root[i];
+        if (root!=NULL){
+            N_tree += root->pt<0 ? -root->pt : 1;
+        }
+    }
+    // Kept lists are built with a stricter opening criterion, so that they remain valid while particles move.
+    const double opening_angle2 = lists ? r->opening_angle2/(1.+r->tree_list_margin) : r->opening_angle2;
+#pragma omp parallel
+    {
+        TRACE_BEGIN(r, REB_TRACE_PHASE_GRAVITY_WALK)
+        struct reb_tree_group_context ctx = {.r = r, .opening_angle2 = opening_angle2, .N_tree = N_tree};
+#pragma omp for schedule(guided)
+        for (int g=0; g<N_groups; g++){
+            ctx.list = lists ? &lists->lists[g] : NULL;
+            reb_tree_group_calculate(&ctx, groups[g]);
+        }
+        TRACE_END(r, REB_TRACE_PHASE_GRAVITY_WALK)
+#pragma omp atomic
+        r->counters.gravity_interactions += ctx.counts.interactions;
+#pragma omp atomic
+        r->counters.tree_cells_opened += ctx.counts.cells_opened;
+#pragma omp atomic
+        r->counters.tree_lists_reused += ctx.lists_reused;
+        free(ctx.pt);
+        free(ctx.gx);
+        free(ctx.gy);
+        free(ctx.gz);
+        free(ctx.gax);
+        free(ctx.gay);
+        free(ctx.gaz);
+        free(ctx.sx);
+        free(ctx.sy);
+        free(ctx.sz);
+        free(ctx.sm);
+        free(ctx.spt);
+        free(ctx.cells);
+    }
+    free(groups);
+}
+#endif // MPI
+
+// Helper routines for REB_GRAVITY_FMM
+
+/**
+  * @brief Local (Taylor) expansion of the acceleration field around the center of a cell.
+  */
+struct reb_fmm_local {
+    double a[3];    ///< Acceleration at the center of the cell
+    double j[6];    ///< First derivatives of the acceleration (xx, xy, xz, yy, yz, zz)
+    double h[10];   ///< Second derivatives of the acceleration (xxx, xxy, xxz, xyy, xyz, xzz, yyy, yyz, yzz, zzz)
+};
+
+/**
+  * @brief Source cell in an interaction list, together with the ghostbox it is seen in.
+  */
+struct reb_fmm_source {
+    const struct reb_treecell* cell;
+    double shiftx;
+    double shifty;
+    double shiftz;
+};
+
+/**
+  * @brief State shared by all levels of the FMM tree walk.
+  * @details The interaction lists of all levels are stored in one stack. 
+  * Each level appends its list and removes it again before returning.
+  */
+struct reb_fmm_context {
+    struct reb_particle* particles;
+    double G;
+    double softening2;
+    double opening_angle2;
+    unsigned int order;
+    struct reb_fmm_source* sources;
+    int N;
+    int allocatedN;
+    struct reb_gravity_walk_counts counts;
+};
+
+static void reb_fmm_push(struct reb_fmm_context* const ctx, const struct reb_treecell* const cell, const double shiftx, const double shifty, const double shiftz){
+    if (ctx->N>=ctx->allocatedN){
+        ctx->allocatedN = ctx->allocatedN ? ctx->allocatedN*2 : 1024;
+        ctx->sources = realloc(ctx->sources, sizeof(struct reb_fmm_source)*ctx->allocatedN);
+    }
+    ctx->sources[ctx->N] = (struct reb_fmm_source){.cell = cell, .shiftx = shiftx, .shifty = shifty, .shiftz = shiftz};
+    ctx->N++;
+}
+
+static void reb_fmm_push_children(struct reb_fmm_context* const ctx, const struct reb_fmm_source s){
+    for (int o=0; o<8; o++){
+        if (s.cell->oct[o]!=NULL){
+            reb_fmm_push(ctx, s.cell->oct[o], s.shiftx, s.shifty, s.shiftz);
+        }
+    }
+}
+
+/**
+  * @brief Adds the field of a point mass to a local expansion.
+  * @param L Local expansion to be incremented.
+  * @param order Order of the expansion.
+  * @param Gm Gravitational constant times mass of the source.
+  * @param dx Position of the expansion center relative to the source.
+  * @param softening2 Square of the gravitational softening length.
+  */
+static void reb_fmm_add_monopole(struct reb_fmm_local* const L, const unsigned int order, const double Gm, const double dx, const double dy, const double dz, const double softening2){
+    const double s2 = dx*dx + dy*dy + dz*dz + softening2;
+    const double inv3 = Gm/(s2*sqrt(s2));
+    L->a[0] -= inv3*dx;
+    L->a[1] -= inv3*dy;
+    L->a[2] -= inv3*dz;
+    if (order<1) return;
+    const double inv5 = 3.*inv3/s2;
+    L->j[0] -= inv3 - inv5*dx*dx;
+    L->j[1] -=      - inv5*dx*dy;
+    L->j[2] -=      - inv5*dx*dz;
+    L->j[3] -= inv3 - inv5*dy*dy;
+    L->j[4] -=      - inv5*dy*dz;
+    L->j[5] -= inv3 - inv5*dz*dz;
+    if (order<2) return;
+    const double inv7 = 5.*inv5/s2;
+    L->h[0] -= -3.*inv5*dx + inv7*dx*dx*dx;
+    L->h[1] -=    -inv5*dy + inv7*dx*dx*dy;
+    L->h[2] -=    -inv5*dz + inv7*dx*dx*dz;
+    L->h[3] -=    -inv5*dx + inv7*dx*dy*dy;
+    L->h[4] -=               inv7*dx*dy*dz;
+    L->h[5] -=    -inv5*dx + inv7*dx*dz*dz;
+    L->h[6] -= -3.*inv5*dy + inv7*dy*dy*dy;
+    L->h[7] -=    -inv5*dz + inv7*dy*dy*dz;
+    L->h[8] -=    -inv5*dy + inv7*dy*dz*dz;
+    L->h[9] -= -3.*inv5*dz + inv7*dz*dz*dz;
+}
+
+/**
+  * @brief Evaluates a local expansion at an offset (dx, dy, dz) from its center.
+  */
+static struct reb_vec3d reb_fmm_evaluate(const struct reb_fmm_local* const L, const double dx, const double dy, const double dz){
+    const double* const j = L->j;
+    const double* const h = L->h;
+    const double xx = 0.5*dx*dx;
+    const double yy = 0.5*dy*dy;
+    const double zz = 0.5*dz*dz;
+    const double xy = dx*dy;
+    const double xz = dx*dz;
+    const double yz = dy*dz;
+    struct reb_vec3d a;
+    a.x = L->a[0] + j[0]*dx + j[1]*dy + j[2]*dz + h[0]*xx + h[3]*yy + h[5]*zz + h[1]*xy + h[2]*xz + h[4]*yz;
+    a.y = L->a[1] + j[1]*dx + j[3]*dy + j[4]*dz + h[1]*xx + h[6]*yy + h[8]*zz + h[3]*xy + h[4]*xz + h[7]*yz;
+    a.z = L->a[2] + j[2]*dx + j[4]*dy + j[5]*dz + h[2]*xx + h[7]*yy + h[9]*zz + h[4]*xy + h[5]*xz + h[8]*yz;
+    return a;
+}
+
+/**
+  * @brief Moves the center of a local expansion by (dx, dy, dz).
+  */
+static struct reb_fmm_local reb_fmm_shift(const struct reb_fmm_local* const L, const double dx, const double dy, const double dz){
+    const double* const h = L->h;
+    struct reb_fmm_local Ls = *L;
+    const struct reb_vec3d a = reb_fmm_evaluate(L, dx, dy, dz);
+    Ls.a[0] = a.x;
+    Ls.a[1] = a.y;
+    Ls.a[2] = a.z;
+    Ls.j[0] += h[0]*dx + h[1]*dy + h[2]*dz;
+    Ls.j[1] += h[1]*dx + h[3]*dy + h[4]*dz;
+    Ls.j[2] += h[2]*dx + h[4]*dy + h[5]*dz;
+    Ls.j[3] += h[3]*dx + h[6]*dy + h[7]*dz;
+    Ls.j[4] += h[4]*dx + h[7]*dy + h[8]*dz;
+    Ls.j[5] += h[5]*dx + h[8]*dy + h[9]*dz;
+    return Ls;
+}
+
+/**
+  * @brief Calculates the acceleration of the particle in a leaf cell.
+  * @details The local expansion accumulated on the way down is evaluated at the 
+  * position of the particle. The remaining sources in the interaction list are added 
+  * using particle-cell interactions (same criterion as REB_GRAVITY_TREE) or by direct 
+  * summation.
+  */
+static void reb_fmm_leaf(struct reb_fmm_context* const ctx, const struct reb_treecell* const A, const struct reb_fmm_local* const L, const int list_start){
+    const double G = ctx->G;
+    const double softening2 = ctx->softening2;
+    const int pt = A->pt;
+    struct reb_particle* const p = &(ctx->particles[pt]);
+    const struct reb_vec3d a = reb_fmm_evaluate(L, p->x - A->x, p->y - A->y, p->z - A->z);
+    double ax = a.x;
+    double ay = a.y;
+    double az = a.z;
+    for (int k=list_start; k<ctx->N; k++){
+        const struct reb_fmm_source s = ctx->sources[k];
+        const struct reb_treecell* const cell = s.cell;
+        if (cell->pt==pt) continue; // Self-interaction
+        const double dx = p->x - (cell->mx + s.shiftx);
+        const double dy = p->y - (cell->my + s.shifty);
+        const double dz = p->z - (cell->mz + s.shiftz);
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        if (cell->pt<0 && cell->w*cell->w > ctx->opening_angle2*r2){
+            ctx->counts.cells_opened++;
+            reb_fmm_push_children(ctx, s);
+            continue;
+        }
+        ctx->counts.interactions++;
+        const double _r = sqrt(r2 + softening2);
+        const double prefact = -G/(_r*_r*_r)*cell->m;
+        ax += prefact*dx;
+        ay += prefact*dy;
+        az += prefact*dz;
+    }
+    p->ax += ax;
+    p->ay += ay;
+    p->az += az;
+}
+
+/**
+  * @brief Walks down the tree of target cells.
+  * @details Sources in the interaction list [list_start, list_end) which are well 
+  * separated from the target cell A are added to the local expansion of A (cell-cell 
+  * interaction). Sources which are too close are either opened up (if they are larger 
+  * than A) or passed on to the daughter cells of A.
+  */
+static void reb_fmm_walk(struct reb_fmm_context* const ctx, const struct reb_treecell* const A, struct reb_fmm_local L, const int list_start, const int list_end){
+    const int new_start = ctx->N;
+    for (int k=list_start; k<list_end; k++){
+        const struct reb_fmm_source s = ctx->sources[k];
+        const struct reb_treecell* const cell = s.cell;
+        const double dx = A->x - (cell->mx + s.shiftx);
+        const double dy = A->y - (cell->my + s.shifty);
+        const double dz = A->z - (cell->mz + s.shiftz);
+        const double r2 = dx*dx + dy*dy + dz*dz;
+        const double w = A->w + cell->w;
+        if (w*w < ctx->opening_angle2*r2){
+            ctx->counts.interactions++;
+            reb_fmm_add_monopole(&L, ctx->order, ctx->G*cell->m, dx, dy, dz, ctx->softening2);
+        }else if (cell->pt>=0 || (A->pt<0 && A->w > cell->w)){
+            reb_fmm_push(ctx, cell, s.shiftx, s.shifty, s.shiftz);
+        }else{
+            ctx->counts.cells_opened++;
+            reb_fmm_push_children(ctx, s);
+        }
+    }
+    if (A->pt>=0){
+        reb_fmm_leaf(ctx, A, &L, new_start);
+    }else{
+        const int new_end = ctx->N;
+        for (int o=0; o<8; o++){
+            const struct reb_treecell* const d = A->oct[o];
+            if (d!=NULL){
+                reb_fmm_walk(ctx, d, reb_fmm_shift(&L, d->x - A->x, d->y - A->y, d->z - A->z), new_start, new_end);
+            }
+        }
+    }
+    ctx->N = new_start;
+}
+
+static void reb_calculate_acceleration_fmm(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    for (int i=0; i<N; i++){
+        particles[i].ax = 0; 
+        particles[i].ay = 0; 
+        particles[i].az = 0; 
+    }
+    if (r->tree_root==NULL){
+        return;
+    }
+    struct reb_fmm_context ctx = {
+        .particles = particles,
+        .G = r->G,
+        .softening2 = r->softening*r->softening,
+        .opening_angle2 = r->opening_angle2,
+        .order = MIN(r->fmm_order, 2),
+    };
+    // The initial interaction list contains all root cells in all ghostboxes.
+    const struct reb_gravity_ghostboxes gbs = reb_gravity_ghostboxes(r);
+    for (int g=0; g<gbs.N; g++){
+        struct reb_ghostbox gb = reb_gravity_ghostbox(&gbs, g);
+        for (int i=0; i<r->root_n; i++){
+            if (r->tree_root[i]!=NULL){
+                reb_fmm_push(&ctx, r->tree_root[i], gb.shiftx, gb.shifty, gb.shiftz);
+            }
+        }
+    }
+    const int list_end = ctx.N;
+    for (int i=0; i<r->root_n; i++){
+        if (reb_sigint) break;
+        if (r->tree_root[i]!=NULL){
+            struct reb_fmm_local L = {0};
+            reb_fmm_walk(&ctx, r->tree_root[i], L, 0, list_end);
+        }
+    }
+    r->counters.gravity_interactions += ctx.counts.interactions;
+    r->counters.tree_cells_opened += ctx.counts.cells_opened;
+    free(ctx.sources);
+}
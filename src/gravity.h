@@ -33,6 +33,43 @@ struct reb_simulation;
   */
 void reb_calculate_acceleration(struct reb_simulation* r);
 
+#if defined(OPENMP) && !defined(GPU) && !defined(SIMD)
+/**
+  * Returns 1 if reb_calculate_acceleration_team() supports the gravity settings of the simulation
+  * (REB_GRAVITY_NONE, or REB_GRAVITY_BASIC without variational particles, interaction groups and
+  * test particles of type 0).
+  */
+int reb_calculate_acceleration_team_supported(const struct reb_simulation* const r);
+
+/**
+  * Same as reb_calculate_acceleration() but needs to be called by all threads of an OpenMP 
+  * parallel region. The work is shared between the threads of the enclosing team (orphaned 
+  * worksharing), so no new threads are forked. Ends with a barrier.
+  */
+void reb_calculate_acceleration_team(struct reb_simulation* r);
+#endif // OPENMP, GPU, SIMD
+
+/**
+  * Adds the acceleration due to the cells in the root boxes roots[0] to roots[N_roots-1] 
+  * to all particles (REB_GRAVITY_TREE only). Used with MPI to add the contribution of 
+  * remote essential trees once they have arrived.
+  */
+void reb_calculate_acceleration_tree_from_roots(struct reb_simulation* r, const int* const roots, const int N_roots);
+
+/**
+  * Returns the potential energy of all particles calculated from the tree (REB_GRAVITY_TREE only).
+  * Cells are opened with the same criterion and expanded to the same order as in the force 
+  * calculation. Only the central box is considered and gravitational softening is included.
+  * The mass moments of the tree are updated first.
+  */
+double reb_calculate_potential_energy_tree(struct reb_simulation* r);
+
+/**
+  * Frees the interaction lists of groups which are kept between force calculations (see tree_list_interval).
+  * Called whenever the tree is deleted.
+  */
+void reb_tree_lists_free(struct reb_simulation* r);
+
 /**
   * The function calculates the acceleration for the variational equations.
   */
@@ -0,0 +1,333 @@
+/**
+ * @file 	gravity_fft.c
+ * @brief 	Particle-mesh gravity for periodic and shearing sheet boxes.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>, Geoffroy Lesur <geoffroy.lesur@obs.ujf-grenoble.fr>
+ *
+ * @details 	This module solves the Poisson equation for a razor thin
+ * sheet of particles in Fourier space. The surface density is assigned
+ * to a two dimensional grid with a triangular shaped cloud (TSC) scheme,
+ * transformed with FFTW, and the in-plane forces are interpolated back to
+ * the particles with the same scheme. Only the x and y components of the
+ * acceleration are calculated. For shearing sheet boundary conditions the
+ * grid is remapped in Fourier space and time dependent wave vectors are used.
+ * The number of grid cells is set with gravity_fft_nx and gravity_fft_ny.
+ * This module requires FFTW (compile with FFTW=1).
+ *
+ * @section LICENSE
+ * Copyright (c) 2011 Hanno Rein, Shangfei Liu, Geoffroy Lesur
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "rebound.h"
+#include "gravity_fft.h"
+#include "boundary.h"
+#ifdef FFTW
+#include <fftw3.h>
+
+/**
+ * @brief Grids, wave vectors and FFT plans of the particle-mesh solver.
+ * @details The real grids are stored in the padded in-place layout used by
+ * FFTW, i.e. every row has ny+2 entries.
+ */
+struct reb_gravity_fft {
+    int nx;                 ///< Number of grid cells in the x direction
+    int ny;                 ///< Number of grid cells in the y direction
+    int ny_complex;         ///< Number of complex entries per row (ny/2+1)
+    struct reb_vec3d boxsize;///< Boxsize used to initialize the wave vectors
+    int shear;              ///< 1 if shearing sheet boundary conditions are used
+    double dx;              ///< Grid spacing in the x direction
+    double dy;              ///< Grid spacing in the y direction
+    double* kx;             ///< Wave vector in the x direction
+    double* ky;             ///< Wave vector in the y direction
+    double* kxt;            ///< Time dependent wave vector (shearing sheet only)
+    double* k;              ///< Magnitude of the wave vector
+    double* density;        ///< Surface density (real and complex, in place)
+    double* fx;             ///< Force in the x direction (real and complex, in place)
+    double* fy;             ///< Force in the y direction (real and complex, in place)
+    double* w1d;            ///< Temporary 1D complex array for remapping (shearing sheet only)
+    fftw_plan r2cfft;       ///< FFT plan real to complex
+    fftw_plan c2rfft;       ///< FFT plan complex to real
+    fftw_plan for1dfft;     ///< FFT plan for remapping (1D, shearing sheet only)
+    fftw_plan bac1dfft;     ///< FFT plan for remapping (1D, shearing sheet only)
+};
+
+void reb_gravity_fft_free(struct reb_simulation* const r){
+    struct reb_gravity_fft* const g = r->gravity_fft;
+    if (g==NULL){
+        return;
+    }
+    fftw_destroy_plan(g->r2cfft);
+    fftw_destroy_plan(g->c2rfft);
+    if (g->shear){
+        fftw_destroy_plan(g->for1dfft);
+        fftw_destroy_plan(g->bac1dfft);
+        fftw_free(g->kxt);
+        fftw_free(g->w1d);
+    }
+    fftw_free(g->kx);
+    fftw_free(g->ky);
+    fftw_free(g->k);
+    fftw_free(g->density);
+    fftw_free(g->fx);
+    fftw_free(g->fy);
+    free(g);
+    r->gravity_fft = NULL;
+}
+
+static struct reb_gravity_fft* reb_gravity_fft_init(struct reb_simulation* const r){
+    struct reb_gravity_fft* g = calloc(1, sizeof(struct reb_gravity_fft));
+    const int nx = r->gravity_fft_nx;
+    const int ny = r->gravity_fft_ny;
+    g->nx = nx;
+    g->ny = ny;
+    g->ny_complex = ny/2+1;
+    g->boxsize = r->boxsize;
+    g->shear = r->boundary==REB_BOUNDARY_SHEAR;
+    g->dx = r->boxsize.x/nx;
+    g->dy = r->boxsize.y/ny;
+
+    const int ncomplex = nx*g->ny_complex;
+    g->kx = fftw_malloc(sizeof(double)*ncomplex);
+    g->ky = fftw_malloc(sizeof(double)*ncomplex);
+    g->k  = fftw_malloc(sizeof(double)*ncomplex);
+    if (g->shear){
+        g->kxt = fftw_malloc(sizeof(double)*ncomplex);
+        g->w1d = fftw_malloc(sizeof(double)*ny*2);
+    }else{
+        g->kxt = g->kx;     // No time dependent wave vectors.
+    }
+    g->density = fftw_malloc(sizeof(double)*ncomplex*2);
+    g->fx = fftw_malloc(sizeof(double)*ncomplex*2);
+    g->fy = fftw_malloc(sizeof(double)*ncomplex*2);
+
+    for (int i=0; i<nx; i++){
+        for (int j=0; j<g->ny_complex; j++){
+            const int idx = i*g->ny_complex + j;
+            g->kx[idx] = 2.*M_PI/r->boxsize.x*(fmod((double)i + nx/2., (double)nx) - nx/2.);
+            g->ky[idx] = 2.*M_PI/r->boxsize.y*(double)j;
+            g->k[idx] = sqrt(g->kx[idx]*g->kx[idx] + g->ky[idx]*g->ky[idx]);
+            // We use 1/k. The k=0 mode is removed by the normalization.
+            if (g->k[idx]==0.) g->k[idx] = 1.;
+        }
+    }
+
+    // In place transforms. The plans are created before the grids are used
+    // because FFTW_MEASURE overwrites the arrays.
+    g->r2cfft = fftw_plan_dft_r2c_2d(nx, ny, g->density, (fftw_complex*)g->density, FFTW_MEASURE);
+    g->c2rfft = fftw_plan_dft_c2r_2d(nx, ny, (fftw_complex*)g->fx, g->fx, FFTW_MEASURE);
+    if (g->shear){
+        g->for1dfft = fftw_plan_dft_1d(ny, (fftw_complex*)g->w1d, (fftw_complex*)g->w1d, FFTW_FORWARD, FFTW_MEASURE);
+        g->bac1dfft = fftw_plan_dft_1d(ny, (fftw_complex*)g->w1d, (fftw_complex*)g->w1d, FFTW_BACKWARD, FFTW_MEASURE);
+    }
+    return g;
+}
+
+/**
+ * @brief Assignment function of the TSC scheme.
+ * @details See Hockney and Eastwood (1981), Computer Simulation Using Particles.
+ */
+static double reb_gravity_fft_W(const double x){
+    const double ax = fabs(x);
+    if (ax<=0.5) return 0.75 - x*x;
+    if (ax<=1.5) return 0.5*(1.5-ax)*(1.5-ax);
+    return 0;
+}
+
+/**
+ * @brief Grid indices and weights of the 3x3 TSC stencil around a particle.
+ * @details Cells which are outside the grid in the x direction are mapped back
+ * periodically. With shearing sheet boundary conditions the y index of these cells
+ * is shifted by the current shear offset. This mapping is only approximate; one
+ * should use an exact (Fourier) interpolation scheme here.
+ */
+static void reb_gravity_fft_stencil(const struct reb_gravity_fft* const g, const double px, const double py, const int ishift, int index[9], double weight[9]){
+    const int nx = g->nx;
+    const int ny = g->ny;
+    const int x = (int)floor((px/g->boxsize.x + 0.5)*nx);
+    const int y = (int)floor((py/g->boxsize.y + 0.5)*ny);
+    int n = 0;
+    for (int ix=x-1; ix<=x+1; ix++){
+        int xt = ix;
+        int yshift = 0;
+        if (xt>=nx){
+            xt -= nx;
+            yshift = ishift;
+        }
+        if (xt<0){
+            xt += nx;
+            yshift = -ishift;
+        }
+        xt = (xt%nx + nx)%nx;   // Only needed for particles outside the box
+        const double tx = ((double)ix+0.5)*g->dx - 0.5*g->boxsize.x - px;
+        const double wx = reb_gravity_fft_W(tx/g->dx);
+        for (int iy=y-1; iy<=y+1; iy++){
+            const int yt = ((iy+yshift)%ny + ny)%ny;
+            const double ty = ((double)iy+0.5)*g->dy - 0.5*g->boxsize.y - py;
+            index[n] = (ny+2)*xt + yt;
+            weight[n] = wx*reb_gravity_fft_W(ty/g->dy);
+            n++;
+        }
+    }
+}
+
+/**
+ * @brief Shifts every row of a real grid in the y direction by a fraction of the shear offset.
+ * @param direction 1 to remap from the sheared to the periodic frame, -1 for the inverse.
+ */
+static void reb_gravity_fft_remap(struct reb_gravity_fft* const g, double* const wi, const double shift_shear, const double direction){
+    const int nx = g->nx;
+    const int ny = g->ny;
+    double* const w1d = g->w1d;
+    for (int i=0; i<nx; i++){
+        for (int j=0; j<ny; j++){
+            w1d[2*j] = wi[j + (ny+2)*i];
+            w1d[2*j+1] = 0.;
+        }
+        fftw_execute(g->for1dfft);
+        for (int j=0; j<ny; j++){
+            // phase = ky * (-shift_shear)
+            const double phase = -direction*2.*M_PI/g->boxsize.y*((j + ny/2)%ny - ny/2)*shift_shear*(double)i/(double)nx;
+            const double rew = w1d[2*j];
+            const double imw = w1d[2*j+1];
+            w1d[2*j]   = rew*cos(phase) - imw*sin(phase);
+            w1d[2*j+1] = rew*sin(phase) + imw*cos(phase);
+            // Throw away the Nyquist frequency
+            if (j==ny/2){
+                w1d[2*j]   = 0.;
+                w1d[2*j+1] = 0.;
+            }
+        }
+        fftw_execute(g->bac1dfft);
+        for (int j=0; j<ny; j++){
+            wi[j + (ny+2)*i] = w1d[2*j]/ny;
+        }
+    }
+}
+
+void reb_gravity_fft_calculate_acceleration(struct reb_simulation* const r){
+    if (r->boundary!=REB_BOUNDARY_PERIODIC && r->boundary!=REB_BOUNDARY_SHEAR){
+        reb_exit("REB_GRAVITY_FFT requires periodic or shear boundary conditions.");
+    }
+    if (r->gravity_fft_nx<=0 || r->gravity_fft_ny<=0){
+        reb_exit("REB_GRAVITY_FFT requires gravity_fft_nx and gravity_fft_ny to be positive.");
+    }
+    struct reb_gravity_fft* g = r->gravity_fft;
+    if (g && (g->nx!=r->gravity_fft_nx || g->ny!=r->gravity_fft_ny
+                || g->boxsize.x!=r->boxsize.x || g->boxsize.y!=r->boxsize.y
+                || g->shear!=(r->boundary==REB_BOUNDARY_SHEAR))){
+        reb_gravity_fft_free(r);
+        g = NULL;
+    }
+    if (g==NULL){
+        g = reb_gravity_fft_init(r);
+        r->gravity_fft = g;
+    }
+
+    struct reb_particle* const particles = r->particles;
+    const int nx = g->nx;
+    const int ny = g->ny;
+    const int ncomplex = nx*g->ny_complex;
+    const int N_real = r->N - r->N_var;
+    const int N_active = r->N_active==-1?N_real:r->N_active;
+    // The grid is periodic in the sense that f(x+boxsize.x,y) = f(x,y+shift_shear).
+    const double shift_shear = g->shear?-reb_boundary_get_ghostbox(r,1,0,0).shifty:0.;
+    const int ishift = (int)round(shift_shear/g->boxsize.y*ny);
+
+    // Assign the surface density to the grid
+    double* const density = g->density;
+    for (int i=0; i<nx*(ny+2); i++){
+        density[i] = 0.;
+    }
+    for (int i=0; i<N_active; i++){
+        int index[9];
+        double weight[9];
+        reb_gravity_fft_stencil(g, particles[i].x, particles[i].y, ishift, index, weight);
+        const double q0 = r->G*particles[i].m/(g->dx*g->dy);
+        for (int n=0; n<9; n++){
+            density[index[n]] += q0*weight[n];
+        }
+    }
+
+    if (g->shear){
+        // Remap in Fourier space to deal with shearing sheet boundary conditions.
+        reb_gravity_fft_remap(g, density, shift_shear, 1);
+    }
+
+    fftw_execute_dft_r2c(g->r2cfft, density, (fftw_complex*)density);
+
+    // Inverse Poisson equation
+    double* const fx = g->fx;
+    double* const fy = g->fy;
+    double* const kxt = g->kxt;
+    double* const k = g->k;
+    for (int i=0; i<ncomplex; i++){
+        if (g->shear){
+            // Time dependent wave vectors
+            kxt[i] = g->kx[i] + shift_shear/g->boxsize.x*g->ky[i];
+            k[i] = sqrt(kxt[i]*kxt[i] + g->ky[i]*g->ky[i]);
+            if (k[i]==0.) k[i] = 1.;
+        }
+        const double q0 = -2.*M_PI*density[2*i]  /(k[i]*nx*ny);
+        const double q1 = -2.*M_PI*density[2*i+1]/(k[i]*nx*ny);
+        const double sinkxt = sin(kxt[i]*g->dx);
+        const double sinky  = sin(g->ky[i]*g->dy);
+        fx[2*i]   =  q1*sinkxt/g->dx;  // Real part of Fx
+        fx[2*i+1] = -q0*sinkxt/g->dx;  // Imaginary part of Fx
+        fy[2*i]   =  q1*sinky/g->dy;
+        fy[2*i+1] = -q0*sinky/g->dy;
+    }
+
+    // Transform the force field back
+    fftw_execute_dft_c2r(g->c2rfft, (fftw_complex*)fx, fx);
+    fftw_execute_dft_c2r(g->c2rfft, (fftw_complex*)fy, fy);
+
+    if (g->shear){
+        reb_gravity_fft_remap(g, fx, shift_shear, -1);
+        reb_gravity_fft_remap(g, fy, shift_shear, -1);
+    }
+
+    // Interpolate the forces back to the particles
+#pragma omp parallel for schedule(guided)
+    for (int i=0; i<N_real; i++){
+        int index[9];
+        double weight[9];
+        reb_gravity_fft_stencil(g, particles[i].x, particles[i].y, ishift, index, weight);
+        double ax = 0.;
+        double ay = 0.;
+        for (int n=0; n<9; n++){
+            ax += fx[index[n]]*weight[n];
+            ay += fy[index[n]]*weight[n];
+        }
+        particles[i].ax = ax;
+        particles[i].ay = ay;
+        particles[i].az = 0.;
+    }
+}
+
+#else // FFTW
+
+void reb_gravity_fft_calculate_acceleration(struct reb_simulation* const r){
+    reb_exit("REB_GRAVITY_FFT requires REBOUND to be compiled with FFTW=1.");
+}
+
+void reb_gravity_fft_free(struct reb_simulation* const r){
+}
+
+#endif // FFTW
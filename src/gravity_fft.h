@@ -0,0 +1,44 @@
+/**
+ * @file 	gravity_fft.h
+ * @brief 	Particle-mesh gravity for periodic and shearing sheet boxes.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>, Geoffroy Lesur <geoffroy.lesur@obs.ujf-grenoble.fr>
+ *
+ * @section LICENSE
+ * Copyright (c) 2011 Hanno Rein, Shangfei Liu, Geoffroy Lesur
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _GRAVITY_FFT_H
+#define _GRAVITY_FFT_H
+struct reb_simulation;
+
+/**
+ * @brief Calculates the accelerations of all particles using the 2D FFT Poisson solver (REB_GRAVITY_FFT).
+ * @details The surface density is assigned to a grid with gravity_fft_nx times gravity_fft_ny
+ * cells using a triangular shaped cloud scheme. Only the forces in the x and y direction are
+ * calculated. Requires REBOUND to be compiled with FFTW=1.
+ * @param r REBOUND simulation to consider
+ */
+void reb_gravity_fft_calculate_acceleration(struct reb_simulation* const r);
+
+/**
+ * @brief Frees the grids and FFT plans of the particle-mesh solver.
+ * @param r REBOUND simulation to consider
+ */
+void reb_gravity_fft_free(struct reb_simulation* const r);
+
+#endif // _GRAVITY_FFT_H
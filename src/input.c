@@ -29,16 +29,24 @@
 #include <time.h>
 #include <getopt.h>
 #include <string.h>
+#include <stddef.h>
 #include "particle.h"
 #include "rebound.h"
 #include "collision.h"
 #include "input.h"
 #include "tree.h"
 #include "simulationarchive.h"
+#include "compression.h"
+#include "integrator_ias15.h"
+#include "output.h"
+#include "allocator.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif
 
+#define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
+#define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
+
 static size_t reb_fread(void *restrict ptr, size_t size, size_t nitems, FILE *restrict stream, char **restrict mem_stream){
     if (mem_stream!=NULL){
         // read from memory
@@ -87,20 +95,20 @@ void reb_read_dp7(struct reb_dp7* dp7, const int N3, FILE* inf, char **restrict
 
 #define CASE_MALLOC(typename, valueref) case REB_BINARY_FIELD_TYPE_##typename: \
     {\
-        valueref = malloc(field.size);\
+        valueref = reb_reserve(valueref, field.size);\
         reb_fread(valueref, field.size,1,inf,mem_stream);\
     }\
     break;
 
 #define CASE_MALLOC_DP7(typename, valueref) case REB_BINARY_FIELD_TYPE_##typename: \
     {\
-        valueref.p0 = malloc(field.size/7);\
-        valueref.p1 = malloc(field.size/7);\
-        valueref.p2 = malloc(field.size/7);\
-        valueref.p3 = malloc(field.size/7);\
-        valueref.p4 = malloc(field.size/7);\
-        valueref.p5 = malloc(field.size/7);\
-        valueref.p6 = malloc(field.size/7);\
+        valueref.p0 = reb_reserve(valueref.p0, field.size/7);\
+        valueref.p1 = reb_reserve(valueref.p1, field.size/7);\
+        valueref.p2 = reb_reserve(valueref.p2, field.size/7);\
+        valueref.p3 = reb_reserve(valueref.p3, field.size/7);\
+        valueref.p4 = reb_reserve(valueref.p4, field.size/7);\
+        valueref.p5 = reb_reserve(valueref.p5, field.size/7);\
+        valueref.p6 = reb_reserve(valueref.p6, field.size/7);\
         reb_fread(valueref.p0, field.size/7,1,inf,mem_stream);\
         reb_fread(valueref.p1, field.size/7,1,inf,mem_stream);\
         reb_fread(valueref.p2, field.size/7,1,inf,mem_stream);\
@@ -111,6 +119,46 @@ void reb_read_dp7(struct reb_dp7* dp7, const int N3, FILE* inf, char **restrict
     }\
     break;
     
+// Offsets of the quantities in a PARTICLES_PHYSICAL field.
+const size_t reb_particle_physical_offsets[REB_PARTICLE_PHYSICAL_N] = {
+    offsetof(struct reb_particle, m),
+    offsetof(struct reb_particle, r),
+    offsetof(struct reb_particle, x),
+    offsetof(struct reb_particle, y),
+    offsetof(struct reb_particle, z),
+    offsetof(struct reb_particle, vx),
+    offsetof(struct reb_particle, vy),
+    offsetof(struct reb_particle, vz),
+};
+
+// If a snapshot only contains the physical state of the particles,
+// the integrator state in the file belongs to a different time.
+// It is discarded and recalculated from the particles.
+static void reb_input_discard_integrator_state(struct reb_simulation* r){
+    reb_integrator_ias15_reset(r);
+    reb_free(r->ri_whfast.p_jh);
+    r->ri_whfast.p_jh = NULL;
+    r->ri_whfast.allocated_N = 0;
+    free(r->ri_whfast.kepler_X_correction);
+    r->ri_whfast.kepler_X_correction = NULL;
+    r->ri_whfast.allocated_N_kepler = 0;
+    r->ri_whfast.is_synchronized = 1;
+    r->ri_whfast.recalculate_coordinates_this_timestep = 1;
+    r->ri_saba.is_synchronized = 1;
+    free(r->ri_janus.p_int);
+    r->ri_janus.p_int = NULL;
+    r->ri_janus.allocated_N = 0;
+    r->ri_janus.recalculate_integer_coordinates_this_timestep = 1;
+    free(r->ri_mercurius.dcrit);
+    r->ri_mercurius.dcrit = NULL;
+    r->ri_mercurius.dcrit_allocatedN = 0;
+    r->ri_mercurius.is_synchronized = 1;
+    r->ri_mercurius.recalculate_coordinates_this_timestep = 1;
+    r->ri_mercurius.recalculate_dcrit_this_timestep = 1;
+    r->ri_eos.is_synchronized = 1;
+    r->ri_leapfrog.is_synchronized = 1;
+}
+
 int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_messages* warnings, char **restrict mem_stream){
     struct reb_binary_field field;
     int numread = reb_fread(&field,sizeof(struct reb_binary_field),1,inf,mem_stream);
@@ -135,6 +183,21 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
         CASE(EXACTFINISHTIME,    &r->exact_finish_time);
         CASE(FORCEISVELOCITYDEP, &r->force_is_velocity_dependent);
         CASE(GRAVITYIGNORETERMS, &r->gravity_ignore_terms);
+        CASE(GRAVITYTILESIZE,    &r->gravity_tile_size);
+        CASE(OMPPERSISTENTTEAM,  &r->omp_persistent_team);
+        CASE(GRAVITYGHOSTBOXTOL, &r->gravity_ghostbox_tolerance);
+        CASE(GRAVITYTPFLOAT,     &r->gravity_testparticle_float);
+        CASE(AUTOSELECTINTERVAL, &r->auto_select_interval);
+        CASE(AUTOSELECTOPENINGANGLE2, &r->auto_select_opening_angle2);
+        CASE(FMMORDER,           &r->fmm_order);
+        CASE(GRAVITYFFTNX,       &r->gravity_fft_nx);
+        CASE(GRAVITYFFTNY,       &r->gravity_fft_ny);
+        CASE(TREESORT,           &r->tree_sort);
+        CASE(TREEGROUPSIZE,      &r->tree_group_size);
+        CASE(TREEORDER,          &r->tree_order);
+        CASE(TREELISTINTERVAL,   &r->tree_list_interval);
+        CASE(TREELISTMARGIN,     &r->tree_list_margin);
+        CASE(TREEFUSEDWALK,      &r->tree_fused_walk);
         CASE(OUTPUTTIMINGLAST,   &r->output_timing_last);
         CASE(SAVEMESSAGES,       &r->save_messages);
         CASE(EXITMAXDISTANCE,    &r->exit_max_distance);
@@ -154,6 +217,7 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
         CASE(NGHOSTZ,            &r->nghostz);
         CASE(COLLISIONRESOLVEKEEPSORTED, &r->collision_resolve_keep_sorted);
         CASE(MINIMUMCOLLISIONVELOCITY, &r->minimum_collision_velocity);
+        CASE(COLLISIONVERLETSKIN, &r->collision_verlet_skin);
         CASE(COLLISIONSPLOG,     &r->collisions_plog);
         CASE(MAXRADIUS,          &r->max_radius);
         CASE(COLLISIONSNLOG,     &r->collisions_Nlog);
@@ -188,12 +252,14 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
         CASE(WHFAST_RECALCJAC,   &r->ri_whfast.recalculate_coordinates_this_timestep);
         CASE(WHFAST_SAFEMODE,    &r->ri_whfast.safe_mode);
         CASE(WHFAST_KEEPUNSYNC,  &r->ri_whfast.keep_unsynchronized);
+        CASE(WHFAST_KEPLERWARMSTART, &r->ri_whfast.kepler_warm_start);
         CASE(WHFAST_ISSYNCHRON,  &r->ri_whfast.is_synchronized);
         CASE(WHFAST_TIMESTEPWARN,&r->ri_whfast.timestep_warning);
         CASE(WHFAST_COORDINATES, &r->ri_whfast.coordinates);
         CASE(IAS15_EPSILON,      &r->ri_ias15.epsilon);
         CASE(IAS15_MINDT,        &r->ri_ias15.min_dt);
         CASE(IAS15_EPSILONGLOBAL,&r->ri_ias15.epsilon_global);
+        CASE(IAS15_REUSEGRAVITY, &r->ri_ias15.reuse_gravity);
         CASE(IAS15_ITERATIONSMAX,&r->ri_ias15.iterations_max_exceeded);
         CASE(IAS15_ALLOCATEDN,   &r->ri_ias15.allocatedN);
         CASE(JANUS_SCALEPOS,     &r->ri_janus.scale_pos);
@@ -219,6 +285,8 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
         CASE(EOS_N,              &r->ri_eos.n);
         CASE(EOS_SAFEMODE,       &r->ri_eos.safe_mode);
         CASE(EOS_ISSYNCHRON,     &r->ri_eos.is_synchronized);
+        CASE(LEAPFROG_SAFEMODE,  &r->ri_leapfrog.safe_mode);
+        CASE(LEAPFROG_ISSYNCHRON,&r->ri_leapfrog.is_synchronized);
         CASE(RAND_SEED,          &r->rand_seed);
         CASE(BS_EPSABS,          &r->ri_bs.eps_abs);
         CASE(BS_EPSREL,          &r->ri_bs.eps_rel);
@@ -227,6 +295,13 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
         CASE(BS_FIRSTORLASTSTEP, &r->ri_bs.firstOrLastStep);
         CASE(BS_PREVIOUSREJECTED,&r->ri_bs.previousRejected);
         CASE(BS_TARGETITER,      &r->ri_bs.targetIter);
+        CASE(BS_PARALLELCOLUMNS, &r->ri_bs.parallel_columns);
+        CASE(BS_PARALLELODES, &r->ri_bs.parallel_odes);
+        CASE(HERMITE_ETA,        &r->ri_hermite.eta);
+        CASE(HERMITE_ETASTART,   &r->ri_hermite.eta_start);
+        CASE(HEARTBEATSTEPS,     &r->heartbeat_steps);
+        CASE(SACOMPRESSION,      &r->simulationarchive_compression);
+        CASE(SAPHYSICALONLY,     &r->simulationarchive_physical_only);
         // temporary solution for depreciated SABA k and corrector variables.
         // can be removed in future versions
         case 138: 
@@ -251,13 +326,15 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
         CASE(WHFAST_CORRECTOR2,  &r->ri_whfast.corrector2);
         CASE(WHFAST_KERNEL,      &r->ri_whfast.kernel);
         case REB_BINARY_FIELD_TYPE_PARTICLES:
-            if(r->particles){
-                free(r->particles);
-            }
+            // Existing allocations are reused when a snapshot is loaded 
+            // into an existing simulation.
             r->allocatedN = (int)(field.size/sizeof(struct reb_particle));
             if (field.size){
-                r->particles = malloc(field.size);
+                r->particles = reb_reserve(r->particles, field.size);
                 reb_fread(r->particles, field.size,1,inf,mem_stream);
+            }else{
+                reb_free(r->particles);
+                r->particles = NULL;
             }
             if (r->allocatedN<r->N && warnings){
                 *warnings |= REB_INPUT_BINARY_WARNING_PARTICLES;
@@ -267,30 +344,109 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
                 r->particles[l].ap = NULL;
                 r->particles[l].sim = r;
             }
-            if (r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE){
+            if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE){
                 for (int l=0;l<r->allocatedN;l++){
                     reb_tree_add_particle_to_tree(r, l);
                 }
             }
             break;
-        case REB_BINARY_FIELD_TYPE_WHFAST_PJ:
-            if(r->ri_whfast.p_jh){
-                free(r->ri_whfast.p_jh);
+        case REB_BINARY_FIELD_TYPE_PARTICLES_DIFF:
+            {
+                // Particles which changed since the first snapshot. Each entry
+                // is the particle index followed by the particle.
+                const size_t size_entry = sizeof(uint32_t)+sizeof(struct reb_particle);
+                const size_t N = field.size/size_entry;
+                for (size_t l=0;l<N;l++){
+                    uint32_t i;
+                    struct reb_particle p;
+                    reb_fread(&i, sizeof(uint32_t),1,inf,mem_stream);
+                    reb_fread(&p, sizeof(struct reb_particle),1,inf,mem_stream);
+                    if (i>=(uint32_t)r->allocatedN){
+                        if (warnings){
+                            *warnings |= REB_INPUT_BINARY_WARNING_PARTICLES;
+                        }
+                        continue;
+                    }
+                    p.c = r->particles[i].c;
+                    p.ap = r->particles[i].ap;
+                    p.sim = r;
+                    r->particles[i] = p;
+                }
             }
+            break;
+        case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL:
+        case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT:
+            {
+                const int single = field.type==REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT;
+                const size_t size_real = single?sizeof(float):sizeof(double);
+                const int N = field.size/(REB_PARTICLE_PHYSICAL_N*size_real+sizeof(uint32_t));
+                char* buf = malloc(field.size);
+                reb_fread(buf, field.size,1,inf,mem_stream);
+                reb_free(r->particles);
+                r->particles = reb_calloc(N?N:1, sizeof(struct reb_particle));
+                r->N = N;
+                r->allocatedN = N;
+                const char* p = buf;
+                for (int k=0;k<REB_PARTICLE_PHYSICAL_N;k++){
+                    for (int l=0;l<N;l++){
+                        double v;
+                        if (single){
+                            float f;
+                            memcpy(&f, p, sizeof(float));
+                            v = f;
+                        }else{
+                            memcpy(&v, p, sizeof(double));
+                        }
+                        memcpy((char*)&r->particles[l]+reb_particle_physical_offsets[k], &v, sizeof(double));
+                        p += size_real;
+                    }
+                }
+                for (int l=0;l<N;l++){
+                    memcpy(&r->particles[l].hash, p, sizeof(uint32_t));
+                    p += sizeof(uint32_t);
+                    r->particles[l].sim = r;
+                }
+                free(buf);
+                reb_input_discard_integrator_state(r);
+                if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE){
+                    reb_tree_delete(r);
+                    for (int l=0;l<N;l++){
+                        reb_tree_add_particle_to_tree(r, l);
+                    }
+                }
+                if (warnings){
+                    *warnings |= REB_INPUT_BINARY_WARNING_PHYSICALONLY;
+                }
+            }
+            break;
+        case REB_BINARY_FIELD_TYPE_WHFAST_PJ:
             r->ri_whfast.allocated_N = (int)(field.size/sizeof(struct reb_particle));
             if (field.size){
-                r->ri_whfast.p_jh = malloc(field.size);
+                r->ri_whfast.p_jh = reb_reserve(r->ri_whfast.p_jh, field.size);
                 reb_fread(r->ri_whfast.p_jh, field.size,1,inf,mem_stream);
+            }else{
+                reb_free(r->ri_whfast.p_jh);
+                r->ri_whfast.p_jh = NULL;
             }
             break;
-        case REB_BINARY_FIELD_TYPE_JANUS_PINT:
-            if(r->ri_janus.p_int){
-                free(r->ri_janus.p_int);
+        case REB_BINARY_FIELD_TYPE_WHFAST_KEPLERXCORR:
+            r->ri_whfast.allocated_N_kepler = (unsigned int)(field.size/sizeof(double));
+            if (field.size){
+                r->ri_whfast.kepler_X_correction = realloc(r->ri_whfast.kepler_X_correction, field.size);
+                reb_fread(r->ri_whfast.kepler_X_correction, field.size,1,inf,mem_stream);
+            }else{
+                free(r->ri_whfast.kepler_X_correction);
+                r->ri_whfast.kepler_X_correction = NULL;
             }
+            break;
+        case REB_BINARY_FIELD_TYPE_JANUS_PINT:
             r->ri_janus.allocated_N = (int)(field.size/sizeof(struct reb_particle_int));
             if (field.size){
-                r->ri_janus.p_int = malloc(field.size);
+                r->ri_janus.p_int = realloc(r->ri_janus.p_int, field.size);
                 reb_fread(r->ri_janus.p_int, field.size,1,inf,mem_stream);
+            }else{
+                free(r->ri_janus.p_int);
+                r->ri_janus.p_int = NULL;
             }
             break;
         case REB_BINARY_FIELD_TYPE_VARCONFIG:
@@ -305,14 +461,23 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
                 }
             }
             break;
-        case REB_BINARY_FIELD_TYPE_MERCURIUS_DCRIT:
-            if(r->ri_mercurius.dcrit){
-                free(r->ri_mercurius.dcrit);
+        case REB_BINARY_FIELD_TYPE_INTERACTIONGROUPS:
+            free(r->interaction_groups);
+            r->interaction_groups = NULL;
+            r->N_interaction_groups = (int)(field.size/sizeof(uint64_t));
+            if (field.size){
+                r->interaction_groups = malloc(field.size);
+                reb_fread(r->interaction_groups, field.size,1,inf,mem_stream);
             }
+            break;
+        case REB_BINARY_FIELD_TYPE_MERCURIUS_DCRIT:
             r->ri_mercurius.dcrit_allocatedN = (int)(field.size/sizeof(double));
             if (field.size){
-                r->ri_mercurius.dcrit = malloc(field.size);
+                r->ri_mercurius.dcrit = realloc(r->ri_mercurius.dcrit, field.size);
                 reb_fread(r->ri_mercurius.dcrit, field.size,1,inf,mem_stream);
+            }else{
+                free(r->ri_mercurius.dcrit);
+                r->ri_mercurius.dcrit = NULL;
             }
             break;
         CASE_MALLOC(IAS15_AT,     r->ri_ias15.at);
@@ -330,6 +495,23 @@ int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_m
         CASE_MALLOC_DP7(IAS15_ER, r->ri_ias15.er);
         case REB_BINARY_FIELD_TYPE_END:
             return 0;
+        case REB_BINARY_FIELD_TYPE_SACOMPRESSED:
+            {
+                char* buf = malloc(field.size);
+                reb_fread(buf, field.size,1,inf,mem_stream);
+                char* buf_fields;
+                size_t size_fields;
+                if (reb_decompress(buf, field.size, &buf_fields, &size_fields)==0){
+                    // The compressed fields end with an END field.
+                    char* bufp = buf_fields;
+                    while(reb_input_field(r, NULL, warnings, &bufp)){ }
+                    free(buf_fields);
+                }else if (warnings){
+                    *warnings |= REB_INPUT_BINARY_WARNING_CORRUPTFILE;
+                }
+                free(buf);
+            }
+            break;
         case REB_BINARY_FIELD_TYPE_FUNCTIONPOINTERS:
             {
                 int fpwarn;
@@ -406,6 +588,9 @@ struct reb_simulation* reb_input_process_warnings(struct reb_simulation* r, enum
     if (warnings & REB_INPUT_BINARY_WARNING_CORRUPTFILE){
         reb_warning(r,"The binary file seems to be corrupted. An attempt has been made to read the uncorrupted parts of it.");
     }
+    if (warnings & REB_INPUT_BINARY_WARNING_PHYSICALONLY){
+        reb_warning(r,"The snapshot only contains the physical state of the particles. Integrating it further is not bit-exact.");
+    }
     return r;
 }
 
@@ -428,3 +613,148 @@ struct reb_simulation* reb_create_simulation_from_binary(char* filename){
     return r;
 }
 
+// Returns 1 if buf contains a header and a sequence of fields which ends with an END field.
+static int reb_input_buffer_is_complete(const char* const buf, const size_t size){
+    const char* header = "REBOUND Binary File.";
+    if (buf==NULL || size<64 || strncmp(buf, header, strlen(header))!=0){
+        return 0;
+    }
+    size_t offset = 64;
+    while (offset+sizeof(struct reb_binary_field)<=size){
+        struct reb_binary_field field;
+        memcpy(&field, buf+offset, sizeof(struct reb_binary_field));
+        if (field.type==REB_BINARY_FIELD_TYPE_END){
+            return 1;
+        }
+        offset += sizeof(struct reb_binary_field);
+        if (field.size>size-offset){
+            return 0;
+        }
+        offset += field.size;
+    }
+    return 0;
+}
+
+void reb_create_simulation_from_buffer_with_messages(struct reb_simulation* r, const char* buf, size_t size, enum reb_input_binary_messages* warnings){
+    if (!reb_input_buffer_is_complete(buf, size)){
+        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return;
+    }
+    reb_free_pointers(r);
+    memset(r,0,sizeof(struct reb_simulation));
+    reb_init_simulation(r);
+    r->simulationarchive_filename = NULL;
+    r->simulationarchive_checkpoint_filename = NULL;
+    // Set to old version by default. Will be overwritten if new version was used.
+    r->simulationarchive_version = 0;
+
+    // Fields are decoded directly from the buffer. The buffer is only read.
+    char* mem_stream = (char*)buf;
+    while(reb_input_field(r, NULL, warnings, &mem_stream)){ }
+}
+
+struct reb_simulation* reb_create_simulation_from_buffer(const char* buf, size_t size){
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    struct reb_simulation* r = reb_create_simulation();
+    reb_create_simulation_from_buffer_with_messages(r, buf, size, &warnings);
+    if (warnings & REB_INPUT_BINARY_ERROR_NOFILE){
+        reb_free_simulation(r);
+        r = NULL;
+    }
+    return reb_input_process_warnings(r, warnings);
+}
+
+#ifdef MPI
+int reb_input_binary_mpi(struct reb_simulation* const r, const char* filename){
+    if (r->N){
+        reb_error(r, "Simulation needs to be empty before particles can be read in parallel.");
+        return -1;
+    }
+    MPI_File fh;
+    if (MPI_File_open(MPI_COMM_WORLD, (char*)filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh)!=MPI_SUCCESS){
+        reb_error(r, "Cannot read binary file. Check filename and file contents.");
+        return -1;
+    }
+    MPI_Offset filesize;
+    MPI_File_get_size(fh, &filesize);
+
+    // Every node reads all fields but the particles into a buffer.
+    char* buf = NULL;
+    size_t allocatedsize = 0;
+    size_t size = 0;
+    MPI_Offset offset = 64; // Header
+    MPI_Offset particles_offset = -1;
+    long long N_file = 0;
+    struct reb_binary_field field = {0};
+    while (field.type!=REB_BINARY_FIELD_TYPE_END && offset+(MPI_Offset)sizeof(struct reb_binary_field)<=filesize){
+        MPI_File_read_at(fh, offset, &field, sizeof(struct reb_binary_field), MPI_BYTE, MPI_STATUS_IGNORE);
+        offset += sizeof(struct reb_binary_field);
+        if (field.type==REB_BINARY_FIELD_TYPE_PARTICLES){
+            particles_offset = offset;
+            N_file = field.size/sizeof(struct reb_particle);
+        }else{
+            char* data = malloc(field.size?field.size:1);
+            MPI_File_read_at(fh, offset, data, field.size, MPI_BYTE, MPI_STATUS_IGNORE);
+            reb_output_stream_write(&buf, &allocatedsize, &size, &field, sizeof(struct reb_binary_field));
+            reb_output_stream_write(&buf, &allocatedsize, &size, data, field.size);
+            free(data);
+        }
+        offset += field.size;
+    }
+    if (field.type!=REB_BINARY_FIELD_TYPE_END || particles_offset<0){
+        free(buf);
+        MPI_File_close(&fh);
+        reb_error(r, "Cannot read binary file. Check filename and file contents.");
+        return -1;
+    }
+
+    const int root_n = r->root_n;
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    char* bufp = buf;
+    while(reb_input_field(r, NULL, &warnings, &bufp)){ }
+    free(buf);
+    r->N = 0;
+    if (r->root_n!=root_n){
+        MPI_File_close(&fh);
+        reb_error(r, "Number of root boxes in binary file does not match the simulation.");
+        return -1;
+    }
+    if (warnings & REB_INPUT_BINARY_WARNING_POINTERS){
+        reb_warning(r,"You have to reset function pointers after creating a reb_simulation struct with a binary file.");
+    }
+
+    // Particles which are stored on every node are read by every node.
+    // All other particles are read in equal slabs and then sent to the 
+    // node which owns their root box.
+    long long N_shared = 0;
+    if (r->mpi_direct){
+        N_shared = N_file;
+    }else if (r->N_active!=-1){
+        N_shared = MIN(r->N_active, N_file);
+    }
+    const long long N_rest = N_file - N_shared;
+    const long long start = N_shared + N_rest*r->mpi_id/r->mpi_num;
+    const long long end = N_shared + N_rest*(r->mpi_id+1)/r->mpi_num;
+    MPI_Datatype mpi_particle_bytes;
+    MPI_Type_contiguous(sizeof(struct reb_particle), MPI_BYTE, &mpi_particle_bytes);
+    MPI_Type_commit(&mpi_particle_bytes);
+    struct reb_particle* const particles = malloc(sizeof(struct reb_particle)*MAX(MAX(N_shared, end-start),1));
+    for (int slab=0; slab<2; slab++){
+        const long long first = slab?start:0;
+        const long long N = slab?end-start:N_shared;
+        MPI_File_read_at_all(fh, particles_offset+first*sizeof(struct reb_particle), particles, (int)N, mpi_particle_bytes, MPI_STATUS_IGNORE);
+        for (long long i=0;i<N;i++){
+            particles[i].c = NULL;
+            particles[i].ap = NULL;
+            reb_add(r, particles[i]);
+        }
+    }
+    free(particles);
+    MPI_Type_free(&mpi_particle_bytes);
+    MPI_File_close(&fh);
+    if (!r->mpi_direct){
+        reb_communication_mpi_distribute_particles(r);
+    }
+    return 0;
+}
+#endif // MPI
@@ -23,6 +23,10 @@
  *
  */
 #ifndef _INPUT_H
+#include <stddef.h>
+
+#define REB_PARTICLE_PHYSICAL_N 8 ///< Number of floating point quantities per particle in a PARTICLES_PHYSICAL field. They are followed by the hashes.
+extern const size_t reb_particle_physical_offsets[REB_PARTICLE_PHYSICAL_N]; ///< Offsets of these quantities in struct reb_particle.
 
 void reb_read_dp7(struct reb_dp7* dp7, const int N3, FILE* inf, char **restrict mem_stream); ///< Internal function to read dp7 structs from file.
 int reb_input_field(struct reb_simulation* r, FILE* inf, enum reb_input_binary_messages* warnings, char **restrict mem_stream); ///< Read one field from inf stream into r. 
@@ -36,6 +36,7 @@
 #include "rebound.h"
 #include "gravity.h"
 #include "output.h"
+#include "profiling.h"
 #include "integrator.h"
 #include "integrator_whfast.h"
 #include "integrator_saba.h"
@@ -46,6 +47,9 @@
 #include "integrator_janus.h"
 #include "integrator_eos.h"
 #include "integrator_bs.h"
+#include "integrator_hermite.h"
+#include "forces.h"
+#include "allocator.h"
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) > (b) ? (b) : (a))   ///< Returns the minimum of a and b
 
@@ -78,6 +82,9 @@ void reb_integrator_part1(struct reb_simulation* r){
 		case REB_INTEGRATOR_BS:
 			reb_integrator_bs_part1(r);
 			break;
+		case REB_INTEGRATOR_HERMITE:
+			reb_integrator_hermite_part1(r);
+			break;
 		default:
 			break;
 	}
@@ -112,6 +119,9 @@ void reb_integrator_part2(struct reb_simulation* r){
 		case REB_INTEGRATOR_BS:
 			reb_integrator_bs_part2(r);
 			break;
+		case REB_INTEGRATOR_HERMITE:
+			reb_integrator_hermite_part2(r);
+			break;
         case REB_INTEGRATOR_NONE:
             r->t += r->dt;
             r->dt_last_done = r->dt;
@@ -182,11 +192,30 @@ void reb_integrator_synchronize(struct reb_simulation* r){
 		case REB_INTEGRATOR_BS:
 			reb_integrator_bs_synchronize(r);
 			break;
+		case REB_INTEGRATOR_HERMITE:
+			reb_integrator_hermite_synchronize(r);
+			break;
 		default:
 			break;
 	}
 }
 
+void reb_integrator_synchronize_output(struct reb_simulation* r){
+	if (r->integrator==REB_INTEGRATOR_WHFAST && r->ri_whfast.is_synchronized==0){
+		const unsigned int keep_unsynchronized = r->ri_whfast.keep_unsynchronized;
+		r->ri_whfast.keep_unsynchronized = 1;
+		reb_integrator_whfast_synchronize(r);
+		r->ri_whfast.keep_unsynchronized = keep_unsynchronized;
+	}else if (r->integrator==REB_INTEGRATOR_SABA && r->ri_saba.is_synchronized==0){
+		const unsigned int keep_unsynchronized = r->ri_saba.keep_unsynchronized;
+		r->ri_saba.keep_unsynchronized = 1;
+		reb_integrator_saba_synchronize(r);
+		r->ri_saba.keep_unsynchronized = keep_unsynchronized;
+	}else{
+		reb_integrator_synchronize(r);
+	}
+}
+
 void reb_integrator_init(struct reb_simulation* r){
 	switch(r->integrator){
 		case REB_INTEGRATOR_SEI:
@@ -209,33 +238,49 @@ void reb_integrator_reset(struct reb_simulation* r){
 	reb_integrator_janus_reset(r);
 	reb_integrator_eos_reset(r);
 	reb_integrator_bs_reset(r);
+	reb_integrator_hermite_reset(r);
 }
 
 void reb_update_acceleration(struct reb_simulation* r){
-	// This should probably go elsewhere
-	PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
-	PROFILING_START()
+	PROFILING_START(r)
+	reb_update_acceleration_gravity(r);
+	reb_update_acceleration_forces(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
+}
+
+void reb_update_acceleration_gravity(struct reb_simulation* r){
 	reb_calculate_acceleration(r);
 	if (r->N_var){
 		reb_calculate_acceleration_var(r);
 	}
-	if (r->additional_forces  && (r->integrator != REB_INTEGRATOR_MERCURIUS || r->ri_mercurius.mode==0)){
+}
+
+void reb_update_acceleration_forces(struct reb_simulation* r){
+	if (reb_forces_used(r) && (r->integrator != REB_INTEGRATOR_MERCURIUS || r->ri_mercurius.mode==0)){
         // For Mercurius:
         // Additional forces are only calculated in the kick step, not during close encounter
         if (r->integrator==REB_INTEGRATOR_MERCURIUS){
             // shift pos and velocity so that external forces are calculated in inertial frame
             // Note: Copying avoids degrading floating point performance
             if(r->N>r->ri_mercurius.allocatedN_additionalforces){
-                r->ri_mercurius.particles_backup_additionalforces = realloc(r->ri_mercurius.particles_backup_additionalforces, r->N*sizeof(struct reb_particle));
+                r->ri_mercurius.particles_backup_additionalforces = reb_reserve(r->ri_mercurius.particles_backup_additionalforces, r->N*sizeof(struct reb_vec6d));
                 r->ri_mercurius.allocatedN_additionalforces = r->N;
             }
-            memcpy(r->ri_mercurius.particles_backup_additionalforces,r->particles,r->N*sizeof(struct reb_particle)); 
+            // Only positions and velocities change.
+            const struct reb_particle* restrict const particles = r->particles;
+            struct reb_vec6d* restrict const backup = r->ri_mercurius.particles_backup_additionalforces;
+            for (int i=0;i<r->N;i++){
+                backup[i] = (struct reb_vec6d){particles[i].x, particles[i].y, particles[i].z, particles[i].vx, particles[i].vy, particles[i].vz};
+            }
             reb_integrator_mercurius_dh_to_inertial(r);
         }
-        r->additional_forces(r);
+        if (r->additional_forces){
+            r->additional_forces(r);
+        }
+        reb_calculate_registered_forces(r);
         if (r->integrator==REB_INTEGRATOR_MERCURIUS){
             struct reb_particle* restrict const particles = r->particles;
-            struct reb_particle* restrict const backup = r->ri_mercurius.particles_backup_additionalforces;
+            const struct reb_vec6d* restrict const backup = r->ri_mercurius.particles_backup_additionalforces;
             for (int i=0;i<r->N;i++){
                 particles[i].x = backup[i].x;
                 particles[i].y = backup[i].y;
@@ -246,7 +291,5 @@ void reb_update_acceleration(struct reb_simulation* r){
             }
         }
     }
-	PROFILING_STOP(PROFILING_CAT_GRAVITY)
-	PROFILING_START()
 }
 
@@ -51,4 +51,14 @@ void reb_integrator_part2(struct reb_simulation* r);
  * set before a binary file is outputted.
  */
 void reb_integrator_init(struct reb_simulation* r);
+
+/**
+ * @brief The two parts of reb_update_acceleration().
+ * @details reb_update_acceleration_gravity() calculates the gravitational
+ * accelerations (including those of variational particles). These depend on the 
+ * positions only. reb_update_acceleration_forces() then adds the additional and
+ * registered forces, which may also depend on velocities. 
+ */
+void reb_update_acceleration_gravity(struct reb_simulation* r);
+void reb_update_acceleration_forces(struct reb_simulation* r);
 #endif
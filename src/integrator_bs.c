@@ -61,6 +61,10 @@
 #include "rebound.h"
 #include "gravity.h"
 #include "integrator_bs.h"
+#include "forces.h"
+#ifdef OPENMP
+#include <omp.h>
+#endif
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -102,11 +106,77 @@ void reb_integrator_bs_update_particles(struct reb_simulation* r, const double*
 }
 
 
-static int tryStep(struct reb_simulation* r, const int Ns, const int k, const int n, const double t0, const double step) {
+// Buffers used by tryStep for column k. If the columns are computed 
+// concurrently, every column writes directly into D[k] and has its own 
+// yTmp and yDot arrays.
+static inline double* column_y1(const struct reb_ode* const ode, const int k, const int parallel){
+    return parallel ? ode->D[k] : ode->y1;
+}
+static inline double* column_yTmp(const struct reb_ode* const ode, const int k, const int parallel){
+    return parallel ? ode->yTmps[k] : ode->yTmp;
+}
+static inline double* column_yDot(const struct reb_ode* const ode, const int k, const int parallel){
+    return parallel ? ode->yDots[k] : ode->yDot;
+}
+
+static int nbody_derivatives_direct_possible(const struct reb_simulation* const r);
+
+#ifdef OPENMP
+// Returns 1 if the derivatives of an ODE set can be evaluated concurrently 
+// with those of other sets, i.e. if it neither reads nor modifies the particles.
+static int ode_is_independent(const struct reb_simulation* const r, const struct reb_ode* const ode){
+    if (ode == r->ri_bs.nbody_ode){
+        return nbody_derivatives_direct_possible(r);
+    }
+    return !ode->needs_nbody;
+}
+#endif // OPENMP
+
+// Evaluates the derivatives of one ODE set at time t. If k is negative, 
+// y0Dot is calculated from y. Otherwise the buffers of column k are used.
+static inline void evaluate_derivatives_ode(struct reb_ode* const ode, const int k, const double t, const int parallel){
+    if (k<0){
+        ode->derivatives(ode, ode->y0Dot, ode->y, t);
+    }else{
+        if (parallel && ode->length==0) return; // Empty N-body ODE, nothing to do
+        ode->derivatives(ode, column_yDot(ode, k, parallel), column_y1(ode, k, parallel), t);
+    }
+}
+
+// Evaluates the derivatives of all ODE sets at time t.
+// With parallel_odes, the sets that depend on the particles are evaluated 
+// first and one after the other. The independent sets are then evaluated 
+// concurrently. Every set only writes to its own buffers and all norms are 
+// later summed up sequentially in a fixed order, so the result does not 
+// depend on the number of threads.
+static void evaluate_derivatives(struct reb_simulation* r, const int Ns, const int k, const double t, const int parallel){
+    struct reb_ode** odes = r->odes;
+#ifdef OPENMP
+    if (!parallel && r->ri_bs.parallel_odes && Ns>1 && omp_get_max_threads()>1){
+        for (int s=0; s < Ns; s++){
+            if (!ode_is_independent(r, odes[s])){
+                evaluate_derivatives_ode(odes[s], k, t, parallel);
+            }
+        }
+#pragma omp parallel for schedule(dynamic,1)
+        for (int s=0; s < Ns; s++){
+            if (ode_is_independent(r, odes[s])){
+                evaluate_derivatives_ode(odes[s], k, t, parallel);
+            }
+        }
+        return;
+    }
+#endif // OPENMP
+    for (int s=0; s < Ns; s++){
+        evaluate_derivatives_ode(odes[s], k, t, parallel);
+    }
+}
+
+static int tryStep(struct reb_simulation* r, const int Ns, const int k, const int n, const double t0, const double step, const int parallel) {
     struct reb_ode** odes = r->odes;
     const double subStep  = step / n;
     double t = t0;
-    int needs_nbody = r->ri_bs.user_ode_needs_nbody;
+    int needs_nbody = r->ri_bs.user_ode_needs_nbody; // Always 0 if parallel
 
     // LeapFrog Method did not seem to be of any advantage 
     //    switch (method) {
@@ -205,7 +275,7 @@ static int tryStep(struct reb_simulation* r, const int Ns, const int k, const in
     t += subStep;
     for (int s=0; s < Ns; s++){
         double* y0 = odes[s]->y;
-        double* y1 = odes[s]->y1;
+        double* y1 = column_y1(odes[s], k, parallel);
         double* y0Dot = odes[s]->y0Dot;
         const int length = odes[s]->length;
         for (int i = 0; i < length; ++i) {
@@ -217,12 +287,10 @@ static int tryStep(struct reb_simulation* r, const int Ns, const int k, const in
     if (needs_nbody){
         reb_integrator_bs_update_particles(r, r->ri_bs.nbody_ode->y1);
     }
-    for (int s=0; s < Ns; s++){
-        odes[s]->derivatives(odes[s], odes[s]->yDot, odes[s]->y1, t);
-    }
+    evaluate_derivatives(r, Ns, k, t, parallel);
     for (int s=0; s < Ns; s++){
         double* y0 = odes[s]->y;
-        double* yTmp = odes[s]->yTmp;
+        double* yTmp = column_yTmp(odes[s], k, parallel);
         const int length = odes[s]->length;
         for (int i = 0; i < length; ++i) {
             yTmp[i] = y0[i];
@@ -232,9 +300,9 @@ static int tryStep(struct reb_simulation* r, const int Ns, const int k, const in
     for (int j = 1; j < n; ++j) {  // Note: iterating n substeps, not 2n substeps as in Eq. (9.13)
         t += subStep;
         for (int s=0; s < Ns; s++){
-            double* y1 = odes[s]->y1;
-            double* yDot = odes[s]->yDot;
-            double* yTmp = odes[s]->yTmp;
+            double* y1 = column_y1(odes[s], k, parallel);
+            double* yDot = column_yDot(odes[s], k, parallel);
+            double* yTmp = column_yTmp(odes[s], k, parallel);
             const int length = odes[s]->length;
             for (int i = 0; i < length; ++i) {
                 const double middle = y1[i];
@@ -246,16 +314,14 @@ static int tryStep(struct reb_simulation* r, const int Ns, const int k, const in
         if (needs_nbody){
             reb_integrator_bs_update_particles(r, r->ri_bs.nbody_ode->y1);
         }
-        for (int s=0; s < Ns; s++){
-            odes[s]->derivatives(odes[s], odes[s]->yDot, odes[s]->y1, t);
-        }
+        evaluate_derivatives(r, Ns, k, t, parallel);
 
         // stability check
         if (j <= maxChecks && k < maxIter) {
             double initialNorm = 0.0;
             double deltaNorm = 0.0;
             for (int s=0; s < Ns; s++){
-                double* yDot = odes[s]->yDot;
+                double* yDot = column_yDot(odes[s], k, parallel);
                 double* y0Dot = odes[s]->y0Dot;
                 double* scale = odes[s]->scale;
                 const int length = odes[s]->length;
@@ -275,9 +341,9 @@ static int tryStep(struct reb_simulation* r, const int Ns, const int k, const in
 
     // correction of the last substep (at t0 + step)
     for (int s=0; s < Ns; s++){
-        double* y1 = odes[s]->y1;
-        double* yTmp = odes[s]->yTmp;
-        double* yDot = odes[s]->yDot;
+        double* y1 = column_y1(odes[s], k, parallel);
+        double* yTmp = column_yTmp(odes[s], k, parallel);
+        double* yDot = column_yDot(odes[s], k, parallel);
         const int length = odes[s]->length;
         for (int i = 0; i < length; ++i) {
             y1[i] = 0.5 * (yTmp[i] + y1[i] + subStep * yDot[i]); // = 0.25*(y_(2n-1) + 2*y_n(2) + y_(2n+1))     Eq (9.13c)
@@ -314,9 +380,84 @@ static void extrapolate(const struct reb_ode* ode, double * const coeff, const i
 }
 
 
+// Returns 1 if the N-body derivatives can be calculated directly from the
+// state vector, without copying it to the particle structures first.
+// This is the case for plain direct summation without any other forces.
+static int nbody_derivatives_direct_possible(const struct reb_simulation* const r){
+#ifdef MPI
+    return 0;
+#else // MPI
+    return r->gravity == REB_GRAVITY_BASIC
+        && r->N_var == 0
+        && r->gravity_ignore_terms == 0
+        && r->nghostx == 0 && r->nghosty == 0 && r->nghostz == 0
+        && !reb_forces_used(r);
+#endif // MPI
+}
+
+// Same as REB_GRAVITY_BASIC but reads positions from y and writes
+// accelerations to yDot. The particle structures are not modified.
+static void nbody_derivatives_direct(struct reb_simulation* const r, double* const yDot, const double* const y){
+    const struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const int N_active = (r->N_active==-1)?N:MIN(r->N_active, N);
+    const int testparticle_type = r->testparticle_type;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    for (int i=0; i<N; i++){
+        yDot[i*6+0] = y[i*6+3];
+        yDot[i*6+1] = y[i*6+4];
+        yDot[i*6+2] = y[i*6+5];
+        yDot[i*6+3] = 0.;
+        yDot[i*6+4] = 0.;
+        yDot[i*6+5] = 0.;
+    }
+    for (int i=1; i<N; i++){
+        const double xi = y[i*6+0];
+        const double yi = y[i*6+1];
+        const double zi = y[i*6+2];
+        const double mi = particles[i].m;
+        const int backreaction = i<N_active || testparticle_type;
+        double axi = 0.;
+        double ayi = 0.;
+        double azi = 0.;
+        const int jend = MIN(i, N_active);
+        for (int j=0; j<jend; j++){
+            const double dx = xi - y[j*6+0];
+            const double dy = yi - y[j*6+1];
+            const double dz = zi - y[j*6+2];
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double prefact = G/(_r*_r*_r);
+            const double prefactj = -prefact*particles[j].m;
+            axi += prefactj*dx;
+            ayi += prefactj*dy;
+            azi += prefactj*dz;
+            if (backreaction){
+                const double prefacti = prefact*mi;
+                yDot[j*6+3] += prefacti*dx;
+                yDot[j*6+4] += prefacti*dy;
+                yDot[j*6+5] += prefacti*dz;
+            }
+        }
+        yDot[i*6+3] += axi;
+        yDot[i*6+4] += ayi;
+        yDot[i*6+5] += azi;
+    }
+    const uint64_t Na = N_active;
+    const uint64_t Nt = N - N_active;
+#ifdef OPENMP
+#pragma omp atomic
+#endif // OPENMP
+    r->counters.gravity_interactions += Na*(Na-1)/2 + Na*Nt;
+}
+
 static void nbody_derivatives(struct reb_ode* ode, double* const yDot, const double* const y, double const t){
     struct reb_simulation* const r = ode->r;
-    if (r->t != t) { 
+    if (r->t != t && nbody_derivatives_direct_possible(r)){
+        nbody_derivatives_direct(r, yDot, y);
+        return;
+    }
+    if (r->t != t) {
         // Not needed for first step. Accelerations already calculated. Just need to copy them
         reb_integrator_bs_update_particles(r, y);
         reb_update_acceleration(r);
@@ -325,6 +466,7 @@ static void nbody_derivatives(struct reb_ode* ode, double* const yDot, const dou
         }
         // Calculate non-gravity accelerations. 
         if (r->additional_forces) r->additional_forces(r);
+        reb_calculate_registered_forces(r);
     }
 
     for (int i=0; i<r->N; i++){
@@ -374,6 +516,17 @@ static void allocate_sequence_arrays(struct reb_simulation_integrator_bs* ri_bs)
     }
 }
 
+static void allocate_column_arrays(struct reb_ode* ode){
+    if (ode->yTmps==NULL){
+        ode->yTmps = malloc(sizeof(double*)*sequence_length);
+        ode->yDots = malloc(sizeof(double*)*sequence_length);
+        for (int k = 0; k < sequence_length; ++k) {
+            ode->yTmps[k] = malloc(sizeof(double)*ode->length);
+            ode->yDots[k] = malloc(sizeof(double)*ode->length);
+        }
+    }
+}
+
 static void reb_integrator_bs_default_scale(struct reb_ode* ode, double* y1, double* y2, double relTol, double absTol){
     double* scale = ode->scale;
     int length = ode->length;
@@ -428,12 +581,39 @@ int reb_integrator_bs_step(struct reb_simulation* r, double dt){
     }
 
     // first evaluation, at the beginning of the step
-    for (int s=0; s < Ns; s++){
-        odes[s]->derivatives(odes[s], odes[s]->y0Dot, odes[s]->y, t);
-    }
+    evaluate_derivatives(r, Ns, -1, t, 0);
 
     const int forward = (dt >= 0.);
 
+    // The columns of the extrapolation table are independent of each other. 
+    // If requested, compute all columns that might be needed concurrently
+    // and only do the extrapolation sequentially. This is only possible
+    // if the derivatives do not modify the simulation, i.e. if no ODE needs
+    // the particles to be updated and the N-body derivatives (if any) are 
+    // calculated directly from the state vector.
+    // The result is the same as when the columns are computed one by one.
+#ifdef OPENMP
+    const int parallel = ri_bs->parallel_columns && omp_get_max_threads()>1 
+        && !ri_bs->user_ode_needs_nbody 
+        && (ri_bs->nbody_ode==NULL || ri_bs->nbody_ode->length==0 || nbody_derivatives_direct_possible(r));
+#else // OPENMP
+    const int parallel = 0;
+#endif // OPENMP
+    int success[sequence_length];
+    if (parallel){
+        for (int s=0; s < Ns; s++){
+            allocate_column_arrays(odes[s]);
+        }
+        // The iteration below never goes beyond targetIter+1.
+        const int kmax = ri_bs->targetIter + 1;
+        // Columns with larger k are more expensive. Start with them.
+#pragma omp parallel for schedule(dynamic,1)
+        for (int j = 0; j <= kmax; ++j) {
+            const int k = kmax - j;
+            success[k] = tryStep(r, Ns, k, ri_bs->sequence[k], t, dt, 1);
+        }
+    }
+
     // iterate over several substep sizes
     int k = -1;
     for (int loop = 1; loop; ) {
@@ -441,7 +621,7 @@ int reb_integrator_bs_step(struct reb_simulation* r, double dt){
         ++k;
         
         // modified midpoint integration with the current substep
-        if ( ! tryStep(r, Ns, k, ri_bs->sequence[k], t, dt)) {
+        if ( ! (parallel ? success[k] : tryStep(r, Ns, k, ri_bs->sequence[k], t, dt, 0))) {
 
             // the stability check failed, we reduce the global step
 #if DEBUG
@@ -454,10 +634,16 @@ int reb_integrator_bs_step(struct reb_simulation* r, double dt){
         } else {
             for (int s=0; s < Ns; s++){
                 const int length = odes[s]->length;
-                for (int i = 0; i < length; ++i) {
-                    double CD = odes[s]->y1[i];
-                    odes[s]->C[i] = CD;
-                    odes[s]->D[k][i] = CD;
+                if (parallel){ // tryStep has already written to D[k]
+                    for (int i = 0; i < length; ++i) {
+                        odes[s]->C[i] = odes[s]->D[k][i];
+                    }
+                }else{
+                    for (int i = 0; i < length; ++i) {
+                        double CD = odes[s]->y1[i];
+                        odes[s]->C[i] = CD;
+                        odes[s]->D[k][i] = CD;
+                    }
                 }
             }
 
@@ -683,6 +869,7 @@ int reb_integrator_bs_step(struct reb_simulation* r, double dt){
 
     if (reject) {
         ri_bs->previousRejected = 1;
+        r->counters.bs_steps_rejected++;
     } else {
         ri_bs->previousRejected = 0;
         ri_bs->firstOrLastStep = 0;
@@ -793,6 +980,16 @@ void reb_free_ode(struct reb_ode* ode){
     ode->yTmp = NULL;
     free(ode->yDot);
     ode->yDot = NULL;
+    if (ode->yTmps){
+        for (int k = 0; k < sequence_length; ++k) {
+            free(ode->yTmps[k]);
+            free(ode->yDots[k]);
+        }
+        free(ode->yTmps);
+        ode->yTmps = NULL;
+        free(ode->yDots);
+        ode->yDots = NULL;
+    }
     
     struct reb_simulation* r = ode->r;
     if (r){ // only do this is ode is in a simulation
@@ -845,5 +1042,7 @@ void reb_integrator_bs_reset(struct reb_simulation* r){
     ri_bs->min_dt           = 0; 
     ri_bs->firstOrLastStep  = 1;
     ri_bs->previousRejected = 0;
+    ri_bs->parallel_columns = 0;
+    ri_bs->parallel_odes = 0;
         
 }
@@ -62,6 +62,101 @@ static const double plf7_6_4_a[2] = {0.5600879810924619,-0.060087981092461900000
 static const double plf7_6_4_b[2] = {1.5171479707207228, -2.0342959414414456000};
 static const double plf7_6_4_z[6] = {-0.3346222298730800, 1.0975679907321640, -1.0380887460967830, 0.6234776317921379, -1.1027532063031910, -0.0141183222088869};
 static const double plf7_6_4_y[6] = {-1.6218101180868010, 0.0061709468110142, 0.8348493592472594, -0.0511253369989315, 0.5633782670698199, -0.5};
+
+/**
+ * @brief Operator splitting method written as a sequence of stages.
+ * @details All methods have the form D(a[0]) K(b[0]) D(a[1]) K(b[1]) ... K(b[N-1]) D(a[N])
+ * where D is a drift and K a kick. Modified kicks have the jerk coefficient c (in units
+ * of dt^3). All methods are symmetric, a[N]=a[0], so the last drift of one step can be
+ * combined with the first drift of the next step. Pre- and post-processors are not included.
+ */
+struct reb_eos_scheme {
+    int N;          // Number of kicks
+    double a[18];   // Drift coefficients
+    double b[17];   // Kick coefficients
+    double c[17];   // Jerk coefficients
+};
+
+// Symmetric method with kicks k[0], ..., k[m-1], ..., k[0] and drifts halfway between kicks.
+static void reb_integrator_eos_scheme_palindrome(struct reb_eos_scheme* const s, const double* const k, const int m){
+    s->N = 2*m-1;
+    for (int i=0;i<s->N;i++){
+        s->b[i] = k[i<m?i:s->N-1-i];
+    }
+    s->a[0] = 0.5*s->b[0];
+    for (int i=1;i<s->N;i++){
+        s->a[i] = 0.5*(s->b[i-1]+s->b[i]);
+    }
+    s->a[s->N] = s->a[0];
+}
+
+static struct reb_eos_scheme reb_integrator_eos_scheme(enum REB_EOS_TYPE type){
+    struct reb_eos_scheme s = {0};
+    switch(type){
+        case REB_EOS_LF:
+        case REB_EOS_PMLF4:
+            s.N = 1;
+            s.a[0] = 0.5;
+            s.b[0] = 1.;
+            s.c[0] = (type==REB_EOS_PMLF4)?1./24.:0.;
+            s.a[1] = 0.5;
+            break;
+        case REB_EOS_LF4:
+            s.N = 3;
+            s.a[0] = lf4_a;
+            s.b[0] = 2.*lf4_a;
+            s.a[1] = 0.5-lf4_a;
+            s.b[1] = 1.-4.*lf4_a;
+            s.a[2] = 0.5-lf4_a;
+            s.b[2] = 2.*lf4_a;
+            s.a[3] = lf4_a;
+            break;
+        case REB_EOS_LF6:
+            reb_integrator_eos_scheme_palindrome(&s, lf6_a, 5);
+            break;
+        case REB_EOS_LF8:
+            reb_integrator_eos_scheme_palindrome(&s, lf8_a, 9);
+            break;
+        case REB_EOS_LF4_2:
+            s.N = 2;
+            s.a[0] = lf4_2_a;
+            s.b[0] = 0.5;
+            s.a[1] = 1.-2.*lf4_2_a;
+            s.b[1] = 0.5;
+            s.a[2] = lf4_2_a;
+            break;
+        case REB_EOS_LF8_6_4:
+            s.N = 7;
+            for (int i=0;i<4;i++){
+                s.a[i] = lf8_6_4_a[i];
+                s.a[7-i] = lf8_6_4_a[i];
+                s.b[i] = lf8_6_4_b[i];
+                s.b[6-i] = lf8_6_4_b[i];
+            }
+            break;
+        case REB_EOS_PMLF6:
+            s.N = 3;
+            for (int i=0;i<2;i++){
+                s.a[i] = pmlf6_a[i];
+                s.a[3-i] = pmlf6_a[i];
+                s.b[i] = pmlf6_b[i];
+                s.b[2-i] = pmlf6_b[i];
+                s.c[i] = pmlf6_c[i];
+                s.c[2-i] = pmlf6_c[i];
+            }
+            break;
+        case REB_EOS_PLF7_6_4:
+            s.N = 3;
+            for (int i=0;i<2;i++){
+                s.a[i] = plf7_6_4_a[i];
+                s.a[3-i] = plf7_6_4_a[i];
+                s.b[i] = plf7_6_4_b[i];
+                s.b[2-i] = plf7_6_4_b[i];
+            }
+            break;
+    }
+    return s;
+}
                 
 static inline void reb_integrator_eos_interaction_shell0(struct reb_simulation* r, double y, double v){
     // Calculate gravity using standard gravity routine
@@ -368,172 +463,16 @@ static void reb_integrator_eos_drift_shell0(struct reb_simulation* const r, doub
     const int n = reos->n;
     const double dt = _dt/n;
     reb_integrator_eos_preprocessor(r, dt, reos->phi1, reb_integrator_eos_drift_shell1, reb_integrator_eos_interaction_shell1);
-    switch(reos->phi1){
-        case REB_EOS_LF:
-            reb_integrator_eos_drift_shell1(r, dt*0.5); 
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, dt, 0.);
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, dt);
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*0.5);
-            break;
-        case REB_EOS_LF4:
-            reb_integrator_eos_drift_shell1(r, dt*lf4_a);
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, dt*2.*lf4_a, 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(0.5-lf4_a));
-                reb_integrator_eos_interaction_shell1(r, dt*(1.-4.*lf4_a), 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(0.5-lf4_a));
-                reb_integrator_eos_interaction_shell1(r, dt*2.*lf4_a, 0.);
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, dt*2.*lf4_a);
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*lf4_a);
-            break;
-        case REB_EOS_LF6:
-            reb_integrator_eos_drift_shell1(r, dt*lf6_a[0]*0.5);
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[0], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[0]+lf6_a[1])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[1], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[1]+lf6_a[2])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[2], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[2]+lf6_a[3])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[3], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[3]+lf6_a[4])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[4], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[3]+lf6_a[4])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[3], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[2]+lf6_a[3])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[2], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[1]+lf6_a[2])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[1], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf6_a[0]+lf6_a[1])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf6_a[0], 0.);
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, dt*lf6_a[0]);
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*lf6_a[0]*0.5);
-            break; 
-        case REB_EOS_LF8: 
-            reb_integrator_eos_drift_shell1(r, dt*lf8_a[0]*0.5);
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[0], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[0]+lf8_a[1])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[1], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[1]+lf8_a[2])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[2], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[2]+lf8_a[3])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[3], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[3]+lf8_a[4])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[4], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[4]+lf8_a[5])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[5], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[5]+lf8_a[6])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[6], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[6]+lf8_a[7])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[7], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[7]+lf8_a[8])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[8], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[7]+lf8_a[8])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[7], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[6]+lf8_a[7])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[6], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[5]+lf8_a[6])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[5], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[4]+lf8_a[5])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[4], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[3]+lf8_a[4])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[3], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[2]+lf8_a[3])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[2], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[1]+lf8_a[2])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[1], 0.);
-                reb_integrator_eos_drift_shell1(r, dt*(lf8_a[0]+lf8_a[1])*0.5);
-                reb_integrator_eos_interaction_shell1(r, dt*lf8_a[0], 0.);
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, dt*lf8_a[0]);
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*lf8_a[0]*0.5);
-            break;
-        case REB_EOS_LF4_2: 
-            reb_integrator_eos_drift_shell1(r, dt*lf4_2_a); 
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, dt*0.5, 0.); 
-                reb_integrator_eos_drift_shell1(r, dt*(1.-2.*lf4_2_a));
-                reb_integrator_eos_interaction_shell1(r, dt*0.5, 0.); 
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, 2.*dt*lf4_2_a); 
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*lf4_2_a); 
-            break;
-        case REB_EOS_LF8_6_4:
-            reb_integrator_eos_drift_shell1(r, dt*lf8_6_4_a[0]);   
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, lf8_6_4_b[0]*dt,0);
-                reb_integrator_eos_drift_shell1(r, lf8_6_4_a[1]*dt);   
-                reb_integrator_eos_interaction_shell1(r, lf8_6_4_b[1]*dt,0);
-                reb_integrator_eos_drift_shell1(r, lf8_6_4_a[2]*dt);   
-                reb_integrator_eos_interaction_shell1(r, lf8_6_4_b[2]*dt,0);
-                reb_integrator_eos_drift_shell1(r, lf8_6_4_a[3]*dt);   
-                reb_integrator_eos_interaction_shell1(r, lf8_6_4_b[3]*dt,0);
-                reb_integrator_eos_drift_shell1(r, lf8_6_4_a[3]*dt);   
-                reb_integrator_eos_interaction_shell1(r, lf8_6_4_b[2]*dt,0);
-                reb_integrator_eos_drift_shell1(r, lf8_6_4_a[2]*dt);   
-                reb_integrator_eos_interaction_shell1(r, lf8_6_4_b[1]*dt,0);
-                reb_integrator_eos_drift_shell1(r, lf8_6_4_a[1]*dt);   
-                reb_integrator_eos_interaction_shell1(r, lf8_6_4_b[0]*dt,0);
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, 2.*dt*lf8_6_4_a[0]);   
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*lf8_6_4_a[0]);   
-            break;
-        case REB_EOS_PMLF4:
-            reb_integrator_eos_drift_shell1(r, dt*0.5); 
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, dt, dt*dt*dt/24.); 
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, dt);
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*0.5);
-            break;
-        case REB_EOS_PMLF6:
-            reb_integrator_eos_drift_shell1(r, dt*pmlf6_a[0]); 
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, dt*pmlf6_b[0], dt*dt*dt*pmlf6_c[0]); 
-                reb_integrator_eos_drift_shell1(r, dt*pmlf6_a[1]);
-                reb_integrator_eos_interaction_shell1(r, dt*pmlf6_b[1], dt*dt*dt*pmlf6_c[1]); 
-                reb_integrator_eos_drift_shell1(r, dt*pmlf6_a[1]);
-                reb_integrator_eos_interaction_shell1(r, dt*pmlf6_b[0], dt*dt*dt*pmlf6_c[0]);
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, 2.*dt*pmlf6_a[0]);
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*pmlf6_a[0]);
-            break;
-        case REB_EOS_PLF7_6_4:
-            reb_integrator_eos_drift_shell1(r, dt*plf7_6_4_a[0]);   
-            for (int i=0;i<n;i++){
-                reb_integrator_eos_interaction_shell1(r, plf7_6_4_b[0]*dt,0);
-                reb_integrator_eos_drift_shell1(r, plf7_6_4_a[1]*dt);   
-                reb_integrator_eos_interaction_shell1(r, plf7_6_4_b[1]*dt,0);
-                reb_integrator_eos_drift_shell1(r, plf7_6_4_a[1]*dt);   
-                reb_integrator_eos_interaction_shell1(r, plf7_6_4_b[0]*dt,0);
-                if (i<n-1){
-                    reb_integrator_eos_drift_shell1(r, 2.*dt*plf7_6_4_a[0]);   
-                }
-            }
-            reb_integrator_eos_drift_shell1(r, dt*plf7_6_4_a[0]);   
-            break;
+    const struct reb_eos_scheme s = reb_integrator_eos_scheme(reos->phi1);
+    for (int i=0;i<n;i++){
+        for (int k=0;k<s.N;k++){
+            // The last drift of a substep is combined with the first drift of the next one.
+            const double a = (k==0 && i>0)?s.a[s.N]+s.a[0]:s.a[k];
+            reb_integrator_eos_drift_shell1(r, dt*a);
+            reb_integrator_eos_interaction_shell1(r, dt*s.b[k], dt*dt*dt*s.c[k]);
+        }
     }
+    reb_integrator_eos_drift_shell1(r, dt*s.a[s.N]);
     reb_integrator_eos_postprocessor(r, dt, reos->phi1, reb_integrator_eos_drift_shell1, reb_integrator_eos_interaction_shell1);
 }
 
@@ -557,117 +496,11 @@ void reb_integrator_eos_part2(struct reb_simulation* const r){
     }else{
         dtfac = 2.;
     }
-    switch(reos->phi0){
-        case REB_EOS_LF:
-            reb_integrator_eos_drift_shell0(r, dt*0.5*dtfac);
-            reb_integrator_eos_interaction_shell0(r, dt, 0.);
-            break;
-        case REB_EOS_LF4:
-            reb_integrator_eos_drift_shell0(r, dt*lf4_a*dtfac);
-            reb_integrator_eos_interaction_shell0(r, dt*2.*lf4_a, 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(0.5-lf4_a));
-            reb_integrator_eos_interaction_shell0(r, dt*(1.-4.*lf4_a), 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(0.5-lf4_a));
-            reb_integrator_eos_interaction_shell0(r, dt*2.*lf4_a, 0.);
-            break;
-        case REB_EOS_LF6:
-            reb_integrator_eos_drift_shell0(r, dt*lf6_a[0]*0.5*dtfac);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[0], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[0]+lf6_a[1])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[1], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[1]+lf6_a[2])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[2], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[2]+lf6_a[3])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[3], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[3]+lf6_a[4])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[4], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[3]+lf6_a[4])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[3], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[2]+lf6_a[3])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[2], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[1]+lf6_a[2])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[1], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf6_a[0]+lf6_a[1])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf6_a[0], 0.);
-            break; 
-        case REB_EOS_LF8: 
-            reb_integrator_eos_drift_shell0(r, dt*lf8_a[0]*0.5*dtfac);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[0], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[0]+lf8_a[1])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[1], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[1]+lf8_a[2])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[2], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[2]+lf8_a[3])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[3], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[3]+lf8_a[4])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[4], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[4]+lf8_a[5])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[5], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[5]+lf8_a[6])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[6], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[6]+lf8_a[7])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[7], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[7]+lf8_a[8])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[8], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[7]+lf8_a[8])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[7], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[6]+lf8_a[7])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[6], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[5]+lf8_a[6])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[5], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[4]+lf8_a[5])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[4], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[3]+lf8_a[4])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[3], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[2]+lf8_a[3])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[2], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[1]+lf8_a[2])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[1], 0.);
-            reb_integrator_eos_drift_shell0(r, dt*(lf8_a[0]+lf8_a[1])*0.5);
-            reb_integrator_eos_interaction_shell0(r, dt*lf8_a[0], 0.);
-            break;
-        case REB_EOS_LF4_2: 
-            reb_integrator_eos_drift_shell0(r, dt*lf4_2_a*dtfac); 
-            reb_integrator_eos_interaction_shell0(r, dt*0.5, 0.); 
-            reb_integrator_eos_drift_shell0(r, dt*(1.-2.*lf4_2_a));
-            reb_integrator_eos_interaction_shell0(r, dt*0.5, 0.); 
-            break;
-        case REB_EOS_LF8_6_4:
-            reb_integrator_eos_drift_shell0(r, dt*lf8_6_4_a[0]*dtfac);   
-            reb_integrator_eos_interaction_shell0(r, lf8_6_4_b[0]*dt,0);
-            reb_integrator_eos_drift_shell0(r, lf8_6_4_a[1]*dt);   
-            reb_integrator_eos_interaction_shell0(r, lf8_6_4_b[1]*dt,0);
-            reb_integrator_eos_drift_shell0(r, lf8_6_4_a[2]*dt);   
-            reb_integrator_eos_interaction_shell0(r, lf8_6_4_b[2]*dt,0);
-            reb_integrator_eos_drift_shell0(r, lf8_6_4_a[3]*dt);   
-            reb_integrator_eos_interaction_shell0(r, lf8_6_4_b[3]*dt,0);
-            reb_integrator_eos_drift_shell0(r, lf8_6_4_a[3]*dt);   
-            reb_integrator_eos_interaction_shell0(r, lf8_6_4_b[2]*dt,0);
-            reb_integrator_eos_drift_shell0(r, lf8_6_4_a[2]*dt);   
-            reb_integrator_eos_interaction_shell0(r, lf8_6_4_b[1]*dt,0);
-            reb_integrator_eos_drift_shell0(r, lf8_6_4_a[1]*dt);   
-            reb_integrator_eos_interaction_shell0(r, lf8_6_4_b[0]*dt,0);
-            break;
-        case REB_EOS_PMLF4:
-            reb_integrator_eos_drift_shell0(r, dt*0.5*dtfac); 
-            reb_integrator_eos_interaction_shell0(r, dt, dt*dt*dt/24.); 
-            break;
-        case REB_EOS_PMLF6:
-            reb_integrator_eos_drift_shell0(r, dt*pmlf6_a[0]*dtfac); 
-            reb_integrator_eos_interaction_shell0(r, dt*pmlf6_b[0], dt*dt*dt*pmlf6_c[0]); 
-            reb_integrator_eos_drift_shell0(r, dt*pmlf6_a[1]);
-            reb_integrator_eos_interaction_shell0(r, dt*pmlf6_b[1], dt*dt*dt*pmlf6_c[1]); 
-            reb_integrator_eos_drift_shell0(r, dt*pmlf6_a[1]);
-            reb_integrator_eos_interaction_shell0(r, dt*pmlf6_b[0], dt*dt*dt*pmlf6_c[0]);
-            break;
-        case REB_EOS_PLF7_6_4:
-            reb_integrator_eos_drift_shell0(r, dt*plf7_6_4_a[0]*dtfac);   
-            reb_integrator_eos_interaction_shell0(r, plf7_6_4_b[0]*dt,0);
-            reb_integrator_eos_drift_shell0(r, plf7_6_4_a[1]*dt);   
-            reb_integrator_eos_interaction_shell0(r, plf7_6_4_b[1]*dt,0);
-            reb_integrator_eos_drift_shell0(r, plf7_6_4_a[1]*dt);   
-            reb_integrator_eos_interaction_shell0(r, plf7_6_4_b[0]*dt,0);
-            break;
+    const struct reb_eos_scheme s = reb_integrator_eos_scheme(reos->phi0);
+    for (int k=0;k<s.N;k++){
+        // The first drift includes the last drift of the previous step if unsynchronized.
+        reb_integrator_eos_drift_shell0(r, dt*s.a[k]*(k==0?dtfac:1.));
+        reb_integrator_eos_interaction_shell0(r, dt*s.b[k], dt*dt*dt*s.c[k]);
     }
 
     reos->is_synchronized = 0;
@@ -691,33 +524,8 @@ void reb_integrator_eos_synchronize(struct reb_simulation* r){
     struct reb_simulation_integrator_eos* const reos = &(r->ri_eos);
     const double dt = r->dt;
     if (reos->is_synchronized == 0){
-        switch(reos->phi0){
-            case REB_EOS_PMLF4:
-            case REB_EOS_LF:
-                reb_integrator_eos_drift_shell0(r, dt*0.5); 
-                break;
-            case REB_EOS_PMLF6:
-                reb_integrator_eos_drift_shell0(r, dt*pmlf6_a[0]); 
-                break;
-            case REB_EOS_LF4:
-                reb_integrator_eos_drift_shell0(r, dt*lf4_a);
-                break;
-            case REB_EOS_LF4_2:
-                reb_integrator_eos_drift_shell0(r, dt*lf4_2_a); 
-                break;
-            case REB_EOS_PLF7_6_4:
-                reb_integrator_eos_drift_shell0(r, dt*plf7_6_4_a[0]);   
-                break;
-            case REB_EOS_LF8_6_4:
-                reb_integrator_eos_drift_shell0(r, dt*lf8_6_4_a[0]);   
-                break;
-            case REB_EOS_LF6:
-                reb_integrator_eos_drift_shell0(r, dt*lf6_a[0]*0.5);
-                break;
-            case REB_EOS_LF8: 
-                reb_integrator_eos_drift_shell0(r, dt*lf8_a[0]*0.5);
-                break;
-        }
+        const struct reb_eos_scheme s = reb_integrator_eos_scheme(reos->phi0);
+        reb_integrator_eos_drift_shell0(r, dt*s.a[s.N]);
         reb_integrator_eos_postprocessor(r, r->dt, reos->phi0, reb_integrator_eos_drift_shell0, reb_integrator_eos_interaction_shell0);
         reos->is_synchronized = 1;
     }
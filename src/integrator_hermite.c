@@ -0,0 +1,304 @@
+/**
+ * @file    integrator_hermite.c
+ * @brief   Fourth order Hermite integrator with individual block timesteps.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details This file implements a fourth order Hermite predictor-corrector
+ * scheme (Makino & Aarseth 1992) with individual, hierarchical timesteps.
+ * Every particle has its own timestep r->dt/2^level which is chosen with
+ * the Aarseth criterion. In each block step, only the particles whose
+ * timestep ends at the current time are advanced and only their forces
+ * are recalculated. The positions of all other particles are predicted
+ * with a Taylor series. At the end of each call to reb_step(), all
+ * particles are synchronized at r->t. The integrator therefore does not
+ * have any state that persists between timesteps.
+ *
+ * @section LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "rebound.h"
+#include "integrator_hermite.h"
+#include "forces.h"
+
+#define REB_HERMITE_MAX_LEVEL 40    ///< The smallest timestep is r->dt/2^REB_HERMITE_MAX_LEVEL
+
+// Length of the timestep of a particle on a given level in units of the smallest timestep.
+static inline int64_t reb_integrator_hermite_ticks(const int level){
+    return ((int64_t)1)<<(REB_HERMITE_MAX_LEVEL-level);
+}
+
+// Returns the level of the largest timestep dt_max/2^level which is not larger than dt_crit.
+// Returns REB_HERMITE_MAX_LEVEL+1 if even the smallest timestep is too large.
+static int reb_integrator_hermite_level(const double dt_max, const double dt_crit){
+    double dt = dt_max;
+    int level = 0;
+    while (dt > dt_crit && level <= REB_HERMITE_MAX_LEVEL){
+        dt *= 0.5;
+        level++;
+    }
+    return level;
+}
+
+static inline double reb_integrator_hermite_norm(const struct reb_vec3d v){
+    return sqrt(v.x*v.x + v.y*v.y + v.z*v.z);
+}
+
+// Calculates the acceleration and jerk of the active particles
+// using the predicted positions and velocities of all particles.
+static void reb_integrator_hermite_forces(struct reb_simulation* const r, const int N_active_list){
+    struct reb_particle* const p = r->ri_hermite.p_pred;
+    struct reb_vec3d* const jerk = r->ri_hermite.jerk_pred;
+    const int* const active = r->ri_hermite.active;
+    const int N_real = r->N;
+    const int N_active = (r->N_active==-1)?N_real:r->N_active;
+    const int testparticle_type = r->testparticle_type;
+    const double G = (r->gravity==REB_GRAVITY_NONE)?0.:r->G;
+    const double softening2 = r->softening*r->softening;
+#pragma omp parallel for schedule(guided)
+    for (int k=0; k<N_active_list; k++){
+        const int i = active[k];
+        // Test particles of type 1 act on massive particles, but not on each other.
+        const int jmax = (testparticle_type==1 && i<N_active)?N_real:N_active;
+        double ax = 0.;
+        double ay = 0.;
+        double az = 0.;
+        double jx = 0.;
+        double jy = 0.;
+        double jz = 0.;
+        for (int j=0; j<jmax; j++){
+            if (i==j) continue;
+            const double dx = p[j].x - p[i].x;
+            const double dy = p[j].y - p[i].y;
+            const double dz = p[j].z - p[i].z;
+            const double dvx = p[j].vx - p[i].vx;
+            const double dvy = p[j].vy - p[i].vy;
+            const double dvz = p[j].vz - p[i].vz;
+            const double r2 = dx*dx + dy*dy + dz*dz + softening2;
+            const double _r = sqrt(r2);
+            const double prefact = G*p[j].m/(r2*_r);
+            const double rv = 3.*(dx*dvx + dy*dvy + dz*dvz)/r2;
+            ax += prefact*dx;
+            ay += prefact*dy;
+            az += prefact*dz;
+            jx += prefact*(dvx - rv*dx);
+            jy += prefact*(dvy - rv*dy);
+            jz += prefact*(dvz - rv*dz);
+        }
+        p[i].ax = ax;
+        p[i].ay = ay;
+        p[i].az = az;
+        jerk[i].x = jx;
+        jerk[i].y = jy;
+        jerk[i].z = jz;
+    }
+}
+
+void reb_integrator_hermite_part1(struct reb_simulation* r){
+    r->gravity_ignore_terms = 0;
+}
+
+void reb_integrator_hermite_part2(struct reb_simulation* r){
+    struct reb_simulation_integrator_hermite* const ri_hermite = &(r->ri_hermite);
+    const int N = r->N;
+    if (r->N_var){
+        reb_error(r, "HERMITE does not support variational particles.");
+        r->status = REB_EXIT_ERROR;
+        return;
+    }
+    if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->boundary==REB_BOUNDARY_PERIODIC || r->boundary==REB_BOUNDARY_SHEAR){
+        reb_error(r, "HERMITE only supports direct summation without ghost boxes.");
+        r->status = REB_EXIT_ERROR;
+        return;
+    }
+    if (reb_forces_used(r) && ri_hermite->additional_forces_warning==0){
+        ri_hermite->additional_forces_warning = 1;
+        reb_warning(r, "HERMITE does not support additional forces. They are ignored.");
+    }
+    if (ri_hermite->allocated_N < N){
+        ri_hermite->allocated_N = N;
+        ri_hermite->p_pred = realloc(ri_hermite->p_pred, sizeof(struct reb_particle)*N);
+        ri_hermite->jerk = realloc(ri_hermite->jerk, sizeof(struct reb_vec3d)*N);
+        ri_hermite->jerk_pred = realloc(ri_hermite->jerk_pred, sizeof(struct reb_vec3d)*N);
+        ri_hermite->level = realloc(ri_hermite->level, sizeof(int)*N);
+        ri_hermite->t = realloc(ri_hermite->t, sizeof(int64_t)*N);
+        ri_hermite->active = realloc(ri_hermite->active, sizeof(int)*N);
+    }
+    struct reb_particle* const particles = r->particles;
+    struct reb_particle* const p_pred = ri_hermite->p_pred;
+    struct reb_vec3d* const jerk = ri_hermite->jerk;
+    struct reb_vec3d* const jerk_pred = ri_hermite->jerk_pred;
+    int* const level = ri_hermite->level;
+    int64_t* const t = ri_hermite->t;
+    int* const active = ri_hermite->active;
+    const double dt = r->dt;
+    const double dt_max = fabs(dt);
+    const double eta = ri_hermite->eta;
+    const int64_t t_end = reb_integrator_hermite_ticks(0);
+
+    // All particles are synchronized at the beginning of the timestep.
+    for (int i=0; i<N; i++){
+        p_pred[i] = particles[i];
+        active[i] = i;
+        t[i] = 0;
+    }
+    reb_integrator_hermite_forces(r, N);
+    int level_exceeded = 0;
+    for (int i=0; i<N; i++){
+        particles[i].ax = p_pred[i].ax;
+        particles[i].ay = p_pred[i].ay;
+        particles[i].az = p_pred[i].az;
+        jerk[i] = jerk_pred[i];
+        // There is no information about higher derivatives yet.
+        const double na = reb_integrator_hermite_norm((struct reb_vec3d){particles[i].ax, particles[i].ay, particles[i].az});
+        const double nj = reb_integrator_hermite_norm(jerk[i]);
+        level[i] = (nj>0.)?reb_integrator_hermite_level(dt_max, ri_hermite->eta_start*na/nj):0;
+        if (level[i] > REB_HERMITE_MAX_LEVEL){
+            level[i] = REB_HERMITE_MAX_LEVEL;
+            level_exceeded = 1;
+        }
+    }
+
+    int64_t t_now = 0;
+    while (t_now < t_end){
+        // Find the next block time and all particles which have to be advanced to it.
+        int64_t t_next = t_end;
+        for (int i=0; i<N; i++){
+            const int64_t ti = t[i] + reb_integrator_hermite_ticks(level[i]);
+            if (ti < t_next){
+                t_next = ti;
+            }
+        }
+        int N_active_list = 0;
+        for (int i=0; i<N; i++){
+            if (t[i] + reb_integrator_hermite_ticks(level[i]) == t_next){
+                active[N_active_list++] = i;
+            }
+        }
+
+        // Predict all particles to t_next. Times are multiples of 2^-REB_HERMITE_MAX_LEVEL, so this is exact.
+        for (int i=0; i<N; i++){
+            const double h = ldexp((double)(t_next - t[i]), -REB_HERMITE_MAX_LEVEL)*dt;
+            const double h2 = h*h/2.;
+            const double h3 = h2*h/3.;
+            p_pred[i].x  = particles[i].x  + h*particles[i].vx + h2*particles[i].ax + h3*jerk[i].x;
+            p_pred[i].y  = particles[i].y  + h*particles[i].vy + h2*particles[i].ay + h3*jerk[i].y;
+            p_pred[i].z  = particles[i].z  + h*particles[i].vz + h2*particles[i].az + h3*jerk[i].z;
+            p_pred[i].vx = particles[i].vx + h*particles[i].ax + h2*jerk[i].x;
+            p_pred[i].vy = particles[i].vy + h*particles[i].ay + h2*jerk[i].y;
+            p_pred[i].vz = particles[i].vz + h*particles[i].az + h2*jerk[i].z;
+        }
+
+        reb_integrator_hermite_forces(r, N_active_list);
+
+        // Correct the active particles and choose their next timestep.
+#pragma omp parallel for schedule(guided) reduction(|:level_exceeded)
+        for (int k=0; k<N_active_list; k++){
+            const int i = active[k];
+            const double h = ldexp((double)(t_next - t[i]), -REB_HERMITE_MAX_LEVEL)*dt;
+            const struct reb_vec3d a0 = {particles[i].ax, particles[i].ay, particles[i].az};
+            const struct reb_vec3d a1 = {p_pred[i].ax, p_pred[i].ay, p_pred[i].az};
+            const struct reb_vec3d j0 = jerk[i];
+            const struct reb_vec3d j1 = jerk_pred[i];
+
+            const double vx = particles[i].vx + h/2.*(a0.x + a1.x) + h*h/12.*(j0.x - j1.x);
+            const double vy = particles[i].vy + h/2.*(a0.y + a1.y) + h*h/12.*(j0.y - j1.y);
+            const double vz = particles[i].vz + h/2.*(a0.z + a1.z) + h*h/12.*(j0.z - j1.z);
+            particles[i].x += h/2.*(particles[i].vx + vx) + h*h/12.*(a0.x - a1.x);
+            particles[i].y += h/2.*(particles[i].vy + vy) + h*h/12.*(a0.y - a1.y);
+            particles[i].z += h/2.*(particles[i].vz + vz) + h*h/12.*(a0.z - a1.z);
+            particles[i].vx = vx;
+            particles[i].vy = vy;
+            particles[i].vz = vz;
+            particles[i].ax = a1.x;
+            particles[i].ay = a1.y;
+            particles[i].az = a1.z;
+            jerk[i] = j1;
+            t[i] = t_next;
+
+            // Aarseth criterion. Second and third derivatives from the Hermite interpolation.
+            const double h2i = 1./(h*h);
+            const double h3i = h2i/h;
+            const struct reb_vec3d a3 = {
+                (12.*(a0.x - a1.x) + 6.*h*(j0.x + j1.x))*h3i,
+                (12.*(a0.y - a1.y) + 6.*h*(j0.y + j1.y))*h3i,
+                (12.*(a0.z - a1.z) + 6.*h*(j0.z + j1.z))*h3i};
+            const struct reb_vec3d a2 = {
+                (-6.*(a0.x - a1.x) - h*(4.*j0.x + 2.*j1.x))*h2i + h*a3.x,
+                (-6.*(a0.y - a1.y) - h*(4.*j0.y + 2.*j1.y))*h2i + h*a3.y,
+                (-6.*(a0.z - a1.z) - h*(4.*j0.z + 2.*j1.z))*h2i + h*a3.z};
+            const double na1 = reb_integrator_hermite_norm(a1);
+            const double nj1 = reb_integrator_hermite_norm(j1);
+            const double na2 = reb_integrator_hermite_norm(a2);
+            const double na3 = reb_integrator_hermite_norm(a3);
+            const double denominator = nj1*na3 + na2*na2;
+            // If all derivatives vanish, the particle does not feel any force and the largest timestep is used.
+            const int level_crit = (denominator>0.)?reb_integrator_hermite_level(dt_max, sqrt(eta*(na1*na2 + nj1*nj1)/denominator)):0;
+            if (level_crit > level[i]){
+                level[i] = level_crit;
+                if (level[i] > REB_HERMITE_MAX_LEVEL){
+                    level[i] = REB_HERMITE_MAX_LEVEL;
+                    level_exceeded = 1;
+                }
+            }else if (level_crit < level[i] && t_next % reb_integrator_hermite_ticks(level[i]-1) == 0){
+                // Timesteps can only grow by a factor of two and only if they stay aligned with the blocks.
+                level[i]--;
+            }
+        }
+        ri_hermite->particle_steps += N_active_list;
+        t_now = t_next;
+    }
+
+    if (level_exceeded && ri_hermite->level_warning==0){
+        ri_hermite->level_warning = 1;
+        reb_warning(r, "HERMITE reached the smallest possible timestep. The integration might not be accurate.");
+    }
+
+    r->t += dt;
+    r->dt_last_done = dt;
+}
+
+void reb_integrator_hermite_synchronize(struct reb_simulation* r){
+    // Do nothing. Particles are synchronized after every timestep.
+}
+
+void reb_integrator_hermite_reset(struct reb_simulation* r){
+    struct reb_simulation_integrator_hermite* const ri_hermite = &(r->ri_hermite);
+    ri_hermite->eta = 0.02;
+    ri_hermite->eta_start = 0.01;
+    ri_hermite->particle_steps = 0;
+    ri_hermite->level_warning = 0;
+    ri_hermite->additional_forces_warning = 0;
+    ri_hermite->allocated_N = 0;
+    free(ri_hermite->p_pred);
+    ri_hermite->p_pred = NULL;
+    free(ri_hermite->jerk);
+    ri_hermite->jerk = NULL;
+    free(ri_hermite->jerk_pred);
+    ri_hermite->jerk_pred = NULL;
+    free(ri_hermite->level);
+    ri_hermite->level = NULL;
+    free(ri_hermite->t);
+    ri_hermite->t = NULL;
+    free(ri_hermite->active);
+    ri_hermite->active = NULL;
+}
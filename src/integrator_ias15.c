@@ -52,6 +52,9 @@ void integrator_generate_constants(void);
 #include "tools.h"
 #include "integrator.h"
 #include "integrator_ias15.h"
+#include "profiling.h"
+#include "forces.h"
+#include "allocator.h"
 
 /**
  * @brief Struct containing pointers to intermediate values
@@ -98,13 +101,13 @@ static double sqrt7(double a){
 }
 
 static void free_dp7(struct reb_dp7* dp7){
-    free(dp7->p0);
-    free(dp7->p1);
-    free(dp7->p2);
-    free(dp7->p3);
-    free(dp7->p4);
-    free(dp7->p5);
-    free(dp7->p6);
+    reb_free(dp7->p0);
+    reb_free(dp7->p1);
+    reb_free(dp7->p2);
+    reb_free(dp7->p3);
+    reb_free(dp7->p4);
+    reb_free(dp7->p5);
+    reb_free(dp7->p6);
     dp7->p0 = NULL;
     dp7->p1 = NULL;
     dp7->p2 = NULL;
@@ -125,13 +128,13 @@ static void clear_dp7(struct reb_dp7* const dp7, const int N3){
     }
 }
 static void realloc_dp7(struct reb_dp7* const dp7, const int N3){
-    dp7->p0 = realloc(dp7->p0,sizeof(double)*N3);
-    dp7->p1 = realloc(dp7->p1,sizeof(double)*N3);
-    dp7->p2 = realloc(dp7->p2,sizeof(double)*N3);
-    dp7->p3 = realloc(dp7->p3,sizeof(double)*N3);
-    dp7->p4 = realloc(dp7->p4,sizeof(double)*N3);
-    dp7->p5 = realloc(dp7->p5,sizeof(double)*N3);
-    dp7->p6 = realloc(dp7->p6,sizeof(double)*N3);
+    dp7->p0 = reb_reserve(dp7->p0,sizeof(double)*N3);
+    dp7->p1 = reb_reserve(dp7->p1,sizeof(double)*N3);
+    dp7->p2 = reb_reserve(dp7->p2,sizeof(double)*N3);
+    dp7->p3 = reb_reserve(dp7->p3,sizeof(double)*N3);
+    dp7->p4 = reb_reserve(dp7->p4,sizeof(double)*N3);
+    dp7->p5 = reb_reserve(dp7->p5,sizeof(double)*N3);
+    dp7->p6 = reb_reserve(dp7->p6,sizeof(double)*N3);
     clear_dp7(dp7,N3);
 }
 
@@ -169,13 +172,13 @@ void reb_integrator_ias15_alloc(struct reb_simulation* r){
         realloc_dp7(&(r->ri_ias15.e),N3);
         realloc_dp7(&(r->ri_ias15.br),N3);
         realloc_dp7(&(r->ri_ias15.er),N3);
-        r->ri_ias15.at = realloc(r->ri_ias15.at,sizeof(double)*N3);
-        r->ri_ias15.x0 = realloc(r->ri_ias15.x0,sizeof(double)*N3);
-        r->ri_ias15.v0 = realloc(r->ri_ias15.v0,sizeof(double)*N3);
-        r->ri_ias15.a0 = realloc(r->ri_ias15.a0,sizeof(double)*N3);
-        r->ri_ias15.csx= realloc(r->ri_ias15.csx,sizeof(double)*N3);
-        r->ri_ias15.csv= realloc(r->ri_ias15.csv,sizeof(double)*N3);
-        r->ri_ias15.csa0 = realloc(r->ri_ias15.csa0,sizeof(double)*N3);
+        r->ri_ias15.at = reb_realloc(r->ri_ias15.at,sizeof(double)*N3);
+        r->ri_ias15.x0 = reb_realloc(r->ri_ias15.x0,sizeof(double)*N3);
+        r->ri_ias15.v0 = reb_realloc(r->ri_ias15.v0,sizeof(double)*N3);
+        r->ri_ias15.a0 = reb_realloc(r->ri_ias15.a0,sizeof(double)*N3);
+        r->ri_ias15.csx= reb_realloc(r->ri_ias15.csx,sizeof(double)*N3);
+        r->ri_ias15.csv= reb_realloc(r->ri_ias15.csv,sizeof(double)*N3);
+        r->ri_ias15.csa0 = reb_realloc(r->ri_ias15.csa0,sizeof(double)*N3);
         double* restrict const csx = r->ri_ias15.csx; 
         double* restrict const csv = r->ri_ias15.csv; 
         for (int i=0;i<N3;i++){
@@ -195,6 +198,275 @@ void reb_integrator_ias15_alloc(struct reb_simulation* r){
 
 }
  
+/**
+ * @brief Minimum number of coordinates (3N) for which the loops over all particles are run in parallel with OpenMP.
+ */
+#define REB_IAS15_OMP_N3_MIN 6144
+
+// The following functions contain the loops over all coordinates. The dp7 structs are passed by 
+// value so that the compiler can make use of the restrict qualifiers and vectorize the loops.
+
+/**
+ * @brief Calculates the g values from the b values at the beginning of a step.
+ */
+static void calculate_g(const int N3, const struct reb_dpconst7 g, const struct reb_dpconst7 b){
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+    for(int k=0;k<N3;k++) {
+        g.p0[k] = b.p6[k]*d[15] + b.p5[k]*d[10] + b.p4[k]*d[6] + b.p3[k]*d[3]  + b.p2[k]*d[1]  + b.p1[k]*d[0]  + b.p0[k];
+        g.p1[k] = b.p6[k]*d[16] + b.p5[k]*d[11] + b.p4[k]*d[7] + b.p3[k]*d[4]  + b.p2[k]*d[2]  + b.p1[k];
+        g.p2[k] = b.p6[k]*d[17] + b.p5[k]*d[12] + b.p4[k]*d[8] + b.p3[k]*d[5]  + b.p2[k];
+        g.p3[k] = b.p6[k]*d[18] + b.p5[k]*d[13] + b.p4[k]*d[9] + b.p3[k];
+        g.p4[k] = b.p6[k]*d[19] + b.p5[k]*d[14] + b.p4[k];
+        g.p5[k] = b.p6[k]*d[20] + b.p5[k];
+        g.p6[k] = b.p6[k];
+    }
+}
+
+/**
+ * @brief Predicts positions (relative to x0) at substep n using the b values.
+ * @param xk Output array, 3N values.
+ */
+REB_TARGET_CLONES static void predict_positions(const int N3, const int n, const double dt, double* restrict const xk, const double* restrict const csx, const double* restrict const a0, const double* restrict const v0, const struct reb_dpconst7 b){
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+    for(int k=0;k<N3;k++) {
+        xk[k] = -csx[k] + ((((((((b.p6[k]*7.*h[n]/9. + b.p5[k])*3.*h[n]/4. + b.p4[k])*5.*h[n]/7. + b.p3[k])*2.*h[n]/3. + b.p2[k])*3.*h[n]/5. + b.p1[k])*h[n]/2. + b.p0[k])*h[n]/3. + a0[k])*dt*h[n]/2. + v0[k])*dt*h[n];
+    }
+}
+
+/**
+ * @brief Predicts velocities (relative to v0) at substep n using the b values.
+ * @param vk Output array, 3N values.
+ */
+REB_TARGET_CLONES static void predict_velocities(const int N3, const int n, const double dt, double* restrict const vk, const double* restrict const csv, const double* restrict const a0, const struct reb_dpconst7 b){
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+    for(int k=0;k<N3;k++) {
+        vk[k] =  -csv[k] + (((((((b.p6[k]*7.*h[n]/8. + b.p5[k])*6.*h[n]/7. + b.p4[k])*5.*h[n]/6. + b.p3[k])*4.*h[n]/5. + b.p2[k])*3.*h[n]/4. + b.p1[k])*2.*h[n]/3. + b.p0[k])*h[n]/2. + a0[k])*dt*h[n];
+    }
+}
+
+/**
+ * @brief Improves the b and g values using the accelerations at substep n.
+ * @param predictor_corrector_error Updated with the maximum change of b.p6 relative to the accelerations (only for n==7).
+ */
+REB_TARGET_CLONES static void correct_b(const int N3, const int n, const int epsilon_global, double* const predictor_corrector_error, const double* restrict const at, const double* restrict const a0, const double* restrict const csa0, const double* restrict const gravity_cs, const struct reb_dpconst7 g, const struct reb_dpconst7 b, const struct reb_dpconst7 csb){
+    switch (n) {
+        case 1: 
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+            for(int k=0;k<N3;++k) {
+                double tmp = g.p0[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p0[k]  = gk/rr[0];
+                add_cs(&(b.p0[k]), &(csb.p0[k]), g.p0[k]-tmp);
+            } break;
+        case 2: 
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+            for(int k=0;k<N3;++k) {
+                double tmp = g.p1[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p1[k] = (gk/rr[1] - g.p0[k])/rr[2];
+                tmp = g.p1[k] - tmp;
+                add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[0]);
+                add_cs(&(b.p1[k]), &(csb.p1[k]), tmp);
+            } break;
+        case 3: 
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+            for(int k=0;k<N3;++k) {
+                double tmp = g.p2[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p2[k] = ((gk/rr[3] - g.p0[k])/rr[4] - g.p1[k])/rr[5];
+                tmp = g.p2[k] - tmp;
+                add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[1]);
+                add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[2]);
+                add_cs(&(b.p2[k]), &(csb.p2[k]), tmp);
+            } break;
+        case 4:
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+            for(int k=0;k<N3;++k) {
+                double tmp = g.p3[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p3[k] = (((gk/rr[6] - g.p0[k])/rr[7] - g.p1[k])/rr[8] - g.p2[k])/rr[9];
+                tmp = g.p3[k] - tmp;
+                add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[3]);
+                add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[4]);
+                add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[5]);
+                add_cs(&(b.p3[k]), &(csb.p3[k]), tmp);
+            } break;
+        case 5:
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+            for(int k=0;k<N3;++k) {
+                double tmp = g.p4[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p4[k] = ((((gk/rr[10] - g.p0[k])/rr[11] - g.p1[k])/rr[12] - g.p2[k])/rr[13] - g.p3[k])/rr[14];
+                tmp = g.p4[k] - tmp;
+                add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[6]);
+                add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[7]);
+                add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[8]);
+                add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[9]);
+                add_cs(&(b.p4[k]), &(csb.p4[k]), tmp);
+            } break;
+        case 6:
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+            for(int k=0;k<N3;++k) {
+                double tmp = g.p5[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p5[k] = (((((gk/rr[15] - g.p0[k])/rr[16] - g.p1[k])/rr[17] - g.p2[k])/rr[18] - g.p3[k])/rr[19] - g.p4[k])/rr[20];
+                tmp = g.p5[k] - tmp;
+                add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[10]);
+                add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[11]);
+                add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[12]);
+                add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[13]);
+                add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[14]);
+                add_cs(&(b.p5[k]), &(csb.p5[k]), tmp);
+            } break;
+        case 7:
+        {
+            double maxak = 0.0;
+            double maxb6ktmp = 0.0;
+            double error = *predictor_corrector_error;
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN) reduction(max:maxak,maxb6ktmp,error)
+            for(int k=0;k<N3;++k) {
+                double tmp = g.p6[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p6[k] = ((((((gk/rr[21] - g.p0[k])/rr[22] - g.p1[k])/rr[23] - g.p2[k])/rr[24] - g.p3[k])/rr[25] - g.p4[k])/rr[26] - g.p5[k])/rr[27];
+                tmp = g.p6[k] - tmp;    
+                add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[15]);
+                add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[16]);
+                add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[17]);
+                add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[18]);
+                add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[19]);
+                add_cs(&(b.p5[k]), &(csb.p5[k]), tmp * c[20]);
+                add_cs(&(b.p6[k]), &(csb.p6[k]), tmp);
+                
+                // Monitor change in b.p6[k] relative to at[k]. The predictor corrector scheme is converged if it is close to 0.
+                if (epsilon_global){
+                    const double ak  = fabs(at[k]);
+                    if (isnormal(ak) && ak>maxak){
+                        maxak = ak;
+                    }
+                    const double b6ktmp = fabs(tmp);  // change of b6ktmp coefficient
+                    if (isnormal(b6ktmp) && b6ktmp>maxb6ktmp){
+                        maxb6ktmp = b6ktmp;
+                    }
+                }else{
+                    const double ak  = at[k];
+                    const double b6ktmp = tmp; 
+                    const double errork = fabs(b6ktmp/ak);
+                    if (isnormal(errork) && errork>error){
+                        error = errork;
+                    }
+                }
+            } 
+            if (epsilon_global){
+                error = maxb6ktmp/maxak;
+            }
+            *predictor_corrector_error = error;
+            
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Calculates the positions and velocities at the end of the step, using compensated summation.
+ */
+static void update_positions_and_velocities(const int N3, const double dt_done, double* restrict const x0, double* restrict const v0, double* restrict const csx, double* restrict const csv, const double* restrict const a0, const struct reb_dpconst7 b){
+#pragma omp parallel for simd if(N3>=REB_IAS15_OMP_N3_MIN)
+    for(int k=0;k<N3;++k) {
+        // Note: dt_done*dt_done is not precalculated to avoid 
+        //       biased round-off errors when a fixed timestep is used.
+        add_cs(&(x0[k]), &(csx[k]), b.p6[k]/72.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), b.p5[k]/56.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), b.p4[k]/42.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), b.p3[k]/30.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), b.p2[k]/20.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), b.p1[k]/12.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), b.p0[k]/6.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), a0[k]/2.*dt_done*dt_done);
+        add_cs(&(x0[k]), &(csx[k]), v0[k]*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), b.p6[k]/8.*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), b.p5[k]/7.*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), b.p4[k]/6.*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), b.p3[k]/5.*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), b.p2[k]/4.*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), b.p1[k]/3.*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), b.p0[k]/2.*dt_done);
+        add_cs(&(v0[k]), &(csv[k]), a0[k]*dt_done);
+    }
+}
+
+/**
+ * @brief Checks if gravity can be reused between iterations of the predictor corrector loop.
+ * @details Gravity depends on the positions only. If the predicted positions at a substep 
+ * are bitwise identical to those of the previous iteration, the accelerations are the same
+ * and only the additional (possibly velocity dependent) forces need to be recalculated.
+ * This is typically the case in the last iterations before convergence.
+ */
+static int reb_integrator_ias15_gravity_reusable(const struct reb_simulation* const r){
+#ifdef MPI
+    return 0; // Skipping the force calculation on some nodes only would break the communication.
+#else // MPI
+    return r->ri_ias15.reuse_gravity
+        && r->integrator==REB_INTEGRATOR_IAS15      // MERCURIUS: gravity also depends on particles outside the map
+        && r->gravity!=REB_GRAVITY_COMPENSATED;     // gravity_cs is not cached
+#endif // MPI
+}
+
+/**
+ * @brief Calculates gravity at the current positions or reuses the accelerations stored in ac
+ * if the positions are the same as those stored in xc. Returns 1 if gravity was reused.
+ */
+static int reb_integrator_ias15_update_gravity_cached(struct reb_simulation* r, const int N, const int cached, double* restrict const xc, double* restrict const ac){
+    struct reb_particle* restrict const particles = r->particles;
+    if (cached){
+        int unchanged = 1;
+        for(int i=0;i<N;i++) {
+            if (particles[i].x!=xc[3*i+0] || particles[i].y!=xc[3*i+1] || particles[i].z!=xc[3*i+2]){
+                unchanged = 0;
+                break;
+            }
+        }
+        if (unchanged){
+            for(int i=0;i<N;i++) {
+                particles[i].ax = ac[3*i+0];
+                particles[i].ay = ac[3*i+1];
+                particles[i].az = ac[3*i+2];
+            }
+            return 1;
+        }
+    }
+    reb_update_acceleration_gravity(r);
+    for(int i=0;i<N;i++) {
+        xc[3*i+0] = particles[i].x;
+        xc[3*i+1] = particles[i].y;
+        xc[3*i+2] = particles[i].z;
+        ac[3*i+0] = particles[i].ax;
+        ac[3*i+1] = particles[i].ay;
+        ac[3*i+2] = particles[i].az;
+    }
+    return 0;
+}
+
 // Does the actual timestep.
 static int reb_integrator_ias15_step(struct reb_simulation* r) {
     reb_integrator_ias15_alloc(r);
@@ -267,15 +539,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         csb.p6[k] = 0.;
     }
 
-    for(int k=0;k<N3;k++) {
-        g.p0[k] = b.p6[k]*d[15] + b.p5[k]*d[10] + b.p4[k]*d[6] + b.p3[k]*d[3]  + b.p2[k]*d[1]  + b.p1[k]*d[0]  + b.p0[k];
-        g.p1[k] = b.p6[k]*d[16] + b.p5[k]*d[11] + b.p4[k]*d[7] + b.p3[k]*d[4]  + b.p2[k]*d[2]  + b.p1[k];
-        g.p2[k] = b.p6[k]*d[17] + b.p5[k]*d[12] + b.p4[k]*d[8] + b.p3[k]*d[5]  + b.p2[k];
-        g.p3[k] = b.p6[k]*d[18] + b.p5[k]*d[13] + b.p4[k]*d[9] + b.p3[k];
-        g.p4[k] = b.p6[k]*d[19] + b.p5[k]*d[14] + b.p4[k];
-        g.p5[k] = b.p6[k]*d[20] + b.p5[k];
-        g.p6[k] = b.p6[k];
-    }
+    calculate_g(N3, g, b);
 
     double integrator_megno_thisdt = 0.;
     double integrator_megno_thisdt_init = 0.;
@@ -283,6 +547,14 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         integrator_megno_thisdt_init = w[0]* r->t * reb_tools_megno_deltad_delta(r);
     }
 
+    const int reuse_gravity = reb_integrator_ias15_gravity_reusable(r);
+    int gravity_cached[8] = {0};    // Substeps for which the cache contains values from this step
+    if (reuse_gravity && N3 > r->ri_ias15.gravity_cache_allocatedN){
+        r->ri_ias15.gravity_cache_x = realloc(r->ri_ias15.gravity_cache_x,sizeof(double)*7*N3);
+        r->ri_ias15.gravity_cache_a = realloc(r->ri_ias15.gravity_cache_a,sizeof(double)*7*N3);
+        r->ri_ias15.gravity_cache_allocatedN = N3;
+    }
+
     double t_beginning = r->t;
     double predictor_corrector_error = 1e300;
     double predictor_corrector_error_last = 2;
@@ -292,6 +564,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
     //   1) predictor_corrector_error better than 1e-16 
     //   2) predictor_corrector_error starts to oscillate
     //   3) more than 12 iterations
+    PROFILING_START(r)
     while(1){
         if(predictor_corrector_error<1e-16){
             break;
@@ -316,44 +589,40 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         for(int n=1;n<8;n++) {                          // Loop over interval using Gauss-Radau spacings
             r->t = t_beginning + r->dt * h[n];
 
-            // Prepare particles arrays for force calculation
-            for(int i=0;i<N;i++) {                      // Predict positions at interval n using b values
+            // Prepare particles arrays for force calculation.
+            // The at array is used as temporary storage, it is overwritten after the force calculation.
+            predict_positions(N3, n, r->dt, at, csx, a0, v0, b);    // Predict positions at interval n using b values
+#pragma omp parallel for if(N3>=REB_IAS15_OMP_N3_MIN)
+            for(int i=0;i<N;i++) {
                 int mi = map[i];
-                const int k0 = 3*i+0;
-                const int k1 = 3*i+1;
-                const int k2 = 3*i+2;
-
-                double xk0;
-                double xk1;
-                double xk2;
-                xk0 = -csx[k0] + ((((((((b.p6[k0]*7.*h[n]/9. + b.p5[k0])*3.*h[n]/4. + b.p4[k0])*5.*h[n]/7. + b.p3[k0])*2.*h[n]/3. + b.p2[k0])*3.*h[n]/5. + b.p1[k0])*h[n]/2. + b.p0[k0])*h[n]/3. + a0[k0])*r->dt*h[n]/2. + v0[k0])*r->dt*h[n];
-                xk1 = -csx[k1] + ((((((((b.p6[k1]*7.*h[n]/9. + b.p5[k1])*3.*h[n]/4. + b.p4[k1])*5.*h[n]/7. + b.p3[k1])*2.*h[n]/3. + b.p2[k1])*3.*h[n]/5. + b.p1[k1])*h[n]/2. + b.p0[k1])*h[n]/3. + a0[k1])*r->dt*h[n]/2. + v0[k1])*r->dt*h[n];
-                xk2 = -csx[k2] + ((((((((b.p6[k2]*7.*h[n]/9. + b.p5[k2])*3.*h[n]/4. + b.p4[k2])*5.*h[n]/7. + b.p3[k2])*2.*h[n]/3. + b.p2[k2])*3.*h[n]/5. + b.p1[k2])*h[n]/2. + b.p0[k2])*h[n]/3. + a0[k2])*r->dt*h[n]/2. + v0[k2])*r->dt*h[n];
-                particles[mi].x = xk0 + x0[k0];
-                particles[mi].y = xk1 + x0[k1];
-                particles[mi].z = xk2 + x0[k2];
+                particles[mi].x = at[3*i+0] + x0[3*i+0];
+                particles[mi].y = at[3*i+1] + x0[3*i+1];
+                particles[mi].z = at[3*i+2] + x0[3*i+2];
             }
-            if (r->calculate_megno || (r->additional_forces && r->force_is_velocity_dependent)){
-                for(int i=0;i<N;i++) {                  // Predict velocities at interval n using b values
+            if (r->calculate_megno || (reb_forces_used(r) && r->force_is_velocity_dependent)){
+                predict_velocities(N3, n, r->dt, at, csv, a0, b);  // Predict velocities at interval n using b values
+#pragma omp parallel for if(N3>=REB_IAS15_OMP_N3_MIN)
+                for(int i=0;i<N;i++) {
                     int mi = map[i];
-                    const int k0 = 3*i+0;
-                    const int k1 = 3*i+1;
-                    const int k2 = 3*i+2;
-
-                    double vk0;
-                    double vk1;
-                    double vk2;
-                    vk0 =  -csv[k0] + (((((((b.p6[k0]*7.*h[n]/8. + b.p5[k0])*6.*h[n]/7. + b.p4[k0])*5.*h[n]/6. + b.p3[k0])*4.*h[n]/5. + b.p2[k0])*3.*h[n]/4. + b.p1[k0])*2.*h[n]/3. + b.p0[k0])*h[n]/2. + a0[k0])*r->dt*h[n];
-                    vk1 =  -csv[k1] + (((((((b.p6[k1]*7.*h[n]/8. + b.p5[k1])*6.*h[n]/7. + b.p4[k1])*5.*h[n]/6. + b.p3[k1])*4.*h[n]/5. + b.p2[k1])*3.*h[n]/4. + b.p1[k1])*2.*h[n]/3. + b.p0[k1])*h[n]/2. + a0[k1])*r->dt*h[n];
-                    vk2 =  -csv[k2] + (((((((b.p6[k2]*7.*h[n]/8. + b.p5[k2])*6.*h[n]/7. + b.p4[k2])*5.*h[n]/6. + b.p3[k2])*4.*h[n]/5. + b.p2[k2])*3.*h[n]/4. + b.p1[k2])*2.*h[n]/3. + b.p0[k2])*h[n]/2. + a0[k2])*r->dt*h[n];
-                    particles[mi].vx = vk0 + v0[k0];
-                    particles[mi].vy = vk1 + v0[k1];
-                    particles[mi].vz = vk2 + v0[k2];
+                    particles[mi].vx = at[3*i+0] + v0[3*i+0];
+                    particles[mi].vy = at[3*i+1] + v0[3*i+1];
+                    particles[mi].vz = at[3*i+2] + v0[3*i+2];
                 }
             }
 
-
-            reb_update_acceleration(r);             // Calculate forces at interval n
+            if (reuse_gravity){
+                PROFILING_START(r)
+                double* const xc = r->ri_ias15.gravity_cache_x + (n-1)*N3;
+                double* const ac = r->ri_ias15.gravity_cache_a + (n-1)*N3;
+                if (reb_integrator_ias15_update_gravity_cached(r, N, gravity_cached[n], xc, ac)){
+                    r->counters.ias15_gravity_reused++;
+                }
+                gravity_cached[n] = 1;
+                reb_update_acceleration_forces(r);
+                PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
+            }else{
+                reb_update_acceleration(r);         // Calculate forces at interval n
+            }
             if (r->calculate_megno){
                 integrator_megno_thisdt += w[n] * r->t * reb_tools_megno_deltad_delta(r);
             }
@@ -364,135 +633,11 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
                 at[3*k+1] = particles[mk].ay;  
                 at[3*k+2] = particles[mk].az;
             }
-            switch (n) {                            // Improve b and g values
-                case 1: 
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p0[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p0[k]  = gk/rr[0];
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), g.p0[k]-tmp);
-                    } break;
-                case 2: 
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p1[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p1[k] = (gk/rr[1] - g.p0[k])/rr[2];
-                        tmp = g.p1[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[0]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp);
-                    } break;
-                case 3: 
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p2[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p2[k] = ((gk/rr[3] - g.p0[k])/rr[4] - g.p1[k])/rr[5];
-                        tmp = g.p2[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[1]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[2]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp);
-                    } break;
-                case 4:
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p3[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p3[k] = (((gk/rr[6] - g.p0[k])/rr[7] - g.p1[k])/rr[8] - g.p2[k])/rr[9];
-                        tmp = g.p3[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[3]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[4]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[5]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp);
-                    } break;
-                case 5:
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p4[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p4[k] = ((((gk/rr[10] - g.p0[k])/rr[11] - g.p1[k])/rr[12] - g.p2[k])/rr[13] - g.p3[k])/rr[14];
-                        tmp = g.p4[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[6]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[7]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[8]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[9]);
-                        add_cs(&(b.p4[k]), &(csb.p4[k]), tmp);
-                    } break;
-                case 6:
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p5[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p5[k] = (((((gk/rr[15] - g.p0[k])/rr[16] - g.p1[k])/rr[17] - g.p2[k])/rr[18] - g.p3[k])/rr[19] - g.p4[k])/rr[20];
-                        tmp = g.p5[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[10]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[11]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[12]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[13]);
-                        add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[14]);
-                        add_cs(&(b.p5[k]), &(csb.p5[k]), tmp);
-                    } break;
-                case 7:
-                {
-                    double maxak = 0.0;
-                    double maxb6ktmp = 0.0;
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p6[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p6[k] = ((((((gk/rr[21] - g.p0[k])/rr[22] - g.p1[k])/rr[23] - g.p2[k])/rr[24] - g.p3[k])/rr[25] - g.p4[k])/rr[26] - g.p5[k])/rr[27];
-                        tmp = g.p6[k] - tmp;    
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[15]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[16]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[17]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[18]);
-                        add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[19]);
-                        add_cs(&(b.p5[k]), &(csb.p5[k]), tmp * c[20]);
-                        add_cs(&(b.p6[k]), &(csb.p6[k]), tmp);
-                        
-                        // Monitor change in b.p6[k] relative to at[k]. The predictor corrector scheme is converged if it is close to 0.
-                        if (r->ri_ias15.epsilon_global){
-                            const double ak  = fabs(at[k]);
-                            if (isnormal(ak) && ak>maxak){
-                                maxak = ak;
-                            }
-                            const double b6ktmp = fabs(tmp);  // change of b6ktmp coefficient
-                            if (isnormal(b6ktmp) && b6ktmp>maxb6ktmp){
-                                maxb6ktmp = b6ktmp;
-                            }
-                        }else{
-                            const double ak  = at[k];
-                            const double b6ktmp = tmp; 
-                            const double errork = fabs(b6ktmp/ak);
-                            if (isnormal(errork) && errork>predictor_corrector_error){
-                                predictor_corrector_error = errork;
-                            }
-                        }
-                    } 
-                    if (r->ri_ias15.epsilon_global){
-                        predictor_corrector_error = maxb6ktmp/maxak;
-                    }
-                    
-                    break;
-                }
-            }
+            correct_b(N3, n, r->ri_ias15.epsilon_global, &predictor_corrector_error, at, a0, csa0, (double*)gravity_cs, g, b, csb);
         }
     }
+    PROFILING_STOP(r, REB_PROFILING_CAT_IAS15_ITERATIONS)
+    r->counters.ias15_iterations += iterations;
     // Set time back to initial value (will be updated below) 
     r->t = t_beginning;
     // Find new timestep
@@ -574,7 +719,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
                 double ratio = r->dt/r->dt_last_done;
                 predict_next_step(ratio, N3, er, br, e, b);
             }
-            
+            r->counters.ias15_steps_rejected++;
             return 0; // Step rejected. Do again. 
         }       
         if (fabs(dt_new/dt_done) > 1.0) {   // New timestep is larger.
@@ -583,29 +728,23 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         r->dt = dt_new;
     }
 
-    // Find new position and velocity values at end of the sequence
-    for(int k=0;k<N3;++k) {
-        // Note: dt_done*dt_done is not precalculated to avoid 
-        //       biased round-off errors when a fixed timestep is used.
-        add_cs(&(x0[k]), &(csx[k]), b.p6[k]/72.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), b.p5[k]/56.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), b.p4[k]/42.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), b.p3[k]/30.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), b.p2[k]/20.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), b.p1[k]/12.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), b.p0[k]/6.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), a0[k]/2.*dt_done*dt_done);
-        add_cs(&(x0[k]), &(csx[k]), v0[k]*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), b.p6[k]/8.*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), b.p5[k]/7.*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), b.p4[k]/6.*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), b.p3[k]/5.*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), b.p2[k]/4.*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), b.p1[k]/3.*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), b.p0[k]/2.*dt_done);
-        add_cs(&(v0[k]), &(csv[k]), a0[k]*dt_done);
+    if (r->integrator==REB_INTEGRATOR_IAS15){
+        // Keep the initial values for dense output. The b values of this step are kept in br.
+        if (N3 > r->ri_ias15.dense_allocatedN){
+            r->ri_ias15.dense_x0 = realloc(r->ri_ias15.dense_x0,sizeof(double)*N3);
+            r->ri_ias15.dense_v0 = realloc(r->ri_ias15.dense_v0,sizeof(double)*N3);
+            r->ri_ias15.dense_allocatedN = N3;
+        }
+        memcpy(r->ri_ias15.dense_x0, x0, sizeof(double)*N3);
+        memcpy(r->ri_ias15.dense_v0, v0, sizeof(double)*N3);
+        r->ri_ias15.dense_N = N;
+        r->ri_ias15.dense_t0 = r->t;
+        r->ri_ias15.dense_dt = dt_done;
     }
 
+    // Find new position and velocity values at end of the sequence
+    update_positions_and_velocities(N3, dt_done, x0, v0, csx, csv, a0, b);
+
     r->t += dt_done;
     r->dt_last_done = dt_done;
 
@@ -712,8 +851,50 @@ void reb_integrator_ias15_part2(struct reb_simulation* r){
 
 void reb_integrator_ias15_synchronize(struct reb_simulation* r){
 }
+
+int reb_integrator_ias15_dense_output(const struct reb_simulation* const r, const double t, struct reb_particle* const particles){
+    const int N = r->N;
+    if (r->integrator!=REB_INTEGRATOR_IAS15 || r->ri_ias15.dense_N==0 || r->ri_ias15.dense_N!=N){
+        return 1; // No step with the current particles done yet.
+    }
+    const double t0 = r->ri_ias15.dense_t0;
+    const double dt = r->ri_ias15.dense_dt;
+    const double hn = (t-t0)/dt;
+    // Allow for round-off errors at both ends of the step.
+    if (!(hn>=-1e-14 && hn<=1.+1e-14)){
+        return 2;
+    }
+    const double* restrict const x0 = r->ri_ias15.dense_x0;
+    const double* restrict const v0 = r->ri_ias15.dense_v0;
+    const double* restrict const a0 = r->ri_ias15.a0;
+    // After a step has been accepted, br contains its b values (b itself contains the prediction for the next step).
+    const struct reb_dpconst7 b = dpcast(r->ri_ias15.br);
+    const int N3 = 3*N;
+    double* xk = malloc(sizeof(double)*N3);
+    double* vk = malloc(sizeof(double)*N3);
+    for(int k=0;k<N3;k++) {
+        xk[k] = x0[k] + ((((((((b.p6[k]*7.*hn/9. + b.p5[k])*3.*hn/4. + b.p4[k])*5.*hn/7. + b.p3[k])*2.*hn/3. + b.p2[k])*3.*hn/5. + b.p1[k])*hn/2. + b.p0[k])*hn/3. + a0[k])*dt*hn/2. + v0[k])*dt*hn;
+        vk[k] = v0[k] + (((((((b.p6[k]*7.*hn/8. + b.p5[k])*6.*hn/7. + b.p4[k])*5.*hn/6. + b.p3[k])*4.*hn/5. + b.p2[k])*3.*hn/4. + b.p1[k])*2.*hn/3. + b.p0[k])*hn/2. + a0[k])*dt*hn;
+    }
+    for(int i=0;i<N;i++){
+        particles[i] = r->particles[i];
+        particles[i].x  = xk[3*i+0];
+        particles[i].y  = xk[3*i+1];
+        particles[i].z  = xk[3*i+2];
+        particles[i].vx = vk[3*i+0];
+        particles[i].vy = vk[3*i+1];
+        particles[i].vz = vk[3*i+2];
+    }
+    free(xk);
+    free(vk);
+    return 0;
+}
 void reb_integrator_ias15_clear(struct reb_simulation* r){
-    const int N3 = r->ri_ias15.allocatedN;
+    int N3 = r->ri_ias15.allocatedN;
+    if (r->integrator==REB_INTEGRATOR_MERCURIUS && 3*r->ri_mercurius.encounterN<N3){
+        // Buffers may be larger than the current encounter. Only the part in use is cleared.
+        N3 = 3*r->ri_mercurius.encounterN;
+    }
     if (N3){
         clear_dp7(&(r->ri_ias15.g),N3);
         clear_dp7(&(r->ri_ias15.e),N3);
@@ -721,6 +902,7 @@ void reb_integrator_ias15_clear(struct reb_simulation* r){
         clear_dp7(&(r->ri_ias15.csb),N3);
         clear_dp7(&(r->ri_ias15.er),N3);
         clear_dp7(&(r->ri_ias15.br),N3);
+        r->ri_ias15.dense_N = 0;
         
         double* restrict const csx = r->ri_ias15.csx; 
         double* restrict const csv = r->ri_ias15.csv; 
@@ -741,22 +923,33 @@ void reb_integrator_ias15_reset(struct reb_simulation* r){
     free_dp7(&(r->ri_ias15.csb));
     free_dp7(&(r->ri_ias15.er));
     free_dp7(&(r->ri_ias15.br));
-    free(r->ri_ias15.at);
+    reb_free(r->ri_ias15.at);
     r->ri_ias15.at =  NULL;
-    free(r->ri_ias15.x0);
+    reb_free(r->ri_ias15.x0);
     r->ri_ias15.x0 =  NULL;
-    free(r->ri_ias15.v0);
+    reb_free(r->ri_ias15.v0);
     r->ri_ias15.v0 =  NULL;
-    free(r->ri_ias15.a0);
+    reb_free(r->ri_ias15.a0);
     r->ri_ias15.a0 =  NULL;
-    free(r->ri_ias15.csx);
+    reb_free(r->ri_ias15.csx);
     r->ri_ias15.csx=  NULL;
-    free(r->ri_ias15.csv);
+    reb_free(r->ri_ias15.csv);
     r->ri_ias15.csv=  NULL;
-    free(r->ri_ias15.csa0);
+    reb_free(r->ri_ias15.csa0);
     r->ri_ias15.csa0 =  NULL;
     free(r->ri_ias15.map);
     r->ri_ias15.map =  NULL;
+    r->ri_ias15.gravity_cache_allocatedN = 0;
+    free(r->ri_ias15.gravity_cache_x);
+    r->ri_ias15.gravity_cache_x =  NULL;
+    free(r->ri_ias15.gravity_cache_a);
+    r->ri_ias15.gravity_cache_a =  NULL;
+    r->ri_ias15.dense_N = 0;
+    r->ri_ias15.dense_allocatedN = 0;
+    free(r->ri_ias15.dense_x0);
+    r->ri_ias15.dense_x0 =  NULL;
+    free(r->ri_ias15.dense_v0);
+    r->ri_ias15.dense_v0 =  NULL;
 }
 
 #ifdef GENERATE_CONSTANTS
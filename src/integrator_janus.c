@@ -39,6 +39,7 @@
 #include "boundary.h"
 #include "integrator.h"
 #include "integrator_janus.h"
+#include "forces.h"
 
 /**
  * Stucture derscribing one specific JANUS scheme
@@ -125,6 +126,11 @@ static double gg(struct reb_janus_scheme s, unsigned int stage){
 }
 
 
+/**
+ * @brief Minimum number of particles for which the loops over all particles are run in parallel with OpenMP.
+ */
+#define REB_JANUS_OMP_N_MIN 2048
+
 static void to_int(struct reb_particle_int* psi, struct reb_particle* ps, unsigned int N, double scale_pos, double scale_vel){
     for(unsigned int i=0; i<N; i++){ 
         psi[i].x = ps[i].x/scale_pos; 
@@ -135,34 +141,55 @@ static void to_int(struct reb_particle_int* psi, struct reb_particle* ps, unsign
         psi[i].vz = ps[i].vz/scale_vel; 
     }
 }
-static void to_double(struct reb_particle* ps, struct reb_particle_int* psi, unsigned int N, double scale_pos, double scale_vel){
-    for(unsigned int i=0; i<N; i++){ 
-        ps[i].x = ((double)psi[i].x)*scale_pos; 
-        ps[i].y = ((double)psi[i].y)*scale_pos; 
-        ps[i].z = ((double)psi[i].z)*scale_pos; 
-        ps[i].vx = ((double)psi[i].vx)*scale_vel; 
-        ps[i].vy = ((double)psi[i].vy)*scale_vel; 
-        ps[i].vz = ((double)psi[i].vz)*scale_vel; 
+
+// Converts positions and, if requested, velocities back to floating point. 
+// Velocities are only needed within a timestep if forces are velocity dependent.
+static void to_double(struct reb_particle* restrict ps, const struct reb_particle_int* restrict psi, const int N, const double scale_pos, const double scale_vel, const int velocities){
+    if (velocities){
+#pragma omp parallel for if(N>=REB_JANUS_OMP_N_MIN)
+        for(int i=0; i<N; i++){ 
+            ps[i].x = ((double)psi[i].x)*scale_pos; 
+            ps[i].y = ((double)psi[i].y)*scale_pos; 
+            ps[i].z = ((double)psi[i].z)*scale_pos; 
+            ps[i].vx = ((double)psi[i].vx)*scale_vel; 
+            ps[i].vy = ((double)psi[i].vy)*scale_vel; 
+            ps[i].vz = ((double)psi[i].vz)*scale_vel; 
+        }
+    }else{
+#pragma omp parallel for if(N>=REB_JANUS_OMP_N_MIN)
+        for(int i=0; i<N; i++){ 
+            ps[i].x = ((double)psi[i].x)*scale_pos; 
+            ps[i].y = ((double)psi[i].y)*scale_pos; 
+            ps[i].z = ((double)psi[i].z)*scale_pos; 
+        }
     }
 }
 
+// The increments in drift() and kick() are odd functions of dt: the products with the 
+// hoisted factors change sign exactly and the conversion to an integer truncates 
+// towards zero. A step with -dt therefore exactly undoes a step with dt.
 static void drift(struct reb_simulation* r, double dt, double scale_pos, double scale_vel){
-    struct reb_simulation_integrator_janus* ri_janus = &(r->ri_janus);
-    const unsigned int N = r->N;
-    for(unsigned int i=0; i<N; i++){
-        ri_janus->p_int[i].x += (REB_PARTICLE_INT_TYPE)(dt*(double)ri_janus->p_int[i].vx*scale_vel/scale_pos) ;
-        ri_janus->p_int[i].y += (REB_PARTICLE_INT_TYPE)(dt*(double)ri_janus->p_int[i].vy*scale_vel/scale_pos) ;
-        ri_janus->p_int[i].z += (REB_PARTICLE_INT_TYPE)(dt*(double)ri_janus->p_int[i].vz*scale_vel/scale_pos) ;
+    struct reb_particle_int* restrict const p_int = r->ri_janus.p_int;
+    const int N = r->N;
+    const double f = dt*scale_vel/scale_pos;
+#pragma omp parallel for if(N>=REB_JANUS_OMP_N_MIN)
+    for(int i=0; i<N; i++){
+        p_int[i].x += (REB_PARTICLE_INT_TYPE)(f*(double)p_int[i].vx);
+        p_int[i].y += (REB_PARTICLE_INT_TYPE)(f*(double)p_int[i].vy);
+        p_int[i].z += (REB_PARTICLE_INT_TYPE)(f*(double)p_int[i].vz);
     }
 }
 
 static void kick(struct reb_simulation* r, double dt, double scale_vel){
-    struct reb_simulation_integrator_janus* ri_janus = &(r->ri_janus);
-    const unsigned int N = r->N;
-    for(unsigned int i=0; i<N; i++){
-        ri_janus->p_int[i].vx += (REB_PARTICLE_INT_TYPE)(dt*r->particles[i].ax/scale_vel) ;
-        ri_janus->p_int[i].vy += (REB_PARTICLE_INT_TYPE)(dt*r->particles[i].ay/scale_vel) ;
-        ri_janus->p_int[i].vz += (REB_PARTICLE_INT_TYPE)(dt*r->particles[i].az/scale_vel) ;
+    struct reb_particle_int* restrict const p_int = r->ri_janus.p_int;
+    const struct reb_particle* restrict const particles = r->particles;
+    const int N = r->N;
+    const double f = dt/scale_vel;
+#pragma omp parallel for if(N>=REB_JANUS_OMP_N_MIN)
+    for(int i=0; i<N; i++){
+        p_int[i].vx += (REB_PARTICLE_INT_TYPE)(f*particles[i].ax);
+        p_int[i].vy += (REB_PARTICLE_INT_TYPE)(f*particles[i].ay);
+        p_int[i].vz += (REB_PARTICLE_INT_TYPE)(f*particles[i].az);
     }
 }
 
@@ -207,7 +234,7 @@ void reb_integrator_janus_part1(struct reb_simulation* r){
     }
 
     drift(r,gg(s,0)*dt/2.,scale_pos,scale_vel);
-    to_double(r->particles, r->ri_janus.p_int, r->N, scale_pos, scale_vel); 
+    to_double(r->particles, r->ri_janus.p_int, r->N, scale_pos, scale_vel, 1); 
 }
 
 void reb_integrator_janus_part2(struct reb_simulation* r){
@@ -242,7 +269,7 @@ void reb_integrator_janus_part2(struct reb_simulation* r){
     kick(r,gg(s,0)*dt, scale_vel);
     for (unsigned int i=1; i<s.stages; i++){
         drift(r,(gg(s,i-1)+gg(s,i))*dt/2.,scale_pos,scale_vel);
-        to_double(r->particles, r->ri_janus.p_int, N, scale_pos, scale_vel); 
+        to_double(r->particles, r->ri_janus.p_int, N, scale_pos, scale_vel, reb_forces_used(r) && r->force_is_velocity_dependent); 
         reb_update_acceleration(r);
         kick(r,gg(s,i)*dt, scale_vel);
     }
@@ -257,7 +284,7 @@ void reb_integrator_janus_part2(struct reb_simulation* r){
 
 void reb_integrator_janus_synchronize(struct reb_simulation* r){
     if (r->ri_janus.allocated_N==r->N){
-        to_double(r->particles, r->ri_janus.p_int, r->N, r->ri_janus.scale_pos, r->ri_janus.scale_vel); 
+        to_double(r->particles, r->ri_janus.p_int, r->N, r->ri_janus.scale_pos, r->ri_janus.scale_vel, 1); 
     }
 }
 
@@ -36,40 +36,141 @@
 
 // Leapfrog integrator (Drift-Kick-Drift)
 // for non-rotating frame.
+// If safe_mode is off, the kick and closing drift of one step are only 
+// carried out at the beginning of the next step, together with its opening 
+// drift. Each step then needs only one pass over the particles.
 void reb_integrator_leapfrog_part1(struct reb_simulation* r){
     r->gravity_ignore_terms = 0;
+	struct reb_simulation_integrator_leapfrog* const ri_leapfrog = &(r->ri_leapfrog);
 	const int N = r->N;
 	struct reb_particle* restrict const particles = r->particles;
 	const double dt = r->dt;
-#pragma omp parallel for schedule(guided)
-	for (int i=0;i<N;i++){
-		particles[i].x  += 0.5* dt * particles[i].vx;
-		particles[i].y  += 0.5* dt * particles[i].vy;
-		particles[i].z  += 0.5* dt * particles[i].vz;
+	if (ri_leapfrog->is_synchronized){
+#pragma omp parallel for if(N>=reb_omp_min_N) schedule(guided)
+		for (int i=0;i<N;i++){
+			particles[i].x  += 0.5* dt * particles[i].vx;
+			particles[i].y  += 0.5* dt * particles[i].vy;
+			particles[i].z  += 0.5* dt * particles[i].vz;
+		}
+	}else{
+		// Accelerations are still those of the previous step.
+		const double dt_last = r->dt_last_done;
+		const double dt_drift = 0.5*(dt_last + dt);
+#pragma omp parallel for if(N>=reb_omp_min_N) schedule(guided)
+		for (int i=0;i<N;i++){
+			particles[i].vx += dt_last * particles[i].ax;
+			particles[i].vy += dt_last * particles[i].ay;
+			particles[i].vz += dt_last * particles[i].az;
+			particles[i].x  += dt_drift * particles[i].vx;
+			particles[i].y  += dt_drift * particles[i].vy;
+			particles[i].z  += dt_drift * particles[i].vz;
+		}
 	}
 	r->t+=dt/2.;
 }
 void reb_integrator_leapfrog_part2(struct reb_simulation* r){
+	struct reb_simulation_integrator_leapfrog* const ri_leapfrog = &(r->ri_leapfrog);
 	const int N = r->N;
 	struct reb_particle* restrict const particles = r->particles;
 	const double dt = r->dt;
-#pragma omp parallel for schedule(guided)
-	for (int i=0;i<N;i++){
-		particles[i].vx += dt * particles[i].ax;
-		particles[i].vy += dt * particles[i].ay;
-		particles[i].vz += dt * particles[i].az;
-		particles[i].x  += 0.5* dt * particles[i].vx;
-		particles[i].y  += 0.5* dt * particles[i].vy;
-		particles[i].z  += 0.5* dt * particles[i].vz;
+	if (ri_leapfrog->safe_mode){
+#pragma omp parallel for if(N>=reb_omp_min_N) schedule(guided)
+		for (int i=0;i<N;i++){
+			particles[i].vx += dt * particles[i].ax;
+			particles[i].vy += dt * particles[i].ay;
+			particles[i].vz += dt * particles[i].az;
+			particles[i].x  += 0.5* dt * particles[i].vx;
+			particles[i].y  += 0.5* dt * particles[i].vy;
+			particles[i].z  += 0.5* dt * particles[i].vz;
+		}
+		ri_leapfrog->is_synchronized = 1;
+	}else{
+		ri_leapfrog->is_synchronized = 0;
 	}
 	r->t+=dt/2.;
 	r->dt_last_done = r->dt;
 }
 	
 void reb_integrator_leapfrog_synchronize(struct reb_simulation* r){
-	// Do nothing.
+	struct reb_simulation_integrator_leapfrog* const ri_leapfrog = &(r->ri_leapfrog);
+	if (ri_leapfrog->is_synchronized == 0){
+		const int N = r->N;
+		struct reb_particle* restrict const particles = r->particles;
+		const double dt = r->dt_last_done;
+#pragma omp parallel for if(N>=reb_omp_min_N) schedule(guided)
+		for (int i=0;i<N;i++){
+			particles[i].vx += dt * particles[i].ax;
+			particles[i].vy += dt * particles[i].ay;
+			particles[i].vz += dt * particles[i].az;
+			particles[i].x  += 0.5* dt * particles[i].vx;
+			particles[i].y  += 0.5* dt * particles[i].vy;
+			particles[i].z  += 0.5* dt * particles[i].vz;
+		}
+		ri_leapfrog->is_synchronized = 1;
+	}
+}
+
+#if defined(OPENMP) && !defined(GPU) && !defined(SIMD)
+// Same as reb_integrator_leapfrog_part1() and reb_integrator_leapfrog_part2() 
+// but called by all threads of a persistent parallel region. A static schedule
+// assigns the same particles to the same thread in every loop. gravity_ignore_terms
+// needs to be set to 0 before the parallel region.
+void reb_integrator_leapfrog_part1_team(struct reb_simulation* r){
+	struct reb_simulation_integrator_leapfrog* const ri_leapfrog = &(r->ri_leapfrog);
+	const int N = r->N;
+	struct reb_particle* restrict const particles = r->particles;
+	const double dt = r->dt;
+	if (ri_leapfrog->is_synchronized){
+#pragma omp for schedule(static)
+		for (int i=0;i<N;i++){
+			particles[i].x  += 0.5* dt * particles[i].vx;
+			particles[i].y  += 0.5* dt * particles[i].vy;
+			particles[i].z  += 0.5* dt * particles[i].vz;
+		}
+	}else{
+		const double dt_last = r->dt_last_done;
+		const double dt_drift = 0.5*(dt_last + dt);
+#pragma omp for schedule(static)
+		for (int i=0;i<N;i++){
+			particles[i].vx += dt_last * particles[i].ax;
+			particles[i].vy += dt_last * particles[i].ay;
+			particles[i].vz += dt_last * particles[i].az;
+			particles[i].x  += dt_drift * particles[i].vx;
+			particles[i].y  += dt_drift * particles[i].vy;
+			particles[i].z  += dt_drift * particles[i].vz;
+		}
+	}
+#pragma omp single nowait
+	r->t+=dt/2.;
+}
+
+void reb_integrator_leapfrog_part2_team(struct reb_simulation* r){
+	struct reb_simulation_integrator_leapfrog* const ri_leapfrog = &(r->ri_leapfrog);
+	const int N = r->N;
+	struct reb_particle* restrict const particles = r->particles;
+	const double dt = r->dt;
+	const int safe_mode = ri_leapfrog->safe_mode;
+	if (safe_mode){
+#pragma omp for schedule(static) nowait
+		for (int i=0;i<N;i++){
+			particles[i].vx += dt * particles[i].ax;
+			particles[i].vy += dt * particles[i].ay;
+			particles[i].vz += dt * particles[i].az;
+			particles[i].x  += 0.5* dt * particles[i].vx;
+			particles[i].y  += 0.5* dt * particles[i].vy;
+			particles[i].z  += 0.5* dt * particles[i].vz;
+		}
+	}
+#pragma omp single
+	{
+		ri_leapfrog->is_synchronized = safe_mode;
+		r->t+=dt/2.;
+		r->dt_last_done = r->dt;
+	}
 }
+#endif // OPENMP, GPU, SIMD
 
 void reb_integrator_leapfrog_reset(struct reb_simulation* r){
-	// Do nothing.
+	r->ri_leapfrog.safe_mode = 1;
+	r->ri_leapfrog.is_synchronized = 1;
 }
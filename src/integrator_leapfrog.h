@@ -28,4 +28,8 @@ void reb_integrator_leapfrog_part1(struct reb_simulation* r);          ///< Inte
 void reb_integrator_leapfrog_part2(struct reb_simulation* r);          ///< Internal function used to call a specific integrator
 void reb_integrator_leapfrog_synchronize(struct reb_simulation* r);    ///< Internal function used to call a specific integrator
 void reb_integrator_leapfrog_reset(struct reb_simulation* r);          ///< Internal function used to call a specific integrator
+#if defined(OPENMP) && !defined(GPU) && !defined(SIMD)
+void reb_integrator_leapfrog_part1_team(struct reb_simulation* r);     ///< Same as reb_integrator_leapfrog_part1() but called by all threads of a parallel region
+void reb_integrator_leapfrog_part2_team(struct reb_simulation* r);     ///< Same as reb_integrator_leapfrog_part2() but called by all threads of a parallel region
+#endif // OPENMP, GPU, SIMD
 #endif
@@ -38,60 +38,30 @@
 #include "integrator_ias15.h"
 #include "integrator_whfast.h"
 #include "collision.h"
+#include "profiling.h"
+#include "allocator.h"
+#include "interaction_groups.h"
 #define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
 #define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
 
 double reb_integrator_mercurius_L_mercury(const struct reb_simulation* const r, double d, double dcrit){
     // This is the changeover function used by the Mercury integrator.
-    double y = (d-0.1*dcrit)/(0.9*dcrit);
-    if (y<0.){
-        return 0.;
-    }else if (y>1.){
-        return 1.;
-    }else{
-        return 10.*(y*y*y) - 15.*(y*y*y*y) + 6.*(y*y*y*y*y);
-    }
+    return reb_integrator_mercurius_L_mercury_y((d-0.1*dcrit)/(0.9*dcrit));
 }
 
 double reb_integrator_mercurius_L_C4(const struct reb_simulation* const r, double d, double dcrit){
     // This is the changeover function C4 proposed by Hernandez (2019)
-    double y = (d-0.1*dcrit)/(0.9*dcrit);
-    if (y<0.){
-        return 0.;
-    }else if (y>1.){
-        return 1.;
-    }else{
-        return (70.*y*y*y*y -315.*y*y*y +540.*y*y -420.*y +126.)*y*y*y*y*y;
-    }
+    return reb_integrator_mercurius_L_C4_y((d-0.1*dcrit)/(0.9*dcrit));
 }
 
 double reb_integrator_mercurius_L_C5(const struct reb_simulation* const r, double d, double dcrit){
     // This is the changeover function C5 proposed by Hernandez (2019)
-    double y = (d-0.1*dcrit)/(0.9*dcrit);
-    if (y<0.){
-        return 0.;
-    }else if (y>1.){
-        return 1.;
-    }else{
-        return (-252.*y*y*y*y*y +1386.*y*y*y*y -3080.*y*y*y +3465.*y*y -1980.*y +462.)*y*y*y*y*y*y;
-    }
-}
-
-static double f(double x){
-    if (x<0) return 0;
-    return exp(-1./x);
+    return reb_integrator_mercurius_L_C5_y((d-0.1*dcrit)/(0.9*dcrit));
 }
 
 double reb_integrator_mercurius_L_infinity(const struct reb_simulation* const r, double d, double dcrit){
     // Infinitely differentiable function.
-    double y = (d-0.1*dcrit)/(0.9*dcrit);
-    if (y<0.){
-        return 0.;
-    }else if (y>1.){
-        return 1.;
-    }else{
-        return f(y) /(f(y) + f(1.-y));
-    }
+    return reb_integrator_mercurius_L_infinity_y((d-0.1*dcrit)/(0.9*dcrit));
 }
 
 
@@ -170,17 +140,180 @@ void reb_integrator_mercurius_dh_to_inertial(struct reb_simulation* r){
 }
 
 
+/**
+ * @brief Number of active particles above which close encounters are predicted with a sweep instead of testing all pairs.
+ */
+#define REB_MERCURIUS_PREDICT_SWEEP_MIN_N 64
+
+/**
+ * @brief Number of particles in close encounters below which all of them are integrated as one group.
+ * @details Every group restarts IAS15 with a small timestep. For a handful of 
+ * particles this overhead outweighs what is saved by integrating groups separately.
+ */
+#define REB_MERCURIUS_GROUPS_MIN_N 16
+
+/**
+ * @brief Box containing the position of a particle before and after the Kepler step, enlarged by its search radius.
+ */
+struct reb_mercurius_predict_box {
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    double zmin;
+    double zmax;
+    int i;
+};
+
+static int reb_mercurius_predict_box_compare(const void* a, const void* b){
+    const struct reb_mercurius_predict_box* const ba = a;
+    const struct reb_mercurius_predict_box* const bb = b;
+    if (ba->xmin < bb->xmin) return -1;
+    if (ba->xmin > bb->xmin) return 1;
+    return ba->i - bb->i;
+}
+
+static int reb_mercurius_encounter_group_find(int* const group, int i){
+    while (group[i]!=i){
+        group[i] = group[group[i]];
+        i = group[i];
+    }
+    return i;
+}
+
+static inline void reb_mercurius_encounter_predict_pair(struct reb_simulation_integrator_mercurius* const rim, const struct reb_particle* const particles, const struct reb_vec6d* const particles_backup, const double* const dcrit, const double dt, const int N_active, const uint64_t* const interaction_groups, const int i, const int j){
+    if (interaction_groups && !reb_interaction_groups_pair(interaction_groups, particles[i].group, particles[j].group)){
+        return; // Particles in groups which do not interact have no close encounters
+    }
+    const double dxn = particles[i].x - particles[j].x;
+    const double dyn = particles[i].y - particles[j].y;
+    const double dzn = particles[i].z - particles[j].z;
+    const double dvxn = particles[i].vx - particles[j].vx;
+    const double dvyn = particles[i].vy - particles[j].vy;
+    const double dvzn = particles[i].vz - particles[j].vz;
+    const double rn = (dxn*dxn + dyn*dyn + dzn*dzn);
+    const double dxo = particles_backup[i].x - particles_backup[j].x;
+    const double dyo = particles_backup[i].y - particles_backup[j].y;
+    const double dzo = particles_backup[i].z - particles_backup[j].z;
+    const double dvxo = particles_backup[i].vx - particles_backup[j].vx;
+    const double dvyo = particles_backup[i].vy - particles_backup[j].vy;
+    const double dvzo = particles_backup[i].vz - particles_backup[j].vz;
+    const double ro = (dxo*dxo + dyo*dyo + dzo*dzo);
+
+    const double drndt = (dxn*dvxn+dyn*dvyn+dzn*dvzn)*2.;
+    const double drodt = (dxo*dvxo+dyo*dvyo+dzo*dvzo)*2.;
+
+    const double a = 6.*(ro-rn)+3.*dt*(drodt+drndt); 
+    const double b = 6.*(rn-ro)-2.*dt*(2.*drodt+drndt); 
+    const double c = dt*drodt; 
+
+    double rmin = MIN(rn,ro);
+
+    const double s = b*b-4.*a*c;
+    const double sr = sqrt(MAX(0.,s));
+    const double tmin1 = (-b + sr)/(2.*a); 
+    const double tmin2 = (-b - sr)/(2.*a); 
+    if (tmin1>0. && tmin1<1.){
+        const double rmin1 = (1.-tmin1)*(1.-tmin1)*(1.+2.*tmin1)*ro
+                             + tmin1*tmin1*(3.-2.*tmin1)*rn
+                             + tmin1*(1.-tmin1)*(1.-tmin1)*dt*drodt
+                             - tmin1*tmin1*(1.-tmin1)*dt*drndt;
+        rmin = MIN(MAX(rmin1,0.),rmin);
+    }
+    if (tmin2>0. && tmin2<1.){
+        const double rmin2 = (1.-tmin2)*(1.-tmin2)*(1.+2.*tmin2)*ro
+                             + tmin2*tmin2*(3.-2.*tmin2)*rn
+                             + tmin2*(1.-tmin2)*(1.-tmin2)*dt*drodt
+                             - tmin2*tmin2*(1.-tmin2)*dt*drndt;
+        rmin = MIN(MAX(rmin2,0.),rmin);
+    }
+
+    double dcritmax2 = MAX(dcrit[i],dcrit[j]);
+    dcritmax2 *= 1.21*dcritmax2;
+    if (rmin < dcritmax2){
+        if (rim->encounter_map[i]==0){
+            rim->encounter_map[i] = i;
+            rim->encounterN++;
+        }
+        if (rim->encounter_map[j]==0){
+            rim->encounter_map[j] = j;
+            rim->encounterN++;
+        }
+        if (j<N_active){ // Two massive particles have a close encounter
+            rim->tponly_encounter = 0;
+        }
+        if (i>0){ // Encounters with the star do not connect groups
+            const int gi = reb_mercurius_encounter_group_find(rim->encounter_group, i);
+            const int gj = reb_mercurius_encounter_group_find(rim->encounter_group, j);
+            rim->encounter_group[MAX(gi,gj)] = MIN(gi,gj);
+        }
+    }
+}
+
+static void reb_mercurius_encounter_predict_sweep(struct reb_simulation* const r){
+    struct reb_simulation_integrator_mercurius* rim = &(r->ri_mercurius);
+    struct reb_particle* const particles = r->particles;
+    const struct reb_vec6d* const particles_backup = rim->particles_backup;
+    const double* const dcrit = rim->dcrit;
+    const uint64_t* const interaction_groups = r->N_interaction_groups?r->interaction_groups:NULL;
+    const int N = r->N;
+    const int N_active = r->N_active==-1?r->N:r->N_active;
+    const double dt = r->dt;
+    // Only pairs whose boxes overlap can have a close encounter. 
+    // The interpolated squared distance is at least m^2 - k*U*(dold+dnew), where m is the smaller 
+    // of the distances dold and dnew before and after the Kepler step, U is the sum of the particle 
+    // speeds and k = 8/27*dt. With dnew-dold bounded by the distance D both particles moved, 
+    // a pair with m >= (1+sqrt(1.5))*k*U + D/sqrt(2) + 1.1*(dcrit_i+dcrit_j) cannot be within 
+    // the critical radius. This bound is a sum of per-particle terms which are used to enlarge
+    // each particle's box. The tested pairs and therefore the results do not change.
+    struct reb_mercurius_predict_box* const boxes = malloc(sizeof(struct reb_mercurius_predict_box)*N);
+    const double k = 8./27.*fabs(dt);
+    for (int i=0; i<N; i++){
+        const struct reb_particle pn = particles[i];
+        const struct reb_vec6d po = particles_backup[i];
+        const double un = sqrt(pn.vx*pn.vx + pn.vy*pn.vy + pn.vz*pn.vz);
+        const double uo = sqrt(po.vx*po.vx + po.vy*po.vy + po.vz*po.vz);
+        const double dx = pn.x - po.x;
+        const double dy = pn.y - po.y;
+        const double dz = pn.z - po.z;
+        const double d = sqrt(dx*dx + dy*dy + dz*dz);
+        // The factor 1.01 accounts for rounding errors in the interpolation.
+        const double rs = 1.01*((1.+sqrt(1.5))*k*MAX(un,uo) + sqrt(0.5)*d + 1.1*dcrit[i]);
+        boxes[i] = (struct reb_mercurius_predict_box){
+            .xmin = MIN(pn.x,po.x) - rs, .xmax = MAX(pn.x,po.x) + rs,
+            .ymin = MIN(pn.y,po.y) - rs, .ymax = MAX(pn.y,po.y) + rs,
+            .zmin = MIN(pn.z,po.z) - rs, .zmax = MAX(pn.z,po.z) + rs,
+            .i = i,
+        };
+    }
+    qsort(boxes, N, sizeof(struct reb_mercurius_predict_box), reb_mercurius_predict_box_compare);
+    for (int a=0; a<N; a++){
+        const struct reb_mercurius_predict_box ba = boxes[a];
+        for (int b=a+1; b<N && boxes[b].xmin<=ba.xmax; b++){
+            const struct reb_mercurius_predict_box bb = boxes[b];
+            if (bb.ymin>ba.ymax || bb.ymax<ba.ymin || bb.zmin>ba.zmax || bb.zmax<ba.zmin) continue;
+            const int i = MIN(ba.i,bb.i);
+            const int j = MAX(ba.i,bb.i);
+            if (i>=N_active) continue; // Test particles do not have encounters with each other
+            reb_mercurius_encounter_predict_pair(rim, particles, particles_backup, dcrit, dt, N_active, interaction_groups, i, j);
+        }
+    }
+    free(boxes);
+}
+
 static void reb_mercurius_encounter_predict(struct reb_simulation* const r){
     // This function predicts close encounters during the timestep
     // It makes use of the old and new position and velocities obtained
     // after the Kepler step.
     struct reb_simulation_integrator_mercurius* rim = &(r->ri_mercurius);
     struct reb_particle* const particles = r->particles;
-    struct reb_particle* const particles_backup = rim->particles_backup;
+    const struct reb_vec6d* const particles_backup = rim->particles_backup;
     const double* const dcrit = rim->dcrit;
+    const uint64_t* const interaction_groups = r->N_interaction_groups?r->interaction_groups:NULL;
     const int N = r->N;
     const int N_active = r->N_active==-1?r->N:r->N_active;
     const double dt = r->dt;
+    PROFILING_START(r)
     rim->encounterN = 1;
     rim->encounter_map[0] = 1;
     if (r->testparticle_type==1){
@@ -191,68 +324,29 @@ static void reb_mercurius_encounter_predict(struct reb_simulation* const r){
     for (int i=1; i<N; i++){
         rim->encounter_map[i] = 0;
     }
-    for (int i=0; i<N_active; i++){
-        for (int j=i+1; j<N; j++){
-            const double dxn = particles[i].x - particles[j].x;
-            const double dyn = particles[i].y - particles[j].y;
-            const double dzn = particles[i].z - particles[j].z;
-            const double dvxn = particles[i].vx - particles[j].vx;
-            const double dvyn = particles[i].vy - particles[j].vy;
-            const double dvzn = particles[i].vz - particles[j].vz;
-            const double rn = (dxn*dxn + dyn*dyn + dzn*dzn);
-            const double dxo = particles_backup[i].x - particles_backup[j].x;
-            const double dyo = particles_backup[i].y - particles_backup[j].y;
-            const double dzo = particles_backup[i].z - particles_backup[j].z;
-            const double dvxo = particles_backup[i].vx - particles_backup[j].vx;
-            const double dvyo = particles_backup[i].vy - particles_backup[j].vy;
-            const double dvzo = particles_backup[i].vz - particles_backup[j].vz;
-            const double ro = (dxo*dxo + dyo*dyo + dzo*dzo);
-
-            const double drndt = (dxn*dvxn+dyn*dvyn+dzn*dvzn)*2.;
-            const double drodt = (dxo*dvxo+dyo*dvyo+dzo*dvzo)*2.;
-
-            const double a = 6.*(ro-rn)+3.*dt*(drodt+drndt); 
-            const double b = 6.*(rn-ro)-2.*dt*(2.*drodt+drndt); 
-            const double c = dt*drodt; 
-
-            double rmin = MIN(rn,ro);
-
-            const double s = b*b-4.*a*c;
-            const double sr = sqrt(MAX(0.,s));
-            const double tmin1 = (-b + sr)/(2.*a); 
-            const double tmin2 = (-b - sr)/(2.*a); 
-            if (tmin1>0. && tmin1<1.){
-                const double rmin1 = (1.-tmin1)*(1.-tmin1)*(1.+2.*tmin1)*ro
-                                     + tmin1*tmin1*(3.-2.*tmin1)*rn
-                                     + tmin1*(1.-tmin1)*(1.-tmin1)*dt*drodt
-                                     - tmin1*tmin1*(1.-tmin1)*dt*drndt;
-                rmin = MIN(MAX(rmin1,0.),rmin);
-            }
-            if (tmin2>0. && tmin2<1.){
-                const double rmin2 = (1.-tmin2)*(1.-tmin2)*(1.+2.*tmin2)*ro
-                                     + tmin2*tmin2*(3.-2.*tmin2)*rn
-                                     + tmin2*(1.-tmin2)*(1.-tmin2)*dt*drodt
-                                     - tmin2*tmin2*(1.-tmin2)*dt*drndt;
-                rmin = MIN(MAX(rmin2,0.),rmin);
-            }
-
-            double dcritmax2 = MAX(dcrit[i],dcrit[j]);
-            dcritmax2 *= 1.21*dcritmax2;
-            if (rmin < dcritmax2){
-                if (rim->encounter_map[i]==0){
-                    rim->encounter_map[i] = i;
-                    rim->encounterN++;
-                }
-                if (rim->encounter_map[j]==0){
-                    rim->encounter_map[j] = j;
-                    rim->encounterN++;
-                }
-                if (j<N_active){ // Two massive particles have a close encounter
-                    rim->tponly_encounter = 0;
-                }
+    for (int i=0; i<N; i++){
+        rim->encounter_group[i] = i;
+    }
+    if (N_active<REB_MERCURIUS_PREDICT_SWEEP_MIN_N){
+        for (int i=0; i<N_active; i++){
+            for (int j=i+1; j<N; j++){
+                reb_mercurius_encounter_predict_pair(rim, particles, particles_backup, dcrit, dt, N_active, interaction_groups, i, j);
             }
         }
+    }else{
+        reb_mercurius_encounter_predict_sweep(r);
     }
+    // Label every particle having an encounter with the smallest index in its group.
+    rim->encounter_group[0] = 0;
+    for (int i=1; i<N; i++){
+        rim->encounter_group[i] = rim->encounter_map[i]?reb_mercurius_encounter_group_find(rim->encounter_group, i):0;
+    }
+    int bin = 0;
+    while (bin<REB_COUNTERS_ENCOUNTER_BINS-1 && (2u<<bin)<=rim->encounterN){
+        bin++;
+    }
+    r->counters.mercurius_encounter_N[bin]++;
+    PROFILING_STOP(r, REB_PROFILING_CAT_ENCOUNTER_PREDICT)
 }
     
 void reb_integrator_mercurius_interaction_step(struct reb_simulation* const r, double dt){
@@ -269,6 +363,7 @@ void reb_integrator_mercurius_jump_step(struct reb_simulation* const r, double d
     struct reb_particle* restrict const particles = r->particles;
     const int N_active = r->N_active==-1?r->N:r->N_active;
     const int N = r->testparticle_type==0 ? N_active: r->N;
+    PROFILING_START(r)
     double px=0., py=0., pz=0.;
     for (int i=1;i<N;i++){
         px += r->particles[i].vx*r->particles[i].m; // in dh
@@ -284,6 +379,7 @@ void reb_integrator_mercurius_jump_step(struct reb_simulation* const r, double d
         particles[i].y += dt*py;
         particles[i].z += dt*pz;
     }
+    PROFILING_STOP(r, REB_PROFILING_CAT_JUMP)
 }
 
 void reb_integrator_mercurius_com_step(struct reb_simulation* const r, double dt){
@@ -294,10 +390,23 @@ void reb_integrator_mercurius_com_step(struct reb_simulation* const r, double dt
 
 void reb_integrator_mercurius_kepler_step(struct reb_simulation* const r, double dt){
     struct reb_particle* restrict const particles = r->particles;
-    const int N = r->N;
-    for (int i=1;i<N;i++){
-        reb_whfast_kepler_solver(r,particles,r->G*particles[0].m,i,dt); // in dh
-    }
+    struct reb_vec6d* restrict const backup = r->ri_mercurius.particles_backup;
+    PROFILING_START(r)
+    // Positions and velocities before the Kepler step are stored in the same pass.
+    // They are used in the encounter prediction and the encounter step.
+    backup[0] = (struct reb_vec6d){particles[0].x, particles[0].y, particles[0].z, particles[0].vx, particles[0].vy, particles[0].vz};
+    reb_whfast_kepler_solver_batch(r,particles,r->G*particles[0].m,1,r->N,dt,NULL,backup); // in dh
+    PROFILING_STOP(r, REB_PROFILING_CAT_KEPLER)
+}
+
+// Only positions and velocities are kept in the backup. Other fields are not changed by the Kepler step.
+static inline void reb_mercurius_restore(struct reb_particle* const p, const struct reb_vec6d b){
+    p->x = b.x;
+    p->y = b.y;
+    p->z = b.z;
+    p->vx = b.vx;
+    p->vy = b.vy;
+    p->vz = b.vz;
 }
 
 static void reb_mercurius_encounter_step(struct reb_simulation* const r, const double _dt){
@@ -306,22 +415,18 @@ static void reb_mercurius_encounter_step(struct reb_simulation* const r, const d
     if (rim->encounterN<2){
         return; // If there are no particles (other than the star) having a close encounter, then there is nothing to do.
     }
+    r->counters.mercurius_encounter_steps++;
+    TRACE_BEGIN(r, REB_TRACE_PHASE_ENCOUNTER)
 
-    int i_enc = 0;
-    rim->encounterNactive = 0;
     for (unsigned int i=0; i<r->N; i++){
         if(rim->encounter_map[i]){  
-            struct reb_particle tmp = r->particles[i];      // Copy for potential use for tponly_encounter
-            r->particles[i] = rim->particles_backup[i];     // Use coordinates before whfast step
-            rim->encounter_map[i_enc] = i;
-            i_enc++;
-            if (r->N_active==-1 || i<r->N_active){
-                rim->encounterNactive++;
-                if (rim->tponly_encounter){
-                    rim->particles_backup[i] = tmp;         // Make copy of particles after the kepler step.
+            struct reb_particle* const p = &(r->particles[i]);
+            const struct reb_vec6d tmp = {p->x, p->y, p->z, p->vx, p->vy, p->vz}; // Copy for potential use for tponly_encounter
+            reb_mercurius_restore(p, rim->particles_backup[i]);   // Use coordinates before whfast step
+            if (rim->tponly_encounter && (r->N_active==-1 || i<r->N_active)){
+                rim->particles_backup[i] = tmp;             // Make copy of particles after the kepler step.
                                                             // used to restore the massive objects' states in the case
                                                             // of only massless test-particle encounters
-                }
             }
         }
     }
@@ -332,63 +437,104 @@ static void reb_mercurius_encounter_step(struct reb_simulation* const r, const d
     const double old_dt = r->dt;
     const double old_t = r->t;
     double t_needed = r->t + _dt; 
-        
-    reb_integrator_ias15_reset(r);
     
-    r->dt = 0.0001*_dt; // start with a small timestep.
+    // Particles in different groups do not interact during the encounter step.
+    // Each group is integrated separately, so a group only takes as many 
+    // IAS15 steps as its own encounter requires.
+    if (rim->encounterN<REB_MERCURIUS_GROUPS_MIN_N){
+        for (unsigned int i=1; i<r->N; i++){
+            if (rim->encounter_group[i]){
+                rim->encounter_group[i] = 1;
+            }
+        }
+    }
+    while (1){
+        // The next group is the one with the smallest particle index
+        int group = 0;
+        unsigned int i_first = 1;
+        for (; i_first<r->N; i_first++){
+            if (rim->encounter_group[i_first]){
+                group = rim->encounter_group[i_first];
+                break;
+            }
+        }
+        if (group==0){
+            break; // All groups done
+        }
+        rim->encounter_map[0] = 0;
+        rim->encounterN = 1;
+        rim->encounterNactive = (r->N_active==-1 || 0<r->N_active)?1:0;
+        for (unsigned int i=i_first; i<r->N; i++){
+            if (rim->encounter_group[i]==group){
+                rim->encounter_group[i] = 0;
+                rim->encounter_map[rim->encounterN] = i;
+                rim->encounterN++;
+                if (r->N_active==-1 || i<r->N_active){
+                    rim->encounterNactive++;
+                }
+            }
+        }
     
-    while(r->t < t_needed && fabs(r->dt/old_dt)>1e-14 ){
-        struct reb_particle star = r->particles[0]; // backup velocity
-        r->particles[0].vx = 0; // star does not move in dh 
-        r->particles[0].vy = 0;
-        r->particles[0].vz = 0;
-        reb_update_acceleration(r);
-        reb_integrator_ias15_part2(r);
-        r->particles[0].vx = star.vx; // restore every timestep for collisions
-        r->particles[0].vy = star.vy;
-        r->particles[0].vz = star.vz;
+        r->t = old_t;
+        // Only the IAS15 state is cleared. The buffers grow to the largest 
+        // encounter group and are reused for all groups and timesteps.
+        reb_integrator_ias15_clear(r);
+    
+        r->dt = 0.0001*_dt; // start with a small timestep.
+    
+        while(r->t < t_needed && fabs(r->dt/old_dt)>1e-14 ){
+            struct reb_particle star = r->particles[0]; // backup velocity
+            r->particles[0].vx = 0; // star does not move in dh 
+            r->particles[0].vy = 0;
+            r->particles[0].vz = 0;
+            reb_update_acceleration(r);
+            reb_integrator_ias15_part2(r);
+            r->particles[0].vx = star.vx; // restore every timestep for collisions
+            r->particles[0].vy = star.vy;
+            r->particles[0].vz = star.vz;
         
-        if (r->t+r->dt >  t_needed){
-            r->dt = t_needed-r->t;
-        }
+            if (r->t+r->dt >  t_needed){
+                r->dt = t_needed-r->t;
+            }
 
-        // Search and resolve collisions
-        reb_collision_search(r);
-
-        // Do any additional post_timestep_modifications.
-        // Note: post_timestep_modifications is called here but also
-        // at the end of the full timestep. The function thus needs
-        // to be implemented with care as not to do the same 
-        // modification multiple times. To do that, check the value of
-        // r->ri_mercurius.mode
-        if (r->post_timestep_modifications){
-            r->post_timestep_modifications(r);
-        }
+            // Search and resolve collisions
+            reb_collision_search(r);
+
+            // Do any additional post_timestep_modifications.
+            // Note: post_timestep_modifications is called here but also
+            // at the end of the full timestep. The function thus needs
+            // to be implemented with care as not to do the same 
+            // modification multiple times. To do that, check the value of
+            // r->ri_mercurius.mode
+            if (r->post_timestep_modifications){
+                r->post_timestep_modifications(r);
+            }
 
-        star.vx = r->particles[0].vx; // keep track of changed star velocity for later collisions
-        star.vy = r->particles[0].vy;
-        star.vz = r->particles[0].vz;
-        if (r->particles[0].x !=0 || r->particles[0].y !=0 || r->particles[0].z !=0){
-            // Collision with star occured
-            // Shift all particles back to heliocentric coordinates
-            // Ignore stars velocity:
-            //   - will not be used after this
-            //   - com velocity is unchained. this velocity will be used
-            //     to reconstruct star's velocity later.
-            for (int i=r->N-1; i>=0; i--){
-                r->particles[i].x -= r->particles[0].x;
-                r->particles[i].y -= r->particles[0].y;
-                r->particles[i].z -= r->particles[0].z;
+            star.vx = r->particles[0].vx; // keep track of changed star velocity for later collisions
+            star.vy = r->particles[0].vy;
+            star.vz = r->particles[0].vz;
+            if (r->particles[0].x !=0 || r->particles[0].y !=0 || r->particles[0].z !=0){
+                // Collision with star occured
+                // Shift all particles back to heliocentric coordinates
+                // Ignore stars velocity:
+                //   - will not be used after this
+                //   - com velocity is unchained. this velocity will be used
+                //     to reconstruct star's velocity later.
+                for (int i=r->N-1; i>=0; i--){
+                    r->particles[i].x -= r->particles[0].x;
+                    r->particles[i].y -= r->particles[0].y;
+                    r->particles[i].z -= r->particles[0].z;
+                }
             }
         }
-    }
 
-    // if only test particles encountered massive bodies, reset the
-    // massive body coordinates to their post Kepler step state
-    if(rim->tponly_encounter){
-        for (int i=1;i<rim->encounterNactive;i++){
-            unsigned int mi = rim->encounter_map[i];
-            r->particles[mi] = rim->particles_backup[mi];
+        // if only test particles encountered massive bodies, reset the
+        // massive body coordinates to their post Kepler step state
+        if(rim->tponly_encounter){
+            for (int i=1;i<rim->encounterNactive;i++){
+                unsigned int mi = rim->encounter_map[i];
+                reb_mercurius_restore(&(r->particles[mi]), rim->particles_backup[mi]);
+            }
         }
     }
 
@@ -396,6 +542,7 @@ static void reb_mercurius_encounter_step(struct reb_simulation* const r, const d
     r->t = old_t;
     r->dt = old_dt;
     rim->mode = 0;
+    TRACE_END(r, REB_TRACE_PHASE_ENCOUNTER)
 
 }
 
@@ -448,8 +595,9 @@ void reb_integrator_mercurius_part1(struct reb_simulation* r){
     if (rim->allocatedN<N){
         // These arrays are only used within one timestep. 
         // Can be recreated without loosing bit-wise reproducibility
-        rim->particles_backup   = realloc(rim->particles_backup,sizeof(struct reb_particle)*N);
+        rim->particles_backup   = reb_reserve(rim->particles_backup,sizeof(struct reb_vec6d)*N);
         rim->encounter_map      = realloc(rim->encounter_map,sizeof(int)*N);
+        rim->encounter_group    = realloc(rim->encounter_group,sizeof(int)*N);
         rim->allocatedN = N;
     }
     if (rim->safe_mode || rim->recalculate_coordinates_this_timestep){
@@ -495,7 +643,6 @@ void reb_integrator_mercurius_part1(struct reb_simulation* r){
 
 void reb_integrator_mercurius_part2(struct reb_simulation* const r){
     struct reb_simulation_integrator_mercurius* const rim = &(r->ri_mercurius);
-    const int N = r->N;
    
     if (rim->is_synchronized){
         reb_integrator_mercurius_interaction_step(r,r->dt/2.);
@@ -505,12 +652,11 @@ void reb_integrator_mercurius_part2(struct reb_simulation* const r){
     reb_integrator_mercurius_jump_step(r,r->dt/2.);
     reb_integrator_mercurius_com_step(r,r->dt); 
     
-    // Make copy of particles before the kepler step.
-    // Then evolve all particles in kepler step.
+    // Evolve all particles in kepler step. The kepler step
+    // makes a copy of positions and velocities before the step.
     // Result will be used in encounter prediction.
     // Particles having a close encounter will be overwritten 
     // later by encounter step.
-    memcpy(rim->particles_backup,r->particles,N*sizeof(struct reb_particle)); 
     reb_integrator_mercurius_kepler_step(r,r->dt);
 
     reb_mercurius_encounter_predict(r);
@@ -556,12 +702,14 @@ void reb_integrator_mercurius_reset(struct reb_simulation* r){
     r->ri_mercurius.tponly_encounter = 0;
     r->ri_mercurius.recalculate_coordinates_this_timestep = 0;
     // Internal arrays (only used within one timestep)
-    free(r->ri_mercurius.particles_backup);
+    reb_free(r->ri_mercurius.particles_backup);
     r->ri_mercurius.particles_backup = NULL;
-    free(r->ri_mercurius.particles_backup_additionalforces);
+    reb_free(r->ri_mercurius.particles_backup_additionalforces);
     r->ri_mercurius.particles_backup_additionalforces = NULL;
     free(r->ri_mercurius.encounter_map);
     r->ri_mercurius.encounter_map = NULL;
+    free(r->ri_mercurius.encounter_group);
+    r->ri_mercurius.encounter_group = NULL;
     r->ri_mercurius.allocatedN = 0;
     r->ri_mercurius.allocatedN_additionalforces = 0;
     // dcrit array
@@ -31,4 +31,91 @@ void reb_integrator_mercurius_reset(struct reb_simulation* r);          ///< Int
 void reb_integrator_mercurius_inertial_to_dh(struct reb_simulation* r); ///< Internal in-place coordinate transformation
 void reb_integrator_mercurius_dh_to_inertial(struct reb_simulation* r); ///< Internal in-place coordinate transformation
 double reb_integrator_mercurius_calculate_dcrit_for_particle(struct reb_simulation* r, unsigned int i); ///< Internal function for calculating dcrit in reb_add_local
+
+/**
+ * @brief Identifies the switching function used by MERCURIUS.
+ * @details The gravity routine uses this to select a specialized force kernel for
+ * the built-in switching functions. User supplied functions are called through 
+ * the function pointer.
+ */
+enum reb_integrator_mercurius_L_type {
+    REB_MERCURIUS_L_CUSTOM = 0,     ///< User supplied switching function
+    REB_MERCURIUS_L_MERCURY = 1,    ///< reb_integrator_mercurius_L_mercury()
+    REB_MERCURIUS_L_INFINITY = 2,   ///< reb_integrator_mercurius_L_infinity()
+    REB_MERCURIUS_L_C4 = 3,         ///< reb_integrator_mercurius_L_C4()
+    REB_MERCURIUS_L_C5 = 4,         ///< reb_integrator_mercurius_L_C5()
+};
+
+// The built-in switching functions as a function of y = (d-0.1*dcrit)/(0.9*dcrit).
+// They are defined here so that the gravity routine can inline them.
+
+static inline double reb_integrator_mercurius_L_mercury_y(const double y){
+    // This is the changeover function used by the Mercury integrator.
+    if (y<0.){
+        return 0.;
+    }else if (y>1.){
+        return 1.;
+    }else{
+        return 10.*(y*y*y) - 15.*(y*y*y*y) + 6.*(y*y*y*y*y);
+    }
+}
+
+static inline double reb_integrator_mercurius_L_C4_y(const double y){
+    // This is the changeover function C4 proposed by Hernandez (2019)
+    if (y<0.){
+        return 0.;
+    }else if (y>1.){
+        return 1.;
+    }else{
+        return (70.*y*y*y*y -315.*y*y*y +540.*y*y -420.*y +126.)*y*y*y*y*y;
+    }
+}
+
+static inline double reb_integrator_mercurius_L_C5_y(const double y){
+    // This is the changeover function C5 proposed by Hernandez (2019)
+    if (y<0.){
+        return 0.;
+    }else if (y>1.){
+        return 1.;
+    }else{
+        return (-252.*y*y*y*y*y +1386.*y*y*y*y -3080.*y*y*y +3465.*y*y -1980.*y +462.)*y*y*y*y*y*y;
+    }
+}
+
+static inline double reb_integrator_mercurius_L_infinity_f(const double x){
+    if (x<0) return 0;
+    return exp(-1./x);
+}
+
+static inline double reb_integrator_mercurius_L_infinity_y(const double y){
+    // Infinitely differentiable function.
+    if (y<0.){
+        return 0.;
+    }else if (y>1.){
+        return 1.;
+    }else{
+        return reb_integrator_mercurius_L_infinity_f(y)/(reb_integrator_mercurius_L_infinity_f(y) + reb_integrator_mercurius_L_infinity_f(1.-y));
+    }
+}
+
+/**
+ * @brief Evaluates the switching function of type L_type.
+ * @details L_type is meant to be a compile time constant, in which case the 
+ * compiler removes the switch statement.
+ */
+static inline double reb_integrator_mercurius_L(const struct reb_simulation* const r, const enum reb_integrator_mercurius_L_type L_type, const double d, const double dcrit){
+    const double y = (d-0.1*dcrit)/(0.9*dcrit);
+    switch (L_type){
+        case REB_MERCURIUS_L_MERCURY:
+            return reb_integrator_mercurius_L_mercury_y(y);
+        case REB_MERCURIUS_L_INFINITY:
+            return reb_integrator_mercurius_L_infinity_y(y);
+        case REB_MERCURIUS_L_C4:
+            return reb_integrator_mercurius_L_C4_y(y);
+        case REB_MERCURIUS_L_C5:
+            return reb_integrator_mercurius_L_C5_y(y);
+        default:
+            return r->ri_mercurius.L(r, d, dcrit);
+    }
+}
 #endif
@@ -265,13 +265,15 @@ void reb_integrator_saba_synchronize(struct reb_simulation* const r){
     struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
     struct reb_simulation_integrator_saba* const ri_saba = &(r->ri_saba);
     int type = ri_saba->type;
+    if (ri_saba->is_synchronized == 0){
+        const int N = r->N;
         struct reb_particle* sync_pj  = NULL;
+        double* const kepler_X_correction = ri_whfast->kepler_X_correction;
         if (ri_saba->keep_unsynchronized){
             sync_pj = malloc(sizeof(struct reb_particle)*r->N);
             memcpy(sync_pj,r->ri_whfast.p_jh,r->N*sizeof(struct reb_particle));
+            ri_whfast->kepler_X_correction = NULL; // Do not change the warm start of the Kepler solver
         }
-    if (ri_saba->is_synchronized == 0){
-        const int N = r->N;
         if (type>=0x100){ // correctors on
             // Drift already done, just need corrector
             reb_saba_corrector_step(r, reb_saba_cc[type%0x100]);
@@ -283,6 +285,7 @@ void reb_integrator_saba_synchronize(struct reb_simulation* const r){
         if (ri_saba->keep_unsynchronized){
             memcpy(r->ri_whfast.p_jh,sync_pj,r->N*sizeof(struct reb_particle));
             free(sync_pj);
+            ri_whfast->kepler_X_correction = kepler_X_correction;
         }else{
             ri_saba->is_synchronized = 1;
         }
@@ -78,16 +78,35 @@ void reb_integrator_sei_part1(struct reb_simulation* const r){
 	r->t+=r->dt/2.;
 }
 
+int reb_integrator_sei_applies_boundary(const struct reb_simulation* const r){
+	// Modifications after the timestep might move particles out of the box.
+	return r->integrator==REB_INTEGRATOR_SEI && r->boundary==REB_BOUNDARY_SHEAR && r->post_timestep_modifications==NULL;
+}
+
 void reb_integrator_sei_part2(struct reb_simulation* r){
 	const int N = r->N;
 	struct reb_particle* const particles = r->particles;
 	const struct reb_simulation_integrator_sei ri_sei = r->ri_sei;
+	r->t+=r->dt/2.;
+	if (reb_integrator_sei_applies_boundary(r)){
+		// Shift particles back into the box while they are in cache.
+		// reb_step() skips reb_boundary_check() in this case.
+		const struct reb_vec3d boxsize = r->boxsize;
+		double offsetp1, offsetm1;
+		reb_boundary_shear_offsets(r, &offsetp1, &offsetm1);
 #pragma omp parallel for schedule(guided)
-	for (int i=0;i<N;i++){
-		operator_phi1(r->dt, &(particles[i]));
-		operator_H012(r->dt, ri_sei, &(particles[i]));
+		for (int i=0;i<N;i++){
+			operator_phi1(r->dt, &(particles[i]));
+			operator_H012(r->dt, ri_sei, &(particles[i]));
+			reb_boundary_shear_particle(&(particles[i]), boxsize, ri_sei.OMEGA, offsetp1, offsetm1);
+		}
+	}else{
+#pragma omp parallel for schedule(guided)
+		for (int i=0;i<N;i++){
+			operator_phi1(r->dt, &(particles[i]));
+			operator_H012(r->dt, ri_sei, &(particles[i]));
+		}
 	}
-	r->t+=r->dt/2.;
 	r->dt_last_done = r->dt;
 }
 
@@ -29,4 +29,5 @@ void reb_integrator_sei_part2(struct reb_simulation* r);       ///< Internal fun
 void reb_integrator_sei_synchronize(struct reb_simulation* r); ///< Internal function used to call a specific integrator
 void reb_integrator_sei_reset(struct reb_simulation* r);       ///< Internal function used to call a specific integrator
 void reb_integrator_sei_init(struct reb_simulation* const r);  ///< Used to initialize constants. 
+int reb_integrator_sei_applies_boundary(const struct reb_simulation* const r); ///< Returns 1 if part2 already applied the shearing sheet boundary conditions.
 #endif
@@ -40,6 +40,8 @@
 #include "boundary.h"
 #include "integrator.h"
 #include "integrator_whfast.h"
+#include "profiling.h"
+#include "allocator.h"
 
 #define MAX(a, b) ((a) < (b) ? (b) : (a))   ///< Returns the maximum of a and b
 #define MIN(a, b) ((a) > (b) ? (b) : (a))   ///< Returns the minimum of a and b
@@ -159,9 +161,29 @@ static void stiefel_Gs3(double *restrict Gs, double beta, double X) {
 
 #define WHFAST_NMAX_QUART 64    ///< Maximum number of iterations for quartic solver
 #define WHFAST_NMAX_NEWT  32    ///< Maximum number of iterations for Newton's method
+
+// Warm start of the Kepler solver. The error of the second order initial guess for X 
+// is dominated by a term proportional to dt^3 whose coefficient changes slowly along 
+// the orbit. The coefficient measured in the last solve of a particle is used to 
+// correct the next guess. Corrections which are not small compared to X (for example 
+// after particles have been removed) are ignored.
+static inline double reb_whfast_kepler_warm_start(const double X, const double _dt, const double correction){
+    const double dX = correction*_dt*_dt*_dt;
+    if (fastabs(dX) < 0.01*fastabs(X)){
+        return X + dX;
+    }
+    return X;
+}
+
+// Returns the coefficient for the next warm start given the guess X_guess and the converged X.
+static inline double reb_whfast_kepler_warm_start_update(const double X, const double X_guess, const double _dt){
+    const double correction = (X - X_guess)/(_dt*_dt*_dt);
+    return isfinite(correction)?correction:0.;
+}
+
 /************************************
  * Keplerian motion for one planet  */
-void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double M, unsigned int i, double _dt){
+void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double M, unsigned int i, double _dt, double* const restrict X_correction){
     const struct reb_particle p1 = p_j[i];
 
     const double r0 = sqrt(p1.x*p1.x + p1.y*p1.y + p1.z*p1.z);
@@ -174,6 +196,7 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
     double Gs[6]; 
     double invperiod=0;  // only used for beta>0. Set to 0 only to suppress compiler warnings.
     double X_per_period = nan(""); // only used for beta>0. nan triggers Newton's method for beta<0.
+    double X_guess = 0.;
         
     if (beta>0.){
         // Elliptic orbit
@@ -192,12 +215,18 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
         X = dtr0i * (1. - dtr0i*eta0*0.5*r0i); // second order guess
         //X = dtr0i *(1.- 0.5*dtr0i*r0i*(eta0-dtr0i*(eta0*eta0*r0i-1./3.*zeta0))); // third order guess
         //X = _dt*beta/M + eta0/M*(0.85*sqrt(1.+zeta0*zeta0/beta/eta0/eta0) - 1.);  // Dan's version 
+        X_guess = X;
+        if (X_correction){
+            X = reb_whfast_kepler_warm_start(X, _dt, X_correction[i]);
+        }
     }else{
         // Hyperbolic orbit
         X = 0.; // Initial guess 
     }
 
     unsigned int converged = 0;
+    unsigned int iterations = 1;
+    unsigned int bisection = 0;
     double oldX = X; 
 
     // Do one Newton step
@@ -214,6 +243,7 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
         X = beta*_dt/M;
         double prevX[WHFAST_NMAX_QUART+1];
         for(int n_lag=1; n_lag < WHFAST_NMAX_QUART; n_lag++){
+            iterations++;
             stiefel_Gs3(Gs, beta, X);
             const double f = r0*X + eta0*Gs[2] + zeta0*Gs[3] - _dt;
             const double fp = r0 + eta0*Gs[1] + zeta0*Gs[2];
@@ -236,6 +266,7 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
         // Newton's method
         double oldX2 = nan("");             
         for (int n_hg=1;n_hg<WHFAST_NMAX_NEWT;n_hg++){
+            iterations++;
             oldX2 = oldX;
             oldX = X;
             stiefel_Gs3(Gs, beta, X);
@@ -253,6 +284,7 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
         
     // If solver did not work, fallback to bisection 
     if (converged == 0){ 
+        bisection = 1;
         double X_min, X_max;
         if (beta>0.){
             //Elliptic
@@ -277,6 +309,7 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
         }
         X = (X_max + X_min)/2.;
         do{
+            iterations++;
             stiefel_Gs3(Gs, beta, X);
             double s   = r0*X + eta0*Gs[2] + zeta0*Gs[3]-_dt;
             if (s>=0.){
@@ -296,6 +329,21 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
         Gs[2] = 0.;
         Gs[3] = 0.;
     }
+    if (X_correction){
+        X_correction[i] = beta>0.?reb_whfast_kepler_warm_start_update(X, X_guess, _dt):0.;
+    }
+
+    // Ignoring const qualifiers. The solver is also called from within 
+    // parallel regions (see reb_whfast_kepler_solver_batch), hence the atomics.
+    struct reb_counters* const counters = &(((struct reb_simulation* const)r)->counters);
+#pragma omp atomic
+    counters->kepler_solves++;
+#pragma omp atomic
+    counters->kepler_iterations += iterations;
+    if (bisection){
+#pragma omp atomic
+        counters->kepler_bisections++;
+    }
 
     // Note: These are not the traditional f and g functions.
     double f = -M*Gs[2]*r0i;
@@ -347,6 +395,252 @@ void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_p
 
 }
 
+#define WHFAST_KEPLER_BATCH 8    ///< Number of orbits advanced together by reb_whfast_kepler_solver_batch
+
+// Same as stiefel_Gs3 for a batch of orbits. The range reduction and doubling loops 
+// run until every orbit is done but only change the orbits that still need them.
+static void stiefel_Gs3_batch(double Gs[4][WHFAST_KEPLER_BATCH], const double* restrict const beta, const double* restrict const X) {
+    double z[WHFAST_KEPLER_BATCH];
+    unsigned int n[WHFAST_KEPLER_BATCH];
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        z[l] = beta[l]*(X[l]*X[l]);
+        n[l] = 0;
+    }
+    int reduce = 1;
+    while(reduce){
+        reduce = 0;
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            if (fabs(z[l])>0.1){
+                z[l] = z[l]/4.;
+                n[l]++;
+                reduce = 1;
+            }
+        }
+    }
+    unsigned int nmax = 0;
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        const int nmaxs = 13;
+        double c_odd  = invfactorial[nmaxs];
+        double c_even = invfactorial[nmaxs-1];
+        for(int np=nmaxs-2;np>=3;np-=2){
+            c_odd  = invfactorial[np]    - z[l] *c_odd;
+            c_even = invfactorial[np-1]  - z[l] *c_even;
+        }
+        Gs[3][l] = c_odd;
+        Gs[2][l] = c_even;
+        Gs[1][l] = invfactorial[1]  - z[l] *c_odd;
+        Gs[0][l] = invfactorial[0]  - z[l] *c_even;
+        nmax = n[l]>nmax?n[l]:nmax;
+    }
+    for (unsigned int k=nmax;k>0;k--){ 
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            if (n[l]>=k){
+                Gs[3][l] = (Gs[2][l]+Gs[0][l]*Gs[3][l])*0.25;
+                Gs[2][l] = Gs[1][l]*Gs[1][l]*0.5;
+                Gs[1][l] = Gs[0][l]*Gs[1][l];
+                Gs[0][l] = 2.*Gs[0][l]*Gs[0][l]-1.;
+            }
+        }
+    }
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        const double X2 = X[l]*X[l];
+        Gs[1][l] *= X[l]; 
+        Gs[2][l] *= X2; 
+        Gs[3][l] *= X2*X[l];
+    }
+}
+
+// Advances the orbits of the particles p[0] to p[WHFAST_KEPLER_BATCH-1] around the central 
+// masses M with Newton's method. Orbits which need the quartic solver or bisection are left 
+// unchanged and flagged in fallback. Orbits with a period shorter than the timestep are flagged in warning.
+// The number of Newton iterations of each orbit is stored in iterations.
+// X_correction contains pointers to the warm start coefficients of the orbits (or NULL).
+REB_TARGET_CLONES static void reb_whfast_kepler_solver_block(struct reb_particle* const p[WHFAST_KEPLER_BATCH], const double* restrict const M, const double _dt, double* const X_correction[WHFAST_KEPLER_BATCH], int* restrict const fallback, int* restrict const warning, int* restrict const iterations){
+    double x[WHFAST_KEPLER_BATCH], y[WHFAST_KEPLER_BATCH], z[WHFAST_KEPLER_BATCH];
+    double vx[WHFAST_KEPLER_BATCH], vy[WHFAST_KEPLER_BATCH], vz[WHFAST_KEPLER_BATCH];
+    double r0[WHFAST_KEPLER_BATCH], r0i[WHFAST_KEPLER_BATCH], beta[WHFAST_KEPLER_BATCH];
+    double eta0[WHFAST_KEPLER_BATCH], zeta0[WHFAST_KEPLER_BATCH];
+    double X[WHFAST_KEPLER_BATCH], Xs[WHFAST_KEPLER_BATCH], oldX[WHFAST_KEPLER_BATCH], oldX2[WHFAST_KEPLER_BATCH];
+    double X_per_period[WHFAST_KEPLER_BATCH], ri[WHFAST_KEPLER_BATCH], X_guess[WHFAST_KEPLER_BATCH];
+    double Gs[4][WHFAST_KEPLER_BATCH];
+    double G1[WHFAST_KEPLER_BATCH], G2[WHFAST_KEPLER_BATCH], G3[WHFAST_KEPLER_BATCH];
+    int active[WHFAST_KEPLER_BATCH];
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        const struct reb_particle p1 = *p[l];
+        x[l] = p1.x; y[l] = p1.y; z[l] = p1.z;
+        vx[l] = p1.vx; vy[l] = p1.vy; vz[l] = p1.vz;
+    }
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        r0[l] = sqrt(x[l]*x[l] + y[l]*y[l] + z[l]*z[l]);
+        r0i[l] = 1./r0[l];
+        const double v2 =  vx[l]*vx[l] + vy[l]*vy[l] + vz[l]*vz[l];
+        beta[l] = 2.*M[l]*r0i[l] - v2;
+        eta0[l] = x[l]*vx[l] + y[l]*vy[l] + z[l]*vz[l];
+        zeta0[l] = M[l] - beta[l]*r0[l];
+        if (beta[l]>0.){
+            // Elliptic orbit
+            const double sqrt_beta = sqrt(beta[l]);
+            const double invperiod = sqrt_beta*beta[l]/(2.*M_PI*M[l]);
+            X_per_period[l] = 2.*M_PI/sqrt_beta;
+            warning[l] = fabs(_dt)*invperiod>1.;
+            const double dtr0i = _dt*r0i[l];
+            X[l] = dtr0i * (1. - dtr0i*eta0[l]*0.5*r0i[l]); // second order guess
+            X_guess[l] = X[l];
+            if (X_correction[l]){
+                X[l] = reb_whfast_kepler_warm_start(X[l], _dt, *X_correction[l]);
+            }
+        }else{
+            // Hyperbolic orbit
+            X_per_period[l] = nan("");
+            warning[l] = 0;
+            X[l] = 0.; // Initial guess 
+            X_guess[l] = 0.;
+        }
+    }
+
+    // Do one Newton step
+    stiefel_Gs3_batch(Gs, beta, X);
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        oldX[l] = X[l];
+        const double eta0Gs1zeta0Gs2 = eta0[l]*Gs[1][l] + zeta0[l]*Gs[2][l];
+        ri[l] = 1./(r0[l] + eta0Gs1zeta0Gs2);
+        X[l]  = ri[l]*(X[l]*eta0Gs1zeta0Gs2-eta0[l]*Gs[2][l]-zeta0[l]*Gs[3][l]+_dt);
+        // Large steps need the quartic solver
+        fallback[l] = fastabs(X[l]-oldX[l]) > 0.01*X_per_period[l];
+        active[l] = !fallback[l];
+        iterations[l] = 1;
+        oldX2[l] = nan("");
+    }
+
+    // Newton's method
+    for (int n_hg=1;n_hg<WHFAST_NMAX_NEWT;n_hg++){
+        int any_active = 0;
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            any_active |= active[l];
+        }
+        if (!any_active){
+            break;
+        }
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            if (active[l]){
+                oldX2[l] = oldX[l];
+                oldX[l] = X[l];
+                iterations[l]++;
+            }
+            Xs[l] = active[l]?X[l]:0.; // Finished orbits might have a diverging X 
+        }
+        stiefel_Gs3_batch(Gs, beta, Xs);
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            if (active[l]){
+                G1[l] = Gs[1][l];
+                G2[l] = Gs[2][l];
+                G3[l] = Gs[3][l];
+                const double eta0Gs1zeta0Gs2 = eta0[l]*Gs[1][l] + zeta0[l]*Gs[2][l];
+                ri[l] = 1./(r0[l] + eta0Gs1zeta0Gs2);
+                X[l]  = ri[l]*(X[l]*eta0Gs1zeta0Gs2-eta0[l]*Gs[2][l]-zeta0[l]*Gs[3][l]+_dt);
+                if (X[l]==oldX[l]||X[l]==oldX2[l]){
+                    // Converged.
+                    active[l] = 0;
+                }
+            }
+        }
+    }
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        fallback[l] |= active[l]; // Not converged, needs bisection
+    }
+
+    for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+        if (fallback[l]) continue;
+        if (X_correction[l]){
+            *X_correction[l] = beta[l]>0.?reb_whfast_kepler_warm_start_update(X[l], X_guess[l], _dt):0.;
+        }
+        if (isnan(ri[l])){
+            // Exception for (almost) straight line motion in hyperbolic case
+            ri[l] = 0.;
+            G1[l] = 0.;
+            G2[l] = 0.;
+            G3[l] = 0.;
+        }
+        // Note: These are not the traditional f and g functions.
+        double f = -M[l]*G2[l]*r0i[l];
+        double g = _dt - M[l]*G3[l];
+        double fd = -M[l]*G1[l]*r0i[l]*ri[l]; 
+        double gd = -M[l]*G2[l]*ri[l]; 
+        
+        p[l]->x += f*x[l] + g*vx[l];
+        p[l]->y += f*y[l] + g*vy[l];
+        p[l]->z += f*z[l] + g*vz[l];
+        
+        p[l]->vx += fd*x[l] + gd*vx[l];
+        p[l]->vy += fd*y[l] + gd*vy[l];
+        p[l]->vz += fd*z[l] + gd*vz[l];
+    }
+}
+
+static void reb_whfast_timestep_warning(struct reb_simulation* const r){
+    if (r->ri_whfast.timestep_warning == 0){
+        r->ri_whfast.timestep_warning++;
+        reb_warning(r,"WHFast convergence issue. Timestep is larger than at least one orbital period.");
+    }
+}
+
+static inline void reb_whfast_kepler_backup(struct reb_vec6d* const restrict backup, const struct reb_particle* const restrict p_j, const unsigned int i){
+    if (backup){
+        backup[i] = (struct reb_vec6d){p_j[i].x, p_j[i].y, p_j[i].z, p_j[i].vx, p_j[i].vy, p_j[i].vz};
+    }
+}
+
+void reb_whfast_kepler_solver_batch(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double M, unsigned int i_start, unsigned int i_end, double _dt, double* const restrict X_correction, struct reb_vec6d* const restrict backup){
+    if (r->var_config_N || i_end<i_start+WHFAST_KEPLER_BATCH){
+        // Variational particles are advanced by the single orbit solver
+        for (unsigned int i=i_start;i<i_end;i++){
+            reb_whfast_kepler_backup(backup, p_j, i);
+            reb_whfast_kepler_solver(r, p_j, M, i, _dt, X_correction);
+        }
+        return;
+    }
+    const int N_blocks = (i_end-i_start)/WHFAST_KEPLER_BATCH;
+    uint64_t solves = 0;
+    uint64_t iterations_sum = 0;
+#pragma omp parallel for if((int)(i_end-i_start)>=reb_omp_min_N) reduction(+:solves,iterations_sum)
+    for (int b=0;b<N_blocks;b++){
+        const unsigned int i0 = i_start + b*WHFAST_KEPLER_BATCH;
+        struct reb_particle* p[WHFAST_KEPLER_BATCH];
+        double Ms[WHFAST_KEPLER_BATCH];
+        int fallback[WHFAST_KEPLER_BATCH];
+        int warning[WHFAST_KEPLER_BATCH];
+        int iterations[WHFAST_KEPLER_BATCH];
+        double* Xc[WHFAST_KEPLER_BATCH];
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            reb_whfast_kepler_backup(backup, p_j, i0+l);
+            p[l] = &p_j[i0+l];
+            Ms[l] = M;
+            Xc[l] = X_correction?&X_correction[i0+l]:NULL;
+        }
+        reb_whfast_kepler_solver_block(p, Ms, _dt, Xc, fallback, warning, iterations);
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            iterations_sum += iterations[l];
+            solves += !fallback[l];
+            if (warning[l]){
+                // Ignoring const qualifiers. See reb_whfast_kepler_solver.
+#pragma omp critical
+                reb_whfast_timestep_warning((struct reb_simulation* const)r);
+            }
+            if (fallback[l]){
+                reb_whfast_kepler_solver(r, p_j, M, i0+l, _dt, X_correction);
+            }
+        }
+    }
+    // Ignoring const qualifiers. See reb_whfast_kepler_solver.
+    struct reb_counters* const counters = &(((struct reb_simulation* const)r)->counters);
+    counters->kepler_solves += solves;
+    counters->kepler_iterations += iterations_sum;
+    for (unsigned int i=i_start+N_blocks*WHFAST_KEPLER_BATCH;i<i_end;i++){
+        reb_whfast_kepler_backup(backup, p_j, i);
+        reb_whfast_kepler_solver(r, p_j, M, i, _dt, X_correction);
+    }
+}
+
 /***************************** 
  * Interaction Hamiltonian  */
 void reb_whfast_interaction_step(struct reb_simulation* const r, const double _dt){
@@ -409,7 +703,7 @@ void reb_whfast_interaction_step(struct reb_simulation* const r, const double _d
             }
             break;
         case REB_WHFAST_COORDINATES_DEMOCRATICHELIOCENTRIC:
-#pragma omp parallel for 
+#pragma omp parallel for if(N_real>=reb_omp_min_N)
             for (unsigned int i=1;i<N_real;i++){
                 p_j[i].vx += _dt*particles[i].ax;
                 p_j[i].vy += _dt*particles[i].ay;
@@ -417,14 +711,14 @@ void reb_whfast_interaction_step(struct reb_simulation* const r, const double _d
             }
             break;
         case REB_WHFAST_COORDINATES_WHDS:
-#pragma omp parallel for 
+#pragma omp parallel for if(N_real>=reb_omp_min_N)
             for (unsigned int i=1;i<N_active;i++){
                 const double mi = particles[i].m;
                 p_j[i].vx += _dt*(m0+mi)*particles[i].ax/m0;
                 p_j[i].vy += _dt*(m0+mi)*particles[i].ay/m0;
                 p_j[i].vz += _dt*(m0+mi)*particles[i].az/m0;
             }
-#pragma omp parallel for 
+#pragma omp parallel for if(N_real>=reb_omp_min_N)
             for (unsigned int i=N_active;i<N_real;i++){
                 p_j[i].vx += _dt*particles[i].ax;
                 p_j[i].vy += _dt*particles[i].ay;
@@ -439,6 +733,7 @@ void reb_whfast_jump_step(const struct reb_simulation* const r, const double _dt
     const int N_real = r->N - r->N_var;
     const int N_active = (r->N_active==-1 || r->testparticle_type ==1)?N_real:r->N_active;
     const double m0 = r->particles[0].m;
+    PROFILING_START(r)
     switch (ri_whfast->coordinates){
         case REB_WHFAST_COORDINATES_JACOBI:
             // Nothing to be done.
@@ -446,14 +741,14 @@ void reb_whfast_jump_step(const struct reb_simulation* const r, const double _dt
         case REB_WHFAST_COORDINATES_DEMOCRATICHELIOCENTRIC:
             {
             double px=0, py=0, pz=0;
-#pragma omp parallel for reduction (+:px), reduction (+:py), reduction (+:pz)
+#pragma omp parallel for if(N_real>=reb_omp_min_N) reduction (+:px), reduction (+:py), reduction (+:pz)
             for(int i=1;i<N_active;i++){
                 const double m = r->particles[i].m;
                 px += m * p_h[i].vx;
                 py += m * p_h[i].vy;
                 pz += m * p_h[i].vz;
             }
-#pragma omp parallel for 
+#pragma omp parallel for if(N_real>=reb_omp_min_N)
             for(int i=1;i<N_real;i++){
                 p_h[i].x += _dt * (px/m0);
                 p_h[i].y += _dt * (py/m0);
@@ -464,21 +759,21 @@ void reb_whfast_jump_step(const struct reb_simulation* const r, const double _dt
         case REB_WHFAST_COORDINATES_WHDS:
             {
             double px=0, py=0, pz=0;
-#pragma omp parallel for reduction (+:px), reduction (+:py), reduction (+:pz)
+#pragma omp parallel for if(N_real>=reb_omp_min_N) reduction (+:px), reduction (+:py), reduction (+:pz)
             for(int i=1;i<N_active;i++){
                 const double m = r->particles[i].m;
                 px += m * p_h[i].vx / (m0+m);
                 py += m * p_h[i].vy / (m0+m);
                 pz += m * p_h[i].vz / (m0+m);
              }
-#pragma omp parallel for 
+#pragma omp parallel for if(N_real>=reb_omp_min_N)
             for(int i=1;i<N_active;i++){
                 const double m = r->particles[i].m;
                 p_h[i].x += _dt * (px - (m * p_h[i].vx / (m0+m)) );
                 p_h[i].y += _dt * (py - (m * p_h[i].vy / (m0+m)) );
                 p_h[i].z += _dt * (pz - (m * p_h[i].vz / (m0+m)) );
             }
-#pragma omp parallel for 
+#pragma omp parallel for if(N_real>=reb_omp_min_N)
             for(int i=N_active;i<N_real;i++){
                 p_h[i].x += _dt * px;
                 p_h[i].y += _dt * py;
@@ -486,7 +781,7 @@ void reb_whfast_jump_step(const struct reb_simulation* const r, const double _dt
             }
             }
             break;
-    };
+    };    PROFILING_STOP(r, REB_PROFILING_CAT_JUMP)
 }
 
 /***************************** 
@@ -499,28 +794,99 @@ void reb_whfast_kepler_step(const struct reb_simulation* const r, const double _
     const int N_active = (r->N_active==-1 || r->testparticle_type ==1)?N_real:r->N_active;
     const int coordinates = r->ri_whfast.coordinates;
     struct reb_particle* const p_j = r->ri_whfast.p_jh;
-    double eta = m0;
-#pragma omp parallel for 
+    double* const X_correction = r->ri_whfast.kepler_warm_start?r->ri_whfast.kepler_X_correction:NULL;
+    PROFILING_START(r)
+    switch (coordinates){
+        case REB_WHFAST_COORDINATES_JACOBI:
+        {
+            // The central mass changes for every active particle
+            double eta = m0;
+            for (int i=1;i<N_active;i++){
+                eta += p_j[i].m;
+                reb_whfast_kepler_solver(r, p_j, eta*G, i, _dt, X_correction);
+            }
+            reb_whfast_kepler_solver_batch(r, p_j, eta*G, MAX(N_active,1), N_real, _dt, X_correction, NULL);
+        }
+            break;
+        case REB_WHFAST_COORDINATES_DEMOCRATICHELIOCENTRIC:
+            reb_whfast_kepler_solver_batch(r, p_j, m0*G, 1, N_real, _dt, X_correction, NULL);
+            break;
+        case REB_WHFAST_COORDINATES_WHDS:
+            for (int i=1;i<N_active;i++){
+                reb_whfast_kepler_solver(r, p_j, (m0+p_j[i].m)*G, i, _dt, X_correction);
+            }
+            reb_whfast_kepler_solver_batch(r, p_j, m0*G, MAX(N_active,1), N_real, _dt, X_correction, NULL);
+            break;
+    };    PROFILING_STOP(r, REB_PROFILING_CAT_KEPLER)
+}
+
+void reb_whfast_kepler_step_ensemble(struct reb_simulation** const rs, const int K, const double _dt){
+    if (K==0){
+        return;
+    }
+    // All simulations have the same number of particles and coordinates.
+    const struct reb_simulation* const r = rs[0];
+    const unsigned int N_real = r->N-r->N_var;
+    const int N_active = (r->N_active==-1 || r->testparticle_type ==1)?N_real:r->N_active;
+    const int coordinates = r->ri_whfast.coordinates;
+    double* const eta = malloc(sizeof(double)*K);
+    double* const M = malloc(sizeof(double)*K);
+    for (int k=0;k<K;k++){
+        eta[k] = rs[k]->particles[0].m;
+    }
+    const int N_blocks = K/WHFAST_KEPLER_BATCH;
     for (unsigned int i=1;i<N_real;i++){
-        switch (coordinates){
-            case REB_WHFAST_COORDINATES_JACOBI:
-                if (i<N_active){
-                    eta += p_j[i].m;
+        // Same central masses as in reb_whfast_kepler_step
+        for (int k=0;k<K;k++){
+            const double m0 = rs[k]->particles[0].m;
+            const double G = rs[k]->G;
+            switch (coordinates){
+                case REB_WHFAST_COORDINATES_JACOBI:
+                    if (i<N_active){
+                        eta[k] += rs[k]->ri_whfast.p_jh[i].m;
+                    }
+                    M[k] = eta[k]*G;
+                    break;
+                case REB_WHFAST_COORDINATES_DEMOCRATICHELIOCENTRIC:
+                    M[k] = m0*G;
+                    break;
+                case REB_WHFAST_COORDINATES_WHDS:
+                    M[k] = i<N_active?(m0+rs[k]->ri_whfast.p_jh[i].m)*G:m0*G;
+                    break;
+            }
+        }
+#pragma omp parallel for
+        for (int b=0;b<N_blocks;b++){
+            const int k0 = b*WHFAST_KEPLER_BATCH;
+            struct reb_particle* p[WHFAST_KEPLER_BATCH];
+            int fallback[WHFAST_KEPLER_BATCH];
+            int warning[WHFAST_KEPLER_BATCH];
+            int iterations[WHFAST_KEPLER_BATCH];
+            double* Xc[WHFAST_KEPLER_BATCH];
+            for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+                p[l] = &rs[k0+l]->ri_whfast.p_jh[i];
+                Xc[l] = rs[k0+l]->ri_whfast.kepler_warm_start?&rs[k0+l]->ri_whfast.kepler_X_correction[i]:NULL;
+            }
+            reb_whfast_kepler_solver_block(p, M+k0, _dt, Xc, fallback, warning, iterations);
+            for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+                // Every block works on different simulations, no atomics needed.
+                rs[k0+l]->counters.kepler_iterations += iterations[l];
+                rs[k0+l]->counters.kepler_solves += !fallback[l];
+                if (warning[l]){
+#pragma omp critical
+                    reb_whfast_timestep_warning(rs[k0+l]);
                 }
-                break;
-            case REB_WHFAST_COORDINATES_DEMOCRATICHELIOCENTRIC:
-                //  eta = m0
-                break;
-            case REB_WHFAST_COORDINATES_WHDS:
-                if (i<N_active){
-                    eta = m0+p_j[i].m;
-                }else{
-                    eta = m0;
+                if (fallback[l]){
+                    reb_whfast_kepler_solver(rs[k0+l], rs[k0+l]->ri_whfast.p_jh, M[k0+l], i, _dt, rs[k0+l]->ri_whfast.kepler_warm_start?rs[k0+l]->ri_whfast.kepler_X_correction:NULL);
                 }
-                break;
-        };
-        reb_whfast_kepler_solver(r, p_j, eta*G, i, _dt);
+            }
+        }
+        for (int k=N_blocks*WHFAST_KEPLER_BATCH;k<K;k++){
+            reb_whfast_kepler_solver(rs[k], rs[k]->ri_whfast.p_jh, M[k], i, _dt, rs[k]->ri_whfast.kepler_warm_start?rs[k]->ri_whfast.kepler_X_correction:NULL);
+        }
     }
+    free(M);
+    free(eta);
 }
 
 void reb_whfast_com_step(const struct reb_simulation* const r, const double _dt){
@@ -793,9 +1159,16 @@ int reb_integrator_whfast_init(struct reb_simulation* const r){
     const int N = r->N;
     if (ri_whfast->allocated_N != N){
         ri_whfast->allocated_N = N;
-        ri_whfast->p_jh = realloc(ri_whfast->p_jh,sizeof(struct reb_particle)*N);
+        ri_whfast->p_jh = reb_reserve(ri_whfast->p_jh,sizeof(struct reb_particle)*N);
         ri_whfast->recalculate_coordinates_this_timestep = 1;
     }
+    if (ri_whfast->kepler_warm_start && ri_whfast->allocated_N_kepler != (unsigned int)N){
+        ri_whfast->kepler_X_correction = realloc(ri_whfast->kepler_X_correction,sizeof(double)*N);
+        for (int i=ri_whfast->allocated_N_kepler;i<N;i++){
+            ri_whfast->kepler_X_correction[i] = 0.; // No warm start
+        }
+        ri_whfast->allocated_N_kepler = N;
+    }
     return 0;
 }
 
@@ -858,6 +1231,95 @@ void reb_integrator_whfast_to_inertial(struct reb_simulation* const r){
     }
 }
 
+static int reb_whfast_particle_modified(const struct reb_particle* const p, const struct reb_particle* const q){
+    return p->x != q->x || p->y != q->y || p->z != q->z
+        || p->vx != q->vx || p->vy != q->vy || p->vz != q->vz
+        || p->m != q->m;
+}
+
+void reb_integrator_whfast_backup_particles(struct reb_simulation* const r){
+    struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    ri_whfast->N_backup = -1;
+    unsigned int safe_mode;
+    switch (r->integrator){
+        case REB_INTEGRATOR_WHFAST:
+            safe_mode = ri_whfast->safe_mode;
+            break;
+        case REB_INTEGRATOR_SABA:
+            safe_mode = r->ri_saba.safe_mode;
+            break;
+        default:
+            return;
+    }
+    const int N = r->N;
+    if (safe_mode || ri_whfast->recalculate_coordinates_this_timestep || r->N_var || ri_whfast->p_jh==NULL || ri_whfast->allocated_N != N){
+        // All coordinates will be recalculated anyway.
+        return;
+    }
+    if (ri_whfast->allocated_Nbackup < N){
+        ri_whfast->allocated_Nbackup = N;
+        ri_whfast->p_backup = realloc(ri_whfast->p_backup,sizeof(struct reb_particle)*N);
+    }
+    memcpy(ri_whfast->p_backup, r->particles, sizeof(struct reb_particle)*N);
+    ri_whfast->N_backup = N;
+    ri_whfast->N_active_backup = (r->N_active==-1 || r->testparticle_type==1)?N:r->N_active;
+}
+
+void reb_integrator_whfast_update_modified_particles(struct reb_simulation* const r){
+    struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    struct reb_particle* const particles = r->particles;
+    struct reb_particle* const p_jh = ri_whfast->p_jh;
+    const struct reb_particle* const p_backup = ri_whfast->p_backup;
+    const int N = r->N;
+    const int N_active = (r->N_active==-1 || r->testparticle_type==1)?N:r->N_active;
+    const int N_backup = ri_whfast->N_backup;
+    ri_whfast->N_backup = -1;
+    if (N_backup != N || ri_whfast->N_active_backup != N_active || r->N_var || ri_whfast->recalculate_coordinates_this_timestep
+            || (r->integrator != REB_INTEGRATOR_WHFAST && r->integrator != REB_INTEGRATOR_SABA)){
+        // No usable copy, particles were added or removed, or the integrator changed.
+        ri_whfast->recalculate_coordinates_this_timestep = 1;
+        return;
+    }
+    int first = 0;
+    while (first<N && !reb_whfast_particle_modified(&particles[first], &p_backup[first])){
+        first++;
+    }
+    if (first==N){
+        // Nothing has been modified. The coordinates in p_jh are still valid.
+        return;
+    }
+    const unsigned int is_synchronized = r->integrator==REB_INTEGRATOR_SABA ? r->ri_saba.is_synchronized : ri_whfast->is_synchronized;
+    if (is_synchronized==0){
+        // p_jh is not synchronized with the particles (keep_unsynchronized). 
+        ri_whfast->recalculate_coordinates_this_timestep = 1;
+        return;
+    }
+    if (first<N_active){
+        if (ri_whfast->coordinates==REB_WHFAST_COORDINATES_JACOBI && first>0){
+            // Jacobi coordinates of particles before the first modified particle do not change.
+            reb_transformations_inertial_to_jacobi_posvel_from(particles, p_jh, particles, N, N_active, first);
+        }else{
+            // Modifying an active particle changes the centre of mass and thus all coordinates.
+            ri_whfast->recalculate_coordinates_this_timestep = 1;
+        }
+        return;
+    }
+    // Only test particles have been modified. They do not affect any other particle.
+    for (int i=first;i<N;i++){
+        if (!reb_whfast_particle_modified(&particles[i], &p_backup[i])){
+            continue;
+        }
+        const struct reb_particle p0 = ri_whfast->coordinates==REB_WHFAST_COORDINATES_JACOBI ? p_jh[0] : particles[0];
+        p_jh[i].x  = particles[i].x  - p0.x;
+        p_jh[i].y  = particles[i].y  - p0.y;
+        p_jh[i].z  = particles[i].z  - p0.z;
+        p_jh[i].vx = particles[i].vx - p_jh[0].vx;
+        p_jh[i].vy = particles[i].vy - p_jh[0].vy;
+        p_jh[i].vz = particles[i].vz - p_jh[0].vz;
+        p_jh[i].m  = particles[i].m;
+    }
+}
+
 void reb_integrator_whfast_debug_operator_kepler(struct reb_simulation* const r,double dt){
     if (reb_integrator_whfast_init(r)){
         // Non recoverable error occured.
@@ -891,6 +1353,8 @@ void reb_integrator_whfast_part1(struct reb_simulation* const r){
         // Non recoverable error occured.
         return;
     }
+    // The particles might have been modified since the last synchronization.
+    ri_whfast->output_is_synchronized = 0;
     
     // Only recalculate Jacobi coordinates if needed
     if (ri_whfast->safe_mode || ri_whfast->recalculate_coordinates_this_timestep){
@@ -954,6 +1418,23 @@ void reb_integrator_whfast_part1(struct reb_simulation* const r){
     r->t+=r->dt/2.;
 }
 
+static void reb_integrator_whfast_to_inertial_posvel(struct reb_simulation* const r){
+    struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    const int N_real = r->N-r->N_var;
+    const int N_active = (r->N_active==-1 || r->testparticle_type==1)?N_real:r->N_active;
+    switch (ri_whfast->coordinates){
+        case REB_WHFAST_COORDINATES_JACOBI:
+            reb_transformations_jacobi_to_inertial_posvel(r->particles, ri_whfast->p_jh, r->particles, N_real, N_active);
+            break;
+        case REB_WHFAST_COORDINATES_DEMOCRATICHELIOCENTRIC:
+            reb_transformations_democraticheliocentric_to_inertial_posvel(r->particles, ri_whfast->p_jh, N_real, N_active);
+            break;
+        case REB_WHFAST_COORDINATES_WHDS:
+            reb_transformations_whds_to_inertial_posvel(r->particles, ri_whfast->p_jh, N_real, N_active);
+            break;
+    };
+}
+
 void reb_integrator_whfast_synchronize(struct reb_simulation* const r){
     struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
     if (reb_integrator_whfast_init(r)){
@@ -961,12 +1442,18 @@ void reb_integrator_whfast_synchronize(struct reb_simulation* const r){
         return;
     }
     if (ri_whfast->is_synchronized == 0){
+        if (ri_whfast->keep_unsynchronized && ri_whfast->output_is_synchronized && !ri_whfast->recalculate_coordinates_this_timestep){
+            // Particles already contain the synchronized output of this step.
+            return;
+        }
         const int N_real = r->N-r->N_var;
         const int N_active = (r->N_active==-1 || r->testparticle_type==1)?N_real:r->N_active;
         struct reb_particle* sync_pj  = NULL;
+        double* const kepler_X_correction = ri_whfast->kepler_X_correction;
         if (ri_whfast->keep_unsynchronized){
             sync_pj = malloc(sizeof(struct reb_particle)*r->N);
             memcpy(sync_pj,r->ri_whfast.p_jh,r->N*sizeof(struct reb_particle));
+            ri_whfast->kepler_X_correction = NULL; // Do not change the warm start of the Kepler solver
         }
         switch (ri_whfast->kernel){
             case REB_WHFAST_KERNEL_DEFAULT: 
@@ -981,6 +1468,8 @@ void reb_integrator_whfast_synchronize(struct reb_simulation* const r){
                 break;
             default:
                 reb_error(r, "WHFast kernel not implemented.");
+                free(sync_pj);
+                ri_whfast->kepler_X_correction = kepler_X_correction;
                 return;
         };
         if (ri_whfast->corrector2){
@@ -989,17 +1478,7 @@ void reb_integrator_whfast_synchronize(struct reb_simulation* const r){
         if (ri_whfast->corrector){
             reb_whfast_apply_corrector(r, -1., ri_whfast->corrector);
         }
-        switch (ri_whfast->coordinates){
-            case REB_WHFAST_COORDINATES_JACOBI:
-                reb_transformations_jacobi_to_inertial_posvel(r->particles, ri_whfast->p_jh, r->particles, N_real, N_active);
-                break;
-            case REB_WHFAST_COORDINATES_DEMOCRATICHELIOCENTRIC:
-                reb_transformations_democraticheliocentric_to_inertial_posvel(r->particles, ri_whfast->p_jh, N_real, N_active);
-                break;
-            case REB_WHFAST_COORDINATES_WHDS:
-                reb_transformations_whds_to_inertial_posvel(r->particles, ri_whfast->p_jh, N_real, N_active);
-                break;
-        };
+        reb_integrator_whfast_to_inertial_posvel(r);
         for (int v=0;v<r->var_config_N;v++){
             struct reb_variational_configuration const vc = r->var_config[v];
             reb_transformations_jacobi_to_inertial_posvel(r->particles+vc.index, ri_whfast->p_jh+vc.index, r-> particles, N_real, N_active);
@@ -1007,6 +1486,8 @@ void reb_integrator_whfast_synchronize(struct reb_simulation* const r){
         if (ri_whfast->keep_unsynchronized){
             memcpy(r->ri_whfast.p_jh,sync_pj,r->N*sizeof(struct reb_particle));
             free(sync_pj);
+            ri_whfast->kepler_X_correction = kepler_X_correction;
+            ri_whfast->output_is_synchronized = 1;
         }else{
             ri_whfast->is_synchronized = 1;
         }
@@ -1197,6 +1678,101 @@ void reb_integrator_whfast_part2(struct reb_simulation* const r){
         }
     }
 }
+
+int reb_integrator_whfast_ensemble_compatible(struct reb_simulation* const r, const struct reb_simulation* const r0){
+    const struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    if (r->integrator != REB_INTEGRATOR_WHFAST 
+            || ri_whfast->kernel != REB_WHFAST_KERNEL_DEFAULT
+            || ri_whfast->corrector || ri_whfast->corrector2
+            || ri_whfast->keep_unsynchronized
+            || r->N_var || r->var_config_N){
+        return 0;
+    }
+    if (r0 != NULL){
+        const struct reb_simulation_integrator_whfast* const ri_whfast0 = &(r0->ri_whfast);
+        if (r->N != r0->N || r->N_active != r0->N_active || r->testparticle_type != r0->testparticle_type
+                || r->dt != r0->dt
+                || ri_whfast->coordinates != ri_whfast0->coordinates
+                || ri_whfast->safe_mode != ri_whfast0->safe_mode){
+            return 0;
+        }
+    }
+    if (reb_integrator_whfast_init(r)){
+        return 0;
+    }
+    return 1;
+}
+
+void reb_integrator_whfast_part1_ensemble(struct reb_simulation** const rs, const int K){
+    if (K==0){
+        return;
+    }
+    const double dt = rs[0]->dt;
+    struct reb_simulation** const rs_synchronized = malloc(sizeof(struct reb_simulation*)*K);
+    struct reb_simulation** const rs_unsynchronized = malloc(sizeof(struct reb_simulation*)*K);
+    int K_synchronized = 0;
+    int K_unsynchronized = 0;
+    for (int k=0;k<K;k++){
+        struct reb_simulation* const r = rs[k];
+        struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+        ri_whfast->output_is_synchronized = 0;
+        if (ri_whfast->safe_mode || ri_whfast->recalculate_coordinates_this_timestep){
+            if (ri_whfast->is_synchronized==0){
+                reb_integrator_whfast_synchronize(r);
+                if (ri_whfast->recalculate_coordinates_but_not_synchronized_warning==0){
+                    reb_warning(r,"Recalculating coordinates but pos/vel were not synchronized before.");
+                    ri_whfast->recalculate_coordinates_but_not_synchronized_warning++;
+                }
+            }
+            reb_integrator_whfast_from_inertial(r);
+            ri_whfast->recalculate_coordinates_this_timestep = 0;
+        }
+        if (ri_whfast->is_synchronized){
+            rs_synchronized[K_synchronized++] = r;
+        }else{
+            rs_unsynchronized[K_unsynchronized++] = r;
+        }
+    }
+    // First half DRIFT step or combined DRIFT step
+    reb_whfast_kepler_step_ensemble(rs_synchronized, K_synchronized, dt/2.);
+    reb_whfast_kepler_step_ensemble(rs_unsynchronized, K_unsynchronized, dt);
+    for (int k=0;k<K;k++){
+        struct reb_simulation* const r = rs[k];
+        reb_whfast_com_step(r, r->ri_whfast.is_synchronized?dt/2.:dt);
+        reb_whfast_jump_step(r, dt/2.);
+        reb_integrator_whfast_to_inertial(r);
+        r->t+=dt/2.;
+    }
+    free(rs_synchronized);
+    free(rs_unsynchronized);
+}
+
+void reb_integrator_whfast_part2_ensemble(struct reb_simulation** const rs, const int K){
+    if (K==0){
+        return;
+    }
+    const double dt = rs[0]->dt;
+    for (int k=0;k<K;k++){
+        struct reb_simulation* const r = rs[k];
+        reb_whfast_interaction_step(r, dt);
+        reb_whfast_jump_step(r, dt/2.);
+        r->ri_whfast.is_synchronized = 0;
+    }
+    if (rs[0]->ri_whfast.safe_mode){
+        reb_whfast_kepler_step_ensemble(rs, K, dt/2.);
+        for (int k=0;k<K;k++){
+            struct reb_simulation* const r = rs[k];
+            reb_whfast_com_step(r, dt/2.);
+            reb_integrator_whfast_to_inertial_posvel(r);
+            r->ri_whfast.is_synchronized = 1;
+        }
+    }
+    for (int k=0;k<K;k++){
+        struct reb_simulation* const r = rs[k];
+        r->t+=dt/2.;
+        r->dt_last_done = dt;
+    }
+}
     
 void reb_integrator_whfast_reset(struct reb_simulation* const r){
     struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
@@ -1206,6 +1782,7 @@ void reb_integrator_whfast_reset(struct reb_simulation* const r){
     ri_whfast->coordinates = REB_WHFAST_COORDINATES_JACOBI;
     ri_whfast->is_synchronized = 1;
     ri_whfast->keep_unsynchronized = 0;
+    ri_whfast->kepler_warm_start = 0;
     ri_whfast->safe_mode = 1;
     ri_whfast->recalculate_coordinates_this_timestep = 0;
     ri_whfast->allocated_N = 0;
@@ -1213,11 +1790,21 @@ void reb_integrator_whfast_reset(struct reb_simulation* const r){
     ri_whfast->timestep_warning = 0;
     ri_whfast->recalculate_coordinates_but_not_synchronized_warning = 0;
     if (ri_whfast->p_jh){
-        free(ri_whfast->p_jh);
+        reb_free(ri_whfast->p_jh);
         ri_whfast->p_jh = NULL;
     }
     if (ri_whfast->p_temp){
         free(ri_whfast->p_temp);
         ri_whfast->p_temp = NULL;
     }
+    ri_whfast->allocated_N_kepler = 0;
+    free(ri_whfast->kepler_X_correction);
+    ri_whfast->kepler_X_correction = NULL;
+    ri_whfast->allocated_Nbackup = 0;
+    ri_whfast->N_backup = -1;
+    ri_whfast->output_is_synchronized = 0;
+    if (ri_whfast->p_backup){
+        free(ri_whfast->p_backup);
+        ri_whfast->p_backup = NULL;
+    }
 }
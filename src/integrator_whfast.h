@@ -30,7 +30,14 @@
 void reb_integrator_whfast_part1(struct reb_simulation* r);		///< Internal function used to call a specific integrator
 void reb_integrator_whfast_part2(struct reb_simulation* r);		///< Internal function used to call a specific integrator
 void reb_integrator_whfast_synchronize(struct reb_simulation* r);	///< Internal function used to call a specific integrator
-void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double M, unsigned int i, double _dt);   ///< Internal function (Main WHFast Kepler Solver)
+int reb_integrator_whfast_ensemble_compatible(struct reb_simulation* const r, const struct reb_simulation* const r0);   ///< Internal function. Returns 1 if r can be advanced in lockstep with r0 (or with other simulations if r0 is NULL).
+void reb_integrator_whfast_part1_ensemble(struct reb_simulation** const rs, const int K);  ///< Internal function. Same as part1 for K compatible simulations advanced in lockstep.
+void reb_integrator_whfast_part2_ensemble(struct reb_simulation** const rs, const int K);  ///< Internal function. Same as part2 for K compatible simulations advanced in lockstep.
+void reb_whfast_kepler_solver(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double M, unsigned int i, double _dt, double* const restrict X_correction);   ///< Internal function (Main WHFast Kepler Solver). X_correction contains the warm start coefficients of all particles (or NULL).
+void reb_whfast_kepler_solver_batch(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double M, unsigned int i_start, unsigned int i_end, double _dt, double* const restrict X_correction, struct reb_vec6d* const restrict backup);   ///< Internal function (Kepler solver for particles i_start to i_end-1, several orbits at a time; stores positions and velocities before the step in backup if not NULL)
+void reb_whfast_kepler_step_ensemble(struct reb_simulation** const rs, const int K, const double _dt);   ///< Internal function (Kepler step for K simulations with the same particle number and coordinates, one particle of several simulations at a time)
+void reb_integrator_whfast_backup_particles(struct reb_simulation* const r);  ///< Internal function. Stores a copy of the particles before they can be modified by the user.
+void reb_integrator_whfast_update_modified_particles(struct reb_simulation* const r);  ///< Internal function. Updates the coordinates of particles which have been modified since reb_integrator_whfast_backup_particles.
 void reb_whfast_calculate_jerk(struct reb_simulation* r);       ///< Calculates "jerk" term
 
 #endif
@@ -0,0 +1,128 @@
+/**
+ * @file    interaction_groups.c
+ * @brief   Interaction groups which restrict the pairs of particles that interact.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details Every particle belongs to a group (reb_particle.group). For each group g,
+ * r->interaction_groups[g] has bit h set if particles in group g feel particles in
+ * group h. The direct summation kernels process particles in blocks and skip a pair
+ * of blocks entirely if none of their groups interact. Pairs which do not interact
+ * in either direction cannot have close encounters or collide.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "rebound.h"
+#include "interaction_groups.h"
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
+#define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
+
+int reb_set_interaction_groups(struct reb_simulation* const r, const int N_groups, const int* const matrix){
+    if (N_groups<0 || N_groups>REB_INTERACTION_GROUPS_MAX){
+        reb_error(r, "The number of interaction groups must be between 0 and 64.");
+        return -1;
+    }
+    free(r->interaction_groups);
+    r->interaction_groups = NULL;
+    r->N_interaction_groups = N_groups;
+    if (N_groups==0){
+        return 0;
+    }
+    r->interaction_groups = calloc(N_groups, sizeof(uint64_t));
+    for (int g=0; g<N_groups; g++){
+        for (int h=0; h<N_groups; h++){
+            if (matrix==NULL || matrix[g*N_groups+h]){
+                r->interaction_groups[g] |= UINT64_C(1)<<h;
+            }
+        }
+    }
+    return 0;
+}
+
+int reb_set_interaction(struct reb_simulation* const r, const int group, const int source, const int enabled){
+    if (group<0 || group>=r->N_interaction_groups || source<0 || source>=r->N_interaction_groups){
+        reb_error(r, "Invalid interaction group. Set the number of groups with reb_set_interaction_groups() first.");
+        return -1;
+    }
+    if (enabled){
+        r->interaction_groups[group] |= UINT64_C(1)<<source;
+    }else{
+        r->interaction_groups[group] &= ~(UINT64_C(1)<<source);
+    }
+    return 0;
+}
+
+int reb_interaction_groups_particles(const struct reb_simulation* const r, const int i, const int j){
+    if (r->N_interaction_groups==0 || i<0 || j<0 || i>=r->N || j>=r->N){
+        return 1;
+    }
+    const uint32_t gi = r->particles[i].group;
+    const uint32_t gj = r->particles[j].group;
+    if (gi>=(uint32_t)r->N_interaction_groups || gj>=(uint32_t)r->N_interaction_groups){
+        return 1;
+    }
+    return reb_interaction_groups_pair(r->interaction_groups, gi, gj);
+}
+
+int reb_interaction_groups_blocks_init(struct reb_simulation* const r, const int* const map, const int start, const int end, const int block_size, struct reb_interaction_groups_blocks* const blocks){
+    const struct reb_particle* const particles = r->particles;
+    const uint64_t* const interaction_groups = r->interaction_groups;
+    const uint32_t N_groups = r->N_interaction_groups;
+    const int N = end>start ? (end-start+block_size-1)/block_size : 0;
+    blocks->N = N;
+    blocks->groups = malloc(sizeof(uint64_t)*3*MAX(N,1));
+    blocks->any = blocks->groups + N;
+    blocks->all = blocks->groups + 2*N;
+    for (int k=0; k<N; k++){
+        uint64_t groups = 0;
+        const int iend = MIN(start+(k+1)*block_size, end);
+        for (int a=start+k*block_size; a<iend; a++){
+            const uint32_t g = particles[map?map[a]:a].group;
+            if (g>=N_groups){
+                reb_error(r, "A particle is not in a valid interaction group. The group must be smaller than N_interaction_groups.");
+                r->status = REB_EXIT_ERROR;
+                reb_interaction_groups_blocks_free(blocks);
+                return -1;
+            }
+            groups |= UINT64_C(1)<<g;
+        }
+        uint64_t any = 0;
+        uint64_t all = ~UINT64_C(0);
+        for (uint32_t g=0; g<N_groups; g++){
+            if ((groups>>g)&1){
+                any |= interaction_groups[g];
+                all &= interaction_groups[g];
+            }
+        }
+        blocks->groups[k] = groups;
+        blocks->any[k] = any;
+        blocks->all[k] = all;
+    }
+    return 0;
+}
+
+void reb_interaction_groups_blocks_free(struct reb_interaction_groups_blocks* const blocks){
+    free(blocks->groups);
+    blocks->groups = NULL;
+    blocks->any = NULL;
+    blocks->all = NULL;
+    blocks->N = 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file    interaction_groups.h
+ * @brief   Interaction groups which restrict the pairs of particles that interact.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _INTERACTION_GROUPS_H
+#define _INTERACTION_GROUPS_H
+#include <stdint.h>
+
+struct reb_simulation;
+
+/**
+ * @brief Groups contained in blocks of consecutive particles.
+ * @details Block k contains the particles at the positions start+k*block_size,...,
+ * start+(k+1)*block_size-1 of the index map (or the particles with these indices
+ * if there is no map). A pair of blocks can be skipped if no group in one block
+ * feels a group in the other block.
+ */
+struct reb_interaction_groups_blocks {
+    int N;              ///< Number of blocks
+    uint64_t* groups;   ///< Bit g is set if the block contains a particle in group g
+    uint64_t* any;      ///< Groups felt by at least one group in the block
+    uint64_t* all;      ///< Groups felt by all groups in the block
+};
+
+/**
+ * @brief Returns 1 if particles in group gi feel particles in group gj or vice versa.
+ */
+static inline int reb_interaction_groups_pair(const uint64_t* const interaction_groups, const uint32_t gi, const uint32_t gj){
+    return ((interaction_groups[gi]>>gj) | (interaction_groups[gj]>>gi)) & 1;
+}
+
+/**
+ * @brief Returns 1 if particles i and j interact in at least one direction.
+ * @details Always returns 1 if no interaction groups are set or one of the
+ * particles is not in a valid group.
+ */
+int reb_interaction_groups_particles(const struct reb_simulation* const r, const int i, const int j);
+
+/**
+ * @brief Calculates the groups of all blocks of the particles at the positions start,...,end-1.
+ * @param map Index map (for example the MERCURIUS encounter map). NULL for the identity.
+ * @return 0 on success. If a particle is not in a valid group, an error message is
+ * set, r->status is set to REB_EXIT_ERROR and -1 is returned.
+ */
+int reb_interaction_groups_blocks_init(struct reb_simulation* const r, const int* const map, const int start, const int end, const int block_size, struct reb_interaction_groups_blocks* const blocks);
+
+/**
+ * @brief Frees the arrays allocated by reb_interaction_groups_blocks_init().
+ */
+void reb_interaction_groups_blocks_free(struct reb_interaction_groups_blocks* const blocks);
+
+#endif // _INTERACTION_GROUPS_H
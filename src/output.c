@@ -29,6 +29,7 @@
 #include <time.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include "particle.h"
 #include "rebound.h"
 #include "tools.h"
@@ -36,6 +37,7 @@
 #include "integrator.h"
 #include "integrator_sei.h"
 #include "input.h"
+#include "profiling.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #include "mpi.h"
@@ -79,24 +81,6 @@ int reb_output_check(struct reb_simulation* r, double interval){
 }
 
 
-#ifdef PROFILING
-#warning PROFILING enabled. Rebound is NOT thread-safe.
-double profiling_time_sum[PROFILING_CAT_NUM];
-double profiling_time_initial   = 0;
-double profiling_timing_initial = 0;
-double profiling_time_final     = 0;
-void profiling_start(void){
-    struct timeval tim;
-    gettimeofday(&tim, NULL);
-    profiling_time_initial = tim.tv_sec+(tim.tv_usec/1000000.0);
-}
-void profiling_stop(int cat){
-    struct timeval tim;
-    gettimeofday(&tim, NULL);
-    profiling_time_final = tim.tv_sec+(tim.tv_usec/1000000.0);
-    profiling_time_sum[cat] += profiling_time_final - profiling_time_initial;
-}
-#endif // PROFILING
 
 void reb_output_timing(struct reb_simulation* r, const double tmax){
     const int N = r->N;
@@ -114,12 +98,11 @@ void reb_output_timing(struct reb_simulation* r, const double tmax){
         r->output_timing_last = temp;
     }else{
         printf("\r");
-#ifdef PROFILING
-        fputs("\033[A\033[2K",stdout);
-        for (int i=0;i<=PROFILING_CAT_NUM;i++){
-            fputs("\033[A\033[2K",stdout);
+        if (r->profiling){
+            for (int i=0;i<r->profiling->output_timing_lines;i++){
+                fputs("\033[A\033[2K",stdout);
+            }
         }
-#endif // PROFILING
     }
     printf("N_tot= %- 9d  ",N_tot);
     if (r->integrator==REB_INTEGRATOR_SEI){
@@ -132,45 +115,18 @@ void reb_output_timing(struct reb_simulation* r, const double tmax){
     if (tmax>0){
         printf("t/tmax= %5.2f%%",r->t/tmax*100.0);
     }
-#ifdef PROFILING
-    if (profiling_timing_initial==0){
-        struct timeval tim;
-        gettimeofday(&tim, NULL);
-        profiling_timing_initial = tim.tv_sec+(tim.tv_usec/1000000.0);
-    }
-    printf("\nCATEGORY       TIME \n");
-    double _sum = 0;
-    for (int i=0;i<=PROFILING_CAT_NUM;i++){
-        switch (i){
-            case PROFILING_CAT_INTEGRATOR:
-                printf("Integrator     ");
-                break;
-            case PROFILING_CAT_BOUNDARY:
-                printf("Boundary check ");
-                break;
-            case PROFILING_CAT_GRAVITY:
-                printf("Gravity/Forces ");
-                break;
-            case PROFILING_CAT_COLLISION:
-                printf("Collisions     ");
-                break;
-#ifdef OPENGL
-            case PROFILING_CAT_VISUALIZATION:
-                printf("Visualization  ");
-                break;
-#endif // OPENGL
-            case PROFILING_CAT_NUM:
-                printf("Other          ");
-                break;
-        }
-        if (i==PROFILING_CAT_NUM){
-            printf("%5.2f%%",(1.-_sum/(profiling_time_final - profiling_timing_initial))*100.);
-        }else{
-            printf("%5.2f%%\n",profiling_time_sum[i]/(profiling_time_final - profiling_timing_initial)*100.);
-            _sum += profiling_time_sum[i];
+    if (r->profiling){
+        struct reb_profiling* const p = r->profiling;
+        const double elapsed = reb_profiling_clock() - p->time_start;
+        printf("\nCATEGORY            TIME [s] SELF [%%]       CALLS\n");
+        double sum = 0;
+        for (int i=0;i<REB_PROFILING_CAT_NUM;i++){
+            printf("%-18s %9.3f %7.2f%% %11llu\n", reb_profiling_category_names[i], p->time[i], p->time_self[i]/elapsed*100., (unsigned long long)p->calls[i]);
+            sum += p->time_self[i];
         }
+        printf("%-18s %9.3f %7.2f%%", "other", elapsed-sum, (1.-sum/elapsed)*100.);
+        p->output_timing_lines = REB_PROFILING_CAT_NUM+2;
     }
-#endif // PROFILING
     fflush(stdout);
     r->output_timing_last = temp;
 }
@@ -218,14 +174,109 @@ void reb_output_orbits(struct reb_simulation* r, char* filename){
     fclose(of);
 }
 
-void static inline reb_save_dp7(struct reb_dp7* dp7, const int N3, char** bufp, size_t* sizep, size_t* allocatedsize){
-    reb_output_stream_write(bufp, allocatedsize, sizep, dp7->p0,sizeof(double)*N3);
-    reb_output_stream_write(bufp, allocatedsize, sizep, dp7->p1,sizeof(double)*N3);
-    reb_output_stream_write(bufp, allocatedsize, sizep, dp7->p2,sizeof(double)*N3);
-    reb_output_stream_write(bufp, allocatedsize, sizep, dp7->p3,sizeof(double)*N3);
-    reb_output_stream_write(bufp, allocatedsize, sizep, dp7->p4,sizeof(double)*N3);
-    reb_output_stream_write(bufp, allocatedsize, sizep, dp7->p5,sizeof(double)*N3);
-    reb_output_stream_write(bufp, allocatedsize, sizep, dp7->p6,sizeof(double)*N3);
+// Scatter-gather output
+// The binary serialization is produced as a list of iovecs. Large arrays
+// are not copied. The iovecs point directly into the simulation's arrays. 
+// Field headers, small values and the particles (which need to be 
+// sanitized) are copied to a small scratch buffer. Whenever the list or
+// the scratch buffer are full, the flush function consumes the iovecs,
+// for example with writev. If no flush function is set, only the total 
+// size is calculated.
+
+// Adds data to the list without copying it.
+static void reb_output_iovecs_add(struct reb_output_iovecs* v, const void* data, const size_t size){
+    if (v->flush==NULL || size==0){
+        v->size += size;
+        return;
+    }
+    if (v->N>0 && (const char*)v->iov[v->N-1].iov_base+v->iov[v->N-1].iov_len == (const char*)data){
+        // Contiguous with previous iovec
+        v->iov[v->N-1].iov_len += size;
+    }else{
+        if (v->N==REB_OUTPUT_IOVECS_N){
+            reb_output_iovecs_flush(v);
+        }
+        v->iov[v->N].iov_base = (void*)data;
+        v->iov[v->N].iov_len = size;
+        v->N++;
+    }
+    // Only updated after the flush so that the iovecs always end at size.
+    v->size += size;
+}
+
+// Copies data to the scratch buffer and adds it to the list. 
+static void* reb_output_iovecs_copy(struct reb_output_iovecs* v, const void* data, const size_t size){
+    if (v->flush==NULL){
+        v->size += size;
+        return NULL;
+    }
+    if (v->scratch_used+size>REB_OUTPUT_SCRATCH_SIZE || v->N==REB_OUTPUT_IOVECS_N){
+        reb_output_iovecs_flush(v);
+    }
+    char* const dst = v->scratch+v->scratch_used;
+    memcpy(dst, data, size);
+    v->scratch_used += size;
+    reb_output_iovecs_add(v, dst, size);
+    return dst;
+}
+
+// Small values might be temporary variables and are therefore copied.
+static void reb_output_iovecs_value(struct reb_output_iovecs* v, const void* data, const size_t size){
+    if (size<=REB_OUTPUT_COPY_MAX){
+        reb_output_iovecs_copy(v, data, size);
+    }else{
+        reb_output_iovecs_add(v, data, size);
+    }
+}
+
+void reb_output_iovecs_flush(struct reb_output_iovecs* v){
+    if (v->flush && v->N){
+        v->flush(v);
+    }
+    v->N = 0;
+    v->scratch_used = 0;
+}
+
+static void reb_output_iovecs_flush_memcpy(struct reb_output_iovecs* v){
+    char* buf = v->data;
+    for (int i=0;i<v->N;i++){
+        memcpy(buf, v->iov[i].iov_base, v->iov[i].iov_len);
+        buf += v->iov[i].iov_len;
+    }
+    v->data = buf;
+}
+
+static void reb_output_iovecs_flush_fd(struct reb_output_iovecs* v){
+    const int fd = *(int*)v->data;
+    struct iovec* iov = v->iov;
+    int N = v->N;
+    while (N>0 && !v->error){
+        ssize_t written = writev(fd, iov, N);
+        if (written<0){
+            v->error = 1;
+            break;
+        }
+        // Skip iovecs which have been written completely
+        while (N>0 && (size_t)written>=iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            N--;
+        }
+        if (N>0){
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+static void reb_save_dp7(struct reb_dp7* dp7, const int N3, struct reb_output_iovecs* v){
+    reb_output_iovecs_add(v, dp7->p0,sizeof(double)*N3);
+    reb_output_iovecs_add(v, dp7->p1,sizeof(double)*N3);
+    reb_output_iovecs_add(v, dp7->p2,sizeof(double)*N3);
+    reb_output_iovecs_add(v, dp7->p3,sizeof(double)*N3);
+    reb_output_iovecs_add(v, dp7->p4,sizeof(double)*N3);
+    reb_output_iovecs_add(v, dp7->p5,sizeof(double)*N3);
+    reb_output_iovecs_add(v, dp7->p6,sizeof(double)*N3);
 }
 
 // Macro to write a single field to a binary file.
@@ -236,15 +287,22 @@ void static inline reb_save_dp7(struct reb_dp7* dp7, const int N3, char** bufp,
         memset(&field,0,sizeof(struct reb_binary_field));\
         field.type = REB_BINARY_FIELD_TYPE_##typename;\
         field.size = (length);\
-        reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));\
-        reb_output_stream_write(bufp, &allocatedsize, sizep, value,field.size);\
+        reb_output_iovecs_copy(v, &field, sizeof(struct reb_binary_field));\
+        reb_output_iovecs_value(v, value, field.size);\
+    }
+
+// Same as WRITE_FIELD but for the seven arrays of a reb_dp7 struct.
+#define WRITE_FIELD_DP7(typename, dp7, N3) {\
+        struct reb_binary_field field;\
+        memset(&field,0,sizeof(struct reb_binary_field));\
+        field.type = REB_BINARY_FIELD_TYPE_##typename;\
+        field.size = sizeof(double)*(N3)*7;\
+        reb_output_iovecs_copy(v, &field, sizeof(struct reb_binary_field));\
+        reb_save_dp7(&(dp7),N3,v);\
     }
 
 
-void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t* sizep){
-    size_t allocatedsize = 0;
-    *bufp = NULL;
-    *sizep = 0;
+void reb_output_binary_to_iovecs(struct reb_simulation* r, struct reb_output_iovecs* v){
     // Init integrators. This helps with bit-by-bit reproducibility.
     reb_integrator_init(r);
 
@@ -252,14 +310,14 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
     char header[64] = "\0";
     int cwritten = sprintf(header,"REBOUND Binary File. Version: %s",reb_version_str);
     snprintf(header+cwritten+1,64-cwritten-1,"%s",reb_githash_str);
-    reb_output_stream_write(bufp, &allocatedsize, sizep, header,sizeof(char)*64);
+    reb_output_iovecs_copy(v, header,sizeof(char)*64);
    
     WRITE_FIELD(T,                  &r->t,                              sizeof(double));
     WRITE_FIELD(G,                  &r->G,                              sizeof(double));
     WRITE_FIELD(SOFTENING,          &r->softening,                      sizeof(double));
     WRITE_FIELD(DT,                 &r->dt,                             sizeof(double));
     WRITE_FIELD(DTLASTDONE,         &r->dt_last_done,                   sizeof(double));
-    WRITE_FIELD(N,                  &r->N,                              sizeof(int));
+    WRITE_FIELD(N,                  v->particles_skip?&v->particles_N:&r->N, sizeof(int));
     WRITE_FIELD(NVAR,               &r->N_var,                          sizeof(int));
     WRITE_FIELD(VARCONFIGN,         &r->var_config_N,                   sizeof(int));
     WRITE_FIELD(NACTIVE,            &r->N_active,                       sizeof(int));
@@ -271,6 +329,21 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
     WRITE_FIELD(EXACTFINISHTIME,    &r->exact_finish_time,              sizeof(int));
     WRITE_FIELD(FORCEISVELOCITYDEP, &r->force_is_velocity_dependent,    sizeof(unsigned int));
     WRITE_FIELD(GRAVITYIGNORETERMS, &r->gravity_ignore_terms,           sizeof(unsigned int));
+    WRITE_FIELD(GRAVITYTILESIZE,    &r->gravity_tile_size,              sizeof(int));
+    WRITE_FIELD(OMPPERSISTENTTEAM,  &r->omp_persistent_team,            sizeof(int));
+    WRITE_FIELD(GRAVITYGHOSTBOXTOL, &r->gravity_ghostbox_tolerance,     sizeof(double));
+    WRITE_FIELD(GRAVITYTPFLOAT,     &r->gravity_testparticle_float,     sizeof(unsigned int));
+    WRITE_FIELD(AUTOSELECTINTERVAL, &r->auto_select_interval,           sizeof(int));
+    WRITE_FIELD(AUTOSELECTOPENINGANGLE2, &r->auto_select_opening_angle2, sizeof(double));
+    WRITE_FIELD(FMMORDER,           &r->fmm_order,                      sizeof(unsigned int));
+    WRITE_FIELD(GRAVITYFFTNX,       &r->gravity_fft_nx,                 sizeof(int));
+    WRITE_FIELD(GRAVITYFFTNY,       &r->gravity_fft_ny,                 sizeof(int));
+    WRITE_FIELD(TREESORT,           &r->tree_sort,                      sizeof(int));
+    WRITE_FIELD(TREEGROUPSIZE,      &r->tree_group_size,                sizeof(int));
+    WRITE_FIELD(TREEORDER,          &r->tree_order,                     sizeof(unsigned int));
+    WRITE_FIELD(TREELISTINTERVAL,   &r->tree_list_interval,             sizeof(int));
+    WRITE_FIELD(TREELISTMARGIN,     &r->tree_list_margin,               sizeof(double));
+    WRITE_FIELD(TREEFUSEDWALK,      &r->tree_fused_walk,                sizeof(int));
     WRITE_FIELD(OUTPUTTIMINGLAST,   &r->output_timing_last,             sizeof(double));
     WRITE_FIELD(SAVEMESSAGES,       &r->save_messages,                  sizeof(int));
     WRITE_FIELD(EXITMAXDISTANCE,    &r->exit_max_distance,              sizeof(double));
@@ -290,6 +363,7 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
     WRITE_FIELD(NGHOSTZ,            &r->nghostz,                        sizeof(int));
     WRITE_FIELD(COLLISIONRESOLVEKEEPSORTED, &r->collision_resolve_keep_sorted, sizeof(int));
     WRITE_FIELD(MINIMUMCOLLISIONVELOCITY, &r->minimum_collision_velocity, sizeof(double));
+    WRITE_FIELD(COLLISIONVERLETSKIN, &r->collision_verlet_skin,       sizeof(double));
     WRITE_FIELD(COLLISIONSPLOG,     &r->collisions_plog,                sizeof(double));
     WRITE_FIELD(MAXRADIUS,          &r->max_radius,                     2*sizeof(double));
     WRITE_FIELD(COLLISIONSNLOG,     &r->collisions_Nlog,                sizeof(long));
@@ -323,13 +397,16 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
     WRITE_FIELD(WHFAST_RECALCJAC,   &r->ri_whfast.recalculate_coordinates_this_timestep, sizeof(unsigned int));
     WRITE_FIELD(WHFAST_SAFEMODE,    &r->ri_whfast.safe_mode,            sizeof(unsigned int));
     WRITE_FIELD(WHFAST_KEEPUNSYNC,  &r->ri_whfast.keep_unsynchronized,  sizeof(unsigned int));
+    WRITE_FIELD(WHFAST_KEPLERWARMSTART, &r->ri_whfast.kepler_warm_start, sizeof(unsigned int));
     WRITE_FIELD(WHFAST_ISSYNCHRON,  &r->ri_whfast.is_synchronized,      sizeof(unsigned int));
     WRITE_FIELD(WHFAST_TIMESTEPWARN,&r->ri_whfast.timestep_warning,     sizeof(unsigned int));
     WRITE_FIELD(WHFAST_PJ,          r->ri_whfast.p_jh,                  sizeof(struct reb_particle)*r->ri_whfast.allocated_N);
+    WRITE_FIELD(WHFAST_KEPLERXCORR, r->ri_whfast.kepler_X_correction,   sizeof(double)*r->ri_whfast.allocated_N_kepler);
     WRITE_FIELD(WHFAST_COORDINATES, &r->ri_whfast.coordinates,          sizeof(int));
     WRITE_FIELD(IAS15_EPSILON,      &r->ri_ias15.epsilon,               sizeof(double));
     WRITE_FIELD(IAS15_MINDT,        &r->ri_ias15.min_dt,                sizeof(double));
     WRITE_FIELD(IAS15_EPSILONGLOBAL,&r->ri_ias15.epsilon_global,        sizeof(unsigned int));
+    WRITE_FIELD(IAS15_REUSEGRAVITY, &r->ri_ias15.reuse_gravity,         sizeof(unsigned int));
     WRITE_FIELD(IAS15_ITERATIONSMAX,&r->ri_ias15.iterations_max_exceeded,sizeof(unsigned long));
     WRITE_FIELD(IAS15_ALLOCATEDN,   &r->ri_ias15.allocatedN,            sizeof(int));
     WRITE_FIELD(JANUS_SCALEPOS,     &r->ri_janus.scale_pos,             sizeof(double));
@@ -361,6 +438,8 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
     WRITE_FIELD(EOS_N,              &r->ri_eos.n,                       sizeof(unsigned int));
     WRITE_FIELD(EOS_SAFEMODE,       &r->ri_eos.safe_mode,               sizeof(unsigned int));
     WRITE_FIELD(EOS_ISSYNCHRON,     &r->ri_eos.is_synchronized,         sizeof(unsigned int));
+    WRITE_FIELD(LEAPFROG_SAFEMODE,  &r->ri_leapfrog.safe_mode,          sizeof(unsigned int));
+    WRITE_FIELD(LEAPFROG_ISSYNCHRON,&r->ri_leapfrog.is_synchronized,    sizeof(unsigned int));
     WRITE_FIELD(RAND_SEED,          &r->rand_seed,                      sizeof(unsigned int));
     WRITE_FIELD(BS_EPSABS,          &r->ri_bs.eps_abs,                  sizeof(double));
     WRITE_FIELD(BS_EPSREL,          &r->ri_bs.eps_rel,                  sizeof(double));
@@ -369,10 +448,18 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
     WRITE_FIELD(BS_FIRSTORLASTSTEP, &r->ri_bs.firstOrLastStep,          sizeof(int));
     WRITE_FIELD(BS_PREVIOUSREJECTED,&r->ri_bs.previousRejected,         sizeof(int));
     WRITE_FIELD(BS_TARGETITER,      &r->ri_bs.targetIter,               sizeof(int));
+    WRITE_FIELD(BS_PARALLELCOLUMNS, &r->ri_bs.parallel_columns,         sizeof(int));
+    WRITE_FIELD(BS_PARALLELODES,    &r->ri_bs.parallel_odes,            sizeof(int));
+    WRITE_FIELD(HERMITE_ETA,        &r->ri_hermite.eta,                 sizeof(double));
+    WRITE_FIELD(HERMITE_ETASTART,   &r->ri_hermite.eta_start,           sizeof(double));
+    WRITE_FIELD(HEARTBEATSTEPS,     &r->heartbeat_steps,                sizeof(unsigned int));
+    WRITE_FIELD(SACOMPRESSION,      &r->simulationarchive_compression,  sizeof(int));
+    WRITE_FIELD(SAPHYSICALONLY,     &r->simulationarchive_physical_only, sizeof(int));
     int functionpointersused = 0;
     if (r->coefficient_of_restitution ||
         r->collision_resolve ||
         r->additional_forces ||
+        r->forces_N ||
         r->heartbeat ||
         r->post_timestep_modifications ||
         r->free_particle_ap){
@@ -383,17 +470,27 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
         struct reb_binary_field field;
         memset(&field,0,sizeof(struct reb_binary_field));
         field.type = REB_BINARY_FIELD_TYPE_PARTICLES;
-        field.size = sizeof(struct reb_particle)*r->N;
-        reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));
+        field.size = sizeof(struct reb_particle)*(v->particles_skip?v->particles_N:r->N);
+        reb_output_iovecs_copy(v, &field,sizeof(struct reb_binary_field));
+        v->particles_offset = v->size;
+        if (v->particles_skip){
+            // The particles are written by the caller.
+            reb_output_iovecs_flush(v);
+            v->size += field.size;
+        }
         // output one particle at a time to sanitize pointers.
-        for (int l=0;l<r->N;l++){
-            struct reb_particle op = r->particles[l];
-            op.c = NULL;
-            op.ap = NULL;
-            op.sim = NULL;
-            reb_output_stream_write(bufp, &allocatedsize, sizep, &op,sizeof(struct reb_particle));
+        for (int l=0;l<r->N && !v->particles_skip;l++){
+            struct reb_particle* op = reb_output_iovecs_copy(v, &r->particles[l], sizeof(struct reb_particle));
+            if (op){
+                op->c = NULL;
+                op->ap = NULL;
+                op->sim = NULL;
+            }
         }
     } 
+    if (r->interaction_groups){
+        WRITE_FIELD(INTERACTIONGROUPS, r->interaction_groups,           sizeof(uint64_t)*r->N_interaction_groups);
+    }
     if (r->var_config){
         WRITE_FIELD(VARCONFIG,      r->var_config,                      sizeof(struct reb_variational_configuration)*r->var_config_N);
     }
@@ -406,53 +503,68 @@ void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t*
         WRITE_FIELD(IAS15_CSX,  r->ri_ias15.csx,    sizeof(double)*N3);
         WRITE_FIELD(IAS15_CSV,  r->ri_ias15.csv,    sizeof(double)*N3);
         WRITE_FIELD(IAS15_CSA0, r->ri_ias15.csa0,   sizeof(double)*N3);
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_G, .size = sizeof(double)*N3*7};
-            reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));
-            reb_save_dp7(&(r->ri_ias15.g),N3,bufp,sizep,&allocatedsize);
-        }
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_B, .size = sizeof(double)*N3*7};
-            reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));
-            reb_save_dp7(&(r->ri_ias15.b),N3,bufp,sizep,&allocatedsize);
-        }
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_CSB, .size = sizeof(double)*N3*7};
-            reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));
-            reb_save_dp7(&(r->ri_ias15.csb),N3,bufp,sizep,&allocatedsize);
-        }
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_E, .size = sizeof(double)*N3*7};
-            reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));
-            reb_save_dp7(&(r->ri_ias15.e),N3,bufp,sizep,&allocatedsize);
-        }
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_BR, .size = sizeof(double)*N3*7};
-            reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));
-            reb_save_dp7(&(r->ri_ias15.br),N3,bufp,sizep,&allocatedsize);
-        }
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_ER, .size = sizeof(double)*N3*7};
-            reb_output_stream_write(bufp, &allocatedsize, sizep, &field,sizeof(struct reb_binary_field));
-            reb_save_dp7(&(r->ri_ias15.er),N3,bufp,sizep,&allocatedsize);
-        }
+        WRITE_FIELD_DP7(IAS15_G,   r->ri_ias15.g,    N3);
+        WRITE_FIELD_DP7(IAS15_B,   r->ri_ias15.b,    N3);
+        WRITE_FIELD_DP7(IAS15_CSB, r->ri_ias15.csb,  N3);
+        WRITE_FIELD_DP7(IAS15_E,   r->ri_ias15.e,    N3);
+        WRITE_FIELD_DP7(IAS15_BR,  r->ri_ias15.br,   N3);
+        WRITE_FIELD_DP7(IAS15_ER,  r->ri_ias15.er,   N3);
     }
     // To output size of binary file, need to calculate it first. 
     if (r->simulationarchive_version<3){ // to be removed in a future release
-        r->simulationarchive_size_first = (*sizep)+sizeof(struct reb_binary_field)*2+sizeof(long)+sizeof(struct reb_simulationarchive_blob16);
+        r->simulationarchive_size_first = v->size+sizeof(struct reb_binary_field)*2+sizeof(long)+sizeof(struct reb_simulationarchive_blob16);
     }else{
-        r->simulationarchive_size_first = (*sizep)+sizeof(struct reb_binary_field)*2+sizeof(long)+sizeof(struct reb_simulationarchive_blob);
+        r->simulationarchive_size_first = v->size+sizeof(struct reb_binary_field)*2+sizeof(long)+sizeof(struct reb_simulationarchive_blob);
     }
     WRITE_FIELD(SASIZEFIRST,        &r->simulationarchive_size_first,   sizeof(long));
     int end_null = 0;
     WRITE_FIELD(END, &end_null, 0);
     if (r->simulationarchive_version<3){ // to be removed in a future release
         struct reb_simulationarchive_blob16 blob = {0};
-        reb_output_stream_write(bufp, &allocatedsize, sizep, &blob, sizeof(struct reb_simulationarchive_blob16));
+        reb_output_iovecs_copy(v, &blob, sizeof(struct reb_simulationarchive_blob16));
     }else{
         struct reb_simulationarchive_blob blob = {0};
-        reb_output_stream_write(bufp, &allocatedsize, sizep, &blob, sizeof(struct reb_simulationarchive_blob));
+        reb_output_iovecs_copy(v, &blob, sizeof(struct reb_simulationarchive_blob));
     }
+    reb_output_iovecs_flush(v);
+}
+
+void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t* sizep){
+    struct reb_output_iovecs* v = calloc(1, sizeof(struct reb_output_iovecs));
+    // The first pass only calculates the size. The buffer is then allocated once.
+    reb_output_binary_to_iovecs(r, v);
+    *sizep = v->size;
+    *bufp = malloc(v->size);
+    memset(v, 0, sizeof(struct reb_output_iovecs));
+    v->flush = reb_output_iovecs_flush_memcpy;
+    v->data = *bufp;
+    reb_output_binary_to_iovecs(r, v);
+    free(v);
+}
+
+size_t reb_output_binary_size(struct reb_simulation* r){
+    struct reb_output_iovecs* v = calloc(1, sizeof(struct reb_output_iovecs));
+    reb_output_binary_to_iovecs(r, v);
+    const size_t size = v->size;
+    free(v);
+    return size;
+}
+
+size_t reb_output_binary_to_buffer(struct reb_simulation* r, char* buf, size_t size){
+    struct reb_output_iovecs* v = calloc(1, sizeof(struct reb_output_iovecs));
+    reb_output_binary_to_iovecs(r, v);
+    const size_t size_binary = v->size;
+    if (size_binary>size){
+        free(v);
+        reb_error(r, "Buffer is too small for the binary. Use reb_output_binary_size() to get the required size.");
+        return 0;
+    }
+    memset(v, 0, sizeof(struct reb_output_iovecs));
+    v->flush = reb_output_iovecs_flush_memcpy;
+    v->data = buf;
+    reb_output_binary_to_iovecs(r, v);
+    free(v);
+    return size_binary;
 }
 
 void reb_output_binary(struct reb_simulation* r, const char* filename){
@@ -467,14 +579,112 @@ void reb_output_binary(struct reb_simulation* r, const char* filename){
         reb_error(r, "Can not open file.");
         return;
     }
-    char* bufp;
-    size_t sizep;
-    reb_output_binary_to_stream(r, &bufp,&sizep);
-    fwrite(bufp,sizep,1,of);
-    free(bufp);
+    // The simulation is written directly from its arrays without an intermediate copy.
+    struct reb_output_iovecs* v = calloc(1, sizeof(struct reb_output_iovecs));
+    int fd = fileno(of);
+    v->flush = reb_output_iovecs_flush_fd;
+    v->data = &fd;
+    reb_output_binary_to_iovecs(r, v);
+    if (v->error){
+        reb_error(r, "Error while writing binary file.");
+    }
+    free(v);
     fclose(of);
 }
 
+#ifdef MPI
+static void reb_output_iovecs_flush_mpi(struct reb_output_iovecs* v){
+    MPI_File fh = *(MPI_File*)v->data;
+    // The iovecs end at the current size of the serialization.
+    MPI_Offset offset = v->size;
+    for (int i=0;i<v->N;i++){
+        offset -= v->iov[i].iov_len;
+    }
+    for (int i=0;i<v->N && !v->error;i++){
+        if (MPI_File_write_at(fh, offset, v->iov[i].iov_base, (int)v->iov[i].iov_len, MPI_BYTE, MPI_STATUS_IGNORE)!=MPI_SUCCESS){
+            v->error = 1;
+        }
+        offset += v->iov[i].iov_len;
+    }
+}
+
+int reb_output_binary_mpi(struct reb_simulation* r, const char* filename){
+    // Particles which are stored on every node are only written by node 0.
+    int first = 0;
+    int N = r->N;
+    if (r->mpi_direct){
+        N = r->mpi_id==0?r->N:0;
+    }else if (r->N_active!=-1 && r->mpi_id!=0){
+        first = r->N_active;
+        N = r->N-r->N_active;
+    }
+    int local[2] = {N, r->N_var || (!r->mpi_direct && r->ri_ias15.allocatedN)};
+    int global[2];
+    long long N_before = 0;
+    long long N_local = N;
+    MPI_Allreduce(local, global, 2, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Exscan(&N_local, &N_before, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (r->mpi_id==0){
+        N_before = 0; // Undefined after MPI_Exscan
+    }
+    if (global[1]){
+        reb_error(r, "Parallel output does not support variational particles or IAS15 with distributed particles.");
+        return -1;
+    }
+
+    MPI_File fh;
+    if (MPI_File_open(MPI_COMM_WORLD, (char*)filename, MPI_MODE_CREATE|MPI_MODE_WRONLY, MPI_INFO_NULL, &fh)!=MPI_SUCCESS){
+        reb_error(r, "Can not open file.");
+        return -1;
+    }
+    MPI_File_set_size(fh, 0);
+
+    // All nodes calculate where the particle data starts. Node 0 also 
+    // writes everything but the particles.
+    struct reb_output_iovecs* v = calloc(1, sizeof(struct reb_output_iovecs));
+    v->particles_skip = 1;
+    v->particles_N = global[0];
+    reb_output_binary_to_iovecs(r, v);
+    const MPI_Offset particles_offset = v->particles_offset;
+    int error = 0;
+    if (r->mpi_id==0){
+        memset(v, 0, sizeof(struct reb_output_iovecs));
+        v->particles_skip = 1;
+        v->particles_N = global[0];
+        v->flush = reb_output_iovecs_flush_mpi;
+        v->data = &fh;
+        reb_output_binary_to_iovecs(r, v);
+        error = v->error;
+    }
+    free(v);
+
+    // Every node writes its particles into its own slab.
+    struct reb_particle* const particles = malloc(sizeof(struct reb_particle)*(N?N:1));
+    for (int i=0;i<N;i++){
+        particles[i] = r->particles[first+i];
+        particles[i].c = NULL;
+        particles[i].ap = NULL;
+        particles[i].sim = NULL;
+    }
+    MPI_Datatype mpi_particle_bytes;
+    MPI_Type_contiguous(sizeof(struct reb_particle), MPI_BYTE, &mpi_particle_bytes);
+    MPI_Type_commit(&mpi_particle_bytes);
+    if (MPI_File_write_at_all(fh, particles_offset+N_before*sizeof(struct reb_particle), particles, N, mpi_particle_bytes, MPI_STATUS_IGNORE)!=MPI_SUCCESS){
+        error = 1;
+    }
+    MPI_Type_free(&mpi_particle_bytes);
+    free(particles);
+    MPI_File_close(&fh);
+
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (error){
+        reb_error(r, "Error while writing binary file.");
+        return -1;
+    }
+    return 0;
+}
+#endif // MPI
+
 void reb_output_binary_positions(struct reb_simulation* r, const char* filename){
     const int N = r->N;
 #ifdef MPI
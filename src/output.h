@@ -27,30 +27,33 @@
 struct reb_simulation;
 
 #include <stdio.h>
-void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t* sizep);
-void reb_output_stream_write(char** bufp, size_t* allocatedsize, size_t* sizep, void* restrict data, size_t size); ///< Replacement for memstream
-
-#ifdef PROFILING
+#include <sys/uio.h>
+#define REB_OUTPUT_IOVECS_N 256             ///< Maximum number of iovecs before the list is flushed
+#define REB_OUTPUT_SCRATCH_SIZE (64*1024)   ///< Size of the buffer for copied data
+#define REB_OUTPUT_COPY_MAX 64              ///< Values up to this size are copied instead of referenced
 /**
- * Profiling categories
+ * @brief List of iovecs produced by reb_output_binary_to_iovecs. 
+ * @details The iovecs point into the simulation's arrays or into the 
+ * scratch buffer. They are only valid until the next call of flush. 
+ * If flush is NULL, only the size is calculated.
  */
-enum profiling_categories {
-	PROFILING_CAT_INTEGRATOR,
-	PROFILING_CAT_BOUNDARY,
-	PROFILING_CAT_GRAVITY,
-	PROFILING_CAT_COLLISION,
-#ifdef OPENGL
-	PROFILING_CAT_VISUALIZATION,
-#endif // OPENGL
-	PROFILING_CAT_NUM,
+struct reb_output_iovecs {
+    struct iovec iov[REB_OUTPUT_IOVECS_N];
+    int N;                                      ///< Number of iovecs in the list
+    char scratch[REB_OUTPUT_SCRATCH_SIZE];      ///< Copies of headers, small values and sanitized particles
+    size_t scratch_used;
+    size_t size;                                ///< Total number of bytes serialized
+    void (*flush)(struct reb_output_iovecs* v); ///< Consumes all iovecs in the list
+    void* data;                                 ///< Can be used by flush
+    int error;                                  ///< Can be set by flush
+    int particles_skip;                         ///< If 1, the particle data is left out but counted in size (parallel output)
+    int particles_N;                            ///< Number of particles in the file if particles_skip is 1
+    size_t particles_offset;                    ///< Set to the position of the particle data
 };
-void profiling_start(void);
-void profiling_stop(int cat);
-#define PROFILING_START() profiling_start();	///< Start profiling block 
-#define PROFILING_STOP(C) profiling_stop(C);	///< Stop profiling block 
-#else // PROFILING
-#define PROFILING_START()	///< Start profiling block (dummy, does nothing) 
-#define PROFILING_STOP(C)	///< Stop profiling block (dummy, does nothing)
-#endif // PROFILING
+void reb_output_binary_to_iovecs(struct reb_simulation* r, struct reb_output_iovecs* v);
+void reb_output_iovecs_flush(struct reb_output_iovecs* v);
+void reb_output_binary_to_stream(struct reb_simulation* r, char** bufp, size_t* sizep); ///< Serializes the simulation into one contiguous buffer
+void reb_output_stream_write(char** bufp, size_t* allocatedsize, size_t* sizep, void* restrict data, size_t size); ///< Replacement for memstream
+
 
 #endif
@@ -0,0 +1,334 @@
+/**
+ * @file    parareal.c
+ * @brief   Time-parallel integration with the Parareal algorithm.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details The integration interval is split into time slices. A cheap
+ * coarse propagator (e.g. WHFast with a large timestep) predicts the
+ * state at the start of every slice. All slices are then integrated in
+ * parallel with the accurate fine propagator. The difference between
+ * the fine and the coarse solution corrects the prediction of the next
+ * iteration (Lions, Maday & Turinici 2001):
+ *
+ *     U_{k+1}^{j+1} = G(U_k^{j+1}) + F(U_k^j) - G(U_k^j)
+ *
+ * After j iterations, the first j slices agree with a serial fine
+ * integration. The algorithm therefore never needs more than N_slices
+ * iterations, but it only pays off if it converges in a few.
+ *
+ * The propagators are copies of the simulations passed by the user. At
+ * the start of every slice, the positions and velocities are replaced
+ * and the integrator recalculates its internal coordinates.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "rebound.h"
+#include "ensemble.h"
+#include "parareal.h"
+#include "integrator_ias15.h"
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
+#define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
+
+// Positions and velocities of all particles.
+#define REB_PARAREAL_STATE_N 6
+
+// Creates a propagator. Function pointers which affect the
+// equations of motion are not copied by reb_copy_simulation_into().
+static struct reb_simulation* reb_parareal_create_propagator(const struct reb_simulation* const r){
+    struct reb_simulation* const p = reb_create_simulation();
+    reb_copy_simulation_into(p, r);
+    p->additional_forces = r->additional_forces;
+    p->pre_timestep_modifications = r->pre_timestep_modifications;
+    p->post_timestep_modifications = r->post_timestep_modifications;
+    p->extras = r->extras;
+    p->exact_finish_time = 1; // Slices need to end exactly at their boundaries.
+    return p;
+}
+
+static void reb_parareal_get_state(const struct reb_simulation* const r, double* const state){
+    const struct reb_particle* const ps = r->particles;
+    for (int i=0;i<r->N;i++){
+        double* const s = state + REB_PARAREAL_STATE_N*i;
+        s[0] = ps[i].x;  s[1] = ps[i].y;  s[2] = ps[i].z;
+        s[3] = ps[i].vx; s[4] = ps[i].vy; s[5] = ps[i].vz;
+    }
+}
+
+static void reb_parareal_set_state(struct reb_simulation* const r, const double* const state, const double t){
+    struct reb_particle* const ps = r->particles;
+    for (int i=0;i<r->N;i++){
+        const double* const s = state + REB_PARAREAL_STATE_N*i;
+        ps[i].x  = s[0]; ps[i].y  = s[1]; ps[i].z  = s[2];
+        ps[i].vx = s[3]; ps[i].vy = s[4]; ps[i].vz = s[5];
+    }
+    r->t = t;
+    // The particles have been modified. Integrators need to start from scratch.
+    r->ri_whfast.recalculate_coordinates_this_timestep = 1;
+    if (r->integrator==REB_INTEGRATOR_IAS15){
+        reb_integrator_ias15_reset(r);
+    }
+}
+
+// Integrates the propagator p from t0 to t1, starting with state_in.
+// Returns 0 on success.
+static int reb_parareal_propagate(struct reb_simulation* const p, const double dt, const double* const state_in, const double t0, const double t1, double* const state_out){
+    const int N = p->N;
+    reb_parareal_set_state(p, state_in, t0);
+    p->dt = dt;
+    reb_ensemble_run_simulation(p, t1);
+    if (p->status!=REB_EXIT_SUCCESS || p->N!=N){
+        return 1;
+    }
+    reb_parareal_get_state(p, state_out);
+    return 0;
+}
+
+// Relative difference between two states, separately for positions and velocities.
+static double reb_parareal_error(const double* const a, const double* const b, const int N){
+    double d[2] = {0., 0.};
+    double n[2] = {0., 0.};
+    for (int i=0;i<N;i++){
+        for (int k=0;k<REB_PARAREAL_STATE_N;k++){
+            const double ak = a[REB_PARAREAL_STATE_N*i+k];
+            const double dk = ak - b[REB_PARAREAL_STATE_N*i+k];
+            d[k/3] += dk*dk;
+            n[k/3] += ak*ak;
+        }
+    }
+    double e = 0.;
+    for (int k=0;k<2;k++){
+        if (n[k]>0.){
+            e = MAX(e, sqrt(d[k]/n[k]));
+        }else if (d[k]>0.){
+            e = INFINITY;
+        }
+    }
+    return e;
+}
+
+// Fine integrations of one iteration are handed out to a pool of threads.
+struct reb_parareal_pool {
+    struct reb_simulation** propagators;    // One fine propagator per thread
+    double dt;
+    const double* U;        // States at the start of the slices
+    double* F;              // States at the end of the slices (fine propagator)
+    const double* T;        // Times of slice boundaries
+    int N_state;
+    int N_slices;
+    pthread_mutex_t mutex;  // Protects next, N_threads_started and error
+    int next;               // Index of the next slice to be integrated
+    int N_threads_started;  // Used to assign a propagator to each thread
+    int error;              // Set to 1 if a fine integration failed
+};
+
+static void* reb_parareal_thread(void* args){
+    struct reb_parareal_pool* const pool = (struct reb_parareal_pool*)args;
+    pthread_mutex_lock(&pool->mutex);
+    struct reb_simulation* const p = pool->propagators[pool->N_threads_started++];
+    pthread_mutex_unlock(&pool->mutex);
+    while (1){
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->next>=pool->N_slices || pool->error || reb_sigint){
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        const int k = pool->next++;
+        pthread_mutex_unlock(&pool->mutex);
+        if (reb_parareal_propagate(p, pool->dt, pool->U+pool->N_state*k, pool->T[k], pool->T[k+1], pool->F+pool->N_state*k)){
+            pthread_mutex_lock(&pool->mutex);
+            pool->error = 1;
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+}
+
+// Integrates the slices first,...,N_slices-1 with the fine propagators using N_threads threads.
+static int reb_parareal_fine(struct reb_parareal_pool* const pool, const int first, const int N_threads){
+    pool->next = first;
+    pool->N_threads_started = 0;
+    pool->error = 0;
+    const int N_threads_used = MAX(1, MIN(N_threads, pool->N_slices-first));
+    pthread_t* const pthreads = malloc(sizeof(pthread_t)*N_threads_used);
+    int* const started = calloc(N_threads_used, sizeof(int));
+    for (int k=1;k<N_threads_used;k++){
+        started[k] = pthread_create(&pthreads[k], NULL, reb_parareal_thread, pool)==0;
+    }
+    // The calling thread works as well.
+    reb_parareal_thread(pool);
+    for (int k=1;k<N_threads_used;k++){
+        if (started[k]){
+            pthread_join(pthreads[k], NULL);
+        }
+    }
+    free(started);
+    free(pthreads);
+    return pool->error || reb_sigint;
+}
+
+int reb_integrate_parareal(struct reb_simulation* const fine, const struct reb_simulation* const coarse, const double tmax, const int N_slices, const double tolerance, const int max_iterations, int N_threads, struct reb_parareal_result* const result){
+    struct timeval time_beginning;
+    gettimeofday(&time_beginning,NULL);
+    if (result){
+        result->iterations = 0;
+        result->error = INFINITY;
+        result->converged = 0;
+        result->walltime = 0.;
+    }
+    if (coarse==NULL || N_slices<1){
+        reb_error(fine, "Parareal needs a coarse simulation and at least one time slice.");
+        return -1;
+    }
+    const struct reb_simulation* const rs[2] = {fine, coarse};
+    for (int l=0;l<2;l++){
+        switch (rs[l]->integrator){
+            case REB_INTEGRATOR_IAS15:
+            case REB_INTEGRATOR_WHFAST:
+            case REB_INTEGRATOR_SABA:
+            case REB_INTEGRATOR_LEAPFROG:
+                break;
+            default:
+                reb_error(fine, "Parareal only supports the IAS15, WHFast, SABA and Leapfrog integrators.");
+                return -1;
+        }
+    }
+    if (coarse->N!=fine->N || fine->N_var){
+        reb_error(fine, "Parareal needs the same number of particles in the fine and coarse simulation and does not support variational particles.");
+        return -1;
+    }
+    reb_sigint = 0;
+    signal(SIGINT, reb_sigint_handler);
+    if (N_threads<=0){
+        N_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    N_threads = MAX(1, MIN(N_threads, N_slices));
+
+    reb_integrator_synchronize(fine);
+    const int N = fine->N;
+    const int N_state = REB_PARAREAL_STATE_N*N;
+    double* const T = malloc(sizeof(double)*(N_slices+1));
+    for (int k=0;k<=N_slices;k++){
+        T[k] = fine->t + (tmax-fine->t)*k/N_slices;
+    }
+    T[N_slices] = tmax;
+    // U: current states at the slice boundaries, G: coarse solutions
+    // of the current iteration, F: fine solutions
+    double* const U = malloc(sizeof(double)*N_state*(N_slices+1));
+    double* const U_new = malloc(sizeof(double)*N_state*(N_slices+1));
+    double* const G = malloc(sizeof(double)*N_state*N_slices);
+    double* const F = malloc(sizeof(double)*N_state*N_slices);
+    double* const G_new = malloc(sizeof(double)*N_state);
+
+    struct reb_simulation* const c = reb_parareal_create_propagator(coarse);
+    struct reb_parareal_pool pool = {
+        .propagators = malloc(sizeof(struct reb_simulation*)*N_threads),
+        .dt = fine->dt,
+        .U = U,
+        .F = F,
+        .T = T,
+        .N_state = N_state,
+        .N_slices = N_slices,
+    };
+    for (int l=0;l<N_threads;l++){
+        pool.propagators[l] = reb_parareal_create_propagator(fine);
+    }
+    pthread_mutex_init(&pool.mutex, NULL);
+
+    // Initial guess from the coarse propagator.
+    int error = 0;
+    reb_parareal_get_state(fine, U);
+    for (int k=0;k<N_slices && !error;k++){
+        error = reb_parareal_propagate(c, coarse->dt, U+N_state*k, T[k], T[k+1], G+N_state*k);
+        memcpy(U+N_state*(k+1), G+N_state*k, sizeof(double)*N_state);
+    }
+    int iterations = 0;
+    int converged = 0;
+    double e_max = INFINITY;
+    while (!error && !converged && iterations<max_iterations){
+        // Slices before iterations have already converged to the serial fine solution.
+        const int first = iterations;
+        error = reb_parareal_fine(&pool, first, N_threads);
+        if (error){
+            break;
+        }
+        iterations++;
+        // Serial correction sweep with the coarse propagator.
+        memcpy(U_new, U, sizeof(double)*N_state*(first+1));
+        memcpy(U_new+N_state*(first+1), F+N_state*first, sizeof(double)*N_state);
+        for (int k=first+1;k<N_slices && !error;k++){
+            error = reb_parareal_propagate(c, coarse->dt, U_new+N_state*k, T[k], T[k+1], G_new);
+            double* const u = U_new+N_state*(k+1);
+            const double* const f = F+N_state*k;
+            double* const g = G+N_state*k;
+            for (int i=0;i<N_state;i++){
+                u[i] = G_new[i] + f[i] - g[i];
+                g[i] = G_new[i];
+            }
+        }
+        e_max = 0.;
+        for (int k=first+1;k<=N_slices;k++){
+            e_max = MAX(e_max, reb_parareal_error(U_new+N_state*k, U+N_state*k, N));
+        }
+        memcpy(U, U_new, sizeof(double)*N_state*(N_slices+1));
+        converged = e_max<=tolerance || iterations>=N_slices;
+    }
+
+    if (!error){
+        reb_parareal_set_state(fine, U+N_state*N_slices, tmax);
+        fine->status = REB_EXIT_SUCCESS;
+    }else{
+        if (reb_sigint){
+            fine->status = REB_EXIT_SIGINT;
+        }
+        reb_error(fine, "Parareal integration failed. The simulation has not been modified.");
+    }
+    if (result){
+        struct timeval time_end;
+        gettimeofday(&time_end,NULL);
+        result->iterations = iterations;
+        result->error = e_max;
+        result->converged = converged;
+        result->walltime = time_end.tv_sec-time_beginning.tv_sec+(time_end.tv_usec-time_beginning.tv_usec)/1e6;
+    }
+
+    pthread_mutex_destroy(&pool.mutex);
+    for (int l=0;l<N_threads;l++){
+        reb_free_simulation(pool.propagators[l]);
+    }
+    free(pool.propagators);
+    reb_free_simulation(c);
+    free(G_new);
+    free(F);
+    free(G);
+    free(U_new);
+    free(U);
+    free(T);
+    if (error){
+        return -1;
+    }
+    return converged?0:1;
+}
@@ -34,6 +34,7 @@
 #include "particle.h"
 #include "integrator_ias15.h"
 #include "integrator_mercurius.h"
+#include "allocator.h"
 #ifndef COLLISIONS_NONE
 #include "collision.h"
 #endif // COLLISIONS_NONE
@@ -46,20 +47,42 @@
 extern double gravity_minimum_mass;
 #endif // GRAVITY_GRAPE
 
+// Resizes the particle array to r->allocatedN particles.
+static void reb_particles_realloc(struct reb_simulation* const r){
+#ifdef OPENMP
+    // Large blocks come from fresh pages which are placed on the NUMA node 
+    // of the thread touching them first. The copy uses the same static 
+    // distribution of particles to threads as the force loops.
+    struct reb_particle* const particles = reb_malloc(sizeof(struct reb_particle)*r->allocatedN);
+    const struct reb_particle* const particles_old = r->particles;
+    const int N = r->N;
+#pragma omp parallel for schedule(static)
+    for (int i=0; i<N; i++){
+        particles[i] = particles_old[i];
+    }
+    reb_free(r->particles);
+    r->particles = particles;
+#else // OPENMP
+    r->particles = reb_realloc(r->particles,sizeof(struct reb_particle)*r->allocatedN);
+#endif // OPENMP
+}
+
 static void reb_add_local(struct reb_simulation* const r, struct reb_particle pt){
 	if (reb_boundary_particle_is_in_box(r, pt)==0){
 		// reb_particle has left the box. Do not add.
 		reb_error(r,"Particle outside of box boundaries. Did not add particle.");
 		return;
 	}
-	while (r->allocatedN<=r->N){
-		r->allocatedN = r->allocatedN ? r->allocatedN * 2 : 128;
-		r->particles = realloc(r->particles,sizeof(struct reb_particle)*r->allocatedN);
+	if (r->allocatedN<=r->N){
+		while (r->allocatedN<=r->N){
+			r->allocatedN = r->allocatedN ? r->allocatedN * 2 : 128;
+		}
+		reb_particles_realloc(r);
 	}
 
 	r->particles[r->N] = pt;
 	r->particles[r->N].sim = r;
-	if (r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE){
+	if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE){
         if (r->root_size==-1){
             reb_error(r,"root_size is -1. Make sure you call reb_configure_box() before using a tree based gravity or collision solver.");
             return;
@@ -71,23 +94,26 @@ static void reb_add_local(struct reb_simulation* const r, struct reb_particle pt
 		reb_tree_add_particle_to_tree(r, r->N);
 	}
 	(r->N)++;
+    reb_particle_lookup_table_set(r, pt.hash, r->N-1);
     if (r->integrator == REB_INTEGRATOR_MERCURIUS){
         struct reb_simulation_integrator_mercurius* rim = &(r->ri_mercurius);
         if (r->ri_mercurius.mode==0){ //WHFast part
             rim->recalculate_dcrit_this_timestep       = 1;
             rim->recalculate_coordinates_this_timestep = 1;
         }else{  // IAS15 part
-            reb_integrator_ias15_reset(r);
             if (rim->dcrit_allocatedN<r->N){
                 rim->dcrit              = realloc(rim->dcrit, sizeof(double)*r->N);
                 rim->dcrit_allocatedN = r->N;
             }
             rim->dcrit[r->N-1] = reb_integrator_mercurius_calculate_dcrit_for_particle(r,r->N-1);
             if (rim->allocatedN<r->N){
-                rim->particles_backup   = realloc(rim->particles_backup,sizeof(struct reb_particle)*r->N);
-                rim->encounter_map      = realloc(rim->encounter_map,sizeof(int)*r->N);
-                rim->allocatedN = r->N;
+                // Particles are added one at a time. Grow geometrically.
+                rim->allocatedN = rim->allocatedN*2>(unsigned int)r->N ? rim->allocatedN*2 : (unsigned int)r->N;
+                rim->particles_backup   = reb_realloc(rim->particles_backup,sizeof(struct reb_vec6d)*rim->allocatedN);
+                rim->encounter_map      = realloc(rim->encounter_map,sizeof(int)*rim->allocatedN);
+                rim->encounter_group    = realloc(rim->encounter_group,sizeof(int)*rim->allocatedN);
             }
+            rim->encounter_group[r->N-1] = 0; // Integrated with the current group
             rim->encounter_map[rim->encounterN] = r->N-1;
             rim->encounterN++;
             if (r->N_active==-1){ 
@@ -95,6 +121,8 @@ static void reb_add_local(struct reb_simulation* const r, struct reb_particle pt
                 // Otherwise, assume we're adding non active particle. 
                 rim->encounterNactive++;
             }
+            // The new particle joins the current encounter. Buffers are kept, only the IAS15 state is cleared.
+            reb_integrator_ias15_clear(r);
         }
     }
 }
@@ -116,19 +144,173 @@ void reb_add(struct reb_simulation* const r, struct reb_particle pt){
 	}
 #endif // GRAVITY_GRAPE
 #ifdef MPI
-	int rootbox = reb_get_rootbox_for_particle(r, pt);
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int proc_id = rootbox/root_n_per_node;
-	if (proc_id != r->mpi_id && r->N >= r->N_active){
-		// Add particle to array and send them to proc_id later. 
-		reb_communication_mpi_add_particle_to_send_queue(r,pt,proc_id);
-		return;
+	if (r->mpi_root_owner){
+		int rootbox = reb_get_rootbox_for_particle(r, pt);
+		int proc_id = r->mpi_root_owner[rootbox];
+		if (proc_id != r->mpi_id && r->N >= r->N_active){
+			// Add particle to array and send them to proc_id later. 
+			reb_communication_mpi_add_particle_to_send_queue(r,pt,proc_id);
+			return;
+		}
 	}
 #endif // MPI
 	// Add particle to local partical array.
 	reb_add_local(r, pt);
 }
 
+// Makes sure that N particles fit into the particle array and, 
+// if needed, the MERCURIUS arrays.
+static void reb_particles_reserve(struct reb_simulation* const r, const int N){
+    if (r->allocatedN<=N){
+        while (r->allocatedN<=N){
+            r->allocatedN = r->allocatedN ? r->allocatedN * 2 : 128;
+        }
+        reb_particles_realloc(r);
+    }
+    if (r->integrator == REB_INTEGRATOR_MERCURIUS && r->ri_mercurius.mode==1){
+        struct reb_simulation_integrator_mercurius* rim = &(r->ri_mercurius);
+        if (rim->dcrit_allocatedN<N){
+            rim->dcrit              = realloc(rim->dcrit, sizeof(double)*N);
+            rim->dcrit_allocatedN = N;
+        }
+        if (rim->allocatedN<N){
+            rim->particles_backup   = reb_realloc(rim->particles_backup,sizeof(struct reb_vec6d)*N);
+            rim->encounter_map      = realloc(rim->encounter_map,sizeof(int)*N);
+            rim->encounter_group    = realloc(rim->encounter_group,sizeof(int)*N);
+            rim->allocatedN = N;
+        }
+    }
+}
+
+void reb_add_many(struct reb_simulation* const r, const struct reb_particle* const particles, const int N){
+    reb_particles_reserve(r, r->N+N);
+    for (int i=0;i<N;i++){
+        reb_add(r, particles[i]);
+    }
+}
+
+void reb_add_serialized_particle_data(struct reb_simulation* r, const int N, uint32_t* hash, double* m, double* radius, double (*xyz)[3], double (*vxvyvz)[3], double (*xyzvxvyvz)[6]){
+    reb_particles_reserve(r, r->N+N);
+    for (int i=0;i<N;i++){
+        struct reb_particle p = {0};
+        if (hash){
+            p.hash = hash[i];
+        }
+        if (m){
+            p.m = m[i];
+        }
+        if (radius){
+            p.r = radius[i];
+        }
+        if (xyz){
+            p.x = xyz[i][0];
+            p.y = xyz[i][1];
+            p.z = xyz[i][2];
+        }
+        if (vxvyvz){
+            p.vx = vxvyvz[i][0];
+            p.vy = vxvyvz[i][1];
+            p.vz = vxvyvz[i][2];
+        }
+        if (xyzvxvyvz){
+            p.x = xyzvxvyvz[i][0];
+            p.y = xyzvxvyvz[i][1];
+            p.z = xyzvxvyvz[i][2];
+            p.vx = xyzvxvyvz[i][3];
+            p.vy = xyzvxvyvz[i][4];
+            p.vz = xyzvxvyvz[i][5];
+        }
+        reb_add(r, p);
+    }
+}
+
+int reb_add_serialized_orbits(struct reb_simulation* r, const int N, enum REB_ORBITS_PRIMARY primary, uint32_t* hash, double* m, double* radius, double* a, double* e, double* inc, double* Omega, double* omega, double* f, double* M){
+    if (N<=0){
+        return 0;
+    }
+    if (a==NULL){
+        reb_error(r, "The semi-major axis is required to add orbits.");
+        return N;
+    }
+    if (primary == REB_ORBITS_PRIMARY_HELIOCENTRIC && r->N==0){
+        reb_error(r, "A heliocentric primary requires at least one particle in the simulation.");
+        return N;
+    }
+    const int N0 = r->N;
+    reb_particles_reserve(r, N0+N);
+    // The new particles are first calculated in the unused part of the
+    // particle array. The orbits are independent of each other once the
+    // masses of the primaries are known.
+    struct reb_particle* const particles = r->particles + N0;
+    struct reb_particle com = {0};
+    double* M_primary = NULL;
+    switch (primary){
+        case REB_ORBITS_PRIMARY_HELIOCENTRIC:
+            com = r->particles[0];
+            break;
+        case REB_ORBITS_PRIMARY_BARYCENTRIC:
+            com = reb_get_com(r);
+            break;
+        case REB_ORBITS_PRIMARY_JACOBI:
+            // The primary of particle i is the center of mass of all
+            // particles added before. Its mass is a prefix sum. The position
+            // is only known after the previous particles have been calculated.
+            com = reb_get_com(r);
+            M_primary = malloc(sizeof(double)*N);
+            double M_com = com.m;
+            for (int i=0;i<N;i++){
+                M_primary[i] = M_com;
+                M_com += m?m[i]:0.;
+            }
+            break;
+    }
+    const double G = r->G;
+    int N_err = 0;
+    int first_err = N;
+#pragma omp parallel for schedule(guided) reduction(+:N_err) reduction(min:first_err)
+    for (int i=0;i<N;i++){
+        struct reb_particle p_primary = com;
+        if (M_primary){
+            p_primary = (struct reb_particle){0};
+            p_primary.m = M_primary[i];
+        }
+        const double _e = e?e[i]:0.;
+        const double _f = M?reb_tools_M_to_f(_e, M[i]):(f?f[i]:0.);
+        int err = 0;
+        struct reb_particle p = reb_tools_orbit_to_particle_err(G, p_primary, m?m[i]:0., a[i], _e, inc?inc[i]:0., Omega?Omega[i]:0., omega?omega[i]:0., _f, &err);
+        if (err){
+            N_err++;
+            if (i<first_err) first_err = i;
+        }
+        p.r = radius?radius[i]:0.;
+        p.hash = hash?hash[i]:0;
+        particles[i] = p;
+    }
+    if (N_err){
+        free(M_primary);
+        char msg[256];
+        snprintf(msg, 256, "The orbital elements of %d particles are not valid (first at index %d). No particles were added.", N_err, first_err);
+        reb_error(r, msg);
+        return N_err;
+    }
+    if (M_primary){
+        // Positions relative to the primaries were calculated above.
+        for (int i=0;i<N;i++){
+            struct reb_particle* const p = &particles[i];
+            p->x += com.x;  p->y += com.y;  p->z += com.z;
+            p->vx += com.vx; p->vy += com.vy; p->vz += com.vz;
+            com = reb_get_com_of_pair(com, *p);
+        }
+        free(M_primary);
+    }
+    // reb_add copies the particle into slot r->N <= N0+i. The space is reserved,
+    // so this never overwrites a particle which has not been added yet.
+    for (int i=0;i<N;i++){
+        reb_add(r, particles[i]);
+    }
+    return 0;
+}
+
 int reb_particle_check_testparticles(struct reb_simulation* const r){
     if (r->N_active == r->N || r->N_active == -1){
         return 0;
@@ -146,6 +328,85 @@ int reb_particle_check_testparticles(struct reb_simulation* const r){
 }
 
 
+void reb_particles_soa_update(struct reb_particles_soa* const soa, const struct reb_particle* const particles, const int N){
+    if (soa->allocatedN<N){
+#ifdef GPU
+        // Device copies are keyed on the host addresses which are about to change.
+        reb_particles_soa_device_free(soa);
+#endif // GPU
+        soa->allocatedN = N;
+        soa->x  = realloc(soa->x, sizeof(double)*N);
+        soa->y  = realloc(soa->y, sizeof(double)*N);
+        soa->z  = realloc(soa->z, sizeof(double)*N);
+        soa->vx = realloc(soa->vx,sizeof(double)*N);
+        soa->vy = realloc(soa->vy,sizeof(double)*N);
+        soa->vz = realloc(soa->vz,sizeof(double)*N);
+        soa->m  = realloc(soa->m, sizeof(double)*N);
+        soa->ax = realloc(soa->ax,sizeof(double)*N);
+        soa->ay = realloc(soa->ay,sizeof(double)*N);
+        soa->az = realloc(soa->az,sizeof(double)*N);
+    }
+#pragma omp parallel for
+    for (int i=0; i<N; i++){
+        soa->x[i]  = particles[i].x;
+        soa->y[i]  = particles[i].y;
+        soa->z[i]  = particles[i].z;
+        soa->vx[i] = particles[i].vx;
+        soa->vy[i] = particles[i].vy;
+        soa->vz[i] = particles[i].vz;
+        soa->m[i]  = particles[i].m;
+    }
+    soa->N = N;
+}
+
+void reb_particles_soa_free(struct reb_particles_soa* const soa){
+#ifdef GPU
+    reb_particles_soa_device_free(soa);
+#endif // GPU
+    free(soa->x);
+    free(soa->y);
+    free(soa->z);
+    free(soa->vx);
+    free(soa->vy);
+    free(soa->vz);
+    free(soa->m);
+    free(soa->ax);
+    free(soa->ay);
+    free(soa->az);
+    soa->x = NULL;
+    soa->y = NULL;
+    soa->z = NULL;
+    soa->vx = NULL;
+    soa->vy = NULL;
+    soa->vz = NULL;
+    soa->m = NULL;
+    soa->ax = NULL;
+    soa->ay = NULL;
+    soa->az = NULL;
+    soa->N = 0;
+    soa->allocatedN = 0;
+}
+
+#ifdef GPU
+void reb_particles_soa_device_alloc(struct reb_particles_soa* const soa){
+    if (soa->device_N || soa->allocatedN==0){
+        return;
+    }
+    const int n = soa->allocatedN;
+#pragma omp target enter data map(alloc: soa->x[0:n], soa->y[0:n], soa->z[0:n], soa->m[0:n], soa->ax[0:n], soa->ay[0:n], soa->az[0:n])
+    soa->device_N = n;
+}
+
+void reb_particles_soa_device_free(struct reb_particles_soa* const soa){
+    if (soa->device_N==0){
+        return;
+    }
+    const int n = soa->device_N;
+#pragma omp target exit data map(delete: soa->x[0:n], soa->y[0:n], soa->z[0:n], soa->m[0:n], soa->ax[0:n], soa->ay[0:n], soa->az[0:n])
+    soa->device_N = 0;
+}
+#endif // GPU
+
 int reb_get_rootbox_for_particle(const struct reb_simulation* const r, struct reb_particle pt){
 	if (r->root_size==-1) return 0;
 	int i = ((int)floor((pt.x + r->boxsize.x/2.)/r->root_size)+r->root_nx)%r->root_nx;
@@ -168,85 +429,144 @@ int reb_get_particle_index(struct reb_particle* p){
 	return i;
 }
 
-static struct reb_particle* reb_search_lookup_table(struct reb_simulation* const r, uint32_t hash){
-    const struct reb_hash_pointer_pair* const lookup = r->particle_lookup_table;
-    if (lookup == NULL){
-        return NULL;
-    }
+// The lookup table is an open addressing hash map with linear probing.
+// Empty slots have index -1. The number of slots is a power of two and 
+// at least twice the number of entries. Entries are only hints: the
+// particle at the stored index is checked before it is returned. If the 
+// check fails, the table is rebuilt. This allows users to change hashes 
+// or to reorder particles without notifying the lookup table.
 
-    int left = 0;
-    int right = r->N_lookup-1;
-    int middle;
-    while(left <= right){
-        middle = (left + right)/2;
-        uint32_t lookuphash = lookup[middle].hash;
-        if(lookuphash < hash){
-            left = middle+1;
-        }
-        else if(lookuphash > hash){
-            right = middle-1;
+static inline uint32_t reb_lookup_table_slot(uint32_t hash, const int allocatedN){
+    // Finalizer of MurmurHash3. Hashes set by users are often consecutive integers.
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash & (allocatedN-1);
+}
+
+static void reb_lookup_table_insert(struct reb_hash_pointer_pair* const table, const int allocatedN, uint32_t hash, int index, int* const N_lookup){
+    uint32_t s = reb_lookup_table_slot(hash, allocatedN);
+    while (table[s].index != -1){
+        if (table[s].hash == hash){ // Duplicate hash. The last particle added wins.
+            table[s].index = index;
+            return;
         }
-        else if(lookuphash == hash){
-            if(lookup[middle].index < r->N){
-                return &r->particles[lookup[middle].index];
-            }
-            else{ // found lookup table entry pointing beyond r->N in particles array. Needs update
-                return NULL;
-            }
+        s = (s+1) & (allocatedN-1);
+    }
+    table[s].hash = hash;
+    table[s].index = index;
+    (*N_lookup)++;
+}
+
+static void reb_lookup_table_resize(struct reb_simulation* const r, int allocatedN){
+    struct reb_hash_pointer_pair* const old_table = r->particle_lookup_table;
+    const int old_allocatedN = r->allocatedN_lookup;
+    struct reb_hash_pointer_pair* const table = malloc(sizeof(struct reb_hash_pointer_pair)*allocatedN);
+    for (int i=0; i<allocatedN; i++){
+        table[i].index = -1;
+    }
+    r->N_lookup = 0;
+    for (int i=0; i<old_allocatedN; i++){
+        if (old_table[i].index != -1){
+            reb_lookup_table_insert(table, allocatedN, old_table[i].hash, old_table[i].index, &r->N_lookup);
         }
     }
-    return NULL;
+    free(old_table);
+    r->particle_lookup_table = table;
+    r->allocatedN_lookup = allocatedN;
 }
 
-static int compare_hash(const void* a, const void* b){
-    struct reb_hash_pointer_pair* ia = (struct reb_hash_pointer_pair*)a; 
-    struct reb_hash_pointer_pair* ib = (struct reb_hash_pointer_pair*)b;
-    return (ia->hash > ib->hash) - (ia->hash < ib->hash); // to avoid overflow possibilities
+void reb_particle_lookup_table_set(struct reb_simulation* const r, uint32_t hash, int index){
+    if (r->particle_lookup_table == NULL){
+        return; // Table will be built during the first lookup.
+    }
+    if (2*(r->N_lookup+1) > r->allocatedN_lookup){
+        reb_lookup_table_resize(r, 2*r->allocatedN_lookup);
+    }
+    reb_lookup_table_insert(r->particle_lookup_table, r->allocatedN_lookup, hash, index, &r->N_lookup);
+}
+
+void reb_particle_lookup_table_unset(struct reb_simulation* const r, uint32_t hash, int index){
+    struct reb_hash_pointer_pair* const table = r->particle_lookup_table;
+    if (table == NULL){
+        return;
+    }
+    const int allocatedN = r->allocatedN_lookup;
+    uint32_t s = reb_lookup_table_slot(hash, allocatedN);
+    while (table[s].index != -1 && table[s].hash != hash){
+        s = (s+1) & (allocatedN-1);
+    }
+    if (table[s].index != index){ // Not found or hash belongs to another particle.
+        return;
+    }
+    // Shift back entries which follow in the same cluster so that no tombstones are needed.
+    uint32_t j = s;
+    while (1){
+        j = (j+1) & (allocatedN-1);
+        if (table[j].index == -1){
+            break;
+        }
+        const uint32_t k = reb_lookup_table_slot(table[j].hash, allocatedN);
+        // Move entry j into the hole at s if its home slot k is not cyclically in (s,j].
+        if ((s<=j) ? (s<k && k<=j) : (s<k || k<=j)){
+            continue;
+        }
+        table[s] = table[j];
+        s = j;
+    }
+    table[s].index = -1;
+    r->N_lookup--;
 }
 
 static void reb_update_particle_lookup_table(struct reb_simulation* const r){
+    int allocatedN = r->allocatedN_lookup ? r->allocatedN_lookup : 128;
+    while (allocatedN < 2*r->N){
+        allocatedN *= 2;
+    }
+    if (allocatedN != r->allocatedN_lookup){
+        free(r->particle_lookup_table);
+        r->particle_lookup_table = malloc(sizeof(struct reb_hash_pointer_pair)*allocatedN);
+        r->allocatedN_lookup = allocatedN;
+    }
+    struct reb_hash_pointer_pair* const table = r->particle_lookup_table;
+    for (int i=0; i<allocatedN; i++){
+        table[i].index = -1;
+    }
+    r->N_lookup = 0;
     const struct reb_particle* const particles = r->particles;
-    int N_hash = 0;
-    int zerohash = -1;
     for(int i=0; i<r->N; i++){
-        if(N_hash >= r->allocatedN_lookup){
-            r->allocatedN_lookup = r->allocatedN_lookup ? r->allocatedN_lookup * 2 : 128;
-            r->particle_lookup_table = realloc(r->particle_lookup_table, sizeof(struct reb_hash_pointer_pair)*r->allocatedN_lookup);
-        }
-        if(particles[i].hash == 0){ // default hash (0) special case
-            if (zerohash == -1){    // first zero hash
-                zerohash = i;
-                r->particle_lookup_table[zerohash].hash = particles[i].hash;
-                r->particle_lookup_table[zerohash].index = i;
-                N_hash++;
-            }
-            else{                   // update zero hash entry in lookup without incrementing N_hash
-                r->particle_lookup_table[zerohash].index = i;
+        reb_lookup_table_insert(table, allocatedN, particles[i].hash, i, &r->N_lookup);
+    }
+}
+
+static struct reb_particle* reb_search_lookup_table(struct reb_simulation* const r, uint32_t hash){
+    const struct reb_hash_pointer_pair* const table = r->particle_lookup_table;
+    if (table == NULL){
+        return NULL;
+    }
+    const int allocatedN = r->allocatedN_lookup;
+    uint32_t s = reb_lookup_table_slot(hash, allocatedN);
+    while (table[s].index != -1){
+        if (table[s].hash == hash){
+            const int index = table[s].index;
+            if (index < r->N && r->particles[index].hash == hash){
+                return &r->particles[index];
             }
+            return NULL; // Entry is outdated. Needs update.
         }
-        else{                   
-            r->particle_lookup_table[N_hash].hash = particles[i].hash;
-            r->particle_lookup_table[N_hash].index = i;
-            N_hash++;
-        }
+        s = (s+1) & (allocatedN-1);
     }
-    r->N_lookup = N_hash;
-    qsort(r->particle_lookup_table, r->N_lookup, sizeof(*r->particle_lookup_table), compare_hash); // only sort the first N_lookup entries that are initialized.
+    return NULL;
 }
 
 struct reb_particle* reb_get_particle_by_hash(struct reb_simulation* const r, uint32_t hash){
-    struct reb_particle* p; 
-    p = reb_search_lookup_table(r, hash);
+    struct reb_particle* p = reb_search_lookup_table(r, hash);
     if (p == NULL){
         reb_update_particle_lookup_table(r);
         p = reb_search_lookup_table(r, hash);
     }
-    else{
-        if (p->hash != hash){
-            reb_update_particle_lookup_table(r);
-            p = reb_search_lookup_table(r, hash);
-        }
-    }
     return p;
 }
 
@@ -255,7 +575,7 @@ void reb_remove_all(struct reb_simulation* const r){
 	r->allocatedN 	= 0;
 	r->N_active 	= -1;
 	r->N_var 	= 0;
-	free(r->particles);
+	reb_free(r->particles);
 	r->particles 	= NULL;
 }
 
@@ -270,8 +590,9 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
                 }
             }
         }
-        reb_integrator_ias15_reset(r);
         if (r->ri_mercurius.mode==1){
+            // Buffers are kept, only the IAS15 state is cleared.
+            reb_integrator_ias15_clear(r);
             struct reb_simulation_integrator_mercurius* rim = &(r->ri_mercurius);
             int after_to_be_removed_particle = 0;
             int encounter_index = -1;
@@ -288,10 +609,14 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
                 rim->encounterNactive--;
             }
             rim->encounterN--;
+            for (int i=index;i<r->N-1;i++){
+                rim->encounter_group[i] = rim->encounter_group[i+1];
+            }
         }
     }
 	if (r->N==1){
 	    r->N = 0;
+        reb_particle_lookup_table_unset(r, r->particles[index].hash, index);
         if(r->free_particle_ap){
             r->free_particle_ap(&r->particles[index]);
         }
@@ -316,8 +641,10 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
         if(index<r->N_active){
             r->N_active--;
         }
+        reb_particle_lookup_table_unset(r, r->particles[index].hash, index);
 		for(int j=index; j<r->N; j++){
 			r->particles[j] = r->particles[j+1];
+            reb_particle_lookup_table_set(r, r->particles[j].hash, j);
 		}
         if (r->tree_root){
 		    reb_error(r, "REBOUND cannot remove a particle a tree and keep the particles sorted. Did not remove particle.");
@@ -335,7 +662,11 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
             if(r->free_particle_ap){
                 r->free_particle_ap(&r->particles[index]);
             }
+            reb_particle_lookup_table_unset(r, r->particles[index].hash, index);
 		    r->particles[index] = r->particles[r->N];
+            if (index<r->N){
+                reb_particle_lookup_table_set(r, r->particles[index].hash, index);
+            }
         }
 	}
 
@@ -354,6 +685,136 @@ int reb_remove_by_hash(struct reb_simulation* const r, uint32_t hash, int keepSo
     }
 }
 
+int reb_remove_many(struct reb_simulation* const r, const int* const indices, const int N, int keepSorted){
+    if (N<=0){
+        return 0;
+    }
+    if (r->N_var){
+        reb_error(r, "Removing particles not supported when calculating MEGNO.  Did not remove particles.");
+        return 0;
+    }
+    if (r->integrator == REB_INTEGRATOR_MERCURIUS){
+        keepSorted = 1; // Force keepSorted for hybrid integrator
+    }
+    if (keepSorted && r->tree_root){
+        reb_error(r, "REBOUND cannot remove a particle a tree and keep the particles sorted. Did not remove particles.");
+        return 0;
+    }
+    const int N_old = r->N;
+    // new_index[i] is the index of particle i after the removal or -1 if it gets removed.
+    int* const new_index = malloc(sizeof(int)*(N_old?N_old:1));
+    for (int i=0;i<N_old;i++){
+        new_index[i] = 0;
+    }
+    int N_removed = 0;
+    for (int k=0;k<N;k++){
+        const int index = indices[k];
+        if (index >= N_old || index < 0){
+            char warning[1024];
+            sprintf(warning, "Index %d passed to reb_remove_many was out of range (N=%d).  Did not remove particle.", index, N_old);
+            reb_error(r, warning);
+            continue;
+        }
+        if (new_index[index]==0){
+            new_index[index] = -1;
+            N_removed++;
+            if(r->free_particle_ap){
+                r->free_particle_ap(&r->particles[index]);
+            }
+        }
+    }
+    if (N_removed==0){
+        free(new_index);
+        return 0;
+    }
+
+    if (r->tree_root){
+        // Just flag particles, will be removed in tree_update.
+        for (int i=0;i<N_old;i++){
+            if (new_index[i]==-1){
+                r->particles[i].y = nan("");
+            }
+        }
+        free(new_index);
+        return N_removed;
+    }
+
+    // Compact the particle array. This preserves the order of the remaining
+    // particles, so keepSorted is always satisfied.
+    int j = 0;
+    for (int i=0;i<N_old;i++){
+        if (new_index[i]==-1){
+            if (i<r->N_active){
+                r->N_active--;
+            }
+        }else{
+            new_index[i] = j;
+            if (i!=j){
+                r->particles[j] = r->particles[i];
+            }
+            j++;
+        }
+    }
+    r->N = j;
+
+    if (r->integrator == REB_INTEGRATOR_MERCURIUS){
+        struct reb_simulation_integrator_mercurius* rim = &(r->ri_mercurius);
+        const int N_dcrit = rim->dcrit_allocatedN<N_old?rim->dcrit_allocatedN:N_old;
+        for (int i=0;i<N_dcrit;i++){
+            if (new_index[i]>=0){
+                rim->dcrit[new_index[i]] = rim->dcrit[i];
+            }
+        }
+        if (rim->mode==1){
+            reb_integrator_ias15_clear(r);
+            int encounterN = 0;
+            int encounterNactive = rim->encounterNactive;
+            for (int i=0;i<rim->encounterN;i++){
+                const int index = rim->encounter_map[i];
+                if (new_index[index]==-1){
+                    if (i<rim->encounterNactive){
+                        encounterNactive--;
+                    }
+                }else{
+                    rim->encounter_map[encounterN++] = new_index[index];
+                }
+            }
+            rim->encounterN = encounterN;
+            rim->encounterNactive = encounterNactive;
+            for (int i=0;i<N_old;i++){
+                if (new_index[i]>=0){
+                    rim->encounter_group[new_index[i]] = rim->encounter_group[i];
+                }
+            }
+        }
+    }
+    free(new_index);
+
+    if (r->particle_lookup_table){
+        reb_update_particle_lookup_table(r);
+    }
+    if (r->N==0){
+        reb_warning(r, "Last particle removed.");
+    }
+    return N_removed;
+}
+
+int reb_remove_many_by_hash(struct reb_simulation* const r, const uint32_t* const hashes, const int N, int keepSorted){
+    int* const indices = malloc(sizeof(int)*(N>0?N:1));
+    int N_found = 0;
+    for (int k=0;k<N;k++){
+        struct reb_particle* p = reb_get_particle_by_hash(r, hashes[k]);
+        if(p == NULL){
+            reb_error(r,"Particle to be removed not found in simulation.  Did not remove particle.");
+        }else{
+            indices[N_found++] = (int)(p - r->particles);
+        }
+    }
+    const int N_removed = reb_remove_many(r, indices, N_found, keepSorted);
+    free(indices);
+    return N_removed;
+}
+
 void reb_particle_isub(struct reb_particle* p1, struct reb_particle* p2){
     p1->x -= p2->x;
     p1->y -= p2->y;
@@ -24,9 +24,11 @@
  */
 #ifndef _PARTICLE_H
 #define _PARTICLE_H
+#include <stdint.h>
 struct reb_simulation;
 struct reb_particle;
 struct reb_treecell;
+struct reb_particles_soa;
 
 /**
  * @brief Returns the index of the rootbox for the current particles based on its position.
@@ -36,8 +38,48 @@ struct reb_treecell;
  */
 int reb_get_rootbox_for_particle(const struct reb_simulation* const r, struct reb_particle pt);
 
+/**
+ * @brief Records in the hash lookup table that the particle with the given hash is at position index.
+ * @details Does nothing if the lookup table has not been built yet.
+ */
+void reb_particle_lookup_table_set(struct reb_simulation* const r, uint32_t hash, int index);
+
+/**
+ * @brief Removes the entry of the particle with the given hash at position index from the hash lookup table.
+ * @details Entries of other particles with the same hash are not removed.
+ */
+void reb_particle_lookup_table_unset(struct reb_simulation* const r, uint32_t hash, int index);
+
 /**
  * @brief Returns 1 if a testparticle of type 0 has a finite mass.
  */
 int reb_particle_check_testparticles(struct reb_simulation* const r);
+/**
+ * @brief Copies positions, velocities and masses of the first N particles into a structure-of-arrays mirror.
+ * @details The arrays of the mirror are grown if needed. Vectorized kernels 
+ * read from the mirror instead of the particles array because contiguous 
+ * loads are much cheaper than strided loads from struct reb_particle.
+ * @param soa Structure-of-arrays mirror to be updated.
+ * @param particles Particle array to read from.
+ * @param N Number of particles to copy.
+ */
+void reb_particles_soa_update(struct reb_particles_soa* const soa, const struct reb_particle* const particles, const int N);
+
+/**
+ * @brief Frees all arrays of a structure-of-arrays mirror.
+ */
+void reb_particles_soa_free(struct reb_particles_soa* const soa);
+
+#ifdef GPU
+/**
+ * @brief Allocates device copies of all arrays of a structure-of-arrays mirror on the offload device.
+ * @details The device copies stay allocated until the host arrays are reallocated or freed.
+ */
+void reb_particles_soa_device_alloc(struct reb_particles_soa* const soa);
+
+/**
+ * @brief Frees the device copies of a structure-of-arrays mirror.
+ */
+void reb_particles_soa_device_free(struct reb_particles_soa* const soa);
+#endif // GPU
 #endif // _PARTICLE_H
@@ -0,0 +1,285 @@
+/**
+ * @file    profiling.c
+ * @brief   Runtime profiling of the main simulation loop.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details The timing data is stored in the simulation itself, so 
+ * several simulations can be profiled independently, also in different
+ * threads. Scopes can be nested. For every category, the total time 
+ * and the self time (excluding nested scopes) are recorded.
+ * The work counters in r->counters are always on and are reset here.
+ * The event tracer records the begin and end of every phase of a 
+ * timestep in a ring buffer and writes them as a Chrome trace.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rebound.h"
+#include "profiling.h"
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
+
+const char* const reb_profiling_category_names[REB_PROFILING_CAT_NUM] = {
+    "integrator",
+    "boundary",
+    "tree",
+    "gravity",
+    "collision",
+    "tree_build",
+    "tree_moments",
+    "gravity_walk",
+    "kepler",
+    "jump",
+    "encounter_predict",
+    "ias15_iterations",
+    "simulationarchive",
+};
+
+double reb_profiling_clock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void reb_profiling_enable(struct reb_simulation* const r){
+    if (r->profiling==NULL){
+        r->profiling = malloc(sizeof(struct reb_profiling));
+    }
+    *(r->profiling) = (struct reb_profiling){0};
+    r->profiling->time_start = reb_profiling_clock();
+}
+
+void reb_profiling_disable(struct reb_simulation* const r){
+    free(r->profiling);
+    r->profiling = NULL;
+}
+
+void reb_profiling_push(struct reb_profiling* const p){
+    if (p->depth<REB_PROFILING_DEPTH_MAX){
+        p->stack[p->depth] = (struct reb_profiling_scope){.start = reb_profiling_clock(), .children = 0.};
+    }
+    p->depth++;
+}
+
+void reb_profiling_pop(struct reb_profiling* const p, const int cat){
+    if (p->depth<=0){
+        // Profiling was enabled while this scope was open.
+        return;
+    }
+    p->depth--;
+    if (p->depth>=REB_PROFILING_DEPTH_MAX){
+        return;
+    }
+    const double dt = reb_profiling_clock() - p->stack[p->depth].start;
+    p->time[cat] += dt;
+    p->time_self[cat] += dt - p->stack[p->depth].children;
+    p->calls[cat]++;
+    if (p->depth>0){
+        p->stack[p->depth-1].children += dt;
+    }
+}
+
+void reb_counters_reset(struct reb_simulation* const r){
+    r->counters = (struct reb_counters){0};
+}
+
+const char* const reb_trace_phase_names[REB_TRACE_PHASE_NUM] = {
+    "step",
+    "part1",
+    "boundary",
+    "tree",
+    "mpi_exchange",
+    "gravity",
+    "gravity_walk",
+    "additional_forces",
+    "part2",
+    "collision_search",
+    "collision_resolve",
+    "encounter",
+    "heartbeat",
+    "simulationarchive",
+};
+
+void reb_trace_enable(struct reb_simulation* const r, uint64_t capacity){
+    if (capacity==0){
+        reb_error(r, "The capacity of the trace buffer needs to be larger than zero.");
+        return;
+    }
+    if (r->trace==NULL){
+        r->trace = calloc(1, sizeof(struct reb_trace));
+    }
+    if (r->trace->capacity!=capacity){
+        free(r->trace->events);
+        r->trace->events = malloc(sizeof(struct reb_trace_event)*capacity);
+        r->trace->capacity = capacity;
+    }
+    r->trace->N = 0;
+    r->trace->time_start = reb_profiling_clock();
+}
+
+void reb_trace_disable(struct reb_simulation* const r){
+    if (r->trace){
+        free(r->trace->events);
+        free(r->trace);
+        r->trace = NULL;
+    }
+}
+
+void reb_trace_record(struct reb_trace* const t, const int phase, const char type){
+    uint64_t i;
+#pragma omp atomic capture
+    i = t->N++;
+    struct reb_trace_event* const e = &t->events[i%t->capacity];
+    e->time = reb_profiling_clock() - t->time_start;
+#ifdef OPENMP
+    e->tid = omp_get_thread_num();
+#else // OPENMP
+    e->tid = 0;
+#endif // OPENMP
+    e->phase = phase;
+    e->type = type;
+}
+
+// Copies the events in the ring buffer into a new array, oldest event first.
+static struct reb_trace_event* reb_trace_events_ordered(const struct reb_trace* const t, uint64_t* N){
+    const uint64_t first = t->N>t->capacity ? t->N-t->capacity : 0;
+    *N = t->N-first;
+    struct reb_trace_event* events = malloc(sizeof(struct reb_trace_event)*(*N+1));
+    for (uint64_t i=0; i<*N; i++){
+        events[i] = t->events[(first+i)%t->capacity];
+    }
+    return events;
+}
+
+#define REB_TRACE_TID_MAX 256   // End events of threads with a larger id are never dropped.
+
+// Writes the events of one process. End events without a begin event 
+// (the begin event was overwritten in the ring buffer) are dropped.
+static void reb_trace_write_events(FILE* of, const struct reb_trace_event* const events, const uint64_t N, const int pid, int* first){
+    int depth[REB_TRACE_TID_MAX] = {0};
+    fprintf(of, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"node %d\"}}", *first?"":",\n", pid, pid);
+    *first = 0;
+    for (uint64_t i=0; i<N; i++){
+        const struct reb_trace_event e = events[i];
+        if (e.phase<0 || e.phase>=REB_TRACE_PHASE_NUM){
+            continue;
+        }
+        if (e.tid>=0 && e.tid<REB_TRACE_TID_MAX){
+            if (e.type=='B'){
+                depth[e.tid]++;
+            }else{
+                if (depth[e.tid]==0){
+                    continue;
+                }
+                depth[e.tid]--;
+            }
+        }
+        fprintf(of, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", reb_trace_phase_names[e.phase], e.type, e.time*1e6, pid, e.tid);
+    }
+}
+
+int reb_trace_output_chrome(struct reb_simulation* const r, const char* filename){
+    struct reb_trace* const t = r->trace;
+    int error = 0;
+#ifdef MPI
+    // Align the clocks of all nodes to node 0 using a barrier.
+    double shift = 0.;
+    if (t){
+        MPI_Barrier(MPI_COMM_WORLD);
+        const double time_sync = reb_profiling_clock();
+        double start_sync0 = time_sync - t->time_start;
+        MPI_Bcast(&start_sync0, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        shift = t->time_start - time_sync + start_sync0;
+    }else{
+        // Participate in the collective calls without events.
+        MPI_Barrier(MPI_COMM_WORLD);
+        double start_sync0 = 0.;
+        MPI_Bcast(&start_sync0, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+    uint64_t N = 0;
+    struct reb_trace_event* events = NULL;
+    if (t){
+        events = reb_trace_events_ordered(t, &N);
+        for (uint64_t i=0; i<N; i++){
+            events[i].time += shift;
+        }
+    }
+    int size = (int)(N*sizeof(struct reb_trace_event));
+    int* sizes = NULL;
+    int* displs = NULL;
+    char* all = NULL;
+    if (r->mpi_id==0){
+        sizes = malloc(sizeof(int)*r->mpi_num);
+        displs = malloc(sizeof(int)*r->mpi_num);
+    }
+    MPI_Gather(&size, 1, MPI_INT, sizes, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (r->mpi_id==0){
+        int total = 0;
+        for (int i=0; i<r->mpi_num; i++){
+            displs[i] = total;
+            total += sizes[i];
+        }
+        all = malloc(total>0?total:1);
+    }
+    MPI_Gatherv(events, size, MPI_BYTE, all, sizes, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+    free(events);
+    if (r->mpi_id==0){
+        FILE* of = fopen(filename, "w");
+        if (of==NULL){
+            reb_error(r, "Cannot open file for the trace.");
+            error = 1;
+        }else{
+            int first = 1;
+            fprintf(of, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+            for (int i=0; i<r->mpi_num; i++){
+                reb_trace_write_events(of, (struct reb_trace_event*)(all+displs[i]), sizes[i]/sizeof(struct reb_trace_event), i, &first);
+            }
+            fprintf(of, "\n]}\n");
+            fclose(of);
+        }
+        free(all);
+        free(sizes);
+        free(displs);
+    }
+    MPI_Bcast(&error, 1, MPI_INT, 0, MPI_COMM_WORLD);
+#else // MPI
+    if (t==NULL){
+        reb_error(r, "Tracing is not enabled. Call reb_trace_enable() first.");
+        return 1;
+    }
+    FILE* of = fopen(filename, "w");
+    if (of==NULL){
+        reb_error(r, "Cannot open file for the trace.");
+        return 1;
+    }
+    uint64_t N;
+    struct reb_trace_event* events = reb_trace_events_ordered(t, &N);
+    int first = 1;
+    fprintf(of, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    reb_trace_write_events(of, events, N, 0, &first);
+    fprintf(of, "\n]}\n");
+    fclose(of);
+    free(events);
+#endif // MPI
+    return error;
+}
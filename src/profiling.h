@@ -0,0 +1,62 @@
+/**
+ * @file    profiling.h
+ * @brief   Runtime profiling of the main simulation loop.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * 
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _PROFILING_H
+#define _PROFILING_H
+struct reb_profiling;
+struct reb_trace;
+
+/**
+ * @brief Returns the value of a monotonic clock in seconds.
+ */
+double reb_profiling_clock(void);
+
+/**
+ * @brief Enters a new profiling scope.
+ */
+void reb_profiling_push(struct reb_profiling* const p);
+
+/**
+ * @brief Leaves the current profiling scope and adds its duration to category cat.
+ */
+void reb_profiling_pop(struct reb_profiling* const p, const int cat);
+
+/**
+ * Profiling scopes are only timed if r->profiling is set. Every
+ * PROFILING_START must be matched by a PROFILING_STOP in the same
+ * thread. Scopes must not be opened inside OpenMP parallel regions.
+ */
+#define PROFILING_START(r) if ((r)->profiling){ reb_profiling_push((r)->profiling); }         ///< Start profiling scope 
+#define PROFILING_STOP(r,C) if ((r)->profiling){ reb_profiling_pop((r)->profiling, (C)); }    ///< Stop profiling scope 
+
+/**
+ * @brief Records a begin ('B') or end ('E') event of phase in the ring buffer of the tracer.
+ * @details Can be called from within OpenMP parallel regions.
+ */
+void reb_trace_record(struct reb_trace* const t, const int phase, const char type);
+
+#define TRACE_BEGIN(r,P) if ((r)->trace){ reb_trace_record((r)->trace, (P), 'B'); }   ///< Record the beginning of phase P
+#define TRACE_END(r,P) if ((r)->trace){ reb_trace_record((r)->trace, (P), 'E'); }     ///< Record the end of phase P
+
+#endif // _PROFILING_H
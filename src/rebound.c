@@ -22,6 +22,12 @@
  * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#if defined(OPENMP) && defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_setaffinity
+#endif // _GNU_SOURCE
+#include <sched.h>
+#endif // OPENMP, linux
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -41,16 +47,25 @@
 #include "integrator_ias15.h"
 #include "integrator_mercurius.h"
 #include "integrator_bs.h"
+#include "integrator_hermite.h"
+#include "integrator_sei.h"
+#include "integrator_leapfrog.h"
+#include "forces.h"
 #include "boundary.h"
 #include "gravity.h"
+#include "gravity_fft.h"
 #include "collision.h"
 #include "tree.h"
+#include "autoselect.h"
 #include "output.h"
+#include "profiling.h"
 #include "tools.h"
 #include "particle.h"
 #include "input.h"
 #include "binarydiff.h"
 #include "simulationarchive.h"
+#include "recorder.h"
+#include "allocator.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif
@@ -69,102 +84,289 @@ const char* reb_version_str = "3.19.3";         // **VERSIONLINE** This line get
 const char* reb_githash_str = STRINGIFY(GITHASH);             // This line gets updated automatically. Do not edit manually.
 
 static int reb_error_message_waiting(struct reb_simulation* const r);
+static void reb_step_raw(struct reb_simulation* const r);
 
+#define REB_STEP_BATCH_MAX 64   ///< Maximum number of steps reb_step_batch() takes without returning.
+
+// The walltime is measured once per call rather than once per step.
+// For small N, the clock calls would otherwise be a noticeable fraction 
+// of the time per step.
 void reb_steps(struct reb_simulation* const r, unsigned int N_steps){
+    const double time_beginning = reb_profiling_clock();
     for (unsigned int i=0;i<N_steps;i++){
-        reb_step(r);
+        reb_step_raw(r);
     }
+    r->walltime += reb_profiling_clock() - time_beginning;
 }
+
 void reb_step(struct reb_simulation* const r){
-    // Update walltime
-    struct timeval time_beginning;
-    gettimeofday(&time_beginning,NULL);
+    const double time_beginning = reb_profiling_clock();
+    reb_step_raw(r);
+    r->walltime += reb_profiling_clock() - time_beginning;
+}
+
+// Returns the number of steps that can be taken in a row without
+// running the heartbeat, SimulationArchive, display or exit checks 
+// in between. 
+static unsigned int reb_step_batch_size(const struct reb_simulation* const r){
+    if (r->display_heartbeat || r->display_data
+            || r->exit_max_distance || r->exit_min_distance || r->usleep > 0
+            || r->simulationarchive_filename || r->simulationarchive_checkpoint_filename){
+        return 1;
+    }
+#ifdef MPI
+    if (r->mpi_root_owner){
+        return 1; // All nodes need to check the exit condition together after every step.
+    }
+#endif // MPI
+    unsigned int batch = REB_STEP_BATCH_MAX;
+    if (r->heartbeat){
+        if (r->heartbeat_steps<=1){
+            return 1;
+        }
+        // Run until the next step at which the heartbeat is called.
+        const unsigned int steps = r->heartbeat_steps - r->steps_done%r->heartbeat_steps;
+        if (steps<batch){
+            batch = steps;
+        }
+    }
+    if (r->recorder){
+        // Run until the next step at which a sample is recorded.
+        const unsigned int steps = reb_recorder_steps_until_sample(r);
+        if (steps<batch){
+            batch = steps;
+        }
+    }
+    return batch;
+}
+
+// Returns 1 if another step can be taken without going through reb_check_exit().
+static int reb_step_batch_continue(const struct reb_simulation* const r, const double tmax){
+    if (r->status!=REB_RUNNING || reb_sigint || r->N==0 || (r->messages && r->messages[0])){
+        return 0;
+    }
+    if (tmax==INFINITY){
+        return 1;
+    }
+    const double dtsign = copysign(1.,r->dt);
+    if (r->exact_finish_time==1){
+        return (r->t+r->dt)*dtsign<tmax*dtsign;
+    }
+    return r->t*dtsign<tmax*dtsign;
+}
+
+#if defined(OPENMP) && !defined(GPU) && !defined(SIMD)
+// Returns 1 if the steps of the simulation can run in one persistent parallel region.
+// This is the case if a step only consists of loops over particles and the direct 
+// summation, all of which support orphaned worksharing.
+static int reb_step_team_supported(const struct reb_simulation* const r){
+    return r->omp_persistent_team && r->integrator==REB_INTEGRATOR_LEAPFROG
+        && reb_calculate_acceleration_team_supported(r)
+        && r->boundary==REB_BOUNDARY_NONE && r->collision==REB_COLLISION_NONE
+        && !reb_forces_used(r) && r->pre_timestep_modifications==NULL && r->post_timestep_modifications==NULL
+        && r->auto_select_interval==0 && r->tree_needs_update==0 && r->tree_root==NULL;
+}
+
+// Takes up to batch steps in one parallel region. The threads share the loops
+// of every step (orphaned worksharing) and only synchronize with barriers, 
+// rather than forking and joining for every loop.
+static void reb_step_batch_team(struct reb_simulation* const r, const double tmax, const unsigned int batch){
+    int next = 1;
+    r->gravity_ignore_terms = 0;
+#pragma omp parallel if(r->N>=reb_omp_min_N)
+    for (unsigned int i=0; next; i++){
+        reb_integrator_leapfrog_part1_team(r);
+        reb_calculate_acceleration_team(r);
+        reb_integrator_leapfrog_part2_team(r);
+#pragma omp single
+        {
+            r->steps_done++;
+            next = i+1<batch && reb_step_batch_continue(r, tmax);
+        }
+    }
+}
+#endif // OPENMP, GPU, SIMD
+
+// Same as reb_step_batch() but takes at most max_steps steps.
+static void reb_step_batch_max(struct reb_simulation* const r, const double tmax, const unsigned int max_steps){
+    unsigned int batch = reb_step_batch_size(r);
+    if (max_steps<batch){
+        batch = max_steps;
+    }
+    const double time_beginning = reb_profiling_clock();
+#if defined(OPENMP) && !defined(GPU) && !defined(SIMD)
+    if (reb_step_team_supported(r)){
+        reb_step_batch_team(r, tmax, batch);
+        r->walltime += reb_profiling_clock() - time_beginning;
+        return;
+    }
+#endif // OPENMP, GPU, SIMD
+    reb_step_raw(r);
+    for (unsigned int i=1; i<batch && reb_step_batch_continue(r, tmax); i++){
+        reb_step_raw(r);
+    }
+    r->walltime += reb_profiling_clock() - time_beginning;
+}
+
+void reb_step_batch(struct reb_simulation* const r, const double tmax){
+    reb_step_batch_max(r, tmax, REB_STEP_BATCH_MAX);
+}
+
+static void reb_step_raw(struct reb_simulation* const r){
+    TRACE_BEGIN(r, REB_TRACE_PHASE_STEP)
+
+    if (r->auto_select_interval>0 && r->steps_done%r->auto_select_interval==0){
+        reb_autoselect(r);
+    }
 
     // A 'DKD'-like integrator will do the first 'D' part.
-    PROFILING_START()
+    PROFILING_START(r)
+    TRACE_BEGIN(r, REB_TRACE_PHASE_PART1)
     if (r->pre_timestep_modifications){
         reb_integrator_synchronize(r);
+        reb_integrator_whfast_backup_particles(r);
         r->pre_timestep_modifications(r);
-        r->ri_whfast.recalculate_coordinates_this_timestep = 1;
+        reb_integrator_whfast_update_modified_particles(r);
         r->ri_mercurius.recalculate_coordinates_this_timestep = 1;
     }
    
     reb_integrator_part1(r);
-    PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
+    TRACE_END(r, REB_TRACE_PHASE_PART1)
+    PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
 
     // Update and simplify tree. 
     // Prepare particles for distribution to other nodes. 
     // This function also creates the tree if called for the first time.
-    if (r->tree_needs_update || r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE){
+    if (r->tree_needs_update || r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->collision==REB_COLLISION_TREE || r->collision==REB_COLLISION_LINETREE){
         // Check for root crossings.
-        PROFILING_START()
+        PROFILING_START(r)
+        TRACE_BEGIN(r, REB_TRACE_PHASE_BOUNDARY)
         reb_boundary_check(r);     
-        PROFILING_STOP(PROFILING_CAT_BOUNDARY)
+        TRACE_END(r, REB_TRACE_PHASE_BOUNDARY)
+        PROFILING_STOP(r, REB_PROFILING_CAT_BOUNDARY)
 
         // Update tree (this will remove particles which left the box)
-        PROFILING_START()
+        PROFILING_START(r)
+        TRACE_BEGIN(r, REB_TRACE_PHASE_TREE)
         reb_tree_update(r);          
-        PROFILING_STOP(PROFILING_CAT_GRAVITY)
+        TRACE_END(r, REB_TRACE_PHASE_TREE)
+        PROFILING_STOP(r, REB_PROFILING_CAT_TREE)
     }
 
-    PROFILING_START()
+    PROFILING_START(r)
 #ifdef MPI
-    // Distribute particles and add newly received particles to tree.
-    reb_communication_mpi_distribute_particles(r);
+    if (r->mpi_root_owner && !r->mpi_direct){
+        TRACE_BEGIN(r, REB_TRACE_PHASE_MPI_EXCHANGE)
+        // Reassign root boxes to nodes. Particles in root boxes which have moved are queued for sending.
+        if (r->mpi_load_balance_interval>0 && r->steps_done%r->mpi_load_balance_interval==0){
+            reb_communication_mpi_load_balance(r);
+        }
+        // Distribute particles and add newly received particles to tree.
+        reb_communication_mpi_distribute_particles(r);
+        TRACE_END(r, REB_TRACE_PHASE_MPI_EXCHANGE)
+    }
 #endif // MPI
 
-    if (r->tree_root!=NULL && r->gravity==REB_GRAVITY_TREE){
+    if (r->tree_root!=NULL && (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM)){
         // Update center of mass and quadrupole moments in tree in preparation of force calculation.
+        TRACE_BEGIN(r, REB_TRACE_PHASE_TREE)
         reb_tree_update_gravity_data(r); 
+        TRACE_END(r, REB_TRACE_PHASE_TREE)
 #ifdef MPI
-        // Prepare essential tree (and particles close to the boundary needed for collisions) for distribution to other nodes.
-        reb_tree_prepare_essential_tree_for_gravity(r);
+        if (r->mpi_root_owner && !r->mpi_direct){
+            TRACE_BEGIN(r, REB_TRACE_PHASE_MPI_EXCHANGE)
+            // Prepare essential tree (and particles close to the boundary needed for collisions) for distribution to other nodes.
+            reb_tree_prepare_essential_tree_for_gravity(r);
 
-        // Transfer essential tree and particles needed for collisions.
-        reb_communication_mpi_distribute_essential_tree_for_gravity(r);
+            // Transfer essential tree and particles needed for collisions.
+            if (r->mpi_pipeline){
+                // Only start the communication here. Forces from the local tree
+                // are calculated while the data is in transit.
+                reb_communication_mpi_start_essential_tree(r, 0);
+            }else{
+                reb_communication_mpi_distribute_essential_tree_for_gravity(r);
+            }
+            TRACE_END(r, REB_TRACE_PHASE_MPI_EXCHANGE)
+        }
 #endif // MPI
     }
+    PROFILING_STOP(r, REB_PROFILING_CAT_TREE)
 
     // Calculate accelerations. 
+    PROFILING_START(r)
+    TRACE_BEGIN(r, REB_TRACE_PHASE_GRAVITY)
     reb_calculate_acceleration(r);
+#ifdef MPI
+    if (r->mpi_pipeline && r->mpi_root_owner && !r->mpi_direct && r->tree_root!=NULL && r->gravity==REB_GRAVITY_TREE){
+        // Add forces from the essential trees of other nodes as they arrive.
+        int roots[r->root_n];
+        int proc;
+        while(1){
+            TRACE_BEGIN(r, REB_TRACE_PHASE_MPI_EXCHANGE)
+            proc = reb_communication_mpi_wait_essential_tree(r, 0);
+            TRACE_END(r, REB_TRACE_PHASE_MPI_EXCHANGE)
+            if (proc<0) break;
+            const int N_roots = reb_communication_mpi_rootboxes_of_proc(r, proc, roots);
+            reb_calculate_acceleration_tree_from_roots(r, roots, N_roots);
+        }
+    }
+#endif // MPI
     if (r->N_var){
         reb_calculate_acceleration_var(r);
     }
+    TRACE_END(r, REB_TRACE_PHASE_GRAVITY)
     // Calculate non-gravity accelerations. 
-    if (r->additional_forces) r->additional_forces(r);
-    PROFILING_STOP(PROFILING_CAT_GRAVITY)
+    if (reb_forces_used(r)){
+        TRACE_BEGIN(r, REB_TRACE_PHASE_ADDITIONAL_FORCES)
+        if (r->additional_forces){
+            r->additional_forces(r);
+        }
+        reb_calculate_registered_forces(r);
+        TRACE_END(r, REB_TRACE_PHASE_ADDITIONAL_FORCES)
+    }
+    PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
 
     // A 'DKD'-like integrator will do the 'KD' part.
-    PROFILING_START()
+    PROFILING_START(r)
+    TRACE_BEGIN(r, REB_TRACE_PHASE_PART2)
     reb_integrator_part2(r);
     
     if (r->post_timestep_modifications){
         reb_integrator_synchronize(r);
+        reb_integrator_whfast_backup_particles(r);
         r->post_timestep_modifications(r);
-        r->ri_whfast.recalculate_coordinates_this_timestep = 1;
+        reb_integrator_whfast_update_modified_particles(r);
         r->ri_mercurius.recalculate_coordinates_this_timestep = 1;
     }
-    PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
+    TRACE_END(r, REB_TRACE_PHASE_PART2)
+    PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
 
     // Do collisions here. We need both the positions and velocities at the same time.
     // Check for root crossings.
-    PROFILING_START()
-    reb_boundary_check(r);     
+    if (!reb_integrator_sei_applies_boundary(r)){
+        PROFILING_START(r)
+        TRACE_BEGIN(r, REB_TRACE_PHASE_BOUNDARY)
+        reb_boundary_check(r);     
+        TRACE_END(r, REB_TRACE_PHASE_BOUNDARY)
+        PROFILING_STOP(r, REB_PROFILING_CAT_BOUNDARY)
+    }
     if (r->tree_needs_update){
         // Update tree (this will remove particles which left the box)
+        PROFILING_START(r)
+        TRACE_BEGIN(r, REB_TRACE_PHASE_TREE)
         reb_tree_update(r);          
+        TRACE_END(r, REB_TRACE_PHASE_TREE)
+        PROFILING_STOP(r, REB_PROFILING_CAT_TREE)
     }
-    PROFILING_STOP(PROFILING_CAT_BOUNDARY)
 
     // Search for collisions using local and essential tree.
-    PROFILING_START()
+    PROFILING_START(r)
+    TRACE_BEGIN(r, REB_TRACE_PHASE_COLLISION_SEARCH)
     reb_collision_search(r);
-    PROFILING_STOP(PROFILING_CAT_COLLISION)
+    TRACE_END(r, REB_TRACE_PHASE_COLLISION_SEARCH)
+    PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION)
+    TRACE_END(r, REB_TRACE_PHASE_STEP)
     
-    // Update walltime
-    struct timeval time_end;
-    gettimeofday(&time_end,NULL);
-    r->walltime += time_end.tv_sec-time_beginning.tv_sec+(time_end.tv_usec-time_beginning.tv_usec)/1e6;
     // Update step counter
     r->steps_done++; // This also counts failed IAS15 steps
 }
@@ -268,15 +470,30 @@ void reb_configure_box(struct reb_simulation* const r, const double root_size, c
 #ifdef MPI
 void reb_mpi_init(struct reb_simulation* const r){
     reb_communication_mpi_init(r,0,NULL);
+    r->mpi_root_owner = malloc(sizeof(int)*r->root_n);
+    if (r->mpi_direct){
+        // Every node keeps all particles. Only the force calculation is split.
+        for (int i=0;i<r->root_n;i++){
+            r->mpi_root_owner[i] = r->mpi_id;
+        }
+        printf("MPI-node: %d. Process id: %d.\n",r->mpi_id, getpid());
+        return;
+    }
     // Make sure domain can be decomposed into equal number of root boxes per node.
     if ((r->root_n/r->mpi_num)*r->mpi_num != r->root_n){
         if (r->mpi_id==0) fprintf(stderr,"ERROR: Number of root boxes (%d) not a multiple of mpi nodes (%d).\n",r->root_n,r->mpi_num);
         exit(-1);
     }
+    // Initially, every node owns an equal number of consecutive root boxes.
+    for (int i=0;i<r->root_n;i++){
+        r->mpi_root_owner[i] = i/(r->root_n/r->mpi_num);
+    }
     printf("MPI-node: %d. Process id: %d.\n",r->mpi_id, getpid());
 }
 
 void reb_mpi_finalize(struct reb_simulation* const r){
+    free(r->mpi_root_owner);
+    r->mpi_root_owner = NULL;
     r->mpi_id = 0;
     r->mpi_num = 0;
     MPI_Finalize();
@@ -298,30 +515,52 @@ void reb_free_simulation(struct reb_simulation* const r){
     free(r);
 }
 
+void reb_free_buffer(void* const buf){
+    free(buf);
+}
+
 void reb_free_pointers(struct reb_simulation* const r){
+    reb_simulationarchive_writer_free(r);
+    reb_simulationarchive_cache_free(r);
+    reb_recorder_disable(r);
     free(r->simulationarchive_filename);
+    free(r->simulationarchive_checkpoint_filename);
     reb_tree_delete(r);
     if(r->display_data){
-        pthread_mutex_destroy(&(r->display_data->mutex));
-        free(r->display_data->r_copy);
-        free(r->display_data->particles_copy);
-        free(r->display_data->p_jh_copy);
+        for (int i=0;i<3;i++){
+            reb_free(r->display_data->buffers[i].particles);
+            reb_free(r->display_data->buffers[i].p_jh);
+        }
         free(r->display_data->particle_data);
         free(r->display_data->orbit_data);
+        free(r->display_data->frame);
         free(r->display_data); // TODO: Free other pointers in display_data
     }
     free(r->gravity_cs  );
+    free(r->profiling);
+    if (r->trace){
+        free(r->trace->events);
+        free(r->trace);
+    }
+    reb_particles_soa_free(&(r->particles_soa));
+    free(r->gravity_omp_a);
+    free(r->gravity_var_pairs);
+    free(r->gravity_ghostboxes);
+    reb_gravity_fft_free(r);
     free(r->collisions  );
+    free(r->collision_sweep_order);
+    reb_collision_verlet_free(r);
     reb_integrator_whfast_reset(r);
     reb_integrator_ias15_reset(r);
     reb_integrator_mercurius_reset(r);
     reb_integrator_bs_reset(r);
+    reb_integrator_hermite_reset(r);
     if(r->free_particle_ap){
         for(int i=0; i<r->N; i++){
             r->free_particle_ap(&r->particles[i]);
         }
     }
-    free(r->particles   );
+    reb_free(r->particles);
     free(r->particle_lookup_table);
     if (r->messages){
         for (int i=0;i<reb_max_messages_N;i++){
@@ -333,6 +572,9 @@ void reb_free_pointers(struct reb_simulation* const r){
         r->extras_cleanup(r);
     }
     free(r->var_config);
+    free(r->interaction_groups);
+    free(r->forces);
+    reb_remove_reductions(r);
     for (int s=0; s<r->odes_N; s++){
         r->odes[s]->r = NULL;
     }
@@ -342,8 +584,28 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     // Note: this will not clear the particle array.
     r->gravity_cs_allocatedN    = 0;
     r->gravity_cs           = NULL;
+    r->particles_soa        = (struct reb_particles_soa){0};
+    r->reductions           = NULL;
+    r->reductions_N         = 0;
+    r->reductions_allocatedN = 0;
+    r->gravity_omp_a_allocatedN = 0;
+    r->gravity_omp_a        = NULL;
+    r->gravity_var_pairs_allocatedN = 0;
+    r->gravity_var_pairs    = NULL;
+    r->gravity_ghostboxes_allocatedN = 0;
+    r->gravity_ghostboxes   = NULL;
+    r->gravity_fft          = NULL;
+    r->profiling            = NULL;
+    r->trace                = NULL;
+    r->recorder             = NULL;
     r->collisions_allocatedN    = 0;
     r->collisions           = NULL;
+    r->collision_sweep_order = NULL;
+    r->collision_sweep_N    = 0;
+    r->collision_verlet     = NULL;
+    r->tree_lists           = NULL;
+    r->simulationarchive_writer = NULL;
+    r->simulationarchive_cache = NULL;
     r->extras               = NULL;
     r->messages             = NULL;
     // ********** Lookup Table
@@ -355,7 +617,14 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     r->ri_whfast.allocated_Ntemp= 0;
     r->ri_whfast.p_jh           = NULL;
     r->ri_whfast.p_temp         = NULL;
+    r->ri_whfast.allocated_N_kepler = 0;
+    r->ri_whfast.kepler_X_correction = NULL;
+    r->ri_whfast.allocated_Nbackup = 0;
+    r->ri_whfast.p_backup       = NULL;
+    r->ri_whfast.N_backup       = -1;
+    r->ri_whfast.output_is_synchronized = 0;
     r->ri_whfast.keep_unsynchronized = 0;
+    r->ri_whfast.kepler_warm_start = 0;
     // ********** IAS15
     r->ri_ias15.allocatedN      = 0;
     set_dp7_null(&(r->ri_ias15.g));
@@ -374,6 +643,13 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     r->ri_ias15.at          = NULL;
     r->ri_ias15.map_allocated_N      = 0;
     r->ri_ias15.map         = NULL;
+    r->ri_ias15.gravity_cache_allocatedN = 0;
+    r->ri_ias15.gravity_cache_x = NULL;
+    r->ri_ias15.gravity_cache_a = NULL;
+    r->ri_ias15.dense_N = 0;
+    r->ri_ias15.dense_allocatedN = 0;
+    r->ri_ias15.dense_x0 = NULL;
+    r->ri_ias15.dense_v0 = NULL;
     // ********** MERCURIUS
     r->ri_mercurius.allocatedN = 0;
     r->ri_mercurius.allocatedN_additionalforces = 0;
@@ -382,6 +658,7 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     r->ri_mercurius.particles_backup = NULL;
     r->ri_mercurius.particles_backup_additionalforces = NULL;
     r->ri_mercurius.encounter_map = NULL;
+    r->ri_mercurius.encounter_group = NULL;
     // ********** JANUS
     r->ri_janus.allocated_N = 0;
     r->ri_janus.p_int = NULL;
@@ -389,6 +666,14 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     r->ri_janus.order = 6;
     r->ri_janus.scale_pos = 1e-16;
     r->ri_janus.scale_vel = 1e-16;
+    // ********** HERMITE
+    r->ri_hermite.allocated_N = 0;
+    r->ri_hermite.p_pred = NULL;
+    r->ri_hermite.jerk = NULL;
+    r->ri_hermite.jerk_pred = NULL;
+    r->ri_hermite.level = NULL;
+    r->ri_hermite.t = NULL;
+    r->ri_hermite.active = NULL;
     // ********** ODEs
     r->odes = NULL;
     r->odes_N = 0;
@@ -405,7 +690,8 @@ int reb_reset_function_pointers(struct reb_simulation* const r){
         r->pre_timestep_modifications ||
         r->post_timestep_modifications ||
         r->free_particle_ap ||
-        r->extras_cleanup){
+        r->extras_cleanup ||
+        r->forces){
       wasnotnull = 1;
     }
     r->coefficient_of_restitution   = NULL;
@@ -417,6 +703,10 @@ int reb_reset_function_pointers(struct reb_simulation* const r){
     r->post_timestep_modifications  = NULL;
     r->free_particle_ap = NULL;
     r->extras_cleanup = NULL;
+    // Registered forces contain function pointers. The array belongs to the original simulation.
+    r->forces = NULL;
+    r->forces_N = 0;
+    r->forces_allocatedN = 0;
     return wasnotnull;
 }
 
@@ -435,6 +725,7 @@ void _reb_copy_simulation_with_messages(struct reb_simulation* r_copy,  struct r
     reb_reset_temporary_pointers(r_copy);
     reb_reset_function_pointers(r_copy);
     r_copy->simulationarchive_filename = NULL;
+    r_copy->simulationarchive_checkpoint_filename = NULL;
     
     // Set to old version by default. Will be overwritten if new version was used.
     r_copy->simulationarchive_version = 0;
@@ -442,7 +733,132 @@ void _reb_copy_simulation_with_messages(struct reb_simulation* r_copy,  struct r
     char* bufp_beginning = bufp; // bufp will be changed
     while(reb_input_field(r_copy, NULL, warnings, &bufp)){ }
     free(bufp_beginning);
-    
+
+}
+
+// Returns a newly allocated copy of the array src or NULL if there is nothing to copy.
+static void* reb_copy_array(const void* const src, const size_t size){
+    if (src==NULL || size==0){
+        return NULL;
+    }
+    void* dst = malloc(size);
+    memcpy(dst, src, size);
+    return dst;
+}
+
+static void reb_copy_dp7(struct reb_dp7* const dst, const struct reb_dp7* const src, const int N3){
+    dst->p0 = reb_malloc_copy(src->p0, sizeof(double)*N3);
+    dst->p1 = reb_malloc_copy(src->p1, sizeof(double)*N3);
+    dst->p2 = reb_malloc_copy(src->p2, sizeof(double)*N3);
+    dst->p3 = reb_malloc_copy(src->p3, sizeof(double)*N3);
+    dst->p4 = reb_malloc_copy(src->p4, sizeof(double)*N3);
+    dst->p5 = reb_malloc_copy(src->p5, sizeof(double)*N3);
+    dst->p6 = reb_malloc_copy(src->p6, sizeof(double)*N3);
+}
+
+void reb_copy_simulation_into(struct reb_simulation* r_copy, const struct reb_simulation* r){
+    // Copies the same state as _reb_copy_simulation_with_messages() but
+    // without serializing the simulation. r is not modified.
+    reb_free_pointers(r_copy);
+    memcpy(r_copy, r, sizeof(struct reb_simulation));
+
+    // Temporary arrays are not copied and will be reallocated when needed.
+    reb_reset_temporary_pointers(r_copy);
+    reb_reset_function_pointers(r_copy);
+    // Settings which are overwritten by reb_reset_temporary_pointers()
+    r_copy->ri_whfast.keep_unsynchronized = r->ri_whfast.keep_unsynchronized;
+    r_copy->ri_janus.order = r->ri_janus.order;
+    r_copy->ri_janus.scale_pos = r->ri_janus.scale_pos;
+    r_copy->ri_janus.scale_vel = r->ri_janus.scale_vel;
+    r_copy->ri_janus.recalculate_integer_coordinates_this_timestep = r->ri_janus.recalculate_integer_coordinates_this_timestep;
+    r_copy->ri_mercurius.L = NULL;
+    r_copy->ri_mercurius.mode = 0;
+    r_copy->ri_mercurius.encounterN = 0;
+    r_copy->ri_mercurius.encounterNactive = 0;
+    r_copy->ri_bs.nbody_ode = NULL;
+    r_copy->ri_bs.sequence = NULL;
+    r_copy->ri_bs.costPerStep = NULL;
+    r_copy->ri_bs.costPerTimeUnit = NULL;
+    r_copy->ri_bs.optimalStep = NULL;
+    r_copy->ri_bs.coeff = NULL;
+    r_copy->tree_root = NULL;
+    r_copy->tree_pool_blocks = NULL;
+    r_copy->tree_pool_N_blocks = 0;
+    r_copy->tree_pool_block = 0;
+    r_copy->tree_pool_N_used = 0;
+    r_copy->tree_pool_free = NULL;
+    r_copy->tree_sort_buffer = NULL;
+    r_copy->tree_sort_allocatedN = 0;
+    r_copy->display_data = NULL;
+    r_copy->simulationarchive_filename = NULL;
+    r_copy->simulationarchive_checkpoint_filename = NULL;
+#ifdef MPI
+    r_copy->particles_send = NULL;
+    r_copy->particles_send_N = 0;
+    r_copy->particles_send_Nmax = 0;
+    r_copy->particles_recv = NULL;
+    r_copy->particles_recv_N = 0;
+    r_copy->particles_recv_Nmax = 0;
+    r_copy->tree_essential_send = NULL;
+    r_copy->tree_essential_send_N = 0;
+    r_copy->tree_essential_send_Nmax = 0;
+    r_copy->tree_essential_recv = NULL;
+    r_copy->tree_essential_recv_N = 0;
+    r_copy->tree_essential_recv_Nmax = 0;
+    r_copy->particles_recv_buffer = NULL;
+    r_copy->tree_essential_recv_buffer = NULL;
+    r_copy->mpi_send_buffer = NULL;
+    r_copy->mpi_send_buffer_Nmax = 0;
+    r_copy->mpi_requests = NULL;
+    r_copy->mpi_requests_pending = NULL;
+    r_copy->mpi_root_owner = NULL;
+#endif // MPI
+
+    // Arrays owned by the simulation
+    r_copy->allocatedN = r->N;
+    r_copy->particles = reb_malloc_copy(r->particles, sizeof(struct reb_particle)*r->N);
+    for (int l=0;l<r_copy->N;l++){
+        r_copy->particles[l].c = NULL;
+        r_copy->particles[l].ap = NULL;
+        r_copy->particles[l].sim = r_copy;
+    }
+    r_copy->var_config = reb_copy_array(r->var_config, sizeof(struct reb_variational_configuration)*r->var_config_N);
+    if (r_copy->var_config){
+        for (int l=0;l<r_copy->var_config_N;l++){
+            r_copy->var_config[l].sim = r_copy;
+        }
+    }
+    r_copy->interaction_groups = reb_copy_array(r->interaction_groups, sizeof(uint64_t)*r->N_interaction_groups);
+    r_copy->ri_whfast.p_jh = reb_malloc_copy(r->ri_whfast.p_jh, sizeof(struct reb_particle)*r->ri_whfast.allocated_N);
+    r_copy->ri_whfast.allocated_N = r_copy->ri_whfast.p_jh?r->ri_whfast.allocated_N:0;
+    r_copy->ri_whfast.kepler_X_correction = reb_copy_array(r->ri_whfast.kepler_X_correction, sizeof(double)*r->ri_whfast.allocated_N_kepler);
+    r_copy->ri_whfast.allocated_N_kepler = r_copy->ri_whfast.kepler_X_correction?r->ri_whfast.allocated_N_kepler:0;
+    r_copy->ri_janus.p_int = reb_copy_array(r->ri_janus.p_int, sizeof(struct reb_particle_int)*r->ri_janus.allocated_N);
+    r_copy->ri_janus.allocated_N = r_copy->ri_janus.p_int?r->ri_janus.allocated_N:0;
+    r_copy->ri_mercurius.dcrit = reb_copy_array(r->ri_mercurius.dcrit, sizeof(double)*r->ri_mercurius.dcrit_allocatedN);
+    r_copy->ri_mercurius.dcrit_allocatedN = r_copy->ri_mercurius.dcrit?r->ri_mercurius.dcrit_allocatedN:0;
+    if (r->ri_ias15.allocatedN){
+        const int N3 = r->ri_ias15.allocatedN;
+        r_copy->ri_ias15.allocatedN = N3;
+        r_copy->ri_ias15.at   = reb_malloc_copy(r->ri_ias15.at,   sizeof(double)*N3);
+        r_copy->ri_ias15.x0   = reb_malloc_copy(r->ri_ias15.x0,   sizeof(double)*N3);
+        r_copy->ri_ias15.v0   = reb_malloc_copy(r->ri_ias15.v0,   sizeof(double)*N3);
+        r_copy->ri_ias15.a0   = reb_malloc_copy(r->ri_ias15.a0,   sizeof(double)*N3);
+        r_copy->ri_ias15.csx  = reb_malloc_copy(r->ri_ias15.csx,  sizeof(double)*N3);
+        r_copy->ri_ias15.csv  = reb_malloc_copy(r->ri_ias15.csv,  sizeof(double)*N3);
+        r_copy->ri_ias15.csa0 = reb_malloc_copy(r->ri_ias15.csa0, sizeof(double)*N3);
+        reb_copy_dp7(&r_copy->ri_ias15.g,   &r->ri_ias15.g,   N3);
+        reb_copy_dp7(&r_copy->ri_ias15.b,   &r->ri_ias15.b,   N3);
+        reb_copy_dp7(&r_copy->ri_ias15.csb, &r->ri_ias15.csb, N3);
+        reb_copy_dp7(&r_copy->ri_ias15.e,   &r->ri_ias15.e,   N3);
+        reb_copy_dp7(&r_copy->ri_ias15.br,  &r->ri_ias15.br,  N3);
+        reb_copy_dp7(&r_copy->ri_ias15.er,  &r->ri_ias15.er,  N3);
+    }
+    if (r_copy->gravity==REB_GRAVITY_TREE || r_copy->gravity==REB_GRAVITY_FMM || r_copy->collision==REB_COLLISION_TREE || r_copy->collision==REB_COLLISION_LINETREE){
+        for (int l=0;l<r_copy->N;l++){
+            reb_tree_add_particle_to_tree(r_copy, l);
+        }
+    }
 }
 
 int reb_diff_simulations(struct reb_simulation* r1, struct reb_simulation* r2, int output_option){
@@ -465,9 +881,7 @@ int reb_diff_simulations(struct reb_simulation* r1, struct reb_simulation* r2, i
 
 struct reb_simulation* reb_copy_simulation(struct reb_simulation* r){
     struct reb_simulation* r_copy = reb_create_simulation();
-    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
-    _reb_copy_simulation_with_messages(r_copy,r,&warnings);
-    r = reb_input_process_warnings(r, warnings);
+    reb_copy_simulation_into(r_copy, r);
     return r_copy;
 }
 
@@ -487,6 +901,7 @@ void reb_init_simulation(struct reb_simulation* r){
     r->dt       = 0.001;
     r->dt_last_done = 0.;
     r->steps_done = 0;
+    r->heartbeat_steps = 0;
     r->root_size    = -1;
     r->root_nx  = 1;
     r->root_ny  = 1;
@@ -507,7 +922,10 @@ void reb_init_simulation(struct reb_simulation* r){
     r->N_var    = 0;    
     r->var_config_N = 0;    
     r->var_config   = NULL;     
+    r->N_interaction_groups = 0;
+    r->interaction_groups = NULL;
     r->exit_min_distance    = 0;    
+    r->exit_encounter       = (struct reb_encounter){.p1 = -1, .p2 = -1};
     r->exit_max_distance    = 0;    
     r->max_radius[0]    = 0.;   
     r->max_radius[1]    = 0.;   
@@ -515,12 +933,29 @@ void reb_init_simulation(struct reb_simulation* r){
     r->exact_finish_time    = 1;
     r->force_is_velocity_dependent = 0;
     r->gravity_ignore_terms    = 0;
+    r->gravity_tile_size       = 256;
+    r->gravity_ghostbox_tolerance = 0.;
+    r->fmm_order               = 2;
+    r->tree_group_size         = 0;
+    r->tree_list_interval      = 0;
+    r->tree_list_margin        = 0.;
+    r->auto_select_interval    = 0;
+    r->auto_select_opening_angle2 = 0.;
+#ifdef QUADRUPOLE
+    r->tree_order              = 1;
+#else // QUADRUPOLE
+    r->tree_order              = 0;
+#endif // QUADRUPOLE
+    r->gravity_fft_nx          = 64;
+    r->gravity_fft_ny          = 64;
     r->calculate_megno  = 0;
     r->output_timing_last   = -1;
     r->save_messages = 0;
     r->track_energy_offset = 0;
     r->display_data = NULL;
     r->walltime = 0;
+    r->integrate_resumable = 0;
+    r->counters = (struct reb_counters){0};
 
     r->minimum_collision_velocity = 0;
     r->collisions_plog  = 0;
@@ -536,6 +971,7 @@ void reb_init_simulation(struct reb_simulation* r){
     r->simulationarchive_next          = 0.;    
     r->simulationarchive_next_step     = 0;    
     r->simulationarchive_filename      = NULL;    
+    r->simulationarchive_checkpoint_filename = NULL;
     
     // Default modules
 #ifdef OPENGL
@@ -572,6 +1008,7 @@ void reb_init_simulation(struct reb_simulation* r){
     r->ri_ias15.epsilon         = 1e-9;
     r->ri_ias15.min_dt      = 0;
     r->ri_ias15.epsilon_global  = 1;
+    r->ri_ias15.reuse_gravity   = 1;
     r->ri_ias15.iterations_max_exceeded = 0;    
     
     // ********** SEI
@@ -595,13 +1032,28 @@ void reb_init_simulation(struct reb_simulation* r){
     r->ri_eos.safe_mode = 1;
     r->ri_eos.is_synchronized = 1;
     
+    // ********** LEAPFROG
+    r->ri_leapfrog.safe_mode = 1;
+    r->ri_leapfrog.is_synchronized = 1;
+    
     
     // ********** NS
     reb_integrator_bs_reset(r);
 
+    // ********** HERMITE
+    reb_integrator_hermite_reset(r);
+
     // Tree parameters. Will not be used unless gravity or collision search makes use of tree.
     r->tree_needs_update= 0;
     r->tree_root        = NULL;
+    r->tree_pool_blocks = NULL;
+    r->tree_pool_N_blocks = 0;
+    r->tree_pool_block  = 0;
+    r->tree_pool_N_used = 0;
+    r->tree_pool_free   = NULL;
+    r->tree_sort        = 0;
+    r->tree_sort_buffer = NULL;
+    r->tree_sort_allocatedN = 0;
     r->opening_angle2   = 0.25;
 
 #ifdef MPI
@@ -620,6 +1072,16 @@ void reb_init_simulation(struct reb_simulation* r){
     r->tree_essential_recv = NULL;
     r->tree_essential_recv_N = 0;             
     r->tree_essential_recv_Nmax = 0;          
+    r->particles_recv_buffer = NULL;
+    r->tree_essential_recv_buffer = NULL;
+    r->mpi_send_buffer = NULL;
+    r->mpi_send_buffer_Nmax = 0;
+    r->mpi_pipeline = 0;
+    r->mpi_root_owner = NULL;
+    r->mpi_load_balance_interval = 0;
+    r->mpi_direct = 0;
+    r->mpi_requests = NULL;
+    r->mpi_requests_pending = NULL;
 
 #else // MPI
 #ifndef LIBREBOUND
@@ -680,7 +1142,17 @@ int reb_check_exit(struct reb_simulation* const r, const double tmax, double* la
             }
         }
     }
-#ifndef MPI
+#ifdef MPI
+    if (r->mpi_root_owner){
+        // Particles are distributed. All nodes exit together.
+        int status_max = 0;
+        MPI_Allreduce(&(r->status), &status_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD); 
+        if (status_max>=0){
+            r->status = status_max;
+        }
+        return r->status;
+    }
+#endif // MPI
     if (!r->N){
         if (!r->odes_N){
             reb_warning(r,"No particles found. Will exit.");
@@ -692,20 +1164,18 @@ int reb_check_exit(struct reb_simulation* const r, const double tmax, double* la
             }
         }
     }
-#else
-    int status_max = 0;
-    MPI_Allreduce(&(r->status), &status_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD); 
-    if (status_max>=0){
-        r->status = status_max;
-    }
-
-#endif // MPI
     return r->status;
 }
 
 
 void reb_run_heartbeat(struct reb_simulation* const r){
-    if (r->heartbeat){ r->heartbeat(r); }               // Heartbeat
+    if (r->heartbeat){                                  // Heartbeat
+        if (r->heartbeat_steps<=1 || r->steps_done%r->heartbeat_steps==0){
+            TRACE_BEGIN(r, REB_TRACE_PHASE_HEARTBEAT)
+            r->heartbeat(r);
+            TRACE_END(r, REB_TRACE_PHASE_HEARTBEAT)
+        }
+    }
     if (r->display_heartbeat){ reb_check_for_display_heartbeat(r); } 
     if (r->exit_max_distance){
         // Check for escaping particles
@@ -722,23 +1192,13 @@ void reb_run_heartbeat(struct reb_simulation* const r){
     }
     if (r->exit_min_distance){
         // Check for close encounters
-        const double min2 = r->exit_min_distance * r->exit_min_distance;
-        const struct reb_particle* const particles = r->particles;
-        const int N = r->N - r->N_var;
-        for (int i=0;i<N;i++){
-            struct reb_particle pi = particles[i];
-            for (int j=0;j<i;j++){
-                struct reb_particle pj = particles[j];
-                const double x = pi.x-pj.x;
-                const double y = pi.y-pj.y;
-                const double z = pi.z-pj.z;
-                const double r2 = x*x + y*y + z*z;
-                if (r2<min2){
-                    r->status = REB_EXIT_ENCOUNTER;
-                }
-            }
+        if (reb_collision_search_min_distance(r, r->exit_min_distance, &r->exit_encounter)){
+            r->status = REB_EXIT_ENCOUNTER;
         }
     }
+    if (r->recorder){
+        reb_recorder_heartbeat(r);
+    }
     if (r->usleep > 0){
         usleep(r->usleep);
     }
@@ -761,15 +1221,22 @@ void reb_sigint_handler(int signum) {
     }
 }
 
-static void* reb_integrate_raw(void* args){
+// Prepares the simulation for an integration. Returns the timestep 
+// which is restored at the end of the integration.
+static double reb_integrate_begin(struct reb_simulation* const r){
     reb_sigint = 0;
     signal(SIGINT, reb_sigint_handler);
-    struct reb_thread_info* thread_info = (struct reb_thread_info*)args;
-	struct reb_simulation* const r = thread_info->r;
 #ifdef MPI
     // Distribute particles
-    reb_communication_mpi_distribute_particles(r);
+    if (r->mpi_root_owner && !r->mpi_direct){
+        reb_communication_mpi_distribute_particles(r);
+    }
 #endif // MPI
+    if (r->integrate_resumable && r->status==REB_RUNNING_LAST_STEP){
+        // A budgeted integration was not resumed after the timestep had been shrunk.
+        r->dt = r->integrate_last_full_dt;
+    }
+    r->integrate_resumable = 0;
 
     double last_full_dt = r->dt; // need to store r->dt in case timestep gets artificially shrunk to meet exact_finish_time=1
     r->dt_last_done = 0.; // Reset in case first timestep attempt will fail
@@ -780,34 +1247,50 @@ static void* reb_integrate_raw(void* args){
 
     r->status = REB_RUNNING;
     reb_run_heartbeat(r);
-    while(reb_check_exit(r,thread_info->tmax,&last_full_dt)<0){
-#ifdef OPENGL
-        if (r->display_data){
-            if (r->display_data->opengl_enabled){ pthread_mutex_lock(&(r->display_data->mutex)); }
-        }
-#endif // OPENGL
-        if (r->simulationarchive_filename){ reb_simulationarchive_heartbeat(r);}
-        reb_step(r); 
-        reb_run_heartbeat(r);
-        if (reb_sigint== 1){
-            r->status = REB_EXIT_SIGINT;
-        }
+    return last_full_dt;
+}
+
+// Takes at most max_steps steps towards tmax and runs the heartbeats.
+static void reb_integrate_iteration(struct reb_simulation* const r, const double tmax, const unsigned int max_steps){
+    if (r->simulationarchive_filename || r->simulationarchive_checkpoint_filename){ reb_simulationarchive_heartbeat(r);}
+    reb_step_batch_max(r, tmax, max_steps); 
+    reb_run_heartbeat(r);
+    if (reb_sigint== 1){
+        r->status = REB_EXIT_SIGINT;
+    }
 #ifdef OPENGL
-        if (r->display_data){
-            if (r->display_data->opengl_enabled){ pthread_mutex_unlock(&(r->display_data->mutex)); }
-        }
-#endif // OPENGL
+    if (r->display_data && r->display_data->opengl_enabled){
+        // Hand a snapshot to the display thread (at most once per frame).
+        reb_display_publish_data(r, 0);
     }
+#endif // OPENGL
+}
 
+static void reb_integrate_finish(struct reb_simulation* const r, const double last_full_dt){
     reb_integrator_synchronize(r);
+#ifdef OPENGL
+    if (r->display_data && r->display_data->opengl_enabled){
+        reb_display_publish_data(r, 1);
+    }
+#endif // OPENGL
     if (r->display_heartbeat){                          // Display Heartbeat
         r->display_heartbeat(r); 
     }
     if(r->exact_finish_time==1){ // if finish_time = 1, r->dt could have been shrunk, so set to the last full timestep
         r->dt = last_full_dt; 
     }
-    if (r->simulationarchive_filename){ reb_simulationarchive_heartbeat(r);}
+    if (r->simulationarchive_filename || r->simulationarchive_checkpoint_filename){ reb_simulationarchive_heartbeat(r);}
+    reb_simulationarchive_writer_flush(r);
+}
 
+static void* reb_integrate_raw(void* args){
+    struct reb_thread_info* thread_info = (struct reb_thread_info*)args;
+	struct reb_simulation* const r = thread_info->r;
+    double last_full_dt = reb_integrate_begin(r);
+    while(reb_check_exit(r,thread_info->tmax,&last_full_dt)<0){
+        reb_integrate_iteration(r, thread_info->tmax, REB_STEP_BATCH_MAX);
+    }
+    reb_integrate_finish(r, last_full_dt);
     return NULL;
 }
 
@@ -857,11 +1340,82 @@ enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tmax){
     return r->status;
 }
 
-  
+// The integration is resumed if the previous call with the same tmax 
+// ran out of budget. The particles are not synchronized when the 
+// budget runs out. This way, the results do not depend on the budget.
+enum REB_STATUS reb_integrate_budget(struct reb_simulation* const r, double tmax, double max_walltime, unsigned long max_steps){
+    if (r->visualization==REB_VISUALIZATION_OPENGL){
+        reb_error(r,"reb_integrate_budget() does not support the OpenGL visualization. Use reb_integrate() instead.");
+        return REB_EXIT_ERROR; 
+    }
+    const double time_beginning = reb_profiling_clock();
+    if (!r->integrate_resumable || r->integrate_tmax!=tmax || r->status>=0){
+        if (r->visualization==REB_VISUALIZATION_WEBGL){
+            reb_display_init_data(r);
+        }else if (r->display_data){
+            r->display_data->opengl_enabled = 0;
+        }
+        r->integrate_last_full_dt = reb_integrate_begin(r);
+        r->integrate_tmax = tmax;
+    }
+    r->integrate_resumable = 0;
+    const unsigned long long steps_beginning = r->steps_done;
+    while(reb_check_exit(r,tmax,&r->integrate_last_full_dt)<0){
+        unsigned int batch = REB_STEP_BATCH_MAX;
+        if (max_steps){
+            const unsigned long long steps = r->steps_done - steps_beginning;
+            if (steps>=max_steps){
+                r->integrate_resumable = 1;
+                return r->status;
+            }
+            if (max_steps-steps<batch){
+                batch = max_steps-steps;
+            }
+        }
+        if (max_walltime>0. && reb_profiling_clock()-time_beginning>=max_walltime){
+            r->integrate_resumable = 1;
+            return r->status;
+        }
+        reb_integrate_iteration(r, tmax, batch);
+    }
+    reb_integrate_finish(r, r->integrate_last_full_dt);
+    return r->status;
+}
+
 #ifdef OPENMP
+int reb_omp_min_N = 0;
+
 void reb_omp_set_num_threads(int num_threads){
     omp_set_num_threads(num_threads);
 }
+
+void reb_omp_set_min_N(int N){
+    reb_omp_min_N = N;
+}
+
+int reb_omp_pin_threads(const int* const cpus, const int N_cpus){
+#ifdef __linux__
+    if (cpus!=NULL && N_cpus<1){
+        return -1;
+    }
+    int error = 0;
+    // The OpenMP runtime reuses its threads for later parallel regions with 
+    // the same number of threads, so they stay pinned.
+#pragma omp parallel reduction(|:error)
+    {
+        const int t = omp_get_thread_num();
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus?cpus[t%N_cpus]:t, &set);
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &set)){
+            error = 1;
+        }
+    }
+    return error?-1:0;
+#else // __linux__
+    return -1;
+#endif // __linux__
+}
 #endif // OPENMP
 
 const char* reb_logo[26] = {
@@ -47,11 +47,18 @@ extern const char* reb_version_str; ///< Version string.
 extern const char* reb_githash_str; ///< Current git hash.
 extern const char* reb_logo[26];    ///< Logo of rebound. 
 extern volatile sig_atomic_t reb_sigint;  ///< Graceful global interrupt handler 
+void reb_sigint_handler(int signum);       ///< Sets reb_sigint when SIGINT is received.
 
 // Forward declarations
 struct reb_simulation;
 struct reb_display_data;
 struct reb_treecell;
+struct reb_gravity_fft;
+struct reb_collision_verlet;
+struct reb_tree_lists;
+struct reb_simulationarchive_writer;
+struct reb_simulationarchive_cache;
+struct reb_recorder;
 struct reb_variational_configuration;
 
 struct reb_particle {
@@ -69,6 +76,7 @@ struct reb_particle {
     double lastcollision;       // Last time the particle had a physical collision.
     struct reb_treecell* c;     // Pointer to the cell the particle is currently in.
     uint32_t hash;              // Hash, can be used to identify particle.
+    uint32_t group;             // Interaction group (see reb_set_interaction_groups()). Default: 0.
     void* ap;                   // This pointer allows REBOUNDx to add additional properties to the particle.
     struct reb_simulation* sim; // Pointer to the parent simulation.
 };
@@ -80,6 +88,16 @@ struct reb_vec3d {
     double z;
 };
 
+// Position and velocity of a particle, for internal use only (compact backups in MERCURIUS).
+struct reb_vec6d {
+    double x;
+    double y;
+    double z;
+    double vx;
+    double vy;
+    double vz;
+};
+
 // Generic pointer with 7 elements, for internal use only (IAS15).
 struct reb_dp7 {
     double* REBOUND_RESTRICT p0;
@@ -91,6 +109,74 @@ struct reb_dp7 {
     double* REBOUND_RESTRICT p6;
 };
 
+// Structure-of-arrays copy of particle data, for internal use only (vectorized kernels).
+struct reb_particles_soa {
+    double* REBOUND_RESTRICT x;
+    double* REBOUND_RESTRICT y;
+    double* REBOUND_RESTRICT z;
+    double* REBOUND_RESTRICT vx;
+    double* REBOUND_RESTRICT vy;
+    double* REBOUND_RESTRICT vz;
+    double* REBOUND_RESTRICT m;
+    double* REBOUND_RESTRICT ax;
+    double* REBOUND_RESTRICT ay;
+    double* REBOUND_RESTRICT az;
+    int N;              // Number of particles currently stored
+    int allocatedN;     // Number of particles the arrays have space for
+    int device_N;       // Number of particles allocated on the offload device (GPU builds only, 0 if not allocated)
+};
+
+// Force registered with reb_add_force(). The function force is called with the particles 
+// i=istart,...,iend-1 of a chunk and adds accelerations to soa->ax[i], soa->ay[i], soa->az[i]. 
+// Positions, velocities and masses of all particles can be read from soa. The function 
+// may be called in parallel for different chunks and must not modify any other data.
+struct reb_force {
+    void (*force)(struct reb_simulation* const r, const struct reb_force* const f, struct reb_particles_soa* const soa, const int istart, const int iend);
+    int istart;                         // First particle the force acts on
+    int iend;                           // One past the last particle the force acts on (-1 for all particles)
+    unsigned int velocity_dependent;    // 1 if the force depends on the velocities
+    void* data;                         // User data, e.g. parameters of the force
+};
+
+// Particle quantities which can be reduced with reb_add_reduction().
+enum REB_REDUCTION_FIELD {
+    REB_REDUCTION_ONE = 0,              // 1 for every particle (counts particles)
+    REB_REDUCTION_X = 1,
+    REB_REDUCTION_Y = 2,
+    REB_REDUCTION_Z = 3,
+    REB_REDUCTION_VX = 4,
+    REB_REDUCTION_VY = 5,
+    REB_REDUCTION_VZ = 6,
+    REB_REDUCTION_M = 7,
+    REB_REDUCTION_R = 8,                // Particle radius
+    REB_REDUCTION_RXY = 9,              // Cylindrical radius sqrt(x^2+y^2)
+    REB_REDUCTION_VY_SHEAR = 10,        // vy relative to the shear (vy+1.5*OMEGA*x with SEI, vy otherwise)
+    REB_REDUCTION_VX_VY_SHEAR = 11,     // vx times vy relative to the shear (translational viscosity)
+    REB_REDUCTION_AREA = 12,            // Cross section pi*r^2 (optical depth)
+    REB_REDUCTION_MIDPLANE_AREA = 13,   // Cross section with the midplane pi*(r^2-z^2) if positive (filling factor)
+};
+
+// Types of reductions.
+enum REB_REDUCTION_TYPE {
+    REB_REDUCTION_SUM = 0,          // values[0]: sum of field
+    REB_REDUCTION_MOMENTS = 1,      // values[0..2]: number of particles, mean and variance of field
+    REB_REDUCTION_HISTOGRAM = 2,    // values[j]: number of particles for which field is in bin j
+    REB_REDUCTION_PROFILE = 3,      // values[j]: sum of field over the particles for which bin_field is in bin j
+};
+
+// Reduction registered with reb_add_reduction(). All registered reductions are evaluated in 
+// a single pass over the particles by reb_calculate_reductions(). The results are in values.
+struct reb_reduction {
+    enum REB_REDUCTION_TYPE type;
+    enum REB_REDUCTION_FIELD field;
+    enum REB_REDUCTION_FIELD bin_field; // Only used for REB_REDUCTION_PROFILE
+    double min;                         // Bins are N_bins equal intervals between min and max. Particles outside are ignored.
+    double max;
+    int N_bins;
+    int N_values;                       // Length of values: 1 for sums, 3 for moments, N_bins otherwise
+    double* values;
+};
+
 struct reb_ghostbox{
     double shiftx;
     double shifty;
@@ -105,6 +191,7 @@ struct reb_simulation_integrator_ias15 {
     double epsilon;
     double min_dt;
     unsigned int epsilon_global;
+    unsigned int reuse_gravity; // If 1 (default), gravity is not recalculated in an iteration if the predicted positions are bitwise unchanged.
    
     // Internal use
     unsigned long iterations_max_exceeded; // Counter how many times the iteration did not converge. 
@@ -126,6 +213,17 @@ struct reb_simulation_integrator_ias15 {
 
     int* map;               // internal map to particles (this is an identity map except when MERCURIUS is used
     int map_allocated_N;    // allocated size for map
+
+    int gravity_cache_allocatedN;   // allocated size (3N) for the gravity cache
+    double* REBOUND_RESTRICT gravity_cache_x; // Predicted positions at the 7 substeps of the current step
+    double* REBOUND_RESTRICT gravity_cache_a; // Accelerations from gravity alone at these positions
+
+    int dense_N;                    // Number of particles in the last accepted step, 0 if no dense output is available
+    double dense_t0;                // Time at the beginning of the last accepted step
+    double dense_dt;                // Length of the last accepted step
+    int dense_allocatedN;           // allocated size (3N) for dense_x0 and dense_v0
+    double* REBOUND_RESTRICT dense_x0; // Positions at the beginning of the last accepted step
+    double* REBOUND_RESTRICT dense_v0; // Velocities at the beginning of the last accepted step
 };
 
 struct reb_simulation_integrator_mercurius {
@@ -145,9 +243,10 @@ struct reb_simulation_integrator_mercurius {
     unsigned int allocatedN_additionalforces;
     unsigned int dcrit_allocatedN;  // Current size of dcrit arrays
     double* dcrit;                  // Precalculated switching radii for particles
-    struct reb_particle* REBOUND_RESTRICT particles_backup; //  contains coordinates before Kepler step for encounter prediction
-    struct reb_particle* REBOUND_RESTRICT particles_backup_additionalforces; // contains coordinates before Kepler step for encounter prediction
+    struct reb_vec6d* REBOUND_RESTRICT particles_backup; //  contains coordinates before Kepler step for encounter prediction
+    struct reb_vec6d* REBOUND_RESTRICT particles_backup_additionalforces; // contains coordinates before the transformation to inertial coordinates for additional forces
     int* encounter_map;             // Map to represent which particles are integrated with ias15
+    int* encounter_group;           // Group of each particle having an encounter (smallest particle index in the group), 0 otherwise
     struct reb_vec3d com_pos;       // Used to keep track of the centre of mass during the timestep
     struct reb_vec3d com_vel;
 };
@@ -206,14 +305,22 @@ struct reb_simulation_integrator_whfast {
     unsigned int recalculate_coordinates_this_timestep;
     unsigned int safe_mode;
     unsigned int keep_unsynchronized;
+    unsigned int kepler_warm_start;                 // If 1, the Kepler solver corrects its initial guess using the previous solve of each particle. Default: 0.
     // Internal 
     struct reb_particle* REBOUND_RESTRICT p_jh;     // Jacobi/heliocentric/WHDS coordinates
     struct reb_particle* REBOUND_RESTRICT p_temp;   // Used for lazy implementer's kernel 
+    double* REBOUND_RESTRICT kepler_X_correction;   // Per particle warm start coefficient for the initial guess of the Kepler solver
+    unsigned int allocated_N_kepler;                // Allocated size of kepler_X_correction
     unsigned int is_synchronized;
     unsigned int allocated_N;
     unsigned int allocated_Ntemp;
     unsigned int timestep_warning;
     unsigned int recalculate_coordinates_but_not_synchronized_warning;
+    struct reb_particle* REBOUND_RESTRICT p_backup; // Copy of particles before pre/post_timestep_modifications. Used to find modified particles.
+    unsigned int allocated_Nbackup;
+    int N_backup;                                   // Number of particles in p_backup, -1 if there is no copy
+    int N_active_backup;
+    unsigned int output_is_synchronized;            // 1 if the particles contain the synchronized output of the current step (see reb_integrator_synchronize_output)
 };
 
 struct reb_ode{ // defines an ODE 
@@ -228,6 +335,8 @@ struct reb_ode{ // defines an ODE
     double* y0Dot;  // Temporary internal array (derivatives at beginning of step)
     double* yDot;   // Temporary internal array (derivatives)
     double* yTmp;   // Temporary internal array (midpoint method)
+    double** yTmps; // Temporary internal arrays (midpoint method, one per column, only used with parallel_columns)
+    double** yDots; // Temporary internal arrays (derivatives, one per column, only used with parallel_columns)
     void (*derivatives)(struct reb_ode* const ode, double* const yDot, const double* const y, const double t); // right hand side 
     void (*getscale)(struct reb_ode* const ode, const double* const y0, const double* const y1); // right hand side 
     struct reb_simulation* r; // weak reference to main simulation 
@@ -251,6 +360,8 @@ struct reb_simulation_integrator_bs {
     int previousRejected;
     int targetIter;
     int user_ode_needs_nbody; // Do not set manually. Use needs_nbody in reb_ode instead.
+    int parallel_columns; // Set to 1 to compute the columns of the extrapolation table concurrently (OpenMP). Only used if no ODE needs the particles and the N-body derivatives do not modify them.
+    int parallel_odes; // Set to 1 to evaluate the derivatives of ODE sets that do not need the particles concurrently (OpenMP).
 };
 
 enum REB_EOS_TYPE {
@@ -275,7 +386,11 @@ struct reb_simulation_integrator_eos {
 
 
 // Integer-based positions and velocities for particles. Used in JANUS integrator. 
+// A wider type such as __int128 can be chosen at compile time for a larger dynamic 
+// range. The python wrapper and binary files assume the default int64_t.
+#ifndef REB_PARTICLE_INT_TYPE
 #define REB_PARTICLE_INT_TYPE int64_t
+#endif // REB_PARTICLE_INT_TYPE
 struct reb_particle_int {
     REB_PARTICLE_INT_TYPE x;
     REB_PARTICLE_INT_TYPE y;
@@ -294,6 +409,26 @@ struct reb_simulation_integrator_janus {
     unsigned int allocated_N;
 };
 
+struct reb_simulation_integrator_leapfrog {
+    unsigned int safe_mode;         // If set to 0, the kick and closing drift of a step are combined with the opening drift of the next step. Default: 1
+    unsigned int is_synchronized;
+};
+
+struct reb_simulation_integrator_hermite {
+    double eta;             // Accuracy parameter of the Aarseth timestep criterion. Default: 0.02
+    double eta_start;       // Accuracy parameter for the first step of each particle within a timestep. Default: 0.01
+    unsigned long long particle_steps; // Number of individual particle steps (for diagnostics)
+    unsigned int level_warning;
+    unsigned int additional_forces_warning;
+    int allocated_N;
+    struct reb_particle* REBOUND_RESTRICT p_pred;   // Predicted positions and velocities, new accelerations
+    struct reb_vec3d* REBOUND_RESTRICT jerk;        // Jerk at the time of the last step of each particle
+    struct reb_vec3d* REBOUND_RESTRICT jerk_pred;   // Jerk at the predicted positions
+    int* level;             // The timestep of particle i is dt/2^level[i]
+    int64_t* t;             // Time of the last step of each particle, in units of the smallest possible timestep
+    int* active;            // Indices of particles advanced in the current block step
+};
+
 struct reb_collision{
     int p1;
     int p2;
@@ -301,6 +436,14 @@ struct reb_collision{
     int ri;
 };
 
+// Close encounter which caused REB_EXIT_ENCOUNTER (see exit_min_distance)
+struct reb_encounter {
+    int p1;                         // Index of the first particle. -1 if no encounter has been found.
+    int p2;                         // Index of the second particle
+    double t;                       // Time at which the distance first fell below exit_min_distance, assuming a linear path during the last timestep
+    double d;                       // Minimum distance during the last timestep, assuming a linear path
+};
+
 // Possible return values of of rebound_integrate
 enum REB_STATUS {
     REB_RUNNING_PAUSED = -3,    // Simulation is paused by visualization.
@@ -316,6 +459,109 @@ enum REB_STATUS {
     REB_EXIT_COLLISION = 7,     // The integration ends early because two particles collided. 
 };
 
+// Categories of the runtime profiler. Scopes can be nested; the self time of a category excludes time spent in nested scopes.
+enum REB_PROFILING_CAT {
+    REB_PROFILING_CAT_INTEGRATOR = 0,       // Integrator (drift, kick, coordinate transformations)
+    REB_PROFILING_CAT_BOUNDARY = 1,         // Boundary checks
+    REB_PROFILING_CAT_TREE = 2,             // Tree maintenance and MPI communication
+    REB_PROFILING_CAT_GRAVITY = 3,          // Gravity and additional forces
+    REB_PROFILING_CAT_COLLISION = 4,        // Collision search and resolution
+    REB_PROFILING_CAT_TREE_BUILD = 5,       // Updating and rebuilding the tree
+    REB_PROFILING_CAT_TREE_MOMENTS = 6,     // Centres of mass and multipole moments of tree cells
+    REB_PROFILING_CAT_GRAVITY_WALK = 7,     // Tree walk of REB_GRAVITY_TREE
+    REB_PROFILING_CAT_KEPLER = 8,           // Kepler steps of WHFast and MERCURIUS
+    REB_PROFILING_CAT_JUMP = 9,             // Jump steps of WHFast and MERCURIUS
+    REB_PROFILING_CAT_ENCOUNTER_PREDICT = 10,   // Close encounter prediction of MERCURIUS
+    REB_PROFILING_CAT_IAS15_ITERATIONS = 11,    // Predictor corrector loop of IAS15
+    REB_PROFILING_CAT_SIMULATIONARCHIVE = 12,   // Writing SimulationArchive snapshots
+    REB_PROFILING_CAT_NUM = 13,
+};
+
+#define REB_PROFILING_DEPTH_MAX 16  // Maximum nesting depth of profiling scopes. Deeper scopes are not timed.
+
+struct reb_profiling_scope {
+    double start;                   // Time when the scope was entered
+    double children;                // Time spent in nested scopes
+};
+
+// Timing data of the runtime profiler. Allocated by reb_profiling_enable().
+struct reb_profiling {
+    double time[REB_PROFILING_CAT_NUM];         // Total time in seconds spent in each category, including nested scopes
+    double time_self[REB_PROFILING_CAT_NUM];    // Time in seconds spent in each category, excluding nested scopes
+    uint64_t calls[REB_PROFILING_CAT_NUM];      // Number of times each category was entered
+    double time_start;                          // Time when profiling was enabled
+    int depth;                                  // Current nesting depth
+    int output_timing_lines;                    // Number of lines printed by the last call to reb_output_timing()
+    struct reb_profiling_scope stack[REB_PROFILING_DEPTH_MAX];
+};
+
+// Phases of a timestep recorded by the event tracer. See reb_trace_enable().
+enum REB_TRACE_PHASE {
+    REB_TRACE_PHASE_STEP = 0,               // Complete call to reb_step()
+    REB_TRACE_PHASE_PART1 = 1,              // First part of the integrator step, including pre_timestep_modifications
+    REB_TRACE_PHASE_BOUNDARY = 2,           // Boundary checks
+    REB_TRACE_PHASE_TREE = 3,               // Tree updates and moments
+    REB_TRACE_PHASE_MPI_EXCHANGE = 4,       // Distribution of particles and essential trees between MPI nodes, including waits
+    REB_TRACE_PHASE_GRAVITY = 5,            // Gravitational accelerations
+    REB_TRACE_PHASE_GRAVITY_WALK = 6,       // Tree walk of one OpenMP thread
+    REB_TRACE_PHASE_ADDITIONAL_FORCES = 7,  // Call to additional_forces
+    REB_TRACE_PHASE_PART2 = 8,              // Second part of the integrator step, including post_timestep_modifications
+    REB_TRACE_PHASE_COLLISION_SEARCH = 9,   // Collision search
+    REB_TRACE_PHASE_COLLISION_RESOLVE = 10, // Collision resolution
+    REB_TRACE_PHASE_ENCOUNTER = 11,         // Close encounter integrated with IAS15 by MERCURIUS
+    REB_TRACE_PHASE_HEARTBEAT = 12,         // Call to heartbeat
+    REB_TRACE_PHASE_SIMULATIONARCHIVE = 13, // Writing a SimulationArchive snapshot
+    REB_TRACE_PHASE_NUM = 14,
+};
+
+// Single begin or end event of the event tracer
+struct reb_trace_event {
+    double time;                    // Time in seconds since the tracer was enabled
+    int32_t tid;                    // OpenMP thread number
+    int16_t phase;                  // enum REB_TRACE_PHASE
+    char type;                      // 'B' for begin, 'E' for end
+};
+
+// Event tracer. Allocated by reb_trace_enable(). Events are stored in a ring buffer, old events are overwritten once the buffer is full.
+struct reb_trace {
+    struct reb_trace_event* events; // Ring buffer
+    uint64_t capacity;              // Size of the ring buffer
+    uint64_t N;                     // Number of events recorded since the tracer was enabled. Event i is stored at index i%capacity.
+    double time_start;              // Time when the tracer was enabled
+};
+
+// Quantities sampled by the diagnostics recorder. Combine with bitwise or. See reb_recorder_enable().
+enum REB_RECORDER_QUANTITY {
+    REB_RECORDER_ENERGY = 1,                // Total energy including energy_offset (column E)
+    REB_RECORDER_ANGULAR_MOMENTUM = 2,      // Angular momentum (columns Lx, Ly, Lz)
+    REB_RECORDER_MEGNO = 4,                 // MEGNO and Lyapunov exponent (columns megno, lyapunov). NaN if MEGNO is not initialized.
+    REB_RECORDER_ORBITS = 8,                // Semi-major axis, eccentricity and inclination in Jacobi coordinates of all particles except the first (columns a1, e1, inc1, a2, ...)
+    REB_RECORDER_MIN_DISTANCE = 16,         // Minimum distance between any two particles (column d_min)
+    REB_RECORDER_REDUCTIONS = 32,           // Values of all reductions registered with reb_add_reduction() when the recorder is enabled (columns red0, red1_0, red1_1, ...)
+};
+
+#define REB_COUNTERS_ENCOUNTER_BINS 16   // Number of bins in the histogram of MERCURIUS encounters
+
+// Counters of the work done during the integration. All counters are zero after the simulation is created and can be reset with reb_counters_reset().
+struct reb_counters {
+    uint64_t gravity_interactions;      // Particle-particle and particle-cell force evaluations. Pairs in direct summation are counted once per ghost box.
+    uint64_t tree_cells_opened;         // Tree cells opened during the force calculation of REB_GRAVITY_TREE and REB_GRAVITY_FMM
+    uint64_t ias15_iterations;          // Predictor corrector iterations of IAS15
+    uint64_t ias15_steps_rejected;      // Steps rejected by IAS15 because the error estimate was too large
+    uint64_t ias15_gravity_reused;      // Substeps of the IAS15 predictor corrector loop in which gravity was reused (see ri_ias15.reuse_gravity)
+    uint64_t bs_steps_rejected;         // Steps rejected by the BS integrator
+    uint64_t mercurius_encounter_steps; // Timesteps in which MERCURIUS integrated at least one close encounter with IAS15
+    uint64_t mercurius_encounter_N[REB_COUNTERS_ENCOUNTER_BINS]; // Histogram of encounterN (including the central object) in MERCURIUS timesteps. Bin k counts steps with 2^k <= encounterN < 2^(k+1). The last bin also counts all larger values.
+    uint64_t collisions_detected;       // Collisions found by the collision search
+    uint64_t collisions_resolved;       // Collisions passed on to the collision resolve function
+    uint64_t kepler_solves;             // Orbits advanced by the WHFast Kepler solver
+    uint64_t kepler_iterations;         // Iterations of the WHFast Kepler solver (Newton, quartic and bisection steps)
+    uint64_t kepler_bisections;         // Orbits for which the WHFast Kepler solver fell back to bisection
+    uint64_t collision_verlet_builds;   // Neighbour lists built by REB_COLLISION_VERLET and REB_COLLISION_LINEVERLET
+    uint64_t tree_lists_reused;         // Kept interaction lists of groups which have been reused (see tree_list_interval)
+    uint64_t tree_fused_searches;       // Collision searches which used the candidate pairs collected during the gravity tree walk (see tree_fused_walk)
+};
+
 // IDs for content of a binary field. Used to read and write binary files.
 enum REB_BINARY_FIELD_TYPE {
     REB_BINARY_FIELD_TYPE_T = 0,
@@ -450,8 +696,41 @@ enum REB_BINARY_FIELD_TYPE {
     REB_BINARY_FIELD_TYPE_BS_FIRSTORLASTSTEP = 160,
     REB_BINARY_FIELD_TYPE_BS_PREVIOUSREJECTED = 161,
     REB_BINARY_FIELD_TYPE_BS_TARGETITER = 162,
+    REB_BINARY_FIELD_TYPE_GRAVITYTILESIZE = 163,
+    REB_BINARY_FIELD_TYPE_FMMORDER = 164,
+    REB_BINARY_FIELD_TYPE_GRAVITYFFTNX = 165,
+    REB_BINARY_FIELD_TYPE_GRAVITYFFTNY = 166,
+    REB_BINARY_FIELD_TYPE_TREESORT = 167,
+    REB_BINARY_FIELD_TYPE_TREEGROUPSIZE = 168,
+    REB_BINARY_FIELD_TYPE_TREEORDER = 169,
+    REB_BINARY_FIELD_TYPE_BS_PARALLELCOLUMNS = 170,
+    REB_BINARY_FIELD_TYPE_HERMITE_ETA = 171,
+    REB_BINARY_FIELD_TYPE_HERMITE_ETASTART = 172,
+    REB_BINARY_FIELD_TYPE_SACOMPRESSION = 173,
+    REB_BINARY_FIELD_TYPE_SAPHYSICALONLY = 174,
+    REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL = 175,
+    REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT = 176,
+    REB_BINARY_FIELD_TYPE_PARTICLES_DIFF = 177,
+    REB_BINARY_FIELD_TYPE_HEARTBEATSTEPS = 178,
+    REB_BINARY_FIELD_TYPE_LEAPFROG_SAFEMODE = 179,
+    REB_BINARY_FIELD_TYPE_LEAPFROG_ISSYNCHRON = 180,
+    REB_BINARY_FIELD_TYPE_IAS15_REUSEGRAVITY = 181,
+    REB_BINARY_FIELD_TYPE_GRAVITYGHOSTBOXTOL = 182,
+    REB_BINARY_FIELD_TYPE_AUTOSELECTINTERVAL = 183,
+    REB_BINARY_FIELD_TYPE_AUTOSELECTOPENINGANGLE2 = 184,
+    REB_BINARY_FIELD_TYPE_WHFAST_KEPLERXCORR = 185,
+    REB_BINARY_FIELD_TYPE_WHFAST_KEPLERWARMSTART = 186,
+    REB_BINARY_FIELD_TYPE_GRAVITYTPFLOAT = 187,
+    REB_BINARY_FIELD_TYPE_COLLISIONVERLETSKIN = 188,
+    REB_BINARY_FIELD_TYPE_TREELISTINTERVAL = 189,
+    REB_BINARY_FIELD_TYPE_TREELISTMARGIN = 190,
+    REB_BINARY_FIELD_TYPE_BS_PARALLELODES = 191,
+    REB_BINARY_FIELD_TYPE_INTERACTIONGROUPS = 192,
+    REB_BINARY_FIELD_TYPE_OMPPERSISTENTTEAM = 193,
+    REB_BINARY_FIELD_TYPE_TREEFUSEDWALK = 194,
 
     REB_BINARY_FIELD_TYPE_HEADER = 1329743186,  // Corresponds to REBO (first characters of header text)
+    REB_BINARY_FIELD_TYPE_SACOMPRESSED = 9997,  // Compressed fields in an SA Blob
     REB_BINARY_FIELD_TYPE_SABLOB = 9998,        // SA Blob
     REB_BINARY_FIELD_TYPE_END = 9999,
 };
@@ -483,33 +762,75 @@ struct reb_simulation {
     int     N_active;
     int     testparticle_type;
     int     testparticle_hidewarnings;
-    struct reb_hash_pointer_pair* particle_lookup_table; // Array of pairs that map particles' hashes to their index in the particles array.
+    struct reb_hash_pointer_pair* particle_lookup_table; // Hash map (open addressing) that maps particles' hashes to their index in the particles array.
     int     hash_ctr;               // Counter for number of assigned hashes to assign unique values.
     int     N_lookup;               // Number of entries in the particle lookup table.
-    int     allocatedN_lookup;      // Number of lookup table entries allocated.
+    int     allocatedN_lookup;      // Number of slots in the particle lookup table (a power of two).
     int     allocatedN;             // Current maximum space allocated in the particles array on this node. 
     struct reb_particle* particles;
     struct reb_vec3d* gravity_cs;   // Containing the information for compensated gravity summation 
     int     gravity_cs_allocatedN;
+    struct reb_particles_soa particles_soa; // Structure-of-arrays mirror of the particles array. Updated by the core before vectorized kernels run.
+    double* gravity_omp_a;          // Per-thread acceleration buffers for the symmetric OpenMP direct summation
+    int     gravity_omp_a_allocatedN;
+    double* gravity_var_pairs;      // Separations and inverse distances of all pairs of particles, shared by all variational configurations
+    size_t  gravity_var_pairs_allocatedN;
+    double* gravity_ghostboxes;     // Position shifts of all ghost boxes (all x, then all y, then all z components), calculated once per force calculation
+    int     gravity_ghostboxes_allocatedN;
     struct reb_treecell** tree_root;// Pointer to the roots of the trees. 
     int     tree_needs_update;      // Flag to force a tree update (after boundary check)
+    struct reb_treecell** tree_pool_blocks; // Blocks of memory from which tree cells are allocated. Block i has room for REB_TREE_POOL_BLOCK<<i cells.
+    int     tree_pool_N_blocks;     // Number of allocated blocks.
+    int     tree_pool_block;        // Index of the block from which new cells are taken.
+    int     tree_pool_N_used;       // Number of cells taken from the current block.
+    struct reb_treecell* tree_pool_free; // List of cells which have been returned to the pool, linked by oct[0].
+    int     tree_sort;              // If set to 1, the particles are sorted along the tree (Morton order) and the tree is rebuilt whenever it is updated.
+    void*   tree_sort_buffer;       // Temporary storage used when sorting particles.
+    int     tree_sort_allocatedN;   // Number of particles for which tree_sort_buffer has room.
+    uint64_t tree_cell_id;          // Incremented whenever a tree cell is allocated. Identifies the cells in kept interaction lists.
+    struct reb_tree_lists* tree_lists; // Interaction lists of groups kept between force calculations (internal).
     double opening_angle2;
     enum REB_STATUS status;
     int     exact_finish_time;
+    int     integrate_resumable;        // 1 if reb_integrate_budget() ran out of budget before reaching integrate_tmax (internal).
+    double  integrate_tmax;             // tmax of the integration reb_integrate_budget() resumes (internal).
+    double  integrate_last_full_dt;     // Timestep to be restored at the end of a budgeted integration (internal).
 
     unsigned int force_is_velocity_dependent;
     unsigned int gravity_ignore_terms;
+    int gravity_tile_size;          // Number of particles per block in the tiled direct summation loops. Set to 0 to disable tiling.
+    double gravity_ghostbox_tolerance; // Ghost box images of a tree cell or block of particles are skipped if their acceleration is guaranteed to be smaller than this value. Default: 0 (no ghost boxes are skipped).
+    unsigned int gravity_testparticle_float; // If set to 1, the accelerations of test particles (type 0) due to all active particles except the first one are calculated in single precision. Default: 0.
+    int N_interaction_groups;       // Number of interaction groups. Default: 0 (all particles interact). See reb_set_interaction_groups().
+    uint64_t* interaction_groups;   // interaction_groups[g] has bit h set if particles in group g feel particles in group h.
+    int omp_persistent_team;        // If set to 1, batches of LEAPFROG steps with NONE or BASIC gravity run in one OpenMP parallel region instead of one region per loop. Only used with OPENMP. Default: 0.
+    unsigned int fmm_order;         // Order of the local expansion used by REB_GRAVITY_FMM (0, 1 or 2).
+    int tree_group_size;            // Maximum number of particles in a cell which share one interaction list in REB_GRAVITY_TREE. Set to 0 to walk the tree separately for each particle.
+    unsigned int tree_order;        // Order of the multipole expansion used by REB_GRAVITY_TREE (0: monopole, 1: quadrupole, 2: octupole).
+    int tree_list_interval;         // If >0, the interaction lists of groups (tree_group_size>1) are kept and reused for up to tree_list_interval steps while they remain valid. Default 0.
+    double tree_list_margin;        // Kept interaction lists are built with the opening criterion opening_angle2/(1+tree_list_margin), so that they are rebuilt less often. Default 0.
+    int tree_fused_walk;            // If set to 1, REB_GRAVITY_TREE collects the candidate pairs for REB_COLLISION_TREE and REB_COLLISION_LINETREE during its tree walk. Default 0.
+    int auto_select_interval;       // If >0, the gravity and collision methods are selected by timing the candidates every auto_select_interval steps. Default 0.
+    double auto_select_opening_angle2; // Largest opening_angle2 which the automatic selection may use for REB_GRAVITY_TREE. Default 0 (REB_GRAVITY_TREE is not a candidate).
+    int gravity_fft_nx;             // Number of grid cells in the x direction used by REB_GRAVITY_FFT.
+    int gravity_fft_ny;             // Number of grid cells in the y direction used by REB_GRAVITY_FFT.
+    struct reb_gravity_fft* gravity_fft; // Grids and FFT plans of REB_GRAVITY_FFT (internal).
     double output_timing_last;      // Time when reb_output_timing() was called the last time. 
     unsigned long display_clock;    // Display clock, internal variable for timing refreshs.
     int save_messages;              // Set to 1 to ignore messages (used in python interface).
     char** messages;                // Array of strings containing last messages (only used if save_messages==1). 
     double exit_max_distance;
     double exit_min_distance;
+    struct reb_encounter exit_encounter; // Pair of particles which caused the last REB_EXIT_ENCOUNTER.
     double usleep;
     struct reb_display_data* display_data; // Datastructure stores visualization related data. Does not have to be modified by the user. 
     int track_energy_offset;
     double energy_offset;
     double walltime;
+    struct reb_profiling* profiling; // Runtime profiling data. NULL if profiling is disabled (default). See reb_profiling_enable().
+    struct reb_counters counters;   // Counters of force evaluations, iterations, rejected steps, etc.
+    struct reb_trace* trace;        // Event tracer. NULL if tracing is disabled (default). See reb_trace_enable().
+    struct reb_recorder* recorder;  // Diagnostics recorder. NULL if disabled (default). See reb_recorder_enable().
     uint32_t python_unit_l;         // Only used for when working with units in python.
     uint32_t python_unit_m;         // Only used for when working with units in python.
     uint32_t python_unit_t;         // Only used for when working with units in python.
@@ -529,26 +850,42 @@ struct reb_simulation {
 #ifdef MPI
     int    mpi_id;                              // Unique id of this node (starting at 0). Used for MPI only.
     int    mpi_num;                             // Number of MPI nodes. Used for MPI only.
-    MPI_Datatype mpi_particle;                  // MPI datatype corresponding to the C struct reb_particle. 
+    MPI_Datatype mpi_particle;                  // MPI datatype for particles moving to another node. All fields but the pointers.
+    MPI_Datatype mpi_particle_essential;        // MPI datatype for particles needed by the collision search of other nodes. Position, velocity, mass and radius only.
     struct reb_particle** particles_send;       // Send buffer for particles. There is one buffer per node. 
     int*   particles_send_N;                    // Current length of particle send buffer. 
     int*   particles_send_Nmax;                 // Maximal length of particle send beffer before realloc() is needed. 
-    struct reb_particle** particles_recv;       // Receive buffer for particles. There is one buffer per node. 
+    struct reb_particle** particles_recv;       // Particles received from each node. Points into particles_recv_buffer. 
     int*   particles_recv_N;                    // Current length of particle receive buffer. 
-    int*   particles_recv_Nmax;                 // Maximal length of particle receive beffer before realloc() is needed. */
+    struct reb_particle* particles_recv_buffer; // Contiguous receive buffer for particles from all nodes.
+    int    particles_recv_Nmax;                 // Maximal length of particles_recv_buffer before realloc() is needed.
 
-    MPI_Datatype mpi_cell;                      // MPI datatype corresponding to the C struct reb_treecell. 
+    MPI_Datatype mpi_cell;                      // MPI datatype for essential cells for collisions. Geometry and particle index only.
+    MPI_Datatype mpi_cell_gravity[3];           // MPI datatypes for essential cells for gravity. Geometry, mass, centre of mass and the moments up to tree_order (index).
     struct reb_treecell** tree_essential_send;  // Send buffer for cells. There is one buffer per node. 
     int*   tree_essential_send_N;               // Current length of cell send buffer. 
     int*   tree_essential_send_Nmax;            // Maximal length of cell send beffer before realloc() is needed. 
-    struct reb_treecell** tree_essential_recv;  // Receive buffer for cells. There is one buffer per node. 
+    struct reb_treecell** tree_essential_recv;  // Cells received from each node. Points into tree_essential_recv_buffer.
     int*   tree_essential_recv_N;               // Current length of cell receive buffer. 
-    int*   tree_essential_recv_Nmax;            // Maximal length of cell receive beffer before realloc() is needed. 
+    struct reb_treecell* tree_essential_recv_buffer; // Contiguous receive buffer for cells from all nodes.
+    int    tree_essential_recv_Nmax;            // Maximal length of tree_essential_recv_buffer before realloc() is needed. 
+    char*  mpi_send_buffer;                     // All send buffers are packed into this buffer before communication.
+    int    mpi_send_buffer_Nmax;                // Size of mpi_send_buffer in bytes.
+    int    mpi_pipeline;                        // If 1, local forces and collisions are calculated while the essential tree is being communicated. Default 0.
+    MPI_Request* mpi_requests;                  // Requests used by the pipelined communication.
+    int*   mpi_requests_pending;                // Number of outstanding receives from each node.
+    int*   mpi_root_owner;                      // Id of the node which owns each root box.
+    int    mpi_load_balance_interval;           // If >0, root boxes are reassigned to balance the number of particles per node every mpi_load_balance_interval steps. Default 0.
+    int    mpi_direct;                          // If 1, all nodes hold all particles and the direct summation (REB_GRAVITY_BASIC, REB_GRAVITY_MERCURIUS) is split between nodes. Set before reb_mpi_init(). Default 0.
 #endif // MPI
 
     int collision_resolve_keep_sorted;
     struct reb_collision* collisions;       ///< Array of all collisions. 
     int collisions_allocatedN;
+    int* collision_sweep_order;             // Particle indices sorted along the sweep axis, kept between timesteps by REB_COLLISION_SWEEP and the exit_min_distance check.
+    int collision_sweep_N;                  // Number of entries in collision_sweep_order.
+    struct reb_collision_verlet* collision_verlet; // Neighbour list kept between timesteps by REB_COLLISION_VERLET and REB_COLLISION_LINEVERLET (internal).
+    double collision_verlet_skin;           // Distance added to the sum of the two largest radii when the neighbour list is built. Default: 0 (chosen automatically).
     double minimum_collision_velocity;
     double collisions_plog;
     double max_radius[2];               // Two largest particle radii, set automatically, needed for collision search.
@@ -567,6 +904,8 @@ struct reb_simulation {
     
      // SimulationArchive 
     int    simulationarchive_version;               // Version of the SA binary format (1=original/, 2=incremental)
+    int    simulationarchive_compression;           // Compression level of SA snapshots (0=none, 1=fastest, ..., 9=smallest)
+    int    simulationarchive_physical_only;         // 0: snapshots allow bit-exact restarts (default), 1: only physical state, 2: physical state in single precision
     long   simulationarchive_size_first;            // (Deprecated SAV1) Size of the initial binary file in a SA
     long   simulationarchive_size_snapshot;         // (Deprecated SAV1) Size of a snapshot in a SA (other than 1st), in bytes
     double simulationarchive_auto_interval;         // Current sampling cadence, in code units
@@ -575,6 +914,13 @@ struct reb_simulation {
     double simulationarchive_next;                  // Next output time (simulation tim or wall time, depending on wether auto_interval or auto_walltime is set)
     unsigned long long simulationarchive_next_step; // Next output step (only used if auto_steps is set)
     char*  simulationarchive_filename;              // Name of output file
+    int    simulationarchive_async;                 // If 1, snapshots are written on a background thread (default: 0)
+    struct reb_simulationarchive_writer* simulationarchive_writer; // Internal. Background thread writing snapshots.
+    struct reb_simulationarchive_cache* simulationarchive_cache; // Internal. First snapshot and open file handle kept between snapshots.
+    double simulationarchive_checkpoint_walltime;   // Wall time between checkpoints
+    double simulationarchive_checkpoint_next;       // Wall time of the next checkpoint
+    int    simulationarchive_checkpoint_N;          // Number of checkpoints kept
+    char*  simulationarchive_checkpoint_filename;   // Name of checkpoint file
 
     // Modules
     enum {
@@ -588,6 +934,10 @@ struct reb_simulation {
         REB_COLLISION_TREE = 2,     // Tree based collision search O(N log(N))
         REB_COLLISION_LINE = 4,     // Direct collision search O(N^2), looks for collisions by assuming a linear path over the last timestep
         REB_COLLISION_LINETREE = 5, // Tree-based collision search O(N log(N)), looks for collisions by assuming a linear path over the last timestep
+        REB_COLLISION_GRID = 6,     // Grid based collision search O(N), for particles with similar radii
+        REB_COLLISION_SWEEP = 7,    // Sweep and prune collision search along the x axis, looks for collisions by assuming a linear path over the last timestep
+        REB_COLLISION_VERLET = 8,   // Neighbour list which is kept between timesteps, finds the same collisions as REB_COLLISION_GRID
+        REB_COLLISION_LINEVERLET = 9, // Neighbour list which is kept between timesteps, finds the same collisions as REB_COLLISION_LINE
         } collision;
     enum {
         REB_INTEGRATOR_IAS15 = 0,    // IAS15 integrator, 15th order, non-symplectic (default)
@@ -600,6 +950,7 @@ struct reb_simulation {
         REB_INTEGRATOR_SABA = 10,    // SABA integrator family (Laskar and Robutel 2001)
         REB_INTEGRATOR_EOS = 11,     // Embedded Operator Splitting (EOS) integrator family (Rein 2019)
         REB_INTEGRATOR_BS = 12,      // Gragg-Bulirsch-Stoer 
+        REB_INTEGRATOR_HERMITE = 13, // Fourth order Hermite integrator with individual block timesteps
         } integrator;
     enum {
         REB_BOUNDARY_NONE = 0,      // Do not check for anything (default)
@@ -613,7 +964,9 @@ struct reb_simulation {
         REB_GRAVITY_COMPENSATED = 2,// Direct summation algorithm O(N^2) but with compensated summation, slightly slower than BASIC but more accurate
         REB_GRAVITY_TREE = 3,       // Use the tree to calculate gravity, O(N log(N)), set opening_angle2 to adjust accuracy.
         REB_GRAVITY_MERCURIUS = 4,  // Special gravity routine only for MERCURIUS
-        REB_GRAVITY_JACOBI = 5,     // Special gravity routine which includes the Jacobi terms for WH integrators 
+        REB_GRAVITY_JACOBI = 5,     // Special gravity routine which includes the Jacobi terms for WH integrators
+        REB_GRAVITY_FMM = 6,        // Use the tree and cell-cell interactions (fast multipole method) to calculate gravity, O(N), set opening_angle2 and fmm_order to adjust accuracy. 
+        REB_GRAVITY_FFT = 7,        // Particle-mesh FFT solver for razor thin periodic and shearing sheet boxes (in-plane forces only), set gravity_fft_nx and gravity_fft_ny to adjust resolution. Requires FFTW=1.
         } gravity;
 
     // Integrators
@@ -625,6 +978,8 @@ struct reb_simulation {
     struct reb_simulation_integrator_janus ri_janus;        // The JANUS struct 
     struct reb_simulation_integrator_eos ri_eos;            // The EOS struct 
     struct reb_simulation_integrator_bs ri_bs;              // The BS struct
+    struct reb_simulation_integrator_hermite ri_hermite;    // The HERMITE struct
+    struct reb_simulation_integrator_leapfrog ri_leapfrog;  // The LEAPFROG struct
 
     // ODEs
     struct reb_ode** odes;  // all ode sets (includes nbody if BS set as integrator)
@@ -632,8 +987,16 @@ struct reb_simulation {
     int odes_allocatedN;   // number of ode sets allocated
     int ode_warnings;
 
+    unsigned int heartbeat_steps;   // The heartbeat function is only called every heartbeat_steps steps. Default: 0 (every step)
+
      // Callback functions
     void (*additional_forces) (struct reb_simulation* const r);
+    struct reb_force* forces;   // Forces registered with reb_add_force(). Evaluated after additional_forces.
+    int forces_N;               // Number of registered forces
+    int forces_allocatedN;
+    struct reb_reduction* reductions;   // Reductions registered with reb_add_reduction().
+    int reductions_N;                   // Number of registered reductions
+    int reductions_allocatedN;
     void (*pre_timestep_modifications) (struct reb_simulation* const r);    // used by REBOUNDx
     void (*post_timestep_modifications) (struct reb_simulation* const r);   // used by REBOUNDx
     void (*heartbeat) (struct reb_simulation* r);
@@ -672,7 +1035,27 @@ struct reb_orbit {
 struct reb_simulation* reb_create_simulation(void);     // allocates memory, then calls reb_init_simulation
 void reb_init_simulation(struct reb_simulation* r);    
 void reb_free_simulation(struct reb_simulation* const r);
+void reb_free_buffer(void* const buf); // Frees a buffer allocated by REBOUND, e.g. by reb_output_particles_ascii_to_buffer. Useful when the caller uses a different allocator (e.g. in Python).
 struct reb_simulation* reb_copy_simulation(struct reb_simulation* r);
+void reb_copy_simulation_into(struct reb_simulation* r_copy, const struct reb_simulation* r); // Overwrites r_copy with a deep copy of r. Function pointers and temporary arrays are not copied.
+
+// Memory allocation. The particle array and large integrator arrays are 64-byte aligned.
+void reb_set_allocator(void* (*allocate)(size_t size, size_t alignment, void* data), void (*deallocate)(void* ptr, void* data), void* data); // Replaces the allocator for these arrays. allocate must return a block aligned to alignment bytes. Pass NULL to restore the default. Must be called before any simulation is created.
+void reb_set_hugepage_threshold(size_t size); // Arrays of at least size bytes (default 2MB) use transparent huge pages where available. 0 disables huge pages.
+// The particle array and the integrator arrays must only be allocated, resized and freed with the following functions, not with malloc, realloc or free.
+void* reb_malloc(size_t size); // Allocates size bytes with the allocator set by reb_set_allocator(). The block is 64-byte aligned.
+void* reb_calloc(size_t N, size_t size); // Same as reb_malloc() but the block is set to zero.
+void* reb_realloc(void* ptr, size_t size); // Returns a block of at least size bytes with the contents of ptr. The block is not moved if it is already large enough. Blocks never shrink. ptr can be NULL.
+void* reb_reserve(void* ptr, size_t size); // Same as reb_realloc() but the contents are not kept if a new block is needed.
+void reb_free(void* ptr); // Frees a block allocated with reb_malloc(). ptr can be NULL.
+
+// Saving and restoring the state of a simulation (time, timestep, particles, integrator arrays).
+// Used to step back, e.g. to locate events. The storage is reused and only grows if the simulation grows.
+struct reb_simulation_state;
+struct reb_simulation_state* reb_simulation_state_create(struct reb_simulation* const r); // Allocates a state. If r is not NULL, the state of r is saved.
+void reb_simulation_state_free(struct reb_simulation_state* const s);
+void reb_simulation_state_save(struct reb_simulation_state* const s, struct reb_simulation* const r);
+int reb_simulation_state_restore(struct reb_simulation* const r, const struct reb_simulation_state* const s); // Returns 0 on success, 1 if the ODEs of r have changed.
 void reb_free_pointers(struct reb_simulation* const r);
 void reb_reset_temporary_pointers(struct reb_simulation* const r);
 int reb_reset_function_pointers(struct reb_simulation* const r); // Returns 1 if one ore more function pointers were not NULL before.
@@ -689,10 +1072,45 @@ int reb_get_next_message(struct reb_simulation* const r, char* const buf); // Ge
 void reb_step(struct reb_simulation* const r);
 void reb_steps(struct reb_simulation* const r, unsigned int N_steps);
 enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tmax);
+enum REB_STATUS reb_integrate_budget(struct reb_simulation* const r, double tmax, double max_walltime, unsigned long max_steps); // Integrates towards tmax for at most max_walltime seconds and max_steps steps (0 means no limit). Returns a negative status if the budget ran out first. The next call with the same tmax resumes the integration.
 void reb_integrator_synchronize(struct reb_simulation* r);
 void reb_integrator_reset(struct reb_simulation* r);
+void reb_integrator_synchronize_output(struct reb_simulation* r); // Synchronizes the particles for output only. For WHFast and SABA, the integrator state stays unsynchronized (as with keep_unsynchronized=1) and the result is reused until the next step.
+int reb_integrator_ias15_dense_output(const struct reb_simulation* const r, const double t, struct reb_particle* const particles); // Evaluates the IAS15 interpolating polynomial of the last accepted step at time t (between r->t-r->dt_last_done and r->t). Writes r->N particles with the positions and velocities at time t into particles. Returns 0 on success, 1 if no dense output is available and 2 if t is outside of the last step.
 void reb_update_acceleration(struct reb_simulation* r);
 
+// Runtime profiling
+void reb_profiling_enable(struct reb_simulation* const r);  // Allocates r->profiling and starts timing. Resets the counters if profiling is already enabled.
+void reb_profiling_disable(struct reb_simulation* const r); // Frees r->profiling.
+extern const char* const reb_profiling_category_names[REB_PROFILING_CAT_NUM]; // Human readable names of the profiling categories
+void reb_counters_reset(struct reb_simulation* const r); // Sets all counters in r->counters to zero.
+void reb_trace_enable(struct reb_simulation* const r, uint64_t capacity); // Allocates r->trace with a ring buffer of capacity events and starts recording. Clears the buffer if tracing is already enabled.
+void reb_trace_disable(struct reb_simulation* const r);  // Frees r->trace.
+int reb_trace_output_chrome(struct reb_simulation* const r, const char* filename); // Writes the recorded events in the Chrome trace event format (JSON), which can be opened in Perfetto or chrome://tracing. With MPI, this needs to be called by all nodes and node 0 writes the events of all nodes. Returns 0 on success.
+extern const char* const reb_trace_phase_names[REB_TRACE_PHASE_NUM]; // Names of the traced phases
+int reb_recorder_enable(struct reb_simulation* const r, const char* const filename, const unsigned int quantities, const double interval, const unsigned int steps, const unsigned int capacity); // Starts recording the quantities (enum REB_RECORDER_QUANTITY) to a binary file. Samples are taken every interval in simulation time or every steps timesteps (if both are 0, every timestep) and stored in a buffer of capacity rows which is written on a background thread once full. With MPI, every node writes its own file. Returns 0 on success.
+void reb_recorder_sample(struct reb_simulation* const r);   // Records one sample now.
+void reb_recorder_flush(struct reb_simulation* const r);    // Writes all buffered samples to the file and waits until they have been written.
+void reb_recorder_disable(struct reb_simulation* const r);  // Flushes and closes the file and frees r->recorder.
+
+// Registered forces
+int reb_add_force(struct reb_simulation* const r, void (*force)(struct reb_simulation* const r, const struct reb_force* const f, struct reb_particles_soa* const soa, const int istart, const int iend), const int istart, const int iend, const unsigned int velocity_dependent, void* data); // Registers a force acting on the particles istart,...,iend-1 (iend=-1 for all particles). All registered forces are evaluated in a single pass over the particles after additional_forces. Returns the index of the force or -1 on error.
+void reb_remove_forces(struct reb_simulation* const r); // Removes all registered forces.
+
+// In-situ reductions
+int reb_add_reduction(struct reb_simulation* const r, enum REB_REDUCTION_TYPE type, enum REB_REDUCTION_FIELD field, enum REB_REDUCTION_FIELD bin_field, double min, double max, int N_bins); // Registers a sum, moments, histogram or binned profile of a particle quantity. bin_field, min, max and N_bins are only used for histograms and profiles. Returns the index of the reduction or -1 on error.
+void reb_calculate_reductions(struct reb_simulation* const r);  // Evaluates all registered reductions in a single (parallel) pass over the particles and stores the results in r->reductions[k].values.
+void reb_remove_reductions(struct reb_simulation* const r);     // Removes all registered reductions.
+
+// Interaction groups
+// Every particle belongs to a group (reb_particle.group). Particles in group g only feel particles in groups h for which
+// matrix[g*N_groups+h] is non-zero (all groups if matrix is NULL). Pairs which do not interact in either direction do not collide.
+// Supported by REB_GRAVITY_BASIC (not with Jacobi coordinates) and REB_GRAVITY_MERCURIUS. Interactions with the central 
+// object in WHFast's democratic heliocentric coordinates and MERCURIUS are part of the Kepler step and always included.
+#define REB_INTERACTION_GROUPS_MAX 64
+int reb_set_interaction_groups(struct reb_simulation* const r, const int N_groups, const int* const matrix); // Sets the number of groups (0 to disable) and the interaction matrix. Returns 0 on success or -1 on error.
+int reb_set_interaction(struct reb_simulation* const r, const int group, const int source, const int enabled); // Enables or disables the force of particles in group source on particles in group group. Returns 0 on success or -1 on error.
+
 // Compare simulations
 // If r1 and r2 are exactly equal to each other then 0 is returned, otherwise 1. Walltime is ignored.
 // If output_option=1, then output is printed on the screen. If 2, only return value os given. 
@@ -714,20 +1132,45 @@ double reb_random_uniform(struct reb_simulation* r, double min, double max);
 double reb_random_powerlaw(struct reb_simulation* r, double min, double max, double slope);
 double reb_random_normal(struct reb_simulation* r, double variance);
 double reb_random_rayleigh(struct reb_simulation* r, double sigma);
+// Counter based random sampling. values[i] only depends on seed and offset+i. Arrays are filled in parallel if OpenMP is enabled.
+void reb_random_uniform_array(uint64_t seed, uint64_t offset, int N, double* values, double min, double max);
+void reb_random_powerlaw_array(uint64_t seed, uint64_t offset, int N, double* values, double min, double max, double slope);
+void reb_random_normal_array(uint64_t seed, uint64_t offset, int N, double* values, double variance);
+void reb_random_rayleigh_array(uint64_t seed, uint64_t offset, int N, double* values, double sigma);
 
 // Serialization functions.
 void reb_serialize_particle_data(struct reb_simulation* r, uint32_t* hash, double* m, double* radius, double (*xyz)[3], double (*vxvyvz)[3], double (*xyzvxvyvz)[6]); // NULL pointers will not be set.
 void reb_set_serialized_particle_data(struct reb_simulation* r, uint32_t* hash, double* m, double* radius, double (*xyz)[3], double (*vxvyvz)[3], double (*xyzvxvyvz)[6]); // Null pointers will be ignored.
+void reb_add_serialized_particle_data(struct reb_simulation* r, const int N, uint32_t* hash, double* m, double* radius, double (*xyz)[3], double (*vxvyvz)[3], double (*xyzvxvyvz)[6]); // Adds N particles. Null pointers will be ignored (the corresponding values are 0).
+enum REB_ORBITS_PRIMARY {
+    REB_ORBITS_PRIMARY_JACOBI = 0,          // Center of mass of all interior particles (default)
+    REB_ORBITS_PRIMARY_HELIOCENTRIC = 1,    // Particle 0
+    REB_ORBITS_PRIMARY_BARYCENTRIC = 2,     // Center of mass of all particles
+};
+int reb_serialize_orbits(struct reb_simulation* r, enum REB_ORBITS_PRIMARY primary, int jacobi_masses, double* a, double* e, double* inc, double* Omega, double* omega, double* pomega, double* f, double* M, double* l); // Orbital elements of particles 1 to N_real-1 are written to arrays of length N_real-1. NULL pointers will not be set. Returns the number of particles for which no orbit could be calculated (their elements are NaN).
+int reb_add_serialized_orbits(struct reb_simulation* r, const int N, enum REB_ORBITS_PRIMARY primary, uint32_t* hash, double* m, double* radius, double* a, double* e, double* inc, double* Omega, double* omega, double* f, double* M); // Adds N particles from arrays of orbital elements (a is required). NULL pointers are 0. If M is not NULL, f is ignored. Returns the number of invalid orbits. In that case no particle is added.
 
 // Output functions
 int reb_output_check(struct reb_simulation* r, double interval);
 void reb_output_timing(struct reb_simulation* r, const double tmax);
 void reb_output_orbits(struct reb_simulation* r, char* filename);
 void reb_output_binary(struct reb_simulation* r, const char* filename);
+size_t reb_output_binary_size(struct reb_simulation* r); // Returns the size in bytes of the binary written by reb_output_binary().
+size_t reb_output_binary_to_buffer(struct reb_simulation* r, char* buf, size_t size); // Writes the binary into buf (e.g. a shared memory segment). Returns the number of bytes written or 0 if buf is too small.
 void reb_output_ascii(struct reb_simulation* r, char* filename);
 void reb_output_binary_positions(struct reb_simulation* r, const char* filename);
 void reb_output_velocity_dispersion(struct reb_simulation* r, char* filename);
 
+// Text files with one particle per line. Columns are separated by spaces, tabs or commas.
+enum REB_ASCII_FORMAT {
+    REB_ASCII_CARTESIAN = 0,    // m r x y z vx vy vz
+    REB_ASCII_ORBITS = 1,       // m r a e inc Omega omega f (heliocentric, relative to particle 0)
+};
+int reb_output_particles_ascii(struct reb_simulation* const r, const char* const filename, const enum REB_ASCII_FORMAT format, const int precision, const char delimiter, int N_threads); // Returns 0 on success. The orbits format does not include particle 0. N_threads<=0 uses all cores.
+char* reb_output_particles_ascii_to_buffer(struct reb_simulation* const r, const enum REB_ASCII_FORMAT format, const int precision, const char delimiter, int N_threads, size_t* const size); // Returns a null terminated buffer which needs to be freed with reb_free_buffer. The length is stored in size if not NULL.
+int reb_input_particles_ascii(struct reb_simulation* const r, const char* const filename, const enum REB_ASCII_FORMAT format, int N_threads); // Returns the number of particles added or -1 on error. No particles are added on error.
+int reb_input_particles_ascii_from_buffer(struct reb_simulation* const r, const char* const buf, const size_t size, const enum REB_ASCII_FORMAT format, int N_threads);
+
 // Compares two simulations, stores difference in buffer.
 void reb_binary_diff(char* buf1, size_t size1, char* buf2, size_t size2, char** bufp, size_t* sizep); 
 // Same as reb_binary_diff, but with options.
@@ -737,6 +1180,7 @@ int reb_binary_diff_with_options(char* buf1, size_t size1, char* buf2, size_t si
 
 // Input functions
 struct reb_simulation* reb_create_simulation_from_binary(char* filename);
+struct reb_simulation* reb_create_simulation_from_buffer(const char* buf, size_t size); // Creates a simulation from a binary in memory, e.g. written by reb_output_binary_to_buffer(). The buffer is only read. Returns NULL on error.
 
 // Possible errors that might occur during binary file reading.
 enum reb_input_binary_messages {
@@ -751,7 +1195,9 @@ enum reb_input_binary_messages {
     REB_INPUT_BINARY_WARNING_FIELD_UNKOWN = 128,
     REB_INPUT_BINARY_ERROR_INTEGRATOR = 256,
     REB_INPUT_BINARY_WARNING_CORRUPTFILE = 512,
+    REB_INPUT_BINARY_WARNING_PHYSICALONLY = 1024,
 };
+void reb_create_simulation_from_buffer_with_messages(struct reb_simulation* r, const char* buf, size_t size, enum reb_input_binary_messages* warnings); // Same as reb_create_simulation_from_buffer() but overwrites r and stores messages in warnings.
 
 // ODE functions
 struct reb_ode* reb_create_ode(struct reb_simulation* r, unsigned int length);
@@ -765,10 +1211,13 @@ double reb_tools_E_to_f(double e, double M); // True anomaly for a given eccentr
 double reb_tools_M_to_E(double e, double M); // Eccentric anomaly for a given eccentricity and mean anomaly
 void reb_tools_init_plummer(struct reb_simulation* r, int _N, double M, double R); // This function sets up a Plummer sphere, N=number of particles, M=total mass, R=characteristic radius
 void reb_run_heartbeat(struct reb_simulation* const r);  // used internally
+int reb_check_exit(struct reb_simulation* const r, const double tmax, double* last_full_dt);  // used internally
+void reb_step_batch(struct reb_simulation* const r, const double tmax);  // used internally. Takes one or more steps without crossing tmax or skipping a heartbeat.
 
 // Functions to add and initialize particles
 struct reb_particle reb_particle_nan(void); // Returns a reb_particle structure with fields/hash/ptrs initialized to nan/0/NULL. 
 void reb_add(struct reb_simulation* const r, struct reb_particle pt);
+void reb_add_many(struct reb_simulation* const r, const struct reb_particle* const particles, const int N); // Adds N particles. Memory is only reallocated once.
 void reb_add_fmt(struct reb_simulation* r, const char* fmt, ...);
 struct reb_particle reb_particle_new(struct reb_simulation* r, const char* fmt, ...);    // Same as reb_add_fmt() but returns the particle instead of adding it to the simualtion.
 struct reb_particle reb_tools_orbit_to_particle_err(double G, struct reb_particle primary, double m, double a, double e, double i, double Omega, double omega, double f, int* err);
@@ -779,6 +1228,8 @@ struct reb_particle reb_tools_pal_to_particle(double G, struct reb_particle prim
 void reb_remove_all(struct reb_simulation* const r);
 int reb_remove(struct reb_simulation* const r, int index, int keepSorted);
 int reb_remove_by_hash(struct reb_simulation* const r, uint32_t hash, int keepSorted);
+int reb_remove_many(struct reb_simulation* const r, const int* const indices, const int N, int keepSorted); // Removes N particles in a single pass. Returns the number of particles removed.
+int reb_remove_many_by_hash(struct reb_simulation* const r, const uint32_t* const hashes, const int N, int keepSorted);
 struct reb_particle* reb_get_particle_by_hash(struct reb_simulation* const r, uint32_t hash);
 int reb_get_particle_index(struct reb_particle* p); // Returns a particle's index in the simulation it's in. Needs to be in the simulation its sim pointer is pointing to. Otherwise -1 returned.
 struct reb_particle reb_get_jacobi_com(struct reb_particle* p); // Returns the Jacobi center of mass for a given particle. Used by python. Particle needs to be in a simulation.
@@ -905,6 +1356,31 @@ struct reb_particle reb_derivatives_omega_f(double G, struct reb_particle primar
 struct reb_particle reb_derivatives_m_omega(double G, struct reb_particle primary, struct reb_particle po);
 struct reb_particle reb_derivatives_m_f(double G, struct reb_particle primary, struct reb_particle po);
 
+// Parameters with respect to which derivatives of Keplerian orbits can be calculated in bulk.
+enum REB_DERIVATIVES_PARAMETER {
+    REB_DERIVATIVES_NONE = -1,  // Second parameter of a first derivative
+    REB_DERIVATIVES_m = 0,
+    REB_DERIVATIVES_a = 1,
+    REB_DERIVATIVES_e = 2,
+    REB_DERIVATIVES_inc = 3,
+    REB_DERIVATIVES_omega = 4,
+    REB_DERIVATIVES_Omega = 5,
+    REB_DERIVATIVES_f = 6,
+    REB_DERIVATIVES_k = 7,
+    REB_DERIVATIVES_h = 8,
+    REB_DERIVATIVES_lambda = 9,
+    REB_DERIVATIVES_ix = 10,
+    REB_DERIVATIVES_iy = 11,
+};
+
+// Calculates N first or second derivatives of the same orbit in one go. The i-th derivative is taken
+// with respect to v1[i] and v2[i] (REB_DERIVATIVES_NONE for a first derivative, or pass v2=NULL if
+// all derivatives are first derivatives) and stored in derivatives[i]. The results agree with those
+// of the reb_derivatives_* functions above to machine precision, but the orbital elements, the solution of Kepler's
+// equation and the trigonometric terms are only calculated once. Returns the number of requested
+// combinations which are not implemented; their derivatives are set to zero.
+int reb_derivatives_many(double G, struct reb_particle primary, struct reb_particle po, int N, const enum REB_DERIVATIVES_PARAMETER* const v1, const enum REB_DERIVATIVES_PARAMETER* const v2, struct reb_particle* const derivatives);
+
 // Functions to operate on particles
 void reb_particle_isub(struct reb_particle* p1, struct reb_particle* p2);
 void reb_particle_iadd(struct reb_particle* p1, struct reb_particle* p2);
@@ -919,8 +1395,17 @@ void reb_move_to_hel(struct reb_simulation* const r);
 void reb_move_to_com(struct reb_simulation* const r);
 
 // Diangnostic functions
+struct reb_diagnostics {
+    double energy;                          // Total energy including energy_offset
+    double energy_kinetic;
+    double energy_potential;
+    struct reb_vec3d angular_momentum;
+};
 double reb_tools_energy(const struct reb_simulation* const r);
 struct reb_vec3d reb_tools_angular_momentum(const struct reb_simulation* const r);
+// Energy and angular momentum in one pass. If tree is 1 and the simulation uses REB_GRAVITY_TREE, 
+// the potential energy is approximated using the tree. Otherwise all pairs are summed up.
+struct reb_diagnostics reb_tools_diagnostics(struct reb_simulation* const r, const int tree);
 struct reb_particle reb_get_com(struct reb_simulation* r);
 struct reb_particle reb_get_com_of_pair(struct reb_particle p1, struct reb_particle p2);
 struct reb_particle reb_get_com_range(struct reb_simulation* r, int first, int last);
@@ -932,12 +1417,23 @@ struct reb_simulationarchive_blob {  // Used in the binary file to identify data
     int32_t offset_prev;             // Offset to beginning of previous blob (size of previous blob).
     int32_t offset_next;             // Offset to end of following blob (size of following blob).
 };
+#define REB_SIMULATIONARCHIVE_STREAMED -1 // offset_next of blobs written to a stream. The size of the following blob is not known when the blob is written.
 struct reb_simulationarchive_blob16 {  // For backwards compatability only. Will be removed in a future release. 
     int32_t index;
     int16_t offset_prev;
     int16_t offset_next;
 };
 
+struct reb_simulationarchive_stream{ // Snapshots written to or read from a file descriptor (pipe, socket, file)
+    int fd;                          // File descriptor (not closed by REBOUND)
+    char* buf_base;                  // First snapshot, the base of all diffs (NULL until it has been written or read)
+    size_t size_base;
+    struct reb_simulationarchive_blob blob; // Blob of the last snapshot written or read
+    char* buf;                       // Data received but not loaded yet (only used for reading)
+    size_t size;
+    size_t capacity;
+};
+
 struct reb_simulationarchive{
     FILE* inf;                   // File pointer (will be kept open)
     char* filename;              // Filename of open file
@@ -948,18 +1444,132 @@ struct reb_simulationarchive{
     double auto_walltime;        // Walltime setting used to create SA (if used)
     unsigned long long auto_step;// Steps in-between SA snapshots (if used)
     long nblobs;                 // Total number of snapshots (including initial binary)
-    uint32_t* offset;            // Index of offsets in file (length nblobs)
+    uint64_t* offset;            // Index of offsets in file (length nblobs)
     double* t;                   // Index of simulation times in file (length nblobs)
+    char* mmap_data;             // Memory mapped file contents (NULL if the file could not be mapped)
+    size_t mmap_size;            // Size of the memory mapped file
+    size_t mmap_pos;             // Current read position in the memory mapped file
+    struct reb_simulation* cache_simulation; // Simulation integrated forward by reb_simulationarchive_get_simulation_exact (NULL if none)
+    long cache_snapshot;         // Snapshot from which cache_simulation was integrated
+};
+// Fields available in reb_simulationarchive_export. Orbital elements are calculated in Jacobi coordinates.
+enum REB_SAEXPORT_FIELD {
+    REB_SAEXPORT_FIELD_M = 0,           // Mass
+    REB_SAEXPORT_FIELD_X = 1,           // Cartesian coordinates
+    REB_SAEXPORT_FIELD_Y = 2,
+    REB_SAEXPORT_FIELD_Z = 3,
+    REB_SAEXPORT_FIELD_VX = 4,          // Cartesian velocities
+    REB_SAEXPORT_FIELD_VY = 5,
+    REB_SAEXPORT_FIELD_VZ = 6,
+    REB_SAEXPORT_FIELD_A = 7,           // Semi-major axis
+    REB_SAEXPORT_FIELD_E = 8,           // Eccentricity
+    REB_SAEXPORT_FIELD_INC = 9,         // Inclination
+    REB_SAEXPORT_FIELD_OMEGA_NODE = 10, // Longitude of ascending node
+    REB_SAEXPORT_FIELD_OMEGA_PERI = 11, // Argument of pericenter
+    REB_SAEXPORT_FIELD_POMEGA = 12,     // Longitude of pericenter
+    REB_SAEXPORT_FIELD_F = 13,          // True anomaly
+    REB_SAEXPORT_FIELD_M_ANOMALY = 14,  // Mean anomaly
+    REB_SAEXPORT_FIELD_L = 15,          // Mean longitude
 };
 struct reb_simulation* reb_create_simulation_from_simulationarchive(struct reb_simulationarchive* sa, long snapshot);
 void reb_create_simulation_from_simulationarchive_with_messages(struct reb_simulation* r, struct reb_simulationarchive* sa, long snapshot, enum reb_input_binary_messages* warnings);
+void reb_load_simulation_from_simulationarchive_with_messages(struct reb_simulation* r, struct reb_simulationarchive* sa, long snapshot, long loaded, enum reb_input_binary_messages* warnings); // Loads a snapshot into an existing simulation, reusing its allocations. If r contains the unmodified snapshot `loaded` of the same archive, only the fields which differ between the two snapshots are read. Pass loaded=-1 otherwise. Function pointers and settings not stored in the archive are kept.
+struct reb_simulation* reb_simulationarchive_get_simulation_exact(struct reb_simulationarchive* sa, double t, void (*setup)(struct reb_simulation* const r)); // Returns a new simulation integrated from the last snapshot before t to exactly t. The archive keeps the simulation it integrated and continues from it if the next t is later and before the next snapshot. setup (can be NULL) is called on every simulation created, e.g. to set additional forces.
+int reb_simulationarchive_integrate_full_steps(struct reb_simulation* const r, double tmax); // Used internally. Takes the same timesteps as reb_integrate() with exact_finish_time=1 but stops before the last, shortened, timestep. Returns 0 on success.
+enum reb_input_binary_messages reb_simulationarchive_serialize_particle_data(struct reb_simulationarchive* sa, const long* snapshots, const int N_snapshots, const int N, int N_threads, double* m, double (*xyz)[3], double (*vxvyvz)[3]); // Loads the particle data of N_snapshots snapshots (each with N particles) into arrays of length N_snapshots*N using N_threads threads (0: one per processor). NULL pointers will not be set.
+enum reb_input_binary_messages reb_simulationarchive_export(struct reb_simulationarchive* sa, const char* filename, const enum REB_SAEXPORT_FIELD* fields, const int N_fields, const int particle_major, int N_threads); // Writes the fields of all particles (excluding variational particles) in all snapshots to a file. Each field is an array of doubles with shape (N_snapshots, N) or, if particle_major=1, (N, N_snapshots).
 struct reb_simulationarchive* reb_open_simulationarchive(const char* filename);
 void reb_close_simulationarchive(struct reb_simulationarchive* sa);
 void reb_simulationarchive_snapshot(struct reb_simulation* r, const char* filename);
 void reb_simulationarchive_automate_interval(struct reb_simulation* const r, const char* filename, double interval);
 void reb_simulationarchive_automate_walltime(struct reb_simulation* const r, const char* filename, double walltime);
 void reb_simulationarchive_automate_step(struct reb_simulation* const r, const char* filename, unsigned long long step);
+void reb_simulationarchive_checkpoint(struct reb_simulation* const r, const char* filename, int N);
+void reb_simulationarchive_automate_checkpoint(struct reb_simulation* const r, const char* filename, double walltime, int N);
 void reb_free_simulationarchive_pointers(struct reb_simulationarchive* sa);
+struct reb_simulationarchive_stream* reb_simulationarchive_stream_create(int fd); // Creates a stream on an open file descriptor. Use a stream either for writing or for reading.
+void reb_simulationarchive_stream_free(struct reb_simulationarchive_stream* s); // Frees the stream. The file descriptor is not closed.
+int reb_simulationarchive_stream_write(struct reb_simulationarchive_stream* s, struct reb_simulation* const r); // Writes a snapshot to the stream. The first snapshot is the full binary, later snapshots are diffs. Nothing is ever written twice. Returns 0 on success, -1 on error.
+int reb_simulationarchive_stream_read_with_messages(struct reb_simulationarchive_stream* s, struct reb_simulation* r, enum reb_input_binary_messages* warnings); // Blocks until the next snapshot has been received and loads it into r. Returns 1 if a snapshot has been loaded, 0 at the end of the stream or on error (see warnings), -1 if the file descriptor is non-blocking and no complete snapshot is available yet.
+
+// Ensemble of simulations which are integrated together. 
+// WHFast simulations with the same number of particles, timestep and settings are advanced in lockstep.
+struct reb_ensemble {
+    int N;                                  // Number of simulations
+    struct reb_simulation** simulations;    // Simulations in the ensemble (not owned by the ensemble)
+    struct reb_simulation** running;        // Internal work array
+};
+struct reb_ensemble* reb_create_ensemble(struct reb_simulation** const simulations, const int N); // allocates memory, then calls reb_init_ensemble
+void reb_init_ensemble(struct reb_ensemble* const e, struct reb_simulation** const simulations, const int N);
+void reb_free_ensemble(struct reb_ensemble* const e);            // Frees the ensemble but not the simulations
+void reb_free_ensemble_pointers(struct reb_ensemble* const e);
+void reb_ensemble_step(struct reb_ensemble* const e);            // Advances every simulation by one timestep
+void reb_ensemble_integrate(struct reb_ensemble* const e, const double tmax); // Same as reb_integrate for every simulation. The exit status of each simulation is stored in its status field.
+// Result of one simulation integrated by reb_ensemble_run
+struct reb_ensemble_result {
+    int status;         // Exit status (enum REB_STATUS). REB_EXIT_SIGINT if the simulation was interrupted or never started.
+    double t;           // Time at the end of the integration
+    double megno;       // MEGNO at the end of the integration (NaN if MEGNO was not calculated)
+    double lyapunov;    // Lyapunov exponent at the end of the integration (NaN if MEGNO was not calculated)
+    double walltime;    // Walltime spent on the integration in seconds
+};
+int reb_ensemble_run(struct reb_simulation* const template_simulation, const int N, void (*setup)(struct reb_simulation* const r, const int index, void* data), void* data, const double tmax, int N_threads, struct reb_ensemble_result* const results, struct reb_simulation** const simulations); // Creates N simulations (copies of template_simulation if not NULL, then passed to setup if not NULL) and integrates them to tmax using N_threads threads (0: one per processor). If simulations is not NULL, simulations[i] is used for the i-th run if it is not NULL; otherwise a new simulation is created and stored there. The caller needs to free these simulations. Returns the number of simulations which have been integrated.
+// Parameters which can be varied by reb_ensemble_sweep
+enum REB_ENSEMBLE_PARAMETER {
+    REB_ENSEMBLE_PARAMETER_MASS = 0,
+    REB_ENSEMBLE_PARAMETER_RADIUS = 1,
+    REB_ENSEMBLE_PARAMETER_X = 2,
+    REB_ENSEMBLE_PARAMETER_Y = 3,
+    REB_ENSEMBLE_PARAMETER_Z = 4,
+    REB_ENSEMBLE_PARAMETER_VX = 5,
+    REB_ENSEMBLE_PARAMETER_VY = 6,
+    REB_ENSEMBLE_PARAMETER_VZ = 7,
+    // Orbital elements are relative to the center of mass of all particles with a lower index (Jacobi coordinates).
+    REB_ENSEMBLE_PARAMETER_A = 8,       // Semi-major axis
+    REB_ENSEMBLE_PARAMETER_E = 9,       // Eccentricity
+    REB_ENSEMBLE_PARAMETER_INC = 10,    // Inclination
+    REB_ENSEMBLE_PARAMETER_OMEGA = 11,  // Longitude of the ascending node (Omega)
+    REB_ENSEMBLE_PARAMETER_PERI = 12,   // Argument of pericenter (omega)
+    REB_ENSEMBLE_PARAMETER_F = 13,      // True anomaly
+    REB_ENSEMBLE_PARAMETER_M = 14,      // Mean anomaly
+};
+struct reb_ensemble_parameter {
+    int particle;                       // Index of the particle in the template simulation
+    enum REB_ENSEMBLE_PARAMETER type;
+    const double* values;               // One value for each simulation
+};
+int reb_ensemble_sweep(const struct reb_simulation* const template_simulation, const int N, const struct reb_ensemble_parameter* const parameters, const int N_parameters, const double tmax, int N_threads, struct reb_ensemble_result* const results, struct reb_particle* const particles, const char* filename); // Creates N copies of template_simulation, sets the parameters of the i-th copy to values[i] and integrates them to tmax. Each thread integrates a chunk of simulations at a time in lockstep, as reb_ensemble_integrate does. Masses, radii and coordinates are set before orbital elements. If particles is not NULL, the final state of the real particles of every simulation is stored there (N times the number of real particles in the template). If filename is not NULL, it is a format string containing %d and every simulation is saved to the SimulationArchive filename%index. Simulations whose SimulationArchive already exists are not integrated again. Function pointers are not copied. Returns the number of simulations which have been integrated.
+#ifdef MPI
+int reb_ensemble_run_mpi(struct reb_simulation* const template_simulation, const int N, void (*setup)(struct reb_simulation* const r, const int index, void* data), void* data, const double tmax, struct reb_ensemble_result* const results, const char* filename); // Same as reb_ensemble_run but distributes the simulations over all MPI nodes. Needs to be called by all nodes. Node 0 hands out the work, all other nodes integrate one simulation at a time. If filename is not NULL, it is a format string containing %d and every simulation is saved to the SimulationArchive filename%index after it has been integrated. Simulations whose SimulationArchive already exists are not integrated again. Their results are read from the file. The results are returned on all nodes.
+#endif // MPI
+
+// Tuning of integrator parameters
+// Parameters which can be tuned by reb_tune
+enum REB_TUNE_PARAMETER {
+    REB_TUNE_PARAMETER_DT = 0,                  // Timestep of integrators with a fixed timestep (WHFast, SABA, EOS, Leapfrog, MERCURIUS, ...)
+    REB_TUNE_PARAMETER_IAS15_EPSILON = 1,       // ri_ias15.epsilon (IAS15, and MERCURIUS during close encounters)
+    REB_TUNE_PARAMETER_MERCURIUS_HILLFAC = 2,   // ri_mercurius.hillfac
+    REB_TUNE_PARAMETER_OPENING_ANGLE2 = 3,      // opening_angle2 (REB_GRAVITY_TREE and REB_GRAVITY_FMM)
+};
+// Result of one pilot integration of reb_tune
+struct reb_tune_result {
+    double value;       // Value of the parameter
+    double error;       // Largest relative energy error during the pilot integration
+    double walltime;    // Walltime spent on the pilot integration in seconds (without the energy calculations)
+    double t;           // Time at the end of the pilot integration. Less than the pilot time if the error target was exceeded or the pilot exited early.
+    int status;         // Exit status of the pilot integration (enum REB_STATUS)
+};
+int reb_tune(struct reb_simulation* const r, const enum REB_TUNE_PARAMETER parameter, const double* const values, const int N_values, const double t_pilot, const double error_target, const int apply, void (*setup)(struct reb_simulation* const r), struct reb_tune_result* const results); // Integrates a copy of r from r->t to r->t+t_pilot for every value of the parameter and returns the index of the value with the shortest walltime whose relative energy error stays below error_target, or -1 if no value meets the target. If apply is 1, the parameter of r is set to this value. setup (can be NULL) is called on every copy, e.g. to set additional forces. results (can be NULL) needs space for N_values results.
+
+// Time-parallel (Parareal) integration
+// Result of reb_integrate_parareal
+struct reb_parareal_result {
+    int iterations;     // Number of Parareal iterations (each with one parallel round of fine integrations)
+    double error;       // Largest relative change of the state at the start of a time slice in the last iteration
+    int converged;      // 1 if error is smaller than the tolerance (or all slices have been integrated with the fine propagator)
+    double walltime;    // Walltime in seconds
+};
+int reb_integrate_parareal(struct reb_simulation* const fine, const struct reb_simulation* const coarse, const double tmax, const int N_slices, const double tolerance, const int max_iterations, int N_threads, struct reb_parareal_result* const result); // Integrates fine to tmax by splitting the interval into N_slices time slices which are integrated in parallel using N_threads threads (0: one per processor). Copies of fine are used as the fine propagator, copies of coarse (e.g. the same integrator with a larger timestep) as the coarse propagator. Iterates until the relative change of all slice states is smaller than tolerance or max_iterations is reached. On return, fine contains the state at tmax. Returns 0 if converged, 1 if not converged, -1 on error. Supported integrators: IAS15, WHFast, SABA, Leapfrog. The number of particles must not change.
 
 
 // Functions to between coordinate systems
@@ -968,6 +1578,7 @@ void reb_free_simulationarchive_pointers(struct reb_simulationarchive* sa);
 // p_mass: Should be the same particles array as ps for real particles. If passing variational
 //         particles in ps, p_mass should be the corresponding array of real particles.
 void reb_transformations_inertial_to_jacobi_posvel(const struct reb_particle* const particles, struct reb_particle* const p_j, const struct reb_particle* const p_mass, const unsigned int N, const int N_active);
+void reb_transformations_inertial_to_jacobi_posvel_from(const struct reb_particle* const particles, struct reb_particle* const p_j, const struct reb_particle* const p_mass, const unsigned int N, const int N_active, const unsigned int first); // Same as above, but only particles first to N-1 (and p_j[0]) are updated.
 void reb_transformations_inertial_to_jacobi_posvelacc(const struct reb_particle* const particles, struct reb_particle* const p_j, const struct reb_particle* const p_mass, const unsigned int N, const int N_active);
 void reb_transformations_inertial_to_jacobi_acc(const struct reb_particle* const particles, struct reb_particle* const p_j,const struct reb_particle* const p_mass, const unsigned int N, const int N_active);
 void reb_transformations_jacobi_to_inertial_posvel(struct reb_particle* const particles, const struct reb_particle* const p_j, const struct reb_particle* const p_mass, const unsigned int N, const int N_active);
@@ -987,11 +1598,46 @@ void reb_transformations_whds_to_inertial_posvel(struct reb_particle* const part
 #ifdef MPI
 void reb_mpi_init(struct reb_simulation* const r);
 void reb_mpi_finalize(struct reb_simulation* const r);
+
+/**
+ * @brief Saves the particles of all nodes to one binary file using MPI-IO. 
+ * @details This function needs to be called by all nodes. Node 0 writes the 
+ * simulation settings, every node writes its particles into its own part of the 
+ * file. The file can be read with reb_create_simulation_from_binary() or, in 
+ * parallel, with reb_input_binary_mpi(). Variational particles are not supported.
+ * @param r The rebound simulation to be considered
+ * @param filename Filename of the binary file.
+ * @return 0 on success, -1 on error.
+ */
+int reb_output_binary_mpi(struct reb_simulation* r, const char* filename);
+
+/**
+ * @brief Reads a binary file in parallel using MPI-IO.
+ * @details This function needs to be called by all nodes after reb_mpi_init(). 
+ * The simulation needs to be empty and set up with the same root boxes as the 
+ * simulation which was saved. Every node reads a part of the particles and sends 
+ * them to the node which owns their root box. 
+ * @param r The rebound simulation to be considered
+ * @param filename Filename of the binary file.
+ * @return 0 on success, -1 on error.
+ */
+int reb_input_binary_mpi(struct reb_simulation* const r, const char* filename);
 #endif // MPI
 
 #ifdef OPENMP
 // Wrapper method to set number of OpenMP threads from python.
 void reb_omp_set_num_threads(int num_threads);
+// Loops over fewer than reb_omp_min_N particles run serially. Forking threads costs more than it saves for small N. Default: 0.
+extern int reb_omp_min_N;
+void reb_omp_set_min_N(int N);
+/**
+ * @brief Pins the OpenMP threads to CPUs.
+ * @details Thread t is pinned to cpus[t%N_cpus], or to CPU t if cpus is NULL.
+ * Pinning only lasts as long as the OpenMP runtime keeps its threads, i.e. as long
+ * as the number of threads does not change. Alternatively, set OMP_PROC_BIND and OMP_PLACES.
+ * @return 0 on success, -1 on error or if not supported (Linux only).
+ */
+int reb_omp_pin_threads(const int* cpus, int N_cpus);
 #endif // OPENMP
 
 // The following stuctures are related to OpenGL/WebGL visualization. Nothing to be changed by the user.
@@ -1004,26 +1650,44 @@ struct reb_particle_opengl {
     float r;
 };
 struct reb_orbit_opengl {
-    float x,y,z;
-    float a, e, f;
-    float omega, Omega, inc;
+    float x,y,z;        // Position of the primary (centre of mass of all interior particles)
+    float dx,dy,dz;     // Position relative to the primary
+    float dvx,dvy,dvz;  // Velocity relative to the primary
+    float gm;           // G*(m_primary+m)
+};
+
+// Snapshot of the simulation which is passed from the compute thread to the display thread.
+struct reb_display_buffer {
+    struct reb_simulation r;                // Shallow copy of the simulation. Pointers other than particles and ri_whfast.p_jh are not valid.
+    struct reb_particle* particles;
+    struct reb_particle* p_jh;              // Only used if WHFast is not synchronized.
+    unsigned long allocated_N;
+    unsigned long allocated_N_whfast;
 };
 
 struct reb_display_data {
     struct reb_simulation* r;
-    struct reb_simulation* r_copy;
+    struct reb_simulation* r_copy;          // Snapshot currently drawn. Points to buffers[buffer_front].r.
     struct reb_particle_opengl* particle_data;
     struct reb_orbit_opengl* orbit_data;
-    struct reb_particle* particles_copy;
-    struct reb_particle* p_jh_copy;
     unsigned long allocated_N;
-    unsigned long allocated_N_whfast;
+    unsigned int N_draw;                    // Number of particles in particle_data.
+    unsigned int N_orbits_draw;             // Number of orbits in orbit_data.
     unsigned int opengl_enabled;
     double scale;
     double mouse_x;
     double mouse_y;
     double retina;
-    pthread_mutex_t mutex;          // Mutex to guarantee non-flickering
+    char* frame;                            // Compact frame for the WebGL widget. Filled by reb_display_prepare_frame().
+    unsigned long frame_size;               // Size of frame in bytes.
+    unsigned long frame_allocated;          // Allocated size of frame in bytes.
+    unsigned long frame_clock;              // Time in ms when the last frame was prepared.
+    unsigned int frame_interval;            // Minimum time in ms between two frames.
+    struct reb_display_buffer buffers[3];   // Triple buffer. Neither thread ever waits for the other one.
+    int buffer_back;                        // Buffer written by the compute thread.
+    int buffer_front;                       // Buffer read by the display thread.
+    int buffer_ready;                       // Index of the third buffer. Flagged with REB_DISPLAY_BUFFER_NEW if it holds a newer snapshot than buffer_front. Only accessed atomically.
+    unsigned long buffer_clock;             // Time in ms when the compute thread last published a snapshot.
     int spheres;                    // Switches between point sprite and real spheres.
     int pause;                      // Pauses visualization, but keep simulation running
     int wire;                       // Shows/hides orbit wires.
@@ -1033,6 +1697,8 @@ struct reb_display_data {
     int clear;                      // Toggles clearing the display on each draw.
     int ghostboxes;                 // Shows/hides ghost boxes.
     int reference;                  // reb_particle used as a reference for centering.
+    int lod;                        // Level of detail. Only every 2^lod-th particle (and orbit) is drawn.
+    int lod_auto;                   // If 1, lod is chosen such that at most REB_DISPLAY_N_MAX particles are drawn.
     unsigned int mouse_action;      
     unsigned int key_mods;      
     struct reb_quaternion view;
@@ -0,0 +1,433 @@
+/**
+ * @file    recorder.c
+ * @brief   Buffered binary time series of diagnostics.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details The recorder samples diagnostics such as the energy, angular
+ * momentum, MEGNO or orbital elements at a fixed cadence. Samples are
+ * stored in a preallocated buffer. Once the buffer is full, it is handed
+ * to a background thread which appends it to the file while the
+ * integration continues with a second buffer.
+ *
+ * The file starts with a header:
+ *   char[8] "REBREC1", int32_t N_columns, N_columns names (char[16] each).
+ * It is followed by blocks:
+ *   int32_t N_rows, then N_columns arrays of N_rows doubles each.
+ * The first column is always the simulation time t.
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "rebound.h"
+#include "recorder.h"
+#include "reductions.h"
+
+#define REB_RECORDER_NAME_LENGTH 16
+#define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
+
+struct reb_recorder {
+    FILE* file;
+    unsigned int quantities;        // Bitmask of enum REB_RECORDER_QUANTITY
+    double interval;                // Interval in simulation time (0 if steps is used)
+    unsigned int steps;             // Interval in timesteps (0 if interval is used)
+    double next;                    // Time of the next sample if interval is used
+    unsigned long long last_steps_done; // steps_done of the last sample. Avoids duplicates at the beginning of reb_integrate().
+    uint64_t N_samples;             // Total number of samples
+    int N_orbits;                   // Number of particles for which orbital elements are recorded
+    int N_reduction_values;         // Number of values of registered reductions which are recorded
+    int N_columns;
+    unsigned int capacity;          // Number of rows per buffer
+    double* buffers[2];             // Column major: buffers[k][column*capacity+row]
+    int active;                     // Buffer which is currently filled
+    unsigned int N_rows;            // Number of rows in the active buffer
+
+    // Writer thread
+    int thread_running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;            // Signaled whenever pending, busy or shutdown changes
+    double* pending;                // Buffer waiting to be written. NULL if there is none.
+    unsigned int pending_rows;
+    int busy;                       // 1 while the writer thread writes a block
+    int shutdown;                   // Set to 1 to terminate the writer thread
+    int error;                      // Set to 1 if a write failed
+};
+
+// Writes one block. Returns 0 on success.
+static int reb_recorder_write_block(struct reb_recorder* const rec, const double* const buffer, const unsigned int N_rows){
+    const int32_t rows = N_rows;
+    int error = fwrite(&rows, sizeof(int32_t), 1, rec->file)!=1;
+    for (int c=0; c<rec->N_columns; c++){
+        error |= fwrite(&buffer[(size_t)c*rec->capacity], sizeof(double), N_rows, rec->file)!=N_rows;
+    }
+    error |= fflush(rec->file)!=0;
+    return error;
+}
+
+static void* reb_recorder_writer_thread(void* args){
+    struct reb_recorder* const rec = args;
+    pthread_mutex_lock(&rec->mutex);
+    while (1){
+        while (rec->pending==NULL && rec->shutdown==0){
+            pthread_cond_wait(&rec->cond, &rec->mutex);
+        }
+        if (rec->pending==NULL){
+            break;
+        }
+        const double* const buffer = rec->pending;
+        const unsigned int N_rows = rec->pending_rows;
+        rec->busy = 1;
+        pthread_mutex_unlock(&rec->mutex);
+
+        const int error = reb_recorder_write_block(rec, buffer, N_rows);
+
+        pthread_mutex_lock(&rec->mutex);
+        rec->error |= error;
+        rec->pending = NULL;
+        rec->busy = 0;
+        pthread_cond_broadcast(&rec->cond);
+    }
+    pthread_mutex_unlock(&rec->mutex);
+    return NULL;
+}
+
+// Waits until the writer thread has written all pending blocks.
+static void reb_recorder_wait(struct reb_simulation* const r, struct reb_recorder* const rec){
+    if (!rec->thread_running){
+        return;
+    }
+    pthread_mutex_lock(&rec->mutex);
+    while (rec->pending!=NULL || rec->busy){
+        pthread_cond_wait(&rec->cond, &rec->mutex);
+    }
+    const int error = rec->error;
+    rec->error = 0;
+    pthread_mutex_unlock(&rec->mutex);
+    if (error){
+        reb_error(r, "Error writing to the diagnostics file.");
+    }
+}
+
+// Hands the active buffer to the writer thread and continues with the other buffer.
+static void reb_recorder_submit(struct reb_simulation* const r, struct reb_recorder* const rec){
+    if (rec->N_rows==0){
+        return;
+    }
+    if (!rec->thread_running){
+        if (reb_recorder_write_block(rec, rec->buffers[rec->active], rec->N_rows)){
+            reb_error(r, "Error writing to the diagnostics file.");
+        }
+        rec->N_rows = 0;
+        return;
+    }
+    // The other buffer might still be written.
+    reb_recorder_wait(r, rec);
+    pthread_mutex_lock(&rec->mutex);
+    rec->pending = rec->buffers[rec->active];
+    rec->pending_rows = rec->N_rows;
+    pthread_cond_broadcast(&rec->cond);
+    pthread_mutex_unlock(&rec->mutex);
+    rec->active = 1 - rec->active;
+    rec->N_rows = 0;
+}
+
+static void reb_recorder_name(char* const names, const int column, const char* const name, const int index){
+    char* const n = names + (size_t)column*REB_RECORDER_NAME_LENGTH;
+    if (index>=0){
+        snprintf(n, REB_RECORDER_NAME_LENGTH, "%s%d", name, index);
+    }else{
+        snprintf(n, REB_RECORDER_NAME_LENGTH, "%s", name);
+    }
+}
+
+// Fills in the column names and returns the number of columns. If names is NULL, only the columns are counted.
+static int reb_recorder_columns(const struct reb_simulation* const r, const unsigned int quantities, const int N_orbits, const int N_reduction_values, char* const names){
+    int c = 0;
+    if (names) reb_recorder_name(names, c, "t", -1);
+    c++;
+    if (quantities & REB_RECORDER_ENERGY){
+        if (names) reb_recorder_name(names, c, "E", -1);
+        c++;
+    }
+    if (quantities & REB_RECORDER_ANGULAR_MOMENTUM){
+        if (names){
+            reb_recorder_name(names, c, "Lx", -1);
+            reb_recorder_name(names, c+1, "Ly", -1);
+            reb_recorder_name(names, c+2, "Lz", -1);
+        }
+        c += 3;
+    }
+    if (quantities & REB_RECORDER_MEGNO){
+        if (names){
+            reb_recorder_name(names, c, "megno", -1);
+            reb_recorder_name(names, c+1, "lyapunov", -1);
+        }
+        c += 2;
+    }
+    if (quantities & REB_RECORDER_ORBITS){
+        for (int i=1; i<=N_orbits; i++){
+            if (names){
+                reb_recorder_name(names, c, "a", i);
+                reb_recorder_name(names, c+1, "e", i);
+                reb_recorder_name(names, c+2, "inc", i);
+            }
+            c += 3;
+        }
+    }
+    if (quantities & REB_RECORDER_MIN_DISTANCE){
+        if (names) reb_recorder_name(names, c, "d_min", -1);
+        c++;
+    }
+    if (quantities & REB_RECORDER_REDUCTIONS){
+        int v = 0;
+        for (int k=0; k<r->reductions_N && v<N_reduction_values; k++){
+            const int N_values = r->reductions[k].N_values;
+            for (int j=0; j<N_values && v<N_reduction_values; j++, v++){
+                if (names){
+                    char name[32];
+                    if (N_values==1){
+                        snprintf(name, 32, "red%d", k);
+                    }else{
+                        snprintf(name, 32, "red%d_%d", k, j);
+                    }
+                    const size_t length = MIN(strlen(name), REB_RECORDER_NAME_LENGTH-1);
+                    memcpy(names + (size_t)c*REB_RECORDER_NAME_LENGTH, name, length);
+                }
+                c++;
+            }
+        }
+    }
+    return c;
+}
+
+int reb_recorder_enable(struct reb_simulation* const r, const char* const filename, const unsigned int quantities, const double interval, const unsigned int steps, const unsigned int capacity){
+    reb_recorder_disable(r);
+    if (interval!=0. && steps!=0){
+        reb_error(r, "Only use one of interval and steps for the recorder.");
+        return 1;
+    }
+    if (capacity==0){
+        reb_error(r, "The capacity of the recorder needs to be larger than zero.");
+        return 1;
+    }
+#ifdef MPI
+    char filename_mpi[1024];
+    snprintf(filename_mpi, 1024, "%s_%d", filename, r->mpi_id);
+    FILE* file = fopen(filename_mpi, "wb");
+#else // MPI
+    FILE* file = fopen(filename, "wb");
+#endif // MPI
+    if (file==NULL){
+        reb_error(r, "Can not open file.");
+        return 1;
+    }
+    struct reb_recorder* const rec = calloc(1, sizeof(struct reb_recorder));
+    rec->file = file;
+    rec->quantities = quantities;
+    rec->interval = interval;
+    rec->steps = steps;
+    rec->next = r->t;
+    rec->N_orbits = (quantities & REB_RECORDER_ORBITS)?(r->N - r->N_var - 1):0;
+    if (rec->N_orbits<0){
+        rec->N_orbits = 0;
+    }
+    rec->N_reduction_values = (quantities & REB_RECORDER_REDUCTIONS)?reb_reductions_N_values(r):0;
+    rec->N_columns = reb_recorder_columns(r, quantities, rec->N_orbits, rec->N_reduction_values, NULL);
+    rec->capacity = capacity;
+    for (int k=0; k<2; k++){
+        rec->buffers[k] = malloc(sizeof(double)*rec->N_columns*capacity);
+    }
+
+    char* const names = calloc(rec->N_columns, REB_RECORDER_NAME_LENGTH);
+    reb_recorder_columns(r, quantities, rec->N_orbits, rec->N_reduction_values, names);
+    char magic[8] = "REBREC1";
+    const int32_t N_columns = rec->N_columns;
+    int error = fwrite(magic, sizeof(char), 8, file)!=8;
+    error |= fwrite(&N_columns, sizeof(int32_t), 1, file)!=1;
+    error |= fwrite(names, REB_RECORDER_NAME_LENGTH, rec->N_columns, file)!=(size_t)rec->N_columns;
+    error |= fflush(file)!=0;
+    free(names);
+    r->recorder = rec;
+    if (error){
+        reb_error(r, "Error writing to the diagnostics file.");
+        reb_recorder_disable(r);
+        return 1;
+    }
+
+    pthread_mutex_init(&rec->mutex, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    if (pthread_create(&rec->thread, NULL, reb_recorder_writer_thread, rec)){
+        pthread_mutex_destroy(&rec->mutex);
+        pthread_cond_destroy(&rec->cond);
+        reb_warning(r, "Cannot create recorder thread. Diagnostics are written synchronously.");
+    }else{
+        rec->thread_running = 1;
+    }
+    return 0;
+}
+
+void reb_recorder_sample(struct reb_simulation* const r){
+    struct reb_recorder* const rec = r->recorder;
+    if (rec==NULL){
+        return;
+    }
+    const unsigned int row = rec->N_rows;
+    double* const buffer = rec->buffers[rec->active];
+    const size_t capacity = rec->capacity;
+    int c = 0;
+    buffer[c++*capacity+row] = r->t;
+    const unsigned int quantities = rec->quantities;
+    if (quantities & (REB_RECORDER_ENERGY | REB_RECORDER_ANGULAR_MOMENTUM)){
+        const struct reb_diagnostics d = reb_tools_diagnostics(r, 0);
+        if (quantities & REB_RECORDER_ENERGY){
+            buffer[c++*capacity+row] = d.energy;
+        }
+        if (quantities & REB_RECORDER_ANGULAR_MOMENTUM){
+            buffer[c++*capacity+row] = d.angular_momentum.x;
+            buffer[c++*capacity+row] = d.angular_momentum.y;
+            buffer[c++*capacity+row] = d.angular_momentum.z;
+        }
+    }
+    if (quantities & REB_RECORDER_MEGNO){
+        const int megno = r->calculate_megno;
+        buffer[c++*capacity+row] = megno?reb_tools_calculate_megno(r):NAN;
+        buffer[c++*capacity+row] = megno?reb_tools_calculate_lyapunov(r):NAN;
+    }
+    if (quantities & REB_RECORDER_ORBITS){
+        // Jacobi coordinates, as in reb_output_orbits(). Particles which have been removed are recorded as NaN.
+        const int N_real = r->N - r->N_var;
+        struct reb_particle com = r->particles[0];
+        for (int i=1; i<=rec->N_orbits; i++){
+            if (i<N_real){
+                const struct reb_orbit o = reb_tools_particle_to_orbit(r->G, r->particles[i], com);
+                com = reb_get_com_of_pair(com, r->particles[i]);
+                buffer[c++*capacity+row] = o.a;
+                buffer[c++*capacity+row] = o.e;
+                buffer[c++*capacity+row] = o.inc;
+            }else{
+                buffer[c++*capacity+row] = NAN;
+                buffer[c++*capacity+row] = NAN;
+                buffer[c++*capacity+row] = NAN;
+            }
+        }
+    }
+    if (quantities & REB_RECORDER_MIN_DISTANCE){
+        const int N_real = r->N - r->N_var;
+        const struct reb_particle* const particles = r->particles;
+        double d2_min = INFINITY;
+        for (int i=0; i<N_real; i++){
+            for (int j=i+1; j<N_real; j++){
+                const double dx = particles[i].x - particles[j].x;
+                const double dy = particles[i].y - particles[j].y;
+                const double dz = particles[i].z - particles[j].z;
+                const double d2 = dx*dx + dy*dy + dz*dz;
+                if (d2<d2_min){
+                    d2_min = d2;
+                }
+            }
+        }
+        buffer[c++*capacity+row] = sqrt(d2_min);
+    }
+    if (quantities & REB_RECORDER_REDUCTIONS){
+        // Reductions registered after the recorder was enabled are not recorded. Removed ones are recorded as NaN.
+        reb_calculate_reductions(r);
+        int v = 0;
+        for (int k=0; k<r->reductions_N && v<rec->N_reduction_values; k++){
+            for (int j=0; j<r->reductions[k].N_values && v<rec->N_reduction_values; j++, v++){
+                buffer[c++*capacity+row] = r->reductions[k].values[j];
+            }
+        }
+        for (; v<rec->N_reduction_values; v++){
+            buffer[c++*capacity+row] = NAN;
+        }
+    }
+    rec->N_rows++;
+    rec->N_samples++;
+    rec->last_steps_done = r->steps_done;
+    if (rec->N_rows==rec->capacity){
+        reb_recorder_submit(r, rec);
+    }
+}
+
+void reb_recorder_heartbeat(struct reb_simulation* const r){
+    struct reb_recorder* const rec = r->recorder;
+    if (rec->N_samples && rec->last_steps_done==r->steps_done){
+        return;
+    }
+    if (rec->steps){
+        if (r->steps_done%rec->steps==0){
+            reb_recorder_sample(r);
+        }
+    }else if (rec->interval!=0.){
+        const double sign = r->dt>0.?1.:-1;
+        if (sign*rec->next <= sign*r->t){
+            reb_recorder_sample(r);
+            // Skip samples which have been missed because the timestep is larger than the interval.
+            while (sign*rec->next <= sign*r->t){
+                rec->next += sign*fabs(rec->interval);
+            }
+        }
+    }else{
+        reb_recorder_sample(r);
+    }
+}
+
+unsigned int reb_recorder_steps_until_sample(const struct reb_simulation* const r){
+    const struct reb_recorder* const rec = r->recorder;
+    if (rec->steps==0){
+        return 1;
+    }
+    return rec->steps - r->steps_done%rec->steps;
+}
+
+void reb_recorder_flush(struct reb_simulation* const r){
+    struct reb_recorder* const rec = r->recorder;
+    if (rec==NULL){
+        return;
+    }
+    reb_recorder_submit(r, rec);
+    reb_recorder_wait(r, rec);
+}
+
+void reb_recorder_disable(struct reb_simulation* const r){
+    struct reb_recorder* const rec = r->recorder;
+    if (rec==NULL){
+        return;
+    }
+    reb_recorder_flush(r);
+    if (rec->thread_running){
+        pthread_mutex_lock(&rec->mutex);
+        rec->shutdown = 1;
+        pthread_cond_broadcast(&rec->cond);
+        pthread_mutex_unlock(&rec->mutex);
+        pthread_join(rec->thread, NULL);
+        pthread_mutex_destroy(&rec->mutex);
+        pthread_cond_destroy(&rec->cond);
+    }
+    fclose(rec->file);
+    free(rec->buffers[0]);
+    free(rec->buffers[1]);
+    free(rec);
+    r->recorder = NULL;
+}
@@ -0,0 +1,40 @@
+/**
+ * @file    recorder.h
+ * @brief   Buffered binary time series of diagnostics.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _RECORDER_H
+#define _RECORDER_H
+struct reb_simulation;
+
+/**
+ * @brief Records a sample if one is due. Called from reb_run_heartbeat().
+ */
+void reb_recorder_heartbeat(struct reb_simulation* const r);
+
+/**
+ * @brief Number of steps which can be taken before the next sample is due.
+ * @details Returns 1 if the samples are taken at fixed intervals in simulation time.
+ */
+unsigned int reb_recorder_steps_until_sample(const struct reb_simulation* const r);
+
+#endif // _RECORDER_H
@@ -0,0 +1,274 @@
+/**
+ * @file    reductions.c
+ * @brief   In-situ reductions over particle quantities.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details Reductions registered with reb_add_reduction() (sums, moments, 
+ * histograms and binned profiles of particle quantities) are evaluated 
+ * together in a single pass over the particles. The particles are split 
+ * into chunks and all reductions are evaluated for one chunk before moving 
+ * on to the next. Every thread accumulates into its own buffer. The buffers 
+ * are added up at the end.
+ * Moments are accumulated relative to the value of the first particle to 
+ * reduce round-off errors.
+ * 
+ * @section     LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "rebound.h"
+#include "reductions.h"
+#ifdef MPI
+#include "communication_mpi.h"
+#include "mpi.h"
+#endif // MPI
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
+
+#define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
+
+/**
+ * @brief Number of particles processed by one thread at a time.
+ */
+#define REB_REDUCTIONS_CHUNK 1024
+
+static inline double reb_reduction_field(const struct reb_simulation* const r, const enum REB_REDUCTION_FIELD field, const struct reb_particle* const p){
+    switch (field){
+        case REB_REDUCTION_ONE:
+            return 1.;
+        case REB_REDUCTION_X:
+            return p->x;
+        case REB_REDUCTION_Y:
+            return p->y;
+        case REB_REDUCTION_Z:
+            return p->z;
+        case REB_REDUCTION_VX:
+            return p->vx;
+        case REB_REDUCTION_VY:
+            return p->vy;
+        case REB_REDUCTION_VZ:
+            return p->vz;
+        case REB_REDUCTION_M:
+            return p->m;
+        case REB_REDUCTION_R:
+            return p->r;
+        case REB_REDUCTION_RXY:
+            return sqrt(p->x*p->x + p->y*p->y);
+        case REB_REDUCTION_VY_SHEAR:
+            return r->integrator==REB_INTEGRATOR_SEI ? p->vy+1.5*r->ri_sei.OMEGA*p->x : p->vy;
+        case REB_REDUCTION_VX_VY_SHEAR:
+            return p->vx*(r->integrator==REB_INTEGRATOR_SEI ? p->vy+1.5*r->ri_sei.OMEGA*p->x : p->vy);
+        case REB_REDUCTION_AREA:
+            return M_PI*p->r*p->r;
+        case REB_REDUCTION_MIDPLANE_AREA:
+            {
+                const double R2 = p->r*p->r - p->z*p->z;
+                return R2>0. ? M_PI*R2 : 0.;
+            }
+    }
+    return 0.;
+}
+
+// Returns the bin of v or -1 if v is outside of [min, max). scale is N_bins/(max-min).
+static inline int reb_reduction_bin(const struct reb_reduction* const red, const double scale, const double v){
+    const double f = (v-red->min)*scale;
+    if (f>=0. && f<red->N_bins){
+        return (int)f;
+    }
+    return -1;
+}
+
+static inline int reb_reductions_thread_num(void){
+#ifdef OPENMP
+    return omp_get_thread_num();
+#else // OPENMP
+    return 0;
+#endif // OPENMP
+}
+
+int reb_add_reduction(struct reb_simulation* const r, enum REB_REDUCTION_TYPE type, enum REB_REDUCTION_FIELD field, enum REB_REDUCTION_FIELD bin_field, double min, double max, int N_bins){
+    const int binned = type==REB_REDUCTION_HISTOGRAM || type==REB_REDUCTION_PROFILE;
+    if (type<REB_REDUCTION_SUM || type>REB_REDUCTION_PROFILE
+            || field<REB_REDUCTION_ONE || field>REB_REDUCTION_MIDPLANE_AREA
+            || bin_field<REB_REDUCTION_ONE || bin_field>REB_REDUCTION_MIDPLANE_AREA
+            || (binned && (N_bins<1 || !(max>min)))){
+        reb_error(r, "Invalid arguments passed to reb_add_reduction().");
+        return -1;
+    }
+    if (r->reductions_allocatedN<=r->reductions_N){
+        r->reductions_allocatedN = r->reductions_allocatedN?2*r->reductions_allocatedN:4;
+        r->reductions = realloc(r->reductions, sizeof(struct reb_reduction)*r->reductions_allocatedN);
+    }
+    int N_values = N_bins;
+    if (type==REB_REDUCTION_SUM){
+        N_values = 1;
+    }else if (type==REB_REDUCTION_MOMENTS){
+        N_values = 3;
+    }
+    r->reductions[r->reductions_N] = (struct reb_reduction){
+        .type = type,
+        .field = field,
+        .bin_field = bin_field,
+        .min = min,
+        .max = max,
+        .N_bins = binned?N_bins:0,
+        .N_values = N_values,
+        .values = calloc(N_values, sizeof(double)),
+    };
+    return r->reductions_N++;
+}
+
+void reb_remove_reductions(struct reb_simulation* const r){
+    for (int k=0; k<r->reductions_N; k++){
+        free(r->reductions[k].values);
+    }
+    free(r->reductions);
+    r->reductions = NULL;
+    r->reductions_N = 0;
+    r->reductions_allocatedN = 0;
+}
+
+int reb_reductions_N_values(const struct reb_simulation* const r){
+    int N_values = 0;
+    for (int k=0; k<r->reductions_N; k++){
+        N_values += r->reductions[k].N_values;
+    }
+    return N_values;
+}
+
+void reb_calculate_reductions(struct reb_simulation* const r){
+    const int reductions_N = r->reductions_N;
+    if (reductions_N==0){
+        return;
+    }
+    // Variational particles are not included.
+    const int N = r->N - r->N_var;
+    const struct reb_particle* const particles = r->particles;
+    const struct reb_reduction* const reductions = r->reductions;
+    int* const offset = malloc(sizeof(int)*reductions_N);
+    double* const shift = malloc(sizeof(double)*reductions_N);
+    int N_values = 0;
+    for (int k=0; k<reductions_N; k++){
+        offset[k] = N_values;
+        N_values += reductions[k].N_values;
+        shift[k] = 0.;
+#ifndef MPI
+        // With MPI, all nodes need to use the same shift.
+        if (reductions[k].type==REB_REDUCTION_MOMENTS && N>0){
+            shift[k] = reb_reduction_field(r, reductions[k].field, &particles[0]);
+        }
+#endif // MPI
+    }
+#ifdef OPENMP
+    const int N_threads = omp_get_max_threads();
+#else // OPENMP
+    const int N_threads = 1;
+#endif // OPENMP
+    double* const acc = calloc((size_t)N_threads*N_values, sizeof(double));
+
+#pragma omp parallel for schedule(static)
+    for (int cstart=0; cstart<N; cstart+=REB_REDUCTIONS_CHUNK){
+        const int cend = MIN(cstart+REB_REDUCTIONS_CHUNK, N);
+        double* const a = acc + (size_t)N_values*reb_reductions_thread_num();
+        // All reductions are evaluated for one chunk while it is in cache.
+        for (int k=0; k<reductions_N; k++){
+            const struct reb_reduction* const red = &reductions[k];
+            const enum REB_REDUCTION_FIELD field = red->field;
+            const double scale = red->N_bins?red->N_bins/(red->max-red->min):0.;
+            double* const ak = a + offset[k];
+            switch (red->type){
+                case REB_REDUCTION_SUM:
+                    {
+                        double sum = 0.;
+                        for (int i=cstart; i<cend; i++){
+                            sum += reb_reduction_field(r, field, &particles[i]);
+                        }
+                        ak[0] += sum;
+                    }
+                    break;
+                case REB_REDUCTION_MOMENTS:
+                    {
+                        const double s = shift[k];
+                        double sum = 0.;
+                        double sum2 = 0.;
+                        for (int i=cstart; i<cend; i++){
+                            const double d = reb_reduction_field(r, field, &particles[i]) - s;
+                            sum += d;
+                            sum2 += d*d;
+                        }
+                        ak[0] += cend-cstart;
+                        ak[1] += sum;
+                        ak[2] += sum2;
+                    }
+                    break;
+                case REB_REDUCTION_HISTOGRAM:
+                    for (int i=cstart; i<cend; i++){
+                        const int j = reb_reduction_bin(red, scale, reb_reduction_field(r, field, &particles[i]));
+                        if (j>=0){
+                            ak[j] += 1.;
+                        }
+                    }
+                    break;
+                case REB_REDUCTION_PROFILE:
+                    for (int i=cstart; i<cend; i++){
+                        const int j = reb_reduction_bin(red, scale, reb_reduction_field(r, red->bin_field, &particles[i]));
+                        if (j>=0){
+                            ak[j] += reb_reduction_field(r, field, &particles[i]);
+                        }
+                    }
+                    break;
+            }
+        }
+    }
+    for (int t=1; t<N_threads; t++){
+        for (int v=0; v<N_values; v++){
+            acc[v] += acc[(size_t)t*N_values+v];
+        }
+    }
+#ifdef MPI
+    MPI_Allreduce(MPI_IN_PLACE, acc, N_values, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif // MPI
+
+    for (int k=0; k<reductions_N; k++){
+        const struct reb_reduction* const red = &reductions[k];
+        const double* const ak = acc + offset[k];
+        double* const values = red->values;
+        if (red->type==REB_REDUCTION_MOMENTS){
+            const double n = ak[0];
+            values[0] = n;
+            values[1] = 0.;
+            values[2] = 0.;
+            if (n>0.){
+                const double mean = ak[1]/n;
+                const double variance = ak[2]/n - mean*mean;
+                values[1] = shift[k] + mean;
+                values[2] = variance>0. ? variance : 0.;
+            }
+        }else{
+            for (int v=0; v<red->N_values; v++){
+                values[v] = ak[v];
+            }
+        }
+    }
+    free(acc);
+    free(shift);
+    free(offset);
+}
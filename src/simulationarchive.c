@@ -30,17 +30,171 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
 #include "particle.h"
 #include "rebound.h"
 #include "binarydiff.h"
+#include "compression.h"
 #include "output.h"
 #include "tools.h"
 #include "input.h"
+#include "simulationarchive.h"
+#include "tree.h"
+#include "collision.h"
+#include "profiling.h"
 #include "output.h"
 #include "integrator_ias15.h"
+#include "allocator.h"
 
 
+// The following functions read from the memory mapped file if available.
+// Otherwise they fall back to the file stream. They behave like fread,
+// fseek, and ftell. In particular, seeking past the end of the file is not
+// an error but the next read fails.
+static size_t reb_simulationarchive_fread(void* ptr, size_t size, size_t nitems, struct reb_simulationarchive* sa){
+    if (sa->mmap_data){
+        const size_t available = sa->mmap_pos<sa->mmap_size ? sa->mmap_size-sa->mmap_pos : 0;
+        if (size==0) return 0;
+        if (nitems > available/size){
+            nitems = available/size;
+        }
+        memcpy(ptr, sa->mmap_data+sa->mmap_pos, size*nitems);
+        sa->mmap_pos += size*nitems;
+        return nitems;
+    }
+    return fread(ptr, size, nitems, sa->inf);
+}
+
+// Returns 1 if the end of the file has been reached.
+static int reb_simulationarchive_eof(struct reb_simulationarchive* sa){
+    if (sa->mmap_data){
+        return sa->mmap_pos>=sa->mmap_size;
+    }
+    return feof(sa->inf);
+}
+
+static int reb_simulationarchive_fseek(struct reb_simulationarchive* sa, long offset, int whence){
+    if (sa->mmap_data){
+        long pos;
+        switch (whence){
+            case SEEK_SET:
+                pos = offset;
+                break;
+            case SEEK_CUR:
+                pos = (long)sa->mmap_pos + offset;
+                break;
+            case SEEK_END:
+                pos = (long)sa->mmap_size + offset;
+                break;
+            default:
+                return -1;
+        }
+        if (pos<0) return -1;
+        sa->mmap_pos = pos;
+        return 0;
+    }
+    return fseek(sa->inf, offset, whence);
+}
+
+static long reb_simulationarchive_ftell(struct reb_simulationarchive* sa){
+    if (sa->mmap_data){
+        return sa->mmap_pos;
+    }
+    return ftell(sa->inf);
+}
+
+static void reb_simulationarchive_munmap(struct reb_simulationarchive* sa){
+    if (sa->mmap_data){
+        munmap(sa->mmap_data, sa->mmap_size);
+        sa->mmap_data = NULL;
+        sa->mmap_size = 0;
+    }
+}
+
+// Fields which are not needed if a snapshot only contains the physical state.
+static int reb_simulationarchive_field_is_state(const uint32_t type){
+    switch (type){
+        case REB_BINARY_FIELD_TYPE_PARTICLES:
+        case REB_BINARY_FIELD_TYPE_WHFAST_PJ:
+        case REB_BINARY_FIELD_TYPE_WHFAST_KEPLERXCORR:
+        case REB_BINARY_FIELD_TYPE_JANUS_PINT:
+        case REB_BINARY_FIELD_TYPE_MERCURIUS_DCRIT:
+        case REB_BINARY_FIELD_TYPE_IAS15_AT:
+        case REB_BINARY_FIELD_TYPE_IAS15_X0:
+        case REB_BINARY_FIELD_TYPE_IAS15_V0:
+        case REB_BINARY_FIELD_TYPE_IAS15_A0:
+        case REB_BINARY_FIELD_TYPE_IAS15_CSX:
+        case REB_BINARY_FIELD_TYPE_IAS15_CSV:
+        case REB_BINARY_FIELD_TYPE_IAS15_CSA0:
+        case REB_BINARY_FIELD_TYPE_IAS15_G:
+        case REB_BINARY_FIELD_TYPE_IAS15_B:
+        case REB_BINARY_FIELD_TYPE_IAS15_CSB:
+        case REB_BINARY_FIELD_TYPE_IAS15_E:
+        case REB_BINARY_FIELD_TYPE_IAS15_BR:
+        case REB_BINARY_FIELD_TYPE_IAS15_ER:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Returns 1 if a snapshot only contains the physical state.
+// Compressed snapshots are not inspected.
+static int reb_simulationarchive_snapshot_is_physical(struct reb_simulationarchive* sa, long snapshot){
+    if (sa->version<2 || snapshot==0){
+        return 0;
+    }
+    reb_simulationarchive_fseek(sa, sa->offset[snapshot], SEEK_SET);
+    struct reb_binary_field field;
+    while (reb_simulationarchive_fread(&field, sizeof(struct reb_binary_field), 1, sa)==1){
+        switch (field.type){
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL:
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT:
+                return 1;
+            case REB_BINARY_FIELD_TYPE_END:
+                return 0;
+        }
+        if (reb_simulationarchive_fseek(sa, field.size, SEEK_CUR)){
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Reads all fields of the first snapshot. If skip_state is 1, the particles
+// and integrator internals are skipped. This is used when the requested 
+// snapshot only contains the physical state, which replaces these fields.
+static void reb_simulationarchive_input_first_snapshot(struct reb_simulation* r, FILE* inf, char** mem_stream, const int skip_state, enum reb_input_binary_messages* warnings){
+    while (1){
+        if (skip_state){
+            struct reb_binary_field field;
+            if (mem_stream){
+                memcpy(&field, *mem_stream, sizeof(struct reb_binary_field));
+            }else{
+                if (fread(&field, sizeof(struct reb_binary_field), 1, inf)!=1){
+                    return;
+                }
+                fseek(inf, -(long)sizeof(struct reb_binary_field), SEEK_CUR);
+            }
+            if (reb_simulationarchive_field_is_state(field.type)){
+                if (mem_stream){
+                    *mem_stream += sizeof(struct reb_binary_field) + field.size;
+                }else{
+                    fseek(inf, sizeof(struct reb_binary_field) + field.size, SEEK_CUR);
+                }
+                continue;
+            }
+        }
+        if (reb_input_field(r, inf, warnings, mem_stream)==0){
+            return;
+        }
+    }
+}
+
 void reb_create_simulation_from_simulationarchive_with_messages(struct reb_simulation* r, struct reb_simulationarchive* sa, long snapshot, enum reb_input_binary_messages* warnings){
     FILE* inf = sa->inf;
     if (inf == NULL){
@@ -58,16 +212,35 @@ void reb_create_simulation_from_simulationarchive_with_messages(struct reb_simul
     memset(r,0,sizeof(struct reb_simulation));
     reb_init_simulation(r);
     r->simulationarchive_filename = NULL;
+    r->simulationarchive_checkpoint_filename = NULL;
     // reb_create_simulation sets simulationarchive_version to 3 by default.
     // This will break reading in old version.
     // Set to old version by default. Will be overwritten if new version was used.
     r->simulationarchive_version = 0;
 
-    fseek(inf, 0, SEEK_SET);
-    while(reb_input_field(r, inf, warnings,NULL)){ }
-
-    // Done?
-    if (snapshot==0) return;
+    if (sa->mmap_data){
+        struct stat file_stat;
+        if (fstat(fileno(inf), &file_stat) || (size_t)file_stat.st_size < sa->mmap_size){
+            // File has been truncated since it was opened. Accessing the mapped memory is no longer safe.
+            reb_simulationarchive_munmap(sa);
+        }
+    }
+    const int physical = reb_simulationarchive_snapshot_is_physical(sa, snapshot);
+    if (sa->mmap_data){
+        // Fields are decoded directly from the memory mapped file.
+        char* mem_stream = sa->mmap_data;
+        reb_simulationarchive_input_first_snapshot(r, NULL, &mem_stream, physical, warnings);
+        if (snapshot==0) return;
+        if (r->simulationarchive_version>=2){ 
+            mem_stream = sa->mmap_data + sa->offset[snapshot];
+            while(reb_input_field(r, NULL, warnings, &mem_stream)){ }
+            return;
+        }
+    }else{
+        fseek(inf, 0, SEEK_SET);
+        reb_simulationarchive_input_first_snapshot(r, inf, NULL, physical, warnings);
+        if (snapshot==0) return;
+    }
 
     // Read SA snapshot
     if(fseek(inf, sa->offset[snapshot], SEEK_SET)){
@@ -108,10 +281,7 @@ void reb_create_simulation_from_simulationarchive_with_messages(struct reb_simul
                     if (r->ri_whfast.safe_mode==0){
                         // If same mode is off, store unsynchronized Jacobi coordinates
                         if (r->ri_whfast.allocated_N<(unsigned int)r->N){
-                            if (r->ri_whfast.p_jh){
-                                free(r->ri_whfast.p_jh);
-                            }
-                            r->ri_whfast.p_jh= malloc(sizeof(struct reb_particle)*r->N);
+                            r->ri_whfast.p_jh = reb_reserve(r->ri_whfast.p_jh, sizeof(struct reb_particle)*r->N);
                             r->ri_whfast.allocated_N = r->N;
                         }
                         ps = r->ri_whfast.p_jh;
@@ -147,10 +317,7 @@ void reb_create_simulation_from_simulationarchive_with_messages(struct reb_simul
                     if (r->ri_mercurius.safe_mode==0){
                         // If same mode is off, store unsynchronized Jacobi coordinates
                         if (r->ri_whfast.allocated_N<(unsigned int)r->N){
-                            if (r->ri_whfast.p_jh){
-                                free(r->ri_whfast.p_jh);
-                            }
-                            r->ri_whfast.p_jh= malloc(sizeof(struct reb_particle)*r->N);
+                            r->ri_whfast.p_jh = reb_reserve(r->ri_whfast.p_jh, sizeof(struct reb_particle)*r->N);
                             r->ri_whfast.allocated_N = r->N;
                         }
                         ps = r->ri_whfast.p_jh;
@@ -232,157 +399,1222 @@ struct reb_simulation* reb_create_simulation_from_simulationarchive(struct reb_s
     return r; // might be null if error occured
 }
 
-void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa, const char* filename,  struct reb_simulationarchive* sa_index, enum reb_input_binary_messages* warnings){
-    const int debug = 0;
-    sa->inf = fopen(filename,"r");
-    if (sa->inf==NULL){
-        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+// Loading snapshots into an existing simulation
+// Snapshots (other than the first) only contain the fields which differ 
+// from the first snapshot. If the simulation contains another unmodified 
+// snapshot, only the fields stored in either of the two snapshots are read.
+// Fields which are only stored in the loaded snapshot are reset to the 
+// values in the first snapshot. Otherwise, all fields are read again.
+// In both cases, the existing allocations are reused.
+
+#define REB_SA_LOAD_MAX_FIELDS 512
+
+// Finds the fields of a snapshot in the memory mapped file. Returns the 
+// number of fields or -1 if the snapshot cannot be used for an incremental
+// load (compressed or physical state only).
+static int reb_simulationarchive_snapshot_fields(struct reb_simulationarchive* sa, long snapshot, const char** fields){
+    const char* p = sa->mmap_data + (snapshot==0?0:sa->offset[snapshot]);
+    const char* const end = sa->mmap_data + sa->mmap_size;
+    int N = 0;
+    while (p+sizeof(struct reb_binary_field)<=end){
+        struct reb_binary_field field;
+        memcpy(&field, p, sizeof(struct reb_binary_field));
+        switch (field.type){
+            case REB_BINARY_FIELD_TYPE_END:
+                return N;
+            case REB_BINARY_FIELD_TYPE_HEADER:
+                p += 64;
+                continue;
+            case REB_BINARY_FIELD_TYPE_SACOMPRESSED:
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL:
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT:
+                return -1;
+        }
+        if (N==REB_SA_LOAD_MAX_FIELDS || field.size>(uint64_t)(end-p)-sizeof(struct reb_binary_field)){
+            return -1;
+        }
+        fields[N++] = p;
+        p += sizeof(struct reb_binary_field)+field.size;
+    }
+    return -1;
+}
+
+static const char* reb_simulationarchive_find_field(const char** fields, const int N, const uint32_t type){
+    for (int i=0;i<N;i++){
+        struct reb_binary_field field;
+        memcpy(&field, fields[i], sizeof(struct reb_binary_field));
+        if (field.type==type){
+            return fields[i];
+        }
+    }
+    return NULL;
+}
+
+// Resets the fields of snapshot `loaded` to the first snapshot and then reads 
+// the fields of `snapshot`. Returns 0 if this is not possible.
+static int reb_simulationarchive_load_incremental(struct reb_simulation* r, struct reb_simulationarchive* sa, long snapshot, long loaded, enum reb_input_binary_messages* warnings){
+    const char* fields_first[REB_SA_LOAD_MAX_FIELDS];
+    const char* fields_loaded[REB_SA_LOAD_MAX_FIELDS];
+    const char* fields_snapshot[REB_SA_LOAD_MAX_FIELDS];
+    const int N_first = reb_simulationarchive_snapshot_fields(sa, 0, fields_first);
+    const int N_loaded = loaded==0?0:reb_simulationarchive_snapshot_fields(sa, loaded, fields_loaded);
+    const int N_snapshot = snapshot==0?0:reb_simulationarchive_snapshot_fields(sa, snapshot, fields_snapshot);
+    if (N_first<0 || N_loaded<0 || N_snapshot<0){
+        return 0;
+    }
+    const char* particles_first = reb_simulationarchive_find_field(fields_first, N_first, REB_BINARY_FIELD_TYPE_PARTICLES);
+    const int particles_snapshot = reb_simulationarchive_find_field(fields_snapshot, N_snapshot, REB_BINARY_FIELD_TYPE_PARTICLES)!=NULL;
+    // Check that all fields can be reset before changing anything.
+    for (int i=0;i<N_loaded;i++){
+        struct reb_binary_field field;
+        memcpy(&field, fields_loaded[i], sizeof(struct reb_binary_field));
+        if (field.type==REB_BINARY_FIELD_TYPE_PARTICLES_DIFF){
+            if (particles_first==NULL) return 0;
+        }else if (reb_simulationarchive_find_field(fields_first, N_first, field.type)==NULL){
+            return 0;
+        }
+    }
+    
+    for (int i=0;i<N_loaded;i++){
+        struct reb_binary_field field;
+        memcpy(&field, fields_loaded[i], sizeof(struct reb_binary_field));
+        if (reb_simulationarchive_find_field(fields_snapshot, N_snapshot, field.type)){
+            continue; // Will be overwritten.
+        }
+        if (field.type==REB_BINARY_FIELD_TYPE_PARTICLES_DIFF){
+            if (particles_snapshot){
+                continue; // Will be overwritten.
+            }
+            // Only reset the particles which changed.
+            struct reb_binary_field field_first;
+            memcpy(&field_first, particles_first, sizeof(struct reb_binary_field));
+            const struct reb_particle* const ps_first = (const struct reb_particle*)(particles_first+sizeof(struct reb_binary_field));
+            const size_t N_ps_first = field_first.size/sizeof(struct reb_particle);
+            const size_t size_entry = sizeof(uint32_t)+sizeof(struct reb_particle);
+            const char* entry = fields_loaded[i]+sizeof(struct reb_binary_field);
+            for (size_t l=0;l<field.size/size_entry;l++){
+                uint32_t k;
+                memcpy(&k, entry+l*size_entry, sizeof(uint32_t));
+                if (k<N_ps_first && k<(uint32_t)r->allocatedN){
+                    struct reb_particle p;
+                    memcpy(&p, &ps_first[k], sizeof(struct reb_particle));
+                    p.c = r->particles[k].c;
+                    p.ap = r->particles[k].ap;
+                    p.sim = r;
+                    r->particles[k] = p;
+                }
+            }
+            continue;
+        }
+        char* mem_stream = (char*)reb_simulationarchive_find_field(fields_first, N_first, field.type);
+        reb_input_field(r, NULL, warnings, &mem_stream);
+    }
+    if (snapshot>0){
+        char* mem_stream = sa->mmap_data + sa->offset[snapshot];
+        while(reb_input_field(r, NULL, warnings, &mem_stream)){ }
+    }
+    return 1;
+}
+
+void reb_load_simulation_from_simulationarchive_with_messages(struct reb_simulation* r, struct reb_simulationarchive* sa, long snapshot, long loaded, enum reb_input_binary_messages* warnings){
+    FILE* inf = sa->inf;
+    if (inf == NULL){
+        *warnings |= REB_INPUT_BINARY_ERROR_FILENOTOPEN;
         return;
     }
-    sa->filename = malloc(strlen(filename)+1);
-    strcpy(sa->filename,filename);
+    if (snapshot<0) snapshot += sa->nblobs;
+    if (snapshot>=sa->nblobs || snapshot<0){
+        *warnings |= REB_INPUT_BINARY_ERROR_OUTOFRANGE;
+        return;
+    }
+    if (sa->version<2){
+        // Version 1 snapshots are not stored as differences.
+        reb_create_simulation_from_simulationarchive_with_messages(r, sa, snapshot, warnings);
+        return;
+    }
+    if (sa->mmap_data){
+        struct stat file_stat;
+        if (fstat(fileno(inf), &file_stat) || (size_t)file_stat.st_size < sa->mmap_size){
+            // File has been truncated since it was opened. Accessing the mapped memory is no longer safe.
+            reb_simulationarchive_munmap(sa);
+        }
+    }
+
+    // Data derived from the particles is recalculated.
+    if (r->ri_bs.nbody_ode){
+        reb_free_ode(r->ri_bs.nbody_ode);
+    }
+    reb_collision_verlet_free(r);
+    const int tree = r->tree_root!=NULL;
     
-    // Get version
-    fseek(sa->inf, 0, SEEK_SET);  
-    struct reb_binary_field field = {0};
-    sa->version = 0;
-    double t0 = 0;
-    do{
-        fread(&field,sizeof(struct reb_binary_field),1,sa->inf);
+    if (sa->mmap_data && !tree && loaded>=0 && loaded<sa->nblobs){
+        if (reb_simulationarchive_load_incremental(r, sa, snapshot, loaded, warnings)){
+            return;
+        }
+    }
+    
+    // Read all fields.
+    if (tree){
+        reb_tree_delete(r);
+    }
+    const int physical = reb_simulationarchive_snapshot_is_physical(sa, snapshot);
+    if (sa->mmap_data){
+        char* mem_stream = sa->mmap_data;
+        reb_simulationarchive_input_first_snapshot(r, NULL, &mem_stream, physical, warnings);
+        if (snapshot>0){
+            mem_stream = sa->mmap_data + sa->offset[snapshot];
+            while(reb_input_field(r, NULL, warnings, &mem_stream)){ }
+        }
+    }else{
+        fseek(inf, 0, SEEK_SET);
+        reb_simulationarchive_input_first_snapshot(r, inf, NULL, physical, warnings);
+        if (snapshot>0){
+            if(fseek(inf, sa->offset[snapshot], SEEK_SET)){
+                *warnings |= REB_INPUT_BINARY_ERROR_SEEK;
+                return;
+            }
+            while(reb_input_field(r, inf, warnings, NULL)){ }
+        }
+    }
+}
+
+// Exact lookups
+// A simulation integrated to time t with exact_finish_time=1 takes full 
+// timesteps until the next timestep would overshoot and then one (or more)
+// shortened timesteps. The simulation after the full timesteps does not 
+// depend on t, so it can be reused for any later time before the next 
+// snapshot. Copies of it are then integrated to t. This gives bitwise the 
+// same result as integrating from the snapshot every time.
+
+int reb_simulationarchive_integrate_full_steps(struct reb_simulation* const r, double tmax){
+    reb_sigint = 0;
+    signal(SIGINT, reb_sigint_handler);
+    const enum REB_STATUS status = r->status;
+    const int exact_finish_time = r->exact_finish_time;
+    const double dtsign = copysign(1.,r->dt);
+    r->exact_finish_time = 1;
+    r->status = REB_RUNNING;
+    while((r->t+r->dt)*dtsign<tmax*dtsign && r->status==REB_RUNNING && r->N && !(r->messages && r->messages[0])){
+        reb_step_batch(r, tmax);
+        reb_run_heartbeat(r);
+        if (reb_sigint==1){
+            r->status = REB_EXIT_SIGINT;
+        }
+    }
+    r->exact_finish_time = exact_finish_time;
+    if (r->status!=REB_RUNNING){
+        return r->status;
+    }
+    r->status = status;
+    return 0;
+}
+
+static long reb_simulationarchive_snapshot_before(struct reb_simulationarchive* sa, double t){
+    long l = 0;
+    long h = sa->nblobs;
+    while (h-l>1){
+        const long m = l+(h-l)/2;
+        if (sa->t[m]>t){
+            h = m;
+        }else{
+            l = m;
+        }
+    }
+    return l;
+}
+
+static struct reb_simulation* reb_simulationarchive_create_exact(struct reb_simulationarchive* sa, long snapshot, void (*setup)(struct reb_simulation* const r)){
+    struct reb_simulation* r = reb_create_simulation_from_simulationarchive(sa, snapshot);
+    if (r==NULL) return NULL;
+    if (setup){
+        setup(r);
+    }
+    r->ri_whfast.keep_unsynchronized = 0;
+    r->ri_saba.keep_unsynchronized = 0;
+    r->exact_finish_time = 1;
+    return r;
+}
+
+struct reb_simulation* reb_simulationarchive_get_simulation_exact(struct reb_simulationarchive* sa, double t, void (*setup)(struct reb_simulation* const r)){
+    if (sa==NULL || sa->nblobs<1) return NULL;
+    if (t<sa->t[0] || t>sa->t[sa->nblobs-1]){
+        fprintf(stderr,"\n\033[1mError!\033[0m Requested time outside of baseline stored in SimulationArchive.\n");
+        return NULL;
+    }
+    const long snapshot = reb_simulationarchive_snapshot_before(sa, t);
+    struct reb_simulation* c = sa->cache_simulation;
+    if (c==NULL || sa->cache_snapshot!=snapshot || (c->t-t)*copysign(1.,c->dt)>0.){
+        if (c){
+            reb_free_simulation(c);
+        }
+        c = reb_simulationarchive_create_exact(sa, snapshot, setup);
+        sa->cache_simulation = c;
+        sa->cache_snapshot = snapshot;
+        if (c==NULL) return NULL;
+    }
+    struct reb_simulation* r;
+    if (reb_simulationarchive_integrate_full_steps(c, t)){
+        // The integration stopped early (error, escape, encounter, ...). 
+        // Start from the snapshot so that the status matches reb_integrate().
+        reb_free_simulation(c);
+        sa->cache_simulation = NULL;
+        r = reb_simulationarchive_create_exact(sa, snapshot, setup);
+        if (r==NULL) return NULL;
+    }else{
+        r = reb_copy_simulation(c);
+        if (r==NULL) return NULL;
+        if (setup){
+            setup(r);
+        }
+    }
+    reb_integrate(r, t);
+    return r;
+}
+
+// Batch loading of particle data
+// Many snapshots are decoded in parallel without creating a simulation for 
+// each one. Only the fields containing the particles and the integrator 
+// state are located in each snapshot. Fields which are not stored in a 
+// snapshot are taken from the first snapshot, which is only decoded once.
+// If the particles stored in a snapshot are not synchronized, a simulation
+// is created and synchronized instead.
+
+struct reb_simulationarchive_particle_fields {
+    uint32_t particles_type;    // Type of the particle field (0 if not found)
+    const char* particles;      // Contents of the particle field
+    uint64_t particles_size;    // Size of the particle field
+    int particles_diff;         // 1 if only some particles are stored
+    int integrator;             // Integrator (-1 if not found)
+    int is_synchronized[5];     // WHFast, SABA, MERCURIUS, EOS, LEAPFROG (-1 if not found)
+    char* decompressed;         // Decompressed fields (owned, NULL if not compressed)
+};
+
+static void reb_simulationarchive_particle_fields_init(struct reb_simulationarchive_particle_fields* f){
+    f->particles_type = 0;
+    f->particles = NULL;
+    f->particles_size = 0;
+    f->particles_diff = 0;
+    f->integrator = -1;
+    for (int k=0;k<5;k++){
+        f->is_synchronized[k] = -1;
+    }
+    f->decompressed = NULL;
+}
+
+static int reb_simulationarchive_field_int(const char* p, const uint64_t size){
+    unsigned int v = 0;
+    memcpy(&v, p, size<sizeof(unsigned int)?size:sizeof(unsigned int));
+    return v;
+}
+
+// Locates the fields in buf. Returns 1 if the fields are corrupted.
+static int reb_simulationarchive_particle_fields_scan(struct reb_simulationarchive_particle_fields* f, const char* buf, const size_t size){
+    const char* p = buf;
+    const char* const end = buf+size;
+    while (p+sizeof(struct reb_binary_field)<=end){
+        struct reb_binary_field field;
+        memcpy(&field, p, sizeof(struct reb_binary_field));
+        p += sizeof(struct reb_binary_field);
+        if (field.type==REB_BINARY_FIELD_TYPE_END){
+            return 0;
+        }
+        if (field.type==REB_BINARY_FIELD_TYPE_HEADER){
+            // The header does not have a size.
+            field.size = 64 - sizeof(struct reb_binary_field);
+        }
+        if (field.size > (uint64_t)(end-p)){
+            return 1;
+        }
         switch (field.type){
-            case REB_BINARY_FIELD_TYPE_HEADER:
-                //fseek(sa->inf,64 - sizeof(struct reb_binary_field),SEEK_CUR);
-                {
-                    long objects = 0;
-                    // Input header.
-                    const long bufsize = 64 - sizeof(struct reb_binary_field);
-                    char readbuf[bufsize], curvbuf[bufsize];
-                    const char* header = "REBOUND Binary File. Version: ";
-                    sprintf(curvbuf,"%s%s",header+sizeof(struct reb_binary_field), reb_version_str);
-                    
-                    objects += fread(readbuf,sizeof(char),bufsize,sa->inf);
-                    // Note: following compares version, but ignores githash.
-                    if(strncmp(readbuf,curvbuf,bufsize)!=0){
-                        *warnings |= REB_INPUT_BINARY_WARNING_VERSION;
-                    }
-                }
+            case REB_BINARY_FIELD_TYPE_PARTICLES:
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL:
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT:
+                f->particles_type = field.type;
+                f->particles = p;
+                f->particles_size = field.size;
                 break;
-            case REB_BINARY_FIELD_TYPE_T:
-                fread(&t0, sizeof(double),1,sa->inf);
+            case REB_BINARY_FIELD_TYPE_PARTICLES_DIFF:
+                f->particles_diff = 1;
                 break;
-            case REB_BINARY_FIELD_TYPE_SAVERSION:
-                fread(&(sa->version), sizeof(int),1,sa->inf);
+            case REB_BINARY_FIELD_TYPE_INTEGRATOR:
+                f->integrator = reb_simulationarchive_field_int(p, field.size);
                 break;
-            case REB_BINARY_FIELD_TYPE_SASIZESNAPSHOT:
-                fread(&(sa->size_snapshot), sizeof(long),1,sa->inf);
+            case REB_BINARY_FIELD_TYPE_WHFAST_ISSYNCHRON:
+                f->is_synchronized[0] = reb_simulationarchive_field_int(p, field.size);
                 break;
-            case REB_BINARY_FIELD_TYPE_SASIZEFIRST:
-                fread(&(sa->size_first), sizeof(long),1,sa->inf);
+            case REB_BINARY_FIELD_TYPE_SABA_ISSYNCHRON:
+                f->is_synchronized[1] = reb_simulationarchive_field_int(p, field.size);
                 break;
-            case REB_BINARY_FIELD_TYPE_SAAUTOWALLTIME:
-                fread(&(sa->auto_walltime), sizeof(double),1,sa->inf);
+            case REB_BINARY_FIELD_TYPE_MERCURIUS_ISSYNCHRON:
+                f->is_synchronized[2] = reb_simulationarchive_field_int(p, field.size);
                 break;
-            case REB_BINARY_FIELD_TYPE_SAAUTOINTERVAL:
-                fread(&(sa->auto_interval), sizeof(double),1,sa->inf);
+            case REB_BINARY_FIELD_TYPE_EOS_ISSYNCHRON:
+                f->is_synchronized[3] = reb_simulationarchive_field_int(p, field.size);
                 break;
-            case REB_BINARY_FIELD_TYPE_SAAUTOSTEP:
-                fread(&(sa->auto_step), sizeof(unsigned long long),1,sa->inf);
+            case REB_BINARY_FIELD_TYPE_LEAPFROG_ISSYNCHRON:
+                f->is_synchronized[4] = reb_simulationarchive_field_int(p, field.size);
                 break;
-            default:
-                fseek(sa->inf,field.size,SEEK_CUR);
+            case REB_BINARY_FIELD_TYPE_SACOMPRESSED:
+                {
+                    size_t size_fields;
+                    if (f->decompressed || reb_decompress(p, field.size, &f->decompressed, &size_fields)){
+                        return 1;
+                    }
+                    if (reb_simulationarchive_particle_fields_scan(f, f->decompressed, size_fields)){
+                        return 1;
+                    }
+                }
                 break;
         }
-    }while(field.type!=REB_BINARY_FIELD_TYPE_END);
+        p += field.size;
+    }
+    return 1; // No END field
+}
 
-    // Make index
-    if (sa->version<2){
-        // Old version
-        if (sa->size_first==-1 || sa->size_snapshot==-1){
-            free(sa->filename);
-            fclose(sa->inf);
-            *warnings |= REB_INPUT_BINARY_ERROR_OUTOFRANGE;
-            return;
+// Copies the particle data of a snapshot to the output arrays. Returns 1
+// if the particles are not synchronized or if the number of particles is not N.
+static int reb_simulationarchive_particle_fields_copy(const struct reb_simulationarchive_particle_fields* const f, const struct reb_simulationarchive_particle_fields* const base, const int N, double* m, double (*xyz)[3], double (*vxvyvz)[3]){
+    if (f->particles_diff){
+        return 1; // Requires the particles of the first snapshot
+    }
+    const struct reb_simulationarchive_particle_fields* const fp = f->particles_type?f:base;
+    if (fp->particles_type==REB_BINARY_FIELD_TYPE_PARTICLES){
+        // The complete state is stored. Check if the integrator was synchronized.
+        const int integrator = f->integrator>=0?f->integrator:base->integrator;
+        int k = -1;
+        switch (integrator){
+            case REB_INTEGRATOR_WHFAST:
+                k = 0;
+                break;
+            case REB_INTEGRATOR_SABA:
+                k = 1;
+                break;
+            case REB_INTEGRATOR_MERCURIUS:
+                k = 2;
+                break;
+            case REB_INTEGRATOR_EOS:
+                k = 3;
+                break;
+            case REB_INTEGRATOR_LEAPFROG:
+                k = 4;
+                break;
+            case REB_INTEGRATOR_JANUS:
+                return 1; // Integer coordinates are not stored in the particles
         }
-        fseek(sa->inf, 0, SEEK_END);  
-        sa->nblobs = (ftell(sa->inf)-sa->size_first)/sa->size_snapshot+1; // +1 accounts for first binary 
-        sa->t = malloc(sizeof(double)*sa->nblobs);
-        sa->offset = malloc(sizeof(uint32_t)*sa->nblobs);
-        sa->t[0] = t0;
-        sa->offset[0] = 0;
-        for(long i=1;i<sa->nblobs;i++){
-            double offset = sa->size_first+(i-1)*sa->size_snapshot;
-            fseek(sa->inf, offset, SEEK_SET);  
-            fread(&(sa->t[i]),sizeof(double), 1, sa->inf);
-            sa->offset[i] = offset;
+        if (k>=0){
+            const int is_synchronized = f->is_synchronized[k]>=0?f->is_synchronized[k]:base->is_synchronized[k];
+            if (is_synchronized!=1){
+                return 1;
+            }
         }
-    }else{
-        // New version
-        if (debug) printf("=============\n");
-        if (debug) printf("SA Version: 2\n");
-        if (sa_index == NULL){ // Need to construct offset index from file.
-            long nblobsmax = 1024;
-            sa->t = malloc(sizeof(double)*nblobsmax);
-            sa->offset = malloc(sizeof(uint32_t)*nblobsmax);
-            fseek(sa->inf, 0, SEEK_SET);  
-            sa->nblobs = 0;
-            int read_error = 0;
-            struct reb_binary_field lastreadfield = {0};
-            for(long i=0;i<nblobsmax;i++){
-                struct reb_binary_field field = {0};
-                sa->offset[i] = ftell(sa->inf);
-                int blob_finished = 0;
-                do{
-                    size_t r1 = fread(&field,sizeof(struct reb_binary_field),1,sa->inf);
-                    if (r1==1){
-                        lastreadfield = field;
-                        switch (field.type){
-                            case REB_BINARY_FIELD_TYPE_HEADER:
-                                {
-                                    if (debug) printf("SA Field. type=HEADER\n");
-                                    int s1 = fseek(sa->inf,64 - sizeof(struct reb_binary_field),SEEK_CUR);
-                                    if (s1){
-                                        read_error = 1;
-                                    }
-                                }
-                                break;
-                            case REB_BINARY_FIELD_TYPE_T:
-                                {
-                                    size_t r2 = fread(&(sa->t[i]), sizeof(double),1,sa->inf);
-                                    if (debug) printf("SA Field. type=TIME      value=%.10f\n",sa->t[1]);
-                                    if (r2!=1){
-                                        read_error = 1;
-                                    }
-                                }
-                                break;
-                            case REB_BINARY_FIELD_TYPE_END:
-                                {
-                                    if (debug) printf("SA Field. type=END   =====\n");
-                                    blob_finished = 1;
-                                }
-                                break;
-                            default:
-                                {
-                                    int s2 = fseek(sa->inf,field.size,SEEK_CUR);
-                                    if (debug) printf("SA Field. type=%-6d    size=%llu\n",field.type,field.size);
-                                    if (s2){
-                                        read_error = 1;
-                                    }
-                                }
-                                break;
-                        }
-                    }else{
-                        read_error = 1;
-                    }
-                }while(blob_finished==0 && read_error==0);
-                if (read_error){
-                    if (debug) printf("SA Error. Error while reading current blob.\n");
-                    // Error during reading. Current snapshot is corrupt.
+        if (fp->particles_size!=N*sizeof(struct reb_particle)){
+            return 1;
+        }
+        for (int i=0;i<N;i++){
+            struct reb_particle p;
+            memcpy(&p, fp->particles+i*sizeof(struct reb_particle), sizeof(struct reb_particle));
+            if (m){
+                m[i] = p.m;
+            }
+            if (xyz){
+                xyz[i][0] = p.x;
+                xyz[i][1] = p.y;
+                xyz[i][2] = p.z;
+            }
+            if (vxvyvz){
+                vxvyvz[i][0] = p.vx;
+                vxvyvz[i][1] = p.vy;
+                vxvyvz[i][2] = p.vz;
+            }
+        }
+        return 0;
+    }
+    if (fp->particles_type==REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL || fp->particles_type==REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT){
+        // Physical state only. The particles are always synchronized.
+        const int single = fp->particles_type==REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT;
+        const size_t size_real = single?sizeof(float):sizeof(double);
+        if (fp->particles_size!=N*(REB_PARTICLE_PHYSICAL_N*size_real+sizeof(uint32_t))){
+            return 1;
+        }
+        for (int k=0;k<REB_PARTICLE_PHYSICAL_N;k++){
+            double* dst = NULL;
+            int stride = 3;
+            switch (reb_particle_physical_offsets[k]){
+                case offsetof(struct reb_particle, m):  dst = m; stride = 1; break;
+                case offsetof(struct reb_particle, x):  dst = xyz?xyz[0]+0:NULL; break;
+                case offsetof(struct reb_particle, y):  dst = xyz?xyz[0]+1:NULL; break;
+                case offsetof(struct reb_particle, z):  dst = xyz?xyz[0]+2:NULL; break;
+                case offsetof(struct reb_particle, vx): dst = vxvyvz?vxvyvz[0]+0:NULL; break;
+                case offsetof(struct reb_particle, vy): dst = vxvyvz?vxvyvz[0]+1:NULL; break;
+                case offsetof(struct reb_particle, vz): dst = vxvyvz?vxvyvz[0]+2:NULL; break;
+            }
+            if (dst==NULL){
+                continue;
+            }
+            const char* src = fp->particles + k*N*size_real;
+            for (int i=0;i<N;i++){
+                if (single){
+                    float v;
+                    memcpy(&v, src+i*size_real, sizeof(float));
+                    dst[i*stride] = v;
+                }else{
+                    memcpy(&dst[i*stride], src+i*size_real, sizeof(double));
+                }
+            }
+        }
+        return 0;
+    }
+    return 1;
+}
+
+struct reb_simulationarchive_batch {
+    struct reb_simulationarchive* sa;
+    const long* snapshots;
+    int N_snapshots;
+    int N;
+    int N_threads;
+    double* m;
+    double (*xyz)[3];
+    double (*vxvyvz)[3];
+    const char* base;                   // Fields of the first snapshot
+    size_t base_size;
+    struct reb_simulationarchive_particle_fields base_fields;
+    size_t file_size;
+};
+
+struct reb_simulationarchive_batch_thread {
+    struct reb_simulationarchive_batch* batch;
+    int thread;
+    enum reb_input_binary_messages warnings;
+};
+
+// Reads size bytes at offset without changing the state of the SimulationArchive.
+static char* reb_simulationarchive_pread(struct reb_simulationarchive* sa, const uint64_t offset, const size_t size){
+    char* buf = malloc(size?size:1);
+    size_t done = 0;
+    while (done<size){
+        const ssize_t n = pread(fileno(sa->inf), buf+done, size-done, offset+done);
+        if (n<=0){
+            free(buf);
+            return NULL;
+        }
+        done += n;
+    }
+    return buf;
+}
+
+// Creates a simulation from the fields in memory and synchronizes it.
+static int reb_simulationarchive_batch_slow(const struct reb_simulationarchive_batch* const b, const char* blob, const int N, double* m, double (*xyz)[3], double (*vxvyvz)[3], enum reb_input_binary_messages* warnings){
+    struct reb_simulation* r = reb_create_simulation();
+    char* mem_stream = (char*)b->base;
+    reb_simulationarchive_input_first_snapshot(r, NULL, &mem_stream, 0, warnings);
+    if (blob){
+        mem_stream = (char*)blob;
+        while(reb_input_field(r, NULL, warnings, &mem_stream)){ }
+    }
+    r->ri_whfast.keep_unsynchronized = 1;
+    r->ri_saba.keep_unsynchronized = 1;
+    reb_integrator_synchronize(r);
+    int ret = 1;
+    if (r->N==N){
+        reb_serialize_particle_data(r, NULL, m, NULL, xyz, vxvyvz, NULL);
+        ret = 0;
+    }
+    reb_free_simulation(r);
+    return ret;
+}
+
+static void* reb_simulationarchive_batch_thread(void* args){
+    struct reb_simulationarchive_batch_thread* const t = args;
+    struct reb_simulationarchive_batch* const b = t->batch;
+    struct reb_simulationarchive* const sa = b->sa;
+    const int N = b->N;
+    for (int s=t->thread; s<b->N_snapshots; s+=b->N_threads){
+        double* m = b->m?b->m+(size_t)s*N:NULL;
+        double (*xyz)[3] = b->xyz?b->xyz+(size_t)s*N:NULL;
+        double (*vxvyvz)[3] = b->vxvyvz?b->vxvyvz+(size_t)s*N:NULL;
+        long snapshot = b->snapshots[s];
+        if (snapshot<0) snapshot += sa->nblobs;
+        int failed = 1;
+        if (snapshot<0 || snapshot>=sa->nblobs){
+            t->warnings |= REB_INPUT_BINARY_ERROR_OUTOFRANGE;
+        }else if (snapshot==0){
+            failed = reb_simulationarchive_particle_fields_copy(&b->base_fields, &b->base_fields, N, m, xyz, vxvyvz);
+            if (failed){
+                failed = reb_simulationarchive_batch_slow(b, NULL, N, m, xyz, vxvyvz, &t->warnings);
+            }
+        }else{
+            const uint64_t offset = sa->offset[snapshot];
+            const uint64_t offset_end = snapshot+1<sa->nblobs?sa->offset[snapshot+1]:b->file_size;
+            char* blob_owned = NULL;
+            const char* blob = NULL;
+            if (offset<offset_end && offset_end<=b->file_size){
+                if (sa->mmap_data){
+                    blob = sa->mmap_data + offset;
+                }else{
+                    blob_owned = reb_simulationarchive_pread(sa, offset, offset_end-offset);
+                    blob = blob_owned;
+                }
+            }
+            if (blob==NULL){
+                t->warnings |= REB_INPUT_BINARY_ERROR_SEEK;
+            }else{
+                struct reb_simulationarchive_particle_fields f;
+                reb_simulationarchive_particle_fields_init(&f);
+                if (reb_simulationarchive_particle_fields_scan(&f, blob, offset_end-offset)){
+                    t->warnings |= REB_INPUT_BINARY_WARNING_CORRUPTFILE;
+                }else{
+                    failed = reb_simulationarchive_particle_fields_copy(&f, &b->base_fields, N, m, xyz, vxvyvz);
+                    if (failed){
+                        failed = reb_simulationarchive_batch_slow(b, blob, N, m, xyz, vxvyvz, &t->warnings);
+                    }
+                }
+                free(f.decompressed);
+            }
+            free(blob_owned);
+        }
+        if (failed){
+            t->warnings |= REB_INPUT_BINARY_WARNING_PARTICLES;
+            for (int i=0;i<N;i++){
+                if (m) m[i] = NAN;
+                for (int k=0;k<3;k++){
+                    if (xyz) xyz[i][k] = NAN;
+                    if (vxvyvz) vxvyvz[i][k] = NAN;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+enum reb_input_binary_messages reb_simulationarchive_serialize_particle_data(struct reb_simulationarchive* sa, const long* snapshots, const int N_snapshots, const int N, int N_threads, double* m, double (*xyz)[3], double (*vxvyvz)[3]){
+    if (sa==NULL || sa->inf==NULL){
+        return REB_INPUT_BINARY_ERROR_FILENOTOPEN;
+    }
+    if (sa->version<2){
+        return REB_INPUT_BINARY_WARNING_VERSION;
+    }
+    if (N_snapshots<=0){
+        return REB_INPUT_BINARY_WARNING_NONE;
+    }
+    struct reb_simulationarchive_batch b;
+    b.sa = sa;
+    b.snapshots = snapshots;
+    b.N_snapshots = N_snapshots;
+    b.N = N;
+    b.m = m;
+    b.xyz = xyz;
+    b.vxvyvz = vxvyvz;
+
+    struct stat file_stat;
+    if (fstat(fileno(sa->inf), &file_stat)){
+        return REB_INPUT_BINARY_ERROR_SEEK;
+    }
+    if (sa->mmap_data && (size_t)file_stat.st_size < sa->mmap_size){
+        // File has been truncated since it was opened. Accessing the mapped memory is no longer safe.
+        reb_simulationarchive_munmap(sa);
+    }
+    b.file_size = sa->mmap_data?sa->mmap_size:(size_t)file_stat.st_size;
+
+    // The first snapshot is decoded once and shared by all threads.
+    b.base_size = sa->nblobs>1?sa->offset[1]:b.file_size;
+    char* base_owned = NULL;
+    if (sa->mmap_data){
+        b.base = sa->mmap_data;
+    }else{
+        base_owned = reb_simulationarchive_pread(sa, 0, b.base_size);
+        if (base_owned==NULL){
+            return REB_INPUT_BINARY_ERROR_SEEK;
+        }
+        b.base = base_owned;
+    }
+    reb_simulationarchive_particle_fields_init(&b.base_fields);
+    if (reb_simulationarchive_particle_fields_scan(&b.base_fields, b.base, b.base_size)){
+        free(b.base_fields.decompressed);
+        free(base_owned);
+        return REB_INPUT_BINARY_WARNING_CORRUPTFILE;
+    }
+
+    if (N_threads<=0){
+        N_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    b.N_threads = N_threads<N_snapshots?N_threads:N_snapshots;
+    if (b.N_threads<1) b.N_threads = 1;
+    struct reb_simulationarchive_batch_thread* threads = malloc(sizeof(struct reb_simulationarchive_batch_thread)*b.N_threads);
+    pthread_t* pthreads = malloc(sizeof(pthread_t)*b.N_threads);
+    for (int k=0;k<b.N_threads;k++){
+        threads[k].batch = &b;
+        threads[k].thread = k;
+        threads[k].warnings = REB_INPUT_BINARY_WARNING_NONE;
+    }
+    int* started = calloc(b.N_threads, sizeof(int));
+    for (int k=1;k<b.N_threads;k++){
+        started[k] = pthread_create(&pthreads[k], NULL, reb_simulationarchive_batch_thread, &threads[k])==0;
+    }
+    reb_simulationarchive_batch_thread(&threads[0]);
+    enum reb_input_binary_messages warnings = threads[0].warnings;
+    for (int k=1;k<b.N_threads;k++){
+        if (started[k]){
+            pthread_join(pthreads[k], NULL);
+        }else{
+            // Thread could not be created. Do the work on this thread.
+            reb_simulationarchive_batch_thread(&threads[k]);
+        }
+        warnings |= threads[k].warnings;
+    }
+    free(started);
+    free(pthreads);
+    free(threads);
+    free(b.base_fields.decompressed);
+    free(base_owned);
+    return warnings;
+}
+
+// Columnar export
+// All snapshots are loaded in chunks with reb_simulationarchive_serialize_particle_data
+// and written to a file with one contiguous block per field. The chunk size
+// is chosen such that the memory used does not depend on the number of snapshots.
+#define REB_SAEXPORT_BUFFER_SIZE (64*1024*1024)   ///< Approximate size of the buffers used by reb_simulationarchive_export, in bytes
+
+static double reb_simulationarchive_export_value(const enum REB_SAEXPORT_FIELD field, const double m, const double* xyz, const double* vxvyvz, const struct reb_orbit* o){
+    switch (field){
+        case REB_SAEXPORT_FIELD_M:          return m;
+        case REB_SAEXPORT_FIELD_X:          return xyz[0];
+        case REB_SAEXPORT_FIELD_Y:          return xyz[1];
+        case REB_SAEXPORT_FIELD_Z:          return xyz[2];
+        case REB_SAEXPORT_FIELD_VX:         return vxvyvz[0];
+        case REB_SAEXPORT_FIELD_VY:         return vxvyvz[1];
+        case REB_SAEXPORT_FIELD_VZ:         return vxvyvz[2];
+        default:
+            break;
+    }
+    if (o==NULL){
+        return NAN;
+    }
+    switch (field){
+        case REB_SAEXPORT_FIELD_A:          return o->a;
+        case REB_SAEXPORT_FIELD_E:          return o->e;
+        case REB_SAEXPORT_FIELD_INC:        return o->inc;
+        case REB_SAEXPORT_FIELD_OMEGA_NODE: return o->Omega;
+        case REB_SAEXPORT_FIELD_OMEGA_PERI: return o->omega;
+        case REB_SAEXPORT_FIELD_POMEGA:     return o->pomega;
+        case REB_SAEXPORT_FIELD_F:          return o->f;
+        case REB_SAEXPORT_FIELD_M_ANOMALY:  return o->M;
+        case REB_SAEXPORT_FIELD_L:          return o->l;
+        default:
+            return NAN;
+    }
+}
+
+enum reb_input_binary_messages reb_simulationarchive_export(struct reb_simulationarchive* sa, const char* filename, const enum REB_SAEXPORT_FIELD* fields, const int N_fields, const int particle_major, int N_threads){
+    if (sa==NULL || sa->inf==NULL){
+        return REB_INPUT_BINARY_ERROR_FILENOTOPEN;
+    }
+    if (sa->version<2){
+        return REB_INPUT_BINARY_WARNING_VERSION;
+    }
+    // The number of particles and G are taken from the first snapshot.
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    struct reb_simulation* r = reb_create_simulation();
+    reb_create_simulation_from_simulationarchive_with_messages(r, sa, 0, &warnings);
+    if (warnings & (REB_INPUT_BINARY_ERROR_FILENOTOPEN|REB_INPUT_BINARY_ERROR_OUTOFRANGE)){
+        reb_free_simulation(r);
+        return warnings;
+    }
+    const int N = r->N;
+    const int N_real = r->N - r->N_var;
+    const double G = r->G;
+    reb_free_simulation(r);
+    
+    int orbits = 0;
+    for (int f=0;f<N_fields;f++){
+        if (fields[f]>=REB_SAEXPORT_FIELD_A){
+            orbits = 1;
+        }
+    }
+
+    FILE* of = fopen(filename, "wb");
+    if (of==NULL){
+        return REB_INPUT_BINARY_ERROR_NOFILE;
+    }
+    const long N_snapshots = sa->nblobs;
+    const size_t size_snapshot = sizeof(double)*(size_t)N*(7+N_fields);
+    long N_chunk = REB_SAEXPORT_BUFFER_SIZE/(size_snapshot?size_snapshot:1);
+    if (N_chunk<1) N_chunk = 1;
+    if (N_chunk>N_snapshots) N_chunk = N_snapshots;
+    long* snapshots = malloc(sizeof(long)*N_chunk);
+    double* m = malloc(sizeof(double)*N_chunk*N);
+    double (*xyz)[3] = malloc(sizeof(double)*3*N_chunk*N);
+    double (*vxvyvz)[3] = malloc(sizeof(double)*3*N_chunk*N);
+    double* out = malloc(sizeof(double)*N_chunk*N_real*N_fields);
+
+    for (long s0=0; s0<N_snapshots; s0+=N_chunk){
+        const long Ns = s0+N_chunk<N_snapshots?N_chunk:N_snapshots-s0;
+        for (long s=0;s<Ns;s++){
+            snapshots[s] = s0+s;
+        }
+        warnings |= reb_simulationarchive_serialize_particle_data(sa, snapshots, Ns, N, N_threads, m, xyz, vxvyvz);
+        
+        // Arrange the data in the order in which it appears in the file.
+        for (long s=0;s<Ns;s++){
+            // Orbital elements are calculated in Jacobi coordinates.
+            struct reb_particle com = {0};
+            for (int i=0;i<N_real;i++){
+                const size_t k = s*N+i;
+                struct reb_particle p = {0};
+                p.m = m[k];
+                p.x = xyz[k][0]; p.y = xyz[k][1]; p.z = xyz[k][2];
+                p.vx = vxvyvz[k][0]; p.vy = vxvyvz[k][1]; p.vz = vxvyvz[k][2];
+                struct reb_orbit o;
+                const int has_orbit = orbits && i>0;
+                if (has_orbit){
+                    o = reb_tools_particle_to_orbit(G, p, com);
+                }
+                com = i==0?p:reb_get_com_of_pair(com, p);
+                for (int f=0;f<N_fields;f++){
+                    const double v = reb_simulationarchive_export_value(fields[f], m[k], xyz[k], vxvyvz[k], has_orbit?&o:NULL);
+                    if (particle_major){
+                        out[((size_t)f*N_real+i)*Ns+s] = v;
+                    }else{
+                        out[((size_t)f*Ns+s)*N_real+i] = v;
+                    }
+                }
+            }
+        }
+
+        // Each field is a contiguous block in the file.
+        for (int f=0;f<N_fields;f++){
+            const size_t offset_field = (size_t)f*N_snapshots*N_real;
+            if (particle_major){
+                // Block of shape N_real x N_snapshots
+                for (int i=0;i<N_real;i++){
+                    fseek(of, sizeof(double)*(offset_field+(size_t)i*N_snapshots+s0), SEEK_SET);
+                    fwrite(&out[((size_t)f*N_real+i)*Ns], sizeof(double), Ns, of);
+                }
+            }else{
+                // Block of shape N_snapshots x N_real
+                fseek(of, sizeof(double)*(offset_field+(size_t)s0*N_real), SEEK_SET);
+                fwrite(&out[(size_t)f*Ns*N_real], sizeof(double), Ns*N_real, of);
+            }
+        }
+    }
+    if (fclose(of)){
+        warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+    }
+    free(out);
+    free(vxvyvz);
+    free(xyz);
+    free(m);
+    free(snapshots);
+    return warnings;
+}
+
+// SimulationArchive index files
+// The offsets and times of all snapshots are stored in a separate file next
+// to the SimulationArchive (filename + ".idx"). Opening a SimulationArchive 
+// then does not require scanning the entire file. The index is validated with
+// the file length and a checksum of the beginning of the file and the last 
+// snapshot. Invalid or missing index files are rebuilt when the 
+// SimulationArchive is opened.
+
+#define REB_SIMULATIONARCHIVE_INDEX_VERSION 1
+#define REB_SIMULATIONARCHIVE_INDEX_CHECKSUM_BYTES 4096 ///< Number of bytes at the beginning and end of the file included in the checksum
+
+struct reb_simulationarchive_index_header {
+    char magic[16];             // "REBOUND SA index"
+    int32_t index_version;      // Format of the index file
+    int32_t sa_version;         // Version of the SimulationArchive
+    uint64_t nblobs;            // Number of snapshots
+    uint64_t file_size;         // Size of the SimulationArchive covered by the index
+    uint64_t checksum;          // See reb_simulationarchive_index_checksum()
+};
+
+struct reb_simulationarchive_index_entry {
+    uint64_t offset;            // Offset of snapshot in the file
+    uint64_t size;              // Size of snapshot in the file (including the blob)
+    double t;                   // Simulation time of snapshot
+};
+
+static const char reb_simulationarchive_index_magic[16] = {'R','E','B','O','U','N','D',' ','S','A',' ','i','n','d','e','x'};
+
+static char* reb_simulationarchive_index_filename(const char* filename){
+    char* filename_index = malloc(strlen(filename)+5);
+    sprintf(filename_index, "%s.idx", filename);
+    return filename_index;
+}
+
+static uint64_t reb_fnv1a(const char* buf, size_t size, uint64_t h){
+    for (size_t i=0;i<size;i++){
+        h ^= (unsigned char)buf[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Checksum of the beginning of the file (header and initial conditions) and
+// the end of the last snapshot, which ends at file_size. Reads from mem if
+// not NULL, otherwise from inf.
+static uint64_t reb_simulationarchive_index_checksum(FILE* inf, const char* mem, uint64_t offset_last, uint64_t file_size){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    char buf[REB_SIMULATIONARCHIVE_INDEX_CHECKSUM_BYTES];
+    uint64_t starts[2] = {0, offset_last};
+    uint64_t ends[2] = {file_size, file_size};
+    if (file_size-offset_last > REB_SIMULATIONARCHIVE_INDEX_CHECKSUM_BYTES){
+        starts[1] = file_size - REB_SIMULATIONARCHIVE_INDEX_CHECKSUM_BYTES;
+    }
+    if (file_size > REB_SIMULATIONARCHIVE_INDEX_CHECKSUM_BYTES){
+        ends[0] = REB_SIMULATIONARCHIVE_INDEX_CHECKSUM_BYTES;
+    }
+    for (int k=0;k<2;k++){
+        const size_t size = ends[k]-starts[k];
+        if (mem){
+            h = reb_fnv1a(mem+starts[k], size, h);
+        }else{
+            if (fseek(inf, starts[k], SEEK_SET) || fread(buf, size, 1, inf)!=1){
+                return 0;
+            }
+            h = reb_fnv1a(buf, size, h);
+        }
+    }
+    return h;
+}
+
+static void reb_simulationarchive_index_write(const char* filename, const struct reb_simulationarchive* const sa, uint64_t file_size, uint64_t checksum){
+    char* filename_index = reb_simulationarchive_index_filename(filename);
+    FILE* of = fopen(filename_index, "wb");
+    free(filename_index);
+    if (of==NULL){
+        // Directory might not be writeable. The index is optional.
+        return;
+    }
+    struct reb_simulationarchive_index_header header = {0};
+    memcpy(header.magic, reb_simulationarchive_index_magic, 16);
+    header.index_version = REB_SIMULATIONARCHIVE_INDEX_VERSION;
+    header.sa_version = sa->version;
+    header.nblobs = sa->nblobs;
+    header.file_size = file_size;
+    header.checksum = checksum;
+    fwrite(&header, sizeof(struct reb_simulationarchive_index_header), 1, of);
+    for (long i=0;i<sa->nblobs;i++){
+        struct reb_simulationarchive_index_entry entry;
+        entry.offset = sa->offset[i];
+        entry.size = (i<sa->nblobs-1 ? sa->offset[i+1] : file_size) - sa->offset[i];
+        entry.t = sa->t[i];
+        fwrite(&entry, sizeof(struct reb_simulationarchive_index_entry), 1, of);
+    }
+    fclose(of);
+}
+
+// Reads the index file and checks that it is consistent with the SimulationArchive. 
+// Returns the size of the file covered by the index, or 0 if the index is missing or invalid.
+// On success, sa->nblobs, sa->offset, and sa->t are set.
+static uint64_t reb_simulationarchive_index_read(const char* filename, struct reb_simulationarchive* const sa){
+    char* filename_index = reb_simulationarchive_index_filename(filename);
+    FILE* inf = fopen(filename_index, "rb");
+    free(filename_index);
+    if (inf==NULL){
+        return 0;
+    }
+    struct reb_simulationarchive_index_header header = {0};
+    if (fread(&header, sizeof(struct reb_simulationarchive_index_header), 1, inf)!=1
+            || memcmp(header.magic, reb_simulationarchive_index_magic, 16)!=0
+            || header.index_version != REB_SIMULATIONARCHIVE_INDEX_VERSION
+            || header.sa_version != sa->version
+            || header.nblobs < 1){
+        fclose(inf);
+        return 0;
+    }
+    // Size of SimulationArchive
+    reb_simulationarchive_fseek(sa, 0, SEEK_END);
+    const uint64_t file_size = reb_simulationarchive_ftell(sa);
+    if (header.file_size > file_size){
+        fclose(inf);
+        return 0;
+    }
+    struct reb_simulationarchive_index_entry* entries = malloc(sizeof(struct reb_simulationarchive_index_entry)*header.nblobs);
+    int valid = fread(entries, sizeof(struct reb_simulationarchive_index_entry), header.nblobs, inf)==header.nblobs;
+    fclose(inf);
+    const uint64_t offset_last = entries[header.nblobs-1].offset;
+    valid = valid && offset_last + entries[header.nblobs-1].size == header.file_size;
+    valid = valid && header.checksum == reb_simulationarchive_index_checksum(sa->inf, sa->mmap_data, offset_last, header.file_size);
+    if (!valid){
+        free(entries);
+        return 0;
+    }
+    sa->nblobs = header.nblobs;
+    sa->offset = malloc(sizeof(uint64_t)*sa->nblobs);
+    sa->t = malloc(sizeof(double)*sa->nblobs);
+    for (long i=0;i<sa->nblobs;i++){
+        sa->offset[i] = entries[i].offset;
+        sa->t[i] = entries[i].t;
+    }
+    free(entries);
+    return header.file_size;
+}
+
+// Updates the index file after a snapshot has been appended to the 
+// SimulationArchive. The snapshot starts at blob_offset, the file of is
+// still open and positioned at the end of the snapshot. The index file is
+// removed if it did not cover the SimulationArchive up to blob_offset.
+static void reb_simulationarchive_index_append(const char* filename, const int version, const double t, FILE* of, uint64_t blob_offset){
+    const uint64_t file_size = ftell(of);
+    char* filename_index = reb_simulationarchive_index_filename(filename);
+    FILE* idx = fopen(filename_index, "r+b");
+    if (idx==NULL){
+        free(filename_index);
+        return;
+    }
+    struct reb_simulationarchive_index_header header = {0};
+    if (fread(&header, sizeof(struct reb_simulationarchive_index_header), 1, idx)!=1
+            || memcmp(header.magic, reb_simulationarchive_index_magic, 16)!=0
+            || header.index_version != REB_SIMULATIONARCHIVE_INDEX_VERSION
+            || header.sa_version != version
+            || header.file_size != blob_offset){
+        // Index is outdated. It will be rebuilt the next time the SimulationArchive is opened.
+        fclose(idx);
+        remove(filename_index);
+        free(filename_index);
+        return;
+    }
+    free(filename_index);
+    struct reb_simulationarchive_index_entry entry;
+    entry.offset = blob_offset;
+    entry.size = file_size - blob_offset;
+    entry.t = t;
+    fseek(idx, sizeof(struct reb_simulationarchive_index_header)+header.nblobs*sizeof(struct reb_simulationarchive_index_entry), SEEK_SET);
+    fwrite(&entry, sizeof(struct reb_simulationarchive_index_entry), 1, idx);
+    header.nblobs++;
+    header.file_size = file_size;
+    header.checksum = reb_simulationarchive_index_checksum(of, NULL, blob_offset, file_size);
+    fseek(idx, 0, SEEK_SET);
+    fwrite(&header, sizeof(struct reb_simulationarchive_index_header), 1, idx);
+    fclose(idx);
+}
+
+// Creates the index file for a new SimulationArchive which contains only the initial binary.
+static void reb_simulationarchive_index_create(const char* filename, const int version, const double t){
+    FILE* inf = fopen(filename, "rb");
+    if (inf==NULL){
+        return;
+    }
+    fseek(inf, 0, SEEK_END);
+    const uint64_t file_size = ftell(inf);
+    const uint64_t checksum = reb_simulationarchive_index_checksum(inf, NULL, 0, file_size);
+    fclose(inf);
+    struct reb_simulationarchive sa = {0};
+    uint64_t offset = 0;
+    double t0 = t;
+    sa.version = version;
+    sa.nblobs = 1;
+    sa.offset = &offset;
+    sa.t = &t0;
+    reb_simulationarchive_index_write(filename, &sa, file_size, checksum);
+}
+
+void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa, const char* filename,  struct reb_simulationarchive* sa_index, enum reb_input_binary_messages* warnings){
+    const int debug = 0;
+    sa->cache_simulation = NULL;
+    sa->cache_snapshot = 0;
+    sa->inf = fopen(filename,"r");
+    if (sa->inf==NULL){
+        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return;
+    }
+    sa->filename = malloc(strlen(filename)+1);
+    strcpy(sa->filename,filename);
+
+    // Map the file into memory. The index is then built and snapshots are 
+    // decoded without any system calls. Several SimulationArchives opened 
+    // from the same file share the page cache. If mapping is not possible, 
+    // the file is read with fread.
+    sa->mmap_data = NULL;
+    sa->mmap_size = 0;
+    sa->mmap_pos = 0;
+    struct stat file_stat;
+    if (fstat(fileno(sa->inf), &file_stat)==0 && file_stat.st_size>0){
+        void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fileno(sa->inf), 0);
+        if (data!=MAP_FAILED){
+            sa->mmap_data = data;
+            sa->mmap_size = file_stat.st_size;
+        }
+    }
+    
+    // Get version
+    reb_simulationarchive_fseek(sa, 0, SEEK_SET);  
+    struct reb_binary_field field = {0};
+    sa->version = 0;
+    double t0 = 0;
+    do{
+        reb_simulationarchive_fread(&field,sizeof(struct reb_binary_field),1, sa);
+        switch (field.type){
+            case REB_BINARY_FIELD_TYPE_HEADER:
+                //fseek(sa->inf,64 - sizeof(struct reb_binary_field),SEEK_CUR);
+                {
+                    long objects = 0;
+                    // Input header.
+                    const long bufsize = 64 - sizeof(struct reb_binary_field);
+                    char readbuf[bufsize], curvbuf[bufsize];
+                    const char* header = "REBOUND Binary File. Version: ";
+                    sprintf(curvbuf,"%s%s",header+sizeof(struct reb_binary_field), reb_version_str);
+                    
+                    objects += reb_simulationarchive_fread(readbuf,sizeof(char),bufsize, sa);
+                    // Note: following compares version, but ignores githash.
+                    if(strncmp(readbuf,curvbuf,bufsize)!=0){
+                        *warnings |= REB_INPUT_BINARY_WARNING_VERSION;
+                    }
+                }
+                break;
+            case REB_BINARY_FIELD_TYPE_T:
+                reb_simulationarchive_fread(&t0, sizeof(double),1, sa);
+                break;
+            case REB_BINARY_FIELD_TYPE_SAVERSION:
+                reb_simulationarchive_fread(&(sa->version), sizeof(int),1, sa);
+                break;
+            case REB_BINARY_FIELD_TYPE_SASIZESNAPSHOT:
+                reb_simulationarchive_fread(&(sa->size_snapshot), sizeof(long),1, sa);
+                break;
+            case REB_BINARY_FIELD_TYPE_SASIZEFIRST:
+                reb_simulationarchive_fread(&(sa->size_first), sizeof(long),1, sa);
+                break;
+            case REB_BINARY_FIELD_TYPE_SAAUTOWALLTIME:
+                reb_simulationarchive_fread(&(sa->auto_walltime), sizeof(double),1, sa);
+                break;
+            case REB_BINARY_FIELD_TYPE_SAAUTOINTERVAL:
+                reb_simulationarchive_fread(&(sa->auto_interval), sizeof(double),1, sa);
+                break;
+            case REB_BINARY_FIELD_TYPE_SAAUTOSTEP:
+                reb_simulationarchive_fread(&(sa->auto_step), sizeof(unsigned long long),1, sa);
+                break;
+            default:
+                reb_simulationarchive_fseek(sa, field.size,SEEK_CUR);
+                break;
+        }
+    }while(field.type!=REB_BINARY_FIELD_TYPE_END);
+
+    // Make index
+    if (sa->version<2){
+        // Old version
+        if (sa->size_first==-1 || sa->size_snapshot==-1){
+            free(sa->filename);
+            reb_simulationarchive_munmap(sa);
+            fclose(sa->inf);
+            *warnings |= REB_INPUT_BINARY_ERROR_OUTOFRANGE;
+            return;
+        }
+        reb_simulationarchive_fseek(sa, 0, SEEK_END);  
+        sa->nblobs = (reb_simulationarchive_ftell(sa)-sa->size_first)/sa->size_snapshot+1; // +1 accounts for first binary 
+        sa->t = malloc(sizeof(double)*sa->nblobs);
+        sa->offset = malloc(sizeof(uint64_t)*sa->nblobs);
+        sa->t[0] = t0;
+        sa->offset[0] = 0;
+        for(long i=1;i<sa->nblobs;i++){
+            double offset = sa->size_first+(i-1)*sa->size_snapshot;
+            reb_simulationarchive_fseek(sa, offset, SEEK_SET);  
+            reb_simulationarchive_fread(&(sa->t[i]),sizeof(double), 1, sa);
+            sa->offset[i] = offset;
+        }
+    }else{
+        // New version
+        if (debug) printf("=============\n");
+        if (debug) printf("SA Version: 2\n");
+        if (sa_index == NULL){ // Need to construct offset index from file.
+            // If there is a valid index file, only snapshots which have been 
+            // appended since the index file was written need to be read.
+            long i_start = 0;
+            int index_complete = 0;
+            int streamed = 0; // 1 if the last blob read was written to a stream. The file can end after it.
+            const uint64_t file_size_indexed = reb_simulationarchive_index_read(filename, sa);
+            if (file_size_indexed){
+                i_start = sa->nblobs;
+                // Check if the last indexed snapshot is also the last snapshot in the file.
+                int32_t offset_next = -1;
+                if (sa->version<3){
+                    struct reb_simulationarchive_blob16 blob = {0};
+                    reb_simulationarchive_fseek(sa, file_size_indexed - sizeof(struct reb_simulationarchive_blob16), SEEK_SET);
+                    if (reb_simulationarchive_fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, sa)==1){
+                        offset_next = blob.offset_next;
+                    }
+                }else{
+                    struct reb_simulationarchive_blob blob = {0};
+                    reb_simulationarchive_fseek(sa, file_size_indexed - sizeof(struct reb_simulationarchive_blob), SEEK_SET);
+                    if (reb_simulationarchive_fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, sa)==1){
+                        offset_next = blob.offset_next;
+                    }
+                }
+                index_complete = offset_next==0;
+                streamed = offset_next==REB_SIMULATIONARCHIVE_STREAMED;
+            }
+            long nblobsmax = i_start+1024;
+            sa->t = realloc(i_start?sa->t:NULL, sizeof(double)*nblobsmax);
+            sa->offset = realloc(i_start?sa->offset:NULL, sizeof(uint64_t)*nblobsmax);
+            reb_simulationarchive_fseek(sa, file_size_indexed, SEEK_SET);  
+            sa->nblobs = i_start;
+            uint64_t file_size_valid = file_size_indexed;
+            int read_error = 0;
+            struct reb_binary_field lastreadfield = {0};
+            for(long i=i_start;i<nblobsmax && index_complete==0;i++){
+                struct reb_binary_field field = {0};
+                sa->offset[i] = reb_simulationarchive_ftell(sa);
+                int blob_finished = 0;
+                int stream_finished = 0;
+                do{
+                    size_t r1 = reb_simulationarchive_fread(&field,sizeof(struct reb_binary_field),1, sa);
+                    if (r1==1){
+                        lastreadfield = field;
+                        switch (field.type){
+                            case REB_BINARY_FIELD_TYPE_HEADER:
+                                {
+                                    if (debug) printf("SA Field. type=HEADER\n");
+                                    int s1 = reb_simulationarchive_fseek(sa, 64 - sizeof(struct reb_binary_field),SEEK_CUR);
+                                    if (s1){
+                                        read_error = 1;
+                                    }
+                                }
+                                break;
+                            case REB_BINARY_FIELD_TYPE_T:
+                                {
+                                    size_t r2 = reb_simulationarchive_fread(&(sa->t[i]), sizeof(double),1, sa);
+                                    if (debug) printf("SA Field. type=TIME      value=%.10f\n",sa->t[1]);
+                                    if (r2!=1){
+                                        read_error = 1;
+                                    }
+                                }
+                                break;
+                            case REB_BINARY_FIELD_TYPE_END:
+                                {
+                                    if (debug) printf("SA Field. type=END   =====\n");
+                                    blob_finished = 1;
+                                }
+                                break;
+                            default:
+                                {
+                                    int s2 = reb_simulationarchive_fseek(sa, field.size,SEEK_CUR);
+                                    if (debug) printf("SA Field. type=%-6d    size=%llu\n",field.type,field.size);
+                                    if (s2){
+                                        read_error = 1;
+                                    }
+                                }
+                                break;
+                        }
+                    }else if (streamed && reb_simulationarchive_eof(sa) && reb_simulationarchive_ftell(sa)==(long)sa->offset[i]){
+                        if (debug) printf("SA Reached end of stream.\n");
+                        stream_finished = 1;
+                    }else{
+                        read_error = 1;
+                    }
+                }while(blob_finished==0 && read_error==0 && stream_finished==0);
+                if (stream_finished){
+                    break;
+                }
+                if (read_error){
+                    if (debug) printf("SA Error. Error while reading current blob.\n");
+                    // Error during reading. Current snapshot is corrupt.
                     break;
                 }
                 // Everything looks normal so far. Attempt to read next blob
                 if (sa->version<3) { // will be removed in a future release
                     struct reb_simulationarchive_blob16 blob = {0};
-                    size_t r3 = fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, sa->inf);
+                    size_t r3 = reb_simulationarchive_fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, sa);
                     if (r3!=1){ // Next snapshot is definitly corrupted. Assume current might also be.
                         if (debug) printf("SA Error. Error while reading next blob.\n");
                         read_error = 1;
@@ -390,15 +1622,16 @@ void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa,
                     }
                     if (i>0){
                         // Checking the offsets. Acts like a checksum.
-                        if (blob.offset_prev + sizeof(struct reb_simulationarchive_blob16) != ftell(sa->inf) - sa->offset[i] ){
+                        if (blob.offset_prev + sizeof(struct reb_simulationarchive_blob16) != reb_simulationarchive_ftell(sa) - sa->offset[i] ){
                             // Offsets don't work. Next snapshot is definitly corrupted. Assume current one as well.
-                            if (debug) printf("SA Error. Offset mismatch: %lu != %ld.\n",blob.offset_prev + sizeof(struct reb_simulationarchive_blob16), ftell(sa->inf) - sa->offset[i] );
+                            if (debug) printf("SA Error. Offset mismatch: %lu != %ld.\n",blob.offset_prev + sizeof(struct reb_simulationarchive_blob16), (long)(reb_simulationarchive_ftell(sa) - sa->offset[i]) );
                             read_error = 1;
                             break;
                         }
                     }
                     // All tests passed. Accept current snapshot. Increase blob count.
                     sa->nblobs = i+1;
+                    file_size_valid = reb_simulationarchive_ftell(sa);
                     if (blob.offset_next==0){
                         // Last blob. 
                         if (debug) printf("SA Reached final blob.\n");
@@ -407,11 +1640,11 @@ void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa,
                     if (i==nblobsmax-1){ // Increase 
                         nblobsmax += 1024;
                         sa->t = realloc(sa->t,sizeof(double)*nblobsmax);
-                        sa->offset = realloc(sa->offset,sizeof(uint32_t)*nblobsmax);
+                        sa->offset = realloc(sa->offset,sizeof(uint64_t)*nblobsmax);
                     }
                 }else{
                     struct reb_simulationarchive_blob blob = {0};
-                    size_t r3 = fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, sa->inf);
+                    size_t r3 = reb_simulationarchive_fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, sa);
                     if (r3!=1){ // Next snapshot is definitly corrupted. Assume current might also be.
                         if (debug) printf("SA Error. Error while reading next blob.\n");
                         read_error = 1;
@@ -419,15 +1652,17 @@ void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa,
                     }
                     if (i>0){
                         // Checking the offsets. Acts like a checksum.
-                        if (blob.offset_prev + sizeof(struct reb_simulationarchive_blob) != ftell(sa->inf) - sa->offset[i] ){
+                        if (blob.offset_prev + sizeof(struct reb_simulationarchive_blob) != reb_simulationarchive_ftell(sa) - sa->offset[i] ){
                             // Offsets don't work. Next snapshot is definitly corrupted. Assume current one as well.
-                            if (debug) printf("SA Error. Offset mismatch: %lu != %ld.\n",blob.offset_prev + sizeof(struct reb_simulationarchive_blob), ftell(sa->inf) - sa->offset[i] );
+                            if (debug) printf("SA Error. Offset mismatch: %lu != %ld.\n",blob.offset_prev + sizeof(struct reb_simulationarchive_blob), (long)(reb_simulationarchive_ftell(sa) - sa->offset[i]) );
                             read_error = 1;
                             break;
                         }
                     }
                     // All tests passed. Accept current snapshot. Increase blob count.
                     sa->nblobs = i+1;
+                    file_size_valid = reb_simulationarchive_ftell(sa);
+                    streamed = blob.offset_next==REB_SIMULATIONARCHIVE_STREAMED;
                     if (blob.offset_next==0){
                         // Last blob. 
                         if (debug) printf("SA Reached final blob.\n");
@@ -436,7 +1671,7 @@ void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa,
                     if (i==nblobsmax-1){ // Increase 
                         nblobsmax += 1024;
                         sa->t = realloc(sa->t,sizeof(double)*nblobsmax);
-                        sa->offset = realloc(sa->offset,sizeof(uint32_t)*nblobsmax);
+                        sa->offset = realloc(sa->offset,sizeof(uint64_t)*nblobsmax);
                     }
                 }
             }
@@ -444,6 +1679,7 @@ void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa,
                 if (sa->nblobs>0){
                     *warnings |= REB_INPUT_BINARY_WARNING_CORRUPTFILE;
                 }else{
+                    reb_simulationarchive_munmap(sa);
                     fclose(sa->inf);
                     free(sa->filename);
                     free(sa->t);
@@ -453,6 +1689,11 @@ void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa,
                     return;
                 }
             }
+            if (sa->nblobs>1 && (sa->nblobs>i_start || file_size_indexed==0)){
+                // Write (updated) index file. Not done for single binary files.
+                const uint64_t checksum = reb_simulationarchive_index_checksum(sa->inf, sa->mmap_data, sa->offset[sa->nblobs-1], file_size_valid);
+                reb_simulationarchive_index_write(filename, sa, file_size_valid, checksum);
+            }
 
         }else{ // reuse index from other SA
             // This is an optimzation for loading many large SAs.
@@ -460,11 +1701,15 @@ void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa,
             // Unexpected behaviour if the shape is not the same.
             sa->nblobs = sa_index->nblobs;
             sa->t = malloc(sizeof(double)*sa->nblobs);
-            sa->offset = malloc(sizeof(uint32_t)*sa->nblobs);
-            fseek(sa->inf, 0, SEEK_SET);
+            sa->offset = malloc(sizeof(uint64_t)*sa->nblobs);
+            reb_simulationarchive_fseek(sa, 0, SEEK_SET);
             // No need to read the large file, just copying the index.
-            memcpy(sa->offset, sa_index->offset, sizeof(uint32_t)*sa->nblobs);
+            memcpy(sa->offset, sa_index->offset, sizeof(uint64_t)*sa->nblobs);
             memcpy(sa->t, sa_index->t, sizeof(double)*sa->nblobs);
+            if (sa->nblobs>0 && sa->offset[sa->nblobs-1]>=sa->mmap_size){
+                // File is shorter than expected. Do not read it from memory.
+                reb_simulationarchive_munmap(sa);
+            }
         }
     }
 }
@@ -480,48 +1725,690 @@ struct reb_simulationarchive* reb_open_simulationarchive(const char* filename){
     }else{
         reb_input_process_warnings(NULL, warnings);
     }
-    return sa;
+    return sa;
+}
+
+void reb_close_simulationarchive(struct reb_simulationarchive* sa){
+    reb_free_simulationarchive_pointers(sa);
+    free(sa);
+}
+
+void reb_free_simulationarchive_pointers(struct reb_simulationarchive* sa){
+    if (sa==NULL) return;
+    reb_simulationarchive_munmap(sa);
+    if (sa->inf){
+        fclose(sa->inf);
+    }
+    free(sa->filename);
+    free(sa->t);
+    free(sa->offset);
+    if (sa->cache_simulation){
+        reb_free_simulation(sa->cache_simulation);
+        sa->cache_simulation = NULL;
+    }
+}
+    
+static int reb_simulationarchive_snapshotsize(struct reb_simulation* const r){
+    int size_snapshot = 0;
+    switch (r->integrator){
+        case REB_INTEGRATOR_JANUS:
+            size_snapshot = sizeof(double)*2+sizeof(struct reb_particle_int)*r->N;
+            break;
+        case REB_INTEGRATOR_WHFAST:
+        case REB_INTEGRATOR_SABA:
+            size_snapshot = sizeof(double)*2+sizeof(double)*7*r->N;
+            break;
+        case REB_INTEGRATOR_MERCURIUS:
+            size_snapshot = sizeof(double)*2+sizeof(double)*8*r->N;
+            break;
+        case REB_INTEGRATOR_IAS15:
+            size_snapshot =  sizeof(double)*4  // time, walltime, dt, dt_last_done
+                             +sizeof(double)*3*r->N*5*7  // dp7 arrays
+                             +sizeof(double)*7*r->N      // particle m, pos, vel
+                             +sizeof(double)*3*r->N*2;   // csx, csv
+            break;
+        default:
+            reb_error(r,"Simulation archive not implemented for this integrator.");
+            break;
+    }
+    return size_snapshot;
+}
+
+// Warnings which can occur while writing a snapshot. They are returned as a
+// bitmask so that the writer thread can pass them on to the simulation.
+enum {
+    REB_SIMULATIONARCHIVE_WARNING_OPEN_FAILED = 1,
+    REB_SIMULATIONARCHIVE_WARNING_RECOVERY_FAILED = 2,
+    REB_SIMULATIONARCHIVE_WARNING_CORRUPTED = 4,
+};
+
+static void reb_simulationarchive_write_warnings(struct reb_simulation* const r, const int warnings){
+    if (warnings & REB_SIMULATIONARCHIVE_WARNING_OPEN_FAILED){
+        reb_error(r,"Can not open file.");
+    }
+    if (warnings & REB_SIMULATIONARCHIVE_WARNING_CORRUPTED){
+        reb_warning(r, "SimulationArchive appears to be corrupted. REBOUND will attempt to fix it before appending more snapshots.\n");
+    }
+    if (warnings & REB_SIMULATIONARCHIVE_WARNING_RECOVERY_FAILED){
+        reb_warning(r, "SimulationArchive appears to be corrupted. A recovery attempt has failed. No snapshot has been saved.\n");
+    }
+}
+
+// Replaces all fields in the diff of a snapshot with one compressed field. 
+// Only the time is kept uncompressed because it is needed to build the 
+// index of snapshots. The diff is left unchanged if it is incompressible.
+static void reb_simulationarchive_compress_diff(char** buf_diff, size_t* size_diff, const int level){
+    char* buf_fields = malloc(*size_diff+sizeof(struct reb_binary_field));
+    size_t size_fields = 0;
+    char* buf_time = NULL;
+    size_t size_time = 0;
+    size_t pos = 0;
+    while (pos+sizeof(struct reb_binary_field)<=*size_diff){
+        struct reb_binary_field field;
+        memcpy(&field, *buf_diff+pos, sizeof(struct reb_binary_field));
+        const size_t size_field = sizeof(struct reb_binary_field)+field.size;
+        if (field.type==REB_BINARY_FIELD_TYPE_T){
+            buf_time = *buf_diff+pos;
+            size_time = size_field;
+        }else{
+            memcpy(buf_fields+size_fields, *buf_diff+pos, size_field);
+            size_fields += size_field;
+        }
+        pos += size_field;
+    }
+    struct reb_binary_field end = {.type = REB_BINARY_FIELD_TYPE_END, .size = 0};
+    memcpy(buf_fields+size_fields, &end, sizeof(struct reb_binary_field));
+    size_fields += sizeof(struct reb_binary_field);
+
+    char* buf_compressed;
+    size_t size_compressed;
+    reb_compress(buf_fields, size_fields, level, &buf_compressed, &size_compressed);
+    free(buf_fields);
+    const size_t size_new = size_time + sizeof(struct reb_binary_field) + size_compressed;
+    if (size_new < *size_diff){
+        char* buf_new = malloc(size_new);
+        if (buf_time){
+            memcpy(buf_new, buf_time, size_time);
+        }
+        struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_SACOMPRESSED, .size = size_compressed};
+        memcpy(buf_new+size_time, &field, sizeof(struct reb_binary_field));
+        memcpy(buf_new+size_time+sizeof(struct reb_binary_field), buf_compressed, size_compressed);
+        free(*buf_diff);
+        *buf_diff = buf_new;
+        *size_diff = size_new;
+    }
+    free(buf_compressed);
+}
+
+// Serializes the physical state of the simulation: the time, the timestep
+// and the masses, radii, positions, velocities and hashes of all particles.
+// The particles are synchronized first. For WHFast and SABA this does not 
+// change how the simulation continues.
+static void reb_simulationarchive_physical_to_stream(struct reb_simulation* const r, char** bufp, size_t* sizep){
+    reb_integrator_synchronize_output(r);
+    const int N = r->N;
+    const int single = r->simulationarchive_physical_only==2;
+    const size_t size_real = single?sizeof(float):sizeof(double);
+    const size_t size_particles = N*(REB_PARTICLE_PHYSICAL_N*size_real+sizeof(uint32_t));
+    const size_t size = 3*sizeof(struct reb_binary_field) + 2*sizeof(double) + size_particles;
+    char* const buf = malloc(size);
+    char* p = buf;
+    struct reb_binary_field field;
+    field.type = REB_BINARY_FIELD_TYPE_T;
+    field.size = sizeof(double);
+    memcpy(p, &field, sizeof(struct reb_binary_field));
+    memcpy(p+sizeof(struct reb_binary_field), &r->t, sizeof(double));
+    p += sizeof(struct reb_binary_field)+sizeof(double);
+    field.type = REB_BINARY_FIELD_TYPE_DT;
+    memcpy(p, &field, sizeof(struct reb_binary_field));
+    memcpy(p+sizeof(struct reb_binary_field), &r->dt, sizeof(double));
+    p += sizeof(struct reb_binary_field)+sizeof(double);
+    field.type = single?REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT:REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL;
+    field.size = size_particles;
+    memcpy(p, &field, sizeof(struct reb_binary_field));
+    p += sizeof(struct reb_binary_field);
+    // One array per quantity. This also helps the compression.
+    for (int k=0;k<REB_PARTICLE_PHYSICAL_N;k++){
+        for (int i=0;i<N;i++){
+            double v;
+            memcpy(&v, (char*)&r->particles[i]+reb_particle_physical_offsets[k], sizeof(double));
+            if (single){
+                const float f = v;
+                memcpy(p, &f, sizeof(float));
+            }else{
+                memcpy(p, &v, sizeof(double));
+            }
+            p += size_real;
+        }
+    }
+    for (int i=0;i<N;i++){
+        memcpy(p, &r->particles[i].hash, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+    }
+    *bufp = buf;
+    *sizep = size;
+}
+
+// Serializes the simulation for a snapshot. Returns 1 if only the physical
+// state has been serialized. The first snapshot of a SimulationArchive is
+// always complete because it provides all other settings.
+static int reb_simulationarchive_serialize(struct reb_simulation* const r, const char* filename, char** bufp, size_t* sizep){
+    if (r->simulationarchive_physical_only){
+        struct stat buffer;
+        if (stat(filename, &buffer) < 0){
+            // The file might not have been created by the asynchronous writer yet.
+            reb_simulationarchive_writer_flush(r);
+        }
+        if (stat(filename, &buffer) == 0){
+            reb_simulationarchive_physical_to_stream(r, bufp, sizep);
+            return 1;
+        }
+    }
+    reb_output_binary_to_stream(r, bufp, sizep);
+    return 0;
+}
+
+// Base snapshot and open file of a SimulationArchive which is being written.
+struct reb_simulationarchive_cache {
+    char* filename;                         // NULL if the cache is empty
+    FILE* of;                               // Open file handle
+    char* buf_base;                         // First snapshot, the base of all diffs
+    size_t size_base;
+    struct reb_simulationarchive_blob blob; // Last blob in the file
+    long tail;                              // Offset of the end of the last blob
+    struct stat st;                         // File status after the last snapshot has been written
+};
+
+static void reb_simulationarchive_cache_clear(struct reb_simulationarchive_cache* const cache){
+    if (cache->of){
+        fclose(cache->of);
+    }
+    free(cache->buf_base);
+    free(cache->filename);
+    *cache = (struct reb_simulationarchive_cache){0};
+}
+
+// Returns 1 if filename is the file in the cache and it has not been modified since.
+static int reb_simulationarchive_cache_valid(const struct reb_simulationarchive_cache* const cache, const char* filename){
+    if (cache->filename==NULL || strcmp(cache->filename, filename)!=0){
+        return 0;
+    }
+    struct stat st;
+    if (stat(filename, &st)!=0){
+        return 0;
+    }
+    return st.st_dev==cache->st.st_dev && st.st_ino==cache->st.st_ino && st.st_size==cache->st.st_size
+        && st.st_mtime==cache->st.st_mtime && st.st_ctime==cache->st.st_ctime;
+}
+
+void reb_simulationarchive_cache_free(struct reb_simulation* const r){
+    if (r->simulationarchive_cache){
+        reb_simulationarchive_cache_clear(r->simulationarchive_cache);
+        free(r->simulationarchive_cache);
+        r->simulationarchive_cache = NULL;
+    }
+}
+
+// Writes a snapshot to the SimulationArchive filename. The snapshot
+// buf_new is the simulation serialized with reb_output_binary_to_stream
+// or, if physical is 1, with reb_simulationarchive_physical_to_stream.
+// A new SimulationArchive is created if the file does not exist. This
+// function does not access the simulation and can therefore run on the
+// writer thread. Warnings are returned as a bitmask. For version 3, the
+// first snapshot, an open file handle and the position of the last blob
+// are kept in cache. The file is only read again if it has been modified 
+// by someone else since the last snapshot.
+static int reb_simulationarchive_write_snapshot(struct reb_simulationarchive_cache* const cache, const char* filename, const int version, const int compression, const int physical, const double t, char* buf_new, size_t size_new){
+    int warnings = 0;
+    struct stat buffer;
+    if (stat(filename, &buffer) < 0){
+        // File does not exist. Output binary.
+        reb_simulationarchive_cache_clear(cache);
+        FILE* of = fopen(filename,"wb");
+        if (of==NULL){
+            return REB_SIMULATIONARCHIVE_WARNING_OPEN_FAILED;
+        }
+        fwrite(buf_new,size_new,1,of);
+        fclose(of);
+        reb_simulationarchive_index_create(filename, version, t);
+        return warnings;
+    }
+    if (version<3){ // duplicate for working with old files. Will be removed in future release
+        // Create buffer containing original binary file
+        FILE* of = fopen(filename,"r+b");
+        fseek(of, 64, SEEK_SET); // Header
+        struct reb_binary_field field = {0};
+        struct reb_simulationarchive_blob16 blob = {0};
+        int bytesread;
+        do{
+            bytesread = fread(&field,sizeof(struct reb_binary_field),1,of);
+            fseek(of, field.size, SEEK_CUR);
+        }while(field.type!=REB_BINARY_FIELD_TYPE_END && bytesread);
+        long size_old = ftell(of);
+        if (bytesread!=1){
+            fclose(of);
+            return REB_SIMULATIONARCHIVE_WARNING_RECOVERY_FAILED;
+        }
+            
+        bytesread = fread(&blob,sizeof(struct reb_simulationarchive_blob16),1,of);
+        if (bytesread!=1){
+            fclose(of);
+            return REB_SIMULATIONARCHIVE_WARNING_RECOVERY_FAILED;
+        }
+        int archive_contains_more_than_one_blob = 0;
+        if (blob.offset_next>0){
+            archive_contains_more_than_one_blob = 1;
+        }
+
+        
+        char* buf_old = malloc(size_old);
+        fseek(of, 0, SEEK_SET);  
+        fread(buf_old, size_old,1,of);
+
+        // Create buffer containing diff
+        char* buf_diff;
+        size_t size_diff;
+        if (physical){
+            // Physical state snapshots are stored as they are.
+            buf_diff = malloc(size_new);
+            memcpy(buf_diff, buf_new, size_new);
+            size_diff = size_new;
+        }else{
+            reb_binary_diff(buf_old, size_old, buf_new, size_new, &buf_diff, &size_diff);
+        }
+        if (compression){
+            reb_simulationarchive_compress_diff(&buf_diff, &size_diff, compression);
+        }
+
+        int file_corrupt = 0;
+        int seek_ok = fseek(of, -sizeof(struct reb_simulationarchive_blob16), SEEK_END);
+        int blobs_read = fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
+        if (seek_ok !=0 || blobs_read != 1){ // cannot read blob
+            file_corrupt = 1;
+        }
+        if ( (archive_contains_more_than_one_blob && blob.offset_prev <=0) || blob.offset_next != 0){ // blob contains unexpected data. Note: First blob is all zeros.
+            file_corrupt = 1;
+        }
+        if (file_corrupt==0 && archive_contains_more_than_one_blob ){
+            // Check if last two blobs are consistent.
+            seek_ok = fseek(of, - sizeof(struct reb_simulationarchive_blob16) - sizeof(struct reb_binary_field), SEEK_CUR);  
+            bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
+            if (seek_ok!=0 || bytesread!=1){
+                file_corrupt = 1;
+            }
+            if (field.type != REB_BINARY_FIELD_TYPE_END || field.size !=0){
+                // expected an END field
+                file_corrupt = 1;
+            }
+            seek_ok = fseek(of, -blob.offset_prev - sizeof(struct reb_simulationarchive_blob16), SEEK_CUR);  
+            struct reb_simulationarchive_blob16 blob2 = {0};
+            blobs_read = fread(&blob2, sizeof(struct reb_simulationarchive_blob16), 1, of);
+            if (seek_ok!=0 || blobs_read!=1 || blob2.offset_next != blob.offset_prev){
+                file_corrupt = 1;
+            }
+        }
+
+        if (file_corrupt){
+            // Find last valid snapshot to allow for restarting and appending to archives where last snapshot was cut off
+            warnings |= REB_SIMULATIONARCHIVE_WARNING_CORRUPTED;
+            int seek_ok;
+            seek_ok = fseek(of, size_old, SEEK_SET);
+            long last_blob = size_old + sizeof(struct reb_simulationarchive_blob16);
+            do
+            {
+                seek_ok = fseek(of, -sizeof(struct reb_binary_field), SEEK_CUR);
+                if (seek_ok != 0){
+                    break;
+                }
+                bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
+                if (bytesread != 1 || field.type != REB_BINARY_FIELD_TYPE_END){ // could be EOF or corrupt snapshot
+                    break;
+                }
+                bytesread = fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
+                if (bytesread != 1){
+                    break;
+                }
+                last_blob = ftell(of);
+                if (blob.offset_next>0){
+                    seek_ok = fseek(of, blob.offset_next, SEEK_CUR);
+                }else{
+                    break;
+                }
+                if (seek_ok != 0){
+                    break;
+                }
+            } while(1);
+
+            // To append diff, seek to last valid location (=EOF if all snapshots valid)
+            fseek(of, last_blob, SEEK_SET);
+        }else{
+            // File is not corrupt. Start at end to save time.
+            fseek(of, 0, SEEK_END);  
+        }
+
+        // Update blob info and Write diff to binary file
+        fseek(of, -sizeof(struct reb_simulationarchive_blob16), SEEK_CUR);  
+        fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
+        blob.offset_next = size_diff+sizeof(struct reb_binary_field);
+        fseek(of, -sizeof(struct reb_simulationarchive_blob16), SEEK_CUR);  
+        fwrite(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
+        const long blob_offset = ftell(of);
+        fwrite(buf_diff, size_diff, 1, of); 
+        field.type = REB_BINARY_FIELD_TYPE_END;
+        field.size = 0;
+        fwrite(&field,sizeof(struct reb_binary_field), 1, of);
+        blob.index++;
+        blob.offset_prev = blob.offset_next;
+        blob.offset_next = 0;
+        fwrite(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
+        reb_simulationarchive_index_append(filename, version, t, of, blob_offset);
+
+        fclose(of);
+        free(buf_old);
+        free(buf_diff);
+    }else{ // Duplicate (version 3 of SimulationArchive. This is the part that will remain. Above duplicate will be removed in future release.
+        if (!reb_simulationarchive_cache_valid(cache, filename)){
+            // Read the first snapshot and find the end of the last valid blob.
+            reb_simulationarchive_cache_clear(cache);
+            FILE* of = fopen(filename,"r+b");
+            if (of==NULL){
+                return REB_SIMULATIONARCHIVE_WARNING_OPEN_FAILED;
+            }
+            fseek(of, 64, SEEK_SET); // Header
+            struct reb_binary_field field = {0};
+            struct reb_simulationarchive_blob blob = {0};
+            int bytesread;
+            do{
+                bytesread = fread(&field,sizeof(struct reb_binary_field),1,of);
+                fseek(of, field.size, SEEK_CUR);
+            }while(field.type!=REB_BINARY_FIELD_TYPE_END && bytesread);
+            long size_old = ftell(of);
+            if (bytesread!=1){
+                fclose(of);
+                return REB_SIMULATIONARCHIVE_WARNING_RECOVERY_FAILED;
+            }
+                
+            bytesread = fread(&blob,sizeof(struct reb_simulationarchive_blob),1,of);
+            if (bytesread!=1){
+                fclose(of);
+                return REB_SIMULATIONARCHIVE_WARNING_RECOVERY_FAILED;
+            }
+            int archive_contains_more_than_one_blob = 0;
+            if (blob.offset_next>0){
+                archive_contains_more_than_one_blob = 1;
+            }
+
+            char* buf_old = malloc(size_old);
+            fseek(of, 0, SEEK_SET);  
+            fread(buf_old, size_old,1,of);
+
+            int file_corrupt = 0;
+            int seek_ok = fseek(of, -sizeof(struct reb_simulationarchive_blob), SEEK_END);
+            int blobs_read = fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
+            if (seek_ok !=0 || blobs_read != 1){ // cannot read blob
+                file_corrupt = 1;
+            }
+            if ( (archive_contains_more_than_one_blob && blob.offset_prev <=0) || (blob.offset_next != 0 && blob.offset_next != REB_SIMULATIONARCHIVE_STREAMED)){ // blob contains unexpected data. Note: First blob is all zeros.
+                file_corrupt = 1;
+            }
+            if (file_corrupt==0 && archive_contains_more_than_one_blob ){
+                // Check if last two blobs are consistent.
+                seek_ok = fseek(of, - sizeof(struct reb_simulationarchive_blob) - sizeof(struct reb_binary_field), SEEK_CUR);  
+                bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
+                if (seek_ok!=0 || bytesread!=1){
+                    file_corrupt = 1;
+                }
+                if (field.type != REB_BINARY_FIELD_TYPE_END || field.size !=0){
+                    // expected an END field
+                    file_corrupt = 1;
+                }
+                seek_ok = fseek(of, -blob.offset_prev - sizeof(struct reb_simulationarchive_blob), SEEK_CUR);  
+                struct reb_simulationarchive_blob blob2 = {0};
+                blobs_read = fread(&blob2, sizeof(struct reb_simulationarchive_blob), 1, of);
+                if (seek_ok!=0 || blobs_read!=1 || blob2.offset_next != blob.offset_prev){
+                    file_corrupt = 1;
+                }
+            }
+
+            if (file_corrupt){
+                // Find last valid snapshot to allow for restarting and appending to archives where last snapshot was cut off
+                warnings |= REB_SIMULATIONARCHIVE_WARNING_CORRUPTED;
+                int seek_ok;
+                seek_ok = fseek(of, size_old, SEEK_SET);
+                long last_blob = size_old + sizeof(struct reb_simulationarchive_blob);
+                do
+                {
+                    seek_ok = fseek(of, -sizeof(struct reb_binary_field), SEEK_CUR);
+                    if (seek_ok != 0){
+                        break;
+                    }
+                    bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
+                    if (bytesread != 1 || field.type != REB_BINARY_FIELD_TYPE_END){ // could be EOF or corrupt snapshot
+                        break;
+                    }
+                    bytesread = fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
+                    if (bytesread != 1){
+                        break;
+                    }
+                    last_blob = ftell(of);
+                    if (blob.offset_next>0){
+                        seek_ok = fseek(of, blob.offset_next, SEEK_CUR);
+                    }else if (blob.offset_next==REB_SIMULATIONARCHIVE_STREAMED){
+                        // Size of the next blob is unknown. Skip its fields.
+                        do{
+                            bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
+                            seek_ok = fseek(of, field.type==REB_BINARY_FIELD_TYPE_END?0:field.size, SEEK_CUR);
+                        }while(bytesread==1 && seek_ok==0 && field.type!=REB_BINARY_FIELD_TYPE_END);
+                        if (bytesread!=1){
+                            break;
+                        }
+                    }else{
+                        break;
+                    }
+                    if (seek_ok != 0){
+                        break;
+                    }
+                } while(1);
+
+                // To append diff, seek to last valid location (=EOF if all snapshots valid)
+                fseek(of, last_blob, SEEK_SET);
+            }else{
+                // File is not corrupt. Start at end to save time.
+                fseek(of, 0, SEEK_END);  
+            }
+            fseek(of, -sizeof(struct reb_simulationarchive_blob), SEEK_CUR);  
+            fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
+
+            cache->filename = malloc(strlen(filename)+1);
+            strcpy(cache->filename, filename);
+            cache->of = of;
+            cache->buf_base = buf_old;
+            cache->size_base = size_old;
+            cache->blob = blob;
+            cache->tail = ftell(of);
+        }
+
+        // Create buffer containing diff
+        char* buf_diff;
+        size_t size_diff;
+        if (physical){
+            // Physical state snapshots are stored as they are.
+            buf_diff = malloc(size_new);
+            memcpy(buf_diff, buf_new, size_new);
+            size_diff = size_new;
+        }else{
+            reb_binary_diff(cache->buf_base, cache->size_base, buf_new, size_new, &buf_diff, &size_diff);
+        }
+        if (compression){
+            reb_simulationarchive_compress_diff(&buf_diff, &size_diff, compression);
+        }
+
+        // Update blob info and Write diff to binary file
+        FILE* of = cache->of;
+        struct reb_simulationarchive_blob blob = cache->blob;
+        struct reb_binary_field field = {0};
+        fseek(of, cache->tail-sizeof(struct reb_simulationarchive_blob), SEEK_SET);  
+        blob.offset_next = size_diff+sizeof(struct reb_binary_field);
+        fwrite(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
+        const long blob_offset = ftell(of);
+        fwrite(buf_diff, size_diff, 1, of); 
+        field.type = REB_BINARY_FIELD_TYPE_END;
+        field.size = 0;
+        fwrite(&field,sizeof(struct reb_binary_field), 1, of);
+        blob.index++;
+        blob.offset_prev = blob.offset_next;
+        blob.offset_next = 0;
+        fwrite(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
+        cache->tail = ftell(of);
+        cache->blob = blob;
+        reb_simulationarchive_index_append(filename, version, t, of, blob_offset);
+        fflush(of);
+        if (stat(filename, &cache->st)!=0){
+            reb_simulationarchive_cache_clear(cache);
+        }
+
+        free(buf_diff);
+    }
+    return warnings;
+}
+
+// Asynchronous writer. The simulation is serialized on the thread which
+// integrates the simulation. The binary diff and the file operations are 
+// done on a background thread. There is room for one snapshot waiting to
+// be written while the writer thread works on the previous one. The 
+// integration only waits if both are occupied.
+
+struct reb_simulationarchive_writer_job {
+    char* filename;
+    int version;
+    int compression;
+    int physical;
+    double t;
+    char* buf;              // Serialized simulation. NULL if there is no job.
+    size_t size;
+};
+
+struct reb_simulationarchive_writer {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    // Signaled whenever job, busy or shutdown changes
+    struct reb_simulationarchive_writer_job job; // Next snapshot to be written
+    int busy;               // 1 while the writer thread writes a snapshot
+    int shutdown;           // Set to 1 to terminate the writer thread
+    int warnings;           // Warnings which have not been passed on to the simulation yet
+    struct reb_simulationarchive_cache cache; // Only used by the writer thread
+};
+
+static void* reb_simulationarchive_writer_thread(void* args){
+    struct reb_simulationarchive_writer* const w = args;
+    pthread_mutex_lock(&w->mutex);
+    while (1){
+        while (w->job.buf==NULL && w->shutdown==0){
+            pthread_cond_wait(&w->cond, &w->mutex);
+        }
+        if (w->job.buf==NULL){
+            break;
+        }
+        struct reb_simulationarchive_writer_job job = w->job;
+        w->job.buf = NULL;
+        w->busy = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+
+        const int warnings = reb_simulationarchive_write_snapshot(&w->cache, job.filename, job.version, job.compression, job.physical, job.t, job.buf, job.size);
+        free(job.filename);
+        free(job.buf);
+
+        pthread_mutex_lock(&w->mutex);
+        w->warnings |= warnings;
+        w->busy = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
 }
 
-void reb_close_simulationarchive(struct reb_simulationarchive* sa){
-    reb_free_simulationarchive_pointers(sa);
-    free(sa);
+static void reb_simulationarchive_writer_submit(struct reb_simulation* const r, const char* filename){
+    struct reb_simulationarchive_writer* w = r->simulationarchive_writer;
+    if (w==NULL){
+        w = calloc(1, sizeof(struct reb_simulationarchive_writer));
+        pthread_mutex_init(&w->mutex, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        if (pthread_create(&w->thread, NULL, reb_simulationarchive_writer_thread, w)){
+            pthread_mutex_destroy(&w->mutex);
+            pthread_cond_destroy(&w->cond);
+            free(w);
+            reb_warning(r, "Cannot create SimulationArchive writer thread. Snapshots are written synchronously.");
+            r->simulationarchive_async = 0;
+            reb_simulationarchive_snapshot(r, filename);
+            return;
+        }
+        r->simulationarchive_writer = w;
+    }
+    struct reb_simulationarchive_writer_job job;
+    job.filename = malloc(strlen(filename)+1);
+    strcpy(job.filename, filename);
+    job.version = r->simulationarchive_version;
+    job.compression = r->simulationarchive_compression;
+    job.physical = reb_simulationarchive_serialize(r, filename, &job.buf, &job.size);
+    job.t = r->t;
+
+    pthread_mutex_lock(&w->mutex);
+    while (w->job.buf!=NULL){
+        pthread_cond_wait(&w->cond, &w->mutex);
+    }
+    w->job = job;
+    const int warnings = w->warnings;
+    w->warnings = 0;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    reb_simulationarchive_write_warnings(r, warnings);
 }
 
-void reb_free_simulationarchive_pointers(struct reb_simulationarchive* sa){
-    if (sa==NULL) return;
-    if (sa->inf){
-        fclose(sa->inf);
+void reb_simulationarchive_writer_flush(struct reb_simulation* const r){
+    struct reb_simulationarchive_writer* const w = r->simulationarchive_writer;
+    if (w==NULL){
+        return;
     }
-    free(sa->filename);
-    free(sa->t);
-    free(sa->offset);
+    pthread_mutex_lock(&w->mutex);
+    while (w->job.buf!=NULL || w->busy){
+        pthread_cond_wait(&w->cond, &w->mutex);
+    }
+    const int warnings = w->warnings;
+    w->warnings = 0;
+    pthread_mutex_unlock(&w->mutex);
+    reb_simulationarchive_write_warnings(r, warnings);
 }
-    
-static int reb_simulationarchive_snapshotsize(struct reb_simulation* const r){
-    int size_snapshot = 0;
-    switch (r->integrator){
-        case REB_INTEGRATOR_JANUS:
-            size_snapshot = sizeof(double)*2+sizeof(struct reb_particle_int)*r->N;
-            break;
-        case REB_INTEGRATOR_WHFAST:
-        case REB_INTEGRATOR_SABA:
-            size_snapshot = sizeof(double)*2+sizeof(double)*7*r->N;
-            break;
-        case REB_INTEGRATOR_MERCURIUS:
-            size_snapshot = sizeof(double)*2+sizeof(double)*8*r->N;
-            break;
-        case REB_INTEGRATOR_IAS15:
-            size_snapshot =  sizeof(double)*4  // time, walltime, dt, dt_last_done
-                             +sizeof(double)*3*r->N*5*7  // dp7 arrays
-                             +sizeof(double)*7*r->N      // particle m, pos, vel
-                             +sizeof(double)*3*r->N*2;   // csx, csv
-            break;
-        default:
-            reb_error(r,"Simulation archive not implemented for this integrator.");
-            break;
+
+void reb_simulationarchive_writer_free(struct reb_simulation* const r){
+    struct reb_simulationarchive_writer* const w = r->simulationarchive_writer;
+    if (w==NULL){
+        return;
     }
-    return size_snapshot;
+    reb_simulationarchive_writer_flush(r);
+    pthread_mutex_lock(&w->mutex);
+    w->shutdown = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->thread, NULL);
+    reb_simulationarchive_cache_clear(&w->cache);
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->cond);
+    free(w);
+    r->simulationarchive_writer = NULL;
+}
+
+// Takes a snapshot triggered by reb_simulationarchive_heartbeat.
+static void reb_simulationarchive_heartbeat_snapshot(struct reb_simulation* const r){
+    PROFILING_START(r)
+    TRACE_BEGIN(r, REB_TRACE_PHASE_SIMULATIONARCHIVE)
+    if (r->simulationarchive_async && r->simulationarchive_version>=2){
+        reb_simulationarchive_writer_submit(r, r->simulationarchive_filename);
+    }else{
+        reb_simulationarchive_snapshot(r, NULL);
+    }
+    TRACE_END(r, REB_TRACE_PHASE_SIMULATIONARCHIVE)
+    PROFILING_STOP(r, REB_PROFILING_CAT_SIMULATIONARCHIVE)
 }
 
 void reb_simulationarchive_heartbeat(struct reb_simulation* const r){
@@ -538,24 +2425,34 @@ void reb_simulationarchive_heartbeat(struct reb_simulation* const r){
             if (sign*r->simulationarchive_next <= sign*r->t){
                 r->simulationarchive_next += sign*r->simulationarchive_auto_interval;
                 //Snap
-                reb_simulationarchive_snapshot(r, NULL);
+                reb_simulationarchive_heartbeat_snapshot(r);
             }
         }
         if (r->simulationarchive_auto_step!=0.){
             if (r->simulationarchive_next_step <= r->steps_done){
                 r->simulationarchive_next_step += r->simulationarchive_auto_step;
                 //Snap
-                reb_simulationarchive_snapshot(r, NULL);
+                reb_simulationarchive_heartbeat_snapshot(r);
             }
         }
         if (r->simulationarchive_auto_walltime!=0.){
             if (r->simulationarchive_next <= r->walltime){
                 r->simulationarchive_next += r->simulationarchive_auto_walltime;
                 //Snap
-                reb_simulationarchive_snapshot(r, NULL);
+                reb_simulationarchive_heartbeat_snapshot(r);
             }
         } 
     }
+    if (r->simulationarchive_checkpoint_filename!=NULL){
+        if (r->simulationarchive_checkpoint_next <= r->walltime){
+            r->simulationarchive_checkpoint_next += r->simulationarchive_checkpoint_walltime;
+            PROFILING_START(r)
+            TRACE_BEGIN(r, REB_TRACE_PHASE_SIMULATIONARCHIVE)
+            reb_simulationarchive_checkpoint(r, r->simulationarchive_checkpoint_filename, r->simulationarchive_checkpoint_N);
+            TRACE_END(r, REB_TRACE_PHASE_SIMULATIONARCHIVE)
+            PROFILING_STOP(r, REB_PROFILING_CAT_SIMULATIONARCHIVE)
+        }
+    }
 }
 static inline void reb_save_dp7_old(struct reb_dp7* dp7, const int N3, FILE* of){
     fwrite(dp7->p0,sizeof(double),N3,of);
@@ -569,350 +2466,101 @@ static inline void reb_save_dp7_old(struct reb_dp7* dp7, const int N3, FILE* of)
 
 void reb_simulationarchive_snapshot(struct reb_simulation* const r, const char* filename){
     if (filename==NULL) filename = r->simulationarchive_filename;
+    if (r->simulationarchive_version>=2){
+        // Snapshots queued by the asynchronous writer need to be written first.
+        reb_simulationarchive_writer_flush(r);
+        char* buf;
+        size_t size;
+        const int physical = reb_simulationarchive_serialize(r, filename, &buf, &size);
+        if (r->simulationarchive_cache==NULL){
+            r->simulationarchive_cache = calloc(1, sizeof(struct reb_simulationarchive_cache));
+        }
+        const int warnings = reb_simulationarchive_write_snapshot(r->simulationarchive_cache, filename, r->simulationarchive_version, r->simulationarchive_compression, physical, r->t, buf, size);
+        free(buf);
+        reb_simulationarchive_write_warnings(r, warnings);
+        return;
+    }
     struct stat buffer;
     if (stat(filename, &buffer) < 0){
         // File does not exist. Output binary.
-        if (r->simulationarchive_version<2){
-            // Old version
-            r->simulationarchive_size_snapshot = reb_simulationarchive_snapshotsize(r);
-        }
+        r->simulationarchive_size_snapshot = reb_simulationarchive_snapshotsize(r);
         reb_output_binary(r,filename);
     }else{
         // File exists, append snapshot.
-        if (r->simulationarchive_version<2){
-            // Old version
-            FILE* of = fopen(filename,"r+");
-            fseek(of, 0, SEEK_END);
-            fwrite(&(r->t),sizeof(double),1, of);
-            fwrite(&(r->walltime),sizeof(double),1, of);
-            switch (r->integrator){
-                case REB_INTEGRATOR_JANUS:
-                    {
-                        fwrite(r->ri_janus.p_int,sizeof(struct reb_particle_int)*r->N,1,of);
+        FILE* of = fopen(filename,"r+");
+        fseek(of, 0, SEEK_END);
+        fwrite(&(r->t),sizeof(double),1, of);
+        fwrite(&(r->walltime),sizeof(double),1, of);
+        switch (r->integrator){
+            case REB_INTEGRATOR_JANUS:
+                {
+                    fwrite(r->ri_janus.p_int,sizeof(struct reb_particle_int)*r->N,1,of);
+                }
+                break;
+            case REB_INTEGRATOR_WHFAST:
+                {
+                    struct reb_particle* ps = r->particles;
+                    if (r->ri_whfast.safe_mode==0){
+                        ps = r->ri_whfast.p_jh;
                     }
-                    break;
-                case REB_INTEGRATOR_WHFAST:
-                    {
-                        struct reb_particle* ps = r->particles;
-                        if (r->ri_whfast.safe_mode==0){
-                            ps = r->ri_whfast.p_jh;
-                        }
-                        for(int i=0;i<r->N;i++){
-                            fwrite(&(r->particles[i].m),sizeof(double),1,of);
-                            fwrite(&(ps[i].x),sizeof(double),1,of);
-                            fwrite(&(ps[i].y),sizeof(double),1,of);
-                            fwrite(&(ps[i].z),sizeof(double),1,of);
-                            fwrite(&(ps[i].vx),sizeof(double),1,of);
-                            fwrite(&(ps[i].vy),sizeof(double),1,of);
-                            fwrite(&(ps[i].vz),sizeof(double),1,of);
-                        }
+                    for(int i=0;i<r->N;i++){
+                        fwrite(&(r->particles[i].m),sizeof(double),1,of);
+                        fwrite(&(ps[i].x),sizeof(double),1,of);
+                        fwrite(&(ps[i].y),sizeof(double),1,of);
+                        fwrite(&(ps[i].z),sizeof(double),1,of);
+                        fwrite(&(ps[i].vx),sizeof(double),1,of);
+                        fwrite(&(ps[i].vy),sizeof(double),1,of);
+                        fwrite(&(ps[i].vz),sizeof(double),1,of);
                     }
-                    break;
-                case REB_INTEGRATOR_MERCURIUS:
-                    {
-                        struct reb_particle* ps = r->particles;
-                        if (r->ri_mercurius.safe_mode==0){
-                            ps = r->ri_whfast.p_jh;
-                        }
-                        for(int i=0;i<r->N;i++){
-                            fwrite(&(r->particles[i].m),sizeof(double),1,of);
-                            fwrite(&(ps[i].x),sizeof(double),1,of);
-                            fwrite(&(ps[i].y),sizeof(double),1,of);
-                            fwrite(&(ps[i].z),sizeof(double),1,of);
-                            fwrite(&(ps[i].vx),sizeof(double),1,of);
-                            fwrite(&(ps[i].vy),sizeof(double),1,of);
-                            fwrite(&(ps[i].vz),sizeof(double),1,of);
-                        }
-                        fwrite(r->ri_mercurius.dcrit,sizeof(double),r->N,of);
+                }
+                break;
+            case REB_INTEGRATOR_MERCURIUS:
+                {
+                    struct reb_particle* ps = r->particles;
+                    if (r->ri_mercurius.safe_mode==0){
+                        ps = r->ri_whfast.p_jh;
                     }
-                    break;
-                case REB_INTEGRATOR_IAS15:
-                    {
-                        fwrite(&(r->dt),sizeof(double),1,of);
-                        fwrite(&(r->dt_last_done),sizeof(double),1,of);
-                        struct reb_particle* ps = r->particles;
-                        const int N3 = r->N*3;
-                        for(int i=0;i<r->N;i++){
-                            fwrite(&(ps[i].m),sizeof(double),1,of);
-                            fwrite(&(ps[i].x),sizeof(double),1,of);
-                            fwrite(&(ps[i].y),sizeof(double),1,of);
-                            fwrite(&(ps[i].z),sizeof(double),1,of);
-                            fwrite(&(ps[i].vx),sizeof(double),1,of);
-                            fwrite(&(ps[i].vy),sizeof(double),1,of);
-                            fwrite(&(ps[i].vz),sizeof(double),1,of);
-                        }
-                        reb_save_dp7_old(&(r->ri_ias15.b)  ,N3,of);
-                        reb_save_dp7_old(&(r->ri_ias15.csb),N3,of);
-                        reb_save_dp7_old(&(r->ri_ias15.e)  ,N3,of);
-                        reb_save_dp7_old(&(r->ri_ias15.br) ,N3,of);
-                        reb_save_dp7_old(&(r->ri_ias15.er) ,N3,of);
-                        fwrite((r->ri_ias15.csx),sizeof(double)*N3,1,of);
-                        fwrite((r->ri_ias15.csv),sizeof(double)*N3,1,of);
+                    for(int i=0;i<r->N;i++){
+                        fwrite(&(r->particles[i].m),sizeof(double),1,of);
+                        fwrite(&(ps[i].x),sizeof(double),1,of);
+                        fwrite(&(ps[i].y),sizeof(double),1,of);
+                        fwrite(&(ps[i].z),sizeof(double),1,of);
+                        fwrite(&(ps[i].vx),sizeof(double),1,of);
+                        fwrite(&(ps[i].vy),sizeof(double),1,of);
+                        fwrite(&(ps[i].vz),sizeof(double),1,of);
                     }
-                    break;
-                default:
-                    reb_error(r,"Simulation archive not implemented for this integrator.");
-                    break;
-            }
-            fclose(of);
-        }else{
-            // New version with incremental outputs
-            if (r->simulationarchive_version<3){ // duplicate for working with old files. Will be removed in future release
-                // Create buffer containing original binary file
-                FILE* of = fopen(filename,"r+b");
-                fseek(of, 64, SEEK_SET); // Header
-                struct reb_binary_field field = {0};
-                struct reb_simulationarchive_blob16 blob = {0};
-                int bytesread;
-                do{
-                    bytesread = fread(&field,sizeof(struct reb_binary_field),1,of);
-                    fseek(of, field.size, SEEK_CUR);
-                }while(field.type!=REB_BINARY_FIELD_TYPE_END && bytesread);
-                long size_old = ftell(of);
-                if (bytesread!=1){
-                    reb_warning(r, "SimulationArchive appears to be corrupted. A recovery attempt has failed. No snapshot has been saved.\n");
-                    return;
-                }
-                    
-                bytesread = fread(&blob,sizeof(struct reb_simulationarchive_blob16),1,of);
-                if (bytesread!=1){
-                    reb_warning(r, "SimulationArchive appears to be corrupted. A recovery attempt has failed. No snapshot has been saved.\n");
-                    return;
-                }
-                int archive_contains_more_than_one_blob = 0;
-                if (blob.offset_next>0){
-                    archive_contains_more_than_one_blob = 1;
-                }
-
-                
-                char* buf_old = malloc(size_old);
-                fseek(of, 0, SEEK_SET);  
-                fread(buf_old, size_old,1,of);
-
-                // Create buffer containing current binary file
-                char* buf_new;
-                size_t size_new;
-                reb_output_binary_to_stream(r, &buf_new, &size_new);
-                
-                // Create buffer containing diff
-                char* buf_diff;
-                size_t size_diff;
-                reb_binary_diff(buf_old, size_old, buf_new, size_new, &buf_diff, &size_diff);
-        
-                int file_corrupt = 0;
-                int seek_ok = fseek(of, -sizeof(struct reb_simulationarchive_blob16), SEEK_END);
-                int blobs_read = fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
-                if (seek_ok !=0 || blobs_read != 1){ // cannot read blob
-                    file_corrupt = 1;
-                }
-                if ( (archive_contains_more_than_one_blob && blob.offset_prev <=0) || blob.offset_next != 0){ // blob contains unexpected data. Note: First blob is all zeros.
-                    file_corrupt = 1;
-                }
-                if (file_corrupt==0 && archive_contains_more_than_one_blob ){
-                    // Check if last two blobs are consistent.
-                    seek_ok = fseek(of, - sizeof(struct reb_simulationarchive_blob16) - sizeof(struct reb_binary_field), SEEK_CUR);  
-                    bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
-                    if (seek_ok!=0 || bytesread!=1){
-                        file_corrupt = 1;
-                    }
-                    if (field.type != REB_BINARY_FIELD_TYPE_END || field.size !=0){
-                        // expected an END field
-                        file_corrupt = 1;
-                    }
-                    seek_ok = fseek(of, -blob.offset_prev - sizeof(struct reb_simulationarchive_blob16), SEEK_CUR);  
-                    struct reb_simulationarchive_blob16 blob2 = {0};
-                    blobs_read = fread(&blob2, sizeof(struct reb_simulationarchive_blob16), 1, of);
-                    if (seek_ok!=0 || blobs_read!=1 || blob2.offset_next != blob.offset_prev){
-                        file_corrupt = 1;
-                    }
-                }
-
-                if (file_corrupt){
-                    // Find last valid snapshot to allow for restarting and appending to archives where last snapshot was cut off
-                    reb_warning(r, "SimulationArchive appears to be corrupted. REBOUND will attempt to fix it before appending more snapshots.\n");
-                    int seek_ok;
-                    seek_ok = fseek(of, size_old, SEEK_SET);
-                    long last_blob = size_old + sizeof(struct reb_simulationarchive_blob16);
-                    do
-                    {
-                        seek_ok = fseek(of, -sizeof(struct reb_binary_field), SEEK_CUR);
-                        if (seek_ok != 0){
-                            break;
-                        }
-                        bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
-                        if (bytesread != 1 || field.type != REB_BINARY_FIELD_TYPE_END){ // could be EOF or corrupt snapshot
-                            break;
-                        }
-                        bytesread = fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
-                        if (bytesread != 1){
-                            break;
-                        }
-                        last_blob = ftell(of);
-                        if (blob.offset_next>0){
-                            seek_ok = fseek(of, blob.offset_next, SEEK_CUR);
-                        }else{
-                            break;
-                        }
-                        if (seek_ok != 0){
-                            break;
-                        }
-                    } while(1);
-
-                    // To append diff, seek to last valid location (=EOF if all snapshots valid)
-                    fseek(of, last_blob, SEEK_SET);
-                }else{
-                    // File is not corrupt. Start at end to save time.
-                    fseek(of, 0, SEEK_END);  
-                }
-
-                // Update blob info and Write diff to binary file
-                fseek(of, -sizeof(struct reb_simulationarchive_blob16), SEEK_CUR);  
-                fread(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
-                blob.offset_next = size_diff+sizeof(struct reb_binary_field);
-                fseek(of, -sizeof(struct reb_simulationarchive_blob16), SEEK_CUR);  
-                fwrite(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
-                fwrite(buf_diff, size_diff, 1, of); 
-                field.type = REB_BINARY_FIELD_TYPE_END;
-                field.size = 0;
-                fwrite(&field,sizeof(struct reb_binary_field), 1, of);
-                blob.index++;
-                blob.offset_prev = blob.offset_next;
-                blob.offset_next = 0;
-                fwrite(&blob, sizeof(struct reb_simulationarchive_blob16), 1, of);
-
-                fclose(of);
-                free(buf_new);
-                free(buf_old);
-                free(buf_diff);
-            }else{ // Duplicate (version 3 of SimulationArchive. This is the part that will remain. Above duplicate will be removed in future release.
-                // Create buffer containing original binary file
-                FILE* of = fopen(filename,"r+b");
-                fseek(of, 64, SEEK_SET); // Header
-                struct reb_binary_field field = {0};
-                struct reb_simulationarchive_blob blob = {0};
-                int bytesread;
-                do{
-                    bytesread = fread(&field,sizeof(struct reb_binary_field),1,of);
-                    fseek(of, field.size, SEEK_CUR);
-                }while(field.type!=REB_BINARY_FIELD_TYPE_END && bytesread);
-                long size_old = ftell(of);
-                if (bytesread!=1){
-                    reb_warning(r, "SimulationArchive appears to be corrupted. A recovery attempt has failed. No snapshot has been saved.\n");
-                    return;
-                }
-                    
-                bytesread = fread(&blob,sizeof(struct reb_simulationarchive_blob),1,of);
-                if (bytesread!=1){
-                    reb_warning(r, "SimulationArchive appears to be corrupted. A recovery attempt has failed. No snapshot has been saved.\n");
-                    return;
-                }
-                int archive_contains_more_than_one_blob = 0;
-                if (blob.offset_next>0){
-                    archive_contains_more_than_one_blob = 1;
-                }
-
-                
-                char* buf_old = malloc(size_old);
-                fseek(of, 0, SEEK_SET);  
-                fread(buf_old, size_old,1,of);
-
-                // Create buffer containing current binary file
-                char* buf_new;
-                size_t size_new;
-                reb_output_binary_to_stream(r, &buf_new, &size_new);
-                
-                // Create buffer containing diff
-                char* buf_diff;
-                size_t size_diff;
-                reb_binary_diff(buf_old, size_old, buf_new, size_new, &buf_diff, &size_diff);
-        
-                int file_corrupt = 0;
-                int seek_ok = fseek(of, -sizeof(struct reb_simulationarchive_blob), SEEK_END);
-                int blobs_read = fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
-                if (seek_ok !=0 || blobs_read != 1){ // cannot read blob
-                    file_corrupt = 1;
+                    fwrite(r->ri_mercurius.dcrit,sizeof(double),r->N,of);
                 }
-                if ( (archive_contains_more_than_one_blob && blob.offset_prev <=0) || blob.offset_next != 0){ // blob contains unexpected data. Note: First blob is all zeros.
-                    file_corrupt = 1;
+                break;
+            case REB_INTEGRATOR_IAS15:
+                {
+                    fwrite(&(r->dt),sizeof(double),1,of);
+                    fwrite(&(r->dt_last_done),sizeof(double),1,of);
+                    struct reb_particle* ps = r->particles;
+                    const int N3 = r->N*3;
+                    for(int i=0;i<r->N;i++){
+                        fwrite(&(ps[i].m),sizeof(double),1,of);
+                        fwrite(&(ps[i].x),sizeof(double),1,of);
+                        fwrite(&(ps[i].y),sizeof(double),1,of);
+                        fwrite(&(ps[i].z),sizeof(double),1,of);
+                        fwrite(&(ps[i].vx),sizeof(double),1,of);
+                        fwrite(&(ps[i].vy),sizeof(double),1,of);
+                        fwrite(&(ps[i].vz),sizeof(double),1,of);
+                    }
+                    reb_save_dp7_old(&(r->ri_ias15.b)  ,N3,of);
+                    reb_save_dp7_old(&(r->ri_ias15.csb),N3,of);
+                    reb_save_dp7_old(&(r->ri_ias15.e)  ,N3,of);
+                    reb_save_dp7_old(&(r->ri_ias15.br) ,N3,of);
+                    reb_save_dp7_old(&(r->ri_ias15.er) ,N3,of);
+                    fwrite((r->ri_ias15.csx),sizeof(double)*N3,1,of);
+                    fwrite((r->ri_ias15.csv),sizeof(double)*N3,1,of);
                 }
-                if (file_corrupt==0 && archive_contains_more_than_one_blob ){
-                    // Check if last two blobs are consistent.
-                    seek_ok = fseek(of, - sizeof(struct reb_simulationarchive_blob) - sizeof(struct reb_binary_field), SEEK_CUR);  
-                    bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
-                    if (seek_ok!=0 || bytesread!=1){
-                        file_corrupt = 1;
-                    }
-                    if (field.type != REB_BINARY_FIELD_TYPE_END || field.size !=0){
-                        // expected an END field
-                        file_corrupt = 1;
-                    }
-                    seek_ok = fseek(of, -blob.offset_prev - sizeof(struct reb_simulationarchive_blob), SEEK_CUR);  
-                    struct reb_simulationarchive_blob blob2 = {0};
-                    blobs_read = fread(&blob2, sizeof(struct reb_simulationarchive_blob), 1, of);
-                    if (seek_ok!=0 || blobs_read!=1 || blob2.offset_next != blob.offset_prev){
-                        file_corrupt = 1;
-                    }
-                }
-
-                if (file_corrupt){
-                    // Find last valid snapshot to allow for restarting and appending to archives where last snapshot was cut off
-                    reb_warning(r, "SimulationArchive appears to be corrupted. REBOUND will attempt to fix it before appending more snapshots.\n");
-                    int seek_ok;
-                    seek_ok = fseek(of, size_old, SEEK_SET);
-                    long last_blob = size_old + sizeof(struct reb_simulationarchive_blob);
-                    do
-                    {
-                        seek_ok = fseek(of, -sizeof(struct reb_binary_field), SEEK_CUR);
-                        if (seek_ok != 0){
-                            break;
-                        }
-                        bytesread = fread(&field, sizeof(struct reb_binary_field), 1, of);
-                        if (bytesread != 1 || field.type != REB_BINARY_FIELD_TYPE_END){ // could be EOF or corrupt snapshot
-                            break;
-                        }
-                        bytesread = fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
-                        if (bytesread != 1){
-                            break;
-                        }
-                        last_blob = ftell(of);
-                        if (blob.offset_next>0){
-                            seek_ok = fseek(of, blob.offset_next, SEEK_CUR);
-                        }else{
-                            break;
-                        }
-                        if (seek_ok != 0){
-                            break;
-                        }
-                    } while(1);
-
-                    // To append diff, seek to last valid location (=EOF if all snapshots valid)
-                    fseek(of, last_blob, SEEK_SET);
-                }else{
-                    // File is not corrupt. Start at end to save time.
-                    fseek(of, 0, SEEK_END);  
-                }
-
-                // Update blob info and Write diff to binary file
-                fseek(of, -sizeof(struct reb_simulationarchive_blob), SEEK_CUR);  
-                fread(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
-                blob.offset_next = size_diff+sizeof(struct reb_binary_field);
-                fseek(of, -sizeof(struct reb_simulationarchive_blob), SEEK_CUR);  
-                fwrite(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
-                fwrite(buf_diff, size_diff, 1, of); 
-                field.type = REB_BINARY_FIELD_TYPE_END;
-                field.size = 0;
-                fwrite(&field,sizeof(struct reb_binary_field), 1, of);
-                blob.index++;
-                blob.offset_prev = blob.offset_next;
-                blob.offset_next = 0;
-                fwrite(&blob, sizeof(struct reb_simulationarchive_blob), 1, of);
-
-                fclose(of);
-                free(buf_new);
-                free(buf_old);
-                free(buf_diff);
-            }
+                break;
+            default:
+                reb_error(r,"Simulation archive not implemented for this integrator.");
+                break;
         }
+        fclose(of);
     }
 }
 
@@ -960,3 +2608,327 @@ void reb_simulationarchive_automate_step(struct reb_simulation* const r, const c
         r->simulationarchive_next_step = r->steps_done;
     }
 }
+
+// Flushes a file to disk. Returns 0 on success.
+static int reb_simulationarchive_fsync(const char* filename){
+    const int fd = open(filename, O_RDONLY);
+    if (fd<0){
+        return -1;
+    }
+    const int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+// Returns filename with suffix k appended (k>0) or a copy of filename (k=0).
+static char* reb_simulationarchive_checkpoint_filename(const char* filename, const int k){
+    char* name = malloc(strlen(filename)+32);
+    if (k){
+        sprintf(name, "%s.%d", filename, k);
+    }else{
+        strcpy(name, filename);
+    }
+    return name;
+}
+
+void reb_simulationarchive_checkpoint(struct reb_simulation* const r, const char* filename, int N){
+    if (filename==NULL){
+        reb_error(r, "Filename missing.");
+        return;
+    }
+    if (N<1) N = 1;
+    // Pending snapshots are written to the Simulation Archive first. It 
+    // is then consistent with the checkpoint should the job be interrupted.
+    reb_simulationarchive_writer_flush(r);
+    if (r->simulationarchive_filename){
+        reb_simulationarchive_fsync(r->simulationarchive_filename);
+    }
+
+    // The new checkpoint is written to a temporary file first.
+    char* buf;
+    size_t size;
+    reb_output_binary_to_stream(r, &buf, &size);
+    char* filename_tmp = malloc(strlen(filename)+5);
+    sprintf(filename_tmp, "%s.tmp", filename);
+    FILE* of = fopen(filename_tmp, "wb");
+    if (of==NULL){
+        reb_error(r, "Can not open file.");
+        free(filename_tmp);
+        free(buf);
+        return;
+    }
+    const size_t written = fwrite(buf, size, 1, of);
+    free(buf);
+    if (written!=1 || fflush(of) || fsync(fileno(of))){
+        reb_error(r, "Error while writing checkpoint.");
+        fclose(of);
+        remove(filename_tmp);
+        free(filename_tmp);
+        return;
+    }
+    fclose(of);
+
+    // Older checkpoints are moved to filename.1, ..., filename.(N-1).
+    // The most recent one gets linked to filename.1 so that filename
+    // itself always exists and is only replaced by the atomic rename.
+    for (int k=N-1;k>=1;k--){
+        char* name_old = reb_simulationarchive_checkpoint_filename(filename, k-1);
+        char* name_new = reb_simulationarchive_checkpoint_filename(filename, k);
+        if (k==1){
+            remove(name_new);
+            link(name_old, name_new);
+        }else{
+            rename(name_old, name_new);
+        }
+        free(name_old);
+        free(name_new);
+    }
+    if (rename(filename_tmp, filename)){
+        reb_error(r, "Error while writing checkpoint.");
+        remove(filename_tmp);
+    }
+    free(filename_tmp);
+
+    // Make the renames durable.
+    char* dirname = malloc(strlen(filename)+2);
+    strcpy(dirname, filename);
+    char* slash = strrchr(dirname, '/');
+    if (slash==NULL){
+        strcpy(dirname, ".");
+    }else if (slash==dirname){
+        dirname[1] = '\0';
+    }else{
+        *slash = '\0';
+    }
+    reb_simulationarchive_fsync(dirname);
+    free(dirname);
+}
+
+void reb_simulationarchive_automate_checkpoint(struct reb_simulation* const r, const char* filename, double walltime, int N){
+    if (r==NULL) return;
+    if (filename==NULL){
+        reb_error(r, "Filename missing.");
+        return;
+    }
+    free(r->simulationarchive_checkpoint_filename);
+    r->simulationarchive_checkpoint_filename = malloc((strlen(filename)+1)*sizeof(char));
+    strcpy(r->simulationarchive_checkpoint_filename, filename);
+    r->simulationarchive_checkpoint_walltime = walltime;
+    r->simulationarchive_checkpoint_next = r->walltime + walltime;
+    r->simulationarchive_checkpoint_N = N;
+}
+
+// Streams. Snapshots are written forward-only: the blob following a snapshot
+// does not contain the size of the next snapshot (offset_next is set to 
+// REB_SIMULATIONARCHIVE_STREAMED) so that nothing needs to be patched once 
+// it has been written. A stream saved to a file is a valid SimulationArchive.
+
+struct reb_simulationarchive_stream* reb_simulationarchive_stream_create(int fd){
+    struct reb_simulationarchive_stream* s = calloc(1, sizeof(struct reb_simulationarchive_stream));
+    s->fd = fd;
+    return s;
+}
+
+void reb_simulationarchive_stream_free(struct reb_simulationarchive_stream* s){
+    if (s==NULL) return;
+    free(s->buf);
+    free(s->buf_base);
+    free(s);
+}
+
+static int reb_simulationarchive_stream_write_all(const int fd, const char* buf, size_t size){
+    while (size){
+        const ssize_t n = write(fd, buf, size);
+        if (n<0){
+            if (errno==EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int reb_simulationarchive_stream_write(struct reb_simulationarchive_stream* s, struct reb_simulation* const r){
+    if (r->simulationarchive_version<3){
+        reb_error(r, "Streaming snapshots requires simulationarchive_version 3.");
+        return -1;
+    }
+    char* buf_new;
+    size_t size_new;
+    if (s->buf_base==NULL){
+        // First snapshot. The binary ends with the first blob.
+        reb_output_binary_to_stream(r, &buf_new, &size_new);
+        s->blob.index = 0;
+        s->blob.offset_prev = 0;
+        s->blob.offset_next = REB_SIMULATIONARCHIVE_STREAMED;
+        memcpy(buf_new+size_new-sizeof(struct reb_simulationarchive_blob), &s->blob, sizeof(struct reb_simulationarchive_blob));
+        if (reb_simulationarchive_stream_write_all(s->fd, buf_new, size_new)){
+            free(buf_new);
+            reb_error(r, "Cannot write to stream.");
+            return -1;
+        }
+        s->buf_base = buf_new;
+        s->size_base = size_new-sizeof(struct reb_simulationarchive_blob);
+        return 0;
+    }
+
+    char* buf_diff;
+    size_t size_diff;
+    if (r->simulationarchive_physical_only){
+        reb_simulationarchive_physical_to_stream(r, &buf_diff, &size_diff);
+    }else{
+        reb_output_binary_to_stream(r, &buf_new, &size_new);
+        reb_binary_diff(s->buf_base, s->size_base, buf_new, size_new, &buf_diff, &size_diff);
+        free(buf_new);
+    }
+    if (r->simulationarchive_compression){
+        reb_simulationarchive_compress_diff(&buf_diff, &size_diff, r->simulationarchive_compression);
+    }
+
+    // Diff, END field and blob are written with one call.
+    const size_t size = size_diff+sizeof(struct reb_binary_field)+sizeof(struct reb_simulationarchive_blob);
+    buf_diff = realloc(buf_diff, size);
+    struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_END, .size = 0};
+    memcpy(buf_diff+size_diff, &field, sizeof(struct reb_binary_field));
+    struct reb_simulationarchive_blob blob = {
+        .index = s->blob.index+1,
+        .offset_prev = size_diff+sizeof(struct reb_binary_field),
+        .offset_next = REB_SIMULATIONARCHIVE_STREAMED,
+    };
+    memcpy(buf_diff+size_diff+sizeof(struct reb_binary_field), &blob, sizeof(struct reb_simulationarchive_blob));
+    const int error = reb_simulationarchive_stream_write_all(s->fd, buf_diff, size);
+    free(buf_diff);
+    if (error){
+        reb_error(r, "Cannot write to stream.");
+        return -1;
+    }
+    s->blob = blob;
+    return 0;
+}
+
+// Returns the size of the next snapshot (including its blob) if it has been
+// received completely, 0 if more data is needed and -1 if the data is not a 
+// valid stream.
+static long reb_simulationarchive_stream_next_size(const struct reb_simulationarchive_stream* const s){
+    size_t pos = 0;
+    if (s->buf_base==NULL){
+        const char* header = "REBOUND Binary File.";
+        const size_t len = strlen(header);
+        if (s->size && strncmp(s->buf, header, s->size<len?s->size:len)!=0){
+            return -1;
+        }
+        if (s->size<64){
+            return 0;
+        }
+        pos = 64;
+    }
+    struct reb_binary_field field;
+    do{
+        if (pos+sizeof(struct reb_binary_field)>s->size){
+            return 0;
+        }
+        memcpy(&field, s->buf+pos, sizeof(struct reb_binary_field));
+        pos += sizeof(struct reb_binary_field);
+        if (field.type!=REB_BINARY_FIELD_TYPE_END){
+            if (field.size>s->size-pos){
+                return 0;
+            }
+            pos += field.size;
+        }
+    }while(field.type!=REB_BINARY_FIELD_TYPE_END);
+    if (pos+sizeof(struct reb_simulationarchive_blob)>s->size){
+        return 0;
+    }
+    struct reb_simulationarchive_blob blob;
+    memcpy(&blob, s->buf+pos, sizeof(struct reb_simulationarchive_blob));
+    // The index and the size of the snapshot act like a checksum.
+    if (s->buf_base==NULL){
+        if (blob.index!=0){
+            return -1;
+        }
+    }else{
+        if (blob.index!=s->blob.index+1 || (size_t)blob.offset_prev!=pos){
+            return -1;
+        }
+    }
+    return pos+sizeof(struct reb_simulationarchive_blob);
+}
+
+// Returns 1 if the diff of a snapshot only contains the physical state.
+static int reb_simulationarchive_stream_is_physical(const char* buf, const size_t size){
+    size_t pos = 0;
+    struct reb_binary_field field;
+    while (pos+sizeof(struct reb_binary_field)<=size){
+        memcpy(&field, buf+pos, sizeof(struct reb_binary_field));
+        switch (field.type){
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL:
+            case REB_BINARY_FIELD_TYPE_PARTICLES_PHYSICAL_FLOAT:
+                return 1;
+            case REB_BINARY_FIELD_TYPE_END:
+                return 0;
+        }
+        pos += sizeof(struct reb_binary_field)+field.size;
+    }
+    return 0;
+}
+
+int reb_simulationarchive_stream_read_with_messages(struct reb_simulationarchive_stream* s, struct reb_simulation* r, enum reb_input_binary_messages* warnings){
+    long size;
+    while ((size = reb_simulationarchive_stream_next_size(s))==0){
+        if (s->size==s->capacity){
+            s->capacity = s->capacity?2*s->capacity:65536;
+            s->buf = realloc(s->buf, s->capacity);
+        }
+        const ssize_t n = read(s->fd, s->buf+s->size, s->capacity-s->size);
+        if (n>0){
+            s->size += n;
+        }else if (n==0){
+            // End of stream
+            if (s->size){
+                // The writer stopped in the middle of a snapshot.
+                *warnings |= REB_INPUT_BINARY_WARNING_CORRUPTFILE;
+                s->size = 0;
+            }
+            return 0;
+        }else if (errno==EAGAIN || errno==EWOULDBLOCK){
+            return -1;
+        }else if (errno!=EINTR){
+            *warnings |= REB_INPUT_BINARY_ERROR_FILENOTOPEN;
+            return 0;
+        }
+    }
+    if (size<0){
+        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return 0;
+    }
+    const size_t size_fields = size-sizeof(struct reb_simulationarchive_blob);
+    const int first = s->buf_base==NULL;
+    if (first){
+        s->buf_base = malloc(size_fields);
+        memcpy(s->buf_base, s->buf, size_fields);
+        s->size_base = size_fields;
+    }
+    memcpy(&s->blob, s->buf+size_fields, sizeof(struct reb_simulationarchive_blob));
+
+    reb_free_pointers(r);
+    memset(r,0,sizeof(struct reb_simulation));
+    reb_init_simulation(r);
+    r->simulationarchive_filename = NULL;
+    r->simulationarchive_checkpoint_filename = NULL;
+    r->simulationarchive_version = 0;
+    const int physical = !first && reb_simulationarchive_stream_is_physical(s->buf, size_fields);
+    char* mem_stream = s->buf_base;
+    reb_simulationarchive_input_first_snapshot(r, NULL, &mem_stream, physical, warnings);
+    if (!first){
+        mem_stream = s->buf;
+        while(reb_input_field(r, NULL, warnings, &mem_stream)){ }
+    }
+    memmove(s->buf, s->buf+size, s->size-size);
+    s->size -= size;
+    if (r->simulationarchive_version<3){
+        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return 0;
+    }
+    return 1;
+}
@@ -31,6 +31,9 @@ struct reb_simulation;
 struct reb_particles;
 
 void reb_simulationarchive_heartbeat(struct reb_simulation* const r);  ///< Internal function to handle outputs for the Simulation Archive.
+void reb_simulationarchive_writer_flush(struct reb_simulation* const r);  ///< Internal function. Waits until all snapshots have been written by the asynchronous writer.
+void reb_simulationarchive_writer_free(struct reb_simulation* const r);   ///< Internal function. Flushes and terminates the asynchronous writer.
+void reb_simulationarchive_cache_free(struct reb_simulation* const r);    ///< Internal function. Closes the SimulationArchive kept open between snapshots.
 void reb_read_simulationarchive_with_messages(struct reb_simulationarchive* sa, const char* filename, struct reb_simulationarchive* sa_shape, enum reb_input_binary_messages* warnings); ///< Internal function to read one snapshot from a simulation archive.
 
 
@@ -0,0 +1,333 @@
+/**
+ * @file    simulationstate.c
+ * @brief   Save and restore the mutable state of a simulation.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details A state holds only what changes during a timestep: the time,
+ * the timestep, the particles, the integrator's internal arrays and a few
+ * counters. Methods which repeatedly step, check and roll back (event
+ * location, shooting methods) can save and restore the state without
+ * copying the entire simulation. The storage is allocated once and only
+ * grows if the simulation grows.
+ *
+ * @section LICENSE
+ * Copyright (c) 2023 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "rebound.h"
+#include "simulationstate.h"
+#include "tree.h"
+#include "integrator_ias15.h"
+#include "allocator.h"
+
+#define REB_STATE_IAS15_N_ARRAYS (6*7+2)   ///< Number of IAS15 arrays of length 3N which are saved (6 dp7 structs, csx and csv)
+
+struct reb_simulation_state {
+    // Scalars
+    double t;
+    double dt;
+    double dt_last_done;
+    unsigned long long steps_done;
+    enum REB_STATUS status;
+    int N;
+    int N_var;
+    int N_active;
+    int hash_ctr;
+    double energy_offset;
+    double max_radius[2];
+    double collisions_plog;
+    long collisions_Nlog;
+    double megno_Ys;
+    double megno_Yss;
+    double megno_cov_Yt;
+    double megno_var_t;
+    double megno_mean_t;
+    double megno_mean_Y;
+    long megno_n;
+    // Copies of the integrator structs. Only the scalars are restored.
+    struct reb_simulation_integrator_ias15 ri_ias15;
+    struct reb_simulation_integrator_whfast ri_whfast;
+    struct reb_simulation_integrator_saba ri_saba;
+    struct reb_simulation_integrator_mercurius ri_mercurius;
+    struct reb_simulation_integrator_janus ri_janus;
+    struct reb_simulation_integrator_eos ri_eos;
+    struct reb_simulation_integrator_bs ri_bs;
+    struct reb_simulation_integrator_hermite ri_hermite;
+
+    // Arrays. N_* is the number of saved elements, allocatedN_* the capacity.
+    struct reb_particle* particles;
+    int allocatedN_particles;
+    double* ias15;
+    int N_ias15;            // Length of each IAS15 array (3N)
+    int allocatedN_ias15;
+    struct reb_particle* p_jh;
+    int N_p_jh;
+    int allocatedN_p_jh;
+    struct reb_particle_int* p_int;
+    int N_p_int;
+    int allocatedN_p_int;
+    double* dcrit;
+    int N_dcrit;
+    int allocatedN_dcrit;
+    double* odes_y;         // State of all ODEs, one after the other
+    int N_odes_y;
+    int allocatedN_odes_y;
+};
+
+// Makes sure that the array *a has room for N elements of the given size.
+static void reb_simulation_state_reserve(void** a, int* allocatedN, const int N, const size_t size){
+    if (*allocatedN<N){
+        *a = realloc(*a, size*N);
+        *allocatedN = N;
+    }
+}
+
+static void reb_simulation_state_dp7_pointers(struct reb_dp7* dp7, double** p){
+    p[0] = dp7->p0; p[1] = dp7->p1; p[2] = dp7->p2; p[3] = dp7->p3;
+    p[4] = dp7->p4; p[5] = dp7->p5; p[6] = dp7->p6;
+}
+
+// Collects pointers to all IAS15 arrays which are saved.
+static void reb_simulation_state_ias15_pointers(struct reb_simulation_integrator_ias15* ri_ias15, double** p){
+    reb_simulation_state_dp7_pointers(&ri_ias15->g,   p+0);
+    reb_simulation_state_dp7_pointers(&ri_ias15->b,   p+7);
+    reb_simulation_state_dp7_pointers(&ri_ias15->csb, p+14);
+    reb_simulation_state_dp7_pointers(&ri_ias15->e,   p+21);
+    reb_simulation_state_dp7_pointers(&ri_ias15->br,  p+28);
+    reb_simulation_state_dp7_pointers(&ri_ias15->er,  p+35);
+    p[42] = ri_ias15->csx;
+    p[43] = ri_ias15->csv;
+}
+
+struct reb_simulation_state* reb_simulation_state_create(struct reb_simulation* const r){
+    struct reb_simulation_state* s = calloc(1, sizeof(struct reb_simulation_state));
+    if (r){
+        reb_simulation_state_save(s, r);
+    }
+    return s;
+}
+
+void reb_simulation_state_free(struct reb_simulation_state* const s){
+    if (s==NULL){
+        return;
+    }
+    free(s->particles);
+    free(s->ias15);
+    free(s->p_jh);
+    free(s->p_int);
+    free(s->dcrit);
+    free(s->odes_y);
+    free(s);
+}
+
+void reb_simulation_state_save(struct reb_simulation_state* const s, struct reb_simulation* const r){
+    s->t = r->t;
+    s->dt = r->dt;
+    s->dt_last_done = r->dt_last_done;
+    s->steps_done = r->steps_done;
+    s->status = r->status;
+    s->N = r->N;
+    s->N_var = r->N_var;
+    s->N_active = r->N_active;
+    s->hash_ctr = r->hash_ctr;
+    s->energy_offset = r->energy_offset;
+    s->max_radius[0] = r->max_radius[0];
+    s->max_radius[1] = r->max_radius[1];
+    s->collisions_plog = r->collisions_plog;
+    s->collisions_Nlog = r->collisions_Nlog;
+    s->megno_Ys = r->megno_Ys;
+    s->megno_Yss = r->megno_Yss;
+    s->megno_cov_Yt = r->megno_cov_Yt;
+    s->megno_var_t = r->megno_var_t;
+    s->megno_mean_t = r->megno_mean_t;
+    s->megno_mean_Y = r->megno_mean_Y;
+    s->megno_n = r->megno_n;
+    s->ri_ias15 = r->ri_ias15;
+    s->ri_whfast = r->ri_whfast;
+    s->ri_saba = r->ri_saba;
+    s->ri_mercurius = r->ri_mercurius;
+    s->ri_janus = r->ri_janus;
+    s->ri_eos = r->ri_eos;
+    s->ri_bs = r->ri_bs;
+    s->ri_hermite = r->ri_hermite;
+
+    reb_simulation_state_reserve((void**)&s->particles, &s->allocatedN_particles, r->N, sizeof(struct reb_particle));
+    memcpy(s->particles, r->particles, sizeof(struct reb_particle)*r->N);
+
+    // Only the arrays which the integrator keeps between timesteps are saved.
+    s->N_ias15 = 0;
+    if (r->integrator==REB_INTEGRATOR_IAS15 && r->ri_ias15.allocatedN){
+        const int N3 = r->ri_ias15.allocatedN;
+        reb_simulation_state_reserve((void**)&s->ias15, &s->allocatedN_ias15, N3*REB_STATE_IAS15_N_ARRAYS, sizeof(double));
+        double* p[REB_STATE_IAS15_N_ARRAYS];
+        reb_simulation_state_ias15_pointers(&r->ri_ias15, p);
+        for (int k=0;k<REB_STATE_IAS15_N_ARRAYS;k++){
+            memcpy(s->ias15+k*N3, p[k], sizeof(double)*N3);
+        }
+        s->N_ias15 = N3;
+    }
+    s->N_p_jh = 0;
+    if ((r->integrator==REB_INTEGRATOR_WHFAST || r->integrator==REB_INTEGRATOR_SABA) && r->ri_whfast.p_jh){
+        const int N = r->ri_whfast.allocated_N;
+        reb_simulation_state_reserve((void**)&s->p_jh, &s->allocatedN_p_jh, N, sizeof(struct reb_particle));
+        memcpy(s->p_jh, r->ri_whfast.p_jh, sizeof(struct reb_particle)*N);
+        s->N_p_jh = N;
+    }
+    s->N_p_int = 0;
+    if (r->integrator==REB_INTEGRATOR_JANUS && r->ri_janus.p_int){
+        const int N = r->ri_janus.allocated_N;
+        reb_simulation_state_reserve((void**)&s->p_int, &s->allocatedN_p_int, N, sizeof(struct reb_particle_int));
+        memcpy(s->p_int, r->ri_janus.p_int, sizeof(struct reb_particle_int)*N);
+        s->N_p_int = N;
+    }
+    s->N_dcrit = 0;
+    if (r->integrator==REB_INTEGRATOR_MERCURIUS && r->ri_mercurius.dcrit){
+        const int N = r->ri_mercurius.dcrit_allocatedN;
+        reb_simulation_state_reserve((void**)&s->dcrit, &s->allocatedN_dcrit, N, sizeof(double));
+        memcpy(s->dcrit, r->ri_mercurius.dcrit, sizeof(double)*N);
+        s->N_dcrit = N;
+    }
+    int N_odes_y = 0;
+    for (int i=0;i<r->odes_N;i++){
+        N_odes_y += r->odes[i]->length;
+    }
+    reb_simulation_state_reserve((void**)&s->odes_y, &s->allocatedN_odes_y, N_odes_y, sizeof(double));
+    N_odes_y = 0;
+    for (int i=0;i<r->odes_N;i++){
+        memcpy(s->odes_y+N_odes_y, r->odes[i]->y, sizeof(double)*r->odes[i]->length);
+        N_odes_y += r->odes[i]->length;
+    }
+    s->N_odes_y = N_odes_y;
+}
+
+int reb_simulation_state_restore(struct reb_simulation* const r, const struct reb_simulation_state* const s){
+    int N_odes_y = 0;
+    for (int i=0;i<r->odes_N;i++){
+        N_odes_y += r->odes[i]->length;
+    }
+    if (N_odes_y!=s->N_odes_y){
+        reb_error(r, "The ODEs of the simulation have changed since the state was saved.");
+        return 1;
+    }
+    N_odes_y = 0;
+    for (int i=0;i<r->odes_N;i++){
+        memcpy(r->odes[i]->y, s->odes_y+N_odes_y, sizeof(double)*r->odes[i]->length);
+        N_odes_y += r->odes[i]->length;
+    }
+
+    r->t = s->t;
+    r->dt = s->dt;
+    r->dt_last_done = s->dt_last_done;
+    r->steps_done = s->steps_done;
+    r->status = s->status;
+    r->N_var = s->N_var;
+    r->N_active = s->N_active;
+    r->hash_ctr = s->hash_ctr;
+    r->energy_offset = s->energy_offset;
+    r->max_radius[0] = s->max_radius[0];
+    r->max_radius[1] = s->max_radius[1];
+    r->collisions_plog = s->collisions_plog;
+    r->collisions_Nlog = s->collisions_Nlog;
+    r->megno_Ys = s->megno_Ys;
+    r->megno_Yss = s->megno_Yss;
+    r->megno_cov_Yt = s->megno_cov_Yt;
+    r->megno_var_t = s->megno_var_t;
+    r->megno_mean_t = s->megno_mean_t;
+    r->megno_mean_Y = s->megno_mean_Y;
+    r->megno_n = s->megno_n;
+
+    // Particles. The array only needs to grow if particles have been added since the state was saved.
+    if (r->allocatedN<s->N){
+        r->particles = reb_reserve(r->particles, sizeof(struct reb_particle)*s->N);
+        r->allocatedN = s->N;
+    }
+    r->N = s->N;
+    memcpy(r->particles, s->particles, sizeof(struct reb_particle)*s->N);
+    for (int i=0;i<r->N;i++){
+        r->particles[i].sim = r;
+        r->particles[i].c = NULL;
+    }
+    if (r->tree_root){
+        reb_tree_delete(r);
+        for (int i=0;i<r->N;i++){
+            reb_tree_add_particle_to_tree(r, i);
+        }
+    }
+
+    // Integrator scalars
+    r->ri_ias15.iterations_max_exceeded = s->ri_ias15.iterations_max_exceeded;
+    r->ri_whfast.is_synchronized = s->ri_whfast.is_synchronized;
+    r->ri_whfast.recalculate_coordinates_this_timestep = s->ri_whfast.recalculate_coordinates_this_timestep;
+    r->ri_whfast.timestep_warning = s->ri_whfast.timestep_warning;
+    r->ri_saba.is_synchronized = s->ri_saba.is_synchronized;
+    r->ri_mercurius.is_synchronized = s->ri_mercurius.is_synchronized;
+    r->ri_mercurius.recalculate_coordinates_this_timestep = s->ri_mercurius.recalculate_coordinates_this_timestep;
+    r->ri_mercurius.recalculate_dcrit_this_timestep = s->ri_mercurius.recalculate_dcrit_this_timestep;
+    r->ri_mercurius.mode = s->ri_mercurius.mode;
+    r->ri_mercurius.com_pos = s->ri_mercurius.com_pos;
+    r->ri_mercurius.com_vel = s->ri_mercurius.com_vel;
+    r->ri_janus.recalculate_integer_coordinates_this_timestep = s->ri_janus.recalculate_integer_coordinates_this_timestep;
+    r->ri_eos.is_synchronized = s->ri_eos.is_synchronized;
+    r->ri_bs.dt_proposed = s->ri_bs.dt_proposed;
+    r->ri_bs.firstOrLastStep = s->ri_bs.firstOrLastStep;
+    r->ri_bs.previousRejected = s->ri_bs.previousRejected;
+    r->ri_bs.targetIter = s->ri_bs.targetIter;
+    r->ri_hermite.particle_steps = s->ri_hermite.particle_steps;
+
+    // Integrator arrays
+    if (s->N_ias15){
+        if (r->ri_ias15.allocatedN!=s->N_ias15){
+            reb_integrator_ias15_reset(r);
+            reb_integrator_ias15_alloc(r);
+        }
+        if (r->ri_ias15.allocatedN==s->N_ias15){
+            const int N3 = s->N_ias15;
+            double* p[REB_STATE_IAS15_N_ARRAYS];
+            reb_simulation_state_ias15_pointers(&r->ri_ias15, p);
+            for (int k=0;k<REB_STATE_IAS15_N_ARRAYS;k++){
+                memcpy(p[k], s->ias15+k*N3, sizeof(double)*N3);
+            }
+        }
+    }else if (r->integrator==REB_INTEGRATOR_IAS15){
+        // No predictor values have been saved (e.g. the state was saved before the first step).
+        reb_integrator_ias15_reset(r);
+    }
+    if (s->N_p_jh){
+        if (r->ri_whfast.allocated_N<(unsigned int)s->N_p_jh){
+            r->ri_whfast.p_jh = reb_reserve(r->ri_whfast.p_jh, sizeof(struct reb_particle)*s->N_p_jh);
+            r->ri_whfast.allocated_N = s->N_p_jh;
+        }
+        memcpy(r->ri_whfast.p_jh, s->p_jh, sizeof(struct reb_particle)*s->N_p_jh);
+    }
+    if (s->N_p_int){
+        if (r->ri_janus.allocated_N<(unsigned int)s->N_p_int){
+            r->ri_janus.p_int = realloc(r->ri_janus.p_int, sizeof(struct reb_particle_int)*s->N_p_int);
+            r->ri_janus.allocated_N = s->N_p_int;
+        }
+        memcpy(r->ri_janus.p_int, s->p_int, sizeof(struct reb_particle_int)*s->N_p_int);
+    }
+    if (s->N_dcrit){
+        if (r->ri_mercurius.dcrit_allocatedN<(unsigned int)s->N_dcrit){
+            r->ri_mercurius.dcrit = realloc(r->ri_mercurius.dcrit, sizeof(double)*s->N_dcrit);
+            r->ri_mercurius.dcrit_allocatedN = s->N_dcrit;
+        }
+        memcpy(r->ri_mercurius.dcrit, s->dcrit, sizeof(double)*s->N_dcrit);
+    }
+    return 0;
+}
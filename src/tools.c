@@ -34,6 +34,7 @@
 #include "particle.h"
 #include "rebound.h"
 #include "tools.h"
+#include "gravity.h"
 
 
 void reb_tools_init_srand(struct reb_simulation* r){
@@ -69,31 +70,179 @@ double reb_random_rayleigh(struct reb_simulation* r, double sigma){
 	return sigma*sqrt(-2*log(y));
 }
 
+/// Counter based random numbers
+
+/**
+ * @brief Philox4x32-10 block function (Salmon et al. 2011).
+ * @details Maps a 128 bit counter and a 64 bit key to 128 random bits.
+ * Every counter gives an independent block, so there is no state to pass on.
+ * @param ctr Counter, overwritten with the random bits.
+ * @param seed Key.
+ */
+static void reb_random_philox(uint32_t ctr[4], const uint64_t seed){
+	uint32_t k0 = (uint32_t)seed;
+	uint32_t k1 = (uint32_t)(seed>>32);
+	for (int round=0; round<10; round++){
+		const uint64_t p0 = (uint64_t)0xD2511F53*ctr[0];
+		const uint64_t p1 = (uint64_t)0xCD9E8D57*ctr[2];
+		const uint32_t c0 = (uint32_t)(p1>>32)^ctr[1]^k0;
+		const uint32_t c2 = (uint32_t)(p0>>32)^ctr[3]^k1;
+		ctr[0] = c0;
+		ctr[1] = (uint32_t)p1;
+		ctr[2] = c2;
+		ctr[3] = (uint32_t)p0;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+}
+
+/**
+ * @brief Returns two uniformly distributed numbers in (0,1] for a given seed, stream and draw.
+ */
+static void reb_random_philox_uniform2(const uint64_t seed, const uint64_t stream, const uint64_t draw, double u[2]){
+	uint32_t ctr[4] = {(uint32_t)draw, (uint32_t)(draw>>32), (uint32_t)stream, (uint32_t)(stream>>32)};
+	reb_random_philox(ctr, seed);
+	// 53 random bits each, +1 so that log(u) is always finite.
+	u[0] = ((double)((((uint64_t)ctr[0]<<32)|ctr[1])>>11)+1.)*0x1p-53;
+	u[1] = ((double)((((uint64_t)ctr[2]<<32)|ctr[3])>>11)+1.)*0x1p-53;
+}
+
+void reb_random_uniform_array(uint64_t seed, uint64_t offset, int N, double* values, double min, double max){
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<N; i++){
+		double u[2];
+		reb_random_philox_uniform2(seed, offset+i, 0, u);
+		values[i] = (1.-u[0])*(max-min)+min;
+	}
+}
+
+void reb_random_powerlaw_array(uint64_t seed, uint64_t offset, int N, double* values, double min, double max, double slope){
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<N; i++){
+		double u[2];
+		reb_random_philox_uniform2(seed, offset+i, 0, u);
+		const double y = 1.-u[0];
+		if(slope == -1) values[i] = exp(y*log(max/min) + log(min));
+		else values[i] = pow( (pow(max,slope+1.)-pow(min,slope+1.))*y+pow(min,slope+1.), 1./(slope+1.));
+	}
+}
+
+void reb_random_normal_array(uint64_t seed, uint64_t offset, int N, double* values, double variance){
+	// Box-Muller transform. Unlike the polar method used in reb_random_normal,
+	// this needs exactly one block of random bits per value.
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<N; i++){
+		double u[2];
+		reb_random_philox_uniform2(seed, offset+i, 0, u);
+		values[i] = sqrt(-2.*log(u[0])*variance)*cos(2.*M_PI*u[1]);
+	}
+}
+
+void reb_random_rayleigh_array(uint64_t seed, uint64_t offset, int N, double* values, double sigma){
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<N; i++){
+		double u[2];
+		reb_random_philox_uniform2(seed, offset+i, 0, u);
+		values[i] = sigma*sqrt(-2*log(u[0]));
+	}
+}
+
 /// Other helper routines
+
+/**
+ * @brief Potential energy from direct summation over all pairs.
+ * @details Pairs between two test particles are skipped, as are pairs involving test 
+ * particles of type 0. The outer loop is distributed over OpenMP threads, the inner 
+ * loop is a plain reduction which the compiler vectorizes.
+ */
+static double reb_tools_potential_energy_direct(const struct reb_simulation* const r){
+    const int N_real = r->N - r->N_var;
+    const int _N_active = (r->N_active==-1)?N_real:r->N_active;
+    const int N_interact = (r->testparticle_type==0)?_N_active:N_real;
+    const struct reb_particle* restrict const particles = r->particles;
+    const double G = r->G;
+    double e_pot = 0.;
+#pragma omp parallel for schedule(guided) reduction(+:e_pot)
+    for (int i=0;i<_N_active;i++){
+        const double xi = particles[i].x;
+        const double yi = particles[i].y;
+        const double zi = particles[i].z;
+        double e_i = 0.;
+#pragma omp simd reduction(+:e_i)
+        for (int j=i+1;j<N_interact;j++){
+            const double dx = xi - particles[j].x;
+            const double dy = yi - particles[j].y;
+            const double dz = zi - particles[j].z;
+            e_i += particles[j].m/sqrt(dx*dx + dy*dy + dz*dz);
+        }
+        e_pot -= G*particles[i].m*e_i;
+    }
+    return e_pot;
+}
+
 double reb_tools_energy(const struct reb_simulation* const r){
-    const int N = r->N;
-    const int N_var = r->N_var;
-    const int _N_active = (r->N_active==-1)?(N-N_var):r->N_active;
+    const int N_real = r->N - r->N_var;
+    const int _N_active = (r->N_active==-1)?N_real:r->N_active;
+    const int N_interact = (r->testparticle_type==0)?_N_active:N_real;
     const struct reb_particle* restrict const particles = r->particles;
     double e_kin = 0.;
-    double e_pot = 0.;
-    int N_interact = (r->testparticle_type==0)?_N_active:(N-N_var);
     for (int i=0;i<N_interact;i++){
         struct reb_particle pi = particles[i];
         e_kin += 0.5 * pi.m * (pi.vx*pi.vx + pi.vy*pi.vy + pi.vz*pi.vz);
     }
-    for (int i=0;i<_N_active;i++){
-        struct reb_particle pi = particles[i];
-        for (int j=i+1;j<N_interact;j++){
-            struct reb_particle pj = particles[j];
-            double dx = pi.x - pj.x;
-            double dy = pi.y - pj.y;
-            double dz = pi.z - pj.z;
-            e_pot -= r->G*pj.m*pi.m/sqrt(dx*dx + dy*dy + dz*dz);
+    return e_kin + reb_tools_potential_energy_direct(r) + r->energy_offset;
+}
+
+double reb_tools_energy_of_particles(const struct reb_simulation* const r, const int* const indices, const int N_indices){
+    const int N_real = r->N - r->N_var;
+    const int _N_active = (r->N_active==-1)?N_real:r->N_active;
+    const int N_interact = (r->testparticle_type==0)?_N_active:N_real;
+    const struct reb_particle* restrict const particles = r->particles;
+    const double G = r->G;
+    char* const selected = calloc(N_real, sizeof(char));
+    for (int k=0;k<N_indices;k++){
+        selected[indices[k]] = 1;
+    }
+    double e = 0.;
+    for (int k=0;k<N_indices;k++){
+        const int i = indices[k];
+        if (i>=N_interact) continue;
+        const struct reb_particle pi = particles[i];
+        e += 0.5 * pi.m * (pi.vx*pi.vx + pi.vy*pi.vy + pi.vz*pi.vz);
+        // Pairs with another selected particle are counted once, from the particle with the larger index.
+        const int jend = (i<_N_active)?N_interact:_N_active;
+        double e_i = 0.;
+        for (int j=0;j<jend;j++){
+            if (j==i || (selected[j] && j>i)) continue;
+            const double dx = pi.x - particles[j].x;
+            const double dy = pi.y - particles[j].y;
+            const double dz = pi.z - particles[j].z;
+            e_i += particles[j].m/sqrt(dx*dx + dy*dy + dz*dz);
         }
+        e -= G*pi.m*e_i;
     }
-    
-    return e_kin + e_pot + r->energy_offset;
+    free(selected);
+    return e;
+}
+
+double reb_tools_potential_energy_of_particle(const struct reb_simulation* const r, const int i, const int exclude){
+    const int N_real = r->N - r->N_var;
+    const int _N_active = (r->N_active==-1)?N_real:r->N_active;
+    const int N_interact = (r->testparticle_type==0)?_N_active:N_real;
+    const struct reb_particle* restrict const particles = r->particles;
+    if (i>=N_interact) return 0.;
+    const struct reb_particle pi = particles[i];
+    // Test particles only interact with active particles.
+    const int jend = (i<_N_active)?N_interact:_N_active;
+    double e_i = 0.;
+    for (int j=0;j<jend;j++){
+        if (j==i || j==exclude) continue;
+        const double dx = pi.x - particles[j].x;
+        const double dy = pi.y - particles[j].y;
+        const double dz = pi.z - particles[j].z;
+        e_i += particles[j].m/sqrt(dx*dx + dy*dy + dz*dz);
+    }
+    return -r->G*pi.m*e_i;
 }
 
 struct reb_vec3d reb_tools_angular_momentum(const struct reb_simulation* const r){
@@ -110,6 +259,43 @@ struct reb_vec3d reb_tools_angular_momentum(const struct reb_simulation* const r
 	return L;
 }
 
+struct reb_diagnostics reb_tools_diagnostics(struct reb_simulation* const r, const int tree){
+    const int N_real = r->N - r->N_var;
+    const int _N_active = (r->N_active==-1)?N_real:r->N_active;
+    const int N_interact = (r->testparticle_type==0)?_N_active:N_real;
+    const struct reb_particle* restrict const particles = r->particles;
+    struct reb_diagnostics d = {0};
+    // Kinetic energy and angular momentum in one pass
+    double e_kin = 0.;
+    double Lx = 0.;
+    double Ly = 0.;
+    double Lz = 0.;
+#pragma omp parallel for reduction(+:e_kin,Lx,Ly,Lz)
+    for (int i=0;i<N_real;i++){
+        const struct reb_particle pi = particles[i];
+        if (i<N_interact){
+            e_kin += 0.5 * pi.m * (pi.vx*pi.vx + pi.vy*pi.vy + pi.vz*pi.vz);
+        }
+        Lx += pi.m*(pi.y*pi.vz - pi.z*pi.vy);
+        Ly += pi.m*(pi.z*pi.vx - pi.x*pi.vz);
+        Lz += pi.m*(pi.x*pi.vy - pi.y*pi.vx);
+    }
+    d.energy_kinetic = e_kin;
+    d.angular_momentum.x = Lx;
+    d.angular_momentum.y = Ly;
+    d.angular_momentum.z = Lz;
+#ifndef MPI
+    if (tree && r->gravity==REB_GRAVITY_TREE && r->tree_root!=NULL && !r->tree_needs_update && r->N_active==-1 && r->N_var==0){
+        d.energy_potential = reb_calculate_potential_energy_tree(r);
+    }else
+#endif // MPI
+    {
+        d.energy_potential = reb_tools_potential_energy_direct(r);
+    }
+    d.energy = d.energy_kinetic + d.energy_potential + r->energy_offset;
+    return d;
+}
+
 void reb_move_to_hel(struct reb_simulation* const r){
     const int N_real = r->N - r->N_var;
     if (N_real>0){
@@ -368,6 +554,53 @@ void reb_set_serialized_particle_data(struct reb_simulation* r, uint32_t* hash,
     }
 }
 
+int reb_serialize_orbits(struct reb_simulation* r, enum REB_ORBITS_PRIMARY primary, int jacobi_masses, double* a, double* e, double* inc, double* Omega, double* omega, double* pomega, double* f, double* M, double* l){
+    const int N_real = r->N - r->N_var;
+    if (N_real<2){
+        return 0;
+    }
+    struct reb_particle* const particles = r->particles;
+    // The Jacobi primary of a particle depends on all interior particles. 
+    // Primaries are therefore calculated first, the orbits can then be 
+    // calculated independently of each other.
+    struct reb_particle* const primaries = malloc(sizeof(struct reb_particle)*(N_real-1));
+    struct reb_particle com = particles[0];
+    if (primary == REB_ORBITS_PRIMARY_BARYCENTRIC){
+        com = reb_get_com(r);
+    }
+    for (int i=1;i<N_real;i++){
+        primaries[i-1] = com;
+        if (jacobi_masses && com.m>0.){
+            // Orbit conversion uses mu=G*(p.m+primary.m), so set primary.m such that mu=G*M_jacobi.
+            primaries[i-1].m = particles[0].m*(particles[i].m + com.m)/com.m - particles[i].m;
+        }
+        if (primary == REB_ORBITS_PRIMARY_JACOBI){
+            com = reb_get_com_of_pair(com, particles[i]);
+        }
+    }
+    const double G = r->G;
+    int N_err = 0;
+#pragma omp parallel for schedule(guided) reduction(+:N_err)
+    for (int i=1;i<N_real;i++){
+        int err = 0;
+        const struct reb_orbit o = reb_tools_particle_to_orbit_err(G, particles[i], primaries[i-1], &err);
+        if (err){
+            N_err++;
+        }
+        if (a)      a[i-1]      = o.a;
+        if (e)      e[i-1]      = o.e;
+        if (inc)    inc[i-1]    = o.inc;
+        if (Omega)  Omega[i-1]  = o.Omega;
+        if (omega)  omega[i-1]  = o.omega;
+        if (pomega) pomega[i-1] = o.pomega;
+        if (f)      f[i-1]      = o.f;
+        if (M)      M[i-1]      = o.M;
+        if (l)      l[i-1]      = o.l;
+    }
+    free(primaries);
+    return N_err;
+}
+
 struct reb_particle reb_get_com_of_pair(struct reb_particle p1, struct reb_particle p2){
 	p1.x   = p1.x*p1.m + p2.x*p2.m;		
 	p1.y   = p1.y*p1.m + p2.y*p2.m;
@@ -413,29 +646,60 @@ struct reb_particle reb_get_jacobi_com(struct reb_particle* p){
     return reb_get_com_range(r, 0, p_index);
 }
 	
+/**
+ * @brief Counter based random stream with an arbitrary number of draws.
+ * @details Used when the number of random numbers needed per element is not
+ * known in advance, e.g. for rejection sampling.
+ */
+struct reb_random_stream {
+	uint64_t seed;
+	uint64_t stream;
+	uint64_t draw;
+	double u[2];
+	int n; // Number of unused values in u
+};
+
+static double reb_random_stream_uniform(struct reb_random_stream* s, double min, double max){
+	if (s->n==0){
+		reb_random_philox_uniform2(s->seed, s->stream, s->draw++, s->u);
+		s->n = 2;
+	}
+	s->n--;
+	return s->u[s->n]*(max-min)+min;
+}
+
 void reb_tools_init_plummer(struct reb_simulation* r, int _N, double M, double R) {
 	// Algorithm from:	
 	// http://adsabs.harvard.edu/abs/1974A%26A....37..183A
 	
+	// Every star uses its own counter based random stream. The stars can 
+	// therefore be generated in parallel and the result does not depend on 
+	// the number of threads. The key is drawn from the simulation's random
+	// number generator, so subsequent calls give different stars.
+	uint64_t seed = rand_r(&(r->rand_seed));
+	seed = (seed<<32) ^ rand_r(&(r->rand_seed));
+	struct reb_particle* stars = malloc(sizeof(struct reb_particle)*_N);
 	double E = 3./64.*M_PI*M*M/R;
+#pragma omp parallel for schedule(static)
 	for (int i=0;i<_N;i++){
+		struct reb_random_stream s = {.seed = seed, .stream = i};
 		struct reb_particle star = {0};
-		double _r = pow(pow(reb_random_uniform(r, 0,1),-2./3.)-1.,-1./2.);
-		double x2 = reb_random_uniform(r, 0,1);
-		double x3 = reb_random_uniform(r, 0,2.*M_PI);
+		double _r = pow(pow(reb_random_stream_uniform(&s, 0,1),-2./3.)-1.,-1./2.);
+		double x2 = reb_random_stream_uniform(&s, 0,1);
+		double x3 = reb_random_stream_uniform(&s, 0,2.*M_PI);
 		star.z = (1.-2.*x2)*_r;
 		star.x = sqrt(_r*_r-star.z*star.z)*cos(x3);
 		star.y = sqrt(_r*_r-star.z*star.z)*sin(x3);
 		double x5,g,q;
 		do{
-			x5 = reb_random_uniform(r, 0.,1.);
-			q = reb_random_uniform(r, 0.,1.);
+			x5 = reb_random_stream_uniform(&s, 0.,1.);
+			q = reb_random_stream_uniform(&s, 0.,1.);
 			g = q*q*pow(1.-q*q,7./2.);
 		}while(0.1*x5>g);
 		double ve = pow(2.,1./2.)*pow(1.+_r*_r,-1./4.);
 		double v = q*ve;
-		double x6 = reb_random_uniform(r, 0.,1.);
-		double x7 = reb_random_uniform(r, 0.,2.*M_PI);
+		double x6 = reb_random_stream_uniform(&s, 0.,1.);
+		double x7 = reb_random_stream_uniform(&s, 0.,2.*M_PI);
 		star.vz = (1.-2.*x6)*v;
 		star.vx = sqrt(v*v-star.vz*star.vz)*cos(x7);
 		star.vy = sqrt(v*v-star.vz*star.vz)*sin(x7);
@@ -450,8 +714,12 @@ void reb_tools_init_plummer(struct reb_simulation* r, int _N, double M, double R
 
 		star.m = M/(double)_N;
 
-		reb_add(r, star);
+		stars[i] = star;
+	}
+	for (int i=0;i<_N;i++){
+		reb_add(r, stars[i]);
 	}
+	free(stars);
 }
 
 double reb_tools_mod2pi(double f){
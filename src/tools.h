@@ -27,6 +27,21 @@
 
 #include <stdint.h>
 
+/**
+ * @brief Marks a hot kernel for function multiversioning.
+ * @details If REBOUND is compiled with PORTABLE=1 (without -march=native), gcc 
+ * compiles the marked function once for AVX-512, once for AVX2 and once for the 
+ * baseline instruction set (SSE2 on x86-64). The version supported by the CPU 
+ * is selected when the library is loaded. Floating point contraction is off with 
+ * -std=c99, so all versions give the same results. On other architectures and 
+ * compilers the macro is empty (NEON is part of the aarch64 baseline).
+ */
+#if defined(PORTABLE) && defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define REB_TARGET_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else // PORTABLE
+#define REB_TARGET_CLONES
+#endif // PORTABLE
+
 struct reb_simulation;
 struct reb_particles;
 
@@ -74,6 +89,27 @@ void reb_tools_solve_kepler_pal(double h, double k, double lambda, double* p, do
  */
 void reb_tools_particle_to_pal(double G, struct reb_particle p, struct reb_particle primary, double *a, double* lambda, double* k, double* h, double* ix, double* iy);
 
+/**
+ * @brief Energy which is lost if the particles with the given indices are removed.
+ * @details Kinetic energy of the particles plus all pair potentials involving at least
+ * one of them. Same conventions for test particles as in reb_tools_energy(). The 
+ * cost is O(N_indices*N) rather than O(N^2).
+ * @param r REBOUND simulation to be considered.
+ * @param indices Indices of the particles.
+ * @param N_indices Number of indices.
+ */
+double reb_tools_energy_of_particles(const struct reb_simulation* const r, const int* const indices, const int N_indices);
+
+/**
+ * @brief Potential energy between particle i and all other particles, except particle exclude.
+ * @details Same conventions for test particles as in reb_tools_energy(). The cost is O(N).
+ * Used to keep track of the energy offset when two particles merge.
+ * @param r REBOUND simulation to be considered.
+ * @param i Index of the particle.
+ * @param exclude Index of a particle to skip (e.g. the merger partner), or -1.
+ */
+double reb_tools_potential_energy_of_particle(const struct reb_simulation* const r, const int i, const int exclude);
+
 /**
  * @brief internal function to handle outputs for the Fast Simulation Restarter.
  */
@@ -25,12 +25,173 @@
  *
  */
 
+#include <string.h>
 #include "transformations.h"
 #include "rebound.h"
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
 
 /******************************
  * Jacobi */
 
+#ifdef OPENMP
+#ifndef REB_TRANSFORMATIONS_SCAN_MIN_N
+#define REB_TRANSFORMATIONS_SCAN_MIN_N 1024 ///< Minimum number of active particles for which the Jacobi transformations use a parallel scan.
+#endif
+
+// The Jacobi coordinate of particle i is its position relative to the centre
+// of mass of particles 0 to i-1. The centres of mass are prefix sums, which are
+// calculated in parallel here: every thread first sums up its own chunk of
+// particles, then starts from the sum of all chunks before it.
+// Components 0-8 are x, y, z, vx, vy, vz, ax, ay, az. Only components k0 to
+// k1-1 are transformed.
+
+static int reb_transformations_use_scan(const int N_active){
+    return N_active >= REB_TRANSFORMATIONS_SCAN_MIN_N && omp_get_max_threads()>1;
+}
+
+static inline void reb_particle_to_components(const struct reb_particle* const p, double* const c){
+    c[0] = p->x;  c[1] = p->y;  c[2] = p->z;
+    c[3] = p->vx; c[4] = p->vy; c[5] = p->vz;
+    c[6] = p->ax; c[7] = p->ay; c[8] = p->az;
+}
+
+static inline void reb_components_to_particle(struct reb_particle* const p, const double* const c){
+    p->x  = c[0]; p->y  = c[1]; p->z  = c[2];
+    p->vx = c[3]; p->vy = c[4]; p->vz = c[5];
+    p->ax = c[6]; p->ay = c[7]; p->az = c[8];
+}
+
+// Calculates p_j for particles 1 to N_active-1. On return, s contains the
+// mass weighted sum of all active particles and eta their total mass.
+static void reb_transformations_inertial_to_jacobi_scan(const struct reb_particle* const particles, struct reb_particle* const p_j, const struct reb_particle* const p_mass, const int N_active, const int k0, const int k1, double* const s, double* const eta){
+    const int T = omp_get_max_threads();
+    double chunk_sums[T][10]; // Total mass (index 9) and mass weighted sum of each chunk
+#pragma omp parallel num_threads(T)
+    {
+        const int nt = omp_get_num_threads();
+        const int t = omp_get_thread_num();
+        const int lo = 1 + (int)((long)(N_active-1)*t/nt);
+        const int hi = 1 + (int)((long)(N_active-1)*(t+1)/nt);
+        double c[10] = {0.};
+        for (int i=lo;i<hi;i++){
+            double ci[9];
+            reb_particle_to_components(&particles[i], ci);
+            const double m = p_mass[i].m;
+            for (int k=k0;k<k1;k++){
+                c[k] += m*ci[k];
+            }
+            c[9] += m;
+        }
+        memcpy(chunk_sums[t], c, sizeof(double)*10);
+#pragma omp barrier
+        double e = p_mass[0].m;
+        double c0[9];
+        reb_particle_to_components(&particles[0], c0);
+        for (int k=k0;k<k1;k++){
+            c[k] = e*c0[k];
+        }
+        for (int u=0;u<t;u++){
+            for (int k=k0;k<k1;k++){
+                c[k] += chunk_sums[u][k];
+            }
+            e += chunk_sums[u][9];
+        }
+        for (int i=lo;i<hi;i++){
+            const double ei = 1./e;
+            double ci[9];
+            double cj[9];
+            reb_particle_to_components(&particles[i], ci);
+            reb_particle_to_components(&p_j[i], cj);
+            const double m = p_mass[i].m;
+            for (int k=k0;k<k1;k++){
+                cj[k] = ci[k] - c[k]*ei;
+                c[k] += m*ci[k];
+            }
+            reb_components_to_particle(&p_j[i], cj);
+            if (k0==0){
+                p_j[i].m = particles[i].m;
+            }
+            e += m;
+        }
+        if (t==nt-1){
+            memcpy(s, c, sizeof(double)*9);
+            *eta = e;
+        }
+    }
+}
+
+// Calculates particles 1 to N_active-1 from p_j. On return, s contains the
+// mass weighted position (velocity, acceleration) of particle 0 and eta its mass.
+static void reb_transformations_jacobi_to_inertial_scan(struct reb_particle* const particles, const struct reb_particle* const p_j, const struct reb_particle* const p_mass, const int N_active, const int k0, const int k1, double* const s, double* const eta){
+    // The centre of mass X of particles 0 to i is the centre of mass of all
+    // active particles minus the sum of m_l/eta_l*p_j[l] over l>i.
+    const int T = omp_get_max_threads();
+    double chunk_sums[T][10]; 
+#pragma omp parallel num_threads(T)
+    {
+        const int nt = omp_get_num_threads();
+        const int t = omp_get_thread_num();
+        const int lo = 1 + (int)((long)(N_active-1)*t/nt);
+        const int hi = 1 + (int)((long)(N_active-1)*(t+1)/nt);
+        double m_chunk = 0.;
+        for (int i=lo;i<hi;i++){
+            m_chunk += p_mass[i].m;
+        }
+        chunk_sums[t][9] = m_chunk;
+#pragma omp barrier
+        // Mass of particles 0 to hi-1
+        double e_hi = p_j[0].m;
+        for (int u=t+1;u<nt;u++){
+            e_hi -= chunk_sums[u][9];
+        }
+        double c[9] = {0.};
+        double e = e_hi;
+        for (int i=hi-1;i>=lo;i--){
+            double cj[9];
+            reb_particle_to_components(&p_j[i], cj);
+            const double w = p_mass[i].m/e;
+            for (int k=k0;k<k1;k++){
+                c[k] += w*cj[k];
+            }
+            e -= p_mass[i].m;
+        }
+        for (int k=k0;k<k1;k++){
+            chunk_sums[t][k] = c[k];
+        }
+#pragma omp barrier
+        // Centre of mass of particles 0 to hi-1
+        reb_particle_to_components(&p_j[0], c);
+        for (int u=t+1;u<nt;u++){
+            for (int k=k0;k<k1;k++){
+                c[k] -= chunk_sums[u][k];
+            }
+        }
+        e = e_hi;
+        for (int i=hi-1;i>=lo;i--){
+            double ci[9];
+            double cj[9];
+            reb_particle_to_components(&particles[i], ci);
+            reb_particle_to_components(&p_j[i], cj);
+            const double w = p_mass[i].m/e;
+            for (int k=k0;k<k1;k++){
+                c[k] -= w*cj[k];
+                ci[k] = cj[k] + c[k];
+            }
+            reb_components_to_particle(&particles[i], ci);
+            e -= p_mass[i].m;
+        }
+        if (t==0){
+            for (int k=k0;k<k1;k++){
+                s[k] = c[k]*e;
+            }
+            *eta = e;
+        }
+    }
+}
+#endif // OPENMP
+
 void reb_transformations_inertial_to_jacobi_posvel(const struct reb_particle* const particles, struct reb_particle* const p_j, const struct reb_particle* const p_mass, const unsigned int N, const int N_active){
     double eta = p_mass[0].m;
     double s_x = eta * particles[0].x;
@@ -39,7 +200,21 @@ void reb_transformations_inertial_to_jacobi_posvel(const struct reb_particle* co
     double s_vx = eta * particles[0].vx;
     double s_vy = eta * particles[0].vy;
     double s_vz = eta * particles[0].vz;
-    for (unsigned int i=1;i<N_active;i++){
+    unsigned int i_start = 1;
+#ifdef OPENMP
+    if (reb_transformations_use_scan(N_active)){
+        double s[9];
+        reb_transformations_inertial_to_jacobi_scan(particles, p_j, p_mass, N_active, 0, 6, s, &eta);
+        s_x = s[0];
+        s_y = s[1];
+        s_z = s[2];
+        s_vx = s[3];
+        s_vy = s[4];
+        s_vz = s[5];
+        i_start = N_active;
+    }
+#endif // OPENMP
+    for (unsigned int i=i_start;i<N_active;i++){
         const double ei = 1./eta;
         const struct reb_particle pi = particles[i];
         eta += p_mass[i].m;
@@ -59,6 +234,61 @@ void reb_transformations_inertial_to_jacobi_posvel(const struct reb_particle* co
         s_vz = s_vz * pme + p_mass[i].m*p_j[i].vz;
     }
     const double ei = 1./eta;
+#pragma omp parallel for if(N>=reb_omp_min_N)
+    for (unsigned int i=N_active;i<N;i++){
+        const struct reb_particle pi = particles[i];
+        p_j[i].m = pi.m;
+        p_j[i].x = pi.x - s_x*ei;
+        p_j[i].y = pi.y - s_y*ei;
+        p_j[i].z = pi.z - s_z*ei;
+        p_j[i].vx = pi.vx - s_vx*ei;
+        p_j[i].vy = pi.vy - s_vy*ei;
+        p_j[i].vz = pi.vz - s_vz*ei;
+    }
+    const double Mtotal  = eta;
+    const double Mtotali = 1./Mtotal;
+    p_j[0].m = Mtotal;
+    p_j[0].x = s_x * Mtotali;
+    p_j[0].y = s_y * Mtotali;
+    p_j[0].z = s_z * Mtotali;
+    p_j[0].vx = s_vx * Mtotali;
+    p_j[0].vy = s_vy * Mtotali;
+    p_j[0].vz = s_vz * Mtotali;
+}
+
+void reb_transformations_inertial_to_jacobi_posvel_from(const struct reb_particle* const particles, struct reb_particle* const p_j, const struct reb_particle* const p_mass, const unsigned int N, const int N_active, const unsigned int first){
+    // Same as reb_transformations_inertial_to_jacobi_posvel but the Jacobi
+    // coordinates of particles 1 to first-1 in p_j are reused.
+    double eta = p_mass[0].m;
+    double s_x = eta * particles[0].x;
+    double s_y = eta * particles[0].y;
+    double s_z = eta * particles[0].z;
+    double s_vx = eta * particles[0].vx;
+    double s_vy = eta * particles[0].vy;
+    double s_vz = eta * particles[0].vz;
+    for (unsigned int i=1;i<N_active;i++){
+        const double ei = 1./eta;
+        eta += p_mass[i].m;
+        const double pme = eta*ei;
+        if (i>=first){
+            const struct reb_particle pi = particles[i];
+            p_j[i].m = pi.m;
+            p_j[i].x = pi.x - s_x*ei;
+            p_j[i].y = pi.y - s_y*ei;
+            p_j[i].z = pi.z - s_z*ei;
+            p_j[i].vx = pi.vx - s_vx*ei;
+            p_j[i].vy = pi.vy - s_vy*ei;
+            p_j[i].vz = pi.vz - s_vz*ei;
+        }
+        s_x  = s_x  * pme + p_mass[i].m*p_j[i].x ;
+        s_y  = s_y  * pme + p_mass[i].m*p_j[i].y ;
+        s_z  = s_z  * pme + p_mass[i].m*p_j[i].z ;
+        s_vx = s_vx * pme + p_mass[i].m*p_j[i].vx;
+        s_vy = s_vy * pme + p_mass[i].m*p_j[i].vy;
+        s_vz = s_vz * pme + p_mass[i].m*p_j[i].vz;
+    }
+    const double ei = 1./eta;
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=N_active;i<N;i++){
         const struct reb_particle pi = particles[i];
         p_j[i].m = pi.m;
@@ -91,7 +321,24 @@ void reb_transformations_inertial_to_jacobi_posvelacc(const struct reb_particle*
     double s_ax = eta * particles[0].ax;
     double s_ay = eta * particles[0].ay;
     double s_az = eta * particles[0].az;
-    for (unsigned int i=1;i<N_active;i++){
+    unsigned int i_start = 1;
+#ifdef OPENMP
+    if (reb_transformations_use_scan(N_active)){
+        double s[9];
+        reb_transformations_inertial_to_jacobi_scan(particles, p_j, p_mass, N_active, 0, 9, s, &eta);
+        s_x = s[0];
+        s_y = s[1];
+        s_z = s[2];
+        s_vx = s[3];
+        s_vy = s[4];
+        s_vz = s[5];
+        s_ax = s[6];
+        s_ay = s[7];
+        s_az = s[8];
+        i_start = N_active;
+    }
+#endif // OPENMP
+    for (unsigned int i=i_start;i<N_active;i++){
         const double ei = 1./eta;
         const struct reb_particle pi = particles[i];
         eta += p_mass[i].m;
@@ -117,6 +364,7 @@ void reb_transformations_inertial_to_jacobi_posvelacc(const struct reb_particle*
         s_az = s_az * pme + p_mass[i].m*p_j[i].az;
     }
     const double ei = 1./eta;
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=N_active;i<N;i++){
         const struct reb_particle pi = particles[i];
         p_j[i].m = pi.m;
@@ -149,7 +397,18 @@ void reb_transformations_inertial_to_jacobi_acc(const struct reb_particle* const
     double s_ax = eta * particles[0].ax;
     double s_ay = eta * particles[0].ay;
     double s_az = eta * particles[0].az;
-    for (unsigned int i=1;i<N_active;i++){
+    unsigned int i_start = 1;
+#ifdef OPENMP
+    if (reb_transformations_use_scan(N_active)){
+        double s[9];
+        reb_transformations_inertial_to_jacobi_scan(particles, p_j, p_mass, N_active, 6, 9, s, &eta);
+        s_ax = s[6];
+        s_ay = s[7];
+        s_az = s[8];
+        i_start = N_active;
+    }
+#endif // OPENMP
+    for (unsigned int i=i_start;i<N_active;i++){
         const double ei = 1./eta;
         const struct reb_particle pi = particles[i];
         eta += p_mass[i].m;
@@ -162,6 +421,7 @@ void reb_transformations_inertial_to_jacobi_acc(const struct reb_particle* const
         s_az = s_az * pme + p_mass[i].m*p_j[i].az;
     }
     const double ei = 1./eta;
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=N_active;i<N;i++){
         const struct reb_particle pi = particles[i];
         p_j[i].ax = pi.ax - s_ax*ei;
@@ -183,17 +443,32 @@ void reb_transformations_jacobi_to_inertial_posvel(struct reb_particle* const pa
     double s_vx = p_j[0].vx * eta;
     double s_vy = p_j[0].vy * eta;
     double s_vz = p_j[0].vz * eta;
-    for (unsigned int i=N-1;i>=N_active;i--){
+    const double eta_inv = 1./eta;
+#pragma omp parallel for if(N>=reb_omp_min_N)
+    for (unsigned int i=N_active;i<N;i++){
         const struct reb_particle pji = p_j[i];
-        const double ei = 1./eta;
-        particles[i].x  = pji.x  + s_x  * ei;
-        particles[i].y  = pji.y  + s_y  * ei;
-        particles[i].z  = pji.z  + s_z  * ei;
-        particles[i].vx = pji.vx + s_vx * ei;
-        particles[i].vy = pji.vy + s_vy * ei;
-        particles[i].vz = pji.vz + s_vz * ei;
-    }
-    for (unsigned int i=N_active-1;i>0;i--){
+        particles[i].x  = pji.x  + s_x  * eta_inv;
+        particles[i].y  = pji.y  + s_y  * eta_inv;
+        particles[i].z  = pji.z  + s_z  * eta_inv;
+        particles[i].vx = pji.vx + s_vx * eta_inv;
+        particles[i].vy = pji.vy + s_vy * eta_inv;
+        particles[i].vz = pji.vz + s_vz * eta_inv;
+    }
+    unsigned int i_start = N_active-1;
+#ifdef OPENMP
+    if (reb_transformations_use_scan(N_active)){
+        double s[9];
+        reb_transformations_jacobi_to_inertial_scan(particles, p_j, p_mass, N_active, 0, 6, s, &eta);
+        s_x = s[0];
+        s_y = s[1];
+        s_z = s[2];
+        s_vx = s[3];
+        s_vy = s[4];
+        s_vz = s[5];
+        i_start = 0;
+    }
+#endif // OPENMP
+    for (unsigned int i=i_start;i>0;i--){
         const struct reb_particle pji = p_j[i];
         const double ei = 1./eta;
         s_x  = (s_x  - p_mass[i].m * pji.x ) * ei;
@@ -230,14 +505,26 @@ void reb_transformations_jacobi_to_inertial_pos(struct reb_particle* const parti
     double s_x  = p_j[0].x  * eta;
     double s_y  = p_j[0].y  * eta;
     double s_z  = p_j[0].z  * eta;
-    for (unsigned int i=N-1;i>=N_active;i--){
+    const double eta_inv = 1./eta;
+#pragma omp parallel for if(N>=reb_omp_min_N)
+    for (unsigned int i=N_active;i<N;i++){
         const struct reb_particle pji = p_j[i];
-        const double ei = 1./eta;
-        particles[i].x  = pji.x  + s_x*ei ;
-        particles[i].y  = pji.y  + s_y*ei ;
-        particles[i].z  = pji.z  + s_z*ei ;
+        particles[i].x  = pji.x  + s_x*eta_inv ;
+        particles[i].y  = pji.y  + s_y*eta_inv ;
+        particles[i].z  = pji.z  + s_z*eta_inv ;
     }
-    for (unsigned int i=N_active-1;i>0;i--){
+    unsigned int i_start = N_active-1;
+#ifdef OPENMP
+    if (reb_transformations_use_scan(N_active)){
+        double s[9];
+        reb_transformations_jacobi_to_inertial_scan(particles, p_j, p_mass, N_active, 0, 3, s, &eta);
+        s_x = s[0];
+        s_y = s[1];
+        s_z = s[2];
+        i_start = 0;
+    }
+#endif // OPENMP
+    for (unsigned int i=i_start;i>0;i--){
         const struct reb_particle pji = p_j[i];
         const double ei = 1./eta;
         s_x  = (s_x  - p_mass[i].m * pji.x ) * ei;
@@ -262,14 +549,26 @@ void reb_transformations_jacobi_to_inertial_acc(struct reb_particle* const parti
     double s_ax  = p_j[0].ax  * eta;
     double s_ay  = p_j[0].ay  * eta;
     double s_az  = p_j[0].az  * eta;
-    for (unsigned int i=N-1;i>=N_active;i--){
+    const double eta_inv = 1./eta;
+#pragma omp parallel for if(N>=reb_omp_min_N)
+    for (unsigned int i=N_active;i<N;i++){
         const struct reb_particle pji = p_j[i];
-        const double ei = 1./eta;
-        particles[i].ax  = pji.ax  + s_ax * ei;
-        particles[i].ay  = pji.ay  + s_ay * ei;
-        particles[i].az  = pji.az  + s_az * ei;
+        particles[i].ax  = pji.ax  + s_ax * eta_inv;
+        particles[i].ay  = pji.ay  + s_ay * eta_inv;
+        particles[i].az  = pji.az  + s_az * eta_inv;
+    }
+    unsigned int i_start = N_active-1;
+#ifdef OPENMP
+    if (reb_transformations_use_scan(N_active)){
+        double s[9];
+        reb_transformations_jacobi_to_inertial_scan(particles, p_j, p_mass, N_active, 6, 9, s, &eta);
+        s_ax = s[6];
+        s_ay = s[7];
+        s_az = s[8];
+        i_start = 0;
     }
-    for (unsigned int i=N_active-1;i>0;i--){
+#endif // OPENMP
+    for (unsigned int i=i_start;i>0;i--){
         const struct reb_particle pji = p_j[i];
         const double ei = 1./eta;
         s_ax  = (s_ax  - p_mass[i].m * pji.ax ) * ei;
@@ -300,7 +599,7 @@ void reb_transformations_inertial_to_whds_posvel(const struct reb_particle* cons
     double vy0 = 0.;
     double vz0 = 0.;
     double m0  = 0.;
-#pragma omp parallel for reduction(+:x0) reduction(+:y0) reduction(+:z0) reduction(+:vx0) reduction(+:vy0) reduction(+:vz0) reduction(+:m0)
+#pragma omp parallel for if(N>=reb_omp_min_N) reduction(+:x0) reduction(+:y0) reduction(+:z0) reduction(+:vx0) reduction(+:vy0) reduction(+:vz0) reduction(+:m0)
     for (unsigned int i=0;i<N_active;i++){
         double m = particles[i].m;
         x0  += particles[i].x *m;
@@ -320,7 +619,7 @@ void reb_transformations_inertial_to_whds_posvel(const struct reb_particle* cons
     p_h[0].m = m0;
     
     m0 = particles[0].m;
-#pragma omp parallel for
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=1;i<N_active;i++){
         p_h[i].x  = particles[i].x  - particles[0].x ;
         p_h[i].y  = particles[i].y  - particles[0].y ;
@@ -332,7 +631,7 @@ void reb_transformations_inertial_to_whds_posvel(const struct reb_particle* cons
         p_h[i].vz = mf*(particles[i].vz - p_h[0].vz);
         p_h[i].m  = mi;
     }
-#pragma omp parallel for
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=N_active;i<N;i++){
         p_h[i].x  = particles[i].x  - particles[0].x ;
         p_h[i].y  = particles[i].y  - particles[0].y ;
@@ -352,7 +651,7 @@ void reb_transformations_whds_to_inertial_pos(struct reb_particle* const particl
 void reb_transformations_whds_to_inertial_posvel(struct reb_particle* const particles, const struct reb_particle* const p_h, const unsigned int N, const int N_active){
     reb_transformations_whds_to_inertial_pos(particles,p_h,N, N_active);
     const double m0 = particles[0].m;
-#pragma omp parallel for
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=1;i<N_active;i++){
         const double mi = particles[i].m;
         double mf = (m0+mi) / m0;
@@ -360,7 +659,7 @@ void reb_transformations_whds_to_inertial_posvel(struct reb_particle* const part
         particles[i].vy = p_h[i].vy/mf+p_h[0].vy;
         particles[i].vz = p_h[i].vz/mf+p_h[0].vz;
     }
-#pragma omp parallel for
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=N_active;i<N;i++){
         particles[i].vx = p_h[i].vx+p_h[0].vx;
         particles[i].vy = p_h[i].vy+p_h[0].vy;
@@ -369,7 +668,7 @@ void reb_transformations_whds_to_inertial_posvel(struct reb_particle* const part
     double vx0  = 0.;
     double vy0  = 0.;
     double vz0  = 0.;
-#pragma omp parallel for reduction(+:vx0) reduction(+:vy0) reduction(+:vz0) 
+#pragma omp parallel for if(N>=reb_omp_min_N) reduction(+:vx0) reduction(+:vy0) reduction(+:vz0)
     for (int i=1;i<N_active;i++){
         double m = particles[i].m;
         vx0 += p_h[i].vx*m/(m0+m);
@@ -393,7 +692,7 @@ void reb_transformations_inertial_to_democraticheliocentric_posvel(const struct
     double vy0 = 0.;
     double vz0 = 0.;
     double m0  = 0.;
-#pragma omp parallel for reduction(+:x0) reduction(+:y0) reduction(+:z0) reduction(+:vx0) reduction(+:vy0) reduction(+:vz0) reduction(+:m0)
+#pragma omp parallel for if(N>=reb_omp_min_N) reduction(+:x0) reduction(+:y0) reduction(+:z0) reduction(+:vx0) reduction(+:vy0) reduction(+:vz0) reduction(+:m0)
     for (int i=0;i<N_active;i++){
         double m = particles[i].m;
         x0  += particles[i].x *m;
@@ -412,7 +711,7 @@ void reb_transformations_inertial_to_democraticheliocentric_posvel(const struct
     p_h[0].vz = vz0/m0;
     p_h[0].m = m0;
     
-#pragma omp parallel for 
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=1;i<N;i++){
         p_h[i].x  = particles[i].x  - particles[0].x ;
         p_h[i].y  = particles[i].y  - particles[0].y ;
@@ -429,7 +728,7 @@ void reb_transformations_democraticheliocentric_to_inertial_pos(struct reb_parti
     double x0  = 0.;
     double y0  = 0.;
     double z0  = 0.;
-#pragma omp parallel for reduction(+:x0) reduction(+:y0) reduction(+:z0) 
+#pragma omp parallel for if(N>=reb_omp_min_N) reduction(+:x0) reduction(+:y0) reduction(+:z0)
     for (int i=1;i<N_active;i++){
         double m = p_h[i].m;
         x0 += p_h[i].x*m/mtot;
@@ -440,7 +739,7 @@ void reb_transformations_democraticheliocentric_to_inertial_pos(struct reb_parti
     particles[0].x  = p_h[0].x - x0;
     particles[0].y  = p_h[0].y - y0;
     particles[0].z  = p_h[0].z - z0;
-#pragma omp parallel for 
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=1;i<N;i++){
         particles[i].x = p_h[i].x+particles[0].x;
         particles[i].y = p_h[i].y+particles[0].y;
@@ -451,7 +750,7 @@ void reb_transformations_democraticheliocentric_to_inertial_pos(struct reb_parti
 void reb_transformations_democraticheliocentric_to_inertial_posvel(struct reb_particle* const particles, const struct reb_particle* const p_h, const unsigned int N, const int N_active){
     reb_transformations_democraticheliocentric_to_inertial_pos(particles,p_h,N,N_active);
     const double m0 = particles[0].m;
-#pragma omp parallel for 
+#pragma omp parallel for if(N>=reb_omp_min_N)
     for (unsigned int i=1;i<N;i++){
         particles[i].vx = p_h[i].vx+p_h[0].vx;
         particles[i].vy = p_h[i].vy+p_h[0].vy;
@@ -460,7 +759,7 @@ void reb_transformations_democraticheliocentric_to_inertial_posvel(struct reb_pa
     double vx0  = 0.;
     double vy0  = 0.;
     double vz0  = 0.;
-#pragma omp parallel for reduction(+:vx0) reduction(+:vy0) reduction(+:vz0) 
+#pragma omp parallel for if(N>=reb_omp_min_N) reduction(+:vx0) reduction(+:vy0) reduction(+:vz0)
     for (int i=1;i<N_active;i++){
         double m = particles[i].m;
         vx0 += p_h[i].vx*m/m0;
@@ -25,6 +25,8 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
@@ -32,10 +34,16 @@
 #include "rebound.h"
 #include "boundary.h"
 #include "tree.h"
+#include "gravity.h"
+#include "profiling.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif // MPI
 
+/**
+  * @brief Minimum number of particles in a cell for its octants to be processed as separate OpenMP tasks.
+  */
+#define REB_TREE_TASK_MIN 2048
 
 /**
   * @brief Given a particle and a pointer to a node cell, the function returns the index of the octant which the particle belongs to.
@@ -63,6 +71,79 @@ static int reb_reb_tree_get_octant_for_particle_in_cell(const struct reb_particl
   */
 static struct reb_treecell *reb_tree_add_particle_to_cell(struct reb_simulation* const r, struct reb_treecell *node, int pt, struct reb_treecell *parent, int o);
 
+/**
+  * @brief Returns a zeroed cell from the cell pool.
+  *
+  * @details Cells which have been returned to the pool are reused first. Otherwise the 
+  * next unused cell of the current block is returned. If the current block is full, the
+  * next block is used. A new block twice the size of the previous one is allocated if 
+  * needed. Blocks are never moved, so pointers to cells stay valid.
+  * @param r REBOUND simulation to operate on
+  */
+static struct reb_treecell* reb_tree_cell_alloc(struct reb_simulation* const r){
+	struct reb_treecell* node = r->tree_pool_free;
+	if (node){
+		r->tree_pool_free = node->oct[0];
+	}else{
+		if (r->tree_pool_N_blocks==0 || r->tree_pool_N_used==(REB_TREE_POOL_BLOCK<<r->tree_pool_block)){
+			const int b = r->tree_pool_N_blocks?r->tree_pool_block+1:0;
+			if (b==r->tree_pool_N_blocks){
+				r->tree_pool_blocks = realloc(r->tree_pool_blocks, sizeof(struct reb_treecell*)*(b+1));
+				r->tree_pool_blocks[b] = malloc(sizeof(struct reb_treecell)*(REB_TREE_POOL_BLOCK<<b));
+				r->tree_pool_N_blocks++;
+			}
+			r->tree_pool_block = b;
+			r->tree_pool_N_used = 0;
+		}
+		node = &(r->tree_pool_blocks[r->tree_pool_block][r->tree_pool_N_used]);
+		r->tree_pool_N_used++;
+	}
+	*node = (struct reb_treecell){0};
+	node->moments = -1;
+	node->id = ++r->tree_cell_id;
+	return node;
+}
+
+/**
+  * @brief Returns a cell to the cell pool.
+  * @param r REBOUND simulation to operate on
+  * @param node is the pointer to the cell. Its children are not freed.
+  */
+static void reb_tree_cell_free(struct reb_simulation* const r, struct reb_treecell* node){
+#pragma omp critical (reb_tree_pool)
+	{
+	node->id = 0; // Invalidates kept interaction lists which contain this cell
+	node->oct[0] = r->tree_pool_free;
+	r->tree_pool_free = node;
+	}
+}
+
+/**
+  * @brief Allocates a new cell and calculates its geometric properties.
+  * @param r REBOUND simulation to operate on
+  * @param parent is the pointer to the parent cell. If the new cell is a root, then parent is NULL.
+  * @param o is the index of the octant of the parent cell.
+  * @param p is a particle inside the new cell. Only used to find the position of a root cell. 
+  */
+static struct reb_treecell* reb_tree_new_cell(struct reb_simulation* const r, struct reb_treecell* parent, int o, const struct reb_particle p){
+	struct reb_treecell* node = reb_tree_cell_alloc(r);
+	if (parent == NULL){ // The new node is a root
+		node->w = r->root_size;
+		int i = ((int)floor((p.x + r->boxsize.x/2.)/r->root_size))%r->root_nx;
+		int j = ((int)floor((p.y + r->boxsize.y/2.)/r->root_size))%r->root_ny;
+		int k = ((int)floor((p.z + r->boxsize.z/2.)/r->root_size))%r->root_nz;
+		node->x = -r->boxsize.x/2.+r->root_size*(0.5+(double)i);
+		node->y = -r->boxsize.y/2.+r->root_size*(0.5+(double)j);
+		node->z = -r->boxsize.z/2.+r->root_size*(0.5+(double)k);
+	}else{ // The new node is a normal node
+		node->w 	= parent->w/2.;
+		node->x 	= parent->x + node->w/2.*((o>>0)%2==0?1.:-1);
+		node->y 	= parent->y + node->w/2.*((o>>1)%2==0?1.:-1);
+		node->z 	= parent->z + node->w/2.*((o>>2)%2==0?1.:-1);
+	}
+	return node;
+}
+
 void reb_tree_add_particle_to_tree(struct reb_simulation* const r, int pt){
 	if (r->tree_root==NULL){
 		r->tree_root = calloc(r->root_nx*r->root_ny*r->root_nz,sizeof(struct reb_treecell*));
@@ -71,9 +152,7 @@ void reb_tree_add_particle_to_tree(struct reb_simulation* const r, int pt){
 	int rootbox = reb_get_rootbox_for_particle(r, p);
 #ifdef MPI
 	// Do not add particles that do not belong to this tree (avoid removing active particles)
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int proc_id = rootbox/root_n_per_node;
-	if (proc_id!=r->mpi_id) return;
+	if (!reb_communication_mpi_rootbox_is_local(r, rootbox)) return;
 #endif 	// MPI
 	r->tree_root[rootbox] = reb_tree_add_particle_to_cell(r, r->tree_root[rootbox],pt,NULL,0);
 }
@@ -82,27 +161,9 @@ static struct reb_treecell *reb_tree_add_particle_to_cell(struct reb_simulation*
 	struct reb_particle* const particles = r->particles;
 	// Initialize a new node
 	if (node == NULL) {  
-		node = calloc(1, sizeof(struct reb_treecell));
-		struct reb_particle p = particles[pt];
-		if (parent == NULL){ // The new node is a root
-			node->w = r->root_size;
-			int i = ((int)floor((p.x + r->boxsize.x/2.)/r->root_size))%r->root_nx;
-			int j = ((int)floor((p.y + r->boxsize.y/2.)/r->root_size))%r->root_ny;
-			int k = ((int)floor((p.z + r->boxsize.z/2.)/r->root_size))%r->root_nz;
-			node->x = -r->boxsize.x/2.+r->root_size*(0.5+(double)i);
-			node->y = -r->boxsize.y/2.+r->root_size*(0.5+(double)j);
-			node->z = -r->boxsize.z/2.+r->root_size*(0.5+(double)k);
-		}else{ // The new node is a normal node
-			node->w 	= parent->w/2.;
-			node->x 	= parent->x + node->w/2.*((o>>0)%2==0?1.:-1);
-			node->y 	= parent->y + node->w/2.*((o>>1)%2==0?1.:-1);
-			node->z 	= parent->z + node->w/2.*((o>>2)%2==0?1.:-1);
-		}
+		node = reb_tree_new_cell(r, parent, o, particles[pt]);
 		node->pt = pt; 
 		particles[pt].c = node;
-		for (int i=0; i<8; i++){
-			node->oct[i] = NULL;
-		}
 		return node;
 	}
 	// In a existing node
@@ -112,8 +173,10 @@ static struct reb_treecell *reb_tree_add_particle_to_cell(struct reb_simulation*
 		o = reb_reb_tree_get_octant_for_particle_in_cell(particles[pt], node);
 		node->oct[o] = reb_tree_add_particle_to_cell(r, node->oct[o], pt, node, o);
 		node->pt = -2;
+		node->moments = -1;
 	}else{ // It's not a leaf
 		node->pt--;
+		node->moments = -1;
 		int o = reb_reb_tree_get_octant_for_particle_in_cell(particles[pt], node);
 		node->oct[o] = reb_tree_add_particle_to_cell(r, node->oct[o], pt, node, o);
 	}
@@ -145,21 +208,55 @@ static int reb_tree_particle_is_inside_cell(const struct reb_simulation* const r
 	return 1;
 }
 
+/**
+  * @brief List of particles which have left their cell during a parallel tree update.
+  */
+struct reb_tree_reinsert {
+	int N;		/**< Number of particles in the list. */
+	int allocatedN;	/**< Size of the index array. */
+	int* index;	/**< Indices of the particles. */
+};
+
 /**
   * @brief The function is called to walk through the whole tree to update its structure and node->pt at the end of each time step.
   *
+  * @details Every leaf is checked, but node->pt is only recounted for cells in which a daughter
+  * has been removed or changed its structure. Such cells are marked with node->moments = -1. 
+  * With OpenMP, the octants of large cells are updated in separate tasks. Particles 
+  * which have left their cell are then only recorded in reinsert and later removed and 
+  * reinserted by reb_tree_update() outside of the parallel region.
   * @param r REBOUND simulation to operate on
   * @param node is the pointer to a node cell
+  * @param reinsert List of particles which need to be reinserted (OpenMP only).
   */
-static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r, struct reb_treecell *node){
+static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r, struct reb_treecell *node, struct reb_tree_reinsert* const reinsert){
 	int test = -1; /**< A temporary int variable is used to store the index of an octant when it needs to be freed. */
 	if (node == NULL) {
 		return NULL;
 	}
 	// Non-leaf nodes	
 	if (node->pt < 0) {
+		struct reb_treecell* old[8];
+		memcpy(old, node->oct, sizeof(old));
+		if (node->pt <= -REB_TREE_TASK_MIN){
+			for (int o=0; o<8; o++) {
+#pragma omp task
+				node->oct[o] = reb_tree_update_cell(r, node->oct[o], reinsert);
+			}
+#pragma omp taskwait
+		}else{
+			for (int o=0; o<8; o++) {
+				node->oct[o] = reb_tree_update_cell(r, node->oct[o], reinsert);
+			}
+		}
 		for (int o=0; o<8; o++) {
-			node->oct[o] = reb_tree_update_cell(r, node->oct[o]);
+			struct reb_treecell *d = node->oct[o];
+			if (d != old[o] || (d != NULL && d->moments < 0)){
+				node->moments = -1;
+			}
+		}
+		if (node->moments >= 0){
+			return node; // Unchanged subtree
 		}
 		node->pt = 0;
 		for (int o=0; o<8; o++) {
@@ -176,12 +273,12 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 		}
 		// Check if the node requires derefinement.
 		if (node->pt == 0) {	// The node is empty.
-			free(node);
+			reb_tree_cell_free(r, node);
 			return NULL;
 		} else if (node->pt == -1) { // The node becomes a leaf.
 			node->pt = node->oct[test]->pt;
 			r->particles[node->pt].c = node;
-			free(node->oct[test]);
+			reb_tree_cell_free(r, node->oct[test]);
 			node->oct[test]=NULL;
 			return node;
 		}
@@ -189,17 +286,32 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 	} 
 	// Leaf nodes
 	if (reb_tree_particle_is_inside_cell(r, node) == 0) {
+#ifdef OPENMP
+#pragma omp critical (reb_tree_reinsert)
+		{
+		if (reinsert->N>=reinsert->allocatedN){
+			reinsert->allocatedN = reinsert->allocatedN?reinsert->allocatedN*2:128;
+			reinsert->index = realloc(reinsert->index, sizeof(int)*reinsert->allocatedN);
+		}
+		reinsert->index[reinsert->N++] = node->pt;
+		}
+#else // OPENMP
         int oldpos = node->pt;
         struct reb_particle reinsertme = r->particles[oldpos];
         if (r->N){ // Check if there remains any particle in the simulation 
             (r->N)--;
+            reb_particle_lookup_table_unset(r, reinsertme.hash, oldpos);
             r->particles[oldpos] = r->particles[r->N];
             r->particles[oldpos].c->pt = oldpos;
+            if (oldpos!=r->N){
+                reb_particle_lookup_table_set(r, r->particles[oldpos].hash, oldpos);
+            }
             if (!isnan(reinsertme.y)){ // Do not reinsert if flagged for removal
                 reb_add(r, reinsertme);
             }
         }
-		free(node);
+#endif // OPENMP
+		reb_tree_cell_free(r, node);
 		return NULL; 
 	} else {
 		r->particles[node->pt].c = node;
@@ -207,20 +319,99 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 	}
 }
 
+#ifdef OPENMP
+static int reb_tree_compare_index_descending(const void* a, const void* b){
+	return *(const int*)b - *(const int*)a;
+}
+
+/**
+  * @brief Removes the particles which have left their cell and reinserts them.
+  * @details Particles are processed in order of decreasing index. The particle which
+  * is copied into the empty slot therefore always has a valid cell.
+  */
+static void reb_tree_reinsert_particles(struct reb_simulation* const r, struct reb_tree_reinsert* const reinsert){
+	qsort(reinsert->index, reinsert->N, sizeof(int), reb_tree_compare_index_descending);
+	for (int i=0; i<reinsert->N; i++){
+		int oldpos = reinsert->index[i];
+		struct reb_particle reinsertme = r->particles[oldpos];
+		if (r->N){ // Check if there remains any particle in the simulation 
+			(r->N)--;
+			reb_particle_lookup_table_unset(r, reinsertme.hash, oldpos);
+			if (oldpos!=r->N){
+				r->particles[oldpos] = r->particles[r->N];
+				r->particles[oldpos].c->pt = oldpos;
+				reb_particle_lookup_table_set(r, r->particles[oldpos].hash, oldpos);
+			}
+			if (!isnan(reinsertme.y)){ // Do not reinsert if flagged for removal
+				reb_add(r, reinsertme);
+			}
+		}
+	}
+	free(reinsert->index);
+}
+#endif // OPENMP
+
 /**
-  * @brief The function calculates the total mass and center of mass of a node. When QUADRUPOLE is defined, it also calculates the mass quadrupole tensor for all non-leaf nodes.
+  * @brief Sets all multipole moments of a cell above the monopole to zero.
   */
-static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* const r, struct reb_treecell *node){
-#ifdef QUADRUPOLE
+static void reb_tree_clear_moments(struct reb_treecell *node){
 	node->mxx = 0;
 	node->mxy = 0;
 	node->mxz = 0;
 	node->myy = 0;
 	node->myz = 0;
 	node->mzz = 0;
-#endif // QUADRUPOLE
+	node->mxxx = 0;
+	node->mxxy = 0;
+	node->mxxz = 0;
+	node->mxyy = 0;
+	node->mxyz = 0;
+	node->mxzz = 0;
+	node->myyy = 0;
+	node->myyz = 0;
+	node->myzz = 0;
+	node->mzzz = 0;
+}
+
+/**
+  * @brief The function calculates the total mass and center of mass of a node. Depending on tree_order, it also calculates the traceless mass quadrupole and octupole tensors for all non-leaf nodes.
+  * @details The moments of a cell are only recalculated if its structure has changed, tree_order 
+  * has changed, or the moments of one of its daughters have changed. A leaf has changed if the 
+  * mass or position of its particle differs from the values stored in the leaf. 
+  * With OpenMP, the octants of large cells are processed in separate tasks.
+  * @return 1 if the moments of the cell have changed, 0 otherwise.
+  */
+static int reb_tree_update_gravity_data_in_cell(const struct reb_simulation* const r, struct reb_treecell *node){
+	const int order = r->tree_order;
 	if (node->pt < 0) {
 		// Non-leaf nodes	
+		int changed[8] = {0};
+		if (node->pt <= -REB_TREE_TASK_MIN){
+			for (int o=0; o<8; o++) {
+				struct reb_treecell* d = node->oct[o];
+				if (d!=NULL){
+#pragma omp task shared(changed)
+					changed[o] = reb_tree_update_gravity_data_in_cell(r, d);
+				}
+			}
+#pragma omp taskwait
+		}else{
+			for (int o=0; o<8; o++) {
+				struct reb_treecell* d = node->oct[o];
+				if (d!=NULL){
+					changed[o] = reb_tree_update_gravity_data_in_cell(r, d);
+				}
+			}
+		}
+		int any_changed = node->moments != order;
+		for (int o=0; o<8; o++) {
+			any_changed |= changed[o];
+		}
+		if (!any_changed){
+			return 0;
+		}
+		node->moments = order;
+		reb_tree_clear_moments(node);
 		node->m  = 0;
 		node->mx = 0;
 		node->my = 0;
@@ -228,7 +419,6 @@ static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* co
 		for (int o=0; o<8; o++) {
 			struct reb_treecell* d = node->oct[o];
 			if (d!=NULL){
-				reb_tree_update_gravity_data_in_cell(r, d);
 				// Calculate the total mass and the center of mass
 				double d_m = d->m;
 				node->mx += d->mx*d_m;
@@ -243,81 +433,404 @@ static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* co
 			node->my /= m_tot;
 			node->mz /= m_tot;
 		}
-#ifdef QUADRUPOLE
-		for (int o=0; o<8; o++) {
-			struct reb_treecell* d = node->oct[o];
-			if (d!=NULL){
-				// Ref: Hernquist, L., 1987, APJS
-				double d_m = d->m;
-				double qx  = d->mx - node->mx;
-				double qy  = d->my - node->my;
-				double qz  = d->mz - node->mz;
-				double qr2 = qx*qx + qy*qy + qz*qz;
-				node->mxx += d->mxx + d_m*(3.*qx*qx - qr2);
-				node->mxy += d->mxy + d_m*3.*qx*qy;
-				node->mxz += d->mxz + d_m*3.*qx*qz;
-				node->myy += d->myy + d_m*(3.*qy*qy - qr2);
-				node->myz += d->myz + d_m*3.*qy*qz;
+		if (r->tree_order>=1){
+			for (int o=0; o<8; o++) {
+				struct reb_treecell* d = node->oct[o];
+				if (d!=NULL){
+					// Ref: Hernquist, L., 1987, APJS
+					double d_m = d->m;
+					double qx  = d->mx - node->mx;
+					double qy  = d->my - node->my;
+					double qz  = d->mz - node->mz;
+					double qr2 = qx*qx + qy*qy + qz*qz;
+					node->mxx += d->mxx + d_m*(3.*qx*qx - qr2);
+					node->mxy += d->mxy + d_m*3.*qx*qy;
+					node->mxz += d->mxz + d_m*3.*qx*qz;
+					node->myy += d->myy + d_m*(3.*qy*qy - qr2);
+					node->myz += d->myz + d_m*3.*qy*qz;
+				}
+			}
+			node->mzz = -node->mxx -node->myy;
+		}
+		if (r->tree_order>=2){
+			// The octupole tensor of a daughter cell shifted by q is O + D(m q q q + sym(Q q)/3), where 
+			// D(T) = 15 T_ijk - 3(d_ij t_k + d_ik t_j + d_jk t_i) with t_i = T_ijj removes the trace. 
+			double txxx = 0, txxy = 0, txxz = 0, txyy = 0, txyz = 0;
+			double txzz = 0, tyyy = 0, tyyz = 0, tyzz = 0, tzzz = 0;
+			for (int o=0; o<8; o++) {
+				struct reb_treecell* d = node->oct[o];
+				if (d!=NULL){
+					double d_m = d->m;
+					double qx  = d->mx - node->mx;
+					double qy  = d->my - node->my;
+					double qz  = d->mz - node->mz;
+					txxx += d_m*qx*qx*qx + d->mxx*qx;
+					txxy += d_m*qx*qx*qy + (d->mxx*qy + 2.*d->mxy*qx)/3.;
+					txxz += d_m*qx*qx*qz + (d->mxx*qz + 2.*d->mxz*qx)/3.;
+					txyy += d_m*qx*qy*qy + (d->myy*qx + 2.*d->mxy*qy)/3.;
+					txyz += d_m*qx*qy*qz + (d->mxy*qz + d->mxz*qy + d->myz*qx)/3.;
+					txzz += d_m*qx*qz*qz + (d->mzz*qx + 2.*d->mxz*qz)/3.;
+					tyyy += d_m*qy*qy*qy + d->myy*qy;
+					tyyz += d_m*qy*qy*qz + (d->myy*qz + 2.*d->myz*qy)/3.;
+					tyzz += d_m*qy*qz*qz + (d->mzz*qy + 2.*d->myz*qz)/3.;
+					tzzz += d_m*qz*qz*qz + d->mzz*qz;
+					node->mxxx += d->mxxx;
+					node->mxxy += d->mxxy;
+					node->mxxz += d->mxxz;
+					node->mxyy += d->mxyy;
+					node->mxyz += d->mxyz;
+					node->mxzz += d->mxzz;
+					node->myyy += d->myyy;
+					node->myyz += d->myyz;
+					node->myzz += d->myzz;
+					node->mzzz += d->mzzz;
+				}
 			}
+			const double tx = txxx + txyy + txzz;
+			const double ty = txxy + tyyy + tyzz;
+			const double tz = txxz + tyyz + tzzz;
+			node->mxxx += 15.*txxx - 9.*tx;
+			node->mxxy += 15.*txxy - 3.*ty;
+			node->mxxz += 15.*txxz - 3.*tz;
+			node->mxyy += 15.*txyy - 3.*tx;
+			node->mxyz += 15.*txyz;
+			node->mxzz += 15.*txzz - 3.*tx;
+			node->myyy += 15.*tyyy - 9.*ty;
+			node->myyz += 15.*tyyz - 3.*tz;
+			node->myzz += 15.*tyzz - 3.*ty;
+			node->mzzz += 15.*tzzz - 9.*tz;
 		}
-		node->mzz = -node->mxx -node->myy;
-#endif // QUADRUPOLE
+		return 1;
 	}else{ 
 		// Leaf nodes
 		struct reb_particle p = r->particles[node->pt];
+		if (node->moments>=0 && node->m==p.m && node->mx==p.x && node->my==p.y && node->mz==p.z){
+			return 0;
+		}
+		if (node->moments<0){
+			reb_tree_clear_moments(node);
+			node->moments = 0;
+		}
 		node->m = p.m;
 		node->mx = p.x;
 		node->my = p.y;
 		node->mz = p.z;
+		return 1;
 	}
 }
 
 void reb_tree_update_gravity_data(struct reb_simulation* const r){
+	PROFILING_START(r)
+#pragma omp parallel
+#pragma omp single
 	for(int i=0;i<r->root_n;i++){
 #ifdef MPI
 		if (reb_communication_mpi_rootbox_is_local(r, i)==1){
 #endif // MPI
 			if (r->tree_root[i]!=NULL){
+#pragma omp task
 				reb_tree_update_gravity_data_in_cell(r, r->tree_root[i]);
 			}
 #ifdef MPI
 		}
 #endif // MPI
 	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_TREE_MOMENTS)
+}
+
+#ifndef MPI
+/**
+  * @brief Number of tree levels encoded in the sort key of a particle.
+  */
+#define REB_TREE_SORT_LEVELS 21
+
+/**
+  * @brief Entry of the array which is sorted if tree_sort is set.
+  */
+struct reb_tree_sort_item {
+	uint64_t key;	/**< Octants of the particle on each level of the tree. The octant in the root cell is stored in the most significant bits. */
+	int rootbox;	/**< Index of the root box. */
+	int index;	/**< Index of the particle before sorting. */
+};
+
+/**
+  * @brief Calculates the sort key of a particle.
+  * @details The cell centres are calculated in the same way as in reb_tree_new_cell(), so
+  * the octants in the key are exactly the octants reb_tree_add_particle_to_cell() would choose.
+  * Sorting particles by rootbox and key orders them along a Morton (Z-order) curve.
+  */
+static uint64_t reb_tree_sort_key(const struct reb_simulation* const r, const struct reb_particle p){
+	double w = r->root_size;
+	double x = -r->boxsize.x/2.+r->root_size*(0.5+(double)(((int)floor((p.x + r->boxsize.x/2.)/r->root_size))%r->root_nx));
+	double y = -r->boxsize.y/2.+r->root_size*(0.5+(double)(((int)floor((p.y + r->boxsize.y/2.)/r->root_size))%r->root_ny));
+	double z = -r->boxsize.z/2.+r->root_size*(0.5+(double)(((int)floor((p.z + r->boxsize.z/2.)/r->root_size))%r->root_nz));
+	uint64_t key = 0;
+	for (int l=0; l<REB_TREE_SORT_LEVELS; l++){
+		int o = 0;
+		if (p.x < x) o+=1;
+		if (p.y < y) o+=2;
+		if (p.z < z) o+=4;
+		key = (key<<3) | o;
+		w = w/2.;
+		x = x + w/2.*((o>>0)%2==0?1.:-1);
+		y = y + w/2.*((o>>1)%2==0?1.:-1);
+		z = z + w/2.*((o>>2)%2==0?1.:-1);
+	}
+	return key;
+}
+
+/**
+  * @brief Sorts items by rootbox and key using a least significant digit radix sort.
+  * @details Passes in which all items have the same digit are skipped. This makes sorting
+  * an already sorted array with few root boxes fast.
+  * @param items Array to be sorted.
+  * @param tmp Temporary array of the same size.
+  * @param N Number of items.
+  * @param root_n Number of root boxes.
+  */
+static void reb_tree_sort_items(struct reb_tree_sort_item* items, struct reb_tree_sort_item* tmp, const int N, const int root_n){
+	if (N<2){
+		return;
+	}
+	struct reb_tree_sort_item* src = items;
+	struct reb_tree_sort_item* dst = tmp;
+	for (int shift=0; shift<3*REB_TREE_SORT_LEVELS; shift+=8){
+		int count[257] = {0};
+		for (int i=0; i<N; i++){
+			count[((src[i].key>>shift)&0xff)+1]++;
+		}
+		if (count[((src[0].key>>shift)&0xff)+1]==N) continue;
+		for (int d=0; d<256; d++){
+			count[d+1] += count[d];
+		}
+		for (int i=0; i<N; i++){
+			dst[count[(src[i].key>>shift)&0xff]++] = src[i];
+		}
+		struct reb_tree_sort_item* t = src; src = dst; dst = t;
+	}
+	if (root_n>1){
+		int* count = calloc(root_n+1, sizeof(int));
+		for (int i=0; i<N; i++){
+			count[src[i].rootbox+1]++;
+		}
+		for (int d=0; d<root_n; d++){
+			count[d+1] += count[d];
+		}
+		for (int i=0; i<N; i++){
+			dst[count[src[i].rootbox]++] = src[i];
+		}
+		free(count);
+		struct reb_tree_sort_item* t = src; src = dst; dst = t;
+	}
+	if (src!=items){
+		memcpy(items, src, sizeof(struct reb_tree_sort_item)*N);
+	}
+}
+
+/**
+  * @brief Builds the cell containing the sorted particles in the index ranges [lo[s],hi[s]) for s=0,1.
+  * @details Active particles and test particles are sorted separately, so the particles 
+  * in a cell form up to two contiguous ranges. If particles cannot be separated with 
+  * the sort key, the remaining particles are inserted with reb_tree_add_particle_to_cell().
+  * @param r REBOUND simulation to operate on
+  * @param parent is the pointer to the parent cell. NULL for root cells.
+  * @param o is the index of the octant of the parent cell.
+  * @param items Sorted items
+  * @param lo First index of each range.
+  * @param hi Index one past the last particle of each range.
+  * @param level Level of the new cell (0 for root cells).
+  */
+static struct reb_treecell* reb_tree_build_cell(struct reb_simulation* const r, struct reb_treecell* parent, int o, const struct reb_tree_sort_item* const items, const int lo[2], const int hi[2], const int level){
+	const int first = lo[0]<hi[0]?lo[0]:lo[1];
+	struct reb_treecell* node = reb_tree_new_cell(r, parent, o, r->particles[first]);
+	node->pt = first;
+	r->particles[first].c = node;
+	const int n = hi[0]-lo[0] + hi[1]-lo[1];
+	if (n==1){
+		return node;
+	}
+	if (level==REB_TREE_SORT_LEVELS){
+		for (int s=0; s<2; s++){
+			for (int i=lo[s]; i<hi[s]; i++){
+				if (i==first) continue;
+				reb_tree_add_particle_to_cell(r, node, i, parent, o);
+			}
+		}
+		return node;
+	}
+	node->pt = -n;
+	const int shift = 3*(REB_TREE_SORT_LEVELS-1-level);
+	int start[2] = {lo[0], lo[1]};
+	for (int oc=0; oc<8; oc++){
+		int end[2];
+		for (int s=0; s<2; s++){
+			end[s] = start[s];
+			while (end[s]<hi[s] && (int)((items[end[s]].key>>shift)&7)==oc){
+				end[s]++;
+			}
+		}
+		if (end[0]>start[0] || end[1]>start[1]){
+			node->oct[oc] = reb_tree_build_cell(r, node, oc, items, start, end, level+1);
+		}
+		start[0] = end[0];
+		start[1] = end[1];
+	}
+	return node;
+}
+
+/**
+  * @brief Sorts the particles along the tree and rebuilds the tree from scratch.
+  * @details Particles flagged for removal are removed first. Active particles and test 
+  * particles are sorted separately so that the active particles stay at the beginning 
+  * of the particle array. Cells are allocated in depth-first order from the beginning 
+  * of the cell pool, so neighbouring cells are also close in memory.
+  * @param r REBOUND simulation to operate on
+  */
+static void reb_tree_sort_and_build(struct reb_simulation* const r){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	if (r->tree_sort_allocatedN<N){
+		r->tree_sort_allocatedN = N;
+		r->tree_sort_buffer = realloc(r->tree_sort_buffer, (sizeof(struct reb_particle)+2*sizeof(struct reb_tree_sort_item))*N);
+	}
+	struct reb_particle* const buffer = r->tree_sort_buffer;
+	struct reb_tree_sort_item* const items = (struct reb_tree_sort_item*)(buffer+N);
+	struct reb_tree_sort_item* const tmp = items+N;
+	
+	// Calculate keys
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<N; i++){
+		const struct reb_particle p = particles[i];
+		if (isnan(p.y) || fabs(p.x)>r->boxsize.x/2. || fabs(p.y)>r->boxsize.y/2. || fabs(p.z)>r->boxsize.z/2.){
+			items[i].index = -1;
+			continue;
+		}
+		items[i].key = reb_tree_sort_key(r, p);
+		items[i].rootbox = reb_get_rootbox_for_particle(r, p);
+		items[i].index = i;
+	}
+
+	// Remove particles
+	const int N_active = r->N_active==-1?N:r->N_active;
+	int N_new = 0;
+	int N_active_new = 0;
+	for (int i=0; i<N; i++){
+		if (items[i].index==-1){
+			if (!isnan(particles[i].y)){ // Not flagged for removal
+				reb_error(r,"A particle left the simulation box and has been removed.");
+			}
+			continue;
+		}
+		items[N_new] = items[i];
+		N_new++;
+		if (i<N_active){
+			N_active_new++;
+		}
+	}
+	reb_tree_sort_items(items, tmp, N_active_new, r->root_n);
+	reb_tree_sort_items(items+N_active_new, tmp, N_new-N_active_new, r->root_n);
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<N_new; i++){
+		buffer[i] = particles[items[i].index];
+	}
+	memcpy(particles, buffer, sizeof(struct reb_particle)*N_new);
+	r->N = N_new;
+	if (r->N_active!=-1){
+		r->N_active = N_active_new;
+	}
+
+	// Build tree. All cells are reused, so kept interaction lists become invalid.
+	reb_tree_lists_free(r);
+	r->tree_pool_block = 0;
+	r->tree_pool_N_used = 0;
+	r->tree_pool_free = NULL;
+	for (int i=0; i<r->root_n; i++){
+		r->tree_root[i] = NULL;
+	}
+	int start[2] = {0, N_active_new};
+	const int hi[2] = {N_active_new, N_new};
+	while (start[0]<hi[0] || start[1]<hi[1]){
+		int rootbox = r->root_n;
+		for (int s=0; s<2; s++){
+			if (start[s]<hi[s] && items[start[s]].rootbox<rootbox){
+				rootbox = items[start[s]].rootbox;
+			}
+		}
+		int end[2];
+		for (int s=0; s<2; s++){
+			end[s] = start[s];
+			while (end[s]<hi[s] && items[end[s]].rootbox==rootbox){
+				end[s]++;
+			}
+		}
+		r->tree_root[rootbox] = reb_tree_build_cell(r, NULL, 0, items, start, end, 0);
+		start[0] = end[0];
+		start[1] = end[1];
+	}
 }
 
+#endif // MPI
+
 void reb_tree_update(struct reb_simulation* const r){
+	PROFILING_START(r)
 	if (r->tree_root==NULL){
 		r->tree_root = calloc(r->root_nx*r->root_ny*r->root_nz,sizeof(struct reb_treecell*));
 	}
+	if (r->tree_sort){
+#ifdef MPI
+		reb_warning(r, "tree_sort is not supported with MPI. Particles will not be sorted.");
+		r->tree_sort = 0;
+#else // MPI
+		if ((r->integrator!=REB_INTEGRATOR_LEAPFROG && r->integrator!=REB_INTEGRATOR_SEI && r->integrator!=REB_INTEGRATOR_NONE) || r->N_var){
+			reb_warning(r, "tree_sort requires the LEAPFROG, SEI or NONE integrator and no variational particles. Particles will not be sorted.");
+			r->tree_sort = 0;
+		}else{
+			reb_tree_sort_and_build(r);
+			r->tree_needs_update= 0;
+			PROFILING_STOP(r, REB_PROFILING_CAT_TREE_BUILD)
+			return;
+		}
+#endif // MPI
+	}
+	struct reb_tree_reinsert reinsert = {0};
+#pragma omp parallel
+#pragma omp single
 	for(int i=0;i<r->root_n;i++){
 
 #ifdef MPI
 		if (reb_communication_mpi_rootbox_is_local(r, i)==1){
 #endif // MPI
-			r->tree_root[i] = reb_tree_update_cell(r, r->tree_root[i]);
+#pragma omp task
+			r->tree_root[i] = reb_tree_update_cell(r, r->tree_root[i], &reinsert);
 #ifdef MPI
 		}
 #endif // MPI
 	}
+#ifdef OPENMP
+	reb_tree_reinsert_particles(r, &reinsert);
+#endif // OPENMP
     r->tree_needs_update= 0;
+	PROFILING_STOP(r, REB_PROFILING_CAT_TREE_BUILD)
 }
-static void reb_tree_delete_cell(struct reb_treecell* node){
-	if (node==NULL){
-		return;
-	}
-	for (int o=0; o<8; o++) {
-		reb_tree_delete_cell(node->oct[o]);
-	}
-}
-
 void reb_tree_delete(struct reb_simulation* const r){
-	if (r->tree_root!=NULL){
-		for(int i=0;i<r->root_n;i++){
-			reb_tree_delete_cell(r->tree_root[i]);
-		}
-		free(r->tree_root);
+#ifndef MPI
+	reb_tree_lists_free(r);
+#endif // MPI
+	// All cells live in the pool, so there is no need to walk the tree.
+	for (int b=0; b<r->tree_pool_N_blocks; b++){
+		free(r->tree_pool_blocks[b]);
 	}
+	free(r->tree_pool_blocks);
+	r->tree_pool_blocks = NULL;
+	r->tree_pool_N_blocks = 0;
+	r->tree_pool_block = 0;
+	r->tree_pool_N_used = 0;
+	r->tree_pool_free = NULL;
+	free(r->tree_root);
+	r->tree_root = NULL;
+	free(r->tree_sort_buffer);
+	r->tree_sort_buffer = NULL;
+	r->tree_sort_allocatedN = 0;
 }
 
 
@@ -377,6 +890,21 @@ void reb_tree_add_essential_node(struct reb_simulation* const r, struct reb_tree
 		reb_tree_add_essential_node_to_node(node, r->tree_root[index]);
 	}
 }
+static void reb_tree_delete_cell(struct reb_simulation* const r, struct reb_treecell* node){
+	for (int o=0;o<8;o++){
+		if (node->oct[o]!=NULL){
+			reb_tree_delete_cell(r, node->oct[o]);
+		}
+	}
+	reb_tree_cell_free(r, node);
+}
+
+void reb_tree_delete_root(struct reb_simulation* const r, int root){
+	if (r->tree_root==NULL || r->tree_root[root]==NULL) return;
+	reb_tree_delete_cell(r, r->tree_root[root]);
+	r->tree_root[root] = NULL;
+}
+
 void reb_tree_prepare_essential_tree_for_gravity(struct reb_simulation* const r){
 	for(int i=0;i<r->root_n;i++){
 		if (reb_communication_mpi_rootbox_is_local(r, i)==1){
@@ -25,9 +25,12 @@
 
 #ifndef _TREE_H
 #define _TREE_H
+#include <stdint.h>
 
 struct reb_treecell; 
 
+#define REB_TREE_POOL_BLOCK 1024    ///< Number of cells in the first block of the tree cell pool. Each further block is twice as large.
+
 /**
  * @brief The data structure of one node of a tree 
  */
@@ -40,18 +43,30 @@ struct reb_treecell {
 	double mx; /**< The x position of the center of mass of a cell */
 	double my; /**< The y position of the center of mass of a cell */
 	double mz; /**< The z position of the center of mass of a cell */
-#ifdef QUADRUPOLE
-	double mxx; /**< The xx component of the quadrupole tensor of mass of a cell */
+	double mxx; /**< The xx component of the quadrupole tensor of mass of a cell (tree_order>=1) */
 	double mxy; /**< The xy component of the quadrupole tensor of mass of a cell */
 	double mxz; /**< The xz component of the quadrupole tensor of mass of a cell */
 	double myy; /**< The yy component of the quadrupole tensor of mass of a cell */
 	double myz; /**< The yz component of the quadrupole tensor of mass of a cell */
 	double mzz; /**< The zz component of the quadrupole tensor of mass of a cell */
-#endif // QUADRUPOLE
+	double mxxx; /**< The xxx component of the octupole tensor of mass of a cell (tree_order>=2) */
+	double mxxy; /**< The xxy component of the octupole tensor of mass of a cell */
+	double mxxz; /**< The xxz component of the octupole tensor of mass of a cell */
+	double mxyy; /**< The xyy component of the octupole tensor of mass of a cell */
+	double mxyz; /**< The xyz component of the octupole tensor of mass of a cell */
+	double mxzz; /**< The xzz component of the octupole tensor of mass of a cell */
+	double myyy; /**< The yyy component of the octupole tensor of mass of a cell */
+	double myyz; /**< The yyz component of the octupole tensor of mass of a cell */
+	double myzz; /**< The yzz component of the octupole tensor of mass of a cell */
+	double mzzz; /**< The zzz component of the octupole tensor of mass of a cell */
 	struct reb_treecell *oct[8]; /**< The pointer array to the octants of a cell */
 	int pt;		/**< It has double usages: in a leaf node, it stores the index 
 			  * of a particle; in a non-leaf node, it equals to (-1)*Total 
 			  * Number of particles within that cell. */ 
+	int moments;	/**< Value of tree_order for which the mass moments were last calculated, 
+			  * -1 if the structure of the cell has changed since then. */
+	uint64_t id;	/**< Unique number assigned when the cell is allocated (see tree_cell_id). */
+	int list;	/**< Index+1 of the kept interaction list if the cell is a group, 0 otherwise (see tree_list_interval). */
 };
 
 /**
@@ -75,7 +90,7 @@ void reb_tree_update_gravity_data(struct reb_simulation* const r);
 void reb_tree_add_particle_to_tree(struct reb_simulation* const r, int pt);
 
 /**
- * @brief Free up all space occupied by the tree structure.
+ * @brief Free up all space occupied by the tree structure, including the cell pool.
  * This will not modify particles.
   * @param r Rebound simulation to operate on
  */
@@ -95,6 +110,11 @@ void reb_tree_prepare_essential_tree_for_gravity(struct reb_simulation* const r)
   * @brief MPI related function used to calculate gravity from nearby nodes
   */
 void reb_tree_prepare_essential_tree_for_collisions(struct reb_simulation* const r);
+/**
+  * @brief Returns all cells of a local root box to the cell pool. Used when the root box moves to another node.
+  * @param root Index of the root box.
+  */
+void reb_tree_delete_root(struct reb_simulation* const r, int root);
 #endif // MPI
 
 #endif // _TREE_H